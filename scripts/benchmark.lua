@@ -0,0 +1,128 @@
+-- Microbenchmarks for the overlay's core primitives. Run with the overlay's
+-- script mode:
+--
+--     eg-overlay.exe --lua-script scripts/benchmark.lua
+--
+-- Each benchmark reports iterations, total time, and per-op cost so changes
+-- to the native modules can be compared before/after.
+
+local overlay = require 'eg-overlay'
+local logger = require 'logger'
+local sqlite = require 'sqlite'
+local json = require 'jansson'
+
+local log = logger.logger:new('benchmark')
+
+local function bench(name, iters, fn)
+    collectgarbage('collect')
+
+    local start = overlay.time()
+    fn(iters)
+    local dur = overlay.time() - start
+
+    log:info('%-28s %10d iters %10.4f s %12.1f ns/op', name, iters, dur, dur / iters * 1e9)
+end
+
+-- uuid generation (rpcrt4 + base64 round trip)
+bench('uuid', 50000, function(n)
+    for i = 1, n do
+        local u = overlay.uuid()
+        overlay.uuidtobase64(u)
+    end
+end)
+
+-- json parse of a typical API-ish payload
+local payload = '[' .. string.rep('{"id":123,"name":"thing","tiers":[{"count":1,"points":5}]},', 199)
+    .. '{"id":123,"name":"thing","tiers":[{"count":1,"points":5}]}]'
+
+bench('json loads (200 objects)', 2000, function(n)
+    for i = 1, n do
+        json.loads(payload)
+    end
+end)
+
+bench('json parse (200 objects)', 2000, function(n)
+    for i = 1, n do
+        json.parse(payload)
+    end
+end)
+
+-- sqlite: per-row binds vs native json ingestion
+local db = sqlite.open(':memory:')
+db:execute('CREATE TABLE bench (id INTEGER, name TEXT, points REAL)')
+
+bench('sqlite insert (bind/step)', 20000, function(n)
+    local ins = db:prepare('INSERT INTO bench (id, name, points) VALUES (:id, :name, :points)')
+    db:execute('BEGIN')
+    for i = 1, n do
+        ins:reset()
+        ins:bind(':id', i)
+        ins:bind(':name', 'row')
+        ins:bind(':points', i * 0.5)
+        ins:step()
+    end
+    ins:finalize()
+    db:execute('COMMIT')
+end)
+
+local rows = {}
+for i = 1, 200 do
+    rows[i] = string.format('{"id":%d,"name":"row","points":%f}', i, i * 0.5)
+end
+local rowsjson = '[' .. table.concat(rows, ',') .. ']'
+
+bench('sqlite insert (runjson x200)', 100, function(n)
+    local ins = db:prepare('INSERT INTO bench (id, name, points) VALUES (:id, :name, :points)')
+    db:execute('BEGIN')
+    for i = 1, n do
+        ins:runjson(rowsjson)
+    end
+    ins:finalize()
+    db:execute('COMMIT')
+end)
+
+bench('sqlite select', 200, function(n)
+    local sel = db:prepare('SELECT id, name, points FROM bench WHERE id < 1000')
+    for i = 1, n do
+        sel:reset()
+        repeat
+            local row = sel:step()
+        until row == nil
+    end
+    sel:finalize()
+end)
+
+log:info('benchmarks complete')
+
+-- msgpack vs jansson round trip on a worker-message-shaped table
+local msgpack = require 'msgpack'
+
+local msg = { kind = 'positions', seq = 12345, points = {} }
+for i = 1, 200 do
+    msg.points[i] = { id = i, x = i * 1.5, y = i * 2.5, z = i * 3.5 }
+end
+
+bench('msgpack pack+unpack', 2000, function(n)
+    for i = 1, n do
+        msgpack.unpack(msgpack.pack(msg))
+    end
+end)
+
+-- the same payload as a JSON document, for an apples-to-apples text
+-- round trip
+local jsonparts = { '{"kind":"positions","seq":12345,"points":[' }
+for i = 1, 200 do
+    jsonparts[#jsonparts+1] = string.format(
+        '{"id":%d,"x":%.1f,"y":%.1f,"z":%.1f}%s',
+        i, i * 1.5, i * 2.5, i * 3.5, i < 200 and ',' or ''
+    )
+end
+jsonparts[#jsonparts+1] = ']}'
+local jsonmsgstr = table.concat(jsonparts)
+
+bench('json loads+dumps', 2000, function(n)
+    for i = 1, n do
+        local ok, v = json.loads(jsonmsgstr)
+        if ok then json.dumps(v) end
+    end
+end)
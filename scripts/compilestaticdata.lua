@@ -0,0 +1,160 @@
+-- Compile the static game data in data/gw2/static.db into
+-- data/gw2/gw2-static.dat, the columnar snapshot mapped by the gw2-static
+-- module. Run this after updatestaticdb.lua when generating a release.
+--
+-- Layout (little endian, must match src/gw2-static.c):
+--   'EGSD', u32 version,
+--   u32 map count, u32 poi count, u32 sector count, u32 string blob size,
+--   u64 maps/pois/sectors/strings section offsets,
+--   then each section as contiguous column arrays and finally the string
+--   blob. Strings are deduplicated, NUL terminated, and referenced by byte
+--   offset; offset 0 is reserved for NULL (the blob starts with a NUL).
+
+local static = require 'gw2.static'
+local overlay = require 'eg-overlay'
+local logger = require 'logger'
+
+local log = logger.logger:new('compilestaticdata')
+
+local VERSION = 1
+
+-- string table; offset 0 = NULL
+local strings = { '\0' }
+local stringoffsets = {}
+local stringsize = 1
+
+local function stringoffset(str)
+    if str==nil then return 0 end
+
+    local off = stringoffsets[str]
+    if off then return off end
+
+    off = stringsize
+    stringoffsets[str] = off
+    table.insert(strings, str)
+    table.insert(strings, '\0')
+    stringsize = stringsize + #str + 1
+
+    return off
+end
+
+local function queryall(sql)
+    local rows = {}
+    local s = static.db:prepare(sql)
+    for row in function() return s:step() end do
+        table.insert(rows, row)
+    end
+    s:finalize()
+
+    return rows
+end
+
+local function packcolumn(rows, fmt, field, default)
+    local parts = {}
+    for _,row in ipairs(rows) do
+        local v = row[field]
+        if v==nil then v = default end
+        table.insert(parts, string.pack(fmt, v))
+    end
+
+    return table.concat(parts)
+end
+
+local function packstringcolumn(rows, field)
+    local parts = {}
+    for _,row in ipairs(rows) do
+        table.insert(parts, string.pack('<I4', stringoffset(row[field])))
+    end
+
+    return table.concat(parts)
+end
+
+log:info('Compiling static data snapshot...')
+
+local maps = queryall([[
+    SELECT id, name, min_level, max_level, default_floor, region, label_x, label_y,
+           map_rect_left, map_rect_right, map_rect_top, map_rect_bottom,
+           continent_rect_left, continent_rect_right, continent_rect_top, continent_rect_bottom
+    FROM maps ORDER BY id
+]])
+
+local pois = queryall([[
+    SELECT id, map, name, type, floor, x, y, chat_link, icon
+    FROM pois ORDER BY map, id
+]])
+
+local sectors = queryall([[
+    SELECT id, map, name, level, x, y
+    FROM sectors ORDER BY map, id
+]])
+
+if #maps==0 then
+    log:error('No maps in static.db; run updatestaticdb.lua first.')
+    return
+end
+
+local mapscols = table.concat({
+    packcolumn(maps, '<i4', 'id', 0),
+    packcolumn(maps, '<i4', 'min_level', 0),
+    packcolumn(maps, '<i4', 'max_level', 0),
+    packcolumn(maps, '<i4', 'default_floor', 0),
+    packcolumn(maps, '<i4', 'region', 0),
+    packstringcolumn(maps, 'name'),
+    packcolumn(maps, '<d', 'label_x', 0),
+    packcolumn(maps, '<d', 'label_y', 0),
+    packcolumn(maps, '<d', 'map_rect_left', 0),
+    packcolumn(maps, '<d', 'map_rect_right', 0),
+    packcolumn(maps, '<d', 'map_rect_top', 0),
+    packcolumn(maps, '<d', 'map_rect_bottom', 0),
+    packcolumn(maps, '<d', 'continent_rect_left', 0),
+    packcolumn(maps, '<d', 'continent_rect_right', 0),
+    packcolumn(maps, '<d', 'continent_rect_top', 0),
+    packcolumn(maps, '<d', 'continent_rect_bottom', 0)
+})
+
+local poiscols = table.concat({
+    packcolumn(pois, '<i4', 'id', 0),
+    packcolumn(pois, '<i4', 'map', 0),
+    packcolumn(pois, '<i4', 'floor', 0),
+    packstringcolumn(pois, 'type'),
+    packstringcolumn(pois, 'name'),
+    packstringcolumn(pois, 'chat_link'),
+    packstringcolumn(pois, 'icon'),
+    packcolumn(pois, '<d', 'x', 0),
+    packcolumn(pois, '<d', 'y', 0)
+})
+
+local sectorscols = table.concat({
+    packcolumn(sectors, '<i4', 'id', 0),
+    packcolumn(sectors, '<i4', 'map', 0),
+    packcolumn(sectors, '<i4', 'level', 0),
+    packstringcolumn(sectors, 'name'),
+    packcolumn(sectors, '<d', 'x', 0),
+    packcolumn(sectors, '<d', 'y', 0)
+})
+
+local blob = table.concat(strings)
+
+local headersize = 4 + 4 + 4 * 4 + 8 * 4
+local mapsoffset = headersize
+local poisoffset = mapsoffset + #mapscols
+local sectorsoffset = poisoffset + #poiscols
+local stringsoffset = sectorsoffset + #sectorscols
+
+local header = 'EGSD' .. string.pack(
+    '<I4I4I4I4I4I8I8I8I8',
+    VERSION, #maps, #pois, #sectors, #blob,
+    mapsoffset, poisoffset, sectorsoffset, stringsoffset
+)
+
+local path = overlay.datafolder('gw2') .. 'gw2-static.dat'
+local f = io.open(path, 'wb')
+if not f then
+    log:error("Couldn't open %s for writing.", path)
+    return
+end
+
+f:write(header, mapscols, poiscols, sectorscols, blob)
+f:close()
+
+log:info('Wrote %s: %d maps, %d POIs, %d sectors, %d string bytes.', path, #maps, #pois, #sectors, #blob)
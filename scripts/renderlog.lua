@@ -0,0 +1,64 @@
+-- Render a binary log (--binary-log, eg-overlay.blog) to text on stdout.
+-- Text formatting happens here, on demand, instead of per record at runtime.
+--
+-- Run with: eg-overlay --lua-script scripts/renderlog.lua
+-- Reads eg-overlay.blog from the working directory.
+
+local LEVELS = {
+    [0] = 'NONE',
+    [1] = 'ERROR',
+    [2] = 'WARNING',
+    [3] = 'INFO',
+    [4] = 'DEBUG',
+}
+
+local path = 'eg-overlay.blog'
+
+local f = io.open(path, 'rb')
+if not f then
+    print(string.format("Couldn't open %s", path))
+    return
+end
+
+if f:read(4)~='EGBL' then
+    print(string.format('%s is not a binary log.', path))
+    f:close()
+    return
+end
+
+local names = {}
+
+while true do
+    local typebyte = f:read(1)
+    if not typebyte then break end
+
+    local rtype = string.byte(typebyte)
+
+    if rtype==1 then
+        local hdr = f:read(3)
+        if not hdr or #hdr < 3 then break end -- torn tail
+
+        local id, len = string.unpack('<I2I1', hdr)
+        names[id] = f:read(len)
+    elseif rtype==2 then
+        local hdr = f:read(17)
+        if not hdr or #hdr < 17 then break end -- torn tail
+
+        local id, level, time, ms, len = string.unpack('<I2I1i8I2I4', hdr)
+        local msg = f:read(len) or ''
+
+        print(string.format(
+            '%s.%03d | %-20s | %-7s | %s',
+            os.date('%Y-%m-%d %H:%M:%S', time),
+            ms,
+            names[id] or '?',
+            LEVELS[level] or tostring(level),
+            msg
+        ))
+    else
+        print(string.format('Corrupt record type %d; stopping.', rtype))
+        break
+    end
+end
+
+f:close()
@@ -1,6 +1,14 @@
 #include <windows.h>
 #include <windowsx.h>
 #include <glad/gl.h>
+#include "gl.h"
+#include "gl-commands.h"
+#include "gw2-static.h"
+#include "schedule.h"
+#include "text-index.h"
+#include "ui/font.h"
+#include "lua-msgpack.h"
+#include "state-journal.h"
 #include <glfw/glfw3.h>
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <glfw/glfw3native.h>
@@ -10,6 +18,7 @@
 
 #include "app.h"
 #include "logging/logger.h"
+#include "logging/binary-sink.h"
 #include "logging/console-sink.h"
 #include "logging/file-sink.h"
 #include "logging/event-sink.h"
@@ -31,6 +40,8 @@
 #include "web-request.h"
 #include "mumble-link.h"
 #include "zip.h"
+#include "lua-worker.h"
+#include "profiler.h"
 #include "utils.h"
 
 #include "xml.h"
@@ -64,10 +75,16 @@ typedef struct {
     const char *target_win_class;
 
     const char *runscript;
+
+    // benchmark capture/replay of MumbleLink snapshots
+    const char *capture_path;
+    const char *replay_path;
 } app_t;
 
 static app_t *app = NULL;
 
+static void app_degradation_update();
+
 static void app_run_script();
 
 static LRESULT CALLBACK winproc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
@@ -126,6 +143,54 @@ static void register_win_class() {
     RegisterClassEx(&wc);
 }
 
+// Input events are recorded into SPSC rings by the hook thread (the hooks
+// must not block on UI processing) and drained by the render thread at
+// frame start. The hooks decide consume-vs-pass-through with the UI's lock
+// free hit snapshot. Full rings drop events rather than stall the system
+// wide hook.
+#define INPUT_RING_SIZE 256
+
+static ui_mouse_event_t mouse_ring[INPUT_RING_SIZE];
+static volatile LONG mouse_ring_head = 0;
+static volatile LONG mouse_ring_tail = 0;
+
+static ui_keyboard_event_t key_ring[64];
+static volatile LONG key_ring_head = 0;
+static volatile LONG key_ring_tail = 0;
+
+static void input_ring_push_mouse(ui_mouse_event_t *event) {
+    LONG next = (mouse_ring_head + 1) % INPUT_RING_SIZE;
+    if (next==mouse_ring_tail) return; // full, drop
+
+    mouse_ring[mouse_ring_head] = *event;
+    InterlockedExchange(&mouse_ring_head, next);
+}
+
+static void input_ring_push_key(ui_keyboard_event_t *event) {
+    LONG next = (key_ring_head + 1) % 64;
+    if (next==key_ring_tail) return;
+
+    key_ring[key_ring_head] = *event;
+    InterlockedExchange(&key_ring_head, next);
+}
+
+// render thread: run everything queued since last frame
+static void input_ring_drain() {
+    while (mouse_ring_tail!=mouse_ring_head) {
+        ui_process_mouse_event(&mouse_ring[mouse_ring_tail]);
+        InterlockedExchange(&mouse_ring_tail, (mouse_ring_tail + 1) % INPUT_RING_SIZE);
+    }
+
+    while (key_ring_tail!=key_ring_head) {
+        ui_process_keyboard_event(&key_ring[key_ring_tail]);
+        InterlockedExchange(&key_ring_tail, (key_ring_tail + 1) % 64);
+    }
+}
+
+static int input_ring_pending() {
+    return mouse_ring_tail!=mouse_ring_head || key_ring_tail!=key_ring_head;
+}
+
 LRESULT CALLBACK keyboard_hook_proc(int nCode, WPARAM wParam, LPARAM lParam) {
     HWND fg_win = GetForegroundWindow();
     if (
@@ -176,7 +241,12 @@ LRESULT CALLBACK keyboard_hook_proc(int nCode, WPARAM wParam, LPARAM lParam) {
     
     ToAscii(keydata->vkCode, keydata->scanCode, keystate, (LPWORD)event.ascii, 0); 
 
-    if (ui_process_keyboard_event(&event)) return 1;
+    // processing happens on the render thread; the hook only decides
+    // whether the game should see the key
+    if (ui_has_focus_fast()) {
+        input_ring_push_key(&event);
+        return 1;
+    }
 
     return CallNextHookEx(NULL, nCode, wParam, lParam);
 }
@@ -232,7 +302,11 @@ LRESULT CALLBACK mouse_hook_proc(int nCode, WPARAM wParam, LPARAM lParam) {
         else me.button = UI_MOUSE_EVENT_BUTTON_X2;
     }
     
-    if (ui_process_mouse_event(&me)) {
+    // hand the event to the render thread; the consume decision is made
+    // here from the lock free hit snapshot so the hook never blocks
+    input_ring_push_mouse(&me);
+
+    if (ui_hit_test_fast(me.x, me.y)) {
         if (wParam==WM_MOUSEMOVE || wParam==WM_LBUTTONUP || wParam==WM_RBUTTONUP) {
             return CallNextHookEx(NULL, nCode, wParam, lParam);
         }
@@ -305,6 +379,18 @@ void app_init(HINSTANCE hinst, int argc, char **argv) {
     logger_add_sink(log, file_sink);
     logger_add_sink(log, lua_sink);
 
+    // structured binary log alongside the text log: records skip line
+    // formatting entirely and rotate at 16MB, cheap enough to keep debug
+    // logging on in the field. render with scripts/renderlog.lua
+    for (int a=1;a<argc;a++) {
+        if (strcmp(argv[a], "--binary-log")==0) {
+            log_sink_t *bin_sink = log_binary_sink_new("eg-overlay.blog", 16 * 1024 * 1024);
+            if (bin_sink) logger_add_sink(log, bin_sink);
+            else logger_error(log, "Couldn't open binary log.");
+            break;
+        }
+    }
+
     // attach additional log output
     if (AttachConsole(ATTACH_PARENT_PROCESS)) {
         // First, if the overlay was launched from a console window of some sort
@@ -358,12 +444,41 @@ void app_init(HINSTANCE hinst, int argc, char **argv) {
             MessageBox(NULL, 
                 "--help\n"
                 "--target-win-class (window class name)\n"
-                "--no-input-hooks",
+                "--no-input-hooks\n"
+                "--capture-mumble (path)\n"
+                "--replay-mumble (path)\n"
+                "--binary-log",
                 "EG-Overlay Command Line Options", MB_OK | MB_ICONINFORMATION);
                 exit(0);
         } else if (strcmp(argv[a], "--no-input-hooks")==0) {
             logger_warn(app->log, "Input hooks DISABLED.");
             no_input_hooks = 1;
+        } else if (strcmp(argv[a], "--capture-mumble")==0) {
+            if (a + 1 == argc) {
+                MessageBox(
+                    NULL,
+                    "--capture-mumble argument requires a path.",
+                    "Command Line Argument Error",
+                    MB_OK | MB_ICONERROR
+                );
+                exit(-1);
+            } else {
+                app->capture_path = argv[++a];
+                logger_warn(app->log, "Capturing MumbleLink snapshots to %s", app->capture_path);
+            }
+        } else if (strcmp(argv[a], "--replay-mumble")==0) {
+            if (a + 1 == argc) {
+                MessageBox(
+                    NULL,
+                    "--replay-mumble argument requires a path.",
+                    "Command Line Argument Error",
+                    MB_OK | MB_ICONERROR
+                );
+                exit(-1);
+            } else {
+                app->replay_path = argv[++a];
+                logger_warn(app->log, "Replaying MumbleLink snapshots from %s", app->replay_path);
+            }
         } else if (strcmp(argv[a], "--lua-script")==0) {
             if (a + 1 == argc) {
                 MessageBox(
@@ -382,6 +497,8 @@ void app_init(HINSTANCE hinst, int argc, char **argv) {
 
     app->settings = settings_new("eg-overlay");
     settings_set_default_double(app->settings, "overlay.frameTargetTime", 32.0);
+    settings_set_default_int(app->settings, "overlay.autoDegrade", 1);
+    settings_set_default_double(app->settings, "overlay.degradeGpuBudgetMs", 6.0);
 
     glfwInit();
 
@@ -425,6 +542,8 @@ void app_init(HINSTANCE hinst, int argc, char **argv) {
 
     gladLoadGL(glfwGetProcAddress);
 
+    gl_detect_capabilities();
+
     int context_flags;
     glGetIntegerv(GL_CONTEXT_FLAGS,&context_flags);
 
@@ -478,6 +597,10 @@ void app_init(HINSTANCE hinst, int argc, char **argv) {
 
     // GW2 is a DirectX application, so we'll be using left-handed rendering
     // instead of right-handed. Switch some defaults around to compensate.
+    // Depth is reverse-Z over a [0,1] clip range: near = 1, far = 0, GEQUAL
+    // test, cleared to 0. This keeps depth precision where the scene is and
+    // makes world draw order irrelevant for opaque coverage.
+    glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
     glDepthFunc(GL_GEQUAL);
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
@@ -525,6 +648,8 @@ void app_cleanup() {
     logger_free(app->log);
     logger_cleanup();
 
+    eg_intern_cleanup();
+
     egoverlay_free(app);
 }
 
@@ -564,10 +689,20 @@ static DWORD WINAPI app_render_thread(LPVOID lpParam) {
     vec3f_t camera_front = {0, 0, 0};
     vec3f_t up = {0.f, 1.f, 0.f};
 
+    // adaptive pacing: the game's frame cadence is estimated from MumbleLink
+    // tick changes and the overlay paces itself to it (bounded by the
+    // configured target), waiting on a high resolution timer instead of
+    // Sleep's ~15ms granularity
+    HANDLE pacer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    uint32_t pace_last_tick = 0;
+    double pace_last_tick_time = 0.0;
+    double game_interval = 0.0; // seconds between game frames, 0 = unknown
+
     float fov = 0.f;
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.f);
-    glClearDepth(-1.f); // left-handed
+    glClearDepth(0.0); // reverse-Z: far plane
     glClearStencil(1);
     //glStencilMask(0x0);
 
@@ -582,10 +717,81 @@ static DWORD WINAPI app_render_thread(LPVOID lpParam) {
         glViewport(0, 0, width, height);
         glScissor(0, 0, width, height);        
 
+        // idle power mode: with no pending UI re-render, no runnable
+        // coroutines, no queued dispatch work, and the game not ticking,
+        // there's nothing to draw — keep the last presented frame and
+        // heartbeat at a low rate. input damages the UI, which wakes the
+        // next heartbeat into a full frame
+        static uint32_t idle_last_tick = 0;
+        static int idle_had_coroutines = 0;
+
+        // one coherent MumbleLink snapshot per frame; everything below
+        // (change detection, pacing, rendering) reads from it
+        mumble_link_capture();
+
+        // replay benchmarking: one captured snapshot per frame at max speed;
+        // report frame stats and exit when the log runs out
+        static size_t replay_frames = 0;
+        static double replay_total = 0.0;
+        static double replay_worst = 0.0;
+        static double replay_start = 0.0;
+
+        if (app->replay_path) {
+            if (!mumble_link_replaying()) {
+                logger_info(
+                    app->log,
+                    "Replay complete: %zu frames in %.2fs, avg %.3fms, worst %.3fms",
+                    replay_frames,
+                    glfwGetTime() - replay_start,
+                    replay_frames ? replay_total * 1000.0 / replay_frames : 0.0,
+                    replay_worst * 1000.0
+                );
+                app_exit();
+                continue;
+            }
+            if (replay_start==0.0) replay_start = glfwGetTime();
+        }
+
+        uint32_t curtick = mumble_link_tick();
+
+        // change detection stays live while idle so availability and map
+        // events still fire (queuing one wakes the loop below)
+        mumble_link_update_events();
+
+        if (!app->replay_path &&
+            !ui_is_damaged() &&
+            !idle_had_coroutines &&
+            !lua_manager_work_pending() &&
+            !input_ring_pending() &&
+            curtick==idle_last_tick
+        ) {
+            Sleep(50);
+            continue;
+        }
+        idle_last_tick = curtick;
+
+        profiler_frame_begin();
+
+        // work recorded off-thread that needs the GL context runs here
+        gl_commands_replay();
+
+        input_ring_drain();
+
+        profiler_zone_begin("events");
         lua_manager_run_events();
+        profiler_zone_end();
+
+        profiler_zone_begin("coroutines");
         int have_coroutines = lua_manager_resume_coroutines();
+        profiler_zone_end();
+
+        idle_had_coroutines = have_coroutines;
+
         lua_manager_queue_event("update", NULL);
+
+        profiler_zone_begin("event-queue");
         lua_manager_run_event_queue();
+        profiler_zone_end();
 
         if (glfwGetWindowAttrib(app->win, GLFW_VISIBLE)==GLFW_FALSE) {
             if (!have_coroutines) Sleep(100);
@@ -612,21 +818,69 @@ static DWORD WINAPI app_render_thread(LPVOID lpParam) {
 
             mat4f_camera_facing(&sceneview, &camera, &camera_front, &up);
 
+            // per frame shader globals, shared by every pipeline
+            gl_frame_ubo_update(&proj, &sceneview, &sceneproj, &avatar, &camera, (float)frame_begin);
+
+            profiler_zone_begin("draw-3d");
             overlay_3d_begin_frame(&sceneview, &sceneproj);
             lua_manager_run_event("draw-3d", NULL);
             overlay_3d_end_frame();
+            profiler_zone_end();
         }
 
         glDisable(GL_DEPTH_TEST);
+        profiler_zone_begin("ui");
         ui_draw(&proj);
+        profiler_zone_end();
         glEnable(GL_DEPTH_TEST);
 
+        profiler_frame_end();
+        app_degradation_update();
+
+        // when the game didn't tick (identical 3D scene) and every UI
+        // damage this frame carried a rect, hint the swap so the driver can
+        // copy just the changed region. GL window coords are bottom-up
+        static uint32_t swap_last_tick = 0;
+        int dmg_x, dmg_y, dmg_w, dmg_h;
+        if (gl_has_swap_hint() &&
+            curtick==swap_last_tick &&
+            ui_damage_bounds(&dmg_x, &dmg_y, &dmg_w, &dmg_h)
+        ) {
+            gl_swap_hint_rect(dmg_x, height - dmg_y - dmg_h, dmg_w, dmg_h);
+        }
+        swap_last_tick = curtick;
+        ui_damage_bounds_reset();
+
         glfwSwapBuffers(app->win);
 
         frame_end = glfwGetTime();
 
+        // companion processes read this out of shared memory
+        mumble_link_publish((float)((frame_end - frame_begin) * 1000.0));
+
+        // track the game's frame interval from MumbleLink tick changes
+        uint32_t tick = mumble_link_tick();
+        if (tick!=pace_last_tick) {
+            if (pace_last_tick_time > 0.0 && frame_end - pace_last_tick_time < 0.25) {
+                double interval = frame_end - pace_last_tick_time;
+                game_interval = game_interval==0.0 ? interval : (game_interval * 0.9) + (interval * 0.1);
+            }
+            pace_last_tick = tick;
+            pace_last_tick_time = frame_end;
+        } else if (frame_end - pace_last_tick_time > 0.5) {
+            game_interval = 0.0; // game stalled or gone, fall back to the target
+        }
+
+        // pace to the game's cadence when it's known and faster than the
+        // configured target; otherwise the target
+        double target_ms = frame_target;
+        if (game_interval > 0.0 && game_interval * 1000.0 < frame_target) {
+            target_ms = game_interval * 1000.0;
+            if (target_ms < 1000.0 / 240.0) target_ms = 1000.0 / 240.0;
+        }
+
         long frame_time = (long)((frame_end - frame_begin) * 1000);
-        long sleep_time = (long)frame_target - frame_time;
+        long sleep_time = (long)target_ms - frame_time;
 
         // if we have extra time after rendering the frame, run the Lua
         // coroutines again if there are any pending and keep running them until
@@ -634,15 +888,33 @@ static DWORD WINAPI app_render_thread(LPVOID lpParam) {
         while (sleep_time > 0 && lua_manager_resume_coroutines()) {
             frame_end = glfwGetTime();
             frame_time = (long)((frame_end - frame_begin) * 1000);
-            sleep_time = (long)frame_target - frame_time;
+            sleep_time = (long)target_ms - frame_time;
+        }
+
+        if (app->replay_path) {
+            // replay runs unpaced; account the frame instead of sleeping
+            double ft = glfwGetTime() - frame_begin;
+            replay_frames++;
+            replay_total += ft;
+            if (ft > replay_worst) replay_worst = ft;
+            continue;
         }
 
-        // if we still have extra time, sleep
+        // if we still have extra time, wait it out precisely
         if (sleep_time > 0) {
-            Sleep(sleep_time);
+            if (pacer) {
+                LARGE_INTEGER due;
+                due.QuadPart = -(LONGLONG)sleep_time * 10000; // relative, 100ns units
+                SetWaitableTimer(pacer, &due, 0, NULL, NULL, FALSE);
+                WaitForSingleObject(pacer, (DWORD)sleep_time + 5);
+            } else {
+                Sleep(sleep_time);
+            }
         }
     }
 
+    if (pacer) CloseHandle(pacer);
+
     logger_debug(app->log, "Waiting for all Lua coroutines to finish.");
     // run shutdown events and wait for all coroutines to finish
     lua_manager_queue_event("shutdown", NULL);
@@ -657,78 +929,144 @@ static DWORD WINAPI app_render_thread(LPVOID lpParam) {
     return 0;
 }
 
-static DWORD WINAPI app_fgwincheck_thread(LPVOID lpParam) {
+// independent startup work staged off the main thread, see app_init
+static DWORD WINAPI app_async_init_thread(LPVOID lpParam) {
     UNUSED_PARAM(lpParam);
-    logger_debug(app->log, "begin foreground window checker thread...");
 
-    HWND lastwin = NULL;
-    char *fg_cls = egoverlay_calloc(513, sizeof(char));
-    char *target_cls = egoverlay_calloc(513, sizeof(char));
+    // rasterize the default UI font's preload glyphs while curl and the
+    // rest of startup initialize; ui_font_new adopts them with atlas
+    // uploads only, keeping FreeType out of time-to-first-frame
+    const char *font_path = NULL;
+    int font_size = 0;
+
+    // the defaults are registered later by ui_init; when this thread wins
+    // the race, fall back to the same values so the common case still
+    // prewarms
+    if (!GET_APP_SETTING_STR("overlay.ui.font.path", &font_path) || !font_path) {
+        font_path = "fonts/Inter.ttf";
+    }
+    if (!GET_APP_SETTING_INT("overlay.ui.font.size", &font_size) || font_size <= 0) {
+        font_size = 12;
+    }
 
-    RECT *target_rect = egoverlay_calloc(1, sizeof(RECT));
-    POINT *target_pos = egoverlay_calloc(1, sizeof(POINT));
+    ui_font_prewarm(font_path, font_size);
 
-    HWND fg_win = NULL;
+    web_request_global_init();
 
-    while (!glfwWindowShouldClose(app->win)) {
-        fg_win = GetForegroundWindow();
+    return 0;
+}
 
-        if (fg_win && fg_win!=lastwin) {
-            memset(fg_cls, 0, 513);
-            GetClassName(fg_win, fg_cls, 512);
+// Re-fit the overlay over the target window's client area. Driven by
+// WinEvent location-change notifications, so a window move/resize is
+// reflected the same frame instead of on the next poll tick.
+static volatile LONG winevent_hooks_active = 0;
+
+static void app_update_target_geometry() {
+    if (!app->target_hwnd) return;
+
+    RECT target_rect = {0};
+    POINT target_pos = {0};
+
+    GetClientRect(app->target_hwnd, &target_rect);
+    target_pos.x = target_rect.left;
+    target_pos.y = target_rect.top;
+    ClientToScreen(app->target_hwnd, &target_pos);
+
+    SetWindowPos(app->win_hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
+    SetWindowPos(
+        app->win_hwnd,
+        HWND_NOTOPMOST,
+        target_pos.x,
+        target_pos.y,
+        target_rect.right - target_rect.left,
+        target_rect.bottom - target_rect.top - 1,
+        SWP_NOACTIVATE
+    );
+}
 
-            if (strcmp(fg_cls, app->target_win_class)==0) {
-                logger_debug(app->log, "Target window reactivated, showing overlay. (%s)", fg_cls);
-                glfwShowWindow(app->win);
-                app->target_hwnd = fg_win;
+// foreground changed: adopt the target window when its class matches and
+// juggle the overlay's z-order accordingly
+static void app_update_foreground(HWND fg_win) {
+    if (!fg_win) return;
 
-            }
+    char fg_cls[513] = {0};
+    GetClassName(fg_win, fg_cls, 512);
 
-            if (fg_win==app->target_hwnd) {
-                SetWindowPos(app->win_hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
-                SetWindowPos(app->win_hwnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
-            } else {
-                //logger_debug(app->log, "Overlay -> not topmost");
-                SetWindowPos(app->win_hwnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
-            }
-        } else {
-            memset(target_cls, 0, 513);     
-            if (
-                app->target_hwnd &&
-                (GetClassName(app->target_hwnd, target_cls, 512)==0 ||
-                 strcmp(target_cls, app->target_win_class)!=0)
-            ) {
-                logger_debug(app->log, "Target window disappeared, hiding overlay.");
-                glfwHideWindow(app->win);
-                app->target_hwnd = NULL;                
-            } else if (fg_win==app->target_hwnd) {
-                GetClientRect(app->target_hwnd, target_rect);
-                target_pos->x = target_rect->left;
-                target_pos->y = target_rect->top;
-                ClientToScreen(app->target_hwnd, target_pos);
-
-                SetWindowPos(app->win_hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
-                SetWindowPos(
-                    app->win_hwnd,
-                    HWND_NOTOPMOST,
-                    target_pos->x,
-                    target_pos->y,
-                    target_rect->right - target_rect->left,
-                    target_rect->bottom - target_rect->top - 1,
-                    SWP_NOACTIVATE
-                );
-            }
+    if (strcmp(fg_cls, app->target_win_class)==0) {
+        logger_debug(app->log, "Target window reactivated, showing overlay. (%s)", fg_cls);
+        glfwShowWindow(app->win);
+        app->target_hwnd = fg_win;
+    }
 
-        }
-        lastwin = fg_win;
+    if (fg_win==app->target_hwnd) {
+        SetWindowPos(app->win_hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
+        SetWindowPos(app->win_hwnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
+        app_update_target_geometry();
+    } else {
+        SetWindowPos(app->win_hwnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOSIZE);
+    }
+}
 
-        Sleep(100);
+// WinEvent notifications, delivered on the main thread's message pump.
+// Foreground changes and target window moves/resizes arrive here instead of
+// being discovered by polling
+static void CALLBACK app_winevent_proc(
+    HWINEVENTHOOK hook,
+    DWORD event,
+    HWND hwnd,
+    LONG id_object,
+    LONG id_child,
+    DWORD event_thread,
+    DWORD event_time
+) {
+    UNUSED_PARAM(hook);
+    UNUSED_PARAM(id_child);
+    UNUSED_PARAM(event_thread);
+    UNUSED_PARAM(event_time);
+
+    if (!app) return;
+
+    if (event==EVENT_SYSTEM_FOREGROUND) {
+        app_update_foreground(hwnd);
+    } else if (id_object==OBJID_WINDOW && hwnd && hwnd==app->target_hwnd) {
+        // EVENT_OBJECT_LOCATIONCHANGE or minimize transitions on the target
+        app_update_target_geometry();
     }
+}
+
+// Slow fallback sweep: WinEvent hooks cover foreground and geometry, but a
+// target window that vanishes without events (crash, class recycled) still
+// has to hide the overlay
+static DWORD WINAPI app_fgwincheck_thread(LPVOID lpParam) {
+    UNUSED_PARAM(lpParam);
+    logger_debug(app->log, "begin foreground window checker thread...");
+
+    char target_cls[513];
+
+    HWND lastwin = NULL;
+
+    while (!glfwWindowShouldClose(app->win)) {
+        // if hook installation failed, fall back to the old foreground poll
+        if (!winevent_hooks_active) {
+            HWND fg_win = GetForegroundWindow();
+            if (fg_win && fg_win!=lastwin) app_update_foreground(fg_win);
+            lastwin = fg_win;
+        }
+
+        memset(target_cls, 0, sizeof(target_cls));
 
-    egoverlay_free(fg_cls);
-    egoverlay_free(target_cls);
-    egoverlay_free(target_rect);
-    egoverlay_free(target_pos);
+        if (
+            app->target_hwnd &&
+            (GetClassName(app->target_hwnd, target_cls, 512)==0 ||
+             strcmp(target_cls, app->target_win_class)!=0)
+        ) {
+            logger_debug(app->log, "Target window disappeared, hiding overlay.");
+            glfwHideWindow(app->win);
+            app->target_hwnd = NULL;
+        }
+
+        Sleep(500);
+    }
 
     logger_debug(app->log, "end foreground window checker thread.");
 
@@ -757,17 +1095,51 @@ int app_run() {
 
     glfwMakeContextCurrent(app->win);
     
+    gl_commands_init();
+
+    // stage the slow, independent initializers onto a worker so they
+    // overlap the GL/Lua/settings work below. curl's global init (schannel
+    // setup) is the big one; web_request_init joins before using it
+    DWORD async_init_tid = 0;
+    HANDLE async_init = CreateThread(0, 0, &app_async_init_thread, NULL, 0, &async_init_tid);
+
+    // the journal is available before Lua so module state blobs are
+    // readable the moment modules load
+    state_journal_init();
+
     // init lua first, others may register module openers
     lua_manager_init();
+    profiler_init();
     settings_lua_init();
     zip_lua_init();
     xml_lua_init();
     json_lua_init();
+    lua_worker_init();
+
+    if (async_init) {
+        WaitForSingleObject(async_init, INFINITE);
+        CloseHandle(async_init);
+    } else {
+        web_request_global_init();
+    }
+
     web_request_init();
     ui_init();
     overlay_3d_init();
     mumble_link_init();
+
+    if (app->capture_path && !mumble_link_start_capture(app->capture_path)) {
+        logger_error(app->log, "Couldn't open capture file %s.", app->capture_path);
+    }
+    if (app->replay_path && !mumble_link_start_replay(app->replay_path)) {
+        logger_error(app->log, "Couldn't open replay file %s.", app->replay_path);
+    }
+
     lua_sqlite_init();
+    gw2_static_lua_init();
+    schedule_lua_init();
+    text_index_lua_init();
+    msgpack_lua_init();
 
     lua_manager_run_file("lua/autoload.lua");
     glfwMakeContextCurrent(NULL);
@@ -785,6 +1157,31 @@ int app_run() {
         return -1;
     }
 
+    // WinEvent hooks deliver on this thread's message pump (glfwPollEvents
+    // dispatches them), so foreground changes and target window moves apply
+    // immediately on the thread that owns the overlay window
+    HWINEVENTHOOK fg_hook = SetWinEventHook(
+        EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND,
+        NULL, &app_winevent_proc, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+    HWINEVENTHOOK loc_hook = SetWinEventHook(
+        EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE,
+        NULL, &app_winevent_proc, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+    HWINEVENTHOOK minimize_hook = SetWinEventHook(
+        EVENT_SYSTEM_MINIMIZESTART, EVENT_SYSTEM_MINIMIZEEND,
+        NULL, &app_winevent_proc, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS
+    );
+
+    if (fg_hook && loc_hook) InterlockedExchange(&winevent_hooks_active, 1);
+    else logger_warn(app->log, "WinEvent hooks unavailable; falling back to polling.");
+
+    // prime the state once; everything after this is event driven
+    app_update_foreground(GetForegroundWindow());
+
     // poll events in a tight loop
     // since we are using hooks any delays here can negatively impact input for the entire system!
     while (!glfwWindowShouldClose(app->win)) {
@@ -793,6 +1190,10 @@ int app_run() {
         Sleep(1);
     }
 
+    if (fg_hook) UnhookWinEvent(fg_hook);
+    if (loc_hook) UnhookWinEvent(loc_hook);
+    if (minimize_hook) UnhookWinEvent(minimize_hook);
+
     logger_debug(app->log, "Waiting for threads to end...");
     
     WaitForSingleObject(render_thread, INFINITE);
@@ -803,11 +1204,17 @@ int app_run() {
     glfwMakeContextCurrent(app->win);
     ui_clear_top_level_elements();
     lua_manager_cleanup();
+    mumble_link_capture_stop();
     mumble_link_cleanup();
     overlay_3d_cleanup();
+    gl_commands_cleanup();
+    state_journal_cleanup();
+    profiler_cleanup();
     ui_cleanup();
     web_request_cleanup();
     xml_cleanup();
+    zip_cleanup();
+    gw2_static_cleanup();
     glfwMakeContextCurrent(NULL);
 
     Shell_NotifyIcon(NIM_DELETE, &nid);
@@ -876,6 +1283,109 @@ char *app_getclipboard_text() {
     return text;
 }
 
+// Reading the clipboard can block: OpenClipboard fails while another process
+// holds it and GetClipboardData waits on delayed rendering from the owning
+// application. app_getclipboard_text_async runs the read on a short lived
+// worker thread and hands the result back to the render thread through the
+// GL command queue, so a large or slow paste never stalls a frame.
+typedef struct {
+    app_clipboard_text_fn *callback;
+    void *data;
+    char *text;
+} app_clipboard_job_t;
+
+static void app_clipboard_deliver(void *data) {
+    app_clipboard_job_t *job = (app_clipboard_job_t*)data;
+
+    job->callback(job->text, job->data);
+    egoverlay_free(job);
+}
+
+static DWORD WINAPI app_clipboard_thread(LPVOID param) {
+    app_clipboard_job_t *job = (app_clipboard_job_t*)param;
+
+    job->text = app_getclipboard_text();
+    gl_commands_record(&app_clipboard_deliver, job);
+
+    return 0;
+}
+
+void app_getclipboard_text_async(app_clipboard_text_fn *callback, void *data) {
+    app_clipboard_job_t *job = egoverlay_calloc(1, sizeof(app_clipboard_job_t));
+    job->callback = callback;
+    job->data = data;
+
+    HANDLE thread = CreateThread(NULL, 0, &app_clipboard_thread, job, 0, NULL);
+
+    if (thread==NULL) {
+        // couldn't spawn a worker; read it here rather than dropping the paste
+        job->text = app_getclipboard_text();
+        app_clipboard_deliver(job);
+        return;
+    }
+
+    CloseHandle(thread);
+}
+
+// Auto-degradation controller. When the smoothed GPU frame time stays over
+// budget, optional visual features are disabled a tier at a time (label
+// collision layout, sprite animation, mid LOD bucket, aggressive trail
+// culling) and restored with hysteresis when headroom returns. The draw
+// paths consult app_degradation_level(); overlay-stats shows the tier.
+static volatile LONG degradation_level = 0;
+
+#define DEGRADATION_MAX_LEVEL 4
+
+int app_degradation_level() {
+    return (int)degradation_level;
+}
+
+static void app_degradation_update() {
+    static int over_frames = 0;
+    static int under_frames = 0;
+
+    int enabled = 1;
+    GET_APP_SETTING_INT("overlay.autoDegrade", &enabled);
+    if (!enabled) {
+        if (degradation_level) InterlockedExchange(&degradation_level, 0);
+        return;
+    }
+
+    double budget = 6.0;
+    GET_APP_SETTING_DOUBLE("overlay.degradeGpuBudgetMs", &budget);
+    if (budget <= 0.0) return;
+
+    double gpu = profiler_recent_gpu_ms();
+    if (gpu < 0.0) return;
+
+    if (gpu > budget) {
+        over_frames++;
+        under_frames = 0;
+
+        // a sustained overrun (about a second at 30fps) drops a tier
+        if (over_frames >= 30 && degradation_level < DEGRADATION_MAX_LEVEL) {
+            InterlockedIncrement(&degradation_level);
+            over_frames = 0;
+            logger_warn(app->log, "GPU over budget (%.2fms > %.2fms), degradation level %d",
+                        gpu, budget, (int)degradation_level);
+        }
+    } else if (gpu < budget * 0.6) {
+        // restore only with clear headroom, and much more slowly than
+        // features are dropped, so the level doesn't oscillate
+        under_frames++;
+        over_frames = 0;
+
+        if (under_frames >= 300 && degradation_level > 0) {
+            InterlockedDecrement(&degradation_level);
+            under_frames = 0;
+            logger_info(app->log, "GPU headroom restored, degradation level %d", (int)degradation_level);
+        }
+    } else {
+        over_frames = 0;
+        under_frames = 0;
+    }
+}
+
 void app_exit() {
     glfwSetWindowShouldClose(app->win, GLFW_TRUE);
 }
@@ -888,9 +1398,16 @@ static void app_run_script() {
     zip_lua_init();
     xml_lua_init();
     json_lua_init();
+    lua_worker_init();
+    web_request_global_init();
     web_request_init();
     mumble_link_init();
+    mumble_link_enable_lazy_capture();
     lua_sqlite_init();
+    gw2_static_lua_init();
+    schedule_lua_init();
+    text_index_lua_init();
+    msgpack_lua_init();
 
     lua_manager_run_file(app->runscript);
 
@@ -898,6 +1415,8 @@ static void app_run_script() {
     mumble_link_cleanup();
     web_request_cleanup();
     xml_cleanup();
+    zip_cleanup();
+    gw2_static_cleanup();
 }
 
 void app_get_mouse_coords(int *x, int *y) {
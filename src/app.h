@@ -11,12 +11,22 @@ void app_get_framebuffer_size(int *width, int *height);
 
 #define GET_APP_SETTING_INT(key, val) settings_get_int   (app_get_settings(), key, val)
 #define GET_APP_SETTING_STR(key, val) settings_get_string(app_get_settings(), key, val)
+#define GET_APP_SETTING_DOUBLE(key, val) settings_get_double(app_get_settings(), key, val)
 
 settings_t *app_get_settings();
 
 void app_setclipboard_text(const char *text);
 char *app_getclipboard_text();
 
+// read the clipboard on a worker thread and deliver the text (or NULL) to
+// callback on the render thread at the start of a frame. callback owns text.
+typedef void app_clipboard_text_fn(char *text, void *data);
+void app_getclipboard_text_async(app_clipboard_text_fn *callback, void *data);
+
 void app_get_mouse_coords(int *x, int *y);
 
 void app_exit();
+
+// current auto-degradation tier, 0 (everything on) .. 4; see
+// app_degradation_update in app.c
+int app_degradation_level();
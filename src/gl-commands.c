@@ -0,0 +1,65 @@
+#include "gl-commands.h"
+#include "utils.h"
+#include <windows.h>
+
+typedef struct {
+    gl_command_fn *fn;
+    void *data;
+} gl_command_t;
+
+typedef struct {
+    gl_command_t *items;
+    size_t count;
+    size_t capacity;
+} gl_command_arena_t;
+
+// two command arenas: one being recorded into, one being replayed. they
+// swap under the mutex at replay time, so recording only ever blocks on
+// the (brief) append, never on the replay itself.
+static gl_command_arena_t record_arena;
+static gl_command_arena_t replay_arena;
+
+static HANDLE command_mutex = NULL;
+
+void gl_commands_init() {
+    command_mutex = CreateMutex(0, FALSE, NULL);
+}
+
+void gl_commands_cleanup() {
+    if (command_mutex) CloseHandle(command_mutex);
+    if (record_arena.items) egoverlay_free(record_arena.items);
+    if (replay_arena.items) egoverlay_free(replay_arena.items);
+}
+
+void gl_commands_record(gl_command_fn *fn, void *data) {
+    WaitForSingleObject(command_mutex, INFINITE);
+
+    if (record_arena.count==record_arena.capacity) {
+        record_arena.capacity = record_arena.capacity ? record_arena.capacity * 2 : 64;
+        record_arena.items = egoverlay_realloc(record_arena.items, record_arena.capacity * sizeof(gl_command_t));
+    }
+
+    record_arena.items[record_arena.count].fn = fn;
+    record_arena.items[record_arena.count].data = data;
+    record_arena.count++;
+
+    ReleaseMutex(command_mutex);
+}
+
+void gl_commands_replay() {
+    WaitForSingleObject(command_mutex, INFINITE);
+
+    // swap the arenas; commands recorded during replay land in the other
+    // one and run next frame
+    gl_command_arena_t batch = record_arena;
+    record_arena = replay_arena;
+    replay_arena = batch;
+
+    ReleaseMutex(command_mutex);
+
+    for (size_t c=0;c<replay_arena.count;c++) {
+        replay_arena.items[c].fn(replay_arena.items[c].data);
+    }
+
+    replay_arena.count = 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Cross-thread GL command recording: any thread records fn/data commands,
+// the render loop replays them (in order) on the thread that owns the GL
+// context. This is the handoff point for work produced off-thread that has
+// to touch GL (texture uploads from decode workers, buffer updates).
+typedef void gl_command_fn(void *data);
+
+void gl_commands_init();
+void gl_commands_cleanup();
+
+// record a command from any thread
+void gl_commands_record(gl_command_fn *fn, void *data);
+
+// replay everything recorded so far; render thread only, once per frame
+void gl_commands_replay();
@@ -2,6 +2,9 @@
 #include "utils.h"
 #include "logging/logger.h"
 #include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <windows.h>
 
 struct gl_shader_program_t {
     GLuint *shaders;
@@ -10,15 +13,92 @@ struct gl_shader_program_t {
     GLuint program;
 };
 
+// In-memory shader source cache. Program builds (and the binary cache hash)
+// used to re-read every source and include file from disk; rebuild-heavy
+// paths (pipeline variants, future hot reload) now hit memory. Entries
+// revalidate by file modification time, so an edited shader still picks up
+// on the next build.
+#define GL_SRC_CACHE_SLOTS 64
+
+struct gl_src_cache_entry {
+    char *path;
+    char *src;
+    size_t len;
+    __time64_t mtime;
+};
+
+static struct gl_src_cache_entry gl_src_cache[GL_SRC_CACHE_SLOTS];
+
+static __time64_t gl_file_mtime(const char *path) {
+    struct __stat64 st;
+
+    if (_stat64(path, &st)!=0) return 0;
+
+    return st.st_mtime;
+}
+
+// returns the cached contents of path; the buffer belongs to the cache, do
+// not free it. NULL when the file can't be read
+static const char *gl_load_source_cached(const char *path, size_t *len) {
+    uint32_t hash = djb2_hash_string(path);
+    size_t ind = hash % GL_SRC_CACHE_SLOTS;
+
+    for (size_t probe=0;probe<GL_SRC_CACHE_SLOTS;probe++) {
+        struct gl_src_cache_entry *e = &gl_src_cache[(ind + probe) % GL_SRC_CACHE_SLOTS];
+
+        if (!e->path) {
+            // miss: load and fill this slot
+            size_t src_len = 0;
+            char *src = load_file(path, &src_len);
+            if (!src) return NULL;
+
+            e->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+            memcpy(e->path, path, strlen(path));
+            e->src = src;
+            e->len = src_len;
+            e->mtime = gl_file_mtime(path);
+
+            *len = e->len;
+            return e->src;
+        }
+
+        if (strcmp(e->path, path)!=0) continue;
+
+        // revalidate against the file's modification time
+        __time64_t mtime = gl_file_mtime(path);
+        if (mtime!=e->mtime) {
+            size_t src_len = 0;
+            char *src = load_file(path, &src_len);
+            if (!src) return NULL;
+
+            egoverlay_free(e->src);
+            e->src = src;
+            e->len = src_len;
+            e->mtime = mtime;
+        }
+
+        *len = e->len;
+        return e->src;
+    }
+
+    // cache full of other paths; fall through uncached
+    *len = 0;
+    return NULL;
+}
+
 GLuint gl_load_shader(const char *path, GLenum shader_type) {
     logger_t *log = logger_get("gl");
 
     size_t src_len = 0;
-    char *src = load_file(path, &src_len);
+    const char *src = gl_load_source_cached(path, &src_len);
+
+    if (!src) {
+        logger_error(log, "Couldn't read shader source %s", path);
+        error_and_exit("EG-Overlay: GL", "Couldn't read shader source %s", path);
+    }
 
     GLuint shader = glCreateShader(shader_type);
     glShaderSource(shader, 1, &src, (const GLint*)&src_len);
-    egoverlay_free(src);
 
     glCompileShader(shader);
    
@@ -39,6 +119,66 @@ GLuint gl_load_shader(const char *path, GLenum shader_type) {
     return shader;
 }
 
+// registered include files also feed the program binary cache hash: a
+// change to an include has to invalidate every cached program
+#define GL_MAX_SHADER_INCLUDES 8
+
+static char *gl_shader_include_paths[GL_MAX_SHADER_INCLUDES];
+static int gl_shader_include_count = 0;
+
+// ARB_bindless_texture support, detected once after the context is up. With
+// bindless, standalone sprite textures carry resident handles per instance
+// and the sprite pass doesn't have to break batches to bind them.
+static int gl_bindless_textures = 0;
+
+int gl_has_bindless_textures() {
+    return gl_bindless_textures;
+}
+
+// GL_WIN_swap_hint: SwapBuffers copies only the hinted regions when the
+// driver honors it, which trims present cost for small UI-only updates on
+// a 4K overlay. A no-op when the extension is missing.
+typedef void (WINAPI *PFNGLADDSWAPHINTRECTWINPROC_)(GLint x, GLint y, GLsizei width, GLsizei height);
+static PFNGLADDSWAPHINTRECTWINPROC_ gl_add_swap_hint_rect = NULL;
+
+int gl_has_swap_hint() {
+    return gl_add_swap_hint_rect!=NULL;
+}
+
+void gl_swap_hint_rect(int x, int y, int w, int h) {
+    if (gl_add_swap_hint_rect) gl_add_swap_hint_rect(x, y, w, h);
+}
+
+// Detect optional capabilities and write the generated capability defines
+// include that shaders pull in via "/capabilities.glsl". The file lives in
+// the shader cache directory so the program binary cache hashes it like any
+// other include; must run after gladLoadGL and before any program is built.
+void gl_detect_capabilities() {
+    logger_t *log = logger_get("gl");
+
+    gl_bindless_textures = GLAD_GL_ARB_bindless_texture ? 1 : 0;
+
+    logger_info(log, "bindless textures: %s", gl_bindless_textures ? "yes" : "no");
+
+    gl_add_swap_hint_rect = (PFNGLADDSWAPHINTRECTWINPROC_)(void*)wglGetProcAddress("glAddSwapHintRectWIN");
+    logger_info(log, "swap hint rects: %s", gl_add_swap_hint_rect ? "yes" : "no");
+
+    CreateDirectory("shader-cache", NULL);
+
+    char src[128] = {0};
+    snprintf(src, sizeof(src), "#define HAS_BINDLESS_TEXTURES %d\n", gl_bindless_textures);
+
+    FILE *f = fopen("shader-cache/capabilities.glsl", "wb");
+    if (f) {
+        fwrite(src, 1, strlen(src), f);
+        fclose(f);
+
+        gl_add_shader_include("shader-cache/capabilities.glsl", "/capabilities.glsl");
+    } else {
+        logger_error(log, "Couldn't write shader-cache/capabilities.glsl");
+    }
+}
+
 void gl_add_shader_include(const char *path, const char *name) {
     logger_t *log = logger_get("gl");
 
@@ -49,6 +189,12 @@ void gl_add_shader_include(const char *path, const char *name) {
 
     egoverlay_free(src);
 
+    if (gl_shader_include_count < GL_MAX_SHADER_INCLUDES) {
+        char *copy = egoverlay_calloc(strlen(path)+1, sizeof(char));
+        memcpy(copy, path, strlen(path));
+        gl_shader_include_paths[gl_shader_include_count++] = copy;
+    }
+
     logger_debug(log, "Shader include %s loaded to %s", path, name);
 }
 
@@ -64,9 +210,133 @@ gl_shader_program_t *gl_shader_program_new() {
     return p;
 }
 
+// On-disk program binary cache. Linked programs are stored keyed by a hash
+// of every source file's content plus the driver's renderer/version
+// strings, so driver updates and shader edits both invalidate naturally.
+typedef struct {
+    char magic[4]; // EGSC
+    uint32_t srchash;
+    GLenum format;
+    GLsizei length;
+} gl_shader_cache_header_t;
+
+static uint32_t gl_shader_cache_hash(gl_shader_source_list_t *sources) {
+    uint32_t hash = 5381;
+
+    const char *renderer = (const char*)glGetString(GL_RENDERER);
+    const char *version = (const char*)glGetString(GL_VERSION);
+
+    if (renderer) hash = (hash * 33) ^ djb2_hash_string(renderer);
+    if (version) hash = (hash * 33) ^ djb2_hash_string(version);
+
+    for (gl_shader_source_list_t *s=sources;s->path;s++) {
+        size_t src_len = 0;
+        const char *src = gl_load_source_cached(s->path, &src_len);
+        if (!src) return 0;
+
+        hash = (hash * 33) ^ djb2_hash_data((const uint8_t*)src, src_len);
+        hash = (hash * 33) ^ (uint32_t)s->type;
+    }
+
+    for (int i=0;i<gl_shader_include_count;i++) {
+        size_t src_len = 0;
+        const char *src = gl_load_source_cached(gl_shader_include_paths[i], &src_len);
+        if (!src) continue;
+
+        hash = (hash * 33) ^ djb2_hash_data((const uint8_t*)src, src_len);
+    }
+
+    return hash;
+}
+
+// Try to restore the linked program from the cache. Returns 1 on success.
+static int gl_shader_program_load_cached(gl_shader_program_t *p, uint32_t srchash) {
+    char path[64];
+    snprintf(path, sizeof(path), "shader-cache/%08x.bin", srchash);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+
+    gl_shader_cache_header_t header = {0};
+    if (fread(&header, sizeof(header), 1, f)!=1 ||
+        memcmp(header.magic, "EGSC", 4)!=0 ||
+        header.srchash!=srchash ||
+        header.length<=0
+    ) {
+        fclose(f);
+        return 0;
+    }
+
+    uint8_t *binary = egoverlay_malloc(header.length);
+    if (fread(binary, 1, header.length, f)!=(size_t)header.length) {
+        egoverlay_free(binary);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    glProgramBinary(p->program, header.format, binary, header.length);
+    egoverlay_free(binary);
+
+    GLint linked = 0;
+    glGetProgramiv(p->program, GL_LINK_STATUS, &linked);
+
+    return linked==GL_TRUE;
+}
+
+static void gl_shader_program_store_cached(gl_shader_program_t *p, uint32_t srchash) {
+    GLint length = 0;
+    glGetProgramiv(p->program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length<=0) return;
+
+    uint8_t *binary = egoverlay_malloc(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(p->program, length, &written, &format, binary);
+
+    if (written<=0) {
+        egoverlay_free(binary);
+        return;
+    }
+
+    CreateDirectory("shader-cache", NULL);
+
+    char path[64];
+    snprintf(path, sizeof(path), "shader-cache/%08x.bin", srchash);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        egoverlay_free(binary);
+        return;
+    }
+
+    gl_shader_cache_header_t header = {0};
+    memcpy(header.magic, "EGSC", 4);
+    header.srchash = srchash;
+    header.format = format;
+    header.length = written;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(binary, 1, written, f);
+    fclose(f);
+
+    egoverlay_free(binary);
+}
+
 gl_shader_program_t *gl_shader_program_new_with_sources(gl_shader_source_list_t *sources) {
+    logger_t *log = logger_get("gl");
+
     gl_shader_program_t *p = gl_shader_program_new();
 
+    uint32_t srchash = gl_shader_cache_hash(sources);
+
+    if (srchash && gl_shader_program_load_cached(p, srchash)) {
+        logger_debug(log, "Shader program %d restored from cache.", p->program);
+        return p;
+    }
+
+    glProgramParameteri(p->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
     while (sources->path) {
         gl_shader_program_attach_shader_file(p, sources->path, sources->type);
         sources++;
@@ -74,6 +344,8 @@ gl_shader_program_t *gl_shader_program_new_with_sources(gl_shader_source_list_t
 
     gl_shader_program_link(p);
 
+    if (srchash) gl_shader_program_store_cached(p, srchash);
+
     return p;
 }
 
@@ -123,3 +395,145 @@ void gl_shader_program_link(gl_shader_program_t *program) {
 void gl_shader_program_use(gl_shader_program_t *program) {
     glUseProgram(program->program);
 }
+
+// Per frame globals shared by every pipeline through a std140 UBO at
+// binding 0, uploaded once per frame instead of re-sending matrices and
+// positions per program switch.
+typedef struct {
+    mat4f_t ortho;
+    mat4f_t view;
+    mat4f_t proj;
+    vec4f_t player;
+    vec4f_t camera;
+    float time;
+    float pad[3];
+} gl_frame_globals_t;
+
+static GLuint frame_ubo = 0;
+
+void gl_frame_ubo_update(
+    mat4f_t *ortho,
+    mat4f_t *view,
+    mat4f_t *proj,
+    vec3f_t *player,
+    vec3f_t *camera,
+    float time
+) {
+    if (!frame_ubo) {
+        glGenBuffers(1, &frame_ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(gl_frame_globals_t), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, frame_ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    gl_frame_globals_t globals = {0};
+    globals.ortho = *ortho;
+    globals.view = *view;
+    globals.proj = *proj;
+    globals.player.x = player->x;
+    globals.player.y = player->y;
+    globals.player.z = player->z;
+    globals.player.w = 1.f;
+    globals.camera.x = camera->x;
+    globals.camera.y = camera->y;
+    globals.camera.z = camera->z;
+    globals.camera.w = 1.f;
+    globals.time = time;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(gl_frame_globals_t), &globals);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// ---- GL state cache ----
+
+// shadowed state; zero/unknown initial values force the first real call
+static GLuint state_program = 0;
+static GLuint state_vao = 0;
+
+// the handful of capabilities the overlay toggles
+#define STATE_CAP_COUNT 4
+static const GLenum state_caps[STATE_CAP_COUNT] = {
+    GL_SCISSOR_TEST, GL_CULL_FACE, GL_DEPTH_TEST, GL_BLEND
+};
+static int state_cap_values[STATE_CAP_COUNT] = { -1, -1, -1, -1 };
+
+static unsigned int state_calls = 0;
+static unsigned int state_redundant = 0;
+
+void egoverlay_glUseProgram(GLuint program) {
+    state_calls++;
+
+    if (program==state_program) {
+        state_redundant++;
+        return;
+    }
+
+    state_program = program;
+    glad_glUseProgram(program);
+}
+
+void egoverlay_glBindVertexArray(GLuint array) {
+    state_calls++;
+
+    if (array==state_vao) {
+        state_redundant++;
+        return;
+    }
+
+    state_vao = array;
+    glad_glBindVertexArray(array);
+}
+
+static int state_cap_index(GLenum cap) {
+    for (int i=0;i<STATE_CAP_COUNT;i++) {
+        if (state_caps[i]==cap) return i;
+    }
+    return -1;
+}
+
+void egoverlay_glEnable(GLenum cap) {
+    state_calls++;
+
+    int ind = state_cap_index(cap);
+    if (ind>=0) {
+        if (state_cap_values[ind]==1) {
+            state_redundant++;
+            return;
+        }
+        state_cap_values[ind] = 1;
+    }
+
+    glad_glEnable(cap);
+}
+
+void egoverlay_glDisable(GLenum cap) {
+    state_calls++;
+
+    int ind = state_cap_index(cap);
+    if (ind>=0) {
+        if (state_cap_values[ind]==0) {
+            state_redundant++;
+            return;
+        }
+        state_cap_values[ind] = 0;
+    }
+
+    glad_glDisable(cap);
+}
+
+void gl_state_invalidate() {
+    state_program = 0;
+    state_vao = 0;
+    for (int i=0;i<STATE_CAP_COUNT;i++) state_cap_values[i] = -1;
+
+    // re-sync the real state with the cleared shadow
+    glad_glUseProgram(0);
+    glad_glBindVertexArray(0);
+}
+
+void gl_state_stats(unsigned int *calls, unsigned int *redundant) {
+    *calls = state_calls;
+    *redundant = state_redundant;
+}
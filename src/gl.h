@@ -16,6 +16,11 @@
     glVertexAttribIPointer(loc, 1, GL_UNSIGNED_INT, sizeof(type), (void*)offsetof(type, memb));\
     glVertexAttribDivisor(loc, div)
 
+#define VERT_ATTRIB_UVEC2(loc, div, type, memb) \
+    glEnableVertexAttribArray(loc);\
+    glVertexAttribIPointer(loc, 2, GL_UNSIGNED_INT, sizeof(type), (void*)offsetof(type, memb));\
+    glVertexAttribDivisor(loc, div)
+
 #define VERT_ATTRIB_MAT4(loc, div, type, memb) \
     VERT_ATTRIB_FLOATS(loc    , 4, div, type, memb, 0                   );\
     VERT_ATTRIB_FLOATS(loc + 1, 4, div, type, memb, ( 4 * sizeof(float)));\
@@ -36,9 +41,51 @@ void                 gl_shader_program_free(gl_shader_program_t *program);
 GLuint gl_load_shader(const char *path, GLenum shader_type);
 
 void gl_add_shader_include(const char *path, const char *name);
+
+// optional capability detection; run once after gladLoadGL, before any
+// shader program is built
+void gl_detect_capabilities();
+int gl_has_bindless_textures();
+int gl_has_swap_hint();
+void gl_swap_hint_rect(int x, int y, int w, int h);
 void gl_del_shader_include(const char *name);
 
 void gl_shader_program_attach_shader_file(gl_shader_program_t *program, const char *path, GLenum type);
 void gl_shader_program_link(gl_shader_program_t *program);
 
 void gl_shader_program_use(gl_shader_program_t *program);
+
+#include "lamath.h"
+
+// upload the per frame globals UBO (binding 0: ortho, scene view/proj,
+// player and camera positions, time), once per frame from the render loop
+void gl_frame_ubo_update(
+    mat4f_t *ortho,
+    mat4f_t *view,
+    mat4f_t *proj,
+    vec3f_t *player,
+    vec3f_t *camera,
+    float time
+);
+
+// State caching shims: these redefine the glad macros, so every call site
+// that includes this header gets redundant-call elision without edits.
+// Calls that actually change state pass through; redundant ones are
+// counted and dropped. gl_state_invalidate resets the shadow state (after
+// anything external touches GL).
+void egoverlay_glUseProgram(GLuint program);
+void egoverlay_glBindVertexArray(GLuint array);
+void egoverlay_glEnable(GLenum cap);
+void egoverlay_glDisable(GLenum cap);
+
+void gl_state_invalidate();
+void gl_state_stats(unsigned int *calls, unsigned int *redundant);
+
+#undef glUseProgram
+#define glUseProgram egoverlay_glUseProgram
+#undef glBindVertexArray
+#define glBindVertexArray egoverlay_glBindVertexArray
+#undef glEnable
+#define glEnable egoverlay_glEnable
+#undef glDisable
+#define glDisable egoverlay_glDisable
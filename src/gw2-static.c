@@ -0,0 +1,515 @@
+/*** RST
+gw2-static
+==========
+
+.. lua:module:: gw2-static
+
+.. code-block:: lua
+
+    local gw2static = require 'gw2-static'
+
+Read-only access to the compiled static game data snapshot.
+
+``scripts/compilestaticdata.lua`` compiles the maps, POIs, and sectors from
+the :lua:mod:`gw2.static` sqlite database into ``data/gw2/gw2-static.dat``, a
+columnar binary with a shared string table. This module memory maps that file
+at first use; lookups read straight out of the mapping, so no Lua tables or
+sqlite pages are built at startup. Rows are only materialized as Lua tables
+when asked for.
+
+Maps are sorted by id and POIs/sectors by map id inside the file, so lookups
+are binary searches over the mapped columns.
+*/
+#include <windows.h>
+#include <string.h>
+#include "gw2-static.h"
+#include "lua-manager.h"
+#include "logging/logger.h"
+#include "utils.h"
+#include <lauxlib.h>
+
+#define GW2_STATIC_MAGIC "EGSD"
+#define GW2_STATIC_VERSION 1
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t map_count;
+    uint32_t poi_count;
+    uint32_t sector_count;
+    uint32_t string_blob_size;
+    uint64_t maps_offset;
+    uint64_t pois_offset;
+    uint64_t sectors_offset;
+    uint64_t strings_offset;
+} gw2_static_header_t;
+#pragma pack(pop)
+
+// column pointers into the mapping. maps are sorted by id, pois and sectors
+// by map id, so per-map queries are binary searches over these arrays
+typedef struct {
+    HANDLE file;
+    HANDLE mapping;
+    const uint8_t *map;
+    size_t map_size;
+
+    uint32_t map_count;
+    const int32_t *map_id;
+    const int32_t *map_min_level;
+    const int32_t *map_max_level;
+    const int32_t *map_default_floor;
+    const int32_t *map_region;
+    const uint32_t *map_name;
+    const double *map_label_x;
+    const double *map_label_y;
+    const double *map_rect[4];       // left, right, top, bottom
+    const double *map_cont_rect[4];  // left, right, top, bottom
+
+    uint32_t poi_count;
+    const int32_t *poi_id;
+    const int32_t *poi_map;
+    const int32_t *poi_floor;
+    const uint32_t *poi_type;
+    const uint32_t *poi_name;
+    const uint32_t *poi_chat_link;
+    const uint32_t *poi_icon;
+    const double *poi_x;
+    const double *poi_y;
+
+    uint32_t sector_count;
+    const int32_t *sector_id;
+    const int32_t *sector_map;
+    const int32_t *sector_level;
+    const uint32_t *sector_name;
+    const double *sector_x;
+    const double *sector_y;
+
+    const char *strings;
+    uint32_t strings_size;
+} gw2_static_t;
+
+static gw2_static_t *gw2_static = NULL;
+static int gw2_static_load_attempted = 0;
+
+static logger_t *logger = NULL;
+
+int gw2_static_lua_open_module(lua_State *L);
+
+void gw2_static_lua_init() {
+    logger = logger_get("gw2-static");
+
+    lua_manager_add_module_opener("gw2-static", &gw2_static_lua_open_module);
+}
+
+void gw2_static_cleanup() {
+    if (!gw2_static) return;
+
+    UnmapViewOfFile(gw2_static->map);
+    CloseHandle(gw2_static->mapping);
+    CloseHandle(gw2_static->file);
+    egoverlay_free(gw2_static);
+    gw2_static = NULL;
+}
+
+// data/gw2/gw2-static.dat next to the executable, same layout
+// overlay.datafolder produces for Lua modules
+static char *gw2_static_path() {
+    char proc_path[MAX_PATH+1] = {0};
+
+    DWORD proc_path_len = GetModuleFileName(NULL, proc_path, MAX_PATH);
+    if (!proc_path_len) return NULL;
+
+    size_t last_sep = 0;
+    for (size_t i=proc_path_len-1;i>0;i--) {
+        if (proc_path[i]=='\\') {
+            last_sep = i;
+            break;
+        }
+    }
+
+    const char *rel = "\\data\\gw2\\gw2-static.dat";
+    char *path = egoverlay_calloc(last_sep + strlen(rel) + 1, sizeof(char));
+    memcpy(path, proc_path, last_sep);
+    memcpy(path + last_sep, rel, strlen(rel));
+
+    return path;
+}
+
+static void gw2_static_load() {
+    if (gw2_static_load_attempted) return;
+    gw2_static_load_attempted = 1;
+
+    char *path = gw2_static_path();
+    if (!path) return;
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file==INVALID_HANDLE_VALUE) {
+        logger_debug(logger, "No static data snapshot at %s.", path);
+        egoverlay_free(path);
+        return;
+    }
+
+    LARGE_INTEGER file_size = {0};
+    GetFileSizeEx(file, &file_size);
+
+    if (file_size.QuadPart < (LONGLONG)sizeof(gw2_static_header_t)) {
+        logger_error(logger, "%s is truncated.", path);
+        CloseHandle(file);
+        egoverlay_free(path);
+        return;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        logger_error(logger, "Couldn't create file mapping for %s.", path);
+        CloseHandle(file);
+        egoverlay_free(path);
+        return;
+    }
+
+    const uint8_t *map = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map) {
+        logger_error(logger, "Couldn't map %s.", path);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        egoverlay_free(path);
+        return;
+    }
+
+    const gw2_static_header_t *hdr = (const gw2_static_header_t*)map;
+
+    if (memcmp(hdr->magic, GW2_STATIC_MAGIC, 4)!=0 || hdr->version!=GW2_STATIC_VERSION) {
+        logger_error(logger, "%s isn't a valid static data snapshot.", path);
+        UnmapViewOfFile(map);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        egoverlay_free(path);
+        return;
+    }
+
+    // sanity check the section extents against the file size before trusting
+    // any of the offsets
+    size_t maps_size    = (size_t)hdr->map_count    * (5 * sizeof(int32_t) + sizeof(uint32_t) + 10 * sizeof(double));
+    size_t pois_size    = (size_t)hdr->poi_count    * (3 * sizeof(int32_t) + 4 * sizeof(uint32_t) + 2 * sizeof(double));
+    size_t sectors_size = (size_t)hdr->sector_count * (3 * sizeof(int32_t) + sizeof(uint32_t) + 2 * sizeof(double));
+
+    if (hdr->maps_offset    + maps_size             > (uint64_t)file_size.QuadPart ||
+        hdr->pois_offset    + pois_size             > (uint64_t)file_size.QuadPart ||
+        hdr->sectors_offset + sectors_size          > (uint64_t)file_size.QuadPart ||
+        hdr->strings_offset + hdr->string_blob_size > (uint64_t)file_size.QuadPart ||
+        hdr->string_blob_size==0
+    ) {
+        logger_error(logger, "%s has out of range sections.", path);
+        UnmapViewOfFile(map);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        egoverlay_free(path);
+        return;
+    }
+
+    gw2_static_t *gs = egoverlay_calloc(1, sizeof(gw2_static_t));
+    gs->file = file;
+    gs->mapping = mapping;
+    gs->map = map;
+    gs->map_size = (size_t)file_size.QuadPart;
+
+    const uint8_t *p = map + hdr->maps_offset;
+    gs->map_count         = hdr->map_count;
+    gs->map_id            = (const int32_t*)p;  p += hdr->map_count * sizeof(int32_t);
+    gs->map_min_level     = (const int32_t*)p;  p += hdr->map_count * sizeof(int32_t);
+    gs->map_max_level     = (const int32_t*)p;  p += hdr->map_count * sizeof(int32_t);
+    gs->map_default_floor = (const int32_t*)p;  p += hdr->map_count * sizeof(int32_t);
+    gs->map_region        = (const int32_t*)p;  p += hdr->map_count * sizeof(int32_t);
+    gs->map_name          = (const uint32_t*)p; p += hdr->map_count * sizeof(uint32_t);
+    gs->map_label_x       = (const double*)p;   p += hdr->map_count * sizeof(double);
+    gs->map_label_y       = (const double*)p;   p += hdr->map_count * sizeof(double);
+    for (int r=0;r<4;r++) { gs->map_rect[r]      = (const double*)p; p += hdr->map_count * sizeof(double); }
+    for (int r=0;r<4;r++) { gs->map_cont_rect[r] = (const double*)p; p += hdr->map_count * sizeof(double); }
+
+    p = map + hdr->pois_offset;
+    gs->poi_count     = hdr->poi_count;
+    gs->poi_id        = (const int32_t*)p;  p += hdr->poi_count * sizeof(int32_t);
+    gs->poi_map       = (const int32_t*)p;  p += hdr->poi_count * sizeof(int32_t);
+    gs->poi_floor     = (const int32_t*)p;  p += hdr->poi_count * sizeof(int32_t);
+    gs->poi_type      = (const uint32_t*)p; p += hdr->poi_count * sizeof(uint32_t);
+    gs->poi_name      = (const uint32_t*)p; p += hdr->poi_count * sizeof(uint32_t);
+    gs->poi_chat_link = (const uint32_t*)p; p += hdr->poi_count * sizeof(uint32_t);
+    gs->poi_icon      = (const uint32_t*)p; p += hdr->poi_count * sizeof(uint32_t);
+    gs->poi_x         = (const double*)p;   p += hdr->poi_count * sizeof(double);
+    gs->poi_y         = (const double*)p;   p += hdr->poi_count * sizeof(double);
+
+    p = map + hdr->sectors_offset;
+    gs->sector_count = hdr->sector_count;
+    gs->sector_id    = (const int32_t*)p;  p += hdr->sector_count * sizeof(int32_t);
+    gs->sector_map   = (const int32_t*)p;  p += hdr->sector_count * sizeof(int32_t);
+    gs->sector_level = (const int32_t*)p;  p += hdr->sector_count * sizeof(int32_t);
+    gs->sector_name  = (const uint32_t*)p; p += hdr->sector_count * sizeof(uint32_t);
+    gs->sector_x     = (const double*)p;   p += hdr->sector_count * sizeof(double);
+    gs->sector_y     = (const double*)p;   p += hdr->sector_count * sizeof(double);
+
+    gs->strings = (const char*)(map + hdr->strings_offset);
+    gs->strings_size = hdr->string_blob_size;
+
+    gw2_static = gs;
+
+    logger_info(
+        logger, "Mapped static data snapshot: %u maps, %u POIs, %u sectors.",
+        gs->map_count, gs->poi_count, gs->sector_count
+    );
+
+    egoverlay_free(path);
+}
+
+// push a string table entry, or nil for offset 0/out of range offsets
+static void gw2_static_push_string(lua_State *L, uint32_t offset) {
+    if (offset==0 || offset>=gw2_static->strings_size) {
+        lua_pushnil(L);
+        return;
+    }
+
+    lua_pushstring(L, gw2_static->strings + offset);
+}
+
+// binary search the sorted map id column; returns -1 when not found
+static int64_t gw2_static_find_map(int32_t id) {
+    int64_t lo = 0;
+    int64_t hi = (int64_t)gw2_static->map_count - 1;
+
+    while (lo<=hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (gw2_static->map_id[mid]==id) return mid;
+        if (gw2_static->map_id[mid]<id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+
+    return -1;
+}
+
+// lower bound of value in a sorted int32 column
+static int64_t gw2_static_lower_bound(const int32_t *col, int64_t count, int32_t value) {
+    int64_t lo = 0;
+    int64_t hi = count;
+
+    while (lo<hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (col[mid]<value) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+int gw2_static_lua_loaded(lua_State *L);
+int gw2_static_lua_map(lua_State *L);
+int gw2_static_lua_mapids(lua_State *L);
+int gw2_static_lua_mappois(lua_State *L);
+int gw2_static_lua_mapsectors(lua_State *L);
+
+luaL_Reg gw2_static_funcs[] = {
+    "loaded"    , &gw2_static_lua_loaded,
+    "map"       , &gw2_static_lua_map,
+    "mapids"    , &gw2_static_lua_mapids,
+    "mappois"   , &gw2_static_lua_mappois,
+    "mapsectors", &gw2_static_lua_mapsectors,
+    NULL        , NULL
+};
+
+int gw2_static_lua_open_module(lua_State *L) {
+    gw2_static_load();
+
+    lua_newtable(L);
+    luaL_setfuncs(L, gw2_static_funcs, 0);
+
+    return 1;
+}
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: loaded()
+
+    Return ``true`` if the static data snapshot was found and mapped.
+
+    :rtype: boolean
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int gw2_static_lua_loaded(lua_State *L) {
+    lua_pushboolean(L, gw2_static!=NULL);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: map(id)
+
+    Return the map with the given id or ``nil``.
+
+    The returned table has the same columns as the :overlay:dbtable:`maps`
+    table: ``id``, ``name``, ``min_level``, ``max_level``, ``default_floor``,
+    ``region``, ``label_x``, ``label_y``, and the ``map_rect_*`` /
+    ``continent_rect_*`` fields.
+
+    :param integer id:
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int gw2_static_lua_map(lua_State *L) {
+    int32_t id = (int32_t)luaL_checkinteger(L, 1);
+
+    if (!gw2_static) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    int64_t m = gw2_static_find_map(id);
+    if (m<0) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    static const char *rect_fields[4]      = {"map_rect_left", "map_rect_right", "map_rect_top", "map_rect_bottom"};
+    static const char *cont_rect_fields[4] = {
+        "continent_rect_left", "continent_rect_right", "continent_rect_top", "continent_rect_bottom"
+    };
+
+    lua_newtable(L);
+    lua_pushinteger(L, gw2_static->map_id[m]);            lua_setfield(L, -2, "id");
+    lua_pushinteger(L, gw2_static->map_min_level[m]);     lua_setfield(L, -2, "min_level");
+    lua_pushinteger(L, gw2_static->map_max_level[m]);     lua_setfield(L, -2, "max_level");
+    lua_pushinteger(L, gw2_static->map_default_floor[m]); lua_setfield(L, -2, "default_floor");
+    lua_pushinteger(L, gw2_static->map_region[m]);        lua_setfield(L, -2, "region");
+    gw2_static_push_string(L, gw2_static->map_name[m]);   lua_setfield(L, -2, "name");
+    lua_pushnumber(L, gw2_static->map_label_x[m]);        lua_setfield(L, -2, "label_x");
+    lua_pushnumber(L, gw2_static->map_label_y[m]);        lua_setfield(L, -2, "label_y");
+    for (int r=0;r<4;r++) {
+        lua_pushnumber(L, gw2_static->map_rect[r][m]);      lua_setfield(L, -2, rect_fields[r]);
+        lua_pushnumber(L, gw2_static->map_cont_rect[r][m]); lua_setfield(L, -2, cont_rect_fields[r]);
+    }
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: mapids()
+
+    Return a sequence of all map ids in the snapshot.
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int gw2_static_lua_mapids(lua_State *L) {
+    if (!gw2_static) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_createtable(L, (int)gw2_static->map_count, 0);
+    for (uint32_t m=0;m<gw2_static->map_count;m++) {
+        lua_pushinteger(L, gw2_static->map_id[m]);
+        lua_rawseti(L, -2, m + 1);
+    }
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: mappois(map[, type])
+
+    Return the POIs of the given map as a sequence of tables, optionally
+    filtered by ``type`` (``'waypoint'``, ``'landmark'``, ``'vista'``, or
+    ``'unlock'``).
+
+    Each row has ``id``, ``map``, ``name``, ``type``, ``floor``, ``x``,
+    ``y``, ``chat_link``, and ``icon`` fields.
+
+    :param integer map:
+    :param string type: (Optional)
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int gw2_static_lua_mappois(lua_State *L) {
+    int32_t mapid = (int32_t)luaL_checkinteger(L, 1);
+    const char *type = luaL_optstring(L, 2, NULL);
+
+    if (!gw2_static) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    int64_t first = gw2_static_lower_bound(gw2_static->poi_map, gw2_static->poi_count, mapid);
+
+    lua_newtable(L);
+    int n = 0;
+
+    for (int64_t i=first;i<gw2_static->poi_count && gw2_static->poi_map[i]==mapid;i++) {
+        if (type) {
+            uint32_t toff = gw2_static->poi_type[i];
+            if (toff==0 || toff>=gw2_static->strings_size) continue;
+            if (strcmp(gw2_static->strings + toff, type)!=0) continue;
+        }
+
+        lua_newtable(L);
+        lua_pushinteger(L, gw2_static->poi_id[i]);              lua_setfield(L, -2, "id");
+        lua_pushinteger(L, gw2_static->poi_map[i]);             lua_setfield(L, -2, "map");
+        lua_pushinteger(L, gw2_static->poi_floor[i]);           lua_setfield(L, -2, "floor");
+        gw2_static_push_string(L, gw2_static->poi_type[i]);      lua_setfield(L, -2, "type");
+        gw2_static_push_string(L, gw2_static->poi_name[i]);      lua_setfield(L, -2, "name");
+        gw2_static_push_string(L, gw2_static->poi_chat_link[i]); lua_setfield(L, -2, "chat_link");
+        gw2_static_push_string(L, gw2_static->poi_icon[i]);      lua_setfield(L, -2, "icon");
+        lua_pushnumber(L, gw2_static->poi_x[i]);                lua_setfield(L, -2, "x");
+        lua_pushnumber(L, gw2_static->poi_y[i]);                lua_setfield(L, -2, "y");
+        lua_rawseti(L, -2, ++n);
+    }
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: mapsectors(map)
+
+    Return the sectors of the given map as a sequence of tables with ``id``,
+    ``map``, ``name``, ``level``, ``x``, and ``y`` fields.
+
+    :param integer map:
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int gw2_static_lua_mapsectors(lua_State *L) {
+    int32_t mapid = (int32_t)luaL_checkinteger(L, 1);
+
+    if (!gw2_static) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    int64_t first = gw2_static_lower_bound(gw2_static->sector_map, gw2_static->sector_count, mapid);
+
+    lua_newtable(L);
+    int n = 0;
+
+    for (int64_t i=first;i<gw2_static->sector_count && gw2_static->sector_map[i]==mapid;i++) {
+        lua_newtable(L);
+        lua_pushinteger(L, gw2_static->sector_id[i]);         lua_setfield(L, -2, "id");
+        lua_pushinteger(L, gw2_static->sector_map[i]);        lua_setfield(L, -2, "map");
+        lua_pushinteger(L, gw2_static->sector_level[i]);      lua_setfield(L, -2, "level");
+        gw2_static_push_string(L, gw2_static->sector_name[i]); lua_setfield(L, -2, "name");
+        lua_pushnumber(L, gw2_static->sector_x[i]);           lua_setfield(L, -2, "x");
+        lua_pushnumber(L, gw2_static->sector_y[i]);           lua_setfield(L, -2, "y");
+        lua_rawseti(L, -2, ++n);
+    }
+
+    return 1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Memory mapped access to the compiled static game data snapshot
+// (data/gw2/gw2-static.dat, written by scripts/compilestaticdata.lua).
+
+void gw2_static_lua_init();
+void gw2_static_cleanup();
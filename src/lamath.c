@@ -2,6 +2,13 @@
 #include "lamath.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+
+// SSE2 is baseline on x64; the hot matrix kernels below use it with a
+// scalar fallback for other targets
+#if defined(_M_X64) || defined(__SSE2__)
+#define LAMATH_SSE2 1
+#include <emmintrin.h>
+#endif
 #include <lauxlib.h>
 
 void mat4f_ortho(mat4f_t *m, float left, float right, float top, float bottom, float near_, float far_) {
@@ -85,10 +92,13 @@ void mat4f_perpsective_lh(mat4f_t *m, float fovy, float aspect, float near_, flo
     m->i3j2 = 0.f;
     m->i4j2 = 0.f;
 
+    // reverse-Z with a [0,1] clip range (glClipControl ZERO_TO_ONE): depth
+    // lands at 1 on the near plane and 0 on the far plane, which puts the
+    // float precision where the scene actually is
     m->i1j3 = 0.f;
     m->i2j3 = 0.f;
-    m->i3j3 = (far_ + near_) / (near_ - far_);
-    m->i4j3 = -(2 * far_ * near_) / (near_ - far_);
+    m->i3j3 = near_ / (near_ - far_);
+    m->i4j3 = (near_ * far_) / (far_ - near_);
 
     m->i1j4 = 0.f;
     m->i2j4 = 0.f;
@@ -258,6 +268,25 @@ void mat4f_inverse(mat4f_t *m, mat4f_t *out) {
 }
 
 void mat4f_mult_mat4f(mat4f_t *a, mat4f_t *b, mat4f_t *out) {
+#ifdef LAMATH_SSE2
+    // each output row is a linear combination of b's rows weighted by a's row
+    const float *af = (const float*)a;
+    const float *bf = (const float*)b;
+    float *of = (float*)out;
+
+    __m128 brow0 = _mm_loadu_ps(bf);
+    __m128 brow1 = _mm_loadu_ps(bf + 4);
+    __m128 brow2 = _mm_loadu_ps(bf + 8);
+    __m128 brow3 = _mm_loadu_ps(bf + 12);
+
+    for (int i=0;i<4;i++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(af[i*4 + 0]), brow0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(af[i*4 + 1]), brow1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(af[i*4 + 2]), brow2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(af[i*4 + 3]), brow3));
+        _mm_storeu_ps(of + i*4, r);
+    }
+#else
     out->i1j1 = a->i1j1 * b->i1j1 + a->i1j2 * b->i2j1 + a->i1j3 * b->i3j1 + a->i1j4 * b->i4j1;
     out->i2j1 = a->i2j1 * b->i1j1 + a->i2j2 * b->i2j1 + a->i2j3 * b->i3j1 + a->i2j4 * b->i4j1;
     out->i3j1 = a->i3j1 * b->i1j1 + a->i3j2 * b->i2j1 + a->i3j3 * b->i3j1 + a->i3j4 * b->i4j1;
@@ -277,13 +306,139 @@ void mat4f_mult_mat4f(mat4f_t *a, mat4f_t *b, mat4f_t *out) {
     out->i2j4 = a->i2j1 * b->i1j4 + a->i2j2 * b->i2j4 + a->i2j3 * b->i3j4 + a->i2j4 * b->i4j4;
     out->i3j4 = a->i3j1 * b->i1j4 + a->i3j2 * b->i2j4 + a->i3j3 * b->i3j4 + a->i3j4 * b->i4j4;
     out->i4j4 = a->i4j1 * b->i1j4 + a->i4j2 * b->i2j4 + a->i4j3 * b->i3j4 + a->i4j4 * b->i4j4;
+#endif
 }
 
 void mat4f_mult_vec4f(mat4f_t *a, vec4f_t *b, vec4f_t *out) {
+#ifdef LAMATH_SSE2
+    const float *af = (const float*)a;
+
+    __m128 r = _mm_mul_ps(_mm_set1_ps(b->x), _mm_loadu_ps(af));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b->y), _mm_loadu_ps(af + 4)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b->z), _mm_loadu_ps(af + 8)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b->w), _mm_loadu_ps(af + 12)));
+
+    _mm_storeu_ps((float*)out, r);
+#else
     out->x = (b->x * a->i1j1) + (b->y * a->i2j1) + (b->z * a->i3j1) + (b->w * a->i4j1);
     out->y = (b->x * a->i1j2) + (b->y * a->i2j2) + (b->z * a->i3j2) + (b->w * a->i4j2);
     out->z = (b->x * a->i1j3) + (b->y * a->i2j3) + (b->z * a->i3j3) + (b->w * a->i4j3);
     out->w = (b->x * a->i1j4) + (b->y * a->i2j4) + (b->z * a->i3j4) + (b->w * a->i4j4);
+#endif
+}
+
+// Extract the six frustum planes (left, right, bottom, top, near, far)
+// from a combined view*projection matrix, normalized, in the repo's
+// row-vector convention: a point is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0.
+//
+// The scene renders with glClipControl(GL_ZERO_TO_ONE) and a reverse-Z
+// projection, so the clip-space z range is [0, w] with z = w at the near
+// plane and z = 0 at the far plane: the z >= 0 boundary (the z column
+// alone) is the far plane and the z <= w boundary (col4 - col3) is the
+// near plane — not the [-1, 1] sums the classic extraction uses.
+void mat4f_frustum_planes(mat4f_t *viewproj, frustum_t *out) {
+    vec4f_t col1 = { viewproj->i1j1, viewproj->i2j1, viewproj->i3j1, viewproj->i4j1 };
+    vec4f_t col2 = { viewproj->i1j2, viewproj->i2j2, viewproj->i3j2, viewproj->i4j2 };
+    vec4f_t col3 = { viewproj->i1j3, viewproj->i2j3, viewproj->i3j3, viewproj->i4j3 };
+    vec4f_t col4 = { viewproj->i1j4, viewproj->i2j4, viewproj->i3j4, viewproj->i4j4 };
+
+    out->planes[0] = (vec4f_t){ col4.x + col1.x, col4.y + col1.y, col4.z + col1.z, col4.w + col1.w }; // left
+    out->planes[1] = (vec4f_t){ col4.x - col1.x, col4.y - col1.y, col4.z - col1.z, col4.w - col1.w }; // right
+    out->planes[2] = (vec4f_t){ col4.x + col2.x, col4.y + col2.y, col4.z + col2.z, col4.w + col2.w }; // bottom
+    out->planes[3] = (vec4f_t){ col4.x - col2.x, col4.y - col2.y, col4.z - col2.z, col4.w - col2.w }; // top
+    out->planes[4] = (vec4f_t){ col4.x - col3.x, col4.y - col3.y, col4.z - col3.z, col4.w - col3.w }; // near (z <= w)
+    out->planes[5] = (vec4f_t){ col3.x, col3.y, col3.z, col3.w };                                     // far (z >= 0)
+
+    for (int p=0;p<6;p++) {
+        vec3f_t n = { out->planes[p].x, out->planes[p].y, out->planes[p].z };
+        float len = vec3f_length(&n);
+
+        if (len==0.f) continue;
+
+        out->planes[p].x /= len;
+        out->planes[p].y /= len;
+        out->planes[p].z /= len;
+        out->planes[p].w /= len;
+    }
+}
+
+// Batch AABB visibility: results[i] = 1 when box i intersects the frustum.
+// The p-vertex test picks the corner most along each plane normal; a box is
+// out as soon as that corner is behind a plane. Planes stay in registers
+// across the whole batch (the per-box work is branchy selects, which is why
+// this is a hoisted scalar loop rather than SSE lanes).
+void frustum_test_aabbs(frustum_t *frustum, const aabb_t *boxes, uint8_t *results, size_t count) {
+    for (size_t b=0;b<count;b++) {
+        const aabb_t *box = &boxes[b];
+        uint8_t visible = 1;
+
+        for (int p=0;p<6;p++) {
+            const vec4f_t *plane = &frustum->planes[p];
+
+            float px = plane->x >= 0.f ? box->max.x : box->min.x;
+            float py = plane->y >= 0.f ? box->max.y : box->min.y;
+            float pz = plane->z >= 0.f ? box->max.z : box->min.z;
+
+            if (plane->x * px + plane->y * py + plane->z * pz + plane->w < 0.f) {
+                visible = 0;
+                break;
+            }
+        }
+
+        results[b] = visible;
+    }
+}
+
+// Scale and offset an interleaved x,y array in place: out = in * scale +
+// offset per component. Two points per SSE op; used for batch continent to
+// screen transforms.
+void vec2f_scale_offset_array(float *xy, size_t count, float sx, float sy, float ox, float oy) {
+#ifdef LAMATH_SSE2
+    __m128 scale  = _mm_set_ps(sy, sx, sy, sx);
+    __m128 offset = _mm_set_ps(oy, ox, oy, ox);
+
+    size_t pairs = count / 2;
+    for (size_t i=0;i<pairs;i++) {
+        __m128 v = _mm_loadu_ps(xy + i * 4);
+        _mm_storeu_ps(xy + i * 4, _mm_add_ps(_mm_mul_ps(v, scale), offset));
+    }
+
+    for (size_t i=pairs*2;i<count;i++) {
+        xy[i*2]     = xy[i*2]     * sx + ox;
+        xy[i*2 + 1] = xy[i*2 + 1] * sy + oy;
+    }
+#else
+    for (size_t i=0;i<count;i++) {
+        xy[i*2]     = xy[i*2]     * sx + ox;
+        xy[i*2 + 1] = xy[i*2 + 1] * sy + oy;
+    }
+#endif
+}
+
+// Transform a whole coordinate array; the matrix rows stay in registers
+// across elements, which is the win over calling mat4f_mult_vec4f in a loop.
+void mat4f_mult_vec4f_array(mat4f_t *a, vec4f_t *in, vec4f_t *out, size_t count) {
+#ifdef LAMATH_SSE2
+    const float *af = (const float*)a;
+
+    __m128 row0 = _mm_loadu_ps(af);
+    __m128 row1 = _mm_loadu_ps(af + 4);
+    __m128 row2 = _mm_loadu_ps(af + 8);
+    __m128 row3 = _mm_loadu_ps(af + 12);
+
+    for (size_t i=0;i<count;i++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(in[i].x), row0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[i].y), row1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[i].z), row2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in[i].w), row3));
+        _mm_storeu_ps((float*)&out[i], r);
+    }
+#else
+    for (size_t i=0;i<count;i++) {
+        mat4f_mult_vec4f(a, &in[i], &out[i]);
+    }
+#endif
 }
 
 static void mat4f_register_metatable(lua_State *L) {
@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 
 typedef struct {
     float i1j1;
@@ -112,6 +113,24 @@ void mat4f_camera_facing(mat4f_t *m, vec3f_t *camera, vec3f_t *forward, vec3f_t
 void mat4f_mult_mat4f(mat4f_t *a, mat4f_t *b, mat4f_t *out);
 void mat4f_mult_vec4f(mat4f_t *a, vec4f_t *b, vec4f_t *out);
 
+// transform count vectors at once; much cheaper than per-vector calls for
+// coordinate arrays (trail transforms, batch continent conversions)
+void mat4f_mult_vec4f_array(mat4f_t *a, vec4f_t *in, vec4f_t *out, size_t count);
+void vec2f_scale_offset_array(float *xy, size_t count, float sx, float sy, float ox, float oy);
+
+// six normalized frustum planes; inside when dot(plane.xyz, p) + plane.w >= 0
+typedef struct {
+    vec4f_t planes[6];
+} frustum_t;
+
+typedef struct {
+    vec3f_t min;
+    vec3f_t max;
+} aabb_t;
+
+void mat4f_frustum_planes(mat4f_t *viewproj, frustum_t *out);
+void frustum_test_aabbs(frustum_t *frustum, const aabb_t *boxes, uint8_t *results, size_t count);
+
 void mat4f_rotatex(mat4f_t *m, float radians);
 void mat4f_rotatey(mat4f_t *m, float radians);
 void mat4f_rotatez(mat4f_t *m, float radians);
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <share.h>
+#include "binary-sink.h"
+#include "logger.h"
+#include "../utils.h"
+
+// Binary log format: 'EGBL' then records. Logger names are interned as they
+// first appear:
+//   type 1 (name): u8 type, u16 id, u8 len, name bytes
+//   type 2 (message): u8 type, u16 logger id, u8 level, i64 time,
+//                     u16 milliseconds, u32 len, message bytes
+// Records are written whole by the single logging thread. Text rendering is
+// deferred to the reader (scripts/renderlog.lua), so a record that nobody
+// ever reads costs a couple of memcpys instead of strftime/snprintf.
+
+#define BINARY_SINK_MAGIC "EGBL"
+#define BINARY_SINK_MAX_NAMES 128
+
+typedef struct log_binary_sink_t {
+    log_sink_t sink;
+
+    char *path;
+    FILE *f;
+    size_t written;
+    size_t max_size;
+
+    char *names[BINARY_SINK_MAX_NAMES];
+    uint16_t name_count;
+} log_binary_sink_t;
+
+static void log_binary_sink_open(log_binary_sink_t *sink) {
+    sink->f = _fsopen(sink->path, "wb", _SH_DENYWR);
+    sink->written = 0;
+
+    // the intern table restarts with the file so every log file is
+    // self contained
+    for (uint16_t n=0;n<sink->name_count;n++) {
+        egoverlay_free(sink->names[n]);
+        sink->names[n] = NULL;
+    }
+    sink->name_count = 0;
+
+    if (sink->f) {
+        fwrite(BINARY_SINK_MAGIC, 1, 4, sink->f);
+        sink->written = 4;
+    }
+}
+
+static void log_binary_sink_rotate(log_binary_sink_t *sink) {
+    fclose(sink->f);
+    sink->f = NULL;
+
+    size_t rotlen = strlen(sink->path) + 3;
+    char *rotated = egoverlay_calloc(rotlen, sizeof(char));
+    snprintf(rotated, rotlen, "%s.1", sink->path);
+
+    remove(rotated);
+    rename(sink->path, rotated);
+    egoverlay_free(rotated);
+
+    log_binary_sink_open(sink);
+}
+
+static uint16_t log_binary_sink_intern(log_binary_sink_t *sink, const char *name) {
+    for (uint16_t n=0;n<sink->name_count;n++) {
+        if (strcmp(sink->names[n], name)==0) return n;
+    }
+
+    uint16_t id = sink->name_count;
+    if (id==BINARY_SINK_MAX_NAMES) return BINARY_SINK_MAX_NAMES - 1;
+
+    sink->names[id] = egoverlay_calloc(strlen(name)+1, sizeof(char));
+    memcpy(sink->names[id], name, strlen(name));
+    sink->name_count++;
+
+    uint8_t type = 1;
+    uint8_t len = (uint8_t)(strlen(name) > 255 ? 255 : strlen(name));
+    fwrite(&type, 1, 1, sink->f);
+    fwrite(&id, 2, 1, sink->f);
+    fwrite(&len, 1, 1, sink->f);
+    fwrite(name, 1, len, sink->f);
+    sink->written += 4 + len;
+
+    return id;
+}
+
+void log_binary_sink_write_record(
+    log_binary_sink_t *sink,
+    enum LOGGER_LEVEL level,
+    const char *logger_name,
+    struct _timeb *tb,
+    const char *message
+) {
+    if (!sink->f) return;
+
+    uint16_t id = log_binary_sink_intern(sink, logger_name);
+
+    uint8_t type = 2;
+    uint8_t lvl = (uint8_t)level;
+    int64_t t = (int64_t)tb->time;
+    uint16_t ms = tb->millitm;
+    uint32_t len = (uint32_t)strlen(message);
+
+    fwrite(&type, 1, 1, sink->f);
+    fwrite(&id, 2, 1, sink->f);
+    fwrite(&lvl, 1, 1, sink->f);
+    fwrite(&t, 8, 1, sink->f);
+    fwrite(&ms, 2, 1, sink->f);
+    fwrite(&len, 4, 1, sink->f);
+    fwrite(message, 1, len, sink->f);
+    sink->written += 18 + len;
+
+    if (level==LOGGER_LEVEL_WARNING || level==LOGGER_LEVEL_ERROR) fflush(sink->f);
+
+    if (sink->max_size && sink->written >= sink->max_size) {
+        log_binary_sink_rotate(sink);
+    }
+}
+
+// text write entry point is never used (write_record takes precedence), but
+// the interface requires one
+void log_binary_sink_write(log_binary_sink_t *sink, enum LOGGER_LEVEL level, const char *message) {
+    UNUSED_PARAM(sink);
+    UNUSED_PARAM(level);
+    UNUSED_PARAM(message);
+}
+
+void log_binary_sink_free(log_binary_sink_t *sink) {
+    if (sink->f) fclose(sink->f);
+    for (uint16_t n=0;n<sink->name_count;n++) egoverlay_free(sink->names[n]);
+    egoverlay_free(sink->path);
+    egoverlay_free(sink);
+}
+
+// sinks are cloned when loggers inherit them; clones are thin wrappers that
+// forward to the original so the file, intern table, and rotation state stay
+// shared (records from every logger land in one file, like file-sink)
+typedef struct {
+    log_sink_t sink;
+    log_binary_sink_t *origin;
+} log_binary_sink_clone_t;
+
+static void log_binary_sink_clone_write_record(
+    log_binary_sink_clone_t *clone,
+    enum LOGGER_LEVEL level,
+    const char *logger_name,
+    struct _timeb *tb,
+    const char *message
+) {
+    log_binary_sink_write_record(clone->origin, level, logger_name, tb, message);
+}
+
+static void log_binary_sink_clone_free(log_binary_sink_clone_t *clone) {
+    egoverlay_free(clone);
+}
+
+log_sink_t *log_binary_sink_clone(log_binary_sink_t *sink);
+
+static log_sink_t *log_binary_sink_clone_clone(log_binary_sink_clone_t *clone) {
+    return log_binary_sink_clone(clone->origin);
+}
+
+log_sink_t *log_binary_sink_clone(log_binary_sink_t *sink) {
+    log_binary_sink_clone_t *clone = egoverlay_calloc(1, sizeof(log_binary_sink_clone_t));
+
+    clone->sink.free = (log_sink_free_fn*)&log_binary_sink_clone_free;
+    clone->sink.clone = (log_sink_clone_fn*)&log_binary_sink_clone_clone;
+    clone->sink.write = (log_sink_write_fn*)&log_binary_sink_write;
+    clone->sink.write_record = (log_sink_write_record_fn*)&log_binary_sink_clone_write_record;
+    clone->origin = sink;
+
+    return (log_sink_t*)clone;
+}
+
+log_sink_t *log_binary_sink_new(const char *path, size_t max_size) {
+    log_binary_sink_t *sink = egoverlay_calloc(1, sizeof(log_binary_sink_t));
+
+    sink->sink.free = (log_sink_free_fn*)&log_binary_sink_free;
+    sink->sink.clone = (log_sink_clone_fn*)&log_binary_sink_clone;
+    sink->sink.write = (log_sink_write_fn*)&log_binary_sink_write;
+    sink->sink.write_record = (log_sink_write_record_fn*)&log_binary_sink_write_record;
+
+    sink->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(sink->path, path, strlen(path));
+    sink->max_size = max_size;
+
+    log_binary_sink_open(sink);
+
+    if (!sink->f) {
+        log_binary_sink_free(sink);
+        return NULL;
+    }
+
+    return (log_sink_t*)sink;
+}
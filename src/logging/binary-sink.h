@@ -0,0 +1,6 @@
+#pragma once
+#include "sink.h"
+
+// Structured binary log sink: fixed-header records with interned logger
+// names, rotated by size. Render to text with scripts/renderlog.lua.
+log_sink_t *log_binary_sink_new(const char *path, size_t max_size);
@@ -27,6 +27,10 @@ log_sink_t *log_event_sink_new() {
 
 void log_event_sink_write(log_sink_t *sink,  enum LOGGER_LEVEL level, const char *message) {
     (void)sink; // no warning
+    // building and queueing the payload costs a json object per log line;
+    // skip it entirely when nothing is listening (console closed)
+    if (!lua_manager_has_event_handlers("log-message")) return;
+
     json_t *data = json_object();
     json_t *msg = json_string(message);
     json_t *lvl = json_string(logger_level_to_str(level));
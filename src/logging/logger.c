@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <windows.h>
 #include "logger.h"
 #include "../utils.h"
 
@@ -17,6 +18,10 @@ struct logger_t {
     enum LOGGER_LEVEL level;
     struct sink_list_node *sinks;
     const char *name;
+
+    // the most verbose level any attached sink accepts, cached so disabled
+    // statements cost one comparison before any formatting happens
+    enum LOGGER_LEVEL max_sink_level;
 };
 
 #define LOGGER_HASHMAP_SIZE 250
@@ -28,13 +33,162 @@ struct logging_s {
 
 struct logging_s *logging = NULL;
 
+static void logger_flush_duplicates();
+
+// Per-callsite token bucket rate limiting. The format string pointer is a
+// stable callsite identity (they're string literals), so a misbehaving loop
+// hammering one statement gets clamped without slowing anything else down.
+// Checked before any formatting, under a slim lock since producers log from
+// several threads.
+#define RL_SLOTS 64
+#define RL_BURST 20.0
+#define RL_REFILL_PER_SEC 5.0
+
+struct rl_slot {
+    const char *fmt;
+    double tokens;
+    uint64_t last_ms;
+    uint32_t dropped;
+};
+
+static struct rl_slot rl_slots[RL_SLOTS];
+static CRITICAL_SECTION rl_cs;
+static int rl_cs_init = 0;
+
+// returns 0 when the message should be dropped. when a previously throttled
+// callsite recovers, *suppressed receives how many messages were dropped so
+// the caller can log a note
+static int logger_rate_limit_allow(const char *fmt, uint32_t *suppressed) {
+    *suppressed = 0;
+
+    if (!rl_cs_init) return 1;
+
+    uint64_t now = GetTickCount64();
+
+    EnterCriticalSection(&rl_cs);
+
+    size_t ind = (((uintptr_t)fmt) >> 4) % RL_SLOTS;
+    struct rl_slot *slot = &rl_slots[ind];
+
+    if (slot->fmt!=fmt) {
+        // collision or first use: the bucket restarts. worst case two hot
+        // callsites sharing a slot throttle a little early
+        slot->fmt = fmt;
+        slot->tokens = RL_BURST;
+        slot->last_ms = now;
+        slot->dropped = 0;
+    }
+
+    slot->tokens += (double)(now - slot->last_ms) / 1000.0 * RL_REFILL_PER_SEC;
+    if (slot->tokens > RL_BURST) slot->tokens = RL_BURST;
+    slot->last_ms = now;
+
+    int allow = slot->tokens >= 1.0;
+    if (allow) {
+        slot->tokens -= 1.0;
+        *suppressed = slot->dropped;
+        slot->dropped = 0;
+    } else {
+        slot->dropped++;
+    }
+
+    LeaveCriticalSection(&rl_cs);
+
+    return allow;
+}
+
+// Asynchronous logging: producers format only their message text (varargs
+// can't cross threads) and push an entry onto a lock-free SList; a
+// background thread assembles the final line (timestamp, logger name,
+// level) and runs the sink I/O. Callers never block on file writes or
+// console output. Entries are 16 byte aligned as SList requires.
+typedef struct log_entry_t {
+    SLIST_ENTRY entry;
+    logger_t *log;
+    enum LOGGER_LEVEL level;
+    struct _timeb tb;
+    char msg[];
+} log_entry_t;
+
+static SLIST_HEADER log_queue;
+static HANDLE log_thread = NULL;
+static int log_thread_stop = 0;
+
+static void logger_write_entry(log_entry_t *e);
+
+static DWORD WINAPI logger_thread_fn(LPVOID param) {
+    UNUSED_PARAM(param);
+
+    while (!log_thread_stop) {
+        PSLIST_ENTRY entries = InterlockedFlushSList(&log_queue);
+
+        if (!entries) {
+            Sleep(5);
+            continue;
+        }
+
+        // the SList is LIFO, reverse to write in submission order
+        PSLIST_ENTRY reversed = NULL;
+        while (entries) {
+            PSLIST_ENTRY next = entries->Next;
+            entries->Next = reversed;
+            reversed = entries;
+            entries = next;
+        }
+
+        while (reversed) {
+            log_entry_t *e = (log_entry_t*)reversed;
+            reversed = reversed->Next;
+
+            logger_write_entry(e);
+            _aligned_free(e);
+        }
+    }
+
+    return 0;
+}
+
 void logger_init() {
+    InitializeCriticalSection(&rl_cs);
+    rl_cs_init = 1;
+
     logging = egoverlay_calloc(1, sizeof(struct logging_s));
     logging->hash_map = egoverlay_calloc(LOGGER_HASHMAP_SIZE, sizeof(char *));
     logging->loggers = egoverlay_calloc(LOGGER_HASHMAP_SIZE, sizeof(logger_t *));
+
+    InitializeSListHead(&log_queue);
+
+    DWORD tid = 0;
+    log_thread = CreateThread(0, 0, &logger_thread_fn, NULL, 0, &tid);
 }
 
 void logger_cleanup() {
+    if (log_thread) {
+        log_thread_stop = 1;
+        WaitForSingleObject(log_thread, INFINITE);
+        CloseHandle(log_thread);
+        log_thread = NULL;
+
+        // drain anything still queued
+        PSLIST_ENTRY entries = InterlockedFlushSList(&log_queue);
+        PSLIST_ENTRY reversed = NULL;
+        while (entries) {
+            PSLIST_ENTRY next = entries->Next;
+            entries->Next = reversed;
+            reversed = entries;
+            entries = next;
+        }
+        while (reversed) {
+            log_entry_t *e = (log_entry_t*)reversed;
+            reversed = reversed->Next;
+            logger_write_entry(e);
+            _aligned_free(e);
+        }
+    }
+
+    // a trailing run of duplicates still owes its repeat note
+    logger_flush_duplicates();
+
     for (size_t h=0;h<LOGGER_HASHMAP_SIZE;h++) {
         if (logging->hash_map[h]) {
             logger_free(logging->loggers[h]);
@@ -81,6 +235,7 @@ logger_t *logger_get(const char *name) {
     struct sink_list_node *s = logging->default_logger->sinks;
     while (s) {
         log_sink_t *sink = log_sink_clone(s->sink);
+        sink->level = s->sink->level; // clones keep the original's filter
         logger_add_sink(new_logger, sink);
         s = s->next;
     }
@@ -151,50 +306,164 @@ enum LOGGER_LEVEL logger_str_to_level(const char *level) {
     return LOGGER_LEVEL_NONE;
 }
 
+// runs on the logging thread (or synchronously before it starts): build
+// the final line and hand it to the sinks
+// consecutive duplicate collapsing, syslog style: identical back to back
+// messages are counted and reported once as "last message repeated N times".
+// only touched on the logging thread (or synchronously before it starts)
+static char dup_msg[256];
+static logger_t *dup_log = NULL;
+static enum LOGGER_LEVEL dup_level;
+static int dup_count = 0;
+
+static void logger_write_sinks(log_entry_t *e);
+
+static void logger_flush_duplicates() {
+    if (dup_count==0) return;
+
+    int count = dup_count;
+    dup_count = 0;
+
+    log_entry_t *note = _aligned_malloc(sizeof(log_entry_t) + 64, MEMORY_ALLOCATION_ALIGNMENT);
+    if (!note) return;
+
+    note->log = dup_log;
+    note->level = dup_level;
+    _ftime_s(&note->tb);
+    snprintf(note->msg, 64, "last message repeated %d times", count);
+
+    logger_write_sinks(note);
+    _aligned_free(note);
+}
+
+static void logger_write_entry(log_entry_t *e) {
+    if (e->log==dup_log && e->level==dup_level && strncmp(e->msg, dup_msg, sizeof(dup_msg)-1)==0) {
+        dup_count++;
+        return;
+    }
+
+    logger_flush_duplicates();
+
+    dup_log = e->log;
+    dup_level = e->level;
+    strncpy_s(dup_msg, sizeof(dup_msg), e->msg, _TRUNCATE);
+
+    logger_write_sinks(e);
+}
+
+static void logger_write_sinks(log_entry_t *e) {
+    // the formatted line is only built if a text sink needs it; structured
+    // sinks take the raw record, which keeps debug level logging cheap
+    char *outbuf = NULL;
+
+    struct sink_list_node *s = e->log->sinks;
+    while (s) {
+        if (s->sink->level!=LOGGER_LEVEL_NONE && e->level > s->sink->level) {
+            s = s->next;
+            continue;
+        }
+
+        if (s->sink->write_record) {
+            s->sink->write_record(s->sink, e->level, e->log->name, &e->tb, e->msg);
+            s = s->next;
+            continue;
+        }
+
+        if (!outbuf) {
+            struct tm *tmp = localtime(&e->tb.time);
+            char timebuf[24];
+            strftime(timebuf, 24, "%Y-%m-%d %T", tmp);
+
+            const char *level_str = logger_level_to_str(e->level);
+
+            size_t outlen = snprintf(NULL, 0, "%s.%03d | % -20s | % -7s | %s",
+                                     timebuf, e->tb.millitm, e->log->name, level_str, e->msg) + 1;
+            outbuf = egoverlay_calloc(outlen, sizeof(char));
+            snprintf(outbuf, outlen, "%s.%03d | % -20s | % -7s | %s",
+                     timebuf, e->tb.millitm, e->log->name, level_str, e->msg);
+        }
+
+        log_sink_write(s->sink, e->level, outbuf);
+        s = s->next;
+    }
+
+    if (outbuf) egoverlay_free(outbuf);
+}
+
+static void logger_push_text(logger_t *log, enum LOGGER_LEVEL level, const char *text);
+
 void logger_log(logger_t *log, enum LOGGER_LEVEL level, const char *message, ...) {
     if (level > log->level) return;
+    // no attached sink wants this level; skip formatting entirely
+    if (log->sinks && level > log->max_sink_level) return;
+
+    uint32_t suppressed = 0;
+    if (!logger_rate_limit_allow(message, &suppressed)) return;
+
+    if (suppressed) {
+        char note[80];
+        snprintf(note, sizeof(note), "(%u similar messages suppressed)", suppressed);
+        logger_push_text(log, level, note);
+    }
 
-    char *msgbuf;
     size_t msglen = 0;
 
-    // first figure out how long the formatted message will be
+    // the message is formatted here since varargs can't cross threads
     va_list args;
     va_start(args, message);
     msglen = vsnprintf(NULL, 0, message, args) + 1;
     va_end(args);
 
-    // now allocate it and do the actual format
-    msgbuf = egoverlay_calloc(msglen, sizeof(char));
-    
+    log_entry_t *e = _aligned_malloc(sizeof(log_entry_t) + msglen, MEMORY_ALLOCATION_ALIGNMENT);
+    if (!e) return;
+
+    e->log = log;
+    e->level = level;
+    _ftime_s(&e->tb);
+
     va_start(args, message);
-    vsnprintf(msgbuf, msglen, message, args);
+    vsnprintf(e->msg, msglen, message, args);
     va_end(args);
 
-    struct _timeb tb;
-    _ftime_s(&tb);
-    struct tm *tmp = localtime(&tb.time);
-    char timebuf[24];
-    strftime(timebuf, 24, "%Y-%m-%d %T", tmp);
+    if (log_thread) {
+        InterlockedPushEntrySList(&log_queue, &e->entry);
+    } else {
+        // before (or after) the logging thread exists, write synchronously
+        logger_write_entry(e);
+        _aligned_free(e);
+    }
+}
 
-    const char *level_str = logger_level_to_str(level);
+static void logger_update_max_sink_level(logger_t *log) {
+    enum LOGGER_LEVEL max = LOGGER_LEVEL_NONE;
 
-    char *outbuf;
-    size_t outlen = 0;
-    outlen = snprintf(NULL, 0, "%s.%03d | % -20s | % -7s | %s",
-                      timebuf, tb.millitm, log->name, level_str, msgbuf) + 1;
-    outbuf = egoverlay_calloc(outlen, sizeof(char));
-    snprintf(outbuf, outlen, "%s.%03d | % -20s | % -7s | %s",
-             timebuf, tb.millitm, log->name, level_str, msgbuf);
+    for (struct sink_list_node *s=log->sinks;s;s=s->next) {
+        // NONE means the sink has no filter and accepts everything
+        enum LOGGER_LEVEL lvl = s->sink->level==LOGGER_LEVEL_NONE ? LOGGER_LEVEL_DEBUG : s->sink->level;
+        if (lvl > max) max = lvl;
+    }
 
-    egoverlay_free(msgbuf);
+    log->max_sink_level = max;
+}
 
-    struct sink_list_node *s = log->sinks;
-    while (s) {
-        log_sink_write(s->sink, level, outbuf);
-        s = s->next;
-    }
+// queue an already formatted message, used for the throttling notes
+static void logger_push_text(logger_t *log, enum LOGGER_LEVEL level, const char *text) {
+    size_t msglen = strlen(text) + 1;
+
+    log_entry_t *e = _aligned_malloc(sizeof(log_entry_t) + msglen, MEMORY_ALLOCATION_ALIGNMENT);
+    if (!e) return;
+
+    e->log = log;
+    e->level = level;
+    _ftime_s(&e->tb);
+    memcpy(e->msg, text, msglen);
 
-    egoverlay_free(outbuf);
+    if (log_thread) {
+        InterlockedPushEntrySList(&log_queue, &e->entry);
+    } else {
+        logger_write_entry(e);
+        _aligned_free(e);
+    }
 }
 
 void logger_add_sink(logger_t *log, log_sink_t *sink) {
@@ -204,12 +473,13 @@ void logger_add_sink(logger_t *log, log_sink_t *sink) {
 
     if (log->sinks==NULL) {
         log->sinks = node;
-        return;
-    }
+    } else {
+        struct sink_list_node *s = log->sinks;
+        while (s->next) s = s->next;
 
-    struct sink_list_node *s = log->sinks;
-    while (s->next) s = s->next;
+        s->next = node;
+    }
 
-    s->next = node;
+    logger_update_max_sink_level(log);
 }
 
@@ -8,6 +8,10 @@ void log_sink_free(log_sink_t *sink) {
     else egoverlay_free(sink);
 }
 
+void log_sink_set_level(log_sink_t *sink, enum LOGGER_LEVEL level) {
+    sink->level = level;
+}
+
 void log_sink_write(log_sink_t *sink, enum LOGGER_LEVEL level, const char *message) {
     sink->write(sink, level, message);
 }
@@ -1,18 +1,35 @@
 #pragma once
+#include <sys/timeb.h>
+
 enum LOGGER_LEVEL;
 
 typedef struct log_sink_t log_sink_t;
 
 typedef void log_sink_free_fn(log_sink_t *sink);
 typedef void log_sink_write_fn(log_sink_t *sink, enum LOGGER_LEVEL level, const char *message);
+// optional: sinks that store structured records take the raw entry instead
+// of the formatted line, so the line is only ever built for text sinks
+typedef void log_sink_write_record_fn(
+    log_sink_t *sink,
+    enum LOGGER_LEVEL level,
+    const char *logger_name,
+    struct _timeb *tb,
+    const char *message
+);
 typedef log_sink_t *log_sink_clone_fn(log_sink_t *sink);
 
 struct log_sink_t {
     log_sink_free_fn *free;
     log_sink_write_fn *write;
+    log_sink_write_record_fn *write_record; // NULL for text sinks
     log_sink_clone_fn *clone;
+
+    // per-sink level filter; LOGGER_LEVEL_NONE (the calloc default) accepts
+    // everything. set with log_sink_set_level
+    enum LOGGER_LEVEL level;
 };
 
 void log_sink_free(log_sink_t *sink);
+void log_sink_set_level(log_sink_t *sink, enum LOGGER_LEVEL level);
 void log_sink_write(log_sink_t *sink, enum LOGGER_LEVEL level,  const char *message);
 log_sink_t *log_sink_clone(log_sink_t *sink);
\ No newline at end of file
@@ -6,20 +6,29 @@
 #include <stb_image.h>
 
 #include <glad/gl.h>
+#include <stdio.h>
 #include <string.h>
 #include <lauxlib.h>
 #include "logging/logger.h"
 #include "gl.h"
 #include "ui/ui.h"
+#include "ui/font.h"
 #include "utils.h"
 #include "logging/logger.h"
 #include "mumble-link.h"
+#include "zip.h"
+#include "profiler.h"
+#include "gl-commands.h"
 #include "app.h"
 #include "assert.h"
 
 typedef struct {
     gl_shader_program_t *sprite_array_program;
     gl_shader_program_t *trail_program;
+    gl_shader_program_t *polyline_program;
+
+    // attribute-less VAO for full-rect draws (heat maps)
+    GLuint heatmap_vao;
 
     mat4f_t *view;
     mat4f_t *proj;
@@ -30,6 +39,19 @@ typedef struct {
 
     vec3f_t mouse_ray;
     vec3f_t camera;
+    // world-space view frustum planes, xyz = normal, w = distance.
+    // recalculated each frame in overlay_3d_begin_frame
+    frustum_t frustum;
+
+    // activation filtering. each sprite can carry a bitmask of activation
+    // conditions; the current game state is a mask of the conditions that
+    // hold. bits are partitioned into up to 4 groups (profession, mount,
+    // festival, ...); within a group any overlapping bit activates the
+    // sprite, across groups all groups must pass
+    uint64_t filter_state;
+    uint64_t filter_groups[4];
+    uint32_t filter_generation;
+
     int in_frame;
     int mouse_in_overlay;
     int mapfullscreen;
@@ -47,8 +69,22 @@ typedef struct {
 
 static overlay_3d_t *overlay_3d = NULL;
 
+// Distance buckets for world sprites and trails, based on distance to the
+// player. Objects in the far bucket are skipped entirely before upload/draw.
+// The far cutoff has hysteresis so objects don't flicker in and out when the
+// player is right at their fade distance.
+#define LOD_BUCKET_NEAR 0
+#define LOD_BUCKET_MID  1
+#define LOD_BUCKET_FAR  2
+
+#define LOD_FAR_ENTER 1.05f
+#define LOD_FAR_EXIT  0.95f
+
 int overlay_3d_lua_open_module(lua_State *L);
 
+void texture_decode_shutdown(void);
+void texture_decode_job_finish(void *data);
+
 gl_shader_source_list_t sprite_array_srcs[] = {
     "shaders/sprite-array.vert", GL_VERTEX_SHADER,
     "shaders/sprite-array.frag", GL_FRAGMENT_SHADER,
@@ -61,6 +97,31 @@ gl_shader_source_list_t trail_srcs[] = {
     NULL                , 0
 };
 
+gl_shader_source_list_t polyline_srcs[] = {
+    "shaders/polyline.vert", GL_VERTEX_SHADER,
+    "shaders/polyline.frag", GL_FRAGMENT_SHADER,
+    NULL                   , 0
+};
+
+gl_shader_source_list_t heatmap_srcs[] = {
+    "shaders/heatmap.vert", GL_VERTEX_SHADER,
+    "shaders/heatmap.frag", GL_FRAGMENT_SHADER,
+    NULL                  , 0
+};
+
+gl_shader_source_list_t mesh_srcs[] = {
+    "shaders/mesh.vert", GL_VERTEX_SHADER,
+    "shaders/mesh.frag", GL_FRAGMENT_SHADER,
+    NULL               , 0
+};
+
+// created lazily by the first mesh list; freed in overlay_3d_cleanup
+static gl_shader_program_t *mesh_program = NULL;
+static GLuint mesh_vbo = 0;
+
+// created lazily by the first heatmap; freed in overlay_3d_cleanup
+static gl_shader_program_t *heatmap_program = NULL;
+
 void overlay_3d_init() {
     overlay_3d = egoverlay_calloc(1, sizeof(overlay_3d_t));
 
@@ -68,13 +129,32 @@ void overlay_3d_init() {
 
     overlay_3d->sprite_array_program = gl_shader_program_new_with_sources(sprite_array_srcs);
     overlay_3d->trail_program        = gl_shader_program_new_with_sources(trail_srcs       );
+    overlay_3d->polyline_program     = gl_shader_program_new_with_sources(polyline_srcs    );
+
+    glGenVertexArrays(1, &overlay_3d->heatmap_vao);
 
     lua_manager_add_module_opener("eg-overlay-3d", &overlay_3d_lua_open_module);
 }
 
 void overlay_3d_cleanup() {
+    texture_decode_shutdown();
+
     gl_shader_program_free(overlay_3d->sprite_array_program);
     gl_shader_program_free(overlay_3d->trail_program);
+    gl_shader_program_free(overlay_3d->polyline_program);
+    if (heatmap_program) {
+        gl_shader_program_free(heatmap_program);
+        heatmap_program = NULL;
+    }
+    if (mesh_program) {
+        gl_shader_program_free(mesh_program);
+        mesh_program = NULL;
+    }
+    if (mesh_vbo) {
+        glDeleteBuffers(1, &mesh_vbo);
+        mesh_vbo = 0;
+    }
+    glDeleteVertexArrays(1, &overlay_3d->heatmap_vao);
     gl_del_shader_include("/3dcommon.glsl");
 
     egoverlay_free(overlay_3d);
@@ -126,12 +206,23 @@ void overlay_3d_calc_mouse_ray() {
     vec3f_normalize(&rayw3, &overlay_3d->mouse_ray);
 }
 
+// Extract the 6 world-space frustum planes from the combined view/projection
+// matrix (Gribb/Hartmann). Sprites are culled against these before instance
+// data is uploaded each frame.
+void overlay_3d_calc_frustum() {
+    mat4f_t viewproj = {0};
+    mat4f_mult_mat4f(overlay_3d->view, overlay_3d->proj, &viewproj);
+
+    mat4f_frustum_planes(&viewproj, &overlay_3d->frustum);
+}
+
 void overlay_3d_begin_frame(mat4f_t *view, mat4f_t *proj) {
     overlay_3d->view = view;
     overlay_3d->proj = proj;
     overlay_3d->in_frame = 1;
 
     overlay_3d_calc_mouse_ray();
+    overlay_3d_calc_frustum();
     mumble_link_camera_position(
         &overlay_3d->camera.x,
         &overlay_3d->camera.y,
@@ -166,13 +257,60 @@ void overlay_3d_begin_frame(mat4f_t *view, mat4f_t *proj) {
     int fbh = 0;
     app_get_framebuffer_size(&fbw, &fbh);
 
+    // the map transforms (projection, view, minimap geometry, continent
+    // bounds) only depend on these inputs; skip the trig and matrix work
+    // on the frames where none of them moved, which is most frames
+    static float last_mapcenterx = 0.f;
+    static float last_mapcentery = 0.f;
+    static float last_mapscale = 0.f;
+    static uint32_t last_uistate = 0xFFFFFFFF;
+    static int last_fbw = 0;
+    static int last_fbh = 0;
+    static float last_rotation = 0.f;
+    static uint32_t last_uisize = 0xFFFFFFFF;
+    static uint16_t last_compassw = 0;
+    static uint16_t last_compassh = 0;
+
+    float rotation = mumble_link_map_rotation();
+    uint32_t uisize = mumble_link_ui_size();
+
+    uint16_t compassw = 0;
+    uint16_t compassh = 0;
+    mumble_link_map_size(&compassw, &compassh);
+
+    if (mapcenterx==last_mapcenterx &&
+        mapcentery==last_mapcentery &&
+        mapscale==last_mapscale &&
+        uistate==last_uistate &&
+        fbw==last_fbw &&
+        fbh==last_fbh &&
+        rotation==last_rotation &&
+        uisize==last_uisize &&
+        compassw==last_compassw &&
+        compassh==last_compassh
+    ) {
+        return;
+    }
+
+    last_mapcenterx = mapcenterx;
+    last_mapcentery = mapcentery;
+    last_mapscale = mapscale;
+    last_uistate = uistate;
+    last_fbw = fbw;
+    last_fbh = fbh;
+    last_rotation = rotation;
+    last_uisize = uisize;
+    last_compassw = compassw;
+    last_compassh = compassh;
+
     uint16_t mapw = 0;
     uint16_t maph = 0;
     if (overlay_3d->mapfullscreen) {
         mapw = (uint16_t)fbw;
         maph = (uint16_t)fbh;
     } else {
-        mumble_link_map_size(&mapw, &maph);
+        mapw = compassw;
+        maph = compassh;
         float minimapscale = 1.f;
        
         switch(mumble_link_ui_size()) {
@@ -287,8 +425,10 @@ Dimensions
 ~~~~~~~~~~
 
 This module does not enforce any restrictions on texture dimensions when
-loading the data, however internally all textures are stored in square
-textures with dimensions that are a power of 2.
+loading the data. Internally, small images (up to 512 pixels on a side)
+loaded without custom options are packed together into a shared atlas so
+sprites using them can be drawn in a single batch; larger images are stored
+in individual square textures with dimensions that are a power of 2.
 
 This should not affect sprites because the original dimensions of the image are
 stored and used when rendering them, but trails may not be rendered as expected
@@ -410,35 +550,61 @@ Functions
 
 int overlay_3d_lua_mouse_points_at(lua_State *L);
 int overlay_3d_lua_mouse_pointer_map_coords(lua_State *L);
+int overlay_3d_lua_map2screen(lua_State *L);
+int overlay_3d_lua_aabbs_visible(lua_State *L);
+int overlay_3d_lua_filter_groups(lua_State *L);
+int overlay_3d_lua_set_filter_state(lua_State *L);
+int overlay_3d_lua_set_filter_bits(lua_State *L);
 
 int texture_map_lua_new(lua_State *L);
 int texture_map_lua_del(lua_State *L);
 int texture_map_lua_clear(lua_State *L);
 int texture_map_lua_add(lua_State *L);
+int texture_map_lua_add_from_zip(lua_State *L);
 int texture_map_lua_has(lua_State *L);
 
 int sprite_list_lua_new(lua_State *L);
 int sprite_list_lua_del(lua_State *L);
 int sprite_list_lua_clear(lua_State *L);
 int sprite_list_lua_add_sprite(lua_State *L);
+int sprite_list_lua_add_sprites(lua_State *L);
 int sprite_list_lua_update_sprites(lua_State *L);
 int sprite_list_lua_remove_sprites(lua_State *L);
 int sprite_list_lua_draw(lua_State *L);
+int sprite_list_lua_nearest(lua_State *L);
+int sprite_list_lua_index_tag(lua_State *L);
+int sprite_list_lua_pointedat(lua_State *L);
+int sprite_list_lua_cluster(lua_State *L);
 
 int trail_list_lua_new(lua_State *L);
+int polyline_batch_lua_new(lua_State *L);
+int heatmap_lua_new(lua_State *L);
+int label_list_lua_new(lua_State *L);
+int mesh_list_lua_new(lua_State *L);
 int trail_list_lua_del(lua_State *L);
 int trail_list_lua_clear(lua_State *L);
 int trail_list_lua_add(lua_State *L);
+int trail_list_lua_add_batch(lua_State *L);
 int trail_list_lua_remove(lua_State *L);
+int trail_list_lua_progress(lua_State *L);
 int trail_list_lua_draw(lua_State *L);
 int trail_list_lua_update(lua_State *L);
 
 luaL_Reg overlay_3d_mod_funcs[] = {
     "mousepointsat"        , &overlay_3d_lua_mouse_points_at,
     "mousepointermapcoords", &overlay_3d_lua_mouse_pointer_map_coords,
+    "map2screen"           , &overlay_3d_lua_map2screen,
+    "aabbsvisible"         , &overlay_3d_lua_aabbs_visible,
+    "filtergroups"         , &overlay_3d_lua_filter_groups,
+    "setfilterstate"       , &overlay_3d_lua_set_filter_state,
+    "setfilterbits"        , &overlay_3d_lua_set_filter_bits,
     "texturemap"           , &texture_map_lua_new,
     "spritelist"           , &sprite_list_lua_new,
     "traillist"            , &trail_list_lua_new,
+    "polylinebatch"        , &polyline_batch_lua_new,
+    "heatmap"              , &heatmap_lua_new,
+    "labellist"            , &label_list_lua_new,
+    "meshlist"             , &mesh_list_lua_new,
     NULL                   , NULL
 };
 
@@ -456,16 +622,186 @@ typedef struct {
     float max_v;
     float xy_ratio;
     GLuint texture;
+
+    // atlas placement. layer is -1 when the texture did not fit in the atlas
+    // and has its own GL texture instead
+    int atlas_layer;
+    float atlas_u0;
+    float atlas_v0;
+
+    // resident ARB_bindless_texture handle for standalone textures, 0 when
+    // unavailable (no driver support, atlas entry, or still loading)
+    GLuint64 bindless_handle;
 } texture_map_texture_t;
 
+// With bindless texture support, standalone textures get a resident handle
+// so the sprite pass can sample them per instance without binding.
+static void texture_map_texture_acquire_handle(texture_map_texture_t *tex) {
+    if (!gl_has_bindless_textures()) return;
+    if (!tex->texture || tex->bindless_handle) return;
+
+    tex->bindless_handle = glGetTextureHandleARB(tex->texture);
+    glMakeTextureHandleResidentARB(tex->bindless_handle);
+}
+
+static void texture_map_texture_release_handle(texture_map_texture_t *tex) {
+    if (!tex->bindless_handle) return;
+
+    glMakeTextureHandleNonResidentARB(tex->bindless_handle);
+    tex->bindless_handle = 0;
+}
+
+// Shared icon atlas. Images up to ATLAS_MAX_ENTRY on a side are shelf packed
+// into ATLAS_PAGE_SIZE texture array layers so sprite draws don't have to
+// break on texture changes. Larger images (trail textures, etc.) and images
+// with custom filtering options keep their own textures.
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_ENTRY  512
+#define ATLAS_PAD          2
+
+typedef struct {
+    GLuint texture; // GL_TEXTURE_2D_ARRAY, 0 until first insert
+    GLsizei layer_count;
+
+    // shelf packing state per layer
+    int *shelf_x;
+    int *shelf_y;
+    int *shelf_h;
+} texture_map_atlas_t;
+
 typedef struct {
     size_t hash_map_size;
     size_t texture_count;
 
     char **keys;
     texture_map_texture_t **texture_info;
+
+    texture_map_atlas_t atlas;
+
+    // bumped when the map is cleared, invalidating pending async loads
+    uint32_t generation;
+
+    // bumped when an async load finishes and texture attributes change, so
+    // sprite lists know to refresh their per-instance texture data
+    uint32_t texture_generation;
 } texture_map_t;
 
+// Asynchronous texture loading. texturemap:add with async=true queues the
+// encoded image for a background decode thread; finished decodes are handed
+// back through the GL command layer and uploaded (through a pixel unpack
+// buffer) when the render loop replays them. Until then the texture renders
+// as a small white placeholder.
+typedef struct texture_decode_job_t {
+    texture_map_t *map;
+    texture_map_texture_t *tex;
+    uint32_t map_generation;
+
+    uint8_t *data; // encoded image data, owned by the job
+    size_t datalen;
+
+    int atlas;
+    int compress;
+    int mipmaps;
+    GLint minfilter;
+    GLint magfilter;
+    float max_aniso;
+
+    // filled in by the decode thread
+    uint8_t *pixels;
+    int width;
+    int height;
+
+    struct texture_decode_job_t *next;
+} texture_decode_job_t;
+
+static HANDLE texture_decode_mutex = NULL;
+static HANDLE texture_decode_thread = NULL;
+static int texture_decode_stop = 0;
+static texture_decode_job_t *texture_decode_queue = NULL;
+
+static GLuint texture_upload_pbo = 0;
+static GLuint texture_placeholder = 0;
+
+static DWORD texture_decode_thread_id = 0;
+
+// texture maps are Lua userdata; pending jobs only act on maps that are
+// still alive (and on the same generation) when their decode finishes
+typedef struct texture_map_live_t {
+    texture_map_t *map;
+    struct texture_map_live_t *next;
+} texture_map_live_t;
+
+static texture_map_live_t *live_texture_maps = NULL;
+
+static DWORD WINAPI texture_decode_thread_fn(LPVOID lpParam) {
+    UNUSED_PARAM(lpParam);
+
+    logger_t *log = logger_get("lua-gl");
+    logger_debug(log, "texture decode thread starting...");
+
+    while (!texture_decode_stop) {
+        WaitForSingleObject(texture_decode_mutex, INFINITE);
+
+        texture_decode_job_t *jobs = texture_decode_queue;
+        texture_decode_queue = NULL;
+
+        ReleaseMutex(texture_decode_mutex);
+
+        while (jobs) {
+            texture_decode_job_t *job = jobs;
+            jobs = jobs->next;
+
+            int channels = 0;
+            job->pixels = stbi_load_from_memory(
+                job->data,
+                (int)job->datalen,
+                &job->width,
+                &job->height,
+                &channels,
+                4
+            );
+
+            // hand the finished decode to the GL thread through the command
+            // layer; the render loop replays it next frame
+            gl_commands_record(&texture_decode_job_finish, job);
+        }
+
+        Sleep(25);
+    }
+
+    logger_debug(log, "texture decode thread ending...");
+
+    return 0;
+}
+
+void texture_decode_job_free(texture_decode_job_t *job) {
+    if (job->pixels) stbi_image_free(job->pixels);
+    egoverlay_free(job->data);
+    egoverlay_free(job);
+}
+
+void texture_decode_shutdown() {
+    if (!texture_decode_thread) return;
+
+    texture_decode_stop = 1;
+    WaitForSingleObject(texture_decode_thread, INFINITE);
+    CloseHandle(texture_decode_thread);
+    CloseHandle(texture_decode_mutex);
+    texture_decode_thread = NULL;
+    texture_decode_mutex = NULL;
+
+    while (texture_decode_queue) {
+        texture_decode_job_t *job = texture_decode_queue;
+        texture_decode_queue = job->next;
+        texture_decode_job_free(job);
+    }
+
+    // decodes already recorded as GL commands are replayed (and freed) by
+    // the render loop while it still runs; anything left at process exit
+    // goes with the process
+}
+
+
 typedef struct {
     struct {
         float x;
@@ -491,14 +827,72 @@ typedef struct {
 
     uint32_t flags;
 
-    mat4f_t rotation;
+    // euler rotation in radians; the rotation matrix is built on the GPU
+    // for non-billboard sprites
+    vec3f_t rotation;
+
+    // declarative animation channel, evaluated per frame in the vertex
+    // shader from the frame time: x = mode (0 none, 1 pulse, 2 bob,
+    // 3 rotate), y = phase (radians), z = amplitude, w = speed (Hz-ish,
+    // radians/second)
+    struct {
+        float mode;
+        float phase;
+        float amplitude;
+        float speed;
+    } anim;
+
+    // atlas uv origin and layer, layer < 0 samples the standalone texture
+    float atlas_u0;
+    float atlas_v0;
+    float atlas_layer;
+
+    // bindless texture handle (lo, hi) for standalone textures; 0 when the
+    // driver has no bindless support or the texture is atlas packed
+    uint32_t tex_handle[2];
 } sprite_list_sprite_t;
 
+// Spatial hash over sprite positions, used by the nearest/pointedat queries
+// so picking doesn't scan every sprite. Cells are SPRITE_GRID_CELL_SIZE map
+// units on a side and hashed into an open addressed table.
+#define SPRITE_GRID_CELL_SIZE 512.f
+
+typedef struct {
+    size_t texture;
+    size_t sprite;
+} sprite_grid_ref_t;
+
+typedef struct sprite_tag_bucket_t {
+    int used;
+    uint32_t hash;
+
+    size_t count;
+    size_t capacity;
+    sprite_grid_ref_t *refs;
+} sprite_tag_bucket_t;
+
+typedef struct {
+    int used;
+    int64_t key;
+
+    size_t count;
+    size_t capacity;
+    sprite_grid_ref_t *refs;
+} sprite_grid_cell_t;
+
 typedef struct {
     GLuint vao;
     GLuint vbo;
 
-    size_t vbo_size;
+    // persistently mapped, triple buffered instance ring. each section holds
+    // vbo_capacity instances. a section is fenced after it is drawn and the
+    // fence waited on before it is written again, so writes are a memcpy
+    // straight into the mapping without stalling the driver
+    size_t vbo_capacity;
+    int vbo_section;
+    size_t vbo_draw_base;
+    GLsync vbo_fences[3];
+    sprite_list_sprite_t *vbo_map;
 
     size_t texture_count;
     char **texture_keys;
@@ -509,6 +903,52 @@ typedef struct {
     sprite_list_sprite_t **sprites;
     int **tags;
 
+    // current distance bucket of each sprite, LOD_BUCKET_*
+    uint8_t **lodbuckets;
+
+    // activation condition bits per sprite (cold data, kept out of the
+    // uploaded instance records). 0 = always visible
+    uint64_t **filterbits;
+
+    // per-frame frustum culled instance counts, world lists only.
+    // culled_counts mirrors sprite_counts but only counts on-screen sprites
+    size_t *culled_counts;
+
+    // clustering (0 = off): world-space merge radius. distant sprites within
+    // a cell are collapsed into one aggregated instance per frame
+    float cluster_dist;
+    struct sprite_cluster_cell_t *cluster_cells;
+    size_t cluster_cell_count; // power of two
+
+    // texture map texture_generation this list last refreshed against
+    uint32_t seen_texture_generation;
+
+    // filter generation the instance buffer was last written under, and
+    // whether that write skipped any sprites (which invalidates the dirty
+    // range patch layout)
+    uint32_t seen_filter_generation;
+    int vbo_filtered;
+
+    // spatial hash, rebuilt lazily when queries run after changes
+    sprite_grid_cell_t *grid_cells;
+    size_t grid_size;
+    int grid_dirty;
+
+    // selector index: when indextag is set (spritelist:indextag), sprites
+    // are bucketed by the hash of that tag field's string value, so
+    // update selectors naming it only visit candidates
+    char *indextag;
+    struct sprite_tag_bucket_t *tagindex;
+    size_t tagindex_size;
+    int tagindex_dirty;
+
+    // modified index ranges per texture, [dirty_min, dirty_max). when only
+    // attributes changed (vbo_valid) the ranges are patched in place instead
+    // of re-writing the entire list into a new ring section
+    size_t *dirty_min;
+    size_t *dirty_max;
+    int vbo_valid;
+
     texture_map_t *texture_map;
     int texture_map_luaref;
 
@@ -524,6 +964,27 @@ typedef struct {
     float v;
 } trail_coordinate_t;
 
+// Trails are split into fixed size triangle strip chunks so long routes can
+// be culled per-chunk. Consecutive chunks share 2 coordinates so the strip
+// stays continuous across the split.
+#define TRAIL_CHUNK_COORDS 128
+
+typedef struct {
+    size_t first;       // first coordinate, relative to the trail's strip
+    size_t coord_count;
+    vec3f_t center;     // bounding sphere over the chunk's coordinates
+    float radius;
+} trail_chunk_t;
+
+// AABB over TRAIL_SEG_GROUP segments, for skipping whole spans of a trail
+// during progress queries
+#define TRAIL_SEG_GROUP 32
+
+typedef struct trail_seg_group_t {
+    vec3f_t min;
+    vec3f_t max;
+} trail_seg_group_t;
+
 typedef struct trail_list_trail_t {
     size_t point_count;
     vec3f_t *points;
@@ -543,16 +1004,40 @@ typedef struct trail_list_trail_t {
     float size;
     int wall;
 
+    // bounding sphere of all points, for distance bucketing
+    vec3f_t bounds_center;
+    float bounds_radius;
+    int lodfar;
+
+    size_t chunk_count;
+    trail_chunk_t *chunks;
+
+    // walk progress acceleration, built lazily on the first progress query:
+    // prefix arc length per point and AABBs over fixed size segment groups
+    float *arclen;
+    struct trail_seg_group_t *seggroups;
+    size_t seggroup_count;
+    int progress_dirty;
+
     int tags;
 } trail_list_trail_t;
 
+// trail list vbo_update states
+#define TRAIL_VBO_CLEAN   0
+#define TRAIL_VBO_REBUILD 1
+#define TRAIL_VBO_APPEND  2 // only append_trail grew, at the end of the buffer
+
 typedef struct {
     GLuint vao;
     GLuint vbo;
 
-    size_t vbo_size;
+    size_t vbo_size; // allocated bytes
+    size_t vbo_used; // bytes in use
     int vbo_update;
 
+    // the trail that points were appended to, used by the append fast path
+    trail_list_trail_t *append_trail;
+
     size_t texture_count;
     char **texture_keys;
 
@@ -563,6 +1048,11 @@ typedef struct {
 
     trail_list_trail_t **trails;
 
+    // per-chunk multi-draw scratch
+    GLint *md_firsts;
+    GLsizei *md_counts;
+    size_t md_capacity;
+
     texture_map_t *texture_map;
     int texture_map_luaref;
 } trail_list_t;
@@ -701,697 +1191,2029 @@ int overlay_3d_lua_mouse_pointer_map_coords(lua_State *L) {
     return 2;
 }
 
-#define TEXTURE_MAP_MT "EGOverlayTextureMap"
-#define lua_checktexturemap(L, ind) (texture_map_t*)luaL_checkudata(L, ind, TEXTURE_MAP_MT)
-
-#define SPRITE_LIST_MT "EGOverlaySpriteList"
-#define lua_checkspritelist(L, ind) (sprite_list_t*)luaL_checkudata(L, ind, SPRITE_LIST_MT)
+/*** RST
+.. lua:function:: map2screen(points[, out])
 
-#define TRAIL_LIST_MT "EGOverlayTrailList"
-#define lua_checktraillist(L, ind) (trail_list_t*)luaL_checkudata(L, ind, TRAIL_LIST_MT)
+    Transform continent coordinates to screen coordinates in bulk using the
+    cached (mini)map transform.
 
-luaL_Reg texture_map_funcs[] = {
-    "__gc" , &texture_map_lua_del,
-    "clear", &texture_map_lua_clear,
-    "add"  , &texture_map_lua_add,
-    "has"  , &texture_map_lua_has,
-    NULL   , NULL
-};
+    ``points`` is a flat sequence of x,y pairs, ``{x1, y1, x2, y2, ...}``. The
+    transformed coordinates are returned as a flat sequence of the same
+    length; pass a table as ``out`` to reuse it instead of allocating a new
+    result table every call.
 
-luaL_Reg sprite_list_funcs[] = {
-    "__gc"  , &sprite_list_lua_del,
-    "clear" , &sprite_list_lua_clear,
-    "add"   , &sprite_list_lua_add_sprite,
-    "update", &sprite_list_lua_update_sprites,
-    "remove", &sprite_list_lua_remove_sprites,
-    "draw"  , &sprite_list_lua_draw,
-    NULL    , NULL
-};
+    Returns ``nil`` if the map transform isn't available yet (no MumbleLink
+    data).
 
-luaL_Reg trail_list_funcs[] = {
-    "__gc"   , &trail_list_lua_del,
-    "clear"  , &trail_list_lua_clear,
-    "add"    , &trail_list_lua_add,
-    "remove" , &trail_list_lua_remove,
-    "draw"   , &trail_list_lua_draw,
-    "update" , &trail_list_lua_update,
-    NULL     , NULL
-};
+    :param table points:
+    :param table out: (Optional)
+    :rtype: table
 
-/*** RST
-.. lua:function:: texturemap()
+    .. code-block:: lua
+        :caption: Example
 
-    Create a new :lua:class:`o3dtexturemap` object.
+        local o3d = require 'eg-overlay-3d'
 
-    :rtype: o3dtexturemap
+        local screen = o3d.map2screen({cx1, cy1, cx2, cy2})
 
     .. versionhistory::
         :0.1.0: Added
 */
-int texture_map_lua_new(lua_State *L) {
-    texture_map_t *map = lua_newuserdata(L, sizeof(texture_map_t));
-    memset(map, 0, sizeof(texture_map_t));
+int overlay_3d_lua_map2screen(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
 
-    map->hash_map_size = 8;
+    lua_Integer n = luaL_len(L, 1);
+    if (n % 2) return luaL_error(L, "o3d.map2screen: points must be a flat sequence of x,y pairs.");
 
-    map->keys         = egoverlay_calloc(map->hash_map_size, sizeof(char*));
-    map->texture_info = egoverlay_calloc(map->hash_map_size, sizeof(texture_map_texture_t*));
-    
-    if (luaL_newmetatable(L, TEXTURE_MAP_MT)) {
-        lua_pushvalue(L, -1);
-        lua_setfield(L, -2, "__index");
-        luaL_setfuncs(L, texture_map_funcs, 0);
+    float contw = overlay_3d->mapcoordsright - overlay_3d->mapcoordsleft;
+    float conth = overlay_3d->mapcoordsbottom - overlay_3d->mapcoordstop;
+
+    if (contw==0.f || conth==0.f) {
+        lua_pushnil(L);
+        return 1;
     }
-    lua_setmetatable(L, -2);
 
-    return 1;
-}
+    int fbw = 0;
+    int fbh = 0;
+    app_get_framebuffer_size(&fbw, &fbh);
 
-int texture_map_lua_del(lua_State *L) {
-    texture_map_t *map = lua_checktexturemap(L, 1);
+    // same mapping mousepointermapcoords inverts: continent bounds onto the
+    // framebuffer when the map is fullscreen, onto the minimap rectangle
+    // otherwise
+    float sx;
+    float sy;
+    float ox;
+    float oy;
+    if (overlay_3d->mapfullscreen) {
+        sx = (float)fbw / contw;
+        sy = (float)fbh / conth;
+        ox = -overlay_3d->mapcoordsleft * sx;
+        oy = -overlay_3d->mapcoordstop * sy;
+    } else {
+        sx = (float)overlay_3d->minimapwidth / contw;
+        sy = (float)overlay_3d->minimapheight / conth;
+        ox = (float)overlay_3d->minimapleft - overlay_3d->mapcoordsleft * sx;
+        oy = ((float)fbh - overlay_3d->minimapbottom - overlay_3d->minimapheight)
+           - overlay_3d->mapcoordstop * sy;
+    }
 
-    for (size_t k=0;k<map->hash_map_size;k++) {
-        if (map->keys[k]==NULL) continue;
+    // reusable scratch; grown to the largest batch seen
+    static float *scratch = NULL;
+    static size_t scratch_size = 0;
 
-        glDeleteTextures(1, &map->texture_info[k]->texture);
-        egoverlay_free(map->texture_info[k]);
-        egoverlay_free(map->keys[k]);
+    if ((size_t)n > scratch_size) {
+        if (scratch) egoverlay_free(scratch);
+        scratch = egoverlay_calloc(n, sizeof(float));
+        scratch_size = n;
     }
 
-    egoverlay_free(map->texture_info);
-    egoverlay_free(map->keys);
+    for (lua_Integer i=1;i<=n;i++) {
+        lua_rawgeti(L, 1, i);
+        scratch[i-1] = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
 
-    return 0;
+    vec2f_scale_offset_array(scratch, n / 2, sx, sy, ox, oy);
+
+    if (lua_gettop(L)>=2 && lua_istable(L, 2)) {
+        lua_pushvalue(L, 2);
+    } else {
+        lua_createtable(L, (int)n, 0);
+    }
+
+    for (lua_Integer i=1;i<=n;i++) {
+        lua_pushnumber(L, scratch[i-1]);
+        lua_rawseti(L, -2, i);
+    }
+
+    return 1;
 }
 
 /*** RST
-.. lua:function:: spritelist(texturemap[, position])
-
-    Create a new :lua:class:`o3dspritelist` object.
+.. lua:function:: aabbsvisible(boxes)
 
-    :param o3dtexturemap texturemap:
-    :param string position: (Optional) How the sprites in this list will be
-        positioned. See below, default ``'world'``.
-    :rtype: o3dspritelist
+    Batch-test axis-aligned boxes against the current view frustum.
 
-    **Position Values**
+    ``boxes`` is a flat sequence of ``minx, miny, minz, maxx, maxy, maxz``
+    per box (world units). Returns a sequence of booleans, one per box, so
+    module-side culling runs one native call instead of per-object dot
+    products in Lua. Only meaningful during :overlay:event:`draw-3d` when
+    the frame's frustum is current.
 
-    =========== ================================================================
-    Value       Description
-    =========== ================================================================
-    ``'world'`` Sprites are drawn within the 3D world, coordinates must be in
-                map coordinates.
-    ``'map'``   Sprites are dawn on the (mini)map, coordinates must be in
-                continent coordinates.
-    =========== ================================================================
+    :param table boxes:
+    :rtype: table
 
     .. versionhistory::
         :0.1.0: Added
 */
-int sprite_list_lua_new(lua_State *L) {
-    texture_map_t *texmap = lua_checktexturemap(L, 1);
-
-    int map = 0;
-    if (lua_gettop(L)>=2) {
-        const char *position = lua_tostring(L, 2);
+int overlay_3d_lua_aabbs_visible(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
 
-        if (strcmp(position, "world")==0) map = 0;
-        else if (strcmp(position, "map")==0) map = 1;
-        else return luaL_error(L, "position must be either 'world' or 'map'");
-    }
+    lua_Integer n = luaL_len(L, 1);
+    if (n % 6) return luaL_error(L, "o3d.aabbsvisible: boxes must be flat min/max triplets (6 numbers per box).");
 
-    sprite_list_t *list = lua_newuserdata(L, sizeof(sprite_list_t));
-    memset(list, 0, sizeof(sprite_list_t));
+    size_t count = (size_t)(n / 6);
 
-    if (luaL_newmetatable(L, SPRITE_LIST_MT)) {
-        lua_pushvalue(L, -1);
-        lua_setfield(L, -2, "__index");
-        luaL_setfuncs(L, sprite_list_funcs, 0);
-    }
-    lua_setmetatable(L, -2);
+    lua_createtable(L, (int)count, 0);
+    if (count==0) return 1;
 
-    list->map = map;
+    // reusable scratch, grown to the largest batch seen
+    static aabb_t *boxes = NULL;
+    static uint8_t *results = NULL;
+    static size_t scratch_count = 0;
 
-    list->texture_map = texmap;
-    lua_pushvalue(L, 1);
-    list->texture_map_luaref = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (count > scratch_count) {
+        if (boxes) egoverlay_free(boxes);
+        if (results) egoverlay_free(results);
+        boxes = egoverlay_calloc(count, sizeof(aabb_t));
+        results = egoverlay_calloc(count, sizeof(uint8_t));
+        scratch_count = count;
+    }
 
-    glGenVertexArrays(1, &list->vao);
-    glGenBuffers(1, &list->vbo);
+    for (size_t b=0;b<count;b++) {
+        float v[6];
+        for (int i=0;i<6;i++) {
+            lua_geti(L, 1, (lua_Integer)(b * 6 + i + 1));
+            v[i] = (float)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+        boxes[b].min.x = v[0];
+        boxes[b].min.y = v[1];
+        boxes[b].min.z = v[2];
+        boxes[b].max.x = v[3];
+        boxes[b].max.y = v[4];
+        boxes[b].max.z = v[5];
+    }
 
-    glBindVertexArray(list->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+    frustum_test_aabbs(&overlay_3d->frustum, boxes, results, count);
 
-    // VBO contents, shader inputs
-    VERT_ATTRIB_VEC3 (0, 1, sprite_list_sprite_t, position );
-    VERT_ATTRIB_FLOAT(1, 1, sprite_list_sprite_t, max_u    );
-    VERT_ATTRIB_FLOAT(2, 1, sprite_list_sprite_t, max_v    );
-    VERT_ATTRIB_FLOAT(3, 1, sprite_list_sprite_t, xy_ratio );
-    VERT_ATTRIB_FLOAT(4, 1, sprite_list_sprite_t, size     );
-    VERT_ATTRIB_FLOAT(5, 1, sprite_list_sprite_t, fade_near);
-    VERT_ATTRIB_FLOAT(6, 1, sprite_list_sprite_t, fade_far );
-    VERT_ATTRIB_VEC4 (7, 1, sprite_list_sprite_t, color    );
-    VERT_ATTRIB_UINT (8, 1, sprite_list_sprite_t, flags    );
-    VERT_ATTRIB_MAT4 (9, 1, sprite_list_sprite_t, rotation );
+    for (size_t b=0;b<count;b++) {
+        lua_pushboolean(L, results[b]);
+        lua_rawseti(L, -2, (lua_Integer)b + 1);
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    
     return 1;
 }
 
-int sprite_list_lua_del(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
+/*** RST
+.. lua:function:: filtergroups(group1[, group2[, group3[, group4]]])
 
-    glDeleteBuffers(1, &list->vbo);
-    glDeleteVertexArrays(1, &list->vao);
+    Define how sprite ``filterbits`` are partitioned into condition groups
+    (for example profession, mount, and festival bits). Within a group a
+    sprite is active when any of its bits is present in the current filter
+    state; across groups every group must pass. Bits outside any group are
+    treated the same way as a group of their own.
 
-    for (size_t t=0;t<list->texture_count;t++) {
-        if (list->sprite_counts[t]) {
-            for (size_t s=0;s<list->sprite_counts[t];s++) {
-                if (list->tags[t][s]>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
-            }
+    :param integer group1: Bitmask of the first group.
+    :param integer group2: (Optional)
+    :param integer group3: (Optional)
+    :param integer group4: (Optional)
 
-            egoverlay_free(list->sprites[t]);
-            egoverlay_free(list->tags[t]);
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_3d_lua_filter_groups(lua_State *L) {
+    for (int g=0;g<4;g++) {
+        if (lua_gettop(L)>=g+1) {
+            overlay_3d->filter_groups[g] = (uint64_t)luaL_checkinteger(L, g+1);
+        } else {
+            overlay_3d->filter_groups[g] = 0;
         }
-        egoverlay_free(list->texture_keys[t]);
     }
 
-    if (list->texture_count) {
-        egoverlay_free(list->texture_keys);
-        egoverlay_free(list->sprite_counts);
-        egoverlay_free(list->sprites);
-        egoverlay_free(list->tags);
-    }
+    overlay_3d->filter_generation++;
 
-    luaL_unref(L, LUA_REGISTRYINDEX, list->texture_map_luaref);
-    
     return 0;
 }
 
 /*** RST
-.. lua:function:: traillist(texturemap[, position])
+.. lua:function:: setfilterstate(state)
 
-    Create a new :lua:class:`o3dtraillist` object.
+    Set the current activation state bits. Sprite visibility across every
+    list is re-evaluated natively against this mask; sprites with
+    ``filterbits`` of ``0`` are always visible.
 
-    :param texturemap texturemap:
-    :param string position: (Optional) How the trails in this list will be
-        positioned. See below, default ``'world'``.
-    :rtype: o3dspritelist
+    :param integer state: Bitmask of the conditions that currently hold.
 
-    **Position Values**
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_3d_lua_set_filter_state(lua_State *L) {
+    uint64_t state = (uint64_t)luaL_checkinteger(L, 1);
 
-    =========== ================================================================
-    Value       Description
-    =========== ================================================================
-    ``'world'`` Trails are drawn within the 3D world, coordinates must be in
-                map coordinates.
-    ``'map'``   Trails are dawn on the (mini)map, coordinates must be in
-                continent coordinates.
-    =========== ================================================================
-
-    .. versionhistory::
-        :0.1.0: Added
-*/
-int trail_list_lua_new(lua_State *L) {
-    texture_map_t *texture_map = lua_checktexturemap(L, 1);
-
-    int map = 0;
-    if (lua_gettop(L)>=2) {
-        const char *position = lua_tostring(L, 2);
-
-        if (strcmp(position, "world")==0) map = 0;
-        else if (strcmp(position, "map")==0) map = 1;
-        else return luaL_error(L, "position must be either 'world' or 'map'");
+    if (state!=overlay_3d->filter_state) {
+        overlay_3d->filter_state = state;
+        overlay_3d->filter_generation++;
     }
 
-    trail_list_t *list = lua_newuserdata(L, sizeof(trail_list_t));
-    memset(list, 0, sizeof(trail_list_t));
+    return 0;
+}
 
-    lua_pushvalue(L, 1);
-    list->texture_map_luaref = luaL_ref(L, LUA_REGISTRYINDEX);
-    list->texture_map = texture_map;
-    list->map = map;
+/*** RST
+.. lua:function:: setfilterbits(mask, on)
 
-    glGenVertexArrays(1, &list->vao);
-    glGenBuffers(1, &list->vbo);
+    Set or clear specific activation state bits without touching the rest of
+    the state. Lets independent condition sources (time windows, professions,
+    mounts) each own their bits without a read-modify-write in Lua.
 
-    glBindVertexArray(list->vao);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+    :param integer mask: The bits to change.
+    :param boolean on: ``true`` sets the bits, ``false`` clears them.
 
-    VERT_ATTRIB_VEC3(0, 0, trail_coordinate_t, position);
-    VERT_ATTRIB_VEC2(1, 0, trail_coordinate_t, u       );
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_3d_lua_set_filter_bits(lua_State *L) {
+    uint64_t mask = (uint64_t)luaL_checkinteger(L, 1);
+    int on = lua_toboolean(L, 2);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    uint64_t state = overlay_3d->filter_state;
+    if (on) state |= mask;
+    else state &= ~mask;
 
-    if (luaL_newmetatable(L, TRAIL_LIST_MT)) {
-        lua_pushvalue(L, -1);
-        lua_setfield(L, -2, "__index");
-        luaL_setfuncs(L, trail_list_funcs, 0);
+    if (state!=overlay_3d->filter_state) {
+        overlay_3d->filter_state = state;
+        overlay_3d->filter_generation++;
     }
-    lua_setmetatable(L, -2);
 
-    return 1;
+    return 0;
 }
 
-int trail_list_lua_del(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
+// Evaluate a sprite's activation bits against the current filter state.
+int sprite_filter_visible(uint64_t bits) {
+    if (bits==0) return 1;
 
-    glDeleteBuffers(1, &list->vbo);
-    glDeleteVertexArrays(1, &list->vao);
+    uint64_t grouped = 0;
 
-    for (size_t t=0;t<list->texture_count;t++) {
-        egoverlay_free(list->texture_keys[t]);
+    for (int g=0;g<4;g++) {
+        uint64_t groupbits = bits & overlay_3d->filter_groups[g];
+        grouped |= groupbits;
 
-        for (size_t trail=0;trail<list->trail_counts[t];trail++) {
-            if (list->trails[t][trail].tags>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->trails[t][trail].tags);
-            if (list->trails[t][trail].points) egoverlay_free(list->trails[t][trail].points);
-        }
-        egoverlay_free(list->trails[t]);
-    }
-    if (list->texture_count) {
-        egoverlay_free(list->texture_keys);
-        egoverlay_free(list->trails);
-        egoverlay_free(list->trail_counts);
+        if (groupbits && !(groupbits & overlay_3d->filter_state)) return 0;
     }
 
-    luaL_unref(L, LUA_REGISTRYINDEX, list->texture_map_luaref);
+    // bits outside any declared group act as one more group
+    uint64_t rest = bits & ~grouped;
+    if (rest && !(rest & overlay_3d->filter_state)) return 0;
 
-    return 0;
+    return 1;
 }
 
-/*** RST
-Classes
--------
-*/
 
 /*** RST
-.. lua:class:: o3dtexturemap
+.. lua:function:: polylinebatch()
 
-    A texture map holds a list of textures that other objects in this module
-    use when being displayed. 
-*/
+    Create a :lua:class:`o3dpolylinebatch`, which draws many line strips on
+    the (mini)map in a single instanced call. Coordinates are continent
+    coordinates; widths are in continent units and the quads are expanded in
+    the vertex shader.
 
-/*** RST
-    .. lua:method:: clear()
+    :rtype: o3dpolylinebatch
 
-        Remove all textures from this map and reset it to an initial state.
+    .. versionhistory::
+        :0.1.0: Added
+*/
 
-        .. danger::
+#define POLYLINE_BATCH_MT "EGOverlayPolylineBatch"
+#define lua_checkpolylinebatch(L, ind) (polyline_batch_t*)luaL_checkudata(L, ind, POLYLINE_BATCH_MT)
 
-            If sprite lists or other objects are still referencing textures
-            within this map after this method is called their draws will not
-            function properly.
+typedef struct {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    float width;
+    float r;
+    float g;
+    float b;
+    float a;
+} polyline_segment_t;
 
-        .. versionhistory::
-            :0.1.0: Added
-        
-*/
-int texture_map_lua_clear(lua_State *L) {
-    texture_map_t *map = lua_checktexturemap(L, 1);
+typedef struct {
+    GLuint vao;
+    GLuint vbo;
+    size_t vbo_capacity; // segments
+
+    polyline_segment_t *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+
+    int dirty;
+} polyline_batch_t;
+
+int polyline_batch_lua_new(lua_State *L);
+int polyline_batch_lua_del(lua_State *L);
+int polyline_batch_lua_add(lua_State *L);
+int polyline_batch_lua_clear(lua_State *L);
+int polyline_batch_lua_draw(lua_State *L);
+
+luaL_Reg polyline_batch_funcs[] = {
+    "__gc" , &polyline_batch_lua_del,
+    "add"  , &polyline_batch_lua_add,
+    "clear", &polyline_batch_lua_clear,
+    "draw" , &polyline_batch_lua_draw,
+    NULL   , NULL
+};
 
-    for (size_t k=0;k<map->hash_map_size;k++) {
-        if (map->keys[k]==NULL) continue;
+int polyline_batch_lua_new(lua_State *L) {
+    polyline_batch_t *batch = lua_newuserdata(L, sizeof(polyline_batch_t));
+    memset(batch, 0, sizeof(polyline_batch_t));
 
-        glDeleteTextures(1, &map->texture_info[k]->texture);
-        egoverlay_free(map->texture_info[k]);
-        map->texture_info[k] = NULL;
-        egoverlay_free(map->keys[k]);
-        map->keys[k] = NULL;
+    if (luaL_newmetatable(L, POLYLINE_BATCH_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, polyline_batch_funcs, 0);
     }
+    lua_setmetatable(L, -2);
 
-    map->texture_count = 0;
+    glGenVertexArrays(1, &batch->vao);
+    glGenBuffers(1, &batch->vbo);
 
-    return 0;
-}
+    glBindVertexArray(batch->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
 
-texture_map_texture_t *texture_map_get(texture_map_t *map, const char *name) {
-    if (!map->keys) return NULL;
-    if (!name) return NULL;
+    VERT_ATTRIB_VEC2 (0, 1, polyline_segment_t, x0   );
+    VERT_ATTRIB_VEC2 (1, 1, polyline_segment_t, x1   );
+    VERT_ATTRIB_FLOAT(2, 1, polyline_segment_t, width);
+    VERT_ATTRIB_VEC4 (3, 1, polyline_segment_t, r    );
 
-    uint32_t hash = djb2_hash_string(name);
-    size_t ind = hash % map->hash_map_size;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
 
-    if (map->keys[ind]==NULL) return NULL;
+    return 1;
+}
 
-    while (map->keys[ind] && strcmp(name, map->keys[ind])!=0) {
-        ind++;
-        // this is a special case, name is a collision but it isn't in the map
-        // yet
-        if (ind==hash % map->hash_map_size) return NULL;
+int polyline_batch_lua_del(lua_State *L) {
+    polyline_batch_t *batch = lua_checkpolylinebatch(L, 1);
 
-        if (ind>=map->hash_map_size) {
-            // edge case, hash % map->hash_map_size == 0
-            if (hash % map->hash_map_size == 0) return NULL;
-            ind = 0;
-        }
-    }
+    glDeleteBuffers(1, &batch->vbo);
+    glDeleteVertexArrays(1, &batch->vao);
 
-    return map->texture_info[ind];
+    if (batch->segments) egoverlay_free(batch->segments);
+
+    return 0;
 }
 
-void texture_map_resize_hash_map(texture_map_t *map) {
-    size_t newsize = map->hash_map_size + 8;
+/*** RST
+.. lua:class:: o3dpolylinebatch
 
-    char **newkeys = egoverlay_calloc(newsize, sizeof(char*));
-    texture_map_texture_t **newinfos = egoverlay_calloc(newsize, sizeof(texture_map_texture_t*));
+    .. lua:method:: add(points, color, width)
 
-    for (size_t oldind=0;oldind<map->hash_map_size;oldind++) {
-        if (map->keys[oldind]==NULL) continue; //shouldn't happen
+        Add a line strip. ``points`` is a sequence of ``{x, y}`` continent
+        coordinates; every consecutive pair becomes a segment in the batch.
 
-        uint32_t hash = djb2_hash_string(map->keys[oldind]);
-        size_t newind = hash % newsize;
+        :param table points:
+        :param integer color: See :ref:`colors`.
+        :param number width: Line width in continent units.
 
-        while (newkeys[newind]) {
-            newind++;
-            if (newind>=newsize) newind = 0;
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int polyline_batch_lua_add(lua_State *L) {
+    polyline_batch_t *batch = lua_checkpolylinebatch(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    ui_color_t color = (ui_color_t)luaL_checkinteger(L, 3);
+    float width = (float)luaL_checknumber(L, 4);
+
+    size_t npoints = luaL_len(L, 2);
+    if (npoints < 2) return luaL_error(L, "polylines need at least 2 points");
+
+    float prevx = 0.f;
+    float prevy = 0.f;
+
+    for (size_t i=1;i<=npoints;i++) {
+        lua_geti(L, 2, i);
+        int pind = lua_gettop(L);
+        lua_geti(L, pind, 1);
+        lua_geti(L, pind, 2);
+
+        float x = (float)lua_tonumber(L, -2);
+        float y = (float)lua_tonumber(L, -1);
+        lua_pop(L, 3);
+
+        if (i > 1 && (x!=prevx || y!=prevy)) { // zero length segments would NaN in the shader
+            if (batch->segment_count==batch->segment_capacity) {
+                batch->segment_capacity = batch->segment_capacity ? batch->segment_capacity * 2 : 64;
+                batch->segments = egoverlay_realloc(
+                    batch->segments,
+                    batch->segment_capacity * sizeof(polyline_segment_t)
+                );
+            }
+
+            polyline_segment_t *seg = &batch->segments[batch->segment_count++];
+            seg->x0 = prevx;
+            seg->y0 = prevy;
+            seg->x1 = x;
+            seg->y1 = y;
+            seg->width = width;
+            seg->r = UI_COLOR_R(color);
+            seg->g = UI_COLOR_G(color);
+            seg->b = UI_COLOR_B(color);
+            seg->a = UI_COLOR_A(color);
         }
-        newkeys[newind] = map->keys[oldind];
-        newinfos[newind] = map->texture_info[oldind];
+
+        prevx = x;
+        prevy = y;
     }
 
-    egoverlay_free(map->keys);
-    egoverlay_free(map->texture_info);
-    map->keys          = newkeys;
-    map->texture_info  = newinfos;
-    map->hash_map_size = newsize;
+    batch->dirty = 1;
+
+    return 0;
 }
 
 /*** RST
-    .. lua:method:: add(name, data[, options])
-
-        Add a texture.
+    .. lua:method:: clear()
 
-        :param string name: The name of the texture, this will be used to
-            reference it later when adding data to sprite lists and other
-            objects.
-        :param string data: The texture data.
-        :param table options: (Optional) A table of texture options. See below.
+        Remove every strip from the batch.
 
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int polyline_batch_lua_clear(lua_State *L) {
+    polyline_batch_t *batch = lua_checkpolylinebatch(L, 1);
 
-        **Options**
+    batch->segment_count = 0;
+    batch->dirty = 1;
 
-        +-----------+----------------------------------------------------------------------------------------+
-        | Field     | Description                                                                            |
-        +===========+========================================================================================+
-        | mipmaps   | A boolean indicating if mipmaps should be generated. Default ``true``.                 |
-        +-----------+----------------------------------------------------------------------------------------+
-        | minfilter | The filtering method used when the texture is displayed at a lower resolution. One of  |
-        |           |                                                                                        |           
-        |           | * ``nearest``                                                                          |
-        |           | * ``linear``                                                                           |
-        |           | * ``nearest-mipmap-nearest``                                                           |
-        |           | * ``linear-mipmap-nearest``                                                            |
-        |           | * ``nearest-mipmap-linear``                                                            |
-        |           | * ``linear-mipmap-linear``                                                             |
-        |           |                                                                                        |
-        |           | Default: ``nearest`` if ``mipmaps`` is ``false`` or ``linear-mipmap-linear`` if        |
-        |           | ``mipmaps`` is ``true``.                                                               |
-        +-----------+----------------------------------------------------------------------------------------+
-        | magfilter | The filtering method used when the texture is displayed at a higher resolution. One of |
-        |           |                                                                                        |
-        |           | * ``nearest``                                                                          |
-        |           | * ``linear``                                                                           |
-        |           |                                                                                        |
-        |           | Default: ``linear``                                                                    |
-        +-----------+----------------------------------------------------------------------------------------+
-        | maxaniso  | The amount of anisotropic to use. Default: the maximum supported on the system,        |
-        |           | probably ``16.0``                                                                      |
-        +-----------+----------------------------------------------------------------------------------------+
+    return 0;
+}
 
-        .. admonition:: Implementation Detail
+/*** RST
+    .. lua:method:: draw()
 
-            EG-Overlay uses `stb_image <https://github.com/nothings/stb/blob/master/stb_image.h>`_
-            to load ``data``, so any format it supports can be used.
+        Draw every segment in the batch on the (mini)map in one instanced
+        call.
 
-            All textures are loaded as 4 channel RGBA images.
+        .. important::
+            This method can only be called during :overlay:event:`draw-3d`.
 
         .. versionhistory::
             :0.1.0: Added
 */
-int texture_map_lua_add(lua_State *L) {
-    texture_map_t *map = lua_checktexturemap(L, 1);
-    size_t namelen = 0;
-    const char *name = luaL_checklstring(L, 2, &namelen);
-    size_t datalen = 0;
-    const uint8_t *data = (const uint8_t*)luaL_checklstring(L, 3, &datalen);
+int polyline_batch_lua_draw(lua_State *L) {
+    polyline_batch_t *batch = lua_checkpolylinebatch(L, 1);
 
-    if (texture_map_get(map, name)) return luaL_error(L, "duplicate texture name: %s", name);
+    if (!overlay_3d->in_frame) return luaL_error(L, "not in a frame");
+    if (batch->segment_count==0) return 0;
 
-    float max_aniso = 0.f;
-    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max_aniso);
+    if (batch->dirty) {
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
 
-    GLint minfilter = GL_LINEAR_MIPMAP_LINEAR;
-    GLint magfilter = GL_LINEAR;
-    int mipmaps = 1;
+        if (batch->vbo_capacity < batch->segment_count) {
+            glBufferData(
+                GL_ARRAY_BUFFER,
+                batch->segment_count * sizeof(polyline_segment_t),
+                NULL,
+                GL_DYNAMIC_DRAW
+            );
+            batch->vbo_capacity = batch->segment_count;
+        }
 
-    if (lua_gettop(L)>=4) {
-        luaL_checktype(L, 4, LUA_TTABLE);
-        if (lua_getfield(L, 4, "mipmaps")!=LUA_TNIL) mipmaps = lua_toboolean(L, -1);
-        lua_pop(L, 1);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, batch->segment_count * sizeof(polyline_segment_t), batch->segments);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        if (!mipmaps) minfilter = GL_NEAREST;
+        batch->dirty = 0;
+    }
 
-        if (lua_getfield(L, 4, "minfilter")==LUA_TSTRING) {
-            const char *minfilterstr = lua_tostring(L, -1);
-            if      (strcmp(minfilterstr, "nearest"               )==0) minfilter = GL_NEAREST;
-            else if (strcmp(minfilterstr, "linear"                )==0) minfilter = GL_LINEAR;
-            else if (strcmp(minfilterstr, "nearest-mipmap-nearest")==0) minfilter = GL_NEAREST_MIPMAP_NEAREST;
-            else if (strcmp(minfilterstr, "linear-mipmap-nearest" )==0) minfilter = GL_LINEAR_MIPMAP_NEAREST;
-            else if (strcmp(minfilterstr, "nearest-mipmap-linear" )==0) minfilter = GL_NEAREST_MIPMAP_LINEAR;
-            else if (strcmp(minfilterstr, "linear-mipmap-linear"  )==0) minfilter = GL_LINEAR_MIPMAP_LINEAR;
-            else return luaL_error(L, "unknown minfilter: %s", minfilterstr);
-        }
-        lua_pop(L, 1);
+    glDisable(GL_CULL_FACE);
 
-        if (lua_getfield(L, 4, "magfilter")==LUA_TSTRING) {
-            const char *magfilterstr = lua_tostring(L, -1);
-            if      (strcmp(magfilterstr, "nearest")==0) magfilter = GL_NEAREST;
-            else if (strcmp(magfilterstr, "linear" )==0) magfilter = GL_LINEAR;
-            else return luaL_error(L,"unknown magfilter: %s", magfilterstr);
-        }
-        lua_pop(L, 1);
+    gl_shader_program_use(overlay_3d->polyline_program);
 
-        if (lua_getfield(L, 4, "maxaniso")==LUA_TNUMBER) max_aniso = (float)lua_tonumber(L, -1);
-        lua_pop(L, 1);
+    glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
+    glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
+
+    int oldvp[4] = {0};
+    if (!overlay_3d->mapfullscreen) {
+        glGetIntegerv(GL_VIEWPORT, oldvp);
+        glViewport(
+            overlay_3d->minimapleft,
+            overlay_3d->minimapbottom,
+            overlay_3d->minimapwidth,
+            overlay_3d->minimapheight
+        );
     }
 
-    int channels = 0;
-    int width = 0;
-    int height = 0;
-    uint8_t *pixels = stbi_load_from_memory(data, (int)datalen, &width, &height, &channels, 4);
+    glBindVertexArray(batch->vao);
 
-    if (!pixels) return luaL_error(L, "failed to load texture data");
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)batch->segment_count);
+    profiler_count_draw(1, (int)batch->segment_count);
 
-    if (map->texture_count==map->hash_map_size) texture_map_resize_hash_map(map);
-
-    uint32_t hash = djb2_hash_string(name);
-    int ind = hash % map->hash_map_size;
+    glBindVertexArray(0);
+    glUseProgram(0);
 
-    while (map->keys[ind]) {
-        ind++;
-        if (ind>=map->hash_map_size) ind = 0;
+    if (!overlay_3d->mapfullscreen) {
+        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
     }
 
-    map->keys[ind] = egoverlay_calloc(namelen+1, sizeof(char));
-    memcpy(map->keys[ind], name, namelen);
+    glEnable(GL_CULL_FACE);
 
-    texture_map_texture_t *tex = egoverlay_calloc(1, sizeof(texture_map_texture_t));
-    map->texture_info[ind] = tex;
+    return 0;
+}
 
-    // calculate how large a square texture needs to be:
-    // what's the smallest power of 2 that is greater than or equal to the
-    // width and height?
-    int32_t req_size = 16;
-    while (req_size < width || req_size < height) req_size <<= 1;
+#define TEXTURE_MAP_MT "EGOverlayTextureMap"
+#define lua_checktexturemap(L, ind) (texture_map_t*)luaL_checkudata(L, ind, TEXTURE_MAP_MT)
 
-    tex->xy_ratio = (float)width / (float)height;
-    tex->max_u = (float)width / (float)req_size;
-    tex->max_v = (float)height / (float)req_size;
+#define SPRITE_LIST_MT "EGOverlaySpriteList"
+#define lua_checkspritelist(L, ind) (sprite_list_t*)luaL_checkudata(L, ind, SPRITE_LIST_MT)
 
-    GLsizei mipmaplevels = 1;
+#define TRAIL_LIST_MT "EGOverlayTrailList"
+#define lua_checktraillist(L, ind) (trail_list_t*)luaL_checkudata(L, ind, TRAIL_LIST_MT)
 
-    if (mipmaps) mipmaplevels += (GLsizei)floorf(log2f((float)req_size));
+luaL_Reg texture_map_funcs[] = {
+    "__gc" , &texture_map_lua_del,
+    "clear", &texture_map_lua_clear,
+    "add"  , &texture_map_lua_add,
+    "addfromzip", &texture_map_lua_add_from_zip,
+    "has"  , &texture_map_lua_has,
+    NULL   , NULL
+};
 
-    glGenTextures(1, &tex->texture);
+luaL_Reg sprite_list_funcs[] = {
+    "__gc"  , &sprite_list_lua_del,
+    "clear" , &sprite_list_lua_clear,
+    "add"   , &sprite_list_lua_add_sprite,
+    "addbatch", &sprite_list_lua_add_sprites,
+    "update", &sprite_list_lua_update_sprites,
+    "remove", &sprite_list_lua_remove_sprites,
+    "draw"  , &sprite_list_lua_draw,
+    "nearest"  , &sprite_list_lua_nearest,
+    "indextag" , &sprite_list_lua_index_tag,
+    "pointedat", &sprite_list_lua_pointedat,
+    "cluster"  , &sprite_list_lua_cluster,
+    NULL    , NULL
+};
 
-    glBindTexture(GL_TEXTURE_2D, tex->texture);
+luaL_Reg trail_list_funcs[] = {
+    "__gc"   , &trail_list_lua_del,
+    "clear"  , &trail_list_lua_clear,
+    "add"    , &trail_list_lua_add,
+    "addbatch", &trail_list_lua_add_batch,
+    "remove" , &trail_list_lua_remove,
+    "progress", &trail_list_lua_progress,
+    "draw"   , &trail_list_lua_draw,
+    "update" , &trail_list_lua_update,
+    NULL     , NULL
+};
+
+/*** RST
+.. lua:function:: texturemap()
+
+    Create a new :lua:class:`o3dtexturemap` object.
+
+    :rtype: o3dtexturemap
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int texture_map_lua_new(lua_State *L) {
+    texture_map_t *map = lua_newuserdata(L, sizeof(texture_map_t));
+    memset(map, 0, sizeof(texture_map_t));
+
+    map->hash_map_size = 8;
+
+    map->keys         = egoverlay_calloc(map->hash_map_size, sizeof(char*));
+    map->texture_info = egoverlay_calloc(map->hash_map_size, sizeof(texture_map_texture_t*));
+
+    texture_map_live_t *live = egoverlay_calloc(1, sizeof(texture_map_live_t));
+    live->map = map;
+    live->next = live_texture_maps;
+    live_texture_maps = live;
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magfilter);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, max_aniso);
+    if (luaL_newmetatable(L, TEXTURE_MAP_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, texture_map_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
 
-    glTexStorage2D(GL_TEXTURE_2D, mipmaplevels, GL_RGBA8, req_size, req_size);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return 1;
+}
 
-    if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+int texture_map_lua_del(lua_State *L) {
+    texture_map_t *map = lua_checktexturemap(L, 1);
 
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    texture_map_live_t **l = &live_texture_maps;
+    while (*l) {
+        if ((*l)->map==map) {
+            texture_map_live_t *dead = *l;
+            *l = dead->next;
+            egoverlay_free(dead);
+            break;
+        }
+        l = &(*l)->next;
+    }
 
-    map->texture_count++;
+    for (size_t k=0;k<map->hash_map_size;k++) {
+        if (map->keys[k]==NULL) continue;
 
-    stbi_image_free(pixels);
+        if (map->texture_info[k]->texture && map->texture_info[k]->texture!=texture_placeholder) {
+            texture_map_texture_release_handle(map->texture_info[k]);
+            glDeleteTextures(1, &map->texture_info[k]->texture);
+        }
+        egoverlay_free(map->texture_info[k]);
+        egoverlay_free(map->keys[k]);
+    }
+
+    if (map->atlas.texture) glDeleteTextures(1, &map->atlas.texture);
+    if (map->atlas.layer_count) {
+        egoverlay_free(map->atlas.shelf_x);
+        egoverlay_free(map->atlas.shelf_y);
+        egoverlay_free(map->atlas.shelf_h);
+    }
+
+    egoverlay_free(map->texture_info);
+    egoverlay_free(map->keys);
 
     return 0;
 }
 
 /*** RST
-    .. lua:method:: has(name)
+.. lua:function:: spritelist(texturemap[, position])
 
-        Returns ``true`` if this map has a texture named ``name``.
+    Create a new :lua:class:`o3dspritelist` object.
 
-        :param string name:
+    :param o3dtexturemap texturemap:
+    :param string position: (Optional) How the sprites in this list will be
+        positioned. See below, default ``'world'``.
+    :rtype: o3dspritelist
 
-        :rtype: boolean
+    **Position Values**
 
-        .. versionhistory::
-            :0.1.0: Added
+    =========== ================================================================
+    Value       Description
+    =========== ================================================================
+    ``'world'`` Sprites are drawn within the 3D world, coordinates must be in
+                map coordinates.
+    ``'map'``   Sprites are dawn on the (mini)map, coordinates must be in
+                continent coordinates.
+    =========== ================================================================
+
+    .. versionhistory::
+        :0.1.0: Added
 */
-int texture_map_lua_has(lua_State *L) {
-    texture_map_t *map = lua_checktexturemap(L, 1);
-    const char *name = luaL_checkstring(L, 2);
+int64_t sprite_grid_cell_key(int64_t cx, int64_t cy, int64_t cz) {
+    return (cx & 0x1FFFFF) | ((cy & 0x1FFFFF) << 21) | ((cz & 0x1FFFFF) << 42);
+}
 
-    uint32_t hash = djb2_hash_string(name);
-    size_t ind = hash % map->hash_map_size;
+int64_t sprite_grid_key(float x, float y, float z) {
+    int64_t cx = (int64_t)floorf(x / SPRITE_GRID_CELL_SIZE);
+    int64_t cy = (int64_t)floorf(y / SPRITE_GRID_CELL_SIZE);
+    int64_t cz = (int64_t)floorf(z / SPRITE_GRID_CELL_SIZE);
 
-    if (map->keys[ind]==NULL) {
-        lua_pushboolean(L, 0);
-        return 1;
-    }
+    return sprite_grid_cell_key(cx, cy, cz);
+}
 
-    while (strcmp(map->keys[ind], name)!=0) {
-        ind++;
-        if (ind >= map->hash_map_size) ind = 0;
-        if (map->keys[ind]==NULL || ind==hash%map->hash_map_size) {
-            lua_pushboolean(L, 0);
-            return 1;
-        }
+void sprite_list_grid_free(sprite_list_t *list) {
+    if (!list->grid_cells) return;
+
+    for (size_t c=0;c<list->grid_size;c++) {
+        if (list->grid_cells[c].refs) egoverlay_free(list->grid_cells[c].refs);
     }
+    egoverlay_free(list->grid_cells);
 
-    lua_pushboolean(L, 1);
-    return 1;
+    list->grid_cells = NULL;
+    list->grid_size = 0;
 }
 
-/*** RST
+sprite_grid_cell_t *sprite_list_grid_cell(sprite_list_t *list, int64_t key, int create) {
+    size_t ind = (size_t)key % list->grid_size;
 
-.. lua:class:: o3dspritelist
-    
-    A sprite list efficiently draws multiple sprites or icons within the 3D
-    scene, each with their own attributes and texture. Sprite lists use
-    textures from a :lua:class:`o3dtexturemap`.
+    while (list->grid_cells[ind].used) {
+        if (list->grid_cells[ind].key==key) return &list->grid_cells[ind];
+        ind = (ind + 1) % list->grid_size;
+    }
 
-    A sprite list stores all sprite information in one place and can render
-    all sprites in a single call, making it much more efficient to draw larger
-    numbers of sprites than drawing each one individually.
+    if (!create) return NULL;
 
-    In addition to the attributes used to display them, each sprite can also
-    have arbitrary data stored in 'tags.' This can be used to remove or update
-    individual or groups of sprites later.
-*/
+    list->grid_cells[ind].used = 1;
+    list->grid_cells[ind].key = key;
 
-/** RST
-    .. lua:method:: clear()
+    return &list->grid_cells[ind];
+}
 
-        Reset this sprite list to an initial state.
+void sprite_list_grid_rebuild(sprite_list_t *list) {
+    sprite_list_grid_free(list);
 
-        .. versionhistory::
-            :0.1.0: Added
-*/
-int sprite_list_lua_clear(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
+    size_t size = 64;
+    while (size < list->total_sprite_count * 2) size *= 2;
+
+    list->grid_cells = egoverlay_calloc(size, sizeof(sprite_grid_cell_t));
+    list->grid_size = size;
 
     for (size_t t=0;t<list->texture_count;t++) {
         for (size_t s=0;s<list->sprite_counts[t];s++) {
-            if (list->tags[t][s]>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
-        }
+            sprite_list_sprite_t *sprite = list->sprites[t] + s;
 
-        egoverlay_free(list->tags[t]);
-        egoverlay_free(list->sprites[t]);
-        egoverlay_free(list->texture_keys[t]);
+            int64_t key = sprite_grid_key(sprite->position.x, sprite->position.y, sprite->position.z);
+            sprite_grid_cell_t *cell = sprite_list_grid_cell(list, key, 1);
+
+            if (cell->count==cell->capacity) {
+                cell->capacity = cell->capacity ? cell->capacity * 2 : 4;
+                cell->refs = egoverlay_realloc(cell->refs, cell->capacity * sizeof(sprite_grid_ref_t));
+            }
+
+            cell->refs[cell->count].texture = t;
+            cell->refs[cell->count].sprite = s;
+            cell->count++;
+        }
     }
 
-    egoverlay_free(list->tags);
-    egoverlay_free(list->sprites);
-    egoverlay_free(list->texture_keys);
-    egoverlay_free(list->sprite_counts);
+    list->grid_dirty = 0;
+}
 
-    list->texture_count = 0;
-    list->tags          = NULL;
-    list->sprites       = NULL;
-    list->texture_keys  = NULL;
-    list->sprite_counts = NULL;
+void sprite_list_tagindex_free(sprite_list_t *list) {
+    if (!list->tagindex) return;
 
-    return 0;
+    for (size_t b=0;b<list->tagindex_size;b++) {
+        if (list->tagindex[b].refs) egoverlay_free(list->tagindex[b].refs);
+    }
+    egoverlay_free(list->tagindex);
+
+    list->tagindex = NULL;
+    list->tagindex_size = 0;
 }
 
-void sprite_list_sprite_update(sprite_list_sprite_t *sprite, lua_State *L, int ind) {
-    if (lua_getfield(L, ind, "x")!=LUA_TNIL) sprite->position.x = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+sprite_tag_bucket_t *sprite_list_tagindex_bucket(sprite_list_t *list, uint32_t hash, int create) {
+    size_t ind = hash % list->tagindex_size;
 
-    if (lua_getfield(L, ind, "y")!=LUA_TNIL) sprite->position.y = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    while (list->tagindex[ind].used) {
+        if (list->tagindex[ind].hash==hash) return &list->tagindex[ind];
+        ind = (ind + 1) % list->tagindex_size;
+    }
 
-    if (lua_getfield(L, ind, "z")!=LUA_TNIL) sprite->position.z = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    if (!create) return NULL;
 
-    if (lua_getfield(L, ind, "size")!=LUA_TNIL) sprite->size = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    list->tagindex[ind].used = 1;
+    list->tagindex[ind].hash = hash;
 
-    if (lua_getfield(L, ind, "fadenear")!=LUA_TNIL) sprite->fade_near = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    return &list->tagindex[ind];
+}
 
-    if (lua_getfield(L, ind, "fadefar")!=LUA_TNIL) sprite->fade_far = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+// Bucket every sprite by the hash of its indexed tag value. Assumes the
+// indexed tag values don't change after a sprite is added (tags tables are
+// referenced, not copied).
+void sprite_list_tagindex_rebuild(sprite_list_t *list, lua_State *L) {
+    sprite_list_tagindex_free(list);
 
-    if (lua_getfield(L, ind, "billboard")!=LUA_TNIL) {
-        int billboard = lua_toboolean(L, -1);
-        sprite->flags = (sprite->flags & ~0x01) | billboard;
-    }
-    lua_pop(L, 1);
+    size_t size = 64;
+    while (size < list->total_sprite_count * 2) size *= 2;
 
-    if (lua_getfield(L, ind, "color")!=LUA_TNIL) {
-        ui_color_t color = (ui_color_t)lua_tointeger(L, -1);
-        sprite->color.r = UI_COLOR_R(color);
-        sprite->color.g = UI_COLOR_G(color);
-        sprite->color.g = UI_COLOR_G(color);
-        sprite->color.a = UI_COLOR_A(color);
-    }
-    lua_pop(L, 1);
+    list->tagindex = egoverlay_calloc(size, sizeof(sprite_tag_bucket_t));
+    list->tagindex_size = size;
 
-    if (lua_getfield(L, ind, "rotation")!=LUA_TNIL) {
-        mat4f_identity(&sprite->rotation);
-        float x = 0.f;
-        float y = 0.f;
-        float z = 0.f;
+    for (size_t t=0;t<list->texture_count;t++) {
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            if (list->tags[t][s]<0) continue;
 
-        lua_geti(L, -1, 1); x = (float)lua_tonumber(L, -1); lua_pop(L, 1);
-        lua_geti(L, -1, 2); y = (float)lua_tonumber(L, -1); lua_pop(L, 1);
-        lua_geti(L, -1, 3); z = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+            lua_geti(L, LUA_REGISTRYINDEX, list->tags[t][s]);
 
-        mat4f_t xr = {0};
-        mat4f_t yr = {0};
-        mat4f_t zr = {0};
+            if (lua_getfield(L, -1, list->indextag)==LUA_TSTRING) {
+                uint32_t hash = djb2_hash_string(lua_tostring(L, -1));
+                sprite_tag_bucket_t *bucket = sprite_list_tagindex_bucket(list, hash, 1);
 
-        mat4f_t zy = {0};
+                if (bucket->count==bucket->capacity) {
+                    bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 8;
+                    bucket->refs = egoverlay_realloc(bucket->refs, bucket->capacity * sizeof(sprite_grid_ref_t));
+                }
 
-        mat4f_rotatex(&xr, deg2rad(x));
-        mat4f_rotatey(&yr, deg2rad(y));
-        mat4f_rotatez(&zr, deg2rad(z));
+                bucket->refs[bucket->count].texture = t;
+                bucket->refs[bucket->count].sprite = s;
+                bucket->count++;
+            }
 
-        mat4f_mult_mat4f(&zr, &yr, &zy);
-        mat4f_mult_mat4f(&zy, &xr, &sprite->rotation);
+            lua_pop(L, 2);
+        }
     }
-    lua_pop(L, 1); 
+
+    list->tagindex_dirty = 0;
 }
 
-/*** RST
-    .. lua:method:: add(texture, attributes)
+void sprite_list_setup_vbo_attribs(sprite_list_t *list) {
+    glBindVertexArray(list->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
 
-        Add a sprite to this list. ``attributes`` must a table with the
-        following fields:
+    // VBO contents, shader inputs
+    VERT_ATTRIB_VEC3 (0, 1, sprite_list_sprite_t, position );
+    VERT_ATTRIB_FLOAT(1, 1, sprite_list_sprite_t, max_u    );
+    VERT_ATTRIB_FLOAT(2, 1, sprite_list_sprite_t, max_v    );
+    VERT_ATTRIB_FLOAT(3, 1, sprite_list_sprite_t, xy_ratio );
+    VERT_ATTRIB_FLOAT(4, 1, sprite_list_sprite_t, size     );
+    VERT_ATTRIB_FLOAT(5, 1, sprite_list_sprite_t, fade_near);
+    VERT_ATTRIB_FLOAT(6, 1, sprite_list_sprite_t, fade_far );
+    VERT_ATTRIB_VEC4 (7, 1, sprite_list_sprite_t, color    );
+    VERT_ATTRIB_UINT (8, 1, sprite_list_sprite_t, flags    );
+    VERT_ATTRIB_VEC3 (9, 1, sprite_list_sprite_t, rotation );
+    VERT_ATTRIB_VEC2 (10, 1, sprite_list_sprite_t, atlas_u0   );
+    VERT_ATTRIB_FLOAT(11, 1, sprite_list_sprite_t, atlas_layer);
+    VERT_ATTRIB_VEC4 (12, 1, sprite_list_sprite_t, anim       );
+    VERT_ATTRIB_UVEC2(13, 1, sprite_list_sprite_t, tex_handle );
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+// Make sure the instance ring can hold at least instances sprites per
+// section. Buffer storage is immutable, so growing means waiting out any
+// in-flight sections and replacing the buffer.
+void sprite_list_ensure_vbo_capacity(sprite_list_t *list, size_t instances) {
+    if (list->vbo_capacity >= instances) return;
+
+    size_t newcap = list->vbo_capacity ? list->vbo_capacity : 256;
+    while (newcap < instances) newcap *= 2;
+
+    if (list->vbo_map) {
+        for (int i=0;i<3;i++) {
+            if (list->vbo_fences[i]) {
+                glClientWaitSync(list->vbo_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(list->vbo_fences[i]);
+                list->vbo_fences[i] = NULL;
+            }
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &list->vbo);
+
+        glGenBuffers(1, &list->vbo);
+        sprite_list_setup_vbo_attribs(list);
+    }
+
+    GLbitfield mapflags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+    glBufferStorage(GL_ARRAY_BUFFER, newcap * 3 * sizeof(sprite_list_sprite_t), NULL, mapflags);
+    list->vbo_map = (sprite_list_sprite_t*)glMapBufferRange(
+        GL_ARRAY_BUFFER,
+        0,
+        newcap * 3 * sizeof(sprite_list_sprite_t),
+        mapflags
+    );
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    list->vbo_capacity = newcap;
+    list->vbo_section = 0;
+}
+
+// Advance to the next ring section and return a pointer to write instances
+// into. Waits on the section's fence if the GPU is still reading it.
+sprite_list_sprite_t *sprite_list_next_vbo_section(sprite_list_t *list, size_t instances) {
+    sprite_list_ensure_vbo_capacity(list, instances);
+
+    list->vbo_section = (list->vbo_section + 1) % 3;
+
+    if (list->vbo_fences[list->vbo_section]) {
+        glClientWaitSync(list->vbo_fences[list->vbo_section], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(list->vbo_fences[list->vbo_section]);
+        list->vbo_fences[list->vbo_section] = NULL;
+    }
+
+    list->vbo_draw_base = (size_t)list->vbo_section * list->vbo_capacity;
+
+    return list->vbo_map + list->vbo_draw_base;
+}
+
+int sprite_list_lua_new(lua_State *L) {
+    texture_map_t *texmap = lua_checktexturemap(L, 1);
+
+    int map = 0;
+    if (lua_gettop(L)>=2) {
+        const char *position = lua_tostring(L, 2);
+
+        if (strcmp(position, "world")==0) map = 0;
+        else if (strcmp(position, "map")==0) map = 1;
+        else return luaL_error(L, "position must be either 'world' or 'map'");
+    }
+
+    sprite_list_t *list = lua_newuserdata(L, sizeof(sprite_list_t));
+    memset(list, 0, sizeof(sprite_list_t));
+
+    if (luaL_newmetatable(L, SPRITE_LIST_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, sprite_list_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    list->map = map;
+
+    list->texture_map = texmap;
+    list->seen_texture_generation = texmap->texture_generation;
+    lua_pushvalue(L, 1);
+    list->texture_map_luaref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    glGenVertexArrays(1, &list->vao);
+    glGenBuffers(1, &list->vbo);
+
+    sprite_list_setup_vbo_attribs(list);
+
+    return 1;
+}
+
+int sprite_list_lua_del(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    for (int i=0;i<3;i++) {
+        if (list->vbo_fences[i]) glDeleteSync(list->vbo_fences[i]);
+    }
+
+    if (list->vbo_map) {
+        glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glDeleteBuffers(1, &list->vbo);
+    glDeleteVertexArrays(1, &list->vao);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        if (list->sprite_counts[t]) {
+            for (size_t s=0;s<list->sprite_counts[t];s++) {
+                if (list->tags[t][s]>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
+            }
+
+            egoverlay_free(list->sprites[t]);
+            egoverlay_free(list->tags[t]);
+            egoverlay_free(list->lodbuckets[t]);
+            egoverlay_free(list->filterbits[t]);
+        }
+        // texture keys are interned; never freed
+    }
+
+    if (list->texture_count) {
+        egoverlay_free(list->texture_keys);
+        egoverlay_free(list->sprite_counts);
+        egoverlay_free(list->sprites);
+        egoverlay_free(list->tags);
+        egoverlay_free(list->lodbuckets);
+        egoverlay_free(list->filterbits);
+        egoverlay_free(list->culled_counts);
+    if (list->cluster_cells) egoverlay_free(list->cluster_cells);
+        egoverlay_free(list->dirty_min);
+        egoverlay_free(list->dirty_max);
+    }
+
+    sprite_list_grid_free(list);
+    sprite_list_tagindex_free(list);
+    if (list->indextag) egoverlay_free(list->indextag);
+
+    luaL_unref(L, LUA_REGISTRYINDEX, list->texture_map_luaref);
+
+    return 0;
+}
+
+/*** RST
+.. lua:function:: traillist(texturemap[, position])
+
+    Create a new :lua:class:`o3dtraillist` object.
+
+    :param texturemap texturemap:
+    :param string position: (Optional) How the trails in this list will be
+        positioned. See below, default ``'world'``.
+    :rtype: o3dspritelist
+
+    **Position Values**
+
+    =========== ================================================================
+    Value       Description
+    =========== ================================================================
+    ``'world'`` Trails are drawn within the 3D world, coordinates must be in
+                map coordinates.
+    ``'map'``   Trails are dawn on the (mini)map, coordinates must be in
+                continent coordinates.
+    =========== ================================================================
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int trail_list_lua_new(lua_State *L) {
+    texture_map_t *texture_map = lua_checktexturemap(L, 1);
+
+    int map = 0;
+    if (lua_gettop(L)>=2) {
+        const char *position = lua_tostring(L, 2);
+
+        if (strcmp(position, "world")==0) map = 0;
+        else if (strcmp(position, "map")==0) map = 1;
+        else return luaL_error(L, "position must be either 'world' or 'map'");
+    }
+
+    trail_list_t *list = lua_newuserdata(L, sizeof(trail_list_t));
+    memset(list, 0, sizeof(trail_list_t));
+
+    lua_pushvalue(L, 1);
+    list->texture_map_luaref = luaL_ref(L, LUA_REGISTRYINDEX);
+    list->texture_map = texture_map;
+    list->map = map;
+
+    glGenVertexArrays(1, &list->vao);
+    glGenBuffers(1, &list->vbo);
+
+    glBindVertexArray(list->vao);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+
+    VERT_ATTRIB_VEC3(0, 0, trail_coordinate_t, position);
+    VERT_ATTRIB_VEC2(1, 0, trail_coordinate_t, u       );
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    if (luaL_newmetatable(L, TRAIL_LIST_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, trail_list_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+int trail_list_lua_del(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    glDeleteBuffers(1, &list->vbo);
+    glDeleteVertexArrays(1, &list->vao);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        // texture keys are interned; never freed
+
+        for (size_t trail=0;trail<list->trail_counts[t];trail++) {
+            if (list->trails[t][trail].tags>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->trails[t][trail].tags);
+            if (list->trails[t][trail].points) egoverlay_free(list->trails[t][trail].points);
+            if (list->trails[t][trail].chunks) egoverlay_free(list->trails[t][trail].chunks);
+            if (list->trails[t][trail].arclen) egoverlay_free(list->trails[t][trail].arclen);
+            if (list->trails[t][trail].seggroups) egoverlay_free(list->trails[t][trail].seggroups);
+        }
+        egoverlay_free(list->trails[t]);
+    }
+    if (list->texture_count) {
+        egoverlay_free(list->texture_keys);
+        egoverlay_free(list->trails);
+        egoverlay_free(list->trail_counts);
+    }
+
+    if (list->md_capacity) {
+        egoverlay_free(list->md_firsts);
+        egoverlay_free(list->md_counts);
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, list->texture_map_luaref);
+
+    return 0;
+}
+
+/*** RST
+Classes
+-------
+*/
+
+/*** RST
+.. lua:class:: o3dtexturemap
+
+    A texture map holds a list of textures that other objects in this module
+    use when being displayed. 
+*/
+
+/*** RST
+    .. lua:method:: clear()
+
+        Remove all textures from this map and reset it to an initial state.
+
+        .. danger::
+
+            If sprite lists or other objects are still referencing textures
+            within this map after this method is called their draws will not
+            function properly.
+
+        .. versionhistory::
+            :0.1.0: Added
+        
+*/
+int texture_map_lua_clear(lua_State *L) {
+    texture_map_t *map = lua_checktexturemap(L, 1);
+
+    for (size_t k=0;k<map->hash_map_size;k++) {
+        if (map->keys[k]==NULL) continue;
+
+        if (map->texture_info[k]->texture && map->texture_info[k]->texture!=texture_placeholder) {
+            texture_map_texture_release_handle(map->texture_info[k]);
+            glDeleteTextures(1, &map->texture_info[k]->texture);
+        }
+        egoverlay_free(map->texture_info[k]);
+        map->texture_info[k] = NULL;
+        egoverlay_free(map->keys[k]);
+        map->keys[k] = NULL;
+    }
+
+    // invalidate any async loads still in flight for this map
+    map->generation++;
+
+    if (map->atlas.texture) {
+        glDeleteTextures(1, &map->atlas.texture);
+        egoverlay_free(map->atlas.shelf_x);
+        egoverlay_free(map->atlas.shelf_y);
+        egoverlay_free(map->atlas.shelf_h);
+
+        map->atlas.texture = 0;
+        map->atlas.layer_count = 0;
+        map->atlas.shelf_x = NULL;
+        map->atlas.shelf_y = NULL;
+        map->atlas.shelf_h = NULL;
+    }
+
+    map->texture_count = 0;
+
+    return 0;
+}
+
+texture_map_texture_t *texture_map_get(texture_map_t *map, const char *name) {
+    if (!map->keys) return NULL;
+    if (!name) return NULL;
+
+    uint32_t hash = djb2_hash_string(name);
+    size_t ind = hash % map->hash_map_size;
+
+    if (map->keys[ind]==NULL) return NULL;
+
+    while (map->keys[ind] && strcmp(name, map->keys[ind])!=0) {
+        ind++;
+        // this is a special case, name is a collision but it isn't in the map
+        // yet
+        if (ind==hash % map->hash_map_size) return NULL;
+
+        if (ind>=map->hash_map_size) {
+            // edge case, hash % map->hash_map_size == 0
+            if (hash % map->hash_map_size == 0) return NULL;
+            ind = 0;
+        }
+    }
+
+    return map->texture_info[ind];
+}
+
+void texture_map_resize_hash_map(texture_map_t *map) {
+    size_t newsize = map->hash_map_size + 8;
+
+    char **newkeys = egoverlay_calloc(newsize, sizeof(char*));
+    texture_map_texture_t **newinfos = egoverlay_calloc(newsize, sizeof(texture_map_texture_t*));
+
+    for (size_t oldind=0;oldind<map->hash_map_size;oldind++) {
+        if (map->keys[oldind]==NULL) continue; //shouldn't happen
+
+        uint32_t hash = djb2_hash_string(map->keys[oldind]);
+        size_t newind = hash % newsize;
+
+        while (newkeys[newind]) {
+            newind++;
+            if (newind>=newsize) newind = 0;
+        }
+        newkeys[newind] = map->keys[oldind];
+        newinfos[newind] = map->texture_info[oldind];
+    }
+
+    egoverlay_free(map->keys);
+    egoverlay_free(map->texture_info);
+    map->keys          = newkeys;
+    map->texture_info  = newinfos;
+    map->hash_map_size = newsize;
+}
+
+// On-disk cache of driver compressed texture levels, keyed by a hash of the
+// source image data. The header is followed by levels entries of an int32_t
+// byte length and the compressed level data.
+typedef struct {
+    char magic[4]; // EGTC
+    int32_t format;
+    int32_t size;   // width/height of level 0
+    int32_t levels;
+} texture_cache_header_t;
+
+void texture_cache_path(char *path, size_t pathlen, const uint8_t *data, size_t datalen) {
+    snprintf(path, pathlen, "texture-cache/%08x-%zx.egtc", djb2_hash_data(data, datalen), datalen);
+}
+
+// Try to upload a previously compressed texture from the disk cache.
+// The texture must already be bound to GL_TEXTURE_2D.
+int texture_map_upload_cached(const uint8_t *data, size_t datalen, int32_t req_size, GLsizei mipmaplevels) {
+    char cachepath[64];
+    texture_cache_path(cachepath, sizeof(cachepath), data, datalen);
+
+    FILE *f = fopen(cachepath, "rb");
+    if (!f) return 0;
+
+    texture_cache_header_t header = {0};
+    if (fread(&header, sizeof(header), 1, f)!=1 ||
+        memcmp(header.magic, "EGTC", 4)!=0 ||
+        header.size!=req_size ||
+        header.levels!=mipmaplevels
+    ) {
+        fclose(f);
+        return 0;
+    }
+
+    int32_t lsize = req_size;
+    for (int32_t level=0;level<header.levels;level++) {
+        int32_t length = 0;
+        if (fread(&length, sizeof(length), 1, f)!=1 || length<=0) {
+            fclose(f);
+            return 0;
+        }
+
+        uint8_t *leveldata = egoverlay_malloc(length);
+        if (fread(leveldata, 1, length, f)!=(size_t)length) {
+            egoverlay_free(leveldata);
+            fclose(f);
+            return 0;
+        }
+
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, header.format, lsize, lsize, 0, length, leveldata);
+        egoverlay_free(leveldata);
+
+        if (lsize > 1) lsize /= 2;
+    }
+
+    fclose(f);
+
+    return 1;
+}
+
+// Upload pixels as a BC7 (BPTC) compressed texture with mipmaps. The driver
+// does the transcode, which is slow, so the compressed levels are read back
+// and cached on disk; subsequent loads of the same image skip the transcode
+// entirely. The texture must already be bound to GL_TEXTURE_2D.
+void texture_map_upload_compressed(
+    const uint8_t *data,
+    size_t datalen,
+    uint8_t *pixels,
+    int width,
+    int height,
+    int32_t req_size,
+    GLsizei mipmaplevels
+) {
+    if (texture_map_upload_cached(data, datalen, req_size, mipmaplevels)) return;
+
+    logger_t *log = logger_get("lua-gl");
+
+    // pad the image out to the full square size; driver compression needs a
+    // single full level upload
+    uint8_t *padded = egoverlay_calloc((size_t)req_size * req_size * 4, sizeof(uint8_t));
+    for (int row=0;row<height;row++) {
+        memcpy(padded + ((size_t)row * req_size * 4), pixels + ((size_t)row * width * 4), (size_t)width * 4);
+    }
+
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_BPTC_UNORM,
+        req_size, req_size, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, padded
+    );
+    egoverlay_free(padded);
+
+    if (mipmaplevels > 1) glGenerateMipmap(GL_TEXTURE_2D);
+
+    GLint compressed = GL_FALSE;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+
+    if (!compressed) {
+        // the driver refused to compress; the texture is still usable, just
+        // not cacheable
+        logger_warn(log, "driver did not compress texture, not caching");
+        return;
+    }
+
+    CreateDirectory("texture-cache", NULL);
+
+    char cachepath[64];
+    texture_cache_path(cachepath, sizeof(cachepath), data, datalen);
+
+    FILE *f = fopen(cachepath, "wb");
+    if (!f) {
+        logger_warn(log, "can't write texture cache file %s", cachepath);
+        return;
+    }
+
+    texture_cache_header_t header = {0};
+    memcpy(header.magic, "EGTC", 4);
+    header.format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+    header.size = req_size;
+    header.levels = mipmaplevels;
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (GLsizei level=0;level<mipmaplevels;level++) {
+        GLint length = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &length);
+
+        uint8_t *leveldata = egoverlay_malloc(length);
+        glGetCompressedTexImage(GL_TEXTURE_2D, level, leveldata);
+
+        int32_t length32 = (int32_t)length;
+        fwrite(&length32, sizeof(length32), 1, f);
+        fwrite(leveldata, 1, length, f);
+        egoverlay_free(leveldata);
+    }
+
+    fclose(f);
+}
+
+// Grow the atlas texture array, copying existing layers into the new storage.
+void texture_map_atlas_grow(texture_map_atlas_t *atlas) {
+    GLsizei newcount = atlas->layer_count ? atlas->layer_count * 2 : 4;
+
+    GLuint newtex = 0;
+    glGenTextures(1, &newtex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, newtex);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, newcount);
+
+    if (atlas->texture) {
+        glCopyImageSubData(
+            atlas->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            newtex        , GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, atlas->layer_count
+        );
+        glDeleteTextures(1, &atlas->texture);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    atlas->texture = newtex;
+    atlas->shelf_x = egoverlay_realloc(atlas->shelf_x, newcount * sizeof(int));
+    atlas->shelf_y = egoverlay_realloc(atlas->shelf_y, newcount * sizeof(int));
+    atlas->shelf_h = egoverlay_realloc(atlas->shelf_h, newcount * sizeof(int));
+
+    for (GLsizei l=atlas->layer_count;l<newcount;l++) {
+        atlas->shelf_x[l] = 0;
+        atlas->shelf_y[l] = 0;
+        atlas->shelf_h[l] = 0;
+    }
+
+    atlas->layer_count = newcount;
+}
+
+// Shelf pack pixels into the atlas and record the placement on tex.
+void texture_map_atlas_insert(texture_map_t *map, texture_map_texture_t *tex, uint8_t *pixels, int width, int height) {
+    texture_map_atlas_t *atlas = &map->atlas;
+
+    int w = width + ATLAS_PAD;
+    int h = height + ATLAS_PAD;
+
+    int layer = -1;
+    int x = 0;
+    int y = 0;
+
+    while (layer < 0) {
+        for (GLsizei l=0;l<atlas->layer_count;l++) {
+            // close the open shelf if the image doesn't fit on it
+            if (atlas->shelf_x[l] + w > ATLAS_PAGE_SIZE) {
+                if (atlas->shelf_h[l]==0) continue; // empty shelf, image is just too wide
+
+                atlas->shelf_y[l] += atlas->shelf_h[l];
+                atlas->shelf_x[l] = 0;
+                atlas->shelf_h[l] = 0;
+            }
+
+            if (atlas->shelf_y[l] + h > ATLAS_PAGE_SIZE) continue; // layer is full
+
+            x = atlas->shelf_x[l];
+            y = atlas->shelf_y[l];
+            layer = (int)l;
+
+            atlas->shelf_x[l] += w;
+            if (h > atlas->shelf_h[l]) atlas->shelf_h[l] = h;
+            break;
+        }
+
+        if (layer < 0) texture_map_atlas_grow(atlas);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas->texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    tex->atlas_layer = layer;
+    tex->atlas_u0 = (float)x / (float)ATLAS_PAGE_SIZE;
+    tex->atlas_v0 = (float)y / (float)ATLAS_PAGE_SIZE;
+    tex->max_u = (float)width / (float)ATLAS_PAGE_SIZE;
+    tex->max_v = (float)height / (float)ATLAS_PAGE_SIZE;
+    tex->xy_ratio = (float)width / (float)height;
+}
+
+int texture_map_is_live(texture_map_t *map) {
+    for (texture_map_live_t *l=live_texture_maps;l;l=l->next) {
+        if (l->map==map) return 1;
+    }
+
+    return 0;
+}
+
+// Upload a finished decode into GL. Runs on the render thread, replayed
+// through the GL command layer.
+void texture_decode_job_finish(void *data) {
+    texture_decode_job_t *job = (texture_decode_job_t*)data;
+
+    logger_t *log = logger_get("lua-gl");
+
+    // the map may have been collected or cleared while the decode ran
+    int valid = texture_map_is_live(job->map) && job->map->generation==job->map_generation;
+
+    if (valid) {
+        valid = 0;
+        for (size_t k=0;k<job->map->hash_map_size;k++) {
+            if (job->map->keys[k] && job->map->texture_info[k]==job->tex) {
+                valid = 1;
+                break;
+            }
+        }
+    }
+
+    if (!valid || !job->pixels) {
+        if (!job->pixels && valid) logger_error(log, "failed to decode async texture data");
+        texture_decode_job_free(job);
+        return;
+    }
+
+    texture_map_texture_t *tex = job->tex;
+
+    if (job->atlas && job->width <= ATLAS_MAX_ENTRY && job->height <= ATLAS_MAX_ENTRY) {
+        texture_map_atlas_insert(job->map, tex, job->pixels, job->width, job->height);
+        tex->texture = 0;
+    } else {
+        int32_t req_size = 16;
+        while (req_size < job->width || req_size < job->height) req_size <<= 1;
+
+        tex->xy_ratio = (float)job->width / (float)job->height;
+        tex->max_u = (float)job->width / (float)req_size;
+        tex->max_v = (float)job->height / (float)req_size;
+
+        GLsizei mipmaplevels = 1;
+        if (job->mipmaps) mipmaplevels += (GLsizei)floorf(log2f((float)req_size));
+
+        glGenTextures(1, &tex->texture);
+        glBindTexture(GL_TEXTURE_2D, tex->texture);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, job->minfilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, job->magfilter);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, job->max_aniso);
+
+        if (job->compress) {
+            texture_map_upload_compressed(
+                job->data,
+                job->datalen,
+                job->pixels,
+                job->width,
+                job->height,
+                req_size,
+                mipmaplevels
+            );
+        } else {
+            glTexStorage2D(GL_TEXTURE_2D, mipmaplevels, GL_RGBA8, req_size, req_size);
+
+            // stream the pixels through the unpack buffer instead of
+            // sourcing the upload from client memory
+            if (!texture_upload_pbo) glGenBuffers(1, &texture_upload_pbo);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture_upload_pbo);
+            glBufferData(
+                GL_PIXEL_UNPACK_BUFFER,
+                (GLsizeiptr)job->width * job->height * 4,
+                job->pixels,
+                GL_STREAM_DRAW
+            );
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, job->width, job->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            if (job->mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        texture_map_texture_acquire_handle(tex);
+    }
+
+    job->map->texture_generation++;
+
+    texture_decode_job_free(job);
+}
+
+
+
+/*** RST
+    .. lua:method:: add(name, data[, options])
+
+        Add a texture.
+
+        :param string name: The name of the texture, this will be used to
+            reference it later when adding data to sprite lists and other
+            objects.
+        :param string data: The texture data.
+        :param table options: (Optional) A table of texture options. See below.
+
+
+        **Options**
+
+        +-----------+----------------------------------------------------------------------------------------+
+        | Field     | Description                                                                            |
+        +===========+========================================================================================+
+        | mipmaps   | A boolean indicating if mipmaps should be generated. Default ``true``.                 |
+        +-----------+----------------------------------------------------------------------------------------+
+        | atlas     | A boolean indicating if the texture may be packed into the shared sprite atlas.       |
+        |           | Atlas packed textures can not be used for trails. Default ``false`` when an options    |
+        |           | table is given, ``true`` otherwise.                                                    |
+        +-----------+----------------------------------------------------------------------------------------+
+        | compress  | A boolean indicating if the texture should be stored in a compressed (BC7) format.     |
+        |           | The compressed data is cached on disk, so the costly transcode only happens the first  |
+        |           | time an image is loaded. Default ``false``.                                            |
+        +-----------+----------------------------------------------------------------------------------------+
+        | async     | A boolean indicating if the image should be decoded on a background thread. The        |
+        |           | texture is usable immediately but renders as a white placeholder until the decode      |
+        |           | finishes, a few frames later. Async textures can not be used for trails.               |
+        |           | Default ``false``.                                                                     |
+        +-----------+----------------------------------------------------------------------------------------+
+        | minfilter | The filtering method used when the texture is displayed at a lower resolution. One of  |
+        |           |                                                                                        |           
+        |           | * ``nearest``                                                                          |
+        |           | * ``linear``                                                                           |
+        |           | * ``nearest-mipmap-nearest``                                                           |
+        |           | * ``linear-mipmap-nearest``                                                            |
+        |           | * ``nearest-mipmap-linear``                                                            |
+        |           | * ``linear-mipmap-linear``                                                             |
+        |           |                                                                                        |
+        |           | Default: ``nearest`` if ``mipmaps`` is ``false`` or ``linear-mipmap-linear`` if        |
+        |           | ``mipmaps`` is ``true``.                                                               |
+        +-----------+----------------------------------------------------------------------------------------+
+        | magfilter | The filtering method used when the texture is displayed at a higher resolution. One of |
+        |           |                                                                                        |
+        |           | * ``nearest``                                                                          |
+        |           | * ``linear``                                                                           |
+        |           |                                                                                        |
+        |           | Default: ``linear``                                                                    |
+        +-----------+----------------------------------------------------------------------------------------+
+        | maxaniso  | The amount of anisotropic to use. Default: the maximum supported on the system,        |
+        |           | probably ``16.0``                                                                      |
+        +-----------+----------------------------------------------------------------------------------------+
+
+        .. admonition:: Implementation Detail
+
+            EG-Overlay uses `stb_image <https://github.com/nothings/stb/blob/master/stb_image.h>`_
+            to load ``data``, so any format it supports can be used.
+
+            All textures are loaded as 4 channel RGBA images.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+// Shared implementation behind add and addfromzip: data/datalen is the
+// encoded image, optsind the stack index of the options table or 0.
+static int texture_map_add_data(
+    lua_State *L,
+    texture_map_t *map,
+    const char *name,
+    size_t namelen,
+    const uint8_t *data,
+    size_t datalen,
+    int optsind
+) {
+    if (texture_map_get(map, name)) return luaL_error(L, "duplicate texture name: %s", name);
+
+    float max_aniso = 0.f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max_aniso);
+
+    GLint minfilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLint magfilter = GL_LINEAR;
+    int mipmaps = 1;
+    int atlas = optsind==0;
+    int compress = 0;
+    int async = 0;
+
+    if (optsind) {
+        luaL_checktype(L, optsind, LUA_TTABLE);
+
+        if (lua_getfield(L, optsind, "atlas")!=LUA_TNIL) atlas = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, optsind, "compress")!=LUA_TNIL) compress = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, optsind, "async")!=LUA_TNIL) async = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        if (lua_getfield(L, optsind, "mipmaps")!=LUA_TNIL) mipmaps = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        if (!mipmaps) minfilter = GL_NEAREST;
+
+        if (lua_getfield(L, optsind, "minfilter")==LUA_TSTRING) {
+            const char *minfilterstr = lua_tostring(L, -1);
+            if      (strcmp(minfilterstr, "nearest"               )==0) minfilter = GL_NEAREST;
+            else if (strcmp(minfilterstr, "linear"                )==0) minfilter = GL_LINEAR;
+            else if (strcmp(minfilterstr, "nearest-mipmap-nearest")==0) minfilter = GL_NEAREST_MIPMAP_NEAREST;
+            else if (strcmp(minfilterstr, "linear-mipmap-nearest" )==0) minfilter = GL_LINEAR_MIPMAP_NEAREST;
+            else if (strcmp(minfilterstr, "nearest-mipmap-linear" )==0) minfilter = GL_NEAREST_MIPMAP_LINEAR;
+            else if (strcmp(minfilterstr, "linear-mipmap-linear"  )==0) minfilter = GL_LINEAR_MIPMAP_LINEAR;
+            else return luaL_error(L, "unknown minfilter: %s", minfilterstr);
+        }
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, optsind, "magfilter")==LUA_TSTRING) {
+            const char *magfilterstr = lua_tostring(L, -1);
+            if      (strcmp(magfilterstr, "nearest")==0) magfilter = GL_NEAREST;
+            else if (strcmp(magfilterstr, "linear" )==0) magfilter = GL_LINEAR;
+            else return luaL_error(L,"unknown magfilter: %s", magfilterstr);
+        }
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, optsind, "maxaniso")==LUA_TNUMBER) max_aniso = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+
+    if (async) {
+        // queue the decode for the background thread and render the texture
+        // as a small white placeholder until the upload lands
+        if (map->texture_count==map->hash_map_size) texture_map_resize_hash_map(map);
+
+        uint32_t hash = djb2_hash_string(name);
+        int ind = hash % map->hash_map_size;
+
+        while (map->keys[ind]) {
+            ind++;
+            if (ind>=map->hash_map_size) ind = 0;
+        }
+
+        map->keys[ind] = egoverlay_calloc(namelen+1, sizeof(char));
+        memcpy(map->keys[ind], name, namelen);
+
+        texture_map_texture_t *tex = egoverlay_calloc(1, sizeof(texture_map_texture_t));
+        map->texture_info[ind] = tex;
+        map->texture_count++;
+
+        if (!texture_placeholder) {
+            uint8_t white[16];
+            memset(white, 0xff, sizeof(white));
+
+            glGenTextures(1, &texture_placeholder);
+            glBindTexture(GL_TEXTURE_2D, texture_placeholder);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 2, 2);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 2, 2, GL_RGBA, GL_UNSIGNED_BYTE, white);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        tex->atlas_layer = -1;
+        tex->texture = texture_placeholder;
+        tex->max_u = 1.f;
+        tex->max_v = 1.f;
+        tex->xy_ratio = 1.f;
+
+        texture_decode_job_t *job = egoverlay_calloc(1, sizeof(texture_decode_job_t));
+        job->map = map;
+        job->tex = tex;
+        job->map_generation = map->generation;
+        job->data = egoverlay_malloc(datalen);
+        memcpy(job->data, data, datalen);
+        job->datalen = datalen;
+        job->atlas = atlas;
+        job->compress = compress;
+        job->mipmaps = mipmaps;
+        job->minfilter = minfilter;
+        job->magfilter = magfilter;
+        job->max_aniso = max_aniso;
+
+        if (!texture_decode_thread) {
+            texture_decode_mutex = CreateMutex(0, FALSE, NULL);
+            texture_decode_thread = CreateThread(0, 0, &texture_decode_thread_fn, NULL, 0, &texture_decode_thread_id);
+        }
+
+        WaitForSingleObject(texture_decode_mutex, INFINITE);
+        job->next = texture_decode_queue;
+        texture_decode_queue = job;
+        ReleaseMutex(texture_decode_mutex);
+
+        return 0;
+    }
+
+    int channels = 0;
+    int width = 0;
+    int height = 0;
+    uint8_t *pixels = stbi_load_from_memory(data, (int)datalen, &width, &height, &channels, 4);
+
+    if (!pixels) return luaL_error(L, "failed to load texture data");
+
+    if (map->texture_count==map->hash_map_size) texture_map_resize_hash_map(map);
+
+    uint32_t hash = djb2_hash_string(name);
+    int ind = hash % map->hash_map_size;
+
+    while (map->keys[ind]) {
+        ind++;
+        if (ind>=map->hash_map_size) ind = 0;
+    }
+
+    map->keys[ind] = egoverlay_calloc(namelen+1, sizeof(char));
+    memcpy(map->keys[ind], name, namelen);
+
+    texture_map_texture_t *tex = egoverlay_calloc(1, sizeof(texture_map_texture_t));
+    map->texture_info[ind] = tex;
+
+    tex->atlas_layer = -1;
+
+    // small images with default options go into the shared atlas so sprite
+    // draws over them can be batched into a single call
+    if (atlas && width <= ATLAS_MAX_ENTRY && height <= ATLAS_MAX_ENTRY) {
+        texture_map_atlas_insert(map, tex, pixels, width, height);
+
+        map->texture_count++;
+        stbi_image_free(pixels);
+
+        return 0;
+    }
+
+    // calculate how large a square texture needs to be:
+    // what's the smallest power of 2 that is greater than or equal to the
+    // width and height?
+    int32_t req_size = 16;
+    while (req_size < width || req_size < height) req_size <<= 1;
+
+    tex->xy_ratio = (float)width / (float)height;
+    tex->max_u = (float)width / (float)req_size;
+    tex->max_v = (float)height / (float)req_size;
+
+    GLsizei mipmaplevels = 1;
+
+    if (mipmaps) mipmaplevels += (GLsizei)floorf(log2f((float)req_size));
+
+    glGenTextures(1, &tex->texture);
+
+    glBindTexture(GL_TEXTURE_2D, tex->texture);
+    
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magfilter);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, max_aniso);
+
+    if (compress) {
+        texture_map_upload_compressed(data, datalen, pixels, width, height, req_size, mipmaplevels);
+    } else {
+        glTexStorage2D(GL_TEXTURE_2D, mipmaplevels, GL_RGBA8, req_size, req_size);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+        if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    texture_map_texture_acquire_handle(tex);
+
+    map->texture_count++;
+
+    stbi_image_free(pixels);
+
+    return 0;
+}
+
+int texture_map_lua_add(lua_State *L) {
+    texture_map_t *map = lua_checktexturemap(L, 1);
+    size_t namelen = 0;
+    const char *name = luaL_checklstring(L, 2, &namelen);
+    size_t datalen = 0;
+    const uint8_t *data = (const uint8_t*)luaL_checklstring(L, 3, &datalen);
+
+    return texture_map_add_data(L, map, name, namelen, data, datalen, lua_gettop(L)>=4 ? 4 : 0);
+}
+
+/*** RST
+    .. lua:method:: addfromzip(name, zip, path[, options])
+
+        Add a texture directly from a file inside a :lua:class:`zip`. The
+        encoded image bytes are read straight out of the zip (a zero copy
+        slice for stored entries) and decoded without ever being copied into
+        a Lua string, which saves hundreds of MB of transient allocations
+        when loading icon heavy packs.
+
+        :param string name: The name of the texture.
+        :param zip zip: An open zip file.
+        :param string path: The file path inside the zip.
+        :param table options: (Optional) See :lua:meth:`add`.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int texture_map_lua_add_from_zip(lua_State *L) {
+    texture_map_t *map = lua_checktexturemap(L, 1);
+    size_t namelen = 0;
+    const char *name = luaL_checklstring(L, 2, &namelen);
+    zip_t *zip = lua_checkzip(L, 3);
+    const char *path = luaL_checkstring(L, 4);
+
+    const uint8_t *data = NULL;
+    size_t datalen = 0;
+
+    if (zip_file_data(zip, path, &data, &datalen)) {
+        return luaL_error(L, "couldn't read %s from zip", path);
+    }
+
+    return texture_map_add_data(L, map, name, namelen, data, datalen, lua_gettop(L)>=5 ? 5 : 0);
+}
+
+/*** RST
+    .. lua:method:: has(name)
+
+        Returns ``true`` if this map has a texture named ``name``.
+
+        :param string name:
+
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int texture_map_lua_has(lua_State *L) {
+    texture_map_t *map = lua_checktexturemap(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+
+    uint32_t hash = djb2_hash_string(name);
+    size_t ind = hash % map->hash_map_size;
+
+    if (map->keys[ind]==NULL) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    while (strcmp(map->keys[ind], name)!=0) {
+        ind++;
+        if (ind >= map->hash_map_size) ind = 0;
+        if (map->keys[ind]==NULL || ind==hash%map->hash_map_size) {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/*** RST
+
+.. lua:class:: o3dspritelist
+    
+    A sprite list efficiently draws multiple sprites or icons within the 3D
+    scene, each with their own attributes and texture. Sprite lists use
+    textures from a :lua:class:`o3dtexturemap`.
+
+    A sprite list stores all sprite information in one place and can render
+    all sprites in a single call, making it much more efficient to draw larger
+    numbers of sprites than drawing each one individually.
+
+    In addition to the attributes used to display them, each sprite can also
+    have arbitrary data stored in 'tags.' This can be used to remove or update
+    individual or groups of sprites later.
+*/
+
+/** RST
+    .. lua:method:: clear()
+
+        Reset this sprite list to an initial state.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_clear(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            if (list->tags[t][s]>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
+        }
+
+        egoverlay_free(list->tags[t]);
+        egoverlay_free(list->lodbuckets[t]);
+        egoverlay_free(list->filterbits[t]);
+        egoverlay_free(list->sprites[t]);
+        // texture keys are interned; never freed
+    }
+
+    egoverlay_free(list->tags);
+    egoverlay_free(list->lodbuckets);
+    egoverlay_free(list->filterbits);
+    egoverlay_free(list->sprites);
+    egoverlay_free(list->texture_keys);
+    egoverlay_free(list->sprite_counts);
+    egoverlay_free(list->culled_counts);
+    if (list->cluster_cells) egoverlay_free(list->cluster_cells);
+    egoverlay_free(list->dirty_min);
+    egoverlay_free(list->dirty_max);
+
+    sprite_list_grid_free(list);
+    sprite_list_tagindex_free(list);
+
+    list->texture_count   = 0;
+    list->tags            = NULL;
+    list->lodbuckets      = NULL;
+    list->filterbits      = NULL;
+    list->sprites         = NULL;
+    list->texture_keys    = NULL;
+    list->sprite_counts   = NULL;
+    list->culled_counts   = NULL;
+    list->cluster_cells   = NULL;
+    list->cluster_cell_count = 0;
+    list->dirty_min       = NULL;
+    list->dirty_max       = NULL;
+    list->vbo_valid       = 0;
+    list->total_sprite_count = 0;
+
+    return 0;
+}
+
+// filterbits live in the cold side table, so callers with the sprite's
+// list position apply them separately from the attribute struct update
+void sprite_list_apply_filterbits(sprite_list_t *list, size_t texture, size_t sprite, lua_State *L, int ind) {
+    if (lua_getfield(L, ind, "filterbits")!=LUA_TNIL) {
+        list->filterbits[texture][sprite] = (uint64_t)lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+}
+
+void sprite_list_sprite_update(sprite_list_sprite_t *sprite, lua_State *L, int ind) {
+    if (lua_getfield(L, ind, "x")!=LUA_TNIL) sprite->position.x = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "y")!=LUA_TNIL) sprite->position.y = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "z")!=LUA_TNIL) sprite->position.z = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "size")!=LUA_TNIL) sprite->size = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "fadenear")!=LUA_TNIL) sprite->fade_near = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "fadefar")!=LUA_TNIL) sprite->fade_far = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "billboard")!=LUA_TNIL) {
+        int billboard = lua_toboolean(L, -1);
+        sprite->flags = (sprite->flags & ~0x01) | billboard;
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "color")!=LUA_TNIL) {
+        ui_color_t color = (ui_color_t)lua_tointeger(L, -1);
+        sprite->color.r = UI_COLOR_R(color);
+        sprite->color.g = UI_COLOR_G(color);
+        sprite->color.b = UI_COLOR_B(color);
+        sprite->color.a = UI_COLOR_A(color);
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "rotation")!=LUA_TNIL) {
+        float x = 0.f;
+        float y = 0.f;
+        float z = 0.f;
+
+        lua_geti(L, -1, 1); x = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+        lua_geti(L, -1, 2); y = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+        lua_geti(L, -1, 3); z = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+
+        // only the angles cross to the GPU; the matrix is built in the
+        // vertex shader
+        sprite->rotation.x = deg2rad(x);
+        sprite->rotation.y = deg2rad(y);
+        sprite->rotation.z = deg2rad(z);
+    }
+    lua_pop(L, 1);
+
+    int animtype = lua_getfield(L, ind, "animation");
+    if (animtype==LUA_TTABLE) {
+        sprite->anim.mode = 0.f;
+
+        if (lua_getfield(L, -1, "mode")==LUA_TSTRING) {
+            const char *mode = lua_tostring(L, -1);
+            if      (strcmp(mode, "pulse" )==0) sprite->anim.mode = 1.f;
+            else if (strcmp(mode, "bob"   )==0) sprite->anim.mode = 2.f;
+            else if (strcmp(mode, "rotate")==0) sprite->anim.mode = 3.f;
+        }
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, -1, "phase")!=LUA_TNIL) sprite->anim.phase = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, -1, "amplitude")!=LUA_TNIL) sprite->anim.amplitude = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+
+        if (lua_getfield(L, -1, "speed")!=LUA_TNIL) sprite->anim.speed = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    } else if (animtype==LUA_TBOOLEAN && !lua_toboolean(L, -1)) {
+        // animation = false clears the channel
+        sprite->anim.mode = 0.f;
+    }
+    lua_pop(L, 1);
+}
+
+/*** RST
+    .. lua:method:: add(texture, attributes)
+
+        Add a sprite to this list. ``attributes`` must a table with the
+        following fields:
 
         ========= ==============================================================
         Field     Description
@@ -1414,909 +3236,3391 @@ void sprite_list_sprite_update(sprite_list_sprite_t *sprite, lua_State *L, int i
                   begins to fade to transparent.
         fadefar   A number that indicates how far away from the player a sprite
                   will become completely transparent.
+        filterbits An integer bitmask of activation conditions, evaluated
+                  against :lua:func:`setfilterstate`. ``0`` (the default)
+                  means always visible.
+        animation A table describing a GPU evaluated animation channel:
+                  ``mode`` (``'pulse'``, ``'bob'``, or ``'rotate'``),
+                  ``amplitude``, ``speed`` (radians/second), and ``phase``
+                  (radians). Animations cost nothing on the CPU after setup;
+                  set ``animation = false`` to clear. Default: none.
         ========= ==============================================================
 
-        :param string texture: The name of the texture, see :lua:meth:`o3dtexturemap.add`.
-        :param table attributes: See above
+        :param string texture: The name of the texture, see :lua:meth:`o3dtexturemap.add`.
+        :param table attributes: See above
+        
+        .. versionhistory::
+            :0.1.0: Added
+*/
+// Find the bucket for texname, creating it if this list hasn't used the
+// texture yet.
+int sprite_list_texture_index(sprite_list_t *list, const char *texname) {
+    // keys are interned: one canonical copy per name, compared by pointer
+    const char *key = eg_intern(texname);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        if (list->texture_keys[t]==key) return (int)t;
+    }
+
+    list->texture_count++;
+    list->texture_keys  = egoverlay_realloc(list->texture_keys , list->texture_count * sizeof(char*));
+    list->sprite_counts = egoverlay_realloc(list->sprite_counts, list->texture_count * sizeof(size_t));
+    list->sprites       = egoverlay_realloc(list->sprites      , list->texture_count * sizeof(sprite_list_sprite_t*));
+    list->tags          = egoverlay_realloc(list->tags         , list->texture_count * sizeof(int*));
+    list->lodbuckets    = egoverlay_realloc(list->lodbuckets   , list->texture_count * sizeof(uint8_t*));
+    list->culled_counts = egoverlay_realloc(list->culled_counts, list->texture_count * sizeof(size_t));
+    list->dirty_min     = egoverlay_realloc(list->dirty_min    , list->texture_count * sizeof(size_t));
+    list->dirty_max     = egoverlay_realloc(list->dirty_max    , list->texture_count * sizeof(size_t));
+
+    int texture = (int)list->texture_count - 1;
+
+    list->texture_keys[texture] = (char*)key;
+
+    list->sprite_counts[texture] = 0;
+    list->sprites[texture] = NULL;
+    list->tags[texture] = NULL;
+    list->lodbuckets[texture] = NULL;
+    list->filterbits[texture] = NULL;
+    list->culled_counts[texture] = 0;
+    list->dirty_min[texture] = SIZE_MAX;
+    list->dirty_max[texture] = 0;
+
+    return texture;
+}
+
+// Grow the per sprite arrays of a texture bucket by count slots in one
+// reallocation.
+void sprite_list_reserve(sprite_list_t *list, int texture, size_t count) {
+    size_t newcount = list->sprite_counts[texture] + count;
+
+    list->sprites[texture] = egoverlay_realloc(list->sprites[texture], newcount * sizeof(sprite_list_sprite_t));
+    list->tags[texture] = egoverlay_realloc(list->tags[texture], newcount * sizeof(int));
+    list->lodbuckets[texture] = egoverlay_realloc(list->lodbuckets[texture], newcount * sizeof(uint8_t));
+    list->filterbits[texture] = egoverlay_realloc(list->filterbits[texture], newcount * sizeof(uint64_t));
+}
+
+// Initialize the next reserved slot with defaults and texture attributes.
+sprite_list_sprite_t *sprite_list_init_sprite(sprite_list_t *list, int texture, texture_map_texture_t *tex) {
+    list->total_sprite_count++;
+    list->sprite_counts[texture]++;
+
+    size_t spritei = list->sprite_counts[texture] - 1;
+    sprite_list_sprite_t *s = list->sprites[texture] + spritei;
+    list->lodbuckets[texture][spritei] = LOD_BUCKET_NEAR;
+    list->filterbits[texture][spritei] = 0;
+
+    s->max_u    = tex->max_u;
+    s->max_v    = tex->max_v;
+    s->xy_ratio = tex->xy_ratio;
+
+    s->atlas_u0    = tex->atlas_u0;
+    s->atlas_v0    = tex->atlas_v0;
+    s->atlas_layer = (float)tex->atlas_layer;
+    s->tex_handle[0] = (uint32_t)(tex->bindless_handle & 0xFFFFFFFF);
+    s->tex_handle[1] = (uint32_t)(tex->bindless_handle >> 32);
+
+    s->position.x = 0.f;
+    s->position.y = 0.f;
+    s->position.z = 0.f;
+
+    list->tags[texture][spritei] = -1;
+    s->size = 80.f;
+
+    s->fade_near = -1.f;
+    s->fade_far  = -1.f;
+
+    s->color.r = 1.f;
+    s->color.g = 1.f;
+    s->color.b = 1.f;
+    s->color.a = 1.f;
+
+    s->flags = 0x01; // billboard
+
+    s->rotation.x = 0.f;
+    s->rotation.y = 0.f;
+    s->rotation.z = 0.f;
+
+    s->anim.mode = 0.f;
+    s->anim.phase = 0.f;
+    s->anim.amplitude = 0.f;
+    s->anim.speed = 0.f;
+
+    return s;
+}
+
+int sprite_list_lua_add_sprite(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+    const char *texname = luaL_checkstring(L, 2);
+
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    texture_map_texture_t *tex = texture_map_get(list->texture_map, texname);
+
+    if (tex==NULL) return luaL_error(L, "invalid texture name: %s", texname);
+
+    int texture = sprite_list_texture_index(list, texname);
+
+    sprite_list_reserve(list, texture, 1);
+    sprite_list_sprite_t *s = sprite_list_init_sprite(list, texture, tex);
+    size_t spritei = list->sprite_counts[texture] - 1;
+
+    if (lua_getfield(L, 3, "tags")!=LUA_TNIL) list->tags[texture][spritei] = luaL_ref(L, LUA_REGISTRYINDEX);
+    else lua_pop(L, 1);
+
+    sprite_list_sprite_update(s, L, 3);
+    sprite_list_apply_filterbits(list, texture, spritei, L, 3);
+
+    list->vbo_update = 1;
+    list->vbo_valid = 0;
+    list->grid_dirty = 1;
+    list->tagindex_dirty = 1;
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: addbatch(texture, sprites)
+
+        Add multiple sprites in a single call. ``sprites`` is a sequence of
+        attribute tables as accepted by :lua:meth:`add`. Storage is grown
+        once for the whole batch and the instance buffer is rebuilt a single
+        time, which is much faster than calling :lua:meth:`add` in a loop
+        when loading large marker packs.
+
+        :param string texture: The name of the texture, see :lua:meth:`o3dtexturemap.add`.
+        :param table sprites: A sequence of attribute tables.
+        :returns: The number of sprites added.
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_add_sprites(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+    const char *texname = luaL_checkstring(L, 2);
+
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    texture_map_texture_t *tex = texture_map_get(list->texture_map, texname);
+
+    if (tex==NULL) return luaL_error(L, "invalid texture name: %s", texname);
+
+    int texture = sprite_list_texture_index(list, texname);
+
+    size_t count = luaL_len(L, 3);
+
+    sprite_list_reserve(list, texture, count);
+
+    for (size_t i=1;i<=count;i++) {
+        if (lua_geti(L, 3, i)!=LUA_TTABLE) return luaL_error(L, "sprite %d is not a table", (int)i);
+        int attrs = lua_gettop(L);
+
+        sprite_list_sprite_t *s = sprite_list_init_sprite(list, texture, tex);
+        size_t spritei = list->sprite_counts[texture] - 1;
+
+        if (lua_getfield(L, attrs, "tags")!=LUA_TNIL) list->tags[texture][spritei] = luaL_ref(L, LUA_REGISTRYINDEX);
+        else lua_pop(L, 1);
+
+        sprite_list_sprite_update(s, L, attrs);
+        sprite_list_apply_filterbits(list, texture, spritei, L, attrs);
+
+        lua_pop(L, 1);
+    }
+
+    if (count) {
+        list->vbo_update = 1;
+        list->vbo_valid = 0;
+        list->grid_dirty = 1;
+        list->tagindex_dirty = 1;
+    }
+
+    lua_pushinteger(L, (lua_Integer)count);
+
+    return 1;
+}
+
+int tags_match(int tagsind, lua_State *L, int tags_ind) {
+    lua_pushnil(L);
+    while (lua_next(L, tags_ind)) {
+        const char *tagkey = lua_tostring(L, -2);
+
+        if (lua_getfield(L, tagsind, tagkey)==LUA_TNIL || lua_compare(L, -1, -2, LUA_OPEQ)==0) {
+            // not a match
+
+            // pop the current key, value, and the value from the sprites tag
+            // table, which is nil
+            lua_pop(L, 3);
+            return 0; 
+        }
+        lua_pop(L, 2); // pop the sprite's tag value and input value, leaving key
+    }
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: update(tags, attributes)
+
+        Update the sprites that have matching tags.
+
+        An empty tags table matches all sprites. A sprite must match all tag
+        values given, if a sprite does not have a value for a tag it will not
+        match.
+
+        Returns the number of sprites updated.
+
+        :param table tags:
+        :param table attributes:
+        :rtype: number
+
+        .. versionhistory::
+            :0.1.0: Added
+
+*/
+int sprite_list_lua_update_sprites(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    int nupdated = 0;
+
+    // when the selector names the indexed tag, only its bucket's sprites
+    // are candidates; tags_match still verifies the full selector
+    sprite_tag_bucket_t *bucket = NULL;
+    if (list->indextag) {
+        if (lua_getfield(L, 2, list->indextag)==LUA_TSTRING) {
+            if (list->tagindex_dirty || !list->tagindex) sprite_list_tagindex_rebuild(list, L);
+
+            uint32_t hash = djb2_hash_string(lua_tostring(L, -1));
+            bucket = sprite_list_tagindex_bucket(list, hash, 0);
+
+            if (!bucket) {
+                // indexed value present but no sprites carry it
+                lua_pop(L, 1);
+                lua_pushinteger(L, 0);
+                return 1;
+            }
+        }
+        lua_pop(L, 1);
+    }
+
+    size_t candidates = bucket ? bucket->count : 0;
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        size_t scan = bucket ? candidates : list->sprite_counts[t];
+
+        for (size_t i=0;i<scan;i++) {
+            size_t st = t;
+            size_t s = i;
+
+            if (bucket) {
+                st = bucket->refs[i].texture;
+                s = bucket->refs[i].sprite;
+            }
+
+            if (list->tags[st][s]<0) continue;
+
+            lua_geti(L, LUA_REGISTRYINDEX, list->tags[st][s]);
+            int tagsind = lua_gettop(L);
+            if (tags_match(tagsind, L, 2)) {
+                sprite_list_sprite_update(list->sprites[st] + s, L, 3);
+                sprite_list_apply_filterbits(list, st, s, L, 3);
+
+                if (s < list->dirty_min[st]) list->dirty_min[st] = s;
+                if (s + 1 > list->dirty_max[st]) list->dirty_max[st] = s + 1;
+
+                nupdated++;
+            }
+            lua_pop(L, 1);
+        }
+
+        if (bucket) break; // the bucket spans all textures
+    }
+
+    if (nupdated) {
+        list->vbo_update = 1;
+        list->grid_dirty = 1;
+    }
+
+    lua_pushinteger(L, nupdated);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: remove(tags)
+
+        Remove sprites that have matching tags.
+
+        An empty tags table matches all sprites. A sprite must match all tag
+        values given, if a sprite does not have a value for a tag it will not
+        match.
+
+        :param table tags:
+        :returns: The number of sprites removed.
+        :rtype: number
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_remove_sprites(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    int nremoved = 0;
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        int snrem = 0;
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            if (list->tags[t][s]<0) continue;
+
+            lua_geti(L, LUA_REGISTRYINDEX, list->tags[t][s]);
+            int tagsind = lua_gettop(L);
+            
+            if (tags_match(tagsind, L, 2)) {
+                luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
+                for (size_t sm=s+1;sm<list->sprite_counts[t];sm++) {
+                    sprite_list_sprite_t *a = list->sprites[t] + sm - 1;
+                    sprite_list_sprite_t *b = list->sprites[t] + sm;
+
+                    memcpy(a, b, sizeof(sprite_list_sprite_t));
+                    list->tags[t][sm-1] = list->tags[t][sm];
+                    list->lodbuckets[t][sm-1] = list->lodbuckets[t][sm];
+                    list->filterbits[t][sm-1] = list->filterbits[t][sm];
+                }
+                list->sprite_counts[t]--;
+                list->total_sprite_count--;
+                s--;
+                snrem++;
+            }
+            lua_pop(L, 1);
+        }
+
+        if (snrem) {
+            nremoved += snrem;
+            list->sprites[t] = egoverlay_realloc(
+                list->sprites[t],
+                list->sprite_counts[t] * sizeof(sprite_list_sprite_t)
+            );
+            list->tags[t] = egoverlay_realloc(list->tags[t], list->sprite_counts[t] * sizeof(int));
+            list->lodbuckets[t] = egoverlay_realloc(list->lodbuckets[t], list->sprite_counts[t] * sizeof(uint8_t));
+            list->filterbits[t] = egoverlay_realloc(list->filterbits[t], list->sprite_counts[t] * sizeof(uint64_t));
+        }
+    }
+
+    if (nremoved) {
+        list->vbo_update = 1;
+        list->vbo_valid = 0;
+        list->grid_dirty = 1;
+        list->tagindex_dirty = 1;
+   }
+
+    lua_pushinteger(L, nremoved);
+
+    return 1;
+}
+
+int sphere_in_frustum(vec3f_t *center, float radius) {
+    for (int p=0;p<6;p++) {
+        vec4f_t *plane = &overlay_3d->frustum.planes[p];
+
+        float dist = (plane->x * center->x) +
+                     (plane->y * center->y) +
+                     (plane->z * center->z) + plane->w;
+
+        if (dist < -radius) return 0;
+    }
+
+    return 1;
+}
+
+int sprite_in_frustum(sprite_list_sprite_t *sprite) {
+    // treat the sprite as a sphere with a radius of its size. this is
+    // conservative: rotated/non-billboard sprites still fit well within it
+    vec3f_t center = { sprite->position.x, sprite->position.y, sprite->position.z };
+
+    return sphere_in_frustum(&center, sprite->size);
+}
+
+// Sort a sprite into a distance bucket based on how far it is from the
+// player. Sprites past their fade_far distance land in the far bucket and
+// are skipped before upload; the cutoff is widened/narrowed by the current
+// bucket so sprites at the boundary don't thrash between buckets.
+uint8_t sprite_lod_bucket(sprite_list_sprite_t *sprite, uint8_t current) {
+    if (sprite->fade_far < 0.f) return LOD_BUCKET_NEAR;
+
+    float dx = sprite->position.x - overlay_3d->player_pos.x;
+    float dy = sprite->position.y - overlay_3d->player_pos.y;
+    float dz = sprite->position.z - overlay_3d->player_pos.z;
+
+    float distsqr = (dx * dx) + (dy * dy) + (dz * dz);
+
+    float farcutoff = sprite->fade_far * (current==LOD_BUCKET_FAR ? LOD_FAR_EXIT : LOD_FAR_ENTER);
+
+    if (distsqr > farcutoff * farcutoff) return LOD_BUCKET_FAR;
+
+    if (sprite->fade_near >= 0.f && distsqr > sprite->fade_near * sprite->fade_near) return LOD_BUCKET_MID;
+
+    return LOD_BUCKET_NEAR;
+}
+
+// Re-copy texture derived attributes into each sprite. Needed after async
+// texture loads finish, since placements and uv extents change.
+void sprite_list_refresh_texture_attribs(sprite_list_t *list) {
+    for (size_t t=0;t<list->texture_count;t++) {
+        texture_map_texture_t *tex = texture_map_get(list->texture_map, list->texture_keys[t]);
+
+        if (!tex) continue;
+
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            sprite_list_sprite_t *sprite = list->sprites[t] + s;
+
+            sprite->max_u       = tex->max_u;
+            sprite->max_v       = tex->max_v;
+            sprite->xy_ratio    = tex->xy_ratio;
+            sprite->atlas_u0    = tex->atlas_u0;
+            sprite->atlas_v0    = tex->atlas_v0;
+            sprite->atlas_layer = (float)tex->atlas_layer;
+            sprite->tex_handle[0] = (uint32_t)(tex->bindless_handle & 0xFFFFFFFF);
+            sprite->tex_handle[1] = (uint32_t)(tex->bindless_handle >> 32);
+        }
+    }
+
+    list->vbo_update = 1;
+    list->vbo_valid = 0;
+}
+
+// Per-frame clustering cell: maps a quantized cell to the aggregated
+// instance written for it this frame.
+typedef struct sprite_cluster_cell_t {
+    uint64_t key;     // 0 = empty
+    uint32_t dest;    // instance index in this frame's ring section
+    uint32_t count;   // sprites merged into the cell
+    float base_size;  // representative's authored size
+} sprite_cluster_cell_t;
+
+// sprites closer than cluster_dist * CLUSTER_NEAR_MULT are never merged
+#define CLUSTER_NEAR_MULT 16.f
+// aggregated sprites grow with sqrt(count), capped
+#define CLUSTER_SIZE_MAX  2.5f
+
+static void sprite_list_cluster_reset(sprite_list_t *list) {
+    size_t want = 16;
+    while (want < list->total_sprite_count * 2) want <<= 1;
+
+    if (list->cluster_cell_count < want) {
+        if (list->cluster_cells) egoverlay_free(list->cluster_cells);
+        list->cluster_cells = egoverlay_calloc(want, sizeof(sprite_cluster_cell_t));
+        list->cluster_cell_count = want;
+    } else {
+        memset(list->cluster_cells, 0, list->cluster_cell_count * sizeof(sprite_cluster_cell_t));
+    }
+}
+
+// Merge sprite into this frame's clusters. Returns 1 when a new instance was
+// written to dest[nvisible] (caller advances counters), 0 when the sprite
+// was folded into an existing aggregate.
+static int sprite_list_cluster_insert(
+    sprite_list_t *list,
+    size_t texture,
+    sprite_list_sprite_t *sprite,
+    sprite_list_sprite_t *dest,
+    size_t nvisible
+) {
+    float dx = sprite->position.x - overlay_3d->camera.x;
+    float dy = sprite->position.y - overlay_3d->camera.y;
+    float dz = sprite->position.z - overlay_3d->camera.z;
+    float dist = sqrtf(dx*dx + dy*dy + dz*dz);
+
+    float neardist = list->cluster_dist * CLUSTER_NEAR_MULT;
+
+    if (dist < neardist) {
+        memcpy(dest + nvisible, sprite, sizeof(sprite_list_sprite_t));
+        return 1;
+    }
+
+    // distance bands double the cell size as sprites get farther away, which
+    // approximates a constant screen-space merge radius with a uniform grid
+    // per band
+    int band = 0;
+    float cell = list->cluster_dist;
+    float scaled = neardist;
+    while (dist >= scaled * 2.f && band < 15) {
+        scaled *= 2.f;
+        cell *= 2.f;
+        band++;
+    }
+
+    int64_t cx = (int64_t)floorf(sprite->position.x / cell);
+    int64_t cy = (int64_t)floorf(sprite->position.y / cell);
+    int64_t cz = (int64_t)floorf(sprite->position.z / cell);
+
+    uint64_t key = 0xcbf29ce484222325ULL;
+    key = (key ^ (uint64_t)cx) * 0x100000001b3ULL;
+    key = (key ^ (uint64_t)cy) * 0x100000001b3ULL;
+    key = (key ^ (uint64_t)cz) * 0x100000001b3ULL;
+    key = (key ^ (uint64_t)band) * 0x100000001b3ULL;
+    key = (key ^ (uint64_t)texture) * 0x100000001b3ULL;
+    if (key==0) key = 1;
+
+    size_t ind = key & (list->cluster_cell_count - 1);
+    while (list->cluster_cells[ind].key!=0 && list->cluster_cells[ind].key!=key) {
+        ind = (ind + 1) & (list->cluster_cell_count - 1);
+    }
+
+    sprite_cluster_cell_t *c = &list->cluster_cells[ind];
+
+    if (c->key==0) {
+        c->key = key;
+        c->dest = (uint32_t)nvisible;
+        c->count = 1;
+        c->base_size = sprite->size;
+
+        memcpy(dest + nvisible, sprite, sizeof(sprite_list_sprite_t));
+        return 1;
+    }
+
+    // fold into the existing aggregate: the representative grows with the
+    // number of merged sprites so dense areas read as one larger marker
+    c->count++;
+
+    float grow = 1.f + 0.25f * sqrtf((float)(c->count - 1));
+    if (grow > CLUSTER_SIZE_MAX) grow = CLUSTER_SIZE_MAX;
+    dest[c->dest].size = c->base_size * grow;
+
+    return 0;
+}
+
+// Build a compacted instance buffer holding only the sprites that are inside
+// the view frustum, written straight into the next mapped ring section. Run
+// once per frame for world lists before drawing; map lists use
+// sprite_list_update_vbo instead.
+void sprite_list_update_vbo_culled(sprite_list_t *list) {
+    sprite_list_sprite_t *dest = sprite_list_next_vbo_section(list, list->total_sprite_count);
+
+    int clustering = list->cluster_dist > 0.f;
+    if (clustering) sprite_list_cluster_reset(list);
+
+    // auto-degradation: tier 2 stops evaluating sprite animation, tier 3
+    // drops the mid distance bucket entirely
+    int degrade = app_degradation_level();
+
+    size_t nvisible = 0;
+    for (size_t t=0;t<list->texture_count;t++) {
+        list->culled_counts[t] = 0;
+
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            sprite_list_sprite_t *sprite = list->sprites[t] + s;
+
+            if (!sprite_filter_visible(list->filterbits[t][s])) continue;
+
+            list->lodbuckets[t][s] = sprite_lod_bucket(sprite, list->lodbuckets[t][s]);
+            if (list->lodbuckets[t][s]==LOD_BUCKET_FAR) continue;
+            if (degrade>=3 && list->lodbuckets[t][s]==LOD_BUCKET_MID) continue;
+
+            if (!sprite_in_frustum(sprite)) continue;
+
+            if (clustering) {
+                if (!sprite_list_cluster_insert(list, t, sprite, dest, nvisible)) continue;
+            } else {
+                memcpy(dest + nvisible, sprite, sizeof(sprite_list_sprite_t));
+            }
+
+            if (degrade>=2) dest[nvisible].anim.mode = 0.f;
+
+            list->culled_counts[t]++;
+            nvisible++;
+        }
+    }
+
+    list->vbo_update = 0;
+}
+
+void sprite_list_update_vbo(sprite_list_t *list) {
+    // if the list structure is unchanged and the GPU is done with the
+    // current section, patch only the modified ranges in place instead of
+    // re-writing every sprite into a new section
+    if (list->vbo_valid) {
+        // the buffer holds every sprite, so in place patching is only valid
+        // while every dirty sprite is still visible; anything that became
+        // inactive needs the full (filtered) rewrite below
+        for (size_t t=0;t<list->texture_count && list->vbo_valid;t++) {
+            for (size_t s=list->dirty_min[t];s<list->dirty_max[t];s++) {
+                if (!sprite_filter_visible(list->filterbits[t][s])) {
+                    list->vbo_valid = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (list->vbo_valid) {
+        GLsync fence = list->vbo_fences[list->vbo_section];
+        GLenum wait = fence ? glClientWaitSync(fence, 0, 0) : GL_ALREADY_SIGNALED;
+
+        if (wait==GL_ALREADY_SIGNALED || wait==GL_CONDITION_SATISFIED) {
+            size_t base = list->vbo_draw_base;
+
+            for (size_t t=0;t<list->texture_count;t++) {
+                if (list->dirty_min[t] < list->dirty_max[t]) {
+                    memcpy(
+                        list->vbo_map + base + list->dirty_min[t],
+                        list->sprites[t] + list->dirty_min[t],
+                        (list->dirty_max[t] - list->dirty_min[t]) * sizeof(sprite_list_sprite_t)
+                    );
+                }
+
+                list->dirty_min[t] = SIZE_MAX;
+                list->dirty_max[t] = 0;
+
+                base += list->sprite_counts[t];
+            }
+
+            list->vbo_update = 0;
+            return;
+        }
+    }
+
+    sprite_list_sprite_t *dest = sprite_list_next_vbo_section(list, list->total_sprite_count);
+
+    list->vbo_filtered = 0;
+
+    size_t offset = 0;
+    for (size_t t=0;t<list->texture_count;t++) {
+        list->dirty_min[t] = SIZE_MAX;
+        list->dirty_max[t] = 0;
+        list->culled_counts[t] = 0;
+
+        for (size_t s=0;s<list->sprite_counts[t];s++) {
+            sprite_list_sprite_t *sprite = list->sprites[t] + s;
+
+            if (!sprite_filter_visible(list->filterbits[t][s])) {
+                list->vbo_filtered = 1;
+                continue;
+            }
+
+            memcpy(dest + offset, sprite, sizeof(sprite_list_sprite_t));
+            list->culled_counts[t]++;
+            offset++;
+        }
+    }
+
+    list->vbo_update = 0;
+
+    // dirty range patching assumes the buffer holds every sprite in order;
+    // a filtered write breaks that layout
+    list->vbo_valid = !list->vbo_filtered;
+}
+
+/*** RST
+    .. lua:method:: cluster(distance)
+
+        Enable or disable clustered decluttering.
+
+        With a ``distance`` greater than ``0``, distant sprites within a
+        merge cell are collapsed into a single aggregated instance each frame
+        (recomputed as the camera moves); the representative grows with the
+        square root of the merged count, so dense areas read as one larger
+        marker instead of hundreds of overlapping ones. Sprites closer than
+        16x ``distance`` always render individually, and the cell size
+        doubles with distance bands to approximate a constant screen-space
+        radius. Pass ``0`` to disable.
+
+        Only world lists cluster; map lists draw every sprite.
+
+        :param number distance: Merge radius in world units, or ``0``.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_cluster(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+    float distance = (float)luaL_checknumber(L, 2);
+
+    if (distance < 0.f) return luaL_error(L, "cluster distance must not be negative");
+
+    list->cluster_dist = distance;
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: draw()
+
+        Draw all sprites in this list.
+
+        :param boolean map: If ``true`` draw sprites on the map or minimap.
+            Otherwise draw sprites in the 3D world.
+
+        .. important::
+        
+            This method can only be called during :overlay:event:`draw-3d`.
+            Attempts to call it at any other time will result in an error.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_draw(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    if (!overlay_3d->in_frame) return luaL_error(L, "draw can only be called during update-3d");
+
+    if (list->total_sprite_count==0) return 0;
+
+    if (list->seen_texture_generation != list->texture_map->texture_generation) {
+        sprite_list_refresh_texture_attribs(list);
+        list->seen_texture_generation = list->texture_map->texture_generation;
+    }
+
+    if (list->seen_filter_generation != overlay_3d->filter_generation) {
+        // activation state changed, map lists have to re-evaluate visibility
+        list->vbo_update = 1;
+        list->vbo_valid = 0;
+        list->seen_filter_generation = overlay_3d->filter_generation;
+    }
+
+    // world lists re-pack only the on-screen sprites each frame; map lists
+    // draw everything and only upload when something changed
+    if (list->map) {
+        if (list->vbo_update) sprite_list_update_vbo(list);
+    } else {
+        sprite_list_update_vbo_culled(list);
+    }
+
+    glDisable(GL_CULL_FACE);
+    
+    gl_shader_program_use(overlay_3d->sprite_array_program);
+
+    int oldvp[4] = {0};
+
+    if (list->map) {
+        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
+        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
+
+        if (!overlay_3d->mapfullscreen) {
+            int fbw, fbh;
+            app_get_framebuffer_size(&fbw, &fbh);
+
+            glGetIntegerv(GL_VIEWPORT, oldvp);
+            glViewport(
+                overlay_3d->minimapleft,
+                overlay_3d->minimapbottom,
+                overlay_3d->minimapwidth,
+                overlay_3d->minimapheight
+            );
+        }
+    }
+
+    // scene matrices and player/camera come from the frame globals UBO
+    glUniform1ui(3, (GLuint)list->map);
+
+    glUniform1f(5, (GLfloat)overlay_3d->minimapleft  );
+    glUniform1f(6, (GLfloat)overlay_3d->minimapbottom);
+    glUniform1f(7, (GLfloat)overlay_3d->minimapheight);
+
+    glBindVertexArray(list->vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    
+    // both paths pack only visible sprites and count them per texture
+    size_t *draw_counts = list->culled_counts;
+
+    if (list->texture_map->atlas.texture) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, list->texture_map->atlas.texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // consecutive atlas packed textures are merged into a single instanced
+    // draw; only textures with their own GL texture break the batch
+    GLint inst = 0;
+    GLsizei run = 0;
+    for (size_t t=0;t<list->texture_count;t++) {
+        if (draw_counts[t]==0) continue;
+
+        texture_map_texture_t *tex = texture_map_get(list->texture_map, list->texture_keys[t]);
+
+        // atlas entries never break the batch; with bindless support,
+        // standalone textures with a resident handle don't either
+        if (tex && (tex->atlas_layer >= 0 || tex->bindless_handle)) {
+            run += (GLsizei)draw_counts[t];
+            continue;
+        }
+
+        if (run) {
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, run, (GLuint)list->vbo_draw_base + inst);
+            profiler_count_draw(1, run);
+            inst += run;
+            run = 0;
+        }
+
+        if (!tex) {
+            logger_t *log = logger_get("lua-gl");
+            logger_error(log, "invalid texture key: %s", list->texture_keys[t]);
+        } else {
+            glBindTexture(GL_TEXTURE_2D, tex->texture);
+        }
+
+        glDrawArraysInstancedBaseInstance(
+            GL_TRIANGLE_STRIP,
+            0,
+            4,
+            (GLsizei)draw_counts[t],
+            (GLuint)list->vbo_draw_base + inst
+        );
+        profiler_count_draw(1, (int)draw_counts[t]);
+        inst += (GLint)draw_counts[t];
+    }
+
+    if (run) {
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, run, (GLuint)list->vbo_draw_base + inst);
+        profiler_count_draw(1, run);
+    }
+
+    // fence the ring section just drawn so the next write to it waits until
+    // the GPU is done reading. a newer fence always supersedes an older one
+    if (list->vbo_fences[list->vbo_section]) glDeleteSync(list->vbo_fences[list->vbo_section]);
+    list->vbo_fences[list->vbo_section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    if (list->map && !overlay_3d->mapfullscreen) {
+        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindVertexArray(0);
+
+    glUseProgram(0);
+
+    glEnable(GL_CULL_FACE);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: nearest(x, y, z[, maxdistance])
+
+        Return the sprite closest to the given position, searched through a
+        spatial index instead of scanning every sprite.
+
+        Returns the sprite's tags table (or ``nil`` if the sprite has no
+        tags), the distance, and the sprite's x, y, and z coordinates.
+        Returns nothing if no sprite is within ``maxdistance``.
+
+        :param number x:
+        :param number y:
+        :param number z:
+        :param number maxdistance: (Optional) default ``5000``.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_nearest(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    float x = (float)luaL_checknumber(L, 2);
+    float y = (float)luaL_checknumber(L, 3);
+    float z = (float)luaL_checknumber(L, 4);
+
+    float maxdist = 5000.f;
+    if (lua_gettop(L)>=5) maxdist = (float)luaL_checknumber(L, 5);
+
+    if (list->total_sprite_count==0) return 0;
+
+    if (list->grid_dirty || !list->grid_cells) sprite_list_grid_rebuild(list);
+
+    int64_t cx = (int64_t)floorf(x / SPRITE_GRID_CELL_SIZE);
+    int64_t cy = (int64_t)floorf(y / SPRITE_GRID_CELL_SIZE);
+    int64_t cz = (int64_t)floorf(z / SPRITE_GRID_CELL_SIZE);
+
+    int maxshell = (int)(maxdist / SPRITE_GRID_CELL_SIZE) + 1;
+
+    sprite_grid_ref_t best = {0};
+    int have_best = 0;
+    float bestdsqr = maxdist * maxdist;
+
+    for (int shell=0;shell<=maxshell;shell++) {
+        // cells in this shell can't contain anything closer than
+        // (shell-1) * cell size, stop once the best find beats that
+        if (have_best && (float)(shell - 1) * SPRITE_GRID_CELL_SIZE > sqrtf(bestdsqr)) break;
+
+        for (int i=-shell;i<=shell;i++) {
+            for (int j=-shell;j<=shell;j++) {
+                for (int k=-shell;k<=shell;k++) {
+                    int ai = i<0 ? -i : i;
+                    int aj = j<0 ? -j : j;
+                    int ak = k<0 ? -k : k;
+                    int cheb = ai > aj ? ai : aj;
+                    if (ak > cheb) cheb = ak;
+
+                    if (cheb!=shell) continue; // interior, already searched
+
+                    sprite_grid_cell_t *cell = sprite_list_grid_cell(
+                        list,
+                        sprite_grid_cell_key(cx + i, cy + j, cz + k),
+                        0
+                    );
+
+                    if (!cell) continue;
+
+                    for (size_t r=0;r<cell->count;r++) {
+                        sprite_list_sprite_t *sprite = list->sprites[cell->refs[r].texture] + cell->refs[r].sprite;
+
+                        if (!sprite_filter_visible(list->filterbits[cell->refs[r].texture][cell->refs[r].sprite])) continue;
+
+                        float dx = sprite->position.x - x;
+                        float dy = sprite->position.y - y;
+                        float dz = sprite->position.z - z;
+                        float dsqr = (dx * dx) + (dy * dy) + (dz * dz);
+
+                        if (dsqr < bestdsqr) {
+                            bestdsqr = dsqr;
+                            best = cell->refs[r];
+                            have_best = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (!have_best) return 0;
+
+    sprite_list_sprite_t *sprite = list->sprites[best.texture] + best.sprite;
+
+    if (list->tags[best.texture][best.sprite]>=0) {
+        lua_geti(L, LUA_REGISTRYINDEX, list->tags[best.texture][best.sprite]);
+    } else {
+        lua_pushnil(L);
+    }
+
+    lua_pushnumber(L, sqrtf(bestdsqr));
+    lua_pushnumber(L, sprite->position.x);
+    lua_pushnumber(L, sprite->position.y);
+    lua_pushnumber(L, sprite->position.z);
+
+    return 5;
+}
+
+/*** RST
+    .. lua:method:: pointedat([radius])
+
+        Return the sprite the mouse pointer is currently pointing at, by
+        marching the mouse ray through the sprite spatial index.
+
+        Each sprite is tested as a sphere of ``radius`` (or the sprite's own
+        size if not given). Returns the sprite's tags table (or ``nil``) and
+        the distance from the camera, or nothing when no sprite is hit.
+
+        :param number radius: (Optional)
+
+        .. important::
+            This method can only be called during :overlay:event:`draw-3d`.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+
+/*** RST
+    .. lua:method:: indextag(name)
+
+        Declare which tag field selector updates should be indexed by.
+        After this, :lua:meth:`update` calls whose selector includes
+        ``name`` with a string value only visit sprites carrying that value
+        instead of scanning the whole list. Indexed tag values must not be
+        changed after a sprite is added.
+
+        :param string name:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sprite_list_lua_index_tag(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+    size_t namelen = 0;
+    const char *name = luaL_checklstring(L, 2, &namelen);
+
+    if (list->indextag) egoverlay_free(list->indextag);
+
+    list->indextag = egoverlay_calloc(namelen+1, sizeof(char));
+    memcpy(list->indextag, name, namelen);
+    list->tagindex_dirty = 1;
+
+    return 0;
+}
+
+int sprite_list_lua_pointedat(lua_State *L) {
+    sprite_list_t *list = lua_checkspritelist(L, 1);
+
+    if (!overlay_3d->in_frame) return luaL_error(L, "not in a frame");
+
+    float radius = 0.f;
+    if (lua_gettop(L)>=2) radius = (float)luaL_checknumber(L, 2);
+
+    if (list->total_sprite_count==0) return 0;
+
+    if (list->grid_dirty || !list->grid_cells) sprite_list_grid_rebuild(list);
+
+    vec3f_t origin = overlay_3d->camera;
+    vec3f_t ray = overlay_3d->mouse_ray;
+
+    float maxdist = 100000.f;
+    float step = SPRITE_GRID_CELL_SIZE / 2.f;
+
+    sprite_grid_ref_t best = {0};
+    int have_best = 0;
+    float bestt = maxdist;
+
+    int64_t lastkey = INT64_MIN;
+
+    for (float dist=0.f;dist<maxdist;dist+=step) {
+        // everything further along the ray is behind the best hit already
+        if (have_best && dist > bestt + SPRITE_GRID_CELL_SIZE) break;
+
+        float px = origin.x + (ray.x * dist);
+        float py = origin.y + (ray.y * dist);
+        float pz = origin.z + (ray.z * dist);
+
+        int64_t key = sprite_grid_key(px, py, pz);
+        if (key==lastkey) continue;
+        lastkey = key;
+
+        sprite_grid_cell_t *cell = sprite_list_grid_cell(list, key, 0);
+        if (!cell) continue;
+
+        for (size_t r=0;r<cell->count;r++) {
+            sprite_list_sprite_t *sprite = list->sprites[cell->refs[r].texture] + cell->refs[r].sprite;
+
+            if (!sprite_filter_visible(list->filterbits[cell->refs[r].texture][cell->refs[r].sprite])) continue;
+
+            float srad = radius > 0.f ? radius : sprite->size;
+
+            vec3f_t omc = {
+                origin.x - sprite->position.x,
+                origin.y - sprite->position.y,
+                origin.z - sprite->position.z
+            };
+
+            float b = vec3f_dot_vec3f(&ray, &omc);
+            float c = vec3f_dot_vec3f(&omc, &omc) - (srad * srad);
+            float dsqr = (b * b) - c;
+
+            if (dsqr < 0.f) continue;
+
+            float t = -b - sqrtf(dsqr);
+            if (t < 0.f) t = -b + sqrtf(dsqr);
+            if (t < 0.f || t >= bestt) continue;
+
+            bestt = t;
+            best = cell->refs[r];
+            have_best = 1;
+        }
+    }
+
+    if (!have_best) return 0;
+
+    if (list->tags[best.texture][best.sprite]>=0) {
+        lua_geti(L, LUA_REGISTRYINDEX, list->tags[best.texture][best.sprite]);
+    } else {
+        lua_pushnil(L);
+    }
+
+    lua_pushnumber(L, bestt);
+
+    return 2;
+}
+
+/*** RST
+.. lua:class:: o3dtraillist
+
+    A trail list displays multiple paths as flat 2D textures drawn along
+    specified points.
+*/
+
+/*** RST
+    .. lua:method:: clear()
+
+        Clear this trail list and set it back to an initial state.
+
+    .. note::
+
+        This will not clear the texture list that this trail list references.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int trail_list_lua_clear(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        // texture keys are interned; never freed
+
+        for (size_t trail=0;trail<list->trail_counts[t];trail++) {
+            if (list->trails[t][trail].tags>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->trails[t][trail].tags);
+            if (list->trails[t][trail].points) egoverlay_free(list->trails[t][trail].points);
+            if (list->trails[t][trail].chunks) egoverlay_free(list->trails[t][trail].chunks);
+            if (list->trails[t][trail].arclen) egoverlay_free(list->trails[t][trail].arclen);
+            if (list->trails[t][trail].seggroups) egoverlay_free(list->trails[t][trail].seggroups);
+        }
+        egoverlay_free(list->trails[t]);
+    }
+    if (list->texture_count) {
+        egoverlay_free(list->texture_keys);
+        egoverlay_free(list->trails);
+        egoverlay_free(list->trail_counts);
+
+        list->texture_keys = NULL;
+        list->trails = NULL;
+        list->trail_counts = NULL;
+    }
+    list->texture_count = 0;
+    list->append_trail = NULL;
+
+    return 0;
+}
+
+// Recalculate the bounding sphere used for distance bucketing.
+void trail_list_trail_calc_bounds(trail_list_trail_t *trail) {
+    trail->progress_dirty = 1;
+
+    vec3f_t bmin = trail->points[0];
+    vec3f_t bmax = trail->points[0];
+    for (size_t i=1;i<trail->point_count;i++) {
+        if (trail->points[i].x < bmin.x) bmin.x = trail->points[i].x;
+        if (trail->points[i].y < bmin.y) bmin.y = trail->points[i].y;
+        if (trail->points[i].z < bmin.z) bmin.z = trail->points[i].z;
+        if (trail->points[i].x > bmax.x) bmax.x = trail->points[i].x;
+        if (trail->points[i].y > bmax.y) bmax.y = trail->points[i].y;
+        if (trail->points[i].z > bmax.z) bmax.z = trail->points[i].z;
+    }
+
+    trail->bounds_center.x = (bmin.x + bmax.x) / 2.f;
+    trail->bounds_center.y = (bmin.y + bmax.y) / 2.f;
+    trail->bounds_center.z = (bmin.z + bmax.z) / 2.f;
+
+    vec3f_t halfdiag = {0};
+    vec3f_sub_vec3f(&bmax, &trail->bounds_center, &halfdiag);
+    trail->bounds_radius = vec3f_length(&halfdiag);
+}
+
+void trail_list_trail_update(trail_list_t *list, trail_list_trail_t *trail, lua_State *L, int ind) {
+    if (lua_getfield(L, ind, "fadenear")!=LUA_TNIL) trail->fade_near = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "fadefar")!=LUA_TNIL) trail->fade_far = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "color")!=LUA_TNIL) {
+        ui_color_t color = (ui_color_t)lua_tointeger(L, -1);
+        trail->color.r = UI_COLOR_R(color);
+        trail->color.g = UI_COLOR_G(color);
+        trail->color.b = UI_COLOR_B(color);
+        trail->color.a = UI_COLOR_A(color);
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "size")!=LUA_TNIL) {
+        trail->size = (float)lua_tonumber(L, -1);
+        list->vbo_update = 1;
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, ind, "wall")!=LUA_TNIL) {
+        trail->wall = lua_toboolean(L, -1);
+        list->vbo_update = 1;
+    }
+    lua_pop(L, 1);
+
+    // points may be given in binary: a string of packed little endian float
+    // x,y,z triplets (12 bytes per point), decoded in bulk with an optional
+    // pointsscale multiplier. this skips building a Lua table per point for
+    // large trails
+    float pointsscale = 1.f;
+    if (lua_getfield(L, ind, "pointsscale")!=LUA_TNIL) pointsscale = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    int pointstype = lua_getfield(L, ind, "points");
+    if (pointstype==LUA_TSTRING) {
+        size_t datalen = 0;
+        const char *data = lua_tolstring(L, -1, &datalen);
+
+        size_t c = datalen / sizeof(vec3f_t);
+        if (c < 2) luaL_error(L, "trails must have at least 2 points.");
+
+        if (trail->points) egoverlay_free(trail->points);
+
+        trail->point_count = c;
+        trail->points = egoverlay_calloc(trail->point_count, sizeof(vec3f_t));
+        memcpy(trail->points, data, c * sizeof(vec3f_t));
+
+        if (pointsscale!=1.f) {
+            for (size_t i=0;i<trail->point_count;i++) {
+                trail->points[i].x *= pointsscale;
+                trail->points[i].y *= pointsscale;
+                trail->points[i].z *= pointsscale;
+            }
+        }
+
+        trail_list_trail_calc_bounds(trail);
+
+        list->vbo_update = TRAIL_VBO_REBUILD;
+        list->append_trail = NULL;
+    } else if (pointstype!=LUA_TNIL) {
+        int pointsind = lua_gettop(L);
+        size_t c = luaL_len(L, pointsind);
+        if (c < 2) luaL_error(L, "trails must have at least 2 points.");
+
+        if (trail->points) egoverlay_free(trail->points);
+
+        trail->point_count = c;
+        trail->points = egoverlay_calloc(trail->point_count, sizeof(vec3f_t));
+
+        for (size_t i=1;i<=trail->point_count;i++) {
+            lua_geti(L, pointsind, i); // the sequence of x,y,z
+            int pind = lua_gettop(L);
+            lua_geti(L, pind, 1);
+            lua_geti(L, pind, 2);
+            lua_geti(L, pind, 3);
+            trail->points[i-1].x = (float)lua_tonumber(L, -3) * pointsscale;
+            trail->points[i-1].y = (float)lua_tonumber(L, -2) * pointsscale;
+            trail->points[i-1].z = (float)lua_tonumber(L, -1) * pointsscale;
+            lua_pop(L, 4);
+        }
+
+        trail_list_trail_calc_bounds(trail);
+
+        list->vbo_update = TRAIL_VBO_REBUILD;
+        list->append_trail = NULL;
+    }
+    lua_pop(L, 1);
+
+    int appendtype = lua_getfield(L, ind, "appendpoints");
+    if (appendtype!=LUA_TNIL && trail->point_count) {
+        int pointsind = lua_gettop(L);
+
+        size_t c = 0;
+        const char *appenddata = NULL;
+        size_t appendlen = 0;
+
+        if (appendtype==LUA_TSTRING) {
+            appenddata = lua_tolstring(L, -1, &appendlen);
+            c = appendlen / sizeof(vec3f_t);
+        } else {
+            c = luaL_len(L, pointsind);
+        }
+
+        if (c) {
+            size_t oldcount = trail->point_count;
+            trail->point_count += c;
+            trail->points = egoverlay_realloc(trail->points, trail->point_count * sizeof(vec3f_t));
+
+            if (appenddata) {
+                memcpy(trail->points + oldcount, appenddata, c * sizeof(vec3f_t));
+
+                if (pointsscale!=1.f) {
+                    for (size_t i=oldcount;i<trail->point_count;i++) {
+                        trail->points[i].x *= pointsscale;
+                        trail->points[i].y *= pointsscale;
+                        trail->points[i].z *= pointsscale;
+                    }
+                }
+            } else {
+                for (size_t i=1;i<=c;i++) {
+                    lua_geti(L, pointsind, i);
+                    int pind = lua_gettop(L);
+                    lua_geti(L, pind, 1);
+                    lua_geti(L, pind, 2);
+                    lua_geti(L, pind, 3);
+                    trail->points[oldcount+i-1].x = (float)lua_tonumber(L, -3) * pointsscale;
+                    trail->points[oldcount+i-1].y = (float)lua_tonumber(L, -2) * pointsscale;
+                    trail->points[oldcount+i-1].z = (float)lua_tonumber(L, -1) * pointsscale;
+                    lua_pop(L, 4);
+                }
+            }
+
+            trail_list_trail_calc_bounds(trail);
+
+            // only this trail growing can use the append fast path; anything
+            // else pending forces a full rebuild
+            if ((list->vbo_update==TRAIL_VBO_CLEAN || list->vbo_update==TRAIL_VBO_APPEND) &&
+                (list->append_trail==NULL || list->append_trail==trail)
+            ) {
+                list->vbo_update = TRAIL_VBO_APPEND;
+                list->append_trail = trail;
+            } else {
+                list->vbo_update = TRAIL_VBO_REBUILD;
+                list->append_trail = NULL;
+            }
+        }
+    }
+    lua_pop(L, 1);
+}
+
+/*** RST
+    .. lua:method:: addtrail(texturename, attributes)
+
+        Create a new trail.
+
+        ``attributes`` must be a table with the following fields:
+
+        =========== ============================================================
+        Field       Description
+        =========== ============================================================
+        points      A sequence of sequences, trail points, ie.
+                    ``{ {1,1,1}, {2,2,2} }``, or a string of packed little
+                    endian float x,y,z triplets (12 bytes per point), which is
+                    decoded in bulk without building Lua tables.
+        pointsscale A number every coordinate is multiplied by, for unit
+                    conversions (ie. meters to inches). Default ``1.0``.
+        tags        A table of attributes that can be used other methods of
+                    this list to update or remove trails with matching tags.
+                    *Note:* the table is referenced directly, not copied.
+        fadenear    A number that indicates how far away from the player a
+                    trail begins to fade to transparent.
+        fadefar     A number that indicates how far away from the player a
+                    trail will become completely transparent.
+        =========== ============================================================
+
+        :param string texturename: The name of a texture in the texture list
+            this trail list references.
+        :param table attributes: See above.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+// Check that texname can be used for trails. Raises a Lua error if not.
+void trail_list_check_texture(lua_State *L, trail_list_t *list, const char *texname) {
+    texture_map_texture_t *tex = texture_map_get(list->texture_map, texname);
+
+    if (!tex) {
+        luaL_error(L, "invalid texture name: %s", texname);
+        return;
+    }
+
+    // trails tile their texture along the path, which the shared atlas can't do
+    if (tex->atlas_layer>=0) {
+        luaL_error(L, "texture %s is atlas packed and can't be used for trails; add it with {atlas=false}", texname);
+        return;
+    }
+
+    if (tex->texture==texture_placeholder && texture_placeholder) {
+        luaL_error(L, "texture %s is still loading and can't be used for trails yet", texname);
+    }
+}
+
+int trail_list_texture_index(trail_list_t *list, const char *texname) {
+    // keys are interned like sprite list keys: pointer equality, no copies
+    const char *key = eg_intern(texname);
+
+    for (size_t t=0;t<list->texture_count;t++) {
+        if (key==list->texture_keys[t]) return (int)t;
+    }
+
+    int texture = (int)list->texture_count;
+    list->texture_count++;
+    list->texture_keys = egoverlay_realloc(list->texture_keys, list->texture_count * sizeof(char*));
+    list->texture_keys[texture] = (char*)key;
+
+    list->trail_counts = egoverlay_realloc(list->trail_counts, list->texture_count * sizeof(size_t));
+    list->trails = egoverlay_realloc(list->trails, list->texture_count * sizeof(trail_list_trail_t**));
+    list->trail_counts[texture] = 0;
+    list->trails[texture] = NULL;
+
+    return texture;
+}
+
+trail_list_trail_t *trail_list_init_trail(trail_list_t *list, int texture) {
+    list->trail_counts[texture]++;
+    list->trails[texture] = egoverlay_realloc(list->trails[texture], list->trail_counts[texture] * sizeof(trail_list_trail_t));
+
+    trail_list_trail_t *trail = list->trails[texture] + list->trail_counts[texture] - 1;
+
+    trail->coord_count = 0;
+    trail->point_count = 0;
+    trail->points      = NULL;
+    trail->fade_near   = -1.f;
+    trail->fade_far    = -1.f;
+    trail->color.r     = 1.f;
+    trail->color.g     = 1.f;
+    trail->color.b     = 1.f;
+    trail->color.a     = 1.f;
+    trail->tags        = -1;
+
+    trail->bounds_center.x = 0.f;
+    trail->bounds_center.y = 0.f;
+    trail->bounds_center.z = 0.f;
+    trail->bounds_radius   = 0.f;
+    trail->lodfar          = 0;
+    trail->chunk_count     = 0;
+    trail->chunks          = NULL;
+
+    trail->size = 40.f;
+    trail->wall = 0;
+
+    trail->arclen         = NULL;
+    trail->seggroups      = NULL;
+    trail->seggroup_count = 0;
+    trail->progress_dirty = 1;
+
+    return trail;
+}
+
+int trail_list_lua_add(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    const char *texname = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    int ptype = lua_getfield(L, 3, "points");
+    if (ptype!=LUA_TTABLE && ptype!=LUA_TSTRING) {
+        return luaL_error(L, "points must be a table or packed string");
+    }
+    if (ptype==LUA_TTABLE && luaL_len(L, -1) < 2) return luaL_error(L, "trails must have at least 2 points.");
+    if (ptype==LUA_TSTRING && lua_rawlen(L, -1) < 2 * sizeof(vec3f_t)) {
+        return luaL_error(L, "trails must have at least 2 points.");
+    }
+    lua_pop(L, 1);
+
+    trail_list_check_texture(L, list, texname);
+
+    int texture = trail_list_texture_index(list, texname);
+
+    trail_list_trail_t *trail = trail_list_init_trail(list, texture);
+
+    if (lua_getfield(L, 3, "tags")!=LUA_TNIL) trail->tags = luaL_ref(L, LUA_REGISTRYINDEX);
+    else lua_pop(L, 1);
+
+    trail_list_trail_update(list, trail, L, 3);
+
+    list->vbo_update = 1;
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: addbatch(texturename, trails)
+
+        Add multiple trails in a single call. ``trails`` is a sequence of
+        attribute tables as accepted by :lua:meth:`addtrail`. The trail
+        geometry is rebuilt once for the whole batch instead of per trail.
+
+        :param string texturename: The name of a texture in the texture list
+            this trail list references.
+        :param table trails: A sequence of attribute tables.
+        :returns: The number of trails added.
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int trail_list_lua_add_batch(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    const char *texname = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    trail_list_check_texture(L, list, texname);
+
+    int texture = trail_list_texture_index(list, texname);
+
+    size_t count = luaL_len(L, 3);
+
+    for (size_t i=1;i<=count;i++) {
+        if (lua_geti(L, 3, i)!=LUA_TTABLE) return luaL_error(L, "trail %d is not a table", (int)i);
+        int attrs = lua_gettop(L);
+
+        int ptype = lua_getfield(L, attrs, "points");
+        if (ptype!=LUA_TTABLE && ptype!=LUA_TSTRING) {
+            return luaL_error(L, "trail %d: points must be a table or packed string", (int)i);
+        }
+        if (ptype==LUA_TTABLE && luaL_len(L, -1) < 2) {
+            return luaL_error(L, "trail %d: trails must have at least 2 points.", (int)i);
+        }
+        if (ptype==LUA_TSTRING && lua_rawlen(L, -1) < 2 * sizeof(vec3f_t)) {
+            return luaL_error(L, "trail %d: trails must have at least 2 points.", (int)i);
+        }
+        lua_pop(L, 1);
+
+        trail_list_trail_t *trail = trail_list_init_trail(list, texture);
+
+        if (lua_getfield(L, attrs, "tags")!=LUA_TNIL) trail->tags = luaL_ref(L, LUA_REGISTRYINDEX);
+        else lua_pop(L, 1);
+
+        trail_list_trail_update(list, trail, L, attrs);
+
+        lua_pop(L, 1);
+    }
+
+    if (count) list->vbo_update = 1;
+
+    lua_pushinteger(L, (lua_Integer)count);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: remove(tags)
+
+        Remove trails that have matching tags.
+
+        :param table tags:
+        :returns: The number of trails removed.
+        :rtype: number
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+// Build the arc length prefix table and segment group AABBs for a trail.
+static void trail_list_trail_build_progress(trail_list_trail_t *trail) {
+    if (trail->arclen) egoverlay_free(trail->arclen);
+    if (trail->seggroups) egoverlay_free(trail->seggroups);
+    trail->arclen = NULL;
+    trail->seggroups = NULL;
+    trail->seggroup_count = 0;
+    trail->progress_dirty = 0;
+
+    if (trail->point_count<2) return;
+
+    trail->arclen = egoverlay_calloc(trail->point_count, sizeof(float));
+
+    for (size_t i=1;i<trail->point_count;i++) {
+        vec3f_t d;
+        vec3f_sub_vec3f(&trail->points[i], &trail->points[i-1], &d);
+        trail->arclen[i] = trail->arclen[i-1] + vec3f_length(&d);
+    }
+
+    size_t segcount = trail->point_count - 1;
+    trail->seggroup_count = (segcount + TRAIL_SEG_GROUP - 1) / TRAIL_SEG_GROUP;
+    trail->seggroups = egoverlay_calloc(trail->seggroup_count, sizeof(trail_seg_group_t));
+
+    for (size_t gi=0;gi<trail->seggroup_count;gi++) {
+        size_t first = gi * TRAIL_SEG_GROUP;
+        size_t last = first + TRAIL_SEG_GROUP;
+        if (last > segcount) last = segcount;
+
+        // segments first..last-1 span points first..last
+        trail_seg_group_t *grp = &trail->seggroups[gi];
+        grp->min = trail->points[first];
+        grp->max = trail->points[first];
+        for (size_t p=first+1;p<=last;p++) {
+            if (trail->points[p].x < grp->min.x) grp->min.x = trail->points[p].x;
+            if (trail->points[p].y < grp->min.y) grp->min.y = trail->points[p].y;
+            if (trail->points[p].z < grp->min.z) grp->min.z = trail->points[p].z;
+            if (trail->points[p].x > grp->max.x) grp->max.x = trail->points[p].x;
+            if (trail->points[p].y > grp->max.y) grp->max.y = trail->points[p].y;
+            if (trail->points[p].z > grp->max.z) grp->max.z = trail->points[p].z;
+        }
+    }
+}
+
+// squared distance from a point to an AABB; 0 inside
+static float point_aabb_dist2(vec3f_t *p, vec3f_t *bmin, vec3f_t *bmax) {
+    float d2 = 0.f;
+
+    if      (p->x < bmin->x) d2 += (bmin->x - p->x) * (bmin->x - p->x);
+    else if (p->x > bmax->x) d2 += (p->x - bmax->x) * (p->x - bmax->x);
+    if      (p->y < bmin->y) d2 += (bmin->y - p->y) * (bmin->y - p->y);
+    else if (p->y > bmax->y) d2 += (p->y - bmax->y) * (p->y - bmax->y);
+    if      (p->z < bmin->z) d2 += (bmin->z - p->z) * (bmin->z - p->z);
+    else if (p->z > bmax->z) d2 += (p->z - bmax->z) * (p->z - bmax->z);
+
+    return d2;
+}
+
+// Nearest point on the trail to p: writes the distance along the trail and
+// returns the squared off route distance, or -1 for degenerate trails.
+static float trail_list_trail_progress(trail_list_trail_t *trail, vec3f_t *p, float *along) {
+    if (trail->progress_dirty || !trail->arclen) trail_list_trail_build_progress(trail);
+    if (!trail->arclen) return -1.f;
+
+    float best_d2 = -1.f;
+    float best_along = 0.f;
+
+    size_t segcount = trail->point_count - 1;
+
+    for (size_t gi=0;gi<trail->seggroup_count;gi++) {
+        trail_seg_group_t *grp = &trail->seggroups[gi];
+
+        if (best_d2>=0.f && point_aabb_dist2(p, &grp->min, &grp->max) >= best_d2) continue;
+
+        size_t first = gi * TRAIL_SEG_GROUP;
+        size_t last = first + TRAIL_SEG_GROUP;
+        if (last > segcount) last = segcount;
+
+        for (size_t s=first;s<last;s++) {
+            vec3f_t *a = &trail->points[s];
+            vec3f_t *b = &trail->points[s+1];
+
+            vec3f_t ab;
+            vec3f_sub_vec3f(b, a, &ab);
+
+            float len2 = ab.x*ab.x + ab.y*ab.y + ab.z*ab.z;
+            float t = 0.f;
+            if (len2 > 0.f) {
+                t = ((p->x - a->x)*ab.x + (p->y - a->y)*ab.y + (p->z - a->z)*ab.z) / len2;
+                if (t < 0.f) t = 0.f;
+                if (t > 1.f) t = 1.f;
+            }
+
+            float cx = a->x + ab.x * t;
+            float cy = a->y + ab.y * t;
+            float cz = a->z + ab.z * t;
+            float d2 = (p->x-cx)*(p->x-cx) + (p->y-cy)*(p->y-cy) + (p->z-cz)*(p->z-cz);
+
+            if (best_d2<0.f || d2 < best_d2) {
+                best_d2 = d2;
+                best_along = trail->arclen[s] + (trail->arclen[s+1] - trail->arclen[s]) * t;
+            }
+        }
+    }
+
+    *along = best_along;
+
+    return best_d2;
+}
+
+/*** RST
+    .. lua:method:: progress(tags, x, y, z)
+
+        Return how far along a trail the given position is.
+
+        The nearest point on the nearest trail matching ``tags`` is found
+        using per trail arc length tables and segment bounding boxes, so the
+        query stays cheap even on trails with thousands of points. Returns
+        the distance along the trail (in the same units as the points), the
+        off route distance (how far the position is from the trail), and the
+        trail's total length. Returns ``nil`` when no trail matches.
+
+        :param table tags: Match trails as in :lua:meth:`update`.
+        :param number x:
+        :param number y:
+        :param number z:
+        :rtype: number, number, number
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int trail_list_lua_progress(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    vec3f_t p;
+    p.x = (float)luaL_checknumber(L, 3);
+    p.y = (float)luaL_checknumber(L, 4);
+    p.z = (float)luaL_checknumber(L, 5);
+
+    float best_d2 = -1.f;
+    float best_along = 0.f;
+    float best_total = 0.f;
+
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        for (size_t t=0;t<list->trail_counts[tex];t++) {
+            trail_list_trail_t *trail = &list->trails[tex][t];
+
+            if (trail->tags<0) continue;
+
+            lua_geti(L, LUA_REGISTRYINDEX, trail->tags);
+            int tagsind = lua_gettop(L);
+            int match = tags_match(tagsind, L, 2);
+            lua_pop(L, 1);
+
+            if (!match) continue;
+
+            float along = 0.f;
+            float d2 = trail_list_trail_progress(trail, &p, &along);
+            if (d2<0.f) continue;
+
+            if (best_d2<0.f || d2 < best_d2) {
+                best_d2 = d2;
+                best_along = along;
+                best_total = trail->arclen[trail->point_count-1];
+            }
+        }
+    }
+
+    if (best_d2<0.f) return 0;
+
+    lua_pushnumber(L, best_along);
+    lua_pushnumber(L, sqrtf(best_d2));
+    lua_pushnumber(L, best_total);
+
+    return 3;
+}
+
+int trail_list_lua_remove(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    int nremoved = 0;
+
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        int tremoved = 0;
+        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+            if (list->trails[tex][trail].tags<0) continue;
+
+            lua_geti(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
+            int tagsind = lua_gettop(L);
+
+            if (tags_match(tagsind, L, 2)) {
+                luaL_unref(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
+                if (list->trails[tex][trail].points) egoverlay_free(list->trails[tex][trail].points);
+                if (list->trails[tex][trail].chunks) egoverlay_free(list->trails[tex][trail].chunks);
+                if (list->trails[tex][trail].arclen) egoverlay_free(list->trails[tex][trail].arclen);
+                if (list->trails[tex][trail].seggroups) egoverlay_free(list->trails[tex][trail].seggroups);
+
+                for (size_t tm=trail+1;tm<list->trail_counts[tex];tm++) {
+                    trail_list_trail_t *a = &list->trails[tex][tm-1];
+                    trail_list_trail_t *b = &list->trails[tex][tm];
+                    memcpy(a, b, sizeof(trail_list_trail_t));
+                }
+                trail--;
+                tremoved++;
+                list->trail_counts[tex]--;
+            }
+            lua_pop(L, 1);
+        }
+        if (tremoved) {
+            list->trails[tex] = egoverlay_realloc(list->trails[tex], list->trail_counts[tex] * sizeof(trail_list_trail_t));
+        }
+        nremoved += tremoved;
+    }
+
+    if (nremoved) {
+        list->vbo_update = TRAIL_VBO_REBUILD;
+        list->append_trail = NULL;
+    }
+
+    lua_pushinteger(L, nremoved);
+    return 1;
+}
+
+trail_coordinate_t *trail_list_trail_calc_coords(trail_list_t *list, trail_list_trail_t *trail) {
+    trail_coordinate_t *coords = NULL;
+
+    trail->coord_count = ((trail->point_count - 1) * 2) + 2;
+    coords = egoverlay_calloc(trail->coord_count, sizeof(trail_coordinate_t));
+    
+    // in the 3D world, up is Y positive
+    vec3f_t up = { 0.f, 1.f, 0.f };
+    if (trail->wall && list->map) {
+        // unless it's a wall, then up is to the east
+        up.x = 1.f;
+        up.y = 0.f;
+        up.z = 0.f;
+    } else if (list->map) {
+        // or on the map, up is Z
+        up.x = 0.f;
+        up.y = 0.f;
+        up.z = 1.f;
+    }
+
+    size_t coord_ind = 0;
+
+    for (size_t i=0; i<trail->point_count-1; i++) {
+        // each segment is made up of 2 points, p1 and p2
+        vec3f_t *p1 = &trail->points[i];
+        vec3f_t *p2 = &trail->points[i+1];
+
+        /* 
+           We calculate a,b,c,d based on the points p1 and p2
+
+           c<----p2----->d
+                 ^
+                 |
+                 |
+                 |
+                 |
+                 |
+           a<----p1----->b
+
+           Our 6 coords are the vertices of 2 triangles:
+            - b, a, d
+            - d, a, c
+
+           The most efficient way of storing and drawing these triangles will
+           be a triangle strip. Each segment will use 4 vertices: b, a, d, c
+           which will be drawn in b, a, d and d, a, c order.
+
+           The next segment will use d, c, e, f and so on.
+        */
+        
+        // forward is a vector from p1 to p2
+        vec3f_t forward = {0};
+        vec3f_sub_vec3f(p2, p1, &forward);
+
+        vec3f_t forwardn = {0};
+        vec3f_normalize(&forward, &forwardn);
+        
+        // side is a vector perpendicular to forward and up
+        vec3f_t side = {0};
+        vec3f_crossproduct(&up, &forwardn, &side);
+
+        vec3f_t siden = {0};
+        vec3f_normalize(&side, &siden);
+
+        // side becomes our vector to b and d
+        // and the opposite direction is to a and c
+        vec3f_mult_f(&siden, trail->size / 2.f, &side);
+
+        // TODO: adjust points where segments meet at angles
+
+        // if this is the first segment then calculate a and b, otherwise
+        // and c and d from the previous segment will become a and b
+        if (i==0) {
+            // b
+            vec3f_add_vec3f(p1, &side, &coords[coord_ind].position);
+            coords[coord_ind].u = 1.f;
+            coords[coord_ind].v = 0.f;
+            coord_ind++;
+
+            // a
+            vec3f_sub_vec3f(p1, &side, &coords[coord_ind].position);
+            coords[coord_ind].u = 0.f;
+            coords[coord_ind].v = 0.f;
+            coord_ind++;
+        }
+
+        float section_len = vec3f_length(&forward);
         
-        .. versionhistory::
-            :0.1.0: Added
-*/
-int sprite_list_lua_add_sprite(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
-    const char *texname = luaL_checkstring(L, 2);
+        // If the segment is too long fading won't be calculated properly
+        // so insert extra points along forward.
+        // I'm not exactly sure what's going on, but I suspect it's something to
+        // do with how the z/depth isn't linear and the calculated fade distance
+        // isn't being interpolated properly when the end vertex is beyond a
+        // certain Z distance away. In any case, breaking long segments up into
+        // multiple smaller ones makes fading with fade_near/fade_far work much
+        // better on very long segments.
+        if (section_len > 5000.f && !list->map) {
+            int extrapoints = (int)floorf(section_len / 5000.f);
+            trail->coord_count += extrapoints * 2;
+            coords = egoverlay_realloc(coords, trail->coord_count * sizeof(trail_coordinate_t));
 
-    luaL_checktype(L, 3, LUA_TTABLE);
+            for (int ep=0; ep < extrapoints; ep++) {
+                float len = 5000.f * (ep + 1);
+                vec3f_t fp = {0}; // vector from p1 to this extra point
+                vec3f_t p = {0};  // the extra point
 
-    texture_map_texture_t *tex = texture_map_get(list->texture_map, texname);
+                vec3f_mult_f(&forwardn, len, &fp);
+                vec3f_add_vec3f(p1, &fp, &p);
 
-    if (tex==NULL) return luaL_error(L, "invalid texture name: %s", texname);
+                float epv = - ( 5000.f / trail->size ) + coords[coord_ind-1].v;
 
-    int texture = -1;
-    for (size_t t=0;t<list->texture_count;t++) {
-        if (strcmp(list->texture_keys[t], texname)==0) {
-            texture = (int)t;
-            break;
+                vec3f_add_vec3f(&p, &side, &coords[coord_ind].position);
+                coords[coord_ind].u = 1.f;
+                coords[coord_ind].v = epv;
+                coord_ind++;
+
+                vec3f_sub_vec3f(&p, &side, &coords[coord_ind].position);
+                coords[coord_ind].u = 0.f;
+                coords[coord_ind].v = epv;
+                coord_ind++;
+
+                section_len -= 5000.f;
+            }
         }
+        
+
+        float section_frac = section_len / trail->size;
+
+        float p2v = section_frac + coords[coord_ind-1].v;
+        
+        // d
+        vec3f_add_vec3f(p2, &side, &coords[coord_ind].position);
+        coords[coord_ind].u = 1.f;
+        coords[coord_ind].v = p2v;
+        coord_ind++;
+
+        // c
+        vec3f_sub_vec3f(p2, &side, &coords[coord_ind].position);
+        coords[coord_ind].u = 0.f;
+        coords[coord_ind].v = p2v;
+        coord_ind++;
     }
 
-    if (texture < 0) {
-        list->texture_count++;
-        list->texture_keys  = egoverlay_realloc(list->texture_keys , list->texture_count * sizeof(char*));
-        list->sprite_counts = egoverlay_realloc(list->sprite_counts, list->texture_count * sizeof(size_t));
-        list->sprites       = egoverlay_realloc(list->sprites      , list->texture_count * sizeof(sprite_list_sprite_t*));
-        list->tags          = egoverlay_realloc(list->tags         , list->texture_count * sizeof(int*));
+    return coords;
+}
+
+// Split a trail's strip into fixed size chunks with bounding spheres.
+// Consecutive chunks overlap by 2 coordinates so no triangle is lost or
+// drawn twice at the seam.
+void trail_list_trail_calc_chunks(trail_list_trail_t *trail, trail_coordinate_t *coords) {
+    if (trail->chunks) egoverlay_free(trail->chunks);
+
+    size_t maxchunks = (trail->coord_count / (TRAIL_CHUNK_COORDS - 2)) + 1;
+    trail->chunks = egoverlay_calloc(maxchunks, sizeof(trail_chunk_t));
+
+    size_t n = 0;
+    size_t start = 0;
+
+    for (;;) {
+        size_t count = trail->coord_count - start;
+        if (count > TRAIL_CHUNK_COORDS) count = TRAIL_CHUNK_COORDS;
+
+        trail_chunk_t *chunk = &trail->chunks[n];
+        chunk->first = start;
+        chunk->coord_count = count;
+
+        vec3f_t bmin = coords[start].position;
+        vec3f_t bmax = coords[start].position;
+        for (size_t i=start+1;i<start+count;i++) {
+            if (coords[i].position.x < bmin.x) bmin.x = coords[i].position.x;
+            if (coords[i].position.y < bmin.y) bmin.y = coords[i].position.y;
+            if (coords[i].position.z < bmin.z) bmin.z = coords[i].position.z;
+            if (coords[i].position.x > bmax.x) bmax.x = coords[i].position.x;
+            if (coords[i].position.y > bmax.y) bmax.y = coords[i].position.y;
+            if (coords[i].position.z > bmax.z) bmax.z = coords[i].position.z;
+        }
+
+        chunk->center.x = (bmin.x + bmax.x) / 2.f;
+        chunk->center.y = (bmin.y + bmax.y) / 2.f;
+        chunk->center.z = (bmin.z + bmax.z) / 2.f;
 
-        texture = (int)list->texture_count - 1;
+        vec3f_t halfdiag = {0};
+        vec3f_sub_vec3f(&bmax, &chunk->center, &halfdiag);
+        chunk->radius = vec3f_length(&halfdiag);
 
-        list->texture_keys[texture] = egoverlay_calloc(strlen(texname)+1, sizeof(char));
-        memcpy(list->texture_keys[texture], texname, strlen(texname));
+        n++;
 
-        list->sprite_counts[texture] = 0;
-        list->sprites[texture] = NULL;
-        list->tags[texture] = NULL;
+        if (start + count >= trail->coord_count) break;
+        start += count - 2;
     }
 
-    list->total_sprite_count++;
-    list->sprite_counts[texture]++;
-    list->sprites[texture] = egoverlay_realloc(
-        list->sprites[texture],
-        list->sprite_counts[texture] * sizeof(sprite_list_sprite_t)
-    );
-    list->tags[texture] = egoverlay_realloc(list->tags[texture], list->sprite_counts[texture] * sizeof(int));
+    trail->chunk_count = n;
+}
 
-    size_t spritei = list->sprite_counts[texture] - 1;
-    sprite_list_sprite_t *s = list->sprites[texture] + spritei;
+void trail_list_update_vbo(trail_list_t *list) {
+    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
 
-    s->max_u    = tex->max_u;
-    s->max_v    = tex->max_v;
-    s->xy_ratio = tex->xy_ratio;
+    // fast path: points were only appended to one trail. if that trail is
+    // the last one in the buffer layout and there's room, recompute just it
+    // and upload only its range
+    if (list->vbo_update==TRAIL_VBO_APPEND && list->append_trail) {
+        trail_list_trail_t *last = NULL;
+        size_t offset = 0;
+
+        for (size_t tex=0;tex<list->texture_count;tex++) {
+            for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+                last = &list->trails[tex][trail];
+                if (last!=list->append_trail) offset += last->coord_count * sizeof(trail_coordinate_t);
+            }
+        }
 
-    s->position.x = 0.f;
-    s->position.y = 0.f;
-    s->position.z = 0.f;
+        if (last==list->append_trail) {
+            trail_coordinate_t *coords = trail_list_trail_calc_coords(list, last);
+            trail_list_trail_calc_chunks(last, coords);
 
-    list->tags[texture][spritei] = -1;
-    s->size = 80.f;
+            size_t bytes = last->coord_count * sizeof(trail_coordinate_t);
 
-    s->fade_near = -1.f;
-    s->fade_far  = -1.f;
+            if (offset + bytes <= list->vbo_size) {
+                glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, coords);
+                egoverlay_free(coords);
 
-    s->color.r = 1.f;
-    s->color.g = 1.f;
-    s->color.b = 1.f;
-    s->color.a = 1.f;
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    s->flags = 0x01; // billboard
+                list->vbo_used = offset + bytes;
+                list->vbo_update = TRAIL_VBO_CLEAN;
+                list->append_trail = NULL;
 
-    if (lua_getfield(L, 3, "tags")!=LUA_TNIL) list->tags[texture][spritei] = luaL_ref(L, LUA_REGISTRYINDEX);
-    else lua_pop(L, 1);
+                return;
+            }
 
-    sprite_list_sprite_update(s, L, 3);
+            egoverlay_free(coords);
+        }
+        // fall through to a full rebuild
+    }
 
-    list->vbo_update = 1;
+    trail_coordinate_t ***coords = egoverlay_calloc(list->texture_count, sizeof(trail_coordinate_t**));
 
-    return 0;
-}
+    size_t newsize = 0;
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        coords[tex] = egoverlay_calloc(list->trail_counts[tex], sizeof(trail_coordinate_t*));
 
-int tags_match(int tagsind, lua_State *L, int tags_ind) {
-    lua_pushnil(L);
-    while (lua_next(L, tags_ind)) {
-        const char *tagkey = lua_tostring(L, -2);
+        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+            coords[tex][trail] = trail_list_trail_calc_coords(list, &list->trails[tex][trail]);
+            trail_list_trail_calc_chunks(&list->trails[tex][trail], coords[tex][trail]);
 
-        if (lua_getfield(L, tagsind, tagkey)==LUA_TNIL || lua_compare(L, -1, -2, LUA_OPEQ)==0) {
-            // not a match
+            newsize += list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t);
+        }
+    }
+    
+    if (newsize > list->vbo_size) {
+        // leave some slack so appending to a live trail doesn't reallocate
+        // the buffer every time
+        list->vbo_size = newsize + (newsize / 2);
+        glBufferData(GL_ARRAY_BUFFER, list->vbo_size, NULL, GL_STATIC_DRAW);
+    }
 
-            // pop the current key, value, and the value from the sprites tag
-            // table, which is nil
-            lua_pop(L, 3);
-            return 0; 
+    size_t offset = 0;
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+            glBufferSubData(
+                GL_ARRAY_BUFFER,
+                offset,
+                list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t),
+                coords[tex][trail]
+            );
+            offset += list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t);
+            egoverlay_free(coords[tex][trail]);
         }
-        lua_pop(L, 2); // pop the sprite's tag value and input value, leaving key
+        egoverlay_free(coords[tex]);
     }
 
-    return 1;
+    egoverlay_free(coords);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);    
+
+    list->vbo_used = newsize;
+    list->vbo_update = TRAIL_VBO_CLEAN;
+    list->append_trail = NULL;
 }
 
 /*** RST
-    .. lua:method:: update(tags, attributes)
+    .. lua:method:: draw()
+    
+        Draw all of the trails in this list.
 
-        Update the sprites that have matching tags.
+        .. important::
+            This method can only be called during :overlay:event:`draw-3d`. Attempts
+            to call it at any other time will result in an error.
 
-        An empty tags table matches all sprites. A sprite must match all tag
-        values given, if a sprite does not have a value for a tag it will not
-        match.
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int trail_list_lua_draw(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
 
-        Returns the number of sprites updated.
+    if (!overlay_3d->in_frame) return luaL_error(L, "not in a frame");
 
-        :param table tags:
-        :param table attributes:
-        :rtype: number
+    if (list->vbo_update) trail_list_update_vbo(list);
+    
+    glDisable(GL_CULL_FACE);
 
-        .. versionhistory::
-            :0.1.0: Added
+    gl_shader_program_use(overlay_3d->trail_program);
 
-*/
-int sprite_list_lua_update_sprites(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
+    glActiveTexture(GL_TEXTURE0);
 
-    luaL_checktype(L, 2, LUA_TTABLE);
-    luaL_checktype(L, 3, LUA_TTABLE);
+    // set general uniforms
 
-    int nupdated = 0;
+    int oldvp[4] = {0};
 
-    for (size_t t=0;t<list->texture_count;t++) {
-        for (size_t s=0;s<list->sprite_counts[t];s++) {
-            if (list->tags[t][s]<0) continue;
+    if (list->map) {
+        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
+        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
 
-            lua_geti(L, LUA_REGISTRYINDEX, list->tags[t][s]);
-            int tagsind = lua_gettop(L);
-            if (tags_match(tagsind, L, 2)) {
-                sprite_list_sprite_update(list->sprites[t] + s, L, 3);
-                nupdated++;
+        if (!overlay_3d->mapfullscreen) {
+            int fbw, fbh;
+            app_get_framebuffer_size(&fbw, &fbh);
+
+            glGetIntegerv(GL_VIEWPORT, oldvp);
+            glViewport(
+                overlay_3d->minimapleft,
+                overlay_3d->minimapbottom,
+                overlay_3d->minimapwidth,
+                overlay_3d->minimapheight
+            );
+        }
+    }
+
+    glUniform1f(5, (GLfloat)overlay_3d->minimapleft);
+    glUniform1f(6, (GLfloat)overlay_3d->minimapbottom);
+    glUniform1f(7, (GLfloat)overlay_3d->minimapheight);
+    glUniform1ui(8, (GLuint)list->map);
+
+    glBindVertexArray(list->vao);
+
+    size_t first = 0;
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        if (list->trail_counts[tex]==0) continue;
+
+        texture_map_texture_t *gltex = texture_map_get(list->texture_map, list->texture_keys[tex]);
+
+        glBindTexture(GL_TEXTURE_2D, gltex->texture);
+
+        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+            trail_list_trail_t *t = &list->trails[tex][trail];
+
+            // skip trails entirely inside the far distance bucket. the offset
+            // into the VBO still has to advance past the skipped coords
+            if (!list->map && t->fade_far >= 0.f) {
+                float dx = t->bounds_center.x - overlay_3d->player_pos.x;
+                float dy = t->bounds_center.y - overlay_3d->player_pos.y;
+                float dz = t->bounds_center.z - overlay_3d->player_pos.z;
+
+                float dist = sqrtf((dx * dx) + (dy * dy) + (dz * dz)) - t->bounds_radius;
+                float farcutoff = t->fade_far * (t->lodfar ? LOD_FAR_EXIT : LOD_FAR_ENTER);
+
+                // auto-degradation tier 4 culls trails at half the distance
+                if (app_degradation_level()>=4) farcutoff *= 0.5f;
+
+                t->lodfar = dist > farcutoff;
+
+                if (t->lodfar) {
+                    first += t->coord_count;
+                    continue;
+                }
             }
-            lua_pop(L, 1);
+
+            glUniform1f(2, list->trails[tex][trail].fade_near);
+            glUniform1f(3, list->trails[tex][trail].fade_far);
+            glUniform4fv(4, 1, (GLfloat*)&list->trails[tex][trail].color);
+
+            if (!list->map && t->chunk_count) {
+                // frustum cull per chunk and issue the visible chunks as a
+                // single multi-draw
+                if (list->md_capacity < t->chunk_count) {
+                    list->md_firsts = egoverlay_realloc(list->md_firsts, t->chunk_count * sizeof(GLint));
+                    list->md_counts = egoverlay_realloc(list->md_counts, t->chunk_count * sizeof(GLsizei));
+                    list->md_capacity = t->chunk_count;
+                }
+
+                GLsizei n = 0;
+                for (size_t c=0;c<t->chunk_count;c++) {
+                    trail_chunk_t *chunk = &t->chunks[c];
+
+                    if (!sphere_in_frustum(&chunk->center, chunk->radius)) continue;
+
+                    list->md_firsts[n] = (GLint)(first + chunk->first);
+                    list->md_counts[n] = (GLsizei)chunk->coord_count;
+                    n++;
+                }
+
+                if (n) {
+                    glMultiDrawArrays(GL_TRIANGLE_STRIP, list->md_firsts, list->md_counts, n);
+                    profiler_count_draw(1, n);
+                }
+            } else {
+                glDrawArrays(GL_TRIANGLE_STRIP, (GLint)first, (GLsizei)list->trails[tex][trail].coord_count);
+                profiler_count_draw(1, 1);
+            }
+
+            first += list->trails[tex][trail].coord_count;
         }
     }
 
-    if (nupdated) {
-        list->vbo_update = 1;
+    if (list->map && !overlay_3d->mapfullscreen) {
+        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
     }
 
-    lua_pushinteger(L, nupdated);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    return 1;
+    glBindVertexArray(0);
+
+    glUseProgram(0);
+
+    glEnable(GL_CULL_FACE);
+
+    return 0;
 }
 
 /*** RST
-    .. lua:method:: remove(tags)
+    .. lua:method:: update(tags, attributes)
 
-        Remove sprites that have matching tags.
+        Update attributes of trails with matching tags.
 
-        An empty tags table matches all sprites. A sprite must match all tag
-        values given, if a sprite does not have a value for a tag it will not
-        match.
+        In addition to the attributes accepted by :lua:meth:`addtrail`,
+        ``attributes`` may contain ``appendpoints``, a sequence of points that
+        are appended to the trail's existing points. Appending is much cheaper
+        than replacing ``points`` for live recorded trails.
 
         :param table tags:
-        :returns: The number of sprites removed.
-        :rtype: number
+        :param table attributes:
+
+        :returns: The number of trails updated
+        :rtype: integer
 
         .. versionhistory::
             :0.1.0: Added
 */
-int sprite_list_lua_remove_sprites(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
+int trail_list_lua_update(lua_State *L) {
+    trail_list_t *list = lua_checktraillist(L, 1);
 
     luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
 
-    int nremoved = 0;
+    int nupdated = 0;
 
-    for (size_t t=0;t<list->texture_count;t++) {
-        int snrem = 0;
-        for (size_t s=0;s<list->sprite_counts[t];s++) {
-            if (list->tags[t][s]<0) continue;
+    for (size_t tex=0;tex<list->texture_count;tex++) {
+        int tupdated = 0;
+        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
+            if (list->trails[tex][trail].tags<0) continue;
 
-            lua_geti(L, LUA_REGISTRYINDEX, list->tags[t][s]);
+            lua_geti(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
             int tagsind = lua_gettop(L);
-            
-            if (tags_match(tagsind, L, 2)) {
-                luaL_unref(L, LUA_REGISTRYINDEX, list->tags[t][s]);
-                for (size_t sm=s+1;sm<list->sprite_counts[t];sm++) {
-                    sprite_list_sprite_t *a = list->sprites[t] + sm - 1;
-                    sprite_list_sprite_t *b = list->sprites[t] + sm;
 
-                    memcpy(a, b, sizeof(sprite_list_sprite_t));
-                    list->tags[t][sm-1] = list->tags[t][sm];
-                }
-                list->sprite_counts[t]--;
-                list->total_sprite_count--;
-                s--;
-                snrem++;
+            if (tags_match(tagsind, L, 2)) {
+                trail_list_trail_update(list, &list->trails[tex][trail], L, 3);
+                tupdated++;
             }
             lua_pop(L, 1);
         }
-
-        if (snrem) {
-            nremoved += snrem;
-            list->sprites[t] = egoverlay_realloc(
-                list->sprites[t],
-                list->sprite_counts[t] * sizeof(sprite_list_sprite_t)
-            );
-            list->tags[t] = egoverlay_realloc(list->tags[t], list->sprite_counts[t] * sizeof(int));
-        }
+        nupdated += tupdated;
     }
 
-    if (nremoved) {
-        list->vbo_update = 1;
-   }
-
-    lua_pushinteger(L, nremoved);
+    if (nupdated) list->vbo_update = 1;
 
+    lua_pushinteger(L, nupdated);
     return 1;
 }
 
-void sprite_list_update_vbo(sprite_list_t *list) {
-    size_t new_vbo_size = 0;
-    for (size_t t=0;t<list->texture_count;t++) {
-        new_vbo_size += (sizeof(sprite_list_sprite_t) * list->sprite_counts[t]);
-    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+/*** RST
+Heat Maps
+---------
 
-    if (list->vbo_size < new_vbo_size) {
-        glBufferData(GL_ARRAY_BUFFER, new_vbo_size, NULL, GL_DYNAMIC_DRAW);
-        list->vbo_size = new_vbo_size;
-    }
+.. lua:function:: heatmap(attributes)
 
-    size_t offset = 0;
-    for (size_t t=0;t<list->texture_count;t++) {
-        size_t tvbo_size = sizeof(sprite_list_sprite_t) * list->sprite_counts[t];
-        if (tvbo_size==0) continue;
-        glBufferSubData(GL_ARRAY_BUFFER, offset, tvbo_size, list->sprites[t]);
-        offset += tvbo_size;
-    }
+    Create a density overlay for the (mini)map.
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    list->vbo_update = 0;
-}
+    Positions are accumulated into a coarse grid; the grid is uploaded as a
+    single texture and rendered as one colored alpha quad over the map, so
+    tens of thousands of samples (gathering nodes, death positions) cost one
+    draw call instead of thousands of sprites.
 
-/*** RST
-    .. lua:method:: draw()
+    ``attributes`` must contain the continent coordinate rectangle the grid
+    covers (``left``, ``top``, ``right``, ``bottom``) and may contain
+    ``width`` and ``height``, the grid resolution in cells (default 256).
 
-        Draw all sprites in this list.
+    :param table attributes:
+    :rtype: o3dheatmap
 
-        :param boolean map: If ``true`` draw sprites on the map or minimap.
-            Otherwise draw sprites in the 3D world.
+    .. code-block:: lua
+        :caption: Example
 
-        .. important::
-        
-            This method can only be called during :overlay:event:`draw-3d`.
-            Attempts to call it at any other time will result in an error.
+        local hm = o3d.heatmap{
+            left = map.continent_rect_left,  top    = map.continent_rect_top,
+            right = map.continent_rect_right, bottom = map.continent_rect_bottom
+        }
 
-        .. versionhistory::
-            :0.1.0: Added
-*/
-int sprite_list_lua_draw(lua_State *L) {
-    sprite_list_t *list = lua_checkspritelist(L, 1);
+        hm:addpoints(deathcoords) -- flat {x1, y1, x2, y2, ...}
 
-    if (!overlay_3d->in_frame) return luaL_error(L, "draw can only be called during update-3d");
+        -- during draw-3d
+        hm:draw()
 
-    if (list->total_sprite_count==0) return 0;
+    .. versionhistory::
+        :0.1.0: Added
+*/
 
-    if (list->vbo_update) sprite_list_update_vbo(list);
+#define HEATMAP_MT "O3DHeatMapMetaTable"
 
-    glDisable(GL_CULL_FACE);
-    
-    gl_shader_program_use(overlay_3d->sprite_array_program);
+typedef struct {
+    int width;
+    int height;
 
-    int oldvp[4] = {0};
+    // continent coordinate rect covered by the grid
+    float left;
+    float top;
+    float right;
+    float bottom;
 
-    if (list->map) {
-        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
-        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
+    float *cells;
+    float maxv;
 
-        if (!overlay_3d->mapfullscreen) {
-            int fbw, fbh;
-            app_get_framebuffer_size(&fbw, &fbh);
+    GLuint texture;
+    int dirty;
+
+    float alpha;
+} heatmap_t;
+
+#define lua_checkheatmap(L, ind) (heatmap_t*)luaL_checkudata(L, ind, HEATMAP_MT)
+
+int heatmap_lua_del(lua_State *L);
+int heatmap_lua_add_points(lua_State *L);
+int heatmap_lua_clear(lua_State *L);
+int heatmap_lua_decay(lua_State *L);
+int heatmap_lua_alpha(lua_State *L);
+int heatmap_lua_draw(lua_State *L);
+
+luaL_Reg heatmap_funcs[] = {
+    "__gc"     , &heatmap_lua_del,
+    "addpoints", &heatmap_lua_add_points,
+    "clear"    , &heatmap_lua_clear,
+    "decay"    , &heatmap_lua_decay,
+    "alpha"    , &heatmap_lua_alpha,
+    "draw"     , &heatmap_lua_draw,
+    NULL       , NULL
+};
 
-            glGetIntegerv(GL_VIEWPORT, oldvp);
-            glViewport(
-                overlay_3d->minimapleft,
-                overlay_3d->minimapbottom,
-                overlay_3d->minimapwidth,
-                overlay_3d->minimapheight
-            );
-        }
-    } else {
-        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)overlay_3d->view);
-        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)overlay_3d->proj);
-    }
+int heatmap_lua_new(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
 
-    glUniform3fv(2, 1, (GLfloat*)&overlay_3d->player_pos);
-    glUniform1ui(3, (GLuint)list->map);
-    glUniform3fv(4, 1, (GLfloat*)&overlay_3d->camera);
+    heatmap_t *hm = lua_newuserdata(L, sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
 
-    glUniform1f(5, (GLfloat)overlay_3d->minimapleft  );
-    glUniform1f(6, (GLfloat)overlay_3d->minimapbottom);
-    glUniform1f(7, (GLfloat)overlay_3d->minimapheight);
+    hm->width = 256;
+    hm->height = 256;
+    hm->alpha = 0.6f;
 
-    glBindVertexArray(list->vao);
+    if (lua_getfield(L, 1, "width")!=LUA_TNIL) hm->width = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 1, "height")!=LUA_TNIL) hm->height = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
 
-    glActiveTexture(GL_TEXTURE0);
-    
-    GLint inst = 0;
-    for (size_t t=0;t<list->texture_count;t++) {
-        texture_map_texture_t *tex = texture_map_get(list->texture_map, list->texture_keys[t]);
+    if (hm->width<1 || hm->height<1 || hm->width>4096 || hm->height>4096) {
+        return luaL_error(L, "heatmap grid size must be 1-4096 cells per side.");
+    }
 
-        if (!tex) {
-            logger_t *log = logger_get("lua-gl");
-            logger_error(log, "invalid texture key: %s", list->texture_keys[t]);
-        } else {
-            glBindTexture(GL_TEXTURE_2D, tex->texture);
-        }
+    if (lua_getfield(L, 1, "left")==LUA_TNIL) return luaL_error(L, "heatmap requires a left attribute");
+    hm->left = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 1, "top")==LUA_TNIL) return luaL_error(L, "heatmap requires a top attribute");
+    hm->top = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 1, "right")==LUA_TNIL) return luaL_error(L, "heatmap requires a right attribute");
+    hm->right = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 1, "bottom")==LUA_TNIL) return luaL_error(L, "heatmap requires a bottom attribute");
+    hm->bottom = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
 
-        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)list->sprite_counts[t], inst);
-        inst += (GLint)list->sprite_counts[t];
+    if (hm->right==hm->left || hm->bottom==hm->top) {
+        return luaL_error(L, "heatmap rect must not be empty.");
     }
 
-    if (list->map && !overlay_3d->mapfullscreen) {
-        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
-    }
+    hm->cells = egoverlay_calloc((size_t)hm->width * hm->height, sizeof(float));
 
+    if (!heatmap_program) heatmap_program = gl_shader_program_new_with_sources(heatmap_srcs);
+
+    glGenTextures(1, &hm->texture);
+    glBindTexture(GL_TEXTURE_2D, hm->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, hm->width, hm->height);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    glBindVertexArray(0);
+    if (luaL_newmetatable(L, HEATMAP_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, heatmap_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
 
-    glUseProgram(0);
+    return 1;
+}
 
-    glEnable(GL_CULL_FACE);
+int heatmap_lua_del(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
+
+    if (hm->cells) egoverlay_free(hm->cells);
+    if (hm->texture) glDeleteTextures(1, &hm->texture);
 
     return 0;
 }
 
 /*** RST
-.. lua:class:: o3dtraillist
+.. lua:class:: o3dheatmap
 
-    A trail list displays multiple paths as flat 2D textures drawn along
-    specified points.
+    .. lua:method:: addpoints(points[, weight])
+
+        Accumulate positions into the density grid. ``points`` is a flat
+        sequence of continent coordinate x,y pairs; each adds ``weight``
+        (default ``1``) to its cell. Points outside the rect are ignored.
+
+        :param table points:
+        :param number weight: (Optional)
+
+        .. versionhistory::
+            :0.1.0: Added
 */
+int heatmap_lua_add_points(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
 
-/*** RST
-    .. lua:method:: clear()
+    luaL_checktype(L, 2, LUA_TTABLE);
+    float weight = (float)luaL_optnumber(L, 3, 1.0);
 
-        Clear this trail list and set it back to an initial state.
+    lua_Integer n = luaL_len(L, 2);
+    if (n % 2) return luaL_error(L, "heatmap:addpoints: points must be a flat sequence of x,y pairs.");
 
-    .. note::
+    float xscale = (float)hm->width  / (hm->right - hm->left);
+    float yscale = (float)hm->height / (hm->bottom - hm->top);
 
-        This will not clear the texture list that this trail list references.
+    for (lua_Integer i=1;i<=n;i+=2) {
+        lua_geti(L, 2, i);
+        lua_geti(L, 2, i+1);
+        float x = (float)lua_tonumber(L, -2);
+        float y = (float)lua_tonumber(L, -1);
+        lua_pop(L, 2);
 
-    .. versionhistory::
-        :0.1.0: Added
-*/
-int trail_list_lua_clear(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
+        int cx = (int)((x - hm->left) * xscale);
+        int cy = (int)((y - hm->top) * yscale);
 
-    for (size_t t=0;t<list->texture_count;t++) {
-        egoverlay_free(list->texture_keys[t]);
+        if (cx<0 || cx>=hm->width || cy<0 || cy>=hm->height) continue;
 
-        for (size_t trail=0;trail<list->trail_counts[t];trail++) {
-            if (list->trails[t][trail].tags>=0) luaL_unref(L, LUA_REGISTRYINDEX, list->trails[t][trail].tags);
-            if (list->trails[t][trail].points) egoverlay_free(list->trails[t][trail].points);
-        }
-        egoverlay_free(list->trails[t]);
+        float *cell = &hm->cells[(size_t)cy * hm->width + cx];
+        *cell += weight;
+        if (*cell > hm->maxv) hm->maxv = *cell;
     }
-    if (list->texture_count) {
-        egoverlay_free(list->texture_keys);
-        egoverlay_free(list->trails);
-        egoverlay_free(list->trail_counts);
 
-        list->texture_keys = NULL;
-        list->trails = NULL;
-        list->trail_counts = NULL;
-    }
-    list->texture_count = 0;
+    hm->dirty = 1;
 
     return 0;
 }
 
-void trail_list_trail_update(trail_list_t *list, trail_list_trail_t *trail, lua_State *L, int ind) {
-    if (lua_getfield(L, ind, "fadenear")!=LUA_TNIL) trail->fade_near = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+/*** RST
+    .. lua:method:: clear()
 
-    if (lua_getfield(L, ind, "fadefar")!=LUA_TNIL) trail->fade_far = (float)lua_tonumber(L, -1);
-    lua_pop(L, 1);
+        Reset the density grid to zero.
 
-    if (lua_getfield(L, ind, "color")!=LUA_TNIL) {
-        ui_color_t color = (ui_color_t)lua_tointeger(L, -1);
-        trail->color.r = UI_COLOR_R(color);
-        trail->color.g = UI_COLOR_G(color);
-        trail->color.b = UI_COLOR_B(color);
-        trail->color.a = UI_COLOR_A(color);
-    }
-    lua_pop(L, 1);
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int heatmap_lua_clear(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
 
-    if (lua_getfield(L, ind, "size")!=LUA_TNIL) {
-        trail->size = (float)lua_tonumber(L, -1);
-        list->vbo_update = 1;
-    }
-    lua_pop(L, 1);
+    memset(hm->cells, 0, (size_t)hm->width * hm->height * sizeof(float));
+    hm->maxv = 0.f;
+    hm->dirty = 1;
 
-    if (lua_getfield(L, ind, "wall")!=LUA_TNIL) {
-        trail->wall = lua_toboolean(L, -1);
-        list->vbo_update = 1;
-    }
-    lua_pop(L, 1);
+    return 0;
+}
 
-    if (lua_getfield(L, ind, "points")!=LUA_TNIL) {
-        int pointsind = lua_gettop(L);
-        size_t c = luaL_len(L, pointsind);
-        if (c < 2) luaL_error(L, "trails must have at least 2 points.");
+/*** RST
+    .. lua:method:: decay(factor)
 
-        if (trail->points) egoverlay_free(trail->points);
+        Multiply every cell by ``factor``. Call periodically to fade old
+        samples out of a live heat map.
 
-        trail->point_count = c;
-        trail->points = egoverlay_calloc(trail->point_count, sizeof(vec3f_t));
+        :param number factor:
 
-        for (size_t i=1;i<=trail->point_count;i++) {
-            lua_geti(L, pointsind, i); // the sequence of x,y,z
-            int pind = lua_gettop(L);
-            lua_geti(L, pind, 1);
-            lua_geti(L, pind, 2);
-            lua_geti(L, pind, 3);
-            trail->points[i-1].x = (float)lua_tonumber(L, -3);
-            trail->points[i-1].y = (float)lua_tonumber(L, -2);
-            trail->points[i-1].z = (float)lua_tonumber(L, -1);
-            lua_pop(L, 4);
-        }
-        list->vbo_update = 1;
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int heatmap_lua_decay(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
+    float factor = (float)luaL_checknumber(L, 2);
+
+    hm->maxv = 0.f;
+    for (size_t c=0;c<(size_t)hm->width * hm->height;c++) {
+        hm->cells[c] *= factor;
+        if (hm->cells[c] > hm->maxv) hm->maxv = hm->cells[c];
     }
-    lua_pop(L, 1);
+
+    hm->dirty = 1;
+
+    return 0;
 }
 
 /*** RST
-    .. lua:method:: addtrail(texturename, attributes)
+    .. lua:method:: alpha(value)
 
-        Create a new trail.
+        Set the overlay opacity, 0.0 - 1.0. Default ``0.6``.
 
-        ``attributes`` must be a table with the following fields:
+        :param number value:
 
-        ======== ===============================================================
-        Field    Description
-        ======== ===============================================================
-        points   A sequence of sequences, trail points. ie. { {1,1,1}, {2,2,2} }
-        tags     A table of attributes that can be used other methods of this
-                 list to update or remove trails with matching tags.
-                 *Note:* the table is referenced directly, not copied.
-        fadenear A number that indicates how far away from the player a trail
-                 begins to fade to transparent.
-        fadefar  A number that indicates how far away from the player a trail
-                 will become completely transparent.
-        ======== ===============================================================
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int heatmap_lua_alpha(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
 
-        :param string texturename: The name of a texture in the texture list
-            this trail list references.
-        :param table attributes: See above.
+    hm->alpha = (float)luaL_checknumber(L, 2);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: draw()
+
+        Draw the density overlay onto the (mini)map. Like the other map
+        drawing methods this may only be called during
+        :overlay:event:`draw-3d`.
 
         .. versionhistory::
             :0.1.0: Added
 */
-int trail_list_lua_add(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
+int heatmap_lua_draw(lua_State *L) {
+    heatmap_t *hm = lua_checkheatmap(L, 1);
 
-    const char *texname = luaL_checkstring(L, 2);
-    luaL_checktype(L, 3, LUA_TTABLE);
+    if (!overlay_3d->in_frame) return luaL_error(L, "draw can only be called during draw-3d");
+    if (hm->maxv<=0.f) return 0;
 
-    if (lua_getfield(L, 3,"points")!=LUA_TTABLE) return luaL_error(L, "points must be a table");
-    lua_pop(L, 1);
+    if (hm->dirty) {
+        glBindTexture(GL_TEXTURE_2D, hm->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, hm->width, hm->height, GL_RED, GL_FLOAT, hm->cells);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        hm->dirty = 0;
+    }
 
-    texture_map_texture_t *tex = texture_map_get(list->texture_map, texname);
+    glDisable(GL_CULL_FACE);
 
-    if (!tex) return luaL_error(L, "invalid texture name: %s", texname);
+    gl_shader_program_use(heatmap_program);
 
-    int texture = -1;
-    for (size_t t=0;t<list->texture_count;t++) {
-        if (strcmp(texname, list->texture_keys[t])==0) {
-            texture = (int)t;
-            break;
-        }
-    }
+    int oldvp[4] = {0};
 
-    if (texture<0) {
-        texture = (int)list->texture_count;
-        list->texture_count++;
-        list->texture_keys = egoverlay_realloc(list->texture_keys, list->texture_count * sizeof(char*));
-        list->texture_keys[texture] = egoverlay_calloc(strlen(texname)+1, sizeof(char));
-        memcpy(list->texture_keys[texture], texname, strlen(texname));
+    glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
+    glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
 
-        list->trail_counts = egoverlay_realloc(list->trail_counts, list->texture_count * sizeof(size_t));
-        list->trails = egoverlay_realloc(list->trails, list->texture_count * sizeof(trail_list_trail_t**));
-        list->trail_counts[texture] = 0;
-        list->trails[texture] = NULL;
+    if (!overlay_3d->mapfullscreen) {
+        glGetIntegerv(GL_VIEWPORT, oldvp);
+        glViewport(
+            overlay_3d->minimapleft,
+            overlay_3d->minimapbottom,
+            overlay_3d->minimapwidth,
+            overlay_3d->minimapheight
+        );
     }
 
-    list->trail_counts[texture]++;
-    list->trails[texture] = egoverlay_realloc(list->trails[texture], list->trail_counts[texture] * sizeof(trail_list_trail_t));
-
-    trail_list_trail_t *trail = list->trails[texture] + list->trail_counts[texture] - 1;
+    glUniform4f(2, hm->left, hm->top, hm->right, hm->bottom);
+    glUniform1f(3, 1.f / hm->maxv);
+    glUniform1f(4, hm->alpha);
 
-    trail->coord_count = 0;
-    trail->point_count = 0;
-    trail->points      = NULL;
-    trail->fade_near   = -1.f;
-    trail->fade_far    = -1.f;
-    trail->color.r     = 1.f;
-    trail->color.g     = 1.f;
-    trail->color.b     = 1.f;
-    trail->color.a     = 1.f;
-    trail->tags        = -1;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hm->texture);
 
-    if (lua_getfield(L, 3, "tags")!=LUA_TNIL) trail->tags = luaL_ref(L, LUA_REGISTRYINDEX);
-    else lua_pop(L, 1);
+    glBindVertexArray(overlay_3d->heatmap_vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
 
-    trail_list_trail_update(list, trail, L, 3);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    list->vbo_update = 1;
+    if (!overlay_3d->mapfullscreen) {
+        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
+    }
 
     return 0;
 }
 
 /*** RST
-    .. lua:method:: remove(tags)
+Labels
+------
 
-        Remove trails that have matching tags.
+.. lua:function:: labellist(fontpath, fontsize)
 
-        :param table tags:
-        :returns: The number of trails removed.
-        :rtype: number
+    Create a screen-space label list.
 
-        .. versionhistory::
-            :0.1.0: Added
+    Labels are text strings anchored to world positions. Each frame the
+    anchors are projected and run through a greedy collision-avoidance
+    placer (closest anchors win contested space, grid-bucketed so hundreds
+    of labels stay cheap); placed labels render through the batched UI text
+    pipeline in one draw. A label remembers its last placement slot, so
+    layouts stay temporally stable instead of jittering as the camera moves.
+
+    :param string fontpath:
+    :param integer fontsize:
+    :rtype: o3dlabellist
+
+    .. versionhistory::
+        :0.1.0: Added
 */
-int trail_list_lua_remove(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
 
-    luaL_checktype(L, 2, LUA_TTABLE);
+#define LABEL_LIST_MT "O3DLabelListMetaTable"
 
-    int nremoved = 0;
+// candidate placements around the anchor, tried in order (a label prefers
+// the slot it used last frame)
+#define LABEL_SLOTS 4
 
-    for (size_t tex=0;tex<list->texture_count;tex++) {
-        int tremoved = 0;
-        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
-            if (list->trails[tex][trail].tags<0) continue;
+// screen bucket size for placed-rect collision tests
+#define LABEL_GRID_CELL 128
+#define LABEL_GRID_CELL_MAX 16
 
-            lua_geti(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
-            int tagsind = lua_gettop(L);
+typedef struct {
+    vec3f_t pos;
+    char *text;
+    size_t text_len;
+    ui_color_t color;
 
-            if (tags_match(tagsind, L, 2)) {
-                luaL_unref(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
-                if (list->trails[tex][trail].points) egoverlay_free(list->trails[tex][trail].points);
+    int width;  // measured on first draw; -1 until then
+    int height;
 
-                for (size_t tm=trail+1;tm<list->trail_counts[tex];tm++) {
-                    trail_list_trail_t *a = &list->trails[tex][tm-1];
-                    trail_list_trail_t *b = &list->trails[tex][tm];
-                    memcpy(a, b, sizeof(trail_list_trail_t));
-                }
-                trail--;
-                tremoved++;
-                list->trail_counts[tex]--;
-            }
-            lua_pop(L, 1);
-        }
-        if (tremoved) {
-            list->trails[tex] = egoverlay_realloc(list->trails[tex], list->trail_counts[tex] * sizeof(trail_list_trail_t));
-        }
-        nremoved += tremoved;
-    }
+    int last_slot;
+} o3d_label_t;
+
+typedef struct {
+    char *font_path;
+    int font_size;
+
+    o3d_label_t *labels;
+    size_t count;
+    size_t capacity;
+} label_list_t;
+
+#define lua_checklabellist(L, ind) (label_list_t*)luaL_checkudata(L, ind, LABEL_LIST_MT)
+
+int label_list_lua_del(lua_State *L);
+int label_list_lua_add(lua_State *L);
+int label_list_lua_clear(lua_State *L);
+int label_list_lua_draw(lua_State *L);
+
+luaL_Reg label_list_funcs[] = {
+    "__gc" , &label_list_lua_del,
+    "add"  , &label_list_lua_add,
+    "clear", &label_list_lua_clear,
+    "draw" , &label_list_lua_draw,
+    NULL   , NULL
+};
 
-    if (nremoved) list->vbo_update = 1;
+int label_list_lua_new(lua_State *L) {
+    const char *fontpath = luaL_checkstring(L, 1);
+    int fontsize = (int)luaL_checkinteger(L, 2);
+
+    label_list_t *list = lua_newuserdata(L, sizeof(label_list_t));
+    memset(list, 0, sizeof(label_list_t));
+
+    list->font_path = egoverlay_calloc(strlen(fontpath)+1, sizeof(char));
+    memcpy(list->font_path, fontpath, strlen(fontpath));
+    list->font_size = fontsize;
+
+    if (luaL_newmetatable(L, LABEL_LIST_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, label_list_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
 
-    lua_pushinteger(L, nremoved);
     return 1;
 }
 
-trail_coordinate_t *trail_list_trail_calc_coords(trail_list_t *list, trail_list_trail_t *trail) {
-    trail_coordinate_t *coords = NULL;
-
-    trail->coord_count = ((trail->point_count - 1) * 2) + 2;
-    coords = egoverlay_calloc(trail->coord_count, sizeof(trail_coordinate_t));
-    
-    // in the 3D world, up is Y positive
-    vec3f_t up = { 0.f, 1.f, 0.f };
-    if (trail->wall && list->map) {
-        // unless it's a wall, then up is to the east
-        up.x = 1.f;
-        up.y = 0.f;
-        up.z = 0.f;
-    } else if (list->map) {
-        // or on the map, up is Z
-        up.x = 0.f;
-        up.y = 0.f;
-        up.z = 1.f;
+static void label_list_clear(label_list_t *list) {
+    for (size_t i=0;i<list->count;i++) {
+        egoverlay_free(list->labels[i].text);
     }
+    list->count = 0;
+}
 
-    size_t coord_ind = 0;
+int label_list_lua_del(lua_State *L) {
+    label_list_t *list = lua_checklabellist(L, 1);
 
-    for (size_t i=0; i<trail->point_count-1; i++) {
-        // each segment is made up of 2 points, p1 and p2
-        vec3f_t *p1 = &trail->points[i];
-        vec3f_t *p2 = &trail->points[i+1];
+    label_list_clear(list);
+    if (list->labels) egoverlay_free(list->labels);
+    egoverlay_free(list->font_path);
 
-        /* 
-           We calculate a,b,c,d based on the points p1 and p2
+    return 0;
+}
 
-           c<----p2----->d
-                 ^
-                 |
-                 |
-                 |
-                 |
-                 |
-           a<----p1----->b
+/*** RST
+.. lua:class:: o3dlabellist
 
-           Our 6 coords are the vertices of 2 triangles:
-            - b, a, d
-            - d, a, c
+    .. lua:method:: add(attributes)
 
-           The most efficient way of storing and drawing these triangles will
-           be a triangle strip. Each segment will use 4 vertices: b, a, d, c
-           which will be drawn in b, a, d and d, a, c order.
+        Add a label. ``attributes`` must contain ``x``, ``y``, ``z``, and
+        ``text``; ``color`` is optional (see :ref:`colors`, default
+        ``0xFFFFFFFF``).
 
-           The next segment will use d, c, e, f and so on.
-        */
-        
-        // forward is a vector from p1 to p2
-        vec3f_t forward = {0};
-        vec3f_sub_vec3f(p2, p1, &forward);
+        :param table attributes:
 
-        vec3f_t forwardn = {0};
-        vec3f_normalize(&forward, &forwardn);
-        
-        // side is a vector perpendicular to forward and up
-        vec3f_t side = {0};
-        vec3f_crossproduct(&up, &forwardn, &side);
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int label_list_lua_add(lua_State *L) {
+    label_list_t *list = lua_checklabellist(L, 1);
 
-        vec3f_t siden = {0};
-        vec3f_normalize(&side, &siden);
+    luaL_checktype(L, 2, LUA_TTABLE);
 
-        // side becomes our vector to b and d
-        // and the opposite direction is to a and c
-        vec3f_mult_f(&siden, trail->size / 2.f, &side);
+    if (list->count==list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 32;
+        list->labels = egoverlay_realloc(list->labels, list->capacity * sizeof(o3d_label_t));
+    }
 
-        // TODO: adjust points where segments meet at angles
+    o3d_label_t *label = &list->labels[list->count];
+    memset(label, 0, sizeof(o3d_label_t));
+    label->color = 0xFFFFFFFF;
+    label->width = -1;
+    label->last_slot = 0;
 
-        // if this is the first segment then calculate a and b, otherwise
-        // and c and d from the previous segment will become a and b
-        if (i==0) {
-            // b
-            vec3f_add_vec3f(p1, &side, &coords[coord_ind].position);
-            coords[coord_ind].u = 1.f;
-            coords[coord_ind].v = 0.f;
-            coord_ind++;
+    if (lua_getfield(L, 2, "x")!=LUA_TNIL) label->pos.x = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 2, "y")!=LUA_TNIL) label->pos.y = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 2, "z")!=LUA_TNIL) label->pos.z = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 2, "color")!=LUA_TNIL) label->color = (ui_color_t)lua_tointeger(L, -1);
+    lua_pop(L, 1);
 
-            // a
-            vec3f_sub_vec3f(p1, &side, &coords[coord_ind].position);
-            coords[coord_ind].u = 0.f;
-            coords[coord_ind].v = 0.f;
-            coord_ind++;
-        }
+    if (lua_getfield(L, 2, "text")!=LUA_TSTRING) {
+        return luaL_error(L, "labels require a text attribute.");
+    }
+    size_t textlen = 0;
+    const char *text = lua_tolstring(L, -1, &textlen);
+    label->text = egoverlay_calloc(textlen+1, sizeof(char));
+    memcpy(label->text, text, textlen);
+    label->text_len = textlen;
+    lua_pop(L, 1);
 
-        float section_len = vec3f_length(&forward);
-        
-        // If the segment is too long fading won't be calculated properly
-        // so insert extra points along forward.
-        // I'm not exactly sure what's going on, but I suspect it's something to
-        // do with how the z/depth isn't linear and the calculated fade distance
-        // isn't being interpolated properly when the end vertex is beyond a
-        // certain Z distance away. In any case, breaking long segments up into
-        // multiple smaller ones makes fading with fade_near/fade_far work much
-        // better on very long segments.
-        if (section_len > 5000.f && !list->map) {
-            int extrapoints = (int)floorf(section_len / 5000.f);
-            trail->coord_count += extrapoints * 2;
-            coords = egoverlay_realloc(coords, trail->coord_count * sizeof(trail_coordinate_t));
+    list->count++;
 
-            for (int ep=0; ep < extrapoints; ep++) {
-                float len = 5000.f * (ep + 1);
-                vec3f_t fp = {0}; // vector from p1 to this extra point
-                vec3f_t p = {0};  // the extra point
+    return 0;
+}
 
-                vec3f_mult_f(&forwardn, len, &fp);
-                vec3f_add_vec3f(p1, &fp, &p);
+/*** RST
+    .. lua:method:: clear()
 
-                float epv = - ( 5000.f / trail->size ) + coords[coord_ind-1].v;
+        Remove all labels.
 
-                vec3f_add_vec3f(&p, &side, &coords[coord_ind].position);
-                coords[coord_ind].u = 1.f;
-                coords[coord_ind].v = epv;
-                coord_ind++;
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int label_list_lua_clear(lua_State *L) {
+    label_list_t *list = lua_checklabellist(L, 1);
 
-                vec3f_sub_vec3f(&p, &side, &coords[coord_ind].position);
-                coords[coord_ind].u = 0.f;
-                coords[coord_ind].v = epv;
-                coord_ind++;
+    label_list_clear(list);
 
-                section_len -= 5000.f;
-            }
-        }
-        
+    return 0;
+}
 
-        float section_frac = section_len / trail->size;
+typedef struct {
+    size_t label;
+    float sx;
+    float sy;
+    float dist2;
+} label_candidate_t;
+
+static int label_candidate_cmp(const void *a, const void *b) {
+    const label_candidate_t *ca = (const label_candidate_t*)a;
+    const label_candidate_t *cb = (const label_candidate_t*)b;
+
+    if (ca->dist2 < cb->dist2) return -1;
+    if (ca->dist2 > cb->dist2) return 1;
+    return 0;
+}
+
+typedef struct {
+    float x;
+    float y;
+    float w;
+    float h;
+} label_rect_t;
+
+static int label_rects_overlap(label_rect_t *a, label_rect_t *b) {
+    return !(a->x + a->w <= b->x || b->x + b->w <= a->x ||
+             a->y + a->h <= b->y || b->y + b->h <= a->y);
+}
+
+/*** RST
+    .. lua:method:: draw()
+
+        Project, place, and draw the labels. May only be called during
+        :overlay:event:`draw-3d`. Labels whose anchors are off screen, or
+        that can't be placed without overlapping a closer label, are skipped
+        for the frame.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int label_list_lua_draw(lua_State *L) {
+    label_list_t *list = lua_checklabellist(L, 1);
+
+    if (!overlay_3d->in_frame) return luaL_error(L, "draw can only be called during draw-3d");
+    if (list->count==0) return 0;
+
+    ui_font_t *font = ui_font_get(list->font_path, list->font_size, INT_MIN, INT_MIN, INT_MIN);
+    if (!font) return 0;
+
+    int fbw = 0;
+    int fbh = 0;
+    app_get_framebuffer_size(&fbw, &fbh);
 
-        float p2v = section_frac + coords[coord_ind-1].v;
-        
-        // d
-        vec3f_add_vec3f(p2, &side, &coords[coord_ind].position);
-        coords[coord_ind].u = 1.f;
-        coords[coord_ind].v = p2v;
-        coord_ind++;
+    mat4f_t vp;
+    mat4f_mult_mat4f(overlay_3d->view, overlay_3d->proj, &vp);
 
-        // c
-        vec3f_sub_vec3f(p2, &side, &coords[coord_ind].position);
-        coords[coord_ind].u = 0.f;
-        coords[coord_ind].v = p2v;
-        coord_ind++;
-    }
+    // project anchors to screen space, nearest first
+    label_candidate_t *candidates = egoverlay_calloc(list->count, sizeof(label_candidate_t));
+    size_t ncand = 0;
 
-    return coords;
-}
+    for (size_t i=0;i<list->count;i++) {
+        o3d_label_t *label = &list->labels[i];
 
-void trail_list_update_vbo(trail_list_t *list) {
-    glBindBuffer(GL_ARRAY_BUFFER, list->vbo);
+        vec4f_t p = { label->pos.x, label->pos.y, label->pos.z, 1.f };
+        vec4f_t clip;
+        mat4f_mult_vec4f(&vp, &p, &clip);
 
-    trail_coordinate_t ***coords = egoverlay_calloc(list->texture_count, sizeof(trail_coordinate_t**));
+        if (clip.w <= 0.001f) continue;
 
-    size_t newsize = 0;
-    for (size_t tex=0;tex<list->texture_count;tex++) {
-        coords[tex] = egoverlay_calloc(list->trail_counts[tex], sizeof(trail_coordinate_t*));
+        float sx = (clip.x / clip.w * 0.5f + 0.5f) * (float)fbw;
+        float sy = (1.f - (clip.y / clip.w * 0.5f + 0.5f)) * (float)fbh;
 
-        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
-            coords[tex][trail] = trail_list_trail_calc_coords(list, &list->trails[tex][trail]);
+        if (sx < -200.f || sx > (float)fbw + 200.f || sy < -200.f || sy > (float)fbh + 200.f) continue;
 
-            newsize += list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t);
+        if (label->width<0) {
+            label->width = (int)ui_font_get_text_width(font, label->text, (int)label->text_len);
+            label->height = (int)ui_font_get_text_height(font);
         }
-    }
-    
-    if (newsize > list->vbo_size) {
-        list->vbo_size = newsize;
-        glBufferData(GL_ARRAY_BUFFER, list->vbo_size * sizeof(trail_coordinate_t), NULL, GL_STATIC_DRAW);
+
+        float dx = label->pos.x - overlay_3d->camera.x;
+        float dy = label->pos.y - overlay_3d->camera.y;
+        float dz = label->pos.z - overlay_3d->camera.z;
+
+        candidates[ncand].label = i;
+        candidates[ncand].sx = sx;
+        candidates[ncand].sy = sy;
+        candidates[ncand].dist2 = dx*dx + dy*dy + dz*dz;
+        ncand++;
     }
 
-    size_t offset = 0;
-    for (size_t tex=0;tex<list->texture_count;tex++) {
-        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
-            glBufferSubData(
-                GL_ARRAY_BUFFER,
-                offset,
-                list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t),
-                coords[tex][trail]
+    qsort(candidates, ncand, sizeof(label_candidate_t), &label_candidate_cmp);
+
+    // greedy placement, closest anchors first, against a screen bucket grid
+    int gridw = fbw / LABEL_GRID_CELL + 2;
+    int gridh = fbh / LABEL_GRID_CELL + 2;
+
+    label_rect_t *placed = egoverlay_calloc(ncand, sizeof(label_rect_t));
+    size_t nplaced = 0;
+
+    uint32_t *cells = egoverlay_calloc((size_t)gridw * gridh * LABEL_GRID_CELL_MAX, sizeof(uint32_t));
+    uint8_t *cell_counts = egoverlay_calloc((size_t)gridw * gridh, sizeof(uint8_t));
+
+    mat4f_t proj;
+    mat4f_ortho(&proj, 0.f, (float)fbw, 0.f, (float)fbh, -1.f, 1.f);
+
+    // auto-degradation tier 1 drops the collision pass: every label places
+    // at its preferred slot without overlap tests
+    int skip_collision = app_degradation_level()>=1;
+
+    for (size_t c=0;c<ncand;c++) {
+        o3d_label_t *label = &list->labels[candidates[c].label];
+
+        for (int try=0;try<LABEL_SLOTS;try++) {
+            int slot = (label->last_slot + try) % LABEL_SLOTS;
+
+            label_rect_t rect;
+            rect.w = (float)label->width + 4.f;
+            rect.h = (float)label->height + 2.f;
+
+            switch (slot) {
+            case 0: // right of the anchor
+                rect.x = candidates[c].sx + 8.f;
+                rect.y = candidates[c].sy - rect.h / 2.f;
+                break;
+            case 1: // above
+                rect.x = candidates[c].sx - rect.w / 2.f;
+                rect.y = candidates[c].sy - 12.f - rect.h;
+                break;
+            case 2: // below
+                rect.x = candidates[c].sx - rect.w / 2.f;
+                rect.y = candidates[c].sy + 12.f;
+                break;
+            default: // left
+                rect.x = candidates[c].sx - 8.f - rect.w;
+                rect.y = candidates[c].sy - rect.h / 2.f;
+                break;
+            }
+
+            // test against placed rects in the overlapped buckets
+            int cx0 = (int)(rect.x / LABEL_GRID_CELL);
+            int cy0 = (int)(rect.y / LABEL_GRID_CELL);
+            int cx1 = (int)((rect.x + rect.w) / LABEL_GRID_CELL);
+            int cy1 = (int)((rect.y + rect.h) / LABEL_GRID_CELL);
+
+            if (cx0<0) cx0 = 0;
+            if (cy0<0) cy0 = 0;
+            if (cx1>=gridw) cx1 = gridw - 1;
+            if (cy1>=gridh) cy1 = gridh - 1;
+
+            int blocked = 0;
+            if (!skip_collision) {
+                for (int gy=cy0;gy<=cy1 && !blocked;gy++) {
+                    for (int gx=cx0;gx<=cx1 && !blocked;gx++) {
+                        size_t cell = (size_t)gy * gridw + gx;
+                        for (uint8_t e=0;e<cell_counts[cell];e++) {
+                            if (label_rects_overlap(&rect, &placed[cells[cell * LABEL_GRID_CELL_MAX + e]])) {
+                                blocked = 1;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (blocked) continue;
+
+            // place it: record the rect in every overlapped bucket and draw
+            placed[nplaced] = rect;
+            for (int gy=cy0;gy<=cy1;gy++) {
+                for (int gx=cx0;gx<=cx1;gx++) {
+                    size_t cell = (size_t)gy * gridw + gx;
+                    if (cell_counts[cell]<LABEL_GRID_CELL_MAX) {
+                        cells[cell * LABEL_GRID_CELL_MAX + cell_counts[cell]] = (uint32_t)nplaced;
+                        cell_counts[cell]++;
+                    }
+                }
+            }
+            nplaced++;
+
+            label->last_slot = slot;
+
+            ui_font_render_text(
+                font, &proj,
+                (int)(rect.x + 2.f), (int)(rect.y + 1.f),
+                label->text, label->text_len,
+                label->color
             );
-            offset += list->trails[tex][trail].coord_count * sizeof(trail_coordinate_t);
-            egoverlay_free(coords[tex][trail]);
+
+            break;
         }
-        egoverlay_free(coords[tex]);
     }
 
-    egoverlay_free(coords);
+    ui_font_flush();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);    
+    egoverlay_free(candidates);
+    egoverlay_free(placed);
+    egoverlay_free(cells);
+    egoverlay_free(cell_counts);
 
-    list->vbo_update = 0;
+    return 0;
 }
 
 /*** RST
-    .. lua:method:: draw()
-    
-        Draw all of the trails in this list.
+Meshes
+------
 
-        .. important::
-            This method can only be called during :overlay:event:`draw-3d`. Attempts
-            to call it at any other time will result in an error.
+.. lua:function:: meshlist()
 
-        .. versionhistory::
-            :0.1.0: Added
+    Create an instanced 3D mesh list.
+
+    A mesh list draws volumetric markers (zone boxes, domes, direction
+    arrows) from a handful of built-in unit meshes, one instanced draw per
+    mesh kind. Instances carry a position, per-axis scale, euler rotation,
+    and color, so a dome over an event area is one instance instead of the
+    dozens of sprites it takes to fake a volume today.
+
+    :rtype: o3dmeshlist
+
+    .. code-block:: lua
+        :caption: Example
+
+        local meshes = o3d.meshlist()
+
+        meshes:add('dome', { x = cx, y = cy, z = cz, scale = 600, color = 0x00FF0040 })
+
+        -- during draw-3d
+        meshes:draw()
+
+    .. versionhistory::
+        :0.1.0: Added
 */
-int trail_list_lua_draw(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
 
-    if (!overlay_3d->in_frame) return luaL_error(L, "not in a frame");
+#define MESH_LIST_MT "O3DMeshListMetaTable"
 
-    if (list->vbo_update) trail_list_update_vbo(list);
-    
-    glDisable(GL_CULL_FACE);
+typedef struct {
+    vec3f_t position;
+    vec3f_t scale;
+    vec3f_t rotation;
+    struct {
+        float r;
+        float g;
+        float b;
+        float a;
+    } color;
+} mesh_instance_t;
 
-    gl_shader_program_use(overlay_3d->trail_program);
+enum {
+    MESH_KIND_BOX = 0,
+    MESH_KIND_DOME,
+    MESH_KIND_ARROW,
+    MESH_KIND_COUNT
+};
 
-    glActiveTexture(GL_TEXTURE0);
+// one shared vertex buffer holds the built-in meshes back to back;
+// interleaved position + normal
+typedef struct {
+    float px, py, pz;
+    float nx, ny, nz;
+} mesh_vertex_t;
 
-    // set general uniforms
+static GLint mesh_firsts[MESH_KIND_COUNT];
+static GLsizei mesh_counts[MESH_KIND_COUNT];
 
-    int oldvp[4] = {0};
+typedef struct {
+    GLuint vao;
+    GLuint instance_vbo;
+    size_t instance_vbo_size;
+
+    mesh_instance_t *instances[MESH_KIND_COUNT];
+    size_t counts[MESH_KIND_COUNT];
+    size_t capacities[MESH_KIND_COUNT];
+
+    int dirty;
+} mesh_list_t;
+
+#define lua_checkmeshlist(L, ind) (mesh_list_t*)luaL_checkudata(L, ind, MESH_LIST_MT)
+
+// append a triangle with a flat face normal
+static size_t mesh_tri(mesh_vertex_t *v, size_t n, vec3f_t a, vec3f_t b, vec3f_t c) {
+    vec3f_t ab = { b.x - a.x, b.y - a.y, b.z - a.z };
+    vec3f_t ac = { c.x - a.x, c.y - a.y, c.z - a.z };
+    vec3f_t norm = {
+        ab.y * ac.z - ab.z * ac.y,
+        ab.z * ac.x - ab.x * ac.z,
+        ab.x * ac.y - ab.y * ac.x
+    };
+    float len = sqrtf(norm.x*norm.x + norm.y*norm.y + norm.z*norm.z);
+    if (len > 0.f) {
+        norm.x /= len;
+        norm.y /= len;
+        norm.z /= len;
+    }
 
-    if (list->map) {
-        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_view);
-        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)&overlay_3d->map_proj);
+    vec3f_t pts[3] = { a, b, c };
+    for (int i=0;i<3;i++) {
+        v[n].px = pts[i].x;
+        v[n].py = pts[i].y;
+        v[n].pz = pts[i].z;
+        v[n].nx = norm.x;
+        v[n].ny = norm.y;
+        v[n].nz = norm.z;
+        n++;
+    }
 
-        if (!overlay_3d->mapfullscreen) {
-            int fbw, fbh;
-            app_get_framebuffer_size(&fbw, &fbh);
+    return n;
+}
 
-            glGetIntegerv(GL_VIEWPORT, oldvp);
-            glViewport(
-                overlay_3d->minimapleft,
-                overlay_3d->minimapbottom,
-                overlay_3d->minimapwidth,
-                overlay_3d->minimapheight
-            );
+static size_t mesh_quad(mesh_vertex_t *v, size_t n, vec3f_t a, vec3f_t b, vec3f_t c, vec3f_t d) {
+    n = mesh_tri(v, n, a, b, c);
+    n = mesh_tri(v, n, a, c, d);
+    return n;
+}
+
+#define MESH_DOME_SEGS  16
+#define MESH_DOME_RINGS 8
+
+#define MESH_PI 3.14159265358979f
+
+// Build the built-in unit meshes into one static vertex buffer. box: 1x1x1
+// centered on the origin. dome: radius 0.5 hemisphere, flat side down.
+// arrow: shaft plus head pointing along +z, length 1 centered on the origin.
+static void mesh_build_builtins() {
+    // box 12, dome rings*segs*2, arrow shaft 12 + head segs*2
+    size_t maxtris = 12 + MESH_DOME_RINGS * MESH_DOME_SEGS * 2 + 12 + MESH_DOME_SEGS * 2;
+    mesh_vertex_t *verts = egoverlay_calloc(maxtris * 3, sizeof(mesh_vertex_t));
+    size_t n = 0;
+
+    // box
+    mesh_firsts[MESH_KIND_BOX] = (GLint)n;
+    {
+        float h = 0.5f;
+        vec3f_t p[8] = {
+            {-h,-h,-h}, { h,-h,-h}, { h, h,-h}, {-h, h,-h},
+            {-h,-h, h}, { h,-h, h}, { h, h, h}, {-h, h, h}
+        };
+        n = mesh_quad(verts, n, p[0], p[3], p[2], p[1]); // -z
+        n = mesh_quad(verts, n, p[4], p[5], p[6], p[7]); // +z
+        n = mesh_quad(verts, n, p[0], p[1], p[5], p[4]); // -y
+        n = mesh_quad(verts, n, p[3], p[7], p[6], p[2]); // +y
+        n = mesh_quad(verts, n, p[0], p[4], p[7], p[3]); // -x
+        n = mesh_quad(verts, n, p[1], p[2], p[6], p[5]); // +x
+    }
+    mesh_counts[MESH_KIND_BOX] = (GLsizei)(n - mesh_firsts[MESH_KIND_BOX]);
+
+    // dome
+    mesh_firsts[MESH_KIND_DOME] = (GLint)n;
+    for (int ring=0;ring<MESH_DOME_RINGS;ring++) {
+        float t0 = (float)ring / MESH_DOME_RINGS * (MESH_PI / 2.f);
+        float t1 = (float)(ring + 1) / MESH_DOME_RINGS * (MESH_PI / 2.f);
+
+        for (int seg=0;seg<MESH_DOME_SEGS;seg++) {
+            float a0 = (float)seg / MESH_DOME_SEGS * 2.f * MESH_PI;
+            float a1 = (float)(seg + 1) / MESH_DOME_SEGS * 2.f * MESH_PI;
+
+            vec3f_t p00 = { 0.5f * cosf(t0) * cosf(a0), 0.5f * sinf(t0), 0.5f * cosf(t0) * sinf(a0) };
+            vec3f_t p01 = { 0.5f * cosf(t0) * cosf(a1), 0.5f * sinf(t0), 0.5f * cosf(t0) * sinf(a1) };
+            vec3f_t p10 = { 0.5f * cosf(t1) * cosf(a0), 0.5f * sinf(t1), 0.5f * cosf(t1) * sinf(a0) };
+            vec3f_t p11 = { 0.5f * cosf(t1) * cosf(a1), 0.5f * sinf(t1), 0.5f * cosf(t1) * sinf(a1) };
+
+            n = mesh_tri(verts, n, p00, p10, p01);
+            if (ring < MESH_DOME_RINGS - 1) {
+                n = mesh_tri(verts, n, p01, p10, p11);
+            }
+        }
+    }
+    mesh_counts[MESH_KIND_DOME] = (GLsizei)(n - mesh_firsts[MESH_KIND_DOME]);
+
+    // arrow
+    mesh_firsts[MESH_KIND_ARROW] = (GLint)n;
+    {
+        float s = 0.08f; // shaft half width
+        vec3f_t p[8] = {
+            {-s,-s,-0.5f}, { s,-s,-0.5f}, { s, s,-0.5f}, {-s, s,-0.5f},
+            {-s,-s, 0.1f}, { s,-s, 0.1f}, { s, s, 0.1f}, {-s, s, 0.1f}
+        };
+        n = mesh_quad(verts, n, p[0], p[3], p[2], p[1]);
+        n = mesh_quad(verts, n, p[0], p[1], p[5], p[4]);
+        n = mesh_quad(verts, n, p[3], p[7], p[6], p[2]);
+        n = mesh_quad(verts, n, p[0], p[4], p[7], p[3]);
+        n = mesh_quad(verts, n, p[1], p[2], p[6], p[5]);
+
+        vec3f_t tip = { 0.f, 0.f, 0.5f };
+        float r = 0.22f;
+        for (int seg=0;seg<MESH_DOME_SEGS;seg++) {
+            float a0 = (float)seg / MESH_DOME_SEGS * 2.f * MESH_PI;
+            float a1 = (float)(seg + 1) / MESH_DOME_SEGS * 2.f * MESH_PI;
+
+            vec3f_t b0 = { r * cosf(a0), r * sinf(a0), 0.1f };
+            vec3f_t b1 = { r * cosf(a1), r * sinf(a1), 0.1f };
+            vec3f_t center = { 0.f, 0.f, 0.1f };
+
+            n = mesh_tri(verts, n, b0, b1, tip);   // cone side
+            n = mesh_tri(verts, n, b1, b0, center); // base cap
         }
-    } else {
-        glUniformMatrix4fv(0, 1, GL_FALSE, (GLfloat*)overlay_3d->view);
-        glUniformMatrix4fv(1, 1, GL_FALSE, (GLfloat*)overlay_3d->proj);
     }
+    mesh_counts[MESH_KIND_ARROW] = (GLsizei)(n - mesh_firsts[MESH_KIND_ARROW]);
 
-    glUniform1f(5, (GLfloat)overlay_3d->minimapleft);
-    glUniform1f(6, (GLfloat)overlay_3d->minimapbottom);
-    glUniform1f(7, (GLfloat)overlay_3d->minimapheight);
-    glUniform1ui(8, (GLuint)list->map);
-    glUniform3fv(9, 1, (GLfloat*)&overlay_3d->player_pos);
-    glUniform3fv(10, 1, (GLfloat*)&overlay_3d->camera);
+    glGenBuffers(1, &mesh_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
+    glBufferData(GL_ARRAY_BUFFER, n * sizeof(mesh_vertex_t), verts, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    egoverlay_free(verts);
+}
+
+int mesh_list_lua_del(lua_State *L);
+int mesh_list_lua_add(lua_State *L);
+int mesh_list_lua_clear(lua_State *L);
+int mesh_list_lua_draw(lua_State *L);
+
+luaL_Reg mesh_list_funcs[] = {
+    "__gc" , &mesh_list_lua_del,
+    "add"  , &mesh_list_lua_add,
+    "clear", &mesh_list_lua_clear,
+    "draw" , &mesh_list_lua_draw,
+    NULL   , NULL
+};
+
+int mesh_list_lua_new(lua_State *L) {
+    if (!mesh_program) {
+        mesh_program = gl_shader_program_new_with_sources(mesh_srcs);
+        mesh_build_builtins();
+    }
+
+    mesh_list_t *list = lua_newuserdata(L, sizeof(mesh_list_t));
+    memset(list, 0, sizeof(mesh_list_t));
+
+    glGenVertexArrays(1, &list->vao);
+    glGenBuffers(1, &list->instance_vbo);
 
     glBindVertexArray(list->vao);
 
-    size_t first = 0;
-    for (size_t tex=0;tex<list->texture_count;tex++) {
-        if (list->trail_counts[tex]==0) continue;
+    glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
+    VERT_ATTRIB_VEC3(0, 0, mesh_vertex_t, px);
+    VERT_ATTRIB_VEC3(1, 0, mesh_vertex_t, nx);
 
-        texture_map_texture_t *gltex = texture_map_get(list->texture_map, list->texture_keys[tex]);
+    glBindBuffer(GL_ARRAY_BUFFER, list->instance_vbo);
+    VERT_ATTRIB_VEC3(3, 1, mesh_instance_t, position);
+    VERT_ATTRIB_VEC3(4, 1, mesh_instance_t, scale   );
+    VERT_ATTRIB_VEC3(5, 1, mesh_instance_t, rotation);
+    VERT_ATTRIB_VEC4(6, 1, mesh_instance_t, color   );
 
-        glBindTexture(GL_TEXTURE_2D, gltex->texture);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
 
-        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
-            glUniform1f(2, list->trails[tex][trail].fade_near);
-            glUniform1f(3, list->trails[tex][trail].fade_far);
-            glUniform4fv(4, 1, (GLfloat*)&list->trails[tex][trail].color);
+    if (luaL_newmetatable(L, MESH_LIST_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, mesh_list_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
 
-            glDrawArrays(GL_TRIANGLE_STRIP, (GLint)first, (GLsizei)list->trails[tex][trail].coord_count);
-            first += list->trails[tex][trail].coord_count;
-        }
+    return 1;
+}
+
+int mesh_list_lua_del(lua_State *L) {
+    mesh_list_t *list = lua_checkmeshlist(L, 1);
+
+    for (int k=0;k<MESH_KIND_COUNT;k++) {
+        if (list->instances[k]) egoverlay_free(list->instances[k]);
     }
 
-    if (list->map && !overlay_3d->mapfullscreen) {
-        glViewport(oldvp[0], oldvp[1], oldvp[2], oldvp[3]);
+    glDeleteBuffers(1, &list->instance_vbo);
+    glDeleteVertexArrays(1, &list->vao);
+
+    return 0;
+}
+
+static int mesh_kind_from_name(lua_State *L, const char *name) {
+    if (strcmp(name, "box"  )==0) return MESH_KIND_BOX;
+    if (strcmp(name, "dome" )==0) return MESH_KIND_DOME;
+    if (strcmp(name, "arrow")==0) return MESH_KIND_ARROW;
+
+    return luaL_error(L, "unknown mesh '%s'; expected 'box', 'dome', or 'arrow'", name);
+}
+
+/*** RST
+.. lua:class:: o3dmeshlist
+
+    .. lua:method:: add(mesh, attributes)
+
+        Add an instance of a built-in mesh: ``'box'`` (unit cube), ``'dome'``
+        (hemisphere, flat side down), or ``'arrow'`` (pointing along +z
+        before rotation).
+
+        ``attributes``:
+
+        ========= ==============================================================
+        Field     Description
+        ========= ==============================================================
+        x         Position, default ``0.0``.
+        y         Position, default ``0.0``.
+        z         Position, default ``0.0``.
+        scale     A number (uniform) or a sequence of 3 numbers, in map
+                  units. A scale of 100 draws a unit mesh 100 units across.
+                  Default ``1``.
+        rotation  A sequence of 3 euler angles in degrees, applied like
+                  sprite rotation. Default none.
+        color     Color and opacity, see :ref:`colors`. Default
+                  ``0xFFFFFF66``.
+        ========= ==============================================================
+
+        :param string mesh:
+        :param table attributes:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int mesh_list_lua_add(lua_State *L) {
+    mesh_list_t *list = lua_checkmeshlist(L, 1);
+    const char *meshname = luaL_checkstring(L, 2);
+
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    int kind = mesh_kind_from_name(L, meshname);
+
+    if (list->counts[kind]==list->capacities[kind]) {
+        list->capacities[kind] = list->capacities[kind] ? list->capacities[kind] * 2 : 16;
+        list->instances[kind] = egoverlay_realloc(
+            list->instances[kind],
+            list->capacities[kind] * sizeof(mesh_instance_t)
+        );
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    mesh_instance_t *inst = &list->instances[kind][list->counts[kind]];
+    memset(inst, 0, sizeof(mesh_instance_t));
+    inst->scale.x = 1.f;
+    inst->scale.y = 1.f;
+    inst->scale.z = 1.f;
+    inst->color.r = 1.f;
+    inst->color.g = 1.f;
+    inst->color.b = 1.f;
+    inst->color.a = 0.4f;
+
+    if (lua_getfield(L, 3, "x")!=LUA_TNIL) inst->position.x = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 3, "y")!=LUA_TNIL) inst->position.y = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (lua_getfield(L, 3, "z")!=LUA_TNIL) inst->position.z = (float)lua_tonumber(L, -1);
+    lua_pop(L, 1);
 
-    glBindVertexArray(0);
+    int scaletype = lua_getfield(L, 3, "scale");
+    if (scaletype==LUA_TNUMBER) {
+        float s = (float)lua_tonumber(L, -1);
+        inst->scale.x = s;
+        inst->scale.y = s;
+        inst->scale.z = s;
+    } else if (scaletype==LUA_TTABLE) {
+        lua_geti(L, -1, 1); inst->scale.x = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+        lua_geti(L, -1, 2); inst->scale.y = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+        lua_geti(L, -1, 3); inst->scale.z = (float)lua_tonumber(L, -1); lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
 
-    glUseProgram(0);
+    if (lua_getfield(L, 3, "rotation")!=LUA_TNIL) {
+        lua_geti(L, -1, 1); inst->rotation.x = deg2rad((float)lua_tonumber(L, -1)); lua_pop(L, 1);
+        lua_geti(L, -1, 2); inst->rotation.y = deg2rad((float)lua_tonumber(L, -1)); lua_pop(L, 1);
+        lua_geti(L, -1, 3); inst->rotation.z = deg2rad((float)lua_tonumber(L, -1)); lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
 
-    glEnable(GL_CULL_FACE);
+    if (lua_getfield(L, 3, "color")!=LUA_TNIL) {
+        ui_color_t color = (ui_color_t)lua_tointeger(L, -1);
+        inst->color.r = UI_COLOR_R(color);
+        inst->color.g = UI_COLOR_G(color);
+        inst->color.b = UI_COLOR_B(color);
+        inst->color.a = UI_COLOR_A(color);
+    }
+    lua_pop(L, 1);
+
+    list->counts[kind]++;
+    list->dirty = 1;
 
     return 0;
 }
 
 /*** RST
-    .. lua:method:: update(tags, attributes)
+    .. lua:method:: clear()
 
-        Update attributes of trails with matching tags.
+        Remove all instances.
 
-        :param table tags:
-        :param table attributes:
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int mesh_list_lua_clear(lua_State *L) {
+    mesh_list_t *list = lua_checkmeshlist(L, 1);
 
-        :returns: The number of trails updated
-        :rtype: integer
+    for (int k=0;k<MESH_KIND_COUNT;k++) {
+        list->counts[k] = 0;
+    }
+    list->dirty = 1;
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: draw()
+
+        Draw all instances: one instanced draw per mesh kind. May only be
+        called during :overlay:event:`draw-3d`.
 
         .. versionhistory::
             :0.1.0: Added
 */
-int trail_list_lua_update(lua_State *L) {
-    trail_list_t *list = lua_checktraillist(L, 1);
+int mesh_list_lua_draw(lua_State *L) {
+    mesh_list_t *list = lua_checkmeshlist(L, 1);
 
-    luaL_checktype(L, 2, LUA_TTABLE);
-    luaL_checktype(L, 3, LUA_TTABLE);
+    if (!overlay_3d->in_frame) return luaL_error(L, "draw can only be called during draw-3d");
 
-    int nupdated = 0;
+    size_t total = 0;
+    for (int k=0;k<MESH_KIND_COUNT;k++) total += list->counts[k];
+    if (total==0) return 0;
 
-    for (size_t tex=0;tex<list->texture_count;tex++) {
-        int tupdated = 0;
-        for (size_t trail=0;trail<list->trail_counts[tex];trail++) {
-            if (list->trails[tex][trail].tags<0) continue;
+    if (list->dirty) {
+        // pack the per-kind instance arrays back to back and re-upload
+        glBindBuffer(GL_ARRAY_BUFFER, list->instance_vbo);
 
-            lua_geti(L, LUA_REGISTRYINDEX, list->trails[tex][trail].tags);
-            int tagsind = lua_gettop(L);
+        if (total * sizeof(mesh_instance_t) > list->instance_vbo_size) {
+            list->instance_vbo_size = total * sizeof(mesh_instance_t);
+            glBufferData(GL_ARRAY_BUFFER, list->instance_vbo_size, NULL, GL_DYNAMIC_DRAW);
+        }
 
-            if (tags_match(tagsind, L, 2)) {
-                trail_list_trail_update(list, &list->trails[tex][trail], L, 3);
-                tupdated++;
-            }
-            lua_pop(L, 1);
+        size_t offset = 0;
+        for (int k=0;k<MESH_KIND_COUNT;k++) {
+            if (!list->counts[k]) continue;
+            glBufferSubData(
+                GL_ARRAY_BUFFER,
+                offset * sizeof(mesh_instance_t),
+                list->counts[k] * sizeof(mesh_instance_t),
+                list->instances[k]
+            );
+            offset += list->counts[k];
         }
-        nupdated += tupdated;
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        list->dirty = 0;
     }
 
-    if (nupdated) list->vbo_update = 1;
+    glDisable(GL_CULL_FACE);
 
-    lua_pushinteger(L, nupdated);
-    return 1;
-}
+    gl_shader_program_use(mesh_program);
+    glBindVertexArray(list->vao);
 
+    GLuint base = 0;
+    for (int k=0;k<MESH_KIND_COUNT;k++) {
+        if (!list->counts[k]) continue;
+
+        glDrawArraysInstancedBaseInstance(
+            GL_TRIANGLES,
+            mesh_firsts[k],
+            mesh_counts[k],
+            (GLsizei)list->counts[k],
+            base
+        );
+        profiler_count_draw(1, (int)list->counts[k]);
+
+        base += (GLuint)list->counts[k];
+    }
+
+    glBindVertexArray(0);
+
+    return 0;
+}
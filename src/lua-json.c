@@ -15,7 +15,10 @@ serialization. It is a thin wrapper of the Jansson library.
 #include "lua-json.h"
 #include <lauxlib.h>
 #include "lua-manager.h"
+#include "utils.h"
 #include <string.h>
+#include <stdio.h>
+#include <windows.h>
 #include "logging/logger.h"
 
 int json_lua_open_module(lua_State *L);
@@ -26,7 +29,10 @@ void json_lua_init() {
 
 // module functions
 int json_lua_mod_loads(lua_State *L);
+int json_lua_mod_parse(lua_State *L);
+int json_lua_mod_compile(lua_State *L);
 int json_lua_mod_dumps(lua_State *L);
+int json_lua_mod_dumpfile(lua_State *L);
 int json_lua_mod_JSON_INDENT(lua_State *L);
 int json_lua_mod_JSON_REAL_PRECISION(lua_State *L);
 int json_lua_mod_array(lua_State *L);
@@ -34,7 +40,10 @@ int json_lua_mod_object(lua_State *L);
 
 luaL_Reg json_mod_funcs[] = {
     "loads"              , &json_lua_mod_loads,
+    "parse"              , &json_lua_mod_parse,
+    "compile"            , &json_lua_mod_compile,
     "dumps"              , &json_lua_mod_dumps,
+    "dumpfile"           , &json_lua_mod_dumpfile,
     "array"              , &json_lua_mod_array,
     "object"             , &json_lua_mod_object,
     "JSON_INDENT"        , &json_lua_mod_JSON_INDENT,
@@ -263,6 +272,69 @@ int json_lua_mod_dumps(lua_State *L) {
     return 1;    
 }
 
+static int json_lua_dump_file_cb(const char *buffer, size_t size, void *data) {
+    return fwrite(buffer, 1, size, (FILE*)data)==size ? 0 : -1;
+}
+
+/*** RST
+    .. lua:function:: dumpfile(value, path[, flags])
+
+        Serialize ``value`` straight to ``path``.
+
+        Unlike :lua:func:`dumps`, the document streams through a buffered
+        writer instead of materializing the full string in memory first, so
+        multi-MB documents serialize with bounded memory. The file is
+        written to a temp path and renamed into place, so a crash mid-write
+        can't leave a truncated document.
+
+        :param value: A JSON value.
+        :param string path:
+        :param integer flags: (Optional) The same flags :lua:func:`dumps`
+            accepts.
+        :returns: ``true`` on success.
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int json_lua_mod_dumpfile(lua_State *L) {
+    json_t *json = lua_checkjson(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+    int flags = (int)luaL_optinteger(L, 3, 0);
+
+    size_t tmplen = strlen(path) + 5;
+    char *tmppath = egoverlay_calloc(tmplen, sizeof(char));
+    snprintf(tmppath, tmplen, "%s.tmp", path);
+
+    FILE *f = fopen(tmppath, "wb");
+    if (!f) {
+        egoverlay_free(tmppath);
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    // a large stdio buffer keeps the callback from degenerating into tiny
+    // writes; jansson calls it per token
+    setvbuf(f, NULL, _IOFBF, 64 * 1024);
+
+    int r = json_dump_callback(json, &json_lua_dump_file_cb, f, flags);
+
+    fflush(f);
+    fclose(f);
+
+    if (r==0) {
+        if (!MoveFileEx(tmppath, path, MOVEFILE_REPLACE_EXISTING)) r = -1;
+    } else {
+        remove(tmppath);
+    }
+
+    egoverlay_free(tmppath);
+
+    lua_pushboolean(L, r==0);
+
+    return 1;
+}
+
 /*** RST
     .. lua:function:: array()
 
@@ -384,6 +456,8 @@ int json_lua_len(lua_State *L);
 int json_lua_pairs(lua_State *L);
 int json_lua_next(lua_State *L);
 
+int json_lua_totable(lua_State *L);
+
 luaL_Reg json_funcs[] = {
     "__gc"      , &json_lua_del,
     "__index"   , &json_lua_index,
@@ -416,7 +490,13 @@ void lua_pushjson(lua_State *L, json_t *json) {
     json_incref(json);
 }
 
-json_t *lua_tojson(lua_State *L, int index) {
+#define LUA_TOJSON_MAX_DEPTH 64
+
+// Recursive conversion core. Errors return NULL with *err set instead of
+// raising, so partially built containers can be released on the way out;
+// lua_tojson raises once at the top. path[] holds the table pointers of the
+// current ancestry for cycle detection.
+static json_t *lua_tojson_rec(lua_State *L, int index, const void **path, int depth, const char **err) {
     switch(lua_type(L, index)) {
     case LUA_TUSERDATA: return json_deep_copy(lua_checkjson(L, index));
     case LUA_TNUMBER:   
@@ -427,13 +507,99 @@ json_t *lua_tojson(lua_State *L, int index) {
     case LUA_TSTRING: {
         const char *val = lua_tostring(L, index);
         return json_string(val);
-    }   
+    }
+    case LUA_TTABLE: {
+        index = lua_absindex(L, index);
+
+        const void *ptr = lua_topointer(L, index);
+        for (int i=0;i<depth;i++) {
+            if (path[i]==ptr) {
+                *err = "table contains a cycle";
+                return NULL;
+            }
+        }
+        if (depth==LUA_TOJSON_MAX_DEPTH) {
+            *err = "table nesting too deep";
+            return NULL;
+        }
+        path[depth] = ptr;
+
+        // a sequence (keys exactly 1..n) becomes an array, anything else an
+        // object
+        lua_Integer n = (lua_Integer)lua_rawlen(L, index);
+        lua_Integer total = 0;
+
+        lua_pushnil(L);
+        while (lua_next(L, index)) {
+            total++;
+            lua_pop(L, 1);
+        }
+
+        if (n==total) {
+            json_t *arr = json_array();
+
+            for (lua_Integer i=1;i<=n;i++) {
+                lua_geti(L, index, i);
+                json_t *item = lua_tojson_rec(L, lua_gettop(L), path, depth + 1, err);
+                lua_pop(L, 1);
+
+                if (!item) {
+                    json_decref(arr);
+                    return NULL;
+                }
+                json_array_append_new(arr, item);
+            }
+
+            return arr;
+        }
+
+        json_t *obj = json_object();
+
+        lua_pushnil(L);
+        while (lua_next(L, index)) {
+            // stringify a copy of the key: lua_tostring on the key itself
+            // would corrupt lua_next for number keys
+            lua_pushvalue(L, -2);
+            const char *key = lua_tostring(L, -1);
+
+            json_t *val = key ? lua_tojson_rec(L, lua_gettop(L) - 1, path, depth + 1, err) : NULL;
+
+            if (!key) *err = "table key can't be converted to a string";
+
+            lua_pop(L, 2); // the key copy and the value
+
+            if (!val) {
+                json_decref(obj);
+                // the live key still on the stack keeps lua_next state; pop it
+                lua_pop(L, 1);
+                return NULL;
+            }
+
+            json_object_set_new(obj, key, val);
+        }
+
+        return obj;
+    }
     default:
-        luaL_error(L, "Lua type incompatible with JSON types.");
+        *err = "Lua type incompatible with JSON types.";
         return NULL;
     }
 }
 
+json_t *lua_tojson(lua_State *L, int index) {
+    const void *path[LUA_TOJSON_MAX_DEPTH];
+    const char *err = NULL;
+
+    json_t *value = lua_tojson_rec(L, index, path, 0, &err);
+
+    if (!value) {
+        luaL_error(L, "%s", err ? err : "Lua type incompatible with JSON types.");
+        return NULL;
+    }
+
+    return value;
+}
+
 json_t *lua_checkjson(lua_State *L, int index) {
     return *(json_t**)luaL_checkudata(L, index, "jansson.json");
 }
@@ -449,6 +615,17 @@ int json_lua_del(lua_State *L) {
 int json_lua_index(lua_State *L) {
     json_t *json = lua_checkjson(L, 1);
 
+    // indexing goes straight at the json data, so methods have to be
+    // resolved here. data wins if an object actually has a 'totable' key
+    if (lua_type(L, 2)==LUA_TSTRING) {
+        const char *mkey = lua_tostring(L, 2);
+
+        if (strcmp(mkey, "totable")==0 && (!json_is_object(json) || !json_object_get(json, mkey))) {
+            lua_pushcfunction(L, &json_lua_totable);
+            return 1;
+        }
+    }
+
     if (json_is_array(json)) {
         int ind = (int)luaL_checkinteger(L, 2);
         ind--; // lua indexes start at 1, we start at 0
@@ -555,7 +732,7 @@ int json_lua_next(lua_State *L) {
 
             if (key) {
                 val = json_object_iter_value(json_object_key_to_iter(key));
-                lua_pushstring(L, key);
+                lua_manager_push_interned(L, key, strlen(key));
                 lua_pushjson(L, val);
                 return 2;
             } else {
@@ -568,7 +745,7 @@ int json_lua_next(lua_State *L) {
         int nextkey = 0;
         json_object_foreach(json, key, val) {
             if (nextkey) {
-                lua_pushstring(L, key);
+                lua_manager_push_interned(L, key, strlen(key));
                 lua_pushjson(L, val);
                 return 2;
             }
@@ -583,3 +760,646 @@ int json_lua_next(lua_State *L) {
 
     return 0;
 }
+
+// Eagerly convert a json value to plain Lua values: containers become
+// presized tables, object keys go through the shared intern cache. One
+// recursive pass instead of thousands of per-access userdata round trips.
+static void json_push_table(lua_State *L, json_t *json) {
+    luaL_checkstack(L, 4, "json");
+
+    switch (json_typeof(json)) {
+    case JSON_TRUE   : lua_pushboolean(L, 1); return;
+    case JSON_FALSE  : lua_pushboolean(L, 0); return;
+    case JSON_NULL   : lua_pushnil(L); return;
+    case JSON_INTEGER: lua_pushinteger(L, json_integer_value(json)); return;
+    case JSON_REAL   : lua_pushnumber(L, json_real_value(json)); return;
+    case JSON_STRING : lua_pushlstring(L, json_string_value(json), json_string_length(json)); return;
+    default: break;
+    }
+
+    if (json_is_array(json)) {
+        size_t n = json_array_size(json);
+        lua_createtable(L, (int)n, 0);
+
+        for (size_t i=0;i<n;i++) {
+            json_push_table(L, json_array_get(json, i));
+            lua_seti(L, -2, (lua_Integer)i + 1);
+        }
+
+        return;
+    }
+
+    // object
+    lua_createtable(L, 0, (int)json_object_size(json));
+
+    const char *key;
+    json_t *val;
+    json_object_foreach(json, key, val) {
+        lua_manager_push_interned(L, key, strlen(key));
+        json_push_table(L, val);
+        lua_rawset(L, -3);
+    }
+}
+
+/*** RST
+    .. lua:method:: totable()
+
+        Eagerly convert this JSON value to plain Lua tables in one pass.
+        Much faster than iterating the lazy wrapper when most of a payload
+        will be read: tables are presized and repeated object keys are
+        interned once.
+
+        :rtype: table
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int json_lua_totable(lua_State *L) {
+    json_t *json = lua_checkjson(L, 1);
+
+    json_push_table(L, json);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: parse(str)
+
+    Parse JSON directly into plain Lua values in a single pass, without
+    building an intermediate document. This is the fast path for parse-only
+    workloads (bulk API payloads): no tree allocation, no refcounting, no
+    later conversion, and repeated object keys are interned. Use
+    :lua:func:`loads` when the document needs to be mutated or serialized
+    again.
+
+    Raises an error on invalid JSON.
+
+    :param string str:
+    :returns: The parsed value.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+// nesting cap for the recursive descent: the Lua stack can grow far past
+// the C stack, so recursion depth has to be bounded explicitly (jansson
+// caps at 2048; match it)
+#define JSON_PARSE_MAX_DEPTH 2048
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos;
+
+    int depth;
+
+    // scratch for decoded strings, reused across the whole parse
+    char *strbuf;
+    size_t strbuf_cap;
+} json_parser_t;
+
+static void json_parse_value(lua_State *L, json_parser_t *p);
+
+static void json_parse_error(lua_State *L, json_parser_t *p, const char *what) {
+    // errors unwind with luaL_error; the scratch buffer has to go first
+    size_t pos = p->pos;
+
+    if (p->strbuf) {
+        egoverlay_free(p->strbuf);
+        p->strbuf = NULL;
+    }
+
+    luaL_error(L, "invalid json: %s at offset %d", what, (int)pos);
+}
+
+static void json_parse_ws(json_parser_t *p) {
+    while (p->pos < p->len) {
+        char c = p->data[p->pos];
+        if (c!=' ' && c!='\t' && c!='\n' && c!='\r') break;
+        p->pos++;
+    }
+}
+
+static int json_parse_hex4(lua_State *L, json_parser_t *p) {
+    if (p->pos + 4 > p->len) json_parse_error(L, p, "truncated unicode escape");
+
+    int value = 0;
+    for (int i=0;i<4;i++) {
+        char c = p->data[p->pos++];
+        value <<= 4;
+        if      (c>='0' && c<='9') value |= c - '0';
+        else if (c>='a' && c<='f') value |= c - 'a' + 10;
+        else if (c>='A' && c<='F') value |= c - 'A' + 10;
+        else json_parse_error(L, p, "bad unicode escape");
+    }
+
+    return value;
+}
+
+static size_t json_utf8_encode(char *out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// parse a string and push it. intern keys (small strings used as object
+// keys repeat constantly); values push normally
+static void json_parse_string(lua_State *L, json_parser_t *p, int intern) {
+    if (p->data[p->pos]!='"') json_parse_error(L, p, "expected string");
+    p->pos++;
+
+    // fast path: no escapes, push the slice directly
+    size_t start = p->pos;
+    while (p->pos < p->len) {
+        char c = p->data[p->pos];
+        if (c=='"') {
+            if (intern) lua_manager_push_interned(L, p->data + start, p->pos - start);
+            else lua_pushlstring(L, p->data + start, p->pos - start);
+            p->pos++;
+            return;
+        }
+        if (c=='\\' || (unsigned char)c < 0x20) break;
+        p->pos++;
+    }
+
+    // slow path: decode escapes into the scratch buffer
+    size_t outlen = p->pos - start;
+    if (p->strbuf_cap < p->len) {
+        p->strbuf_cap = p->len;
+        p->strbuf = egoverlay_realloc(p->strbuf, p->strbuf_cap);
+    }
+    memcpy(p->strbuf, p->data + start, outlen);
+
+    while (p->pos < p->len) {
+        char c = p->data[p->pos];
+
+        if (c=='"') {
+            if (intern) lua_manager_push_interned(L, p->strbuf, outlen);
+            else lua_pushlstring(L, p->strbuf, outlen);
+            p->pos++;
+            return;
+        }
+
+        if ((unsigned char)c < 0x20) json_parse_error(L, p, "control character in string");
+
+        if (c!='\\') {
+            p->strbuf[outlen++] = c;
+            p->pos++;
+            continue;
+        }
+
+        p->pos++;
+        if (p->pos>=p->len) json_parse_error(L, p, "truncated escape");
+
+        char esc = p->data[p->pos++];
+        switch (esc) {
+        case '"' : p->strbuf[outlen++] = '"'; break;
+        case '\\': p->strbuf[outlen++] = '\\'; break;
+        case '/' : p->strbuf[outlen++] = '/'; break;
+        case 'b' : p->strbuf[outlen++] = '\b'; break;
+        case 'f' : p->strbuf[outlen++] = '\f'; break;
+        case 'n' : p->strbuf[outlen++] = '\n'; break;
+        case 'r' : p->strbuf[outlen++] = '\r'; break;
+        case 't' : p->strbuf[outlen++] = '\t'; break;
+        case 'u': {
+            uint32_t cp = (uint32_t)json_parse_hex4(L, p);
+
+            // surrogate pair
+            if (cp>=0xD800 && cp<=0xDBFF) {
+                if (p->pos + 2 > p->len || p->data[p->pos]!='\\' || p->data[p->pos+1]!='u') {
+                    json_parse_error(L, p, "unpaired surrogate");
+                }
+                p->pos += 2;
+                uint32_t low = (uint32_t)json_parse_hex4(L, p);
+                if (low<0xDC00 || low>0xDFFF) json_parse_error(L, p, "bad low surrogate");
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            } else if (cp>=0xDC00 && cp<=0xDFFF) {
+                json_parse_error(L, p, "unpaired surrogate");
+            }
+
+            outlen += json_utf8_encode(p->strbuf + outlen, cp);
+            break;
+        }
+        default:
+            json_parse_error(L, p, "bad escape");
+        }
+    }
+
+    json_parse_error(L, p, "unterminated string");
+}
+
+static void json_parse_number(lua_State *L, json_parser_t *p) {
+    size_t start = p->pos;
+    int isint = 1;
+
+    if (p->pos < p->len && p->data[p->pos]=='-') p->pos++;
+    while (p->pos < p->len && p->data[p->pos]>='0' && p->data[p->pos]<='9') p->pos++;
+
+    if (p->pos < p->len && (p->data[p->pos]=='.' || p->data[p->pos]=='e' || p->data[p->pos]=='E')) {
+        isint = 0;
+        while (p->pos < p->len) {
+            char c = p->data[p->pos];
+            if ((c>='0' && c<='9') || c=='.' || c=='e' || c=='E' || c=='+' || c=='-') p->pos++;
+            else break;
+        }
+    }
+
+    if (p->pos==start) json_parse_error(L, p, "expected number");
+
+    // the buffer isn't NUL terminated at pos, so bound the conversion
+    char numbuf[64];
+    size_t numlen = p->pos - start;
+    if (numlen >= sizeof(numbuf)) json_parse_error(L, p, "number too long");
+    memcpy(numbuf, p->data + start, numlen);
+    numbuf[numlen] = 0;
+
+    if (isint) {
+        lua_pushinteger(L, (lua_Integer)strtoll(numbuf, NULL, 10));
+    } else {
+        lua_pushnumber(L, strtod(numbuf, NULL));
+    }
+}
+
+static void json_parse_value_inner(lua_State *L, json_parser_t *p);
+
+static void json_parse_value(lua_State *L, json_parser_t *p) {
+    if (!lua_checkstack(L, 4)) json_parse_error(L, p, "nesting too deep");
+    if (++p->depth > JSON_PARSE_MAX_DEPTH) json_parse_error(L, p, "nesting too deep");
+
+    json_parse_value_inner(L, p);
+
+    p->depth--;
+}
+
+static void json_parse_value_inner(lua_State *L, json_parser_t *p) {
+
+    json_parse_ws(p);
+    if (p->pos>=p->len) json_parse_error(L, p, "unexpected end of input");
+
+    char c = p->data[p->pos];
+
+    if (c=='{') {
+        p->pos++;
+        lua_newtable(L);
+
+        json_parse_ws(p);
+        if (p->pos < p->len && p->data[p->pos]=='}') {
+            p->pos++;
+            return;
+        }
+
+        for (;;) {
+            json_parse_ws(p);
+            json_parse_string(L, p, 1);
+            json_parse_ws(p);
+            if (p->pos>=p->len || p->data[p->pos]!=':') json_parse_error(L, p, "expected ':'");
+            p->pos++;
+            json_parse_value(L, p);
+            lua_rawset(L, -3);
+
+            json_parse_ws(p);
+            if (p->pos>=p->len) json_parse_error(L, p, "unterminated object");
+            if (p->data[p->pos]==',') {
+                p->pos++;
+                continue;
+            }
+            if (p->data[p->pos]=='}') {
+                p->pos++;
+                return;
+            }
+            json_parse_error(L, p, "expected ',' or '}'");
+        }
+    } else if (c=='[') {
+        p->pos++;
+        lua_newtable(L);
+
+        json_parse_ws(p);
+        if (p->pos < p->len && p->data[p->pos]==']') {
+            p->pos++;
+            return;
+        }
+
+        lua_Integer n = 1;
+        for (;;) {
+            json_parse_value(L, p);
+            lua_rawseti(L, -2, n++);
+
+            json_parse_ws(p);
+            if (p->pos>=p->len) json_parse_error(L, p, "unterminated array");
+            if (p->data[p->pos]==',') {
+                p->pos++;
+                continue;
+            }
+            if (p->data[p->pos]==']') {
+                p->pos++;
+                return;
+            }
+            json_parse_error(L, p, "expected ',' or ']'");
+        }
+    } else if (c=='"') {
+        json_parse_string(L, p, 0);
+    } else if (c=='t') {
+        if (p->pos + 4 > p->len || memcmp(p->data + p->pos, "true", 4)!=0) json_parse_error(L, p, "bad literal");
+        p->pos += 4;
+        lua_pushboolean(L, 1);
+    } else if (c=='f') {
+        if (p->pos + 5 > p->len || memcmp(p->data + p->pos, "false", 5)!=0) json_parse_error(L, p, "bad literal");
+        p->pos += 5;
+        lua_pushboolean(L, 0);
+    } else if (c=='n') {
+        if (p->pos + 4 > p->len || memcmp(p->data + p->pos, "null", 4)!=0) json_parse_error(L, p, "bad literal");
+        p->pos += 4;
+        lua_pushnil(L);
+    } else {
+        json_parse_number(L, p);
+    }
+}
+
+int json_lua_mod_parse(lua_State *L) {
+    json_parser_t p = {0};
+    p.data = luaL_checklstring(L, 1, &p.len);
+
+    json_parse_value(L, &p);
+
+    json_parse_ws(&p);
+    if (p.pos!=p.len) {
+        if (p.strbuf) egoverlay_free(p.strbuf);
+        return luaL_error(L, "invalid json: trailing data at offset %d", (int)p.pos);
+    }
+
+    if (p.strbuf) egoverlay_free(p.strbuf);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: compile(schema)
+
+    Compile a field schema into a :lua:class:`jsondecoder`. ``schema`` maps
+    field names to type names (``'int'``, ``'number'``, ``'string'``,
+    ``'bool'``, or ``'any'``). Decoding extracts exactly those fields from a
+    JSON object in one pass and skips everything else without allocating
+    it, which is what fixed-shape payloads parsed constantly (the
+    MumbleLink identity, API types) want.
+
+    :param table schema:
+    :rtype: jsondecoder
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define JSON_DECODER_MT "jsondecoder"
+#define luaL_checkjsondecoder(L, ind) (json_decoder_t*)luaL_checkudata(L, ind, JSON_DECODER_MT)
+
+#define JSON_FIELD_ANY    0
+#define JSON_FIELD_INT    1
+#define JSON_FIELD_NUMBER 2
+#define JSON_FIELD_STRING 3
+#define JSON_FIELD_BOOL   4
+
+typedef struct {
+    char *name;
+    size_t namelen;
+    int type;
+} json_decoder_field_t;
+
+typedef struct {
+    int nfields;
+    json_decoder_field_t *fields;
+} json_decoder_t;
+
+// skip one JSON value without building anything
+static void json_skip_value(lua_State *L, json_parser_t *p) {
+    json_parse_ws(p);
+    if (p->pos>=p->len) json_parse_error(L, p, "unexpected end of input");
+
+    char c = p->data[p->pos];
+
+    if (c=='"') {
+        p->pos++;
+        while (p->pos < p->len) {
+            char sc = p->data[p->pos++];
+            if (sc=='\\') {
+                if (p->pos < p->len) p->pos++;
+            } else if (sc=='"') {
+                return;
+            }
+        }
+        json_parse_error(L, p, "unterminated string");
+    }
+
+    if (c=='{' || c=='[') {
+        char open = c;
+        char close = open=='{' ? '}' : ']';
+        int depth = 0;
+
+        while (p->pos < p->len) {
+            char sc = p->data[p->pos];
+
+            if (sc=='"') {
+                json_skip_value(L, p); // strings may contain braces
+                continue;
+            }
+
+            p->pos++;
+            if (sc==open) depth++;
+            else if (sc==close) {
+                depth--;
+                if (depth==0) return;
+            }
+        }
+
+        json_parse_error(L, p, "unterminated container");
+    }
+
+    // literal or number; scan to a delimiter
+    while (p->pos < p->len) {
+        char sc = p->data[p->pos];
+        if (sc==',' || sc=='}' || sc==']' || sc==' ' || sc=='\t' || sc=='\n' || sc=='\r') return;
+        p->pos++;
+    }
+}
+
+int json_decoder_lua_del(lua_State *L);
+int json_decoder_lua_decode(lua_State *L);
+
+static luaL_Reg json_decoder_funcs[] = {
+    "__gc"  , &json_decoder_lua_del,
+    "decode", &json_decoder_lua_decode,
+    NULL    , NULL
+};
+
+int json_lua_mod_compile(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    // count fields
+    int nfields = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        nfields++;
+        lua_pop(L, 1);
+    }
+
+    json_decoder_t *dec = lua_newuserdata(L, sizeof(json_decoder_t));
+    memset(dec, 0, sizeof(json_decoder_t));
+
+    if (luaL_newmetatable(L, JSON_DECODER_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, json_decoder_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    dec->fields = egoverlay_calloc(nfields, sizeof(json_decoder_field_t));
+
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        // converting a non-string key in place would corrupt lua_next
+        if (lua_type(L, -2)!=LUA_TSTRING || lua_type(L, -1)!=LUA_TSTRING) {
+            return luaL_error(L, "schema entries must be name = typename");
+        }
+
+        size_t namelen = 0;
+        const char *name = lua_tolstring(L, -2, &namelen);
+        const char *type = lua_tostring(L, -1);
+
+        json_decoder_field_t *f = &dec->fields[dec->nfields];
+
+        if      (strcmp(type, "any"   )==0) f->type = JSON_FIELD_ANY;
+        else if (strcmp(type, "int"   )==0) f->type = JSON_FIELD_INT;
+        else if (strcmp(type, "number")==0) f->type = JSON_FIELD_NUMBER;
+        else if (strcmp(type, "string")==0) f->type = JSON_FIELD_STRING;
+        else if (strcmp(type, "bool"  )==0) f->type = JSON_FIELD_BOOL;
+        else return luaL_error(L, "unknown schema type: %s", type);
+
+        f->name = egoverlay_calloc(namelen+1, sizeof(char));
+        memcpy(f->name, name, namelen);
+        f->namelen = namelen;
+
+        dec->nfields++;
+
+        lua_pop(L, 1);
+    }
+
+    return 1;
+}
+
+int json_decoder_lua_del(lua_State *L) {
+    json_decoder_t *dec = luaL_checkjsondecoder(L, 1);
+
+    for (int f=0;f<dec->nfields;f++) {
+        if (dec->fields[f].name) egoverlay_free(dec->fields[f].name);
+    }
+    if (dec->fields) egoverlay_free(dec->fields);
+
+    return 0;
+}
+
+/*** RST
+.. lua:class:: jsondecoder
+
+    .. lua:method:: decode(str)
+
+        Decode a JSON object, returning a table with the schema's fields
+        (missing fields are absent; fields whose value doesn't match the
+        declared type raise an error).
+
+        :param string str:
+        :rtype: table
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int json_decoder_lua_decode(lua_State *L) {
+    json_decoder_t *dec = luaL_checkjsondecoder(L, 1);
+
+    json_parser_t p = {0};
+    p.data = luaL_checklstring(L, 2, &p.len);
+
+    json_parse_ws(&p);
+    if (p.pos>=p.len || p.data[p.pos]!='{') {
+        if (p.strbuf) egoverlay_free(p.strbuf);
+        return luaL_error(L, "decode requires a json object");
+    }
+    p.pos++;
+
+    lua_createtable(L, 0, dec->nfields);
+    int result = lua_gettop(L);
+
+    json_parse_ws(&p);
+    if (p.pos < p.len && p.data[p.pos]=='}') {
+        p.pos++;
+    } else for (;;) {
+        json_parse_ws(&p);
+        json_parse_string(L, &p, 1); // the key
+        size_t keylen = 0;
+        const char *key = lua_tolstring(L, -1, &keylen);
+
+        json_parse_ws(&p);
+        if (p.pos>=p.len || p.data[p.pos]!=':') json_parse_error(L, &p, "expected ':'");
+        p.pos++;
+
+        json_decoder_field_t *field = NULL;
+        for (int f=0;f<dec->nfields;f++) {
+            if (dec->fields[f].namelen==keylen && memcmp(dec->fields[f].name, key, keylen)==0) {
+                field = &dec->fields[f];
+                break;
+            }
+        }
+
+        if (!field) {
+            lua_pop(L, 1); // the key
+            json_skip_value(L, &p);
+        } else {
+            json_parse_value(L, &p);
+
+            int ok = 1;
+            switch (field->type) {
+            case JSON_FIELD_INT   : ok = lua_isinteger(L, -1) || lua_isnil(L, -1); break;
+            case JSON_FIELD_NUMBER: ok = lua_isnumber(L, -1) || lua_isnil(L, -1); break;
+            case JSON_FIELD_STRING: ok = lua_isstring(L, -1) || lua_isnil(L, -1); break;
+            case JSON_FIELD_BOOL  : ok = lua_isboolean(L, -1) || lua_isnil(L, -1); break;
+            default: break;
+            }
+
+            if (!ok) {
+                if (p.strbuf) egoverlay_free(p.strbuf);
+                return luaL_error(L, "field %s has the wrong type", field->name);
+            }
+
+            lua_rawset(L, result);
+        }
+
+        json_parse_ws(&p);
+        if (p.pos>=p.len) json_parse_error(L, &p, "unterminated object");
+        if (p.data[p.pos]==',') {
+            p.pos++;
+            continue;
+        }
+        if (p.data[p.pos]=='}') {
+            p.pos++;
+            break;
+        }
+        json_parse_error(L, &p, "expected ',' or '}'");
+    }
+
+    if (p.strbuf) egoverlay_free(p.strbuf);
+
+    return 1;
+}
@@ -5,4 +5,5 @@
 void json_lua_init();
 
 json_t *lua_checkjson(lua_State *L, int index);
-void lua_pushjson(lua_State *L, json_t *json);
\ No newline at end of file
+void lua_pushjson(lua_State *L, json_t *json);
+json_t *lua_tojson(lua_State *L, int index);
\ No newline at end of file
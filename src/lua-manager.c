@@ -13,7 +13,10 @@
 #include <lualib.h>
 #include <lauxlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include "lua-json.h"
+#include "state-journal.h"
 
 typedef struct lua_event_callback_list_t {
     lua_manager_event_callback *cb;
@@ -23,6 +26,7 @@ typedef struct lua_event_callback_list_t {
 
 typedef struct lua_event_list_t {
     char *event;
+    int event_owned; // set when the name couldn't be interned
     json_t *data;
     int data_cbi;
 
@@ -31,6 +35,7 @@ typedef struct lua_event_list_t {
 
 typedef struct lua_event_handler_t {
     int cbi;
+    char *source; // chunk source of the registering module, for hot reload
     struct lua_event_handler_t *next;
 } lua_event_handler_t;
 
@@ -41,12 +46,24 @@ typedef struct lua_manager_module_opener_t {
     struct lua_manager_module_opener_t *next;
 } lua_manager_module_opener_t;
 
+typedef struct lua_module_stats_t {
+    char *name;
+    double cpu_seconds;
+    uint64_t calls;
+} lua_module_stats_t;
+
 typedef struct lua_manager_coroutine_thread_list_t {
     lua_State *thread;
     int threadi;
+    lua_module_stats_t *stats; // CPU accounting bucket for this coroutine
     struct lua_manager_coroutine_thread_list_t *next;
 } lua_manager_coroutine_thread_list_t;
 
+// coroutine scheduling classes
+#define LUA_CO_PRIORITY_HIGH   0
+#define LUA_CO_PRIORITY_NORMAL 1
+#define LUA_CO_PRIORITY_LOW    2
+
 typedef struct {
     logger_t *log;
     lua_State *lua;
@@ -60,13 +77,108 @@ typedef struct {
     lua_event_handler_t **event_handlers;
 
     lua_manager_module_opener_t *module_openers;
-    lua_manager_coroutine_thread_list_t *coroutine_threads;
+
+    // yielded coroutines, one round robin list per priority class. higher
+    // classes are resumed first and everything shares a per frame time
+    // budget, so slow background work can't starve the frame or each other
+    lua_manager_coroutine_thread_list_t *coroutines[3];
+    lua_manager_coroutine_thread_list_t *coroutine_tails[3];
+
+    // priority a coroutine asked for before it was first suspended
+    int pending_priority;
 } lua_manager_t;
 
 // stored statically so that events can be queued before Lua is even setup
 static lua_event_list_t *event_queue = NULL;
 static int no_events = 0;
 
+// queue depths, maintained under the event lock, plus backpressure state.
+// when the event queue backs up past the threshold a queue-backpressure
+// event tells producers to throttle; relief is signalled once the queue
+// drains below half the threshold
+#define EVENT_QUEUE_BACKPRESSURE 256
+
+static size_t event_queue_depth = 0;
+static size_t event_cb_depth = 0;
+static int event_backpressure = 0;
+
+// events and event callbacks are queued from several threads (loggers, the
+// web request worker); this guards the queues, the node pools, and the
+// event name intern table. it's created in lua_manager_init; queueing
+// before that is single threaded startup code
+static HANDLE event_mutex = NULL;
+
+static void event_lock() {
+    if (event_mutex) WaitForSingleObject(event_mutex, INFINITE);
+}
+
+static void event_unlock() {
+    if (event_mutex) ReleaseMutex(event_mutex);
+}
+
+// Event names come from a small fixed set ('update', mumble events, ...)
+// but were copied to the heap for every queued event. Intern them once and
+// reuse the pointer; interned names live for the process.
+#define EVENT_INTERN_SIZE 64
+
+static char *interned_events[EVENT_INTERN_SIZE];
+
+// must be called with the event lock held. *owned is set when the returned
+// name is a one-off copy the caller has to free
+static char *intern_event_name(const char *event, int *owned) {
+    *owned = 0;
+
+    uint32_t hash = djb2_hash_string(event);
+    size_t ind = hash % EVENT_INTERN_SIZE;
+
+    for (size_t probes=0;probes<EVENT_INTERN_SIZE;probes++) {
+        if (interned_events[ind]==NULL) {
+            interned_events[ind] = egoverlay_calloc(strlen(event)+1, sizeof(char));
+            memcpy(interned_events[ind], event, strlen(event));
+            return interned_events[ind];
+        }
+
+        if (strcmp(interned_events[ind], event)==0) return interned_events[ind];
+
+        ind = (ind + 1) % EVENT_INTERN_SIZE;
+    }
+
+    // table full of other names; shouldn't happen with the overlay's event
+    // set, but fall back to a per event copy rather than failing
+    *owned = 1;
+    char *copy = egoverlay_calloc(strlen(event)+1, sizeof(char));
+    memcpy(copy, event, strlen(event));
+    return copy;
+}
+
+// node pools so per frame events (update, mumble changes, log messages)
+// stop churning the heap
+static lua_event_list_t *event_node_pool = NULL;
+static lua_event_callback_list_t *event_cb_node_pool = NULL;
+
+// must be called with the event lock held
+static lua_event_list_t *event_node_get() {
+    if (event_node_pool) {
+        lua_event_list_t *e = event_node_pool;
+        event_node_pool = e->next;
+        memset(e, 0, sizeof(lua_event_list_t));
+        return e;
+    }
+
+    return egoverlay_calloc(1, sizeof(lua_event_list_t));
+}
+
+static lua_event_callback_list_t *event_cb_node_get() {
+    if (event_cb_node_pool) {
+        lua_event_callback_list_t *e = event_cb_node_pool;
+        event_cb_node_pool = e->next;
+        memset(e, 0, sizeof(lua_event_callback_list_t));
+        return e;
+    }
+
+    return egoverlay_calloc(1, sizeof(lua_event_callback_list_t));
+}
+
 static lua_manager_t *lua = NULL;
 
 char *get_lua_module_path(lua_State *L, int stack_depth);
@@ -86,6 +198,30 @@ int overlay_findfiles(lua_State *L);
 int overlay_uuid(lua_State *L);
 int overlay_uuidtobase64(lua_State *L);
 int overlay_uuidfrombase64(lua_State *L);
+int overlay_coroutine_priority(lua_State *L);
+int overlay_timeout(lua_State *L);
+int overlay_interval(lua_State *L);
+int overlay_cancel_timer(lua_State *L);
+int overlay_reload_module(lua_State *L);
+int overlay_lua_stats(lua_State *L);
+int overlay_heap_checkpoint(lua_State *L);
+int overlay_queue_stats(lua_State *L);
+int overlay_journal_get(lua_State *L);
+int overlay_journal_set(lua_State *L);
+int overlay_heap_delta(lua_State *L);
+static void lua_manager_unref_l(lua_State *L, int r);
+
+// sampling Lua profiler (defined near the bottom of this file)
+void lua_manager_profile_hook(lua_State *L, lua_Debug *ar);
+int lua_manager_profiling();
+int lua_manager_profile_interval();
+
+int overlay_degradation_level(lua_State *L);
+int overlay_lua_profile_start(lua_State *L);
+int overlay_lua_profile_stop(lua_State *L);
+int overlay_ref_stats(lua_State *L);
+int overlay_add_batched_event_handler(lua_State *L);
+int overlay_remove_batched_event_handler(lua_State *L);
 
 luaL_Reg overlay_funcs[] = {
     "addeventhandler"   , &overlay_add_event_handler,
@@ -103,9 +239,28 @@ luaL_Reg overlay_funcs[] = {
     "uuid"              , &overlay_uuid,
     "uuidtobase64"      , &overlay_uuidtobase64,
     "uuidfrombase64"    , &overlay_uuidfrombase64,
+    "coroutinepriority" , &overlay_coroutine_priority,
+    "timeout"           , &overlay_timeout,
+    "interval"          , &overlay_interval,
+    "canceltimer"       , &overlay_cancel_timer,
+    "reloadmodule"      , &overlay_reload_module,
+    "luastats"          , &overlay_lua_stats,
+    "heapcheckpoint"    , &overlay_heap_checkpoint,
+    "queuestats"        , &overlay_queue_stats,
+    "journalget"        , &overlay_journal_get,
+    "journalset"        , &overlay_journal_set,
+    "heapdelta"         , &overlay_heap_delta,
+    "degradationlevel"  , &overlay_degradation_level,
+    "luaprofilestart"   , &overlay_lua_profile_start,
+    "luaprofilestop"    , &overlay_lua_profile_stop,
+    "refstats"          , &overlay_ref_stats,
+    "addbatchedeventhandler"   , &overlay_add_batched_event_handler,
+    "removebatchedeventhandler", &overlay_remove_batched_event_handler,
     NULL                ,  NULL
 };
 
+static int cached_module_searcher(lua_State *L);
+
 int open_overlay_module(lua_State *L) {
     lua_newtable(L);
     luaL_setfuncs(L, overlay_funcs, 0);
@@ -131,8 +286,86 @@ int embedded_module_searcher(lua_State *L) {
     return 1;
 }
 
+// Custom Lua allocator: Lua's allocation traffic is dominated by small,
+// short lived blocks, so blocks up to 128 bytes are cached on per size
+// class free lists (16 byte classes) instead of hitting the heap every
+// time. Blocks are rounded up to their class size, which also lets a
+// realloc within the same class return the same pointer. Only the main
+// state (render thread) uses this allocator; worker states keep the
+// default one.
+#define LUA_ALLOC_CLASS_SIZE  16
+#define LUA_ALLOC_CLASSES      8
+
+typedef struct lua_alloc_block_t {
+    struct lua_alloc_block_t *next;
+} lua_alloc_block_t;
+
+static lua_alloc_block_t *lua_alloc_free_lists[LUA_ALLOC_CLASSES];
+
+static size_t lua_alloc_class(size_t size) {
+    return (size + LUA_ALLOC_CLASS_SIZE - 1) / LUA_ALLOC_CLASS_SIZE;
+}
+
+static void lua_alloc_release(void *ptr, size_t size) {
+    size_t cls = lua_alloc_class(size);
+
+    if (cls==0 || cls > LUA_ALLOC_CLASSES) {
+        free(ptr);
+        return;
+    }
+
+    lua_alloc_block_t *block = (lua_alloc_block_t*)ptr;
+    block->next = lua_alloc_free_lists[cls-1];
+    lua_alloc_free_lists[cls-1] = block;
+}
+
+static void *lua_alloc_take(size_t size) {
+    size_t cls = lua_alloc_class(size);
+
+    if (cls==0 || cls > LUA_ALLOC_CLASSES) return malloc(size);
+
+    if (lua_alloc_free_lists[cls-1]) {
+        lua_alloc_block_t *block = lua_alloc_free_lists[cls-1];
+        lua_alloc_free_lists[cls-1] = block->next;
+        return block;
+    }
+
+    return malloc(cls * LUA_ALLOC_CLASS_SIZE);
+}
+
+static void *lua_manager_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    UNUSED_PARAM(ud);
+
+    if (nsize==0) {
+        if (ptr) lua_alloc_release(ptr, osize);
+        return NULL;
+    }
+
+    if (ptr==NULL) return lua_alloc_take(nsize);
+
+    size_t ocls = lua_alloc_class(osize);
+    size_t ncls = lua_alloc_class(nsize);
+
+    // same pooled class: the block is already big enough
+    if (ocls==ncls && ocls<=LUA_ALLOC_CLASSES) return ptr;
+
+    // both large: let the heap do the move
+    if (ocls > LUA_ALLOC_CLASSES && ncls > LUA_ALLOC_CLASSES) return realloc(ptr, nsize);
+
+    void *newptr = lua_alloc_take(nsize);
+    if (!newptr) return NULL;
+
+    memcpy(newptr, ptr, osize < nsize ? osize : nsize);
+    lua_alloc_release(ptr, osize);
+
+    return newptr;
+}
+
 void lua_manager_init() {
     lua = egoverlay_calloc(1, sizeof(lua_manager_t));
+    lua->pending_priority = LUA_CO_PRIORITY_NORMAL;
+
+    if (!event_mutex) event_mutex = CreateMutex(0, FALSE, NULL);
 
     lua->log = logger_get("lua");
 
@@ -142,7 +375,7 @@ void lua_manager_init() {
     lua->event_handler_types = egoverlay_calloc(lua->event_handler_table_size, sizeof(char*));
     lua->event_handlers = egoverlay_calloc(lua->event_handler_table_size, sizeof(lua_event_handler_t*));
 
-    lua->lua = luaL_newstate();
+    lua->lua = lua_newstate(&lua_manager_alloc, NULL);
 
     if (!lua->lua) {
         logger_error(lua->log, "Couldn't initialize new Lua state.");
@@ -156,6 +389,17 @@ void lua_manager_init() {
     lua_getfield(lua->lua, -1, "searchers");
     lua_pushcfunction(lua->lua, &embedded_module_searcher);
     lua_seti(lua->lua, -2, luaL_len(lua->lua, -2) + 1);
+
+    // and the bytecode cached file searcher, ahead of the stock Lua file
+    // searcher so file modules load through the cache
+    int nsearchers = (int)luaL_len(lua->lua, -1);
+    for (int i=nsearchers;i>=2;i--) {
+        lua_geti(lua->lua, -1, i);
+        lua_seti(lua->lua, -2, i + 1);
+    }
+    lua_pushcfunction(lua->lua, &cached_module_searcher);
+    lua_seti(lua->lua, -2, 2);
+
     lua_pop(lua->lua, 2);
 
     lua_manager_add_module_opener("eg-overlay", &open_overlay_module);
@@ -175,7 +419,7 @@ void lua_manager_cleanup() {
             lua_event_handler_t *h = lua->event_handlers[e];
             while (h) {
                 lua_event_handler_t *next = h->next;
-                luaL_unref(lua->lua, LUA_REGISTRYINDEX, h->cbi);
+                lua_manager_unref_l(lua->lua, h->cbi);
                 egoverlay_free(h);
                 h = next;
             }
@@ -213,11 +457,160 @@ void lua_manager_add_module_opener(const char *name, lua_manager_module_opener_f
     last_mo->next = mo;
 }
 
+// Bytecode cache: compiling every module source on startup is measurable
+// on big installs. Compiled chunks are dumped to lua-cache/ keyed by a hash
+// of the source path and revalidated against the source's size and mtime.
+typedef struct {
+    char magic[4]; // EGLC
+    int64_t srcsize;
+    int64_t srcmtime;
+    uint32_t pathlen; // the source path follows the header, then the chunk
+} lua_cache_header_t;
+
+struct lua_dump_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static int lua_manager_dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    UNUSED_PARAM(L);
+
+    struct lua_dump_buf *buf = (struct lua_dump_buf*)ud;
+
+    if (buf->len + sz > buf->cap) {
+        buf->cap = buf->cap ? buf->cap * 2 : 4096;
+        while (buf->len + sz > buf->cap) buf->cap *= 2;
+        buf->data = egoverlay_realloc(buf->data, buf->cap);
+    }
+
+    memcpy(buf->data + buf->len, p, sz);
+    buf->len += sz;
+
+    return 0;
+}
+
+// Load a Lua source file through the bytecode cache. Behaves like
+// luaL_loadfile: pushes the chunk or an error message and returns the load
+// status.
+int lua_manager_load_file_cached(lua_State *L, const char *path) {
+    struct _stat64 st = {0};
+    if (_stati64(path, &st)!=0) return luaL_loadfile(L, path); // missing file, let loadfile report it
+
+    char cachepath[64];
+    snprintf(cachepath, sizeof(cachepath), "lua-cache/%08x.luac", djb2_hash_string(path));
+
+    FILE *f = fopen(cachepath, "rb");
+    if (f) {
+        lua_cache_header_t header = {0};
+
+        int valid = fread(&header, sizeof(header), 1, f)==1 &&
+            memcmp(header.magic, "EGLC", 4)==0 &&
+            header.srcsize==(int64_t)st.st_size &&
+            header.srcmtime==(int64_t)st.st_mtime &&
+            header.pathlen==(uint32_t)strlen(path);
+
+        if (valid) {
+            // hash collision guard: the stored path has to match
+            char *stored_path = egoverlay_calloc(header.pathlen + 1, sizeof(char));
+            valid = fread(stored_path, 1, header.pathlen, f)==header.pathlen &&
+                strcmp(stored_path, path)==0;
+            egoverlay_free(stored_path);
+        }
+
+        if (valid) {
+            fseek(f, 0, SEEK_END);
+            long end = ftell(f);
+            long chunklen = end - (long)(sizeof(header) + header.pathlen);
+            fseek(f, sizeof(header) + header.pathlen, SEEK_SET);
+
+            char *chunk = egoverlay_malloc(chunklen);
+            if (fread(chunk, 1, chunklen, f)==(size_t)chunklen) {
+                fclose(f);
+
+                char chunkname[MAX_PATH + 1];
+                snprintf(chunkname, sizeof(chunkname), "@%s", path);
+
+                int r = luaL_loadbufferx(L, chunk, chunklen, chunkname, "b");
+                egoverlay_free(chunk);
+
+                if (r==LUA_OK) return LUA_OK;
+
+                // stale/corrupt bytecode, recompile below
+                lua_pop(L, 1);
+            } else {
+                egoverlay_free(chunk);
+                fclose(f);
+            }
+        } else {
+            fclose(f);
+        }
+    }
+
+    int r = luaL_loadfile(L, path);
+    if (r!=LUA_OK) return r;
+
+    struct lua_dump_buf buf = {0};
+    if (lua_dump(L, &lua_manager_dump_writer, &buf, 0)==0 && buf.len) {
+        CreateDirectory("lua-cache", NULL);
+
+        FILE *out = fopen(cachepath, "wb");
+        if (out) {
+            lua_cache_header_t header = {0};
+            memcpy(header.magic, "EGLC", 4);
+            header.srcsize = (int64_t)st.st_size;
+            header.srcmtime = (int64_t)st.st_mtime;
+            header.pathlen = (uint32_t)strlen(path);
+
+            fwrite(&header, sizeof(header), 1, out);
+            fwrite(path, 1, header.pathlen, out);
+            fwrite(buf.data, 1, buf.len, out);
+            fclose(out);
+        }
+    }
+
+    if (buf.data) egoverlay_free(buf.data);
+
+    return LUA_OK;
+}
+
+// package.searchers entry that resolves file modules like the stock Lua
+// searcher but loads them through the bytecode cache
+static int cached_module_searcher(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "searchpath");
+    lua_pushstring(L, name);
+    lua_getfield(L, -3, "path"); // package.path; -3 is the package table
+    lua_call(L, 2, 2);
+
+    if (lua_isnil(L, -2)) {
+        // not found; return the error message like the stock searcher
+        lua_remove(L, -2);
+        return 1;
+    }
+
+    lua_pop(L, 1); // the nil error slot
+
+    const char *path = lua_tostring(L, -1);
+
+    if (lua_manager_load_file_cached(L, path)!=LUA_OK) {
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                          name, path, lua_tostring(L, -1));
+    }
+
+    // return the chunk and the file name
+    lua_pushvalue(L, -2);
+
+    return 2;
+}
+
 void lua_manager_run_file(const char *path) {
 
     lua_State *thread = lua_newthread(lua->lua);
 
-    int r = luaL_loadfile(thread, path);
+    int r = lua_manager_load_file_cached(thread, path);
 
     if (r != LUA_OK) {
         const char *err_msg = lua_tolstring(thread, -1, NULL);
@@ -349,11 +742,12 @@ int overlay_add_event_handler(lua_State *L) {
     }
     
     lua_pushvalue(L, 2);
-    int cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+    int cbi = lua_manager_ref(L);
 
     lua_event_handler_t *h = egoverlay_calloc(1, sizeof(lua_event_handler_t));
     h->cbi = cbi;
-    
+    h->source = get_lua_module_path(L, 1);
+
     uint32_t event_hash = djb2_hash_string(event);
     uint32_t event_ind = event_hash % lua->event_handler_table_size;
 
@@ -433,10 +827,11 @@ int overlay_remove_event_handler(lua_State *L) {
 
     if (h->cbi!=cbi) return 0;
 
-    luaL_unref(L, LUA_REGISTRYINDEX, h->cbi);
+    lua_manager_unref_l(L, h->cbi);
 
     if (prev) prev->next = h->next;
     if (prev==NULL) lua->event_handlers[event_ind] = h->next;
+    if (h->source) egoverlay_free(h->source);
     egoverlay_free(h);
 
     char *mod = lua_manager_get_lua_module_name(L);
@@ -471,16 +866,19 @@ int overlay_queue_event(lua_State *L) {
 
     if (lua_gettop(L)==2) {
         lua_pushvalue(L, 2);
-        data_cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+        data_cbi = lua_manager_ref(L);
     }
 
-    lua_event_list_t *e = egoverlay_calloc(1, sizeof(lua_event_list_t));
+    event_lock();
+
+    lua_event_list_t *e = event_node_get();
     e->data_cbi = data_cbi;
-    e->event = egoverlay_calloc(strlen(event)+1, sizeof(char));
-    memcpy(e->event, event, strlen(event));
+    e->event = intern_event_name(event, &e->event_owned);
+    event_queue_depth++;
 
     if (event_queue==NULL) {
         event_queue = e;
+        event_unlock();
         return 0;
     }
 
@@ -489,6 +887,8 @@ int overlay_queue_event(lua_State *L) {
 
     eq->next = e;
 
+    event_unlock();
+
     return 0;
 }
 
@@ -538,8 +938,85 @@ int overlay_settings(lua_State *L) {
     return 1;
 }
 
+// Interned short string pushing: a direct mapped cache of registry
+// references so strings the overlay pushes constantly (XML names, JSON
+// object keys) skip re-hashing through the Lua string table. Slots pin at
+// most LUA_INTERN_SIZE short strings; longer or colliding strings fall back
+// to lua_pushlstring.
+#define LUA_INTERN_SIZE    256
+#define LUA_INTERN_MAX_LEN  64
+
+typedef struct {
+    uint32_t hash;
+    uint16_t len;
+    char str[LUA_INTERN_MAX_LEN];
+    int ref;
+} lua_intern_entry_t;
+
+static lua_intern_entry_t lua_interned[LUA_INTERN_SIZE];
+
+void lua_manager_push_interned(lua_State *L, const char *s, size_t len) {
+    if (len==0 || len>=LUA_INTERN_MAX_LEN) {
+        lua_pushlstring(L, s, len);
+        return;
+    }
+
+    uint32_t hash = djb2_hash_data((const uint8_t*)s, len);
+    lua_intern_entry_t *e = &lua_interned[hash % LUA_INTERN_SIZE];
+
+    if (e->ref && e->hash==hash && e->len==len && memcmp(e->str, s, len)==0) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, e->ref);
+        return;
+    }
+
+    lua_pushlstring(L, s, len);
+
+    // take over the slot
+    if (e->ref) lua_manager_unref_l(L, e->ref);
+
+    lua_pushvalue(L, -1);
+    e->ref = lua_manager_ref(L);
+    e->hash = hash;
+    e->len = (uint16_t)len;
+    memcpy(e->str, s, len);
+}
+
+// Registry reference accounting. Lua 5.4's luaL_ref already recycles slots
+// through an internal free list, so allocation is O(1) and the registry only
+// grows under leaks — which is exactly what long sessions hit. Every ref
+// taken through lua_manager_ref / released through lua_manager_unref is
+// counted, and overlay.refstats() reports outstanding/peak counts plus the
+// registry length so a leaking module shows up as a climbing number instead
+// of slow memory growth nobody can attribute.
+static volatile LONG ref_outstanding = 0;
+static volatile LONG ref_peak = 0;
+
+// counted luaL_unref against an explicit state, for the internal sites
+// that hold refs from coroutine threads
+static void lua_manager_unref_l(lua_State *L, int r) {
+    if (r==LUA_REFNIL || r==LUA_NOREF || r==0) return;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, r);
+    InterlockedDecrement(&ref_outstanding);
+}
+
+// pop the value on top of the stack into the registry, counted
+int lua_manager_ref(lua_State *L) {
+    int r = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    if (r!=LUA_REFNIL && r!=LUA_NOREF) {
+        LONG now = InterlockedIncrement(&ref_outstanding);
+        if (now > ref_peak) ref_peak = now;
+    }
+
+    return r;
+}
+
 void lua_manager_unref(int cbi) {
+    if (cbi==LUA_REFNIL || cbi==LUA_NOREF || cbi==0) return;
+
     luaL_unref(lua->lua, LUA_REGISTRYINDEX, cbi);
+    InterlockedDecrement(&ref_outstanding);
 }
 
 int lua_manager_gettableref_bool(int table_ind, const char *field) {
@@ -561,12 +1038,16 @@ void lua_manager_settabletref_bool(int table_ind, const char *field, int value)
 }
 
 void lua_manager_add_event_callback(lua_manager_event_callback *cb, void *data) {
-    lua_event_callback_list_t *e = egoverlay_calloc(1, sizeof(lua_event_callback_list_t));
+    event_lock();
+
+    lua_event_callback_list_t *e = event_cb_node_get();
     e->cb = cb;
     e->data = data;
+    event_cb_depth++;
 
     if (lua->event_cbs==NULL) {
         lua->event_cbs = e;
+        event_unlock();
         return;
     }
 
@@ -574,6 +1055,8 @@ void lua_manager_add_event_callback(lua_manager_event_callback *cb, void *data)
     while (l->next) l = l->next;
 
     l->next = e;
+
+    event_unlock();
 }
 
 lua_event_handler_t *get_event_handlers(const char *event) {
@@ -593,63 +1076,718 @@ lua_event_handler_t *get_event_handlers(const char *event) {
         return NULL;
     }
 
-    return lua->event_handlers[event_ind];
+    return lua->event_handlers[event_ind];
+}
+
+// Per module CPU accounting: every Lua dispatch (event handlers, their
+// coroutine resumes, C originated callbacks) is timed and charged to the
+// registering module's chunk source. GC step time is tracked separately.
+#define LUA_STATS_MODULES 64
+
+static lua_module_stats_t module_stats[LUA_STATS_MODULES];
+static int module_stats_count = 0;
+static double lua_gc_seconds = 0.0;
+
+// find or create the accounting bucket for a chunk source; entries live for
+// the process so pointers to them are stable
+static lua_module_stats_t *lua_stats_entry(const char *source) {
+    if (!source) source = "(native)";
+
+    for (int i=0;i<module_stats_count;i++) {
+        if (strcmp(module_stats[i].name, source)==0) return &module_stats[i];
+    }
+
+    if (module_stats_count==LUA_STATS_MODULES) return &module_stats[0];
+
+    lua_module_stats_t *e = &module_stats[module_stats_count++];
+    e->name = egoverlay_calloc(strlen(source)+1, sizeof(char));
+    memcpy(e->name, source, strlen(source));
+
+    return e;
+}
+
+static void lua_stats_add(lua_module_stats_t *entry, double seconds) {
+    entry->cpu_seconds += seconds;
+    entry->calls++;
+}
+
+/*** RST
+.. lua:function:: luastats()
+
+    Return per-module Lua accounting: a ``modules`` table keyed by module
+    source mapping to ``{ cpu = seconds, calls = n }``, plus ``gctime``
+    (seconds spent in paced GC steps) and ``memory`` (Lua heap bytes).
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_lua_stats(lua_State *L) {
+    lua_createtable(L, 0, 3);
+
+    lua_createtable(L, 0, module_stats_count);
+    for (int i=0;i<module_stats_count;i++) {
+        lua_createtable(L, 0, 2);
+
+        lua_pushnumber(L, module_stats[i].cpu_seconds);
+        lua_setfield(L, -2, "cpu");
+
+        lua_pushinteger(L, (lua_Integer)module_stats[i].calls);
+        lua_setfield(L, -2, "calls");
+
+        lua_setfield(L, -2, module_stats[i].name);
+    }
+    lua_setfield(L, -2, "modules");
+
+    lua_pushnumber(L, lua_gc_seconds);
+    lua_setfield(L, -2, "gctime");
+
+    lua_pushinteger(L, ((lua_Integer)lua_gc(lua->lua, LUA_GCCOUNT, 0) * 1024) + lua_gc(lua->lua, LUA_GCCOUNTB, 0));
+    lua_setfield(L, -2, "memory");
+
+    return 1;
+}
+
+static void lua_manager_append_coroutine(int priority, lua_manager_coroutine_thread_list_t *coroutine) {
+    coroutine->next = NULL;
+
+    if (lua->coroutine_tails[priority]) lua->coroutine_tails[priority]->next = coroutine;
+    else lua->coroutines[priority] = coroutine;
+    lua->coroutine_tails[priority] = coroutine;
+}
+
+lua_manager_coroutine_thread_list_t *lua_manager_add_coroutine_thread(lua_State *thread, int threadi) {
+    size_t cosize = sizeof(lua_manager_coroutine_thread_list_t);
+    lua_manager_coroutine_thread_list_t *coroutine = egoverlay_calloc(1, cosize);
+    coroutine->thread = thread;
+    coroutine->threadi = threadi;
+
+    lua_manager_append_coroutine(lua->pending_priority, coroutine);
+    lua->pending_priority = LUA_CO_PRIORITY_NORMAL;
+
+    return coroutine;
+}
+
+void lua_manager_remove_coroutine_thread(int threadi) {
+    for (int p=0;p<3;p++) {
+        lua_manager_coroutine_thread_list_t *c = lua->coroutines[p];
+        lua_manager_coroutine_thread_list_t *prev = NULL;
+
+        while (c) {
+            if (c->threadi == threadi) {
+                lua_manager_unref_l(lua->lua, c->threadi);
+                lua_closethread(c->thread, NULL);
+                if (prev) prev->next = c->next;
+                if (lua->coroutines[p]==c) lua->coroutines[p] = c->next;
+                if (lua->coroutine_tails[p]==c) lua->coroutine_tails[p] = prev;
+                egoverlay_free(c);
+                return;
+            }
+            prev = c;
+            c = c->next;
+        }
+    }
+}
+
+/*** RST
+.. lua:function:: coroutinepriority(value)
+
+    Set the scheduling priority of the calling coroutine. High priority
+    coroutines are resumed first each frame; low priority ones only run
+    with whatever time budget is left.
+
+    :param string value: One of ``'high'``, ``'normal'`` (the default), or
+        ``'low'``.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_coroutine_priority(lua_State *L) {
+    const char *value = luaL_checkstring(L, 1);
+
+    int priority = LUA_CO_PRIORITY_NORMAL;
+    if      (strcmp(value, "high"  )==0) priority = LUA_CO_PRIORITY_HIGH;
+    else if (strcmp(value, "normal")==0) priority = LUA_CO_PRIORITY_NORMAL;
+    else if (strcmp(value, "low"   )==0) priority = LUA_CO_PRIORITY_LOW;
+    else return luaL_error(L, "priority must be 'high', 'normal', or 'low'");
+
+    // if the coroutine is already suspended in a list, move it; otherwise
+    // it's still on its first run and the priority applies when it yields
+    for (int p=0;p<3;p++) {
+        lua_manager_coroutine_thread_list_t *c = lua->coroutines[p];
+        lua_manager_coroutine_thread_list_t *prev = NULL;
+
+        while (c) {
+            if (c->thread==L) {
+                if (p==priority) return 0;
+
+                if (prev) prev->next = c->next;
+                if (lua->coroutines[p]==c) lua->coroutines[p] = c->next;
+                if (lua->coroutine_tails[p]==c) lua->coroutine_tails[p] = prev;
+
+                lua_manager_append_coroutine(priority, c);
+                return 0;
+            }
+            prev = c;
+            c = c->next;
+        }
+    }
+
+    lua->pending_priority = priority;
+
+    return 0;
+}
+
+// Scheduled Lua callbacks: a deadline ordered binary heap serviced once per
+// frame. Modules previously had to register update handlers and compare
+// overlay.time() themselves every frame for anything time based.
+typedef struct {
+    double deadline;
+    double interval; // 0 for one-shot timers
+    int cbi;         // 0 when the timer was cancelled
+    int id;
+} lua_timer_t;
+
+static lua_timer_t *timer_heap = NULL;
+static size_t timer_count = 0;
+static size_t timer_capacity = 0;
+static int next_timer_id = 1;
+
+static void timer_heap_push(lua_timer_t t) {
+    if (timer_count==timer_capacity) {
+        timer_capacity = timer_capacity ? timer_capacity * 2 : 16;
+        timer_heap = egoverlay_realloc(timer_heap, timer_capacity * sizeof(lua_timer_t));
+    }
+
+    size_t i = timer_count++;
+    timer_heap[i] = t;
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (timer_heap[parent].deadline <= timer_heap[i].deadline) break;
+
+        lua_timer_t tmp = timer_heap[parent];
+        timer_heap[parent] = timer_heap[i];
+        timer_heap[i] = tmp;
+        i = parent;
+    }
+}
+
+static lua_timer_t timer_heap_pop() {
+    lua_timer_t top = timer_heap[0];
+
+    timer_count--;
+    timer_heap[0] = timer_heap[timer_count];
+
+    size_t i = 0;
+    for (;;) {
+        size_t smallest = i;
+        size_t l = (i * 2) + 1;
+        size_t r = l + 1;
+
+        if (l < timer_count && timer_heap[l].deadline < timer_heap[smallest].deadline) smallest = l;
+        if (r < timer_count && timer_heap[r].deadline < timer_heap[smallest].deadline) smallest = r;
+
+        if (smallest==i) break;
+
+        lua_timer_t tmp = timer_heap[smallest];
+        timer_heap[smallest] = timer_heap[i];
+        timer_heap[i] = tmp;
+        i = smallest;
+    }
+
+    return top;
+}
+
+struct lua_timer_fire_data {
+    int cbi;
+    int unref; // one-shot timers release their callback after firing
+};
+
+static int lua_manager_run_timer_cb(lua_State *L, struct lua_timer_fire_data *data) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->cbi);
+
+    if (data->unref) lua_manager_unref_l(L, data->cbi);
+    egoverlay_free(data);
+
+    return 0;
+}
+
+// Fire everything that's due; runs once per frame before event callbacks.
+static void lua_manager_run_timers() {
+    double now = glfwGetTime();
+
+    while (timer_count && timer_heap[0].deadline <= now) {
+        lua_timer_t t = timer_heap_pop();
+
+        if (t.cbi==0) continue; // cancelled
+
+        struct lua_timer_fire_data *fire = egoverlay_calloc(1, sizeof(struct lua_timer_fire_data));
+        fire->cbi = t.cbi;
+        fire->unref = t.interval==0.0;
+
+        lua_manager_add_event_callback(&lua_manager_run_timer_cb, fire);
+
+        if (t.interval > 0.0) {
+            t.deadline = now + t.interval;
+            timer_heap_push(t);
+        }
+    }
+}
+
+static int lua_manager_add_timer(lua_State *L, double interval_value) {
+    double seconds = luaL_checknumber(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (seconds < 0) return luaL_error(L, "timer seconds must not be negative");
+
+    lua_pushvalue(L, 2);
+
+    lua_timer_t t = {0};
+    t.deadline = glfwGetTime() + seconds;
+    t.interval = interval_value > 0.0 ? seconds : 0.0;
+    t.cbi = lua_manager_ref(L);
+    t.id = next_timer_id++;
+
+    timer_heap_push(t);
+
+    lua_pushinteger(L, t.id);
+
+    return 1;
+}
+
+// Schedule a one-shot timeout for the function at cb_ind on the stack from
+// native code; used by modules (schedule engine) that arm timers themselves.
+// Returns the timer id.
+int lua_manager_schedule_timeout(lua_State *L, int cb_ind, double seconds) {
+    lua_pushvalue(L, cb_ind);
+
+    lua_timer_t t = {0};
+    t.deadline = glfwGetTime() + seconds;
+    t.interval = 0.0;
+    t.cbi = lua_manager_ref(L);
+    t.id = next_timer_id++;
+
+    timer_heap_push(t);
+
+    return t.id;
+}
+
+/*** RST
+.. lua:function:: timeout(seconds, callback)
+
+    Call ``callback`` once, ``seconds`` from now. The callback runs like an
+    event handler and may yield as a coroutine.
+
+    :param number seconds:
+    :param function callback:
+    :returns: A timer id for :lua:func:`canceltimer`.
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_timeout(lua_State *L) {
+    return lua_manager_add_timer(L, 0.0);
+}
+
+/*** RST
+.. lua:function:: interval(seconds, callback)
+
+    Call ``callback`` every ``seconds``. The next deadline is scheduled when
+    the timer fires, so slow frames don't queue a backlog of calls.
+
+    :param number seconds:
+    :param function callback:
+    :returns: A timer id for :lua:func:`canceltimer`.
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_interval(lua_State *L) {
+    return lua_manager_add_timer(L, 1.0);
+}
+
+/*** RST
+.. lua:function:: canceltimer(id)
+
+    Cancel a timer created with :lua:func:`timeout` or :lua:func:`interval`.
+
+    :param integer id:
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_cancel_timer(lua_State *L) {
+    int id = (int)luaL_checkinteger(L, 1);
+
+    for (size_t i=0;i<timer_count;i++) {
+        if (timer_heap[i].id==id && timer_heap[i].cbi) {
+            lua_manager_unref_l(L, timer_heap[i].cbi);
+            timer_heap[i].cbi = 0;
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+// Drop every event handler that was registered from the given chunk
+// source. Used when a module is hot reloaded, so its old closures stop
+// receiving events.
+static void lua_manager_remove_handlers_from(const char *source) {
+    // reload can run from inside an event dispatch that holds pointers into
+    // these lists, so nodes are tombstoned (cbi 0, skipped by dispatch)
+    // rather than unlinked and freed
+    for (size_t i=0;i<lua->event_handler_table_size;i++) {
+        for (lua_event_handler_t *h=lua->event_handlers[i];h;h=h->next) {
+            if (h->cbi && h->source && strcmp(h->source, source)==0) {
+                lua_manager_unref_l(lua->lua, h->cbi);
+                h->cbi = 0;
+            }
+        }
+    }
+}
+
+/*** RST
+.. lua:function:: reloadmodule(name)
+
+    Reload a file module in place, without restarting the Lua state.
+
+    If the loaded module is a table with a ``savestate`` function, it is
+    called first and its return value is passed to the reloaded module's
+    ``restorestate`` function (when present), so a module can carry its
+    runtime state across the reload. Event handlers registered by the old
+    module are removed before the new version loads (which re-registers its
+    own).
+
+    :param string name: The module name as passed to ``require``.
+    :returns: The reloaded module.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_reload_module(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+
+    // resolve the module's source file; embedded/native modules can't be
+    // reloaded
+    lua_getglobal(L, "package");           // 2
+    lua_getfield(L, 2, "searchpath");
+    lua_pushvalue(L, 1);
+    lua_getfield(L, 2, "path");
+    lua_call(L, 2, 1);                     // 3: path or nil
+
+    if (lua_isnil(L, 3)) return luaL_error(L, "can't reload '%s': not a file module", name);
+
+    // handlers record the chunk source as "@<path>"
+    const char *path = lua_tostring(L, 3);
+    char *source = egoverlay_calloc(strlen(path)+2, sizeof(char));
+    source[0] = '@';
+    memcpy(source+1, path, strlen(path));
+
+    lua_settop(L, 2);
+
+    lua_getfield(L, 2, "loaded");          // 3
+    lua_getfield(L, 3, name);              // 4: the old module, or nil
+
+    // snapshot the old module's state
+    int have_snapshot = 0;
+    if (lua_type(L, 4)==LUA_TTABLE) {
+        if (lua_getfield(L, 4, "savestate")==LUA_TFUNCTION) {
+            if (lua_pcall(L, 0, 1, 0)==LUA_OK) {
+                have_snapshot = 1;         // 5: the snapshot
+            } else {
+                logger_error(lua->log, "Error in %s savestate: %s", name, lua_tostring(L, -1));
+                lua_pop(L, 1);
+            }
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    if (!have_snapshot) lua_settop(L, 4);
+
+    lua_manager_remove_handlers_from(source);
+    egoverlay_free(source);
+
+    // drop the old module and load the new one
+    lua_pushnil(L);
+    lua_setfield(L, 3, name);
+
+    lua_getglobal(L, "require");
+    lua_pushvalue(L, 1);
+    if (lua_pcall(L, 1, 1, 0)!=LUA_OK) {
+        return lua_error(L); // the message is on top
+    }
+
+    // top: the new module; restore the snapshot into it
+    if (have_snapshot && lua_type(L, -1)==LUA_TTABLE) {
+        if (lua_getfield(L, -1, "restorestate")==LUA_TFUNCTION) {
+            lua_pushvalue(L, 5);
+
+            if (lua_pcall(L, 1, 0, 0)!=LUA_OK) {
+                logger_error(lua->log, "Error in %s restorestate: %s", name, lua_tostring(L, -1));
+                lua_pop(L, 1);
+            }
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    logger_info(lua->log, "Reloaded module %s.", name);
+
+    return 1;
+}
+
+// Heap profiling over the CRT debug heap that egoverlay_calloc/malloc
+// already route through (with file/line tags). A checkpoint captures the
+// heap state; the delta reports blocks/bytes allocated since, which is how
+// leaks across a repeated operation (open/close a window, change maps
+// twice) are measured. Debug builds only; release builds return nil.
+#ifdef _DEBUG
+static _CrtMemState heap_checkpoint_state;
+static int heap_checkpoint_taken = 0;
+#endif
+
+/*** RST
+.. lua:function:: heapcheckpoint()
+
+    Record the current heap state for :lua:func:`heapdelta`. Only available
+    in debug builds.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_heap_checkpoint(lua_State *L) {
+    UNUSED_PARAM(L);
+
+#ifdef _DEBUG
+    _CrtMemCheckpoint(&heap_checkpoint_state);
+    heap_checkpoint_taken = 1;
+#endif
+
+    return 0;
+}
+
+/*** RST
+.. lua:function:: heapdelta()
+
+    Return the heap growth since the last :lua:func:`heapcheckpoint` as a
+    table with ``blocks`` and ``bytes`` (overlay allocations plus normal
+    heap blocks). Returns ``nil`` in release builds or when no checkpoint
+    was taken. Run an operation twice between checkpoint and delta: a
+    nonzero steady-state delta is a leak, and the CRT dump (written to the
+    debugger output) has the file/line of every leaked block.
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_heap_delta(lua_State *L) {
+#ifdef _DEBUG
+    if (!heap_checkpoint_taken) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    _CrtMemState now_state;
+    _CrtMemState diff;
+    _CrtMemCheckpoint(&now_state);
+
+    if (!_CrtMemDifference(&diff, &heap_checkpoint_state, &now_state)) {
+        // no differences
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "blocks");
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "bytes");
+        return 1;
+    }
+
+    lua_createtable(L, 0, 2);
+
+    lua_pushinteger(L, (lua_Integer)(diff.lCounts[_CLIENT_BLOCK] + diff.lCounts[_NORMAL_BLOCK]));
+    lua_setfield(L, -2, "blocks");
+
+    lua_pushinteger(L, (lua_Integer)(diff.lSizes[_CLIENT_BLOCK] + diff.lSizes[_NORMAL_BLOCK]));
+    lua_setfield(L, -2, "bytes");
+
+    // the full statistics (and leaked block origins) go to the debugger
+    _CrtMemDumpStatistics(&diff);
+
+    return 1;
+#else
+    lua_pushnil(L);
+    return 1;
+#endif
+}
+
+/*** RST
+.. lua:function:: queuestats()
+
+    Return the current dispatch queue depths: ``events`` (queued events
+    waiting for the next frame), ``callbacks`` (pending native callbacks),
+    ``coroutines`` (a table of ``high``/``normal``/``low`` counts), and
+    ``backpressure`` (whether :overlay:event:`queue-backpressure` is in
+    effect).
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_queue_stats(lua_State *L) {
+    event_lock();
+    size_t events = event_queue_depth;
+    size_t callbacks = event_cb_depth;
+    event_unlock();
+
+    lua_createtable(L, 0, 4);
+
+    lua_pushinteger(L, (lua_Integer)events);
+    lua_setfield(L, -2, "events");
+
+    lua_pushinteger(L, (lua_Integer)callbacks);
+    lua_setfield(L, -2, "callbacks");
+
+    const char *classnames[3] = { "high", "normal", "low" };
+    lua_createtable(L, 0, 3);
+    for (int p=0;p<3;p++) {
+        int count = 0;
+        for (lua_manager_coroutine_thread_list_t *c=lua->coroutines[p];c;c=c->next) count++;
+        lua_pushinteger(L, count);
+        lua_setfield(L, -2, classnames[p]);
+    }
+    lua_setfield(L, -2, "coroutines");
+
+    lua_pushboolean(L, event_backpressure);
+    lua_setfield(L, -2, "backpressure");
+
+    return 1;
+}
+
+// anything queued for dispatch (events, native callbacks, due timers)?
+// used by the idle detector in the render loop
+int lua_manager_work_pending() {
+    event_lock();
+    int pending = event_queue!=NULL || lua->event_cbs!=NULL;
+    event_unlock();
+
+    if (!pending && timer_count && timer_heap[0].deadline <= glfwGetTime()) pending = 1;
+
+    return pending;
+}
+
+/*** RST
+.. lua:function:: journalget(key)
+
+    Read a blob from the binary state journal, or ``nil``. The journal is
+    loaded before any module, so state saved here (window geometry, last
+    map, pack lists) is available the moment a module loads — no JSON
+    parsing or re-derivation on the startup path.
+
+    :param string key:
+    :rtype: string
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_journal_get(lua_State *L) {
+    const char *key = luaL_checkstring(L, 1);
+
+    const void *data = NULL;
+    size_t length = 0;
+
+    if (!state_journal_get(key, &data, &length)) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)data, length);
+
+    return 1;
 }
 
-void lua_manager_add_coroutine_thread(lua_State *thread, int threadi) {
-    size_t cosize = sizeof(lua_manager_coroutine_thread_list_t);
-    lua_manager_coroutine_thread_list_t *coroutine = egoverlay_calloc(1, cosize);
-    coroutine->thread = thread;
-    coroutine->threadi = threadi;
+/*** RST
+.. lua:function:: journalset(key, value)
 
-    if (lua->coroutine_threads==NULL) {
-        lua->coroutine_threads = coroutine;
-        return;
-    }
-    
-    lua_manager_coroutine_thread_list_t *c = lua->coroutine_threads;
-    while (c->next) c = c->next;
-    c->next = coroutine;
-}
+    Write a blob to the state journal. Writes append a single record (no
+    full-document rewrite); superseded records are dropped by the startup
+    compaction.
 
-void lua_manager_remove_coroutine_thread(int threadi) {
-    lua_manager_coroutine_thread_list_t *c = lua->coroutine_threads;
-    lua_manager_coroutine_thread_list_t *p = NULL;
-
-    while (c) {
-        if (c->threadi == threadi) {
-            luaL_unref(lua->lua, LUA_REGISTRYINDEX, c->threadi);
-            lua_closethread(c->thread, NULL);
-            if (p) p->next = c->next;
-            if (lua->coroutine_threads==c) lua->coroutine_threads = c->next;
-            egoverlay_free(c);
-            return;
-        }
-        p = c;
-        c = c->next;
-    }
+    :param string key:
+    :param string value:
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_journal_set(lua_State *L) {
+    const char *key = luaL_checkstring(L, 1);
+    size_t length = 0;
+    const char *value = luaL_checklstring(L, 2, &length);
+
+    state_journal_set(key, value, length);
+
+    return 0;
 }
 
 void lua_manager_run_events() {
+    lua_manager_run_timers();
+
+    event_lock();
     lua_event_callback_list_t *e = lua->event_cbs;
-    lua_event_callback_list_t *prev = NULL;
+    lua->event_cbs = NULL;
+    event_cb_depth = 0;
+    event_unlock();
+
     while (e) {
         lua_event_callback_list_t *next = e->next;
 
         lua_State *cothread = lua_newthread(lua->lua);
 
         int narg = e->cb(cothread, e->data);
-        
+
+        // a negative return means the callback handled everything itself
+        // (fire and forget deliveries); nothing to resume
+        if (narg < 0) {
+            lua_pop(lua->lua, 1);
+            lua_closethread(cothread, NULL);
+
+            event_lock();
+            e->next = event_cb_node_pool;
+            event_cb_node_pool = e;
+            event_unlock();
+
+            e = next;
+            continue;
+        }
+
+        lua->pending_priority = LUA_CO_PRIORITY_NORMAL;
+
+        lua_module_stats_t *stats = lua_stats_entry(NULL);
+        double resume_start = glfwGetTime();
+
         int nres = 0;
+        if (lua_manager_profiling()) {
+            lua_sethook(cothread, &lua_manager_profile_hook, LUA_MASKCOUNT, lua_manager_profile_interval());
+        }
+
         int status = lua_resume(cothread, NULL, narg, &nres);
 
+        lua_stats_add(stats, glfwGetTime() - resume_start);
+
         if (status==LUA_YIELD) {
             // the event handler yielded, save the thread and resume it later
             if (nres) lua_pop(cothread, nres);
             
             // store the thread so it doesn't get GCd
-            int threadi = luaL_ref(lua->lua, LUA_REGISTRYINDEX);
-            lua_manager_add_coroutine_thread(cothread, threadi);
+            int threadi = lua_manager_ref(lua->lua);
+            lua_manager_add_coroutine_thread(cothread, threadi)->stats = stats;
         } else if (status==LUA_OK) {
             // no coroutine so just close the thread
             if (nres) lua_pop(cothread, nres);
@@ -670,54 +1808,113 @@ void lua_manager_run_events() {
             lua_closethread(cothread, NULL);
         }
         
-        if (lua->event_cbs==e) lua->event_cbs = e->next;
-        egoverlay_free(e);
-        if (prev) prev->next = e->next;
+        event_lock();
+        e->next = event_cb_node_pool;
+        event_cb_node_pool = e;
+        event_unlock();
+
         e = next;
     }
 }
 
 int lua_manager_resume_coroutines() {
-    lua_manager_coroutine_thread_list_t *c = lua->coroutine_threads;
-    lua_manager_coroutine_thread_list_t *p = NULL;
+    // how long one resume pass may run, so coroutine work can't blow the
+    // frame budget no matter how many are pending
+    static double budget_seconds = 0.0;
+    if (budget_seconds==0.0) {
+        settings_set_default_int(app_get_settings(), "overlay.luaCoroutineBudget", 4);
+
+        int budget_ms = 4;
+        GET_APP_SETTING_INT("overlay.luaCoroutineBudget", &budget_ms);
+        if (budget_ms < 1) budget_ms = 1;
+        budget_seconds = (double)budget_ms / 1000.0;
+    }
 
-    while (c) {
-        int nres = 0;
-        int status = lua_resume(c->thread, NULL, 0, &nres);
+    double start = glfwGetTime();
+    int out_of_time = 0;
 
-        if (status==LUA_YIELD) {
-            // coroutine yielded again, leave it in the list
-            if (nres) lua_pop(c->thread, nres);
-            p = c;
-            c = c->next;
-        } else if (status==LUA_OK) {
-            // coroutine finished, remove it and free thread
-            luaL_unref(lua->lua, LUA_REGISTRYINDEX, c->threadi);
-            lua_closethread(c->thread, NULL);
-            if (p) p->next = c->next;
-            if (lua->coroutine_threads==c) lua->coroutine_threads = c->next;
-            lua_manager_coroutine_thread_list_t *n = c->next;
-            egoverlay_free(c);
-            c = n;
-        } else {
-            // error, clean up the thread
-            const char *errmsg = luaL_checkstring(c->thread, -1);
-            luaL_traceback(lua->lua, c->thread, errmsg, 0);
-            const char *traceback = luaL_checkstring(lua->lua, -1);
+    for (int p=0;p<3 && !out_of_time;p++) {
+        // take the class list and put yielded coroutines back at the tail,
+        // so the class round robins across passes
+        lua_manager_coroutine_thread_list_t *c = lua->coroutines[p];
+        lua->coroutines[p] = NULL;
+        lua->coroutine_tails[p] = NULL;
 
-            logger_error(lua->log, "Error occurred while resuming event coroutine: %s", traceback);
-            lua_pop(lua->lua, 1);
-            lua_pop(c->thread, 1);
-            luaL_unref(lua->lua, LUA_REGISTRYINDEX, c->threadi);
-            lua_closethread(c->thread, NULL);
-            if (p) p->next = c->next;
-            if (lua->coroutine_threads==c) lua->coroutine_threads = c->next;
+        while (c) {
             lua_manager_coroutine_thread_list_t *n = c->next;
-            egoverlay_free(c);
+
+            // a running coroutine isn't in any list; if it calls
+            // coroutinepriority mid-run the new class lands here
+            lua->pending_priority = p;
+
+            double resume_start = glfwGetTime();
+
+            int nres = 0;
+            if (lua_manager_profiling()) {
+                lua_sethook(c->thread, &lua_manager_profile_hook, LUA_MASKCOUNT, lua_manager_profile_interval());
+            }
+
+            int status = lua_resume(c->thread, NULL, 0, &nres);
+
+            if (c->stats) lua_stats_add(c->stats, glfwGetTime() - resume_start);
+
+            if (status==LUA_YIELD) {
+                // coroutine yielded again, put it back
+                if (nres) lua_pop(c->thread, nres);
+                lua_manager_append_coroutine(lua->pending_priority, c);
+            } else if (status==LUA_OK) {
+                // coroutine finished, remove it and free thread
+                lua_manager_unref_l(lua->lua, c->threadi);
+                lua_closethread(c->thread, NULL);
+                egoverlay_free(c);
+            } else {
+                // error, clean up the thread
+                const char *errmsg = luaL_checkstring(c->thread, -1);
+                luaL_traceback(lua->lua, c->thread, errmsg, 0);
+                const char *traceback = luaL_checkstring(lua->lua, -1);
+
+                logger_error(lua->log, "Error occurred while resuming event coroutine: %s", traceback);
+                lua_pop(lua->lua, 1);
+                lua_pop(c->thread, 1);
+                lua_manager_unref_l(lua->lua, c->threadi);
+                lua_closethread(c->thread, NULL);
+                egoverlay_free(c);
+            }
+
             c = n;
+
+            if (glfwGetTime() - start > budget_seconds) {
+                // put whatever wasn't resumed back for the next pass
+                while (c) {
+                    n = c->next;
+                    lua_manager_append_coroutine(p, c);
+                    c = n;
+                }
+                out_of_time = 1;
+            }
         }
     }
-    return lua->coroutine_threads ? 1 : 0;
+
+    // spend whatever is left of the budget on incremental GC steps, so
+    // collection work happens in the frame's slack instead of as pauses in
+    // the middle of allocation heavy event handlers
+    double gc_start = glfwGetTime();
+    while (!out_of_time && glfwGetTime() - start < budget_seconds) {
+        if (lua_gc(lua->lua, LUA_GCSTEP, 8)) break; // a cycle just finished
+    }
+    lua_gc_seconds += glfwGetTime() - gc_start;
+
+    for (int p=0;p<3;p++) {
+        if (lua->coroutines[p]) return 1;
+    }
+
+    return 0;
+}
+
+// does anything listen for this event? producers of high frequency events
+// (the log sink) skip building payloads when nothing does
+int lua_manager_has_event_handlers(const char *event) {
+    return get_event_handlers(event)!=NULL;
 }
 
 void lua_manager_call_event_handlers(const char *event, int data_cbi) {
@@ -727,6 +1924,12 @@ void lua_manager_call_event_handlers(const char *event, int data_cbi) {
         // get the reference to the next handler since this one might remove itself
         next = h->next;
 
+        if (h->cbi==0) {
+            // tombstoned by a module reload
+            h = next;
+            continue;
+        }
+
         // run each event in its own thread, this way event handlers can
         // be coroutines and yield
         lua_State *cothread = lua_newthread(lua->lua);
@@ -737,16 +1940,27 @@ void lua_manager_call_event_handlers(const char *event, int data_cbi) {
             lua_rawgeti(cothread, LUA_REGISTRYINDEX, data_cbi);
         } else lua_pushnil(cothread);
 
+        lua->pending_priority = LUA_CO_PRIORITY_NORMAL;
+
+        lua_module_stats_t *stats = lua_stats_entry(h->source);
+        double resume_start = glfwGetTime();
+
         int nres = 0;
+        if (lua_manager_profiling()) {
+            lua_sethook(cothread, &lua_manager_profile_hook, LUA_MASKCOUNT, lua_manager_profile_interval());
+        }
+
         int status = lua_resume(cothread, NULL, 2, &nres);
 
+        lua_stats_add(stats, glfwGetTime() - resume_start);
+
         if (status==LUA_YIELD) {
             // the event handler yielded, save the thread and resume it later
             if (nres) lua_pop(cothread, nres);
             
             // store the thread so it doesn't get GCd
-            int threadi = luaL_ref(lua->lua, LUA_REGISTRYINDEX);
-            lua_manager_add_coroutine_thread(cothread, threadi);
+            int threadi = lua_manager_ref(lua->lua);
+            lua_manager_add_coroutine_thread(cothread, threadi)->stats = stats;
         } else if (status==LUA_OK) {
             // no coroutine so just close the thread
             if (nres) lua_pop(cothread, nres);
@@ -770,29 +1984,223 @@ void lua_manager_call_event_handlers(const char *event, int data_cbi) {
     }
 }
 
+// Opt-in batched subscriptions: instead of one handler call per event, all
+// events with the same name queued in a pump are delivered to a batch
+// handler as a single call with an array of payloads, amortizing the
+// C-to-Lua boundary for high frequency producers (position updates,
+// WebSocket messages).
+typedef struct lua_batch_handler_t {
+    const char *event; // interned
+    int cbi;
+    int id;
+    struct lua_batch_handler_t *next;
+} lua_batch_handler_t;
+
+static lua_batch_handler_t *batch_handlers = NULL;
+static int next_batch_handler_id = 1;
+
+/*** RST
+.. lua:function:: addbatchedeventhandler(event, handler)
+
+    Like :lua:func:`addeventhandler`, but all events with this name queued
+    in one frame arrive as a single call: ``handler(event, {data1, data2,
+    ...})``, oldest first. Use for high frequency events where per-event
+    handler calls dominate.
+
+    :param string event:
+    :param function handler:
+    :returns: A handler id for :lua:func:`removebatchedeventhandler`.
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_add_batched_event_handler(lua_State *L) {
+    size_t eventlen = 0;
+    const char *event = luaL_checklstring(L, 1, &eventlen);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    lua_batch_handler_t *h = egoverlay_calloc(1, sizeof(lua_batch_handler_t));
+    h->event = eg_intern(event);
+
+    lua_pushvalue(L, 2);
+    h->cbi = lua_manager_ref(L);
+    h->id = next_batch_handler_id++;
+
+    h->next = batch_handlers;
+    batch_handlers = h;
+
+    lua_pushinteger(L, h->id);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: removebatchedeventhandler(id)
+
+    Remove a handler added with :lua:func:`addbatchedeventhandler`.
+
+    :param integer id:
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_remove_batched_event_handler(lua_State *L) {
+    int id = (int)luaL_checkinteger(L, 1);
+
+    lua_batch_handler_t **h = &batch_handlers;
+    while (*h) {
+        if ((*h)->id==id) {
+            lua_batch_handler_t *dead = *h;
+            *h = dead->next;
+            lua_manager_unref_l(L, dead->cbi);
+            egoverlay_free(dead);
+            break;
+        }
+        h = &(*h)->next;
+    }
+
+    return 0;
+}
+
+// deliver the batches accumulated during a pump: batches is a registry
+// ref to a table of event name -> array of payloads
+static void lua_manager_deliver_batches(int batchesi) {
+    lua_State *L = lua->lua;
+
+    for (lua_batch_handler_t *h=batch_handlers;h;h=h->next) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, batchesi);
+        int btype = lua_getfield(L, -1, h->event);
+        lua_remove(L, -2);
+
+        if (btype!=LUA_TTABLE) {
+            lua_pop(L, 1);
+            continue;
+        }
+
+        // run it like an event handler coroutine. the thread has to end up
+        // below the batch array on this stack so xmove takes the array
+        lua_State *cothread = lua_newthread(L);
+        lua_insert(L, -2);
+
+        lua_rawgeti(cothread, LUA_REGISTRYINDEX, h->cbi);
+        lua_manager_push_interned(cothread, h->event, strlen(h->event));
+        lua_xmove(L, cothread, 1); // the batch array
+
+        int nres = 0;
+        if (lua_manager_profiling()) {
+            lua_sethook(cothread, &lua_manager_profile_hook, LUA_MASKCOUNT, lua_manager_profile_interval());
+        }
+
+        int status = lua_resume(cothread, NULL, 2, &nres);
+
+        if (status==LUA_YIELD) {
+            if (nres) lua_pop(cothread, nres);
+            int threadi = lua_manager_ref(L);
+            lua_manager_add_coroutine_thread(cothread, threadi);
+        } else {
+            if (status!=LUA_OK) {
+                logger_error(lua->log, "Error in batched event handler: %s", lua_tostring(cothread, -1));
+                lua_pop(cothread, 1);
+            } else if (nres) {
+                lua_pop(cothread, nres);
+            }
+            lua_pop(L, 1); // the thread
+            lua_closethread(cothread, NULL);
+        }
+    }
+}
+
+// does any batch handler want this event name?
+static int lua_manager_has_batch_handlers(const char *event) {
+    for (lua_batch_handler_t *h=batch_handlers;h;h=h->next) {
+        if (h->event==event || strcmp(h->event, event)==0) return 1;
+    }
+
+    return 0;
+}
+
 void lua_manager_run_event_queue() {
+    event_lock();
     lua_event_list_t *eq = event_queue;
-    
+
     // clear the event queue now. any events added during these events will be
     // added to a 'new' queue that will be dispatched next frame
     event_queue = NULL;
 
+    size_t depth = event_queue_depth;
+    event_queue_depth = 0;
+    event_unlock();
+
+    // backpressure: tell producers when the queue backs up, and again when
+    // it recovers
+    if (!event_backpressure && depth > EVENT_QUEUE_BACKPRESSURE) {
+        event_backpressure = 1;
+        logger_warn(lua->log, "event queue backpressure: %zu queued events", depth);
+
+        json_t *data = json_object();
+        json_object_set_new(data, "depth", json_integer((json_int_t)depth));
+        lua_manager_queue_event("queue-backpressure", data);
+        json_decref(data);
+    } else if (event_backpressure && depth < EVENT_QUEUE_BACKPRESSURE / 2) {
+        event_backpressure = 0;
+        lua_manager_queue_event("queue-backpressure-relieved", NULL);
+    }
+
+    // lazily created per pump when a batched subscription matches:
+    // { [event name] = { payload, payload, ... } }
+    int batchesi = 0;
+
     while (eq) {
         lua_event_list_t *next = eq->next;
 
         if (eq->data && !eq->data_cbi) {
             lua_pushjson(lua->lua, eq->data);
             json_decref(eq->data);
-            eq->data_cbi = luaL_ref(lua->lua, LUA_REGISTRYINDEX);
+            eq->data_cbi = lua_manager_ref(lua->lua);
+        }
+
+        if (batch_handlers && lua_manager_has_batch_handlers(eq->event)) {
+            lua_State *L = lua->lua;
+
+            if (!batchesi) {
+                lua_newtable(L);
+                batchesi = lua_manager_ref(L);
+            }
+
+            lua_rawgeti(L, LUA_REGISTRYINDEX, batchesi);
+            if (lua_getfield(L, -1, eq->event)!=LUA_TTABLE) {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, eq->event);
+            }
+
+            if (eq->data_cbi) lua_rawgeti(L, LUA_REGISTRYINDEX, eq->data_cbi);
+            else lua_pushboolean(L, 1); // placeholder for data-less events
+            lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+
+            lua_pop(L, 2); // the per-event array and the batches table
         }
 
         lua_manager_call_event_handlers(eq->event, eq->data_cbi);
 
-        egoverlay_free(eq->event);
-        if (eq->data_cbi) luaL_unref(lua->lua, LUA_REGISTRYINDEX, eq->data_cbi);
-        egoverlay_free(eq);
+        // the event name is usually interned; only one-off copies are freed
+        if (eq->event_owned) egoverlay_free(eq->event);
+        if (eq->data_cbi) lua_manager_unref_l(lua->lua, eq->data_cbi);
+
+        event_lock();
+        eq->next = event_node_pool;
+        event_node_pool = eq;
+        event_unlock();
+
         eq = next;
     }
+
+    if (batchesi) {
+        lua_manager_deliver_batches(batchesi);
+        lua_manager_unref_l(lua->lua, batchesi);
+    }
 }
 
 void lua_manager_run_event(const char *event, json_t *data) {
@@ -803,12 +2211,12 @@ void lua_manager_run_event(const char *event, json_t *data) {
     int data_cbi = 0;
     if (data) {
         lua_pushjson(lua->lua, data);
-        data_cbi = luaL_ref(lua->lua, LUA_REGISTRYINDEX);
+        data_cbi = lua_manager_ref(lua->lua);
     }
 
     lua_manager_call_event_handlers(event, data_cbi);
 
-    if (data_cbi) luaL_unref(lua->lua, LUA_REGISTRYINDEX, data_cbi);
+    if (data_cbi) lua_manager_unref_l(lua->lua, data_cbi);
 }
 
 void lua_manager_queue_event(const char *event, json_t *data) { 
@@ -816,16 +2224,19 @@ void lua_manager_queue_event(const char *event, json_t *data) {
         return;
     }
 
-    lua_event_list_t *e = egoverlay_calloc(1, sizeof(lua_event_list_t));
+    event_lock();
+
+    lua_event_list_t *e = event_node_get();
     if (data) {
         e->data = data;
         json_incref(data);
     }
-    e->event = egoverlay_calloc(strlen(event)+1, sizeof(char));
-    memcpy(e->event, event, strlen(event));
+    e->event = intern_event_name(event, &e->event_owned);
+    event_queue_depth++;
 
     if (event_queue==NULL) {
         event_queue = e;
+        event_unlock();
         return;
     }
 
@@ -833,6 +2244,8 @@ void lua_manager_queue_event(const char *event, json_t *data) {
     while (eq->next) eq = eq->next;
 
     eq->next = e;
+
+    event_unlock();
 }
 
 /*** RST
@@ -1299,3 +2712,234 @@ Events
         :0.0.1: Added
 */
 
+
+/*** RST
+.. lua:function:: degradationlevel()
+
+    Return the current auto-degradation tier: ``0`` when everything is on,
+    up to ``4`` as the GPU budget controller disables optional visual
+    features (label collision layout, sprite animation, mid LOD bucket,
+    aggressive trail culling). See the ``overlay.autoDegrade`` and
+    ``overlay.degradeGpuBudgetMs`` settings.
+
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_degradation_level(lua_State *L) {
+    lua_pushinteger(L, app_degradation_level());
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: luaprofilestart([instructions])
+
+    Start the sampling Lua profiler.
+
+    While active, a count hook fires every ``instructions`` Lua instructions
+    (default 10000) on every coroutine and records the current call stack.
+    Samples aggregate by collapsed stack, so the overhead stays low enough to
+    profile live sessions of third party modules without their source.
+
+    :param integer instructions: (Optional) Instructions between samples.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+/*** RST
+.. lua:function:: luaprofilestop(path)
+
+    Stop the profiler and write the aggregated samples to ``path`` in
+    collapsed stack format (``frame;frame;frame count`` per line), the input
+    flamegraph generators take.
+
+    :param string path:
+    :returns: The number of samples recorded.
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define LUAPROF_STACKS 1024
+#define LUAPROF_MAX_DEPTH 32
+#define LUAPROF_LINE_MAX 2048
+
+typedef struct {
+    char *stack;      // collapsed stack string
+    uint64_t count;
+} luaprof_entry_t;
+
+static int luaprof_active = 0;
+static int luaprof_interval = 10000;
+static luaprof_entry_t *luaprof_entries = NULL;
+static size_t luaprof_capacity = 0;
+static size_t luaprof_count = 0;
+static uint64_t luaprof_samples = 0;
+
+int lua_manager_profiling() {
+    return luaprof_active;
+}
+
+int lua_manager_profile_interval() {
+    return luaprof_interval;
+}
+
+static void luaprof_record(const char *stack) {
+    if (luaprof_capacity==0) {
+        luaprof_capacity = LUAPROF_STACKS;
+        luaprof_entries = egoverlay_calloc(luaprof_capacity, sizeof(luaprof_entry_t));
+    } else if (luaprof_count * 2 >= luaprof_capacity) {
+        size_t newcap = luaprof_capacity * 2;
+        luaprof_entry_t *newentries = egoverlay_calloc(newcap, sizeof(luaprof_entry_t));
+
+        for (size_t i=0;i<luaprof_capacity;i++) {
+            if (!luaprof_entries[i].stack) continue;
+
+            size_t ind = djb2_hash_string(luaprof_entries[i].stack) % newcap;
+            while (newentries[ind].stack) ind = (ind + 1) % newcap;
+            newentries[ind] = luaprof_entries[i];
+        }
+
+        egoverlay_free(luaprof_entries);
+        luaprof_entries = newentries;
+        luaprof_capacity = newcap;
+    }
+
+    size_t ind = djb2_hash_string(stack) % luaprof_capacity;
+    while (luaprof_entries[ind].stack) {
+        if (strcmp(luaprof_entries[ind].stack, stack)==0) {
+            luaprof_entries[ind].count++;
+            return;
+        }
+        ind = (ind + 1) % luaprof_capacity;
+    }
+
+    luaprof_entries[ind].stack = egoverlay_calloc(strlen(stack)+1, sizeof(char));
+    memcpy(luaprof_entries[ind].stack, stack, strlen(stack));
+    luaprof_entries[ind].count = 1;
+    luaprof_count++;
+}
+
+// the count hook: walk the stack root to leaf, build the collapsed stack
+// string, and bump its sample count
+void lua_manager_profile_hook(lua_State *L, lua_Debug *ar) {
+    UNUSED_PARAM(ar);
+
+    if (!luaprof_active) {
+        // profiling stopped; remove this thread's hook on its next fire
+        lua_sethook(L, NULL, 0, 0);
+        return;
+    }
+
+    // find the depth first so frames can be emitted root first
+    int depth = 0;
+    lua_Debug frame;
+    while (depth < 200 && lua_getstack(L, depth, &frame)) depth++;
+
+    char line[LUAPROF_LINE_MAX];
+    size_t used = 0;
+    line[0] = 0;
+
+    int start = depth - 1;
+    if (start > LUAPROF_MAX_DEPTH - 1) start = LUAPROF_MAX_DEPTH - 1;
+
+    for (int level=start;level>=0;level--) {
+        if (!lua_getstack(L, level, &frame)) continue;
+        if (!lua_getinfo(L, "Sn", &frame)) continue;
+
+        const char *name = frame.name;
+        char buf[160];
+
+        if (name) {
+            snprintf(buf, sizeof(buf), "%s:%s", frame.short_src, name);
+        } else {
+            snprintf(buf, sizeof(buf), "%s:%d", frame.short_src, frame.linedefined);
+        }
+
+        size_t len = strlen(buf);
+        if (used + len + 2 >= sizeof(line)) break;
+
+        if (used) line[used++] = ';';
+        memcpy(line + used, buf, len);
+        used += len;
+        line[used] = 0;
+    }
+
+    if (used) {
+        luaprof_record(line);
+        luaprof_samples++;
+    }
+}
+
+int overlay_lua_profile_start(lua_State *L) {
+    luaprof_interval = (int)luaL_optinteger(L, 1, 10000);
+    if (luaprof_interval < 100) luaprof_interval = 100;
+
+    luaprof_samples = 0;
+    luaprof_active = 1;
+
+    // the current thread starts sampling immediately; coroutines pick the
+    // hook up when they're next resumed
+    lua_sethook(L, &lua_manager_profile_hook, LUA_MASKCOUNT, luaprof_interval);
+
+    return 0;
+}
+
+int overlay_lua_profile_stop(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    luaprof_active = 0;
+    lua_sethook(L, NULL, 0, 0);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return luaL_error(L, "Couldn't open %s for writing.", path);
+
+    for (size_t i=0;i<luaprof_capacity;i++) {
+        if (!luaprof_entries[i].stack) continue;
+
+        fprintf(f, "%s %llu\n", luaprof_entries[i].stack, (unsigned long long)luaprof_entries[i].count);
+
+        egoverlay_free(luaprof_entries[i].stack);
+        luaprof_entries[i].stack = NULL;
+    }
+    fclose(f);
+
+    luaprof_count = 0;
+
+    lua_pushinteger(L, (lua_Integer)luaprof_samples);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: refstats()
+
+    Return registry reference accounting, for tracking down modules that
+    leak callbacks or userdata references over long sessions:
+
+    - ``outstanding``: references currently held through the manager
+    - ``peak``: the high water mark this session
+    - ``registrylen``: the raw registry table length (grows only when
+      references leak; Lua recycles released slots)
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int overlay_ref_stats(lua_State *L) {
+    lua_newtable(L);
+
+    lua_pushinteger(L, (lua_Integer)ref_outstanding);
+    lua_setfield(L, -2, "outstanding");
+    lua_pushinteger(L, (lua_Integer)ref_peak);
+    lua_setfield(L, -2, "peak");
+
+    lua_pushinteger(L, (lua_Integer)lua_rawlen(L, LUA_REGISTRYINDEX));
+    lua_setfield(L, -2, "registrylen");
+
+    return 1;
+}
@@ -29,6 +29,24 @@ void lua_manager_add_module_opener(const char *module_name, lua_manager_module_o
 
 int lua_manager_resume_coroutines();
 
+// anything queued for dispatch (events, callbacks, due timers)?
+int lua_manager_work_pending();
+
+// does anything listen for this event?
+int lua_manager_has_event_handlers(const char *event);
+
 void lua_manager_unref(int cbi);
+
+// pop the value on top of the stack into the registry with leak accounting;
+// pair with lua_manager_unref. see overlay.refstats()
+int lua_manager_ref(lua_State *L);
+
+// schedule a one-shot timeout for the function at cb_ind from native code;
+// returns the timer id (see overlay.canceltimer)
+int lua_manager_schedule_timeout(lua_State *L, int cb_ind, double seconds);
+
+// push a string through the shared intern cache; cheap for the short names
+// the overlay pushes constantly (XML names, JSON object keys)
+void lua_manager_push_interned(lua_State *L, const char *s, size_t len);
 int lua_manager_gettableref_bool(int table_ind, const char *field);
 void lua_manager_settabletref_bool(int table_ind, const char *field, int value);
@@ -0,0 +1,389 @@
+/*** RST
+msgpack
+=======
+
+.. lua:module:: msgpack
+
+.. code-block:: lua
+
+    local msgpack = require 'msgpack'
+
+Binary serialization for worker messages, the state journal, and capture
+logs.
+
+MessagePack encodes straight between Lua values and compact binary, so hot
+paths stop paying JSON's text formatting and parsing costs. Tables with
+consecutive integer keys from 1 encode as arrays; everything else encodes as
+maps. Strings are binary safe in both directions.
+*/
+#include <string.h>
+#include <stdint.h>
+#include "lua-msgpack.h"
+#include "lua-manager.h"
+#include "utils.h"
+#include <lauxlib.h>
+
+#define MSGPACK_MAX_DEPTH 64
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} mp_buffer_t;
+
+static void mp_put(mp_buffer_t *buf, const void *bytes, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        while (buf->len + len > buf->capacity) {
+            buf->capacity = buf->capacity ? buf->capacity * 2 : 256;
+        }
+        buf->data = egoverlay_realloc(buf->data, buf->capacity);
+    }
+
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+}
+
+static void mp_put_u8(mp_buffer_t *buf, uint8_t v) { mp_put(buf, &v, 1); }
+
+static void mp_put_be16(mp_buffer_t *buf, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    mp_put(buf, b, 2);
+}
+
+static void mp_put_be32(mp_buffer_t *buf, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    mp_put(buf, b, 4);
+}
+
+static void mp_put_be64(mp_buffer_t *buf, uint64_t v) {
+    uint8_t b[8];
+    for (int i=0;i<8;i++) b[i] = (uint8_t)(v >> (56 - i * 8));
+    mp_put(buf, b, 8);
+}
+
+static void mp_encode(lua_State *L, int ind, mp_buffer_t *buf, int depth);
+
+static void mp_encode_table(lua_State *L, int ind, mp_buffer_t *buf, int depth) {
+    // array when the keys are exactly 1..n
+    lua_Integer n = (lua_Integer)lua_rawlen(L, ind);
+    lua_Integer total = 0;
+
+    lua_pushnil(L);
+    while (lua_next(L, ind)) {
+        total++;
+        lua_pop(L, 1);
+    }
+
+    if (n==total) {
+        if (n < 16) mp_put_u8(buf, (uint8_t)(0x90 | n));
+        else if (n <= 0xFFFF) { mp_put_u8(buf, 0xdc); mp_put_be16(buf, (uint16_t)n); }
+        else { mp_put_u8(buf, 0xdd); mp_put_be32(buf, (uint32_t)n); }
+
+        for (lua_Integer i=1;i<=n;i++) {
+            lua_geti(L, ind, i);
+            mp_encode(L, lua_gettop(L), buf, depth);
+            lua_pop(L, 1);
+        }
+        return;
+    }
+
+    if (total < 16) mp_put_u8(buf, (uint8_t)(0x80 | total));
+    else if (total <= 0xFFFF) { mp_put_u8(buf, 0xde); mp_put_be16(buf, (uint16_t)total); }
+    else { mp_put_u8(buf, 0xdf); mp_put_be32(buf, (uint32_t)total); }
+
+    lua_pushnil(L);
+    while (lua_next(L, ind)) {
+        mp_encode(L, lua_gettop(L) - 1, buf, depth); // key
+        mp_encode(L, lua_gettop(L), buf, depth);     // value
+        lua_pop(L, 1);
+    }
+}
+
+static void mp_encode(lua_State *L, int ind, mp_buffer_t *buf, int depth) {
+    if (depth > MSGPACK_MAX_DEPTH) {
+        luaL_error(L, "msgpack.pack: table nesting too deep");
+        return;
+    }
+
+    switch (lua_type(L, ind)) {
+    case LUA_TNIL:
+        mp_put_u8(buf, 0xc0);
+        break;
+    case LUA_TBOOLEAN:
+        mp_put_u8(buf, lua_toboolean(L, ind) ? 0xc3 : 0xc2);
+        break;
+    case LUA_TNUMBER:
+        if (lua_isinteger(L, ind)) {
+            lua_Integer v = lua_tointeger(L, ind);
+
+            if (v >= 0 && v < 128) {
+                mp_put_u8(buf, (uint8_t)v);
+            } else if (v < 0 && v >= -32) {
+                mp_put_u8(buf, (uint8_t)(int8_t)v);
+            } else if (v >= INT16_MIN && v <= INT16_MAX) {
+                mp_put_u8(buf, 0xd1);
+                mp_put_be16(buf, (uint16_t)(int16_t)v);
+            } else if (v >= INT32_MIN && v <= INT32_MAX) {
+                mp_put_u8(buf, 0xd2);
+                mp_put_be32(buf, (uint32_t)(int32_t)v);
+            } else {
+                mp_put_u8(buf, 0xd3);
+                mp_put_be64(buf, (uint64_t)v);
+            }
+        } else {
+            double d = lua_tonumber(L, ind);
+            uint64_t bits = 0;
+            memcpy(&bits, &d, 8);
+            mp_put_u8(buf, 0xcb);
+            mp_put_be64(buf, bits);
+        }
+        break;
+    case LUA_TSTRING: {
+        size_t len = 0;
+        const char *s = lua_tolstring(L, ind, &len);
+
+        if (len < 32) mp_put_u8(buf, (uint8_t)(0xa0 | len));
+        else if (len <= 0xFF) { mp_put_u8(buf, 0xd9); mp_put_u8(buf, (uint8_t)len); }
+        else if (len <= 0xFFFF) { mp_put_u8(buf, 0xda); mp_put_be16(buf, (uint16_t)len); }
+        else { mp_put_u8(buf, 0xdb); mp_put_be32(buf, (uint32_t)len); }
+
+        mp_put(buf, s, len);
+        break;
+    }
+    case LUA_TTABLE:
+        mp_encode_table(L, ind, buf, depth + 1);
+        break;
+    default:
+        luaL_error(L, "msgpack.pack: can't serialize a %s", lua_typename(L, lua_type(L, ind)));
+    }
+}
+
+// ---- decoding ----
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} mp_reader_t;
+
+static int mp_need(lua_State *L, mp_reader_t *r, size_t n) {
+    if (r->pos + n > r->len) return luaL_error(L, "msgpack.unpack: truncated data");
+    return 0;
+}
+
+static uint64_t mp_read_be(mp_reader_t *r, int bytes) {
+    uint64_t v = 0;
+    for (int i=0;i<bytes;i++) v = (v << 8) | r->data[r->pos++];
+    return v;
+}
+
+static void mp_decode(lua_State *L, mp_reader_t *r, int depth);
+
+static void mp_decode_array(lua_State *L, mp_reader_t *r, lua_Integer count, int depth) {
+    // every element costs at least one byte; reject counts the remaining
+    // data can't possibly satisfy before preallocating
+    if ((size_t)count > r->len - r->pos) luaL_error(L, "msgpack.unpack: truncated data");
+
+    lua_createtable(L, (int)count, 0);
+    for (lua_Integer i=1;i<=count;i++) {
+        mp_decode(L, r, depth);
+        lua_rawseti(L, -2, i);
+    }
+}
+
+static void mp_decode_map(lua_State *L, mp_reader_t *r, lua_Integer count, int depth) {
+    if ((size_t)count > (r->len - r->pos) / 2) luaL_error(L, "msgpack.unpack: truncated data");
+
+    lua_createtable(L, 0, (int)count);
+    for (lua_Integer i=0;i<count;i++) {
+        mp_decode(L, r, depth); // key
+        mp_decode(L, r, depth); // value
+        lua_rawset(L, -3);
+    }
+}
+
+static void mp_decode(lua_State *L, mp_reader_t *r, int depth) {
+    if (depth > MSGPACK_MAX_DEPTH) {
+        luaL_error(L, "msgpack.unpack: nesting too deep");
+        return;
+    }
+
+    luaL_checkstack(L, 4, "msgpack.unpack");
+    mp_need(L, r, 1);
+
+    uint8_t b = r->data[r->pos++];
+
+    if (b < 0x80) { lua_pushinteger(L, b); return; }                 // pos fixint
+    if (b >= 0xe0) { lua_pushinteger(L, (int8_t)b); return; }        // neg fixint
+
+    if ((b & 0xf0)==0x90) { mp_decode_array(L, r, b & 0x0f, depth + 1); return; }
+    if ((b & 0xf0)==0x80) { mp_decode_map(L, r, b & 0x0f, depth + 1); return; }
+    if ((b & 0xe0)==0xa0) {
+        size_t len = b & 0x1f;
+        mp_need(L, r, len);
+        lua_pushlstring(L, (const char*)r->data + r->pos, len);
+        r->pos += len;
+        return;
+    }
+
+    switch (b) {
+    case 0xc0: lua_pushnil(L); return;
+    case 0xc2: lua_pushboolean(L, 0); return;
+    case 0xc3: lua_pushboolean(L, 1); return;
+
+    case 0xca: { // float32
+        mp_need(L, r, 4);
+        uint32_t bits = (uint32_t)mp_read_be(r, 4);
+        float f = 0;
+        memcpy(&f, &bits, 4);
+        lua_pushnumber(L, f);
+        return;
+    }
+    case 0xcb: { // float64
+        mp_need(L, r, 8);
+        uint64_t bits = mp_read_be(r, 8);
+        double d = 0;
+        memcpy(&d, &bits, 8);
+        lua_pushnumber(L, d);
+        return;
+    }
+
+    case 0xcc: mp_need(L, r, 1); lua_pushinteger(L, (lua_Integer)mp_read_be(r, 1)); return;
+    case 0xcd: mp_need(L, r, 2); lua_pushinteger(L, (lua_Integer)mp_read_be(r, 2)); return;
+    case 0xce: mp_need(L, r, 4); lua_pushinteger(L, (lua_Integer)mp_read_be(r, 4)); return;
+    case 0xcf: mp_need(L, r, 8); lua_pushinteger(L, (lua_Integer)mp_read_be(r, 8)); return;
+
+    case 0xd0: mp_need(L, r, 1); lua_pushinteger(L, (int8_t)mp_read_be(r, 1)); return;
+    case 0xd1: mp_need(L, r, 2); lua_pushinteger(L, (int16_t)mp_read_be(r, 2)); return;
+    case 0xd2: mp_need(L, r, 4); lua_pushinteger(L, (int32_t)mp_read_be(r, 4)); return;
+    case 0xd3: mp_need(L, r, 8); lua_pushinteger(L, (int64_t)mp_read_be(r, 8)); return;
+
+    case 0xd9: { // str8
+        mp_need(L, r, 1);
+        size_t len = (size_t)mp_read_be(r, 1);
+        mp_need(L, r, len);
+        lua_pushlstring(L, (const char*)r->data + r->pos, len);
+        r->pos += len;
+        return;
+    }
+    case 0xda: {
+        mp_need(L, r, 2);
+        size_t len = (size_t)mp_read_be(r, 2);
+        mp_need(L, r, len);
+        lua_pushlstring(L, (const char*)r->data + r->pos, len);
+        r->pos += len;
+        return;
+    }
+    case 0xdb: {
+        mp_need(L, r, 4);
+        size_t len = (size_t)mp_read_be(r, 4);
+        mp_need(L, r, len);
+        lua_pushlstring(L, (const char*)r->data + r->pos, len);
+        r->pos += len;
+        return;
+    }
+    case 0xc4: case 0xc5: case 0xc6: { // bin8/16/32: same as strings here
+        int lenbytes = 1 << (b - 0xc4);
+        mp_need(L, r, lenbytes);
+        size_t len = (size_t)mp_read_be(r, lenbytes);
+        mp_need(L, r, len);
+        lua_pushlstring(L, (const char*)r->data + r->pos, len);
+        r->pos += len;
+        return;
+    }
+
+    case 0xdc: mp_need(L, r, 2); mp_decode_array(L, r, (lua_Integer)mp_read_be(r, 2), depth + 1); return;
+    case 0xdd: mp_need(L, r, 4); mp_decode_array(L, r, (lua_Integer)mp_read_be(r, 4), depth + 1); return;
+    case 0xde: mp_need(L, r, 2); mp_decode_map(L, r, (lua_Integer)mp_read_be(r, 2), depth + 1); return;
+    case 0xdf: mp_need(L, r, 4); mp_decode_map(L, r, (lua_Integer)mp_read_be(r, 4), depth + 1); return;
+    }
+
+    luaL_error(L, "msgpack.unpack: unsupported type byte 0x%02x", b);
+}
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: pack(value)
+
+    Serialize a Lua value (nil, boolean, number, string, or table) to a
+    MessagePack binary string.
+
+    :returns: The packed bytes.
+    :rtype: string
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+// the grow buffer lives in a GC-owned box so an encoder error (longjmp)
+// can't leak it
+static int mp_buffer_gc(lua_State *L) {
+    mp_buffer_t *buf = (mp_buffer_t*)lua_touserdata(L, 1);
+
+    if (buf->data) {
+        egoverlay_free(buf->data);
+        buf->data = NULL;
+    }
+
+    return 0;
+}
+
+int msgpack_lua_pack(lua_State *L) {
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+
+    mp_buffer_t *buf = (mp_buffer_t*)lua_newuserdata(L, sizeof(mp_buffer_t));
+    memset(buf, 0, sizeof(mp_buffer_t));
+
+    if (luaL_newmetatable(L, "MsgpackBufferMetaTable")) {
+        lua_pushcfunction(L, &mp_buffer_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+
+    mp_encode(L, 1, buf, 0);
+
+    lua_pushlstring(L, (const char*)buf->data, buf->len);
+
+    egoverlay_free(buf->data);
+    buf->data = NULL;
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: unpack(data)
+
+    Deserialize a MessagePack binary string back to a Lua value. Raises an
+    error on truncated or unsupported data.
+
+    :param string data:
+    :returns: The decoded value.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int msgpack_lua_unpack(lua_State *L) {
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 1, &len);
+
+    mp_reader_t r = { (const uint8_t*)data, len, 0 };
+    mp_decode(L, &r, 0);
+
+    return 1;
+}
+
+int msgpack_lua_open_module(lua_State *L) {
+    lua_newtable(L);
+    lua_pushcfunction(L, &msgpack_lua_pack);
+    lua_setfield(L, -2, "pack");
+    lua_pushcfunction(L, &msgpack_lua_unpack);
+    lua_setfield(L, -2, "unpack");
+
+    return 1;
+}
+
+void msgpack_lua_init() {
+    lua_manager_add_module_opener("msgpack", &msgpack_lua_open_module);
+}
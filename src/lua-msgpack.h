@@ -0,0 +1,5 @@
+#pragma once
+
+// MessagePack serialization exposed to Lua; see lua-msgpack.c.
+
+void msgpack_lua_init();
@@ -16,21 +16,77 @@ Functions
 
 #include <windows.h>
 #include <sqlite3.h>
+#include "lua-manager.h"
+#include "mumble-link.h"
+#include "utils.h"
 #include <stdlib.h>
 #include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
+#include <jansson.h>
 #include "logging/logger.h"
 
-#include "lua-manager.h"
 
 #define DBMTNAME "db"
 #define STMTMTNAME "statement"
 
+// per connection prepared statement cache: db:execute with the same SQL
+// text (the common case, modules use literal queries) reuses the compiled
+// statement instead of re-preparing each call. least recently used entries
+// are evicted
+#define DB_STMT_CACHE_SIZE 32
+
+typedef struct {
+    char *sql;
+    sqlite3_stmt *stmt;
+    uint64_t lastused;
+} db_cached_stmt_t;
+
+typedef struct db_async_job_t db_async_job_t;
+
 typedef struct db_t {
     sqlite3 *db;
+
+    db_cached_stmt_t stmt_cache[DB_STMT_CACHE_SIZE];
+    uint64_t stmt_cache_clock;
+
+    // async query worker, created on the first queryasync. queries run
+    // serialized per connection on this thread; sharing the connection with
+    // the render thread relies on sqlite's serialized threading mode, so
+    // the build must not define SQLITE_THREADSAFE=0 (see src/meson.build)
+    HANDLE async_thread;
+    HANDLE async_mutex;
+    int async_stop;
+    db_async_job_t *async_jobs;
 } db_t;
 
+// a cell of an async result, built on the worker thread and converted to
+// Lua on the render thread
+typedef struct {
+    int type;
+    sqlite3_int64 ival;
+    double dval;
+    char *text;
+    size_t textlen;
+} db_async_cell_t;
+
+struct db_async_job_t {
+    sqlite3 *db;
+    char *sql;
+    int cbi;
+
+    int ncols;
+    char **colnames;
+
+    size_t nrows;
+    size_t rowcap;
+    db_async_cell_t *cells; // nrows * ncols
+
+    char *errmsg;
+
+    struct db_async_job_t *next;
+};
+
 typedef struct statement_t {
     db_t *db;
     sqlite3_stmt *stmt;
@@ -44,13 +100,22 @@ int lua_open_db_module(lua_State *L);
 int sqlite_lua_memory_used(lua_State *L);
 int sqlite_lua_memory_highwater(lua_State *L);
 
+static void db_async_job_free(db_async_job_t *job);
+
 int db_lua_open(lua_State *L);
 int db_lua_del(lua_State *L);
 int db_lua_prepare(lua_State *L);
 int db_lua_execute(lua_State *L);
+int db_lua_query_async(lua_State *L);
+int db_lua_maintain(lua_State *L);
+int db_lua_warmup(lua_State *L);
+int db_lua_blob_open(lua_State *L);
 
 int statement_lua_finalize(lua_State *L);
 int statement_lua_bind(lua_State *L);
+int statement_lua_run_json(lua_State *L);
+int statement_lua_exec_batch(lua_State *L);
+int statement_lua_fetch_all(lua_State *L);
 int statement_lua_step(lua_State *L);
 int statement_lua_reset(lua_State *L);
 
@@ -77,6 +142,10 @@ luaL_Reg db_funcs[] = {
     "__gc"   , &db_lua_del,
     "prepare", &db_lua_prepare,
     "execute", &db_lua_execute,
+    "queryasync", &db_lua_query_async,
+    "maintain", &db_lua_maintain,
+    "warmup"  , &db_lua_warmup,
+    "blobopen", &db_lua_blob_open,
     NULL     , NULL
 };
 
@@ -85,34 +154,75 @@ luaL_Reg statment_funcs[] = {
     "__close", &statement_lua_finalize,
     "finalize", &statement_lua_finalize,
     "bind" , &statement_lua_bind,
+    "runjson", &statement_lua_run_json,
+    "execbatch", &statement_lua_exec_batch,
+    "fetchall", &statement_lua_fetch_all,
     "step" , &statement_lua_step,
     "reset", &statement_lua_reset,
     NULL   ,  NULL
 };
 
 /*** RST
-.. lua:function:: open(db)
+.. lua:function:: open(db[, mode])
 
     Open the sqlite databse given by the string ``db``. This will usually be a
     path to a sqlite database, but it can be any valid SQLite database string.
 
+    ``mode`` may be ``'tuned'``, which applies the overlay profile (WAL
+    journaling, ``synchronous=NORMAL``, a 16MB page cache, memory mapped
+    reads, and in-memory temp storage) — use it for databases the overlay
+    reads heavily like marker packs — or ``'readonly'``, which opens a
+    read-only connection sharing this process' page cache.
+
+    :param string db:
+    :param string mode: (Optional)
     :rtype: sqlitedb
 
     .. versionhistory::
         :0.0.1: Added
+        :0.1.0: Added ``mode``
 */
 int db_lua_open(lua_State *L) {
     const char *name = luaL_checkstring(L, 1);
 
+    const char *mode = NULL;
+    if (lua_gettop(L)>=2) mode = luaL_checkstring(L, 2);
+
+    int tuned = mode && strcmp(mode, "tuned")==0;
+    int readonly = mode && strcmp(mode, "readonly")==0;
+
+    if (mode && !tuned && !readonly) return luaL_error(L, "mode must be 'tuned' or 'readonly'");
+
     sqlite3 *db = NULL;
-    int err = sqlite3_open(name, &db);
+    int err;
+
+    if (readonly) {
+        // read-only connections share the page cache with other
+        // connections to the same database in this process
+        err = sqlite3_open_v2(name, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_SHAREDCACHE, NULL);
+    } else {
+        err = sqlite3_open(name, &db);
+    }
+
     if (err!=SQLITE_OK) {
         const char *errstr = sqlite3_errstr(err);
         return luaL_error(L, "Couldn't open DB %s: %s", name, errstr);
     }
 
+    if (tuned) {
+        // the overlay profile: WAL (readers don't block the writer),
+        // relaxed fsync, a real page cache, mmap'd reads, and in-memory
+        // temp storage. WAL sticks with the database file; the rest are
+        // per connection
+        sqlite3_exec(db, "PRAGMA journal_mode=WAL",      NULL, NULL, NULL);
+        sqlite3_exec(db, "PRAGMA synchronous=NORMAL",    NULL, NULL, NULL);
+        sqlite3_exec(db, "PRAGMA cache_size=-16384",     NULL, NULL, NULL);
+        sqlite3_exec(db, "PRAGMA mmap_size=268435456",   NULL, NULL, NULL);
+        sqlite3_exec(db, "PRAGMA temp_store=MEMORY",     NULL, NULL, NULL);
+    }
+
     db_t *lua_db = (db_t*)lua_newuserdata(L, sizeof(db_t));
-    memset(lua_db, 0, sizeof(lua_db));
+    memset(lua_db, 0, sizeof(db_t));
     lua_db->db = db;
 
     if (luaL_newmetatable(L, DBMTNAME)) {
@@ -162,6 +272,29 @@ int sqlite_lua_memory_highwater(lua_State *L) {
 int db_lua_del(lua_State *L) {
     db_t *db = luaL_checkdb(L, 1);
 
+    if (db->async_thread) {
+        db->async_stop = 1;
+        WaitForSingleObject(db->async_thread, INFINITE);
+        CloseHandle(db->async_thread);
+        CloseHandle(db->async_mutex);
+
+        // jobs the worker never picked up are dropped; their callback refs
+        // stay registered, which is the safe side of this rare edge
+        db_async_job_t *job = db->async_jobs;
+        while (job) {
+            db_async_job_t *next = job->next;
+            db_async_job_free(job);
+            job = next;
+        }
+    }
+
+    for (int i=0;i<DB_STMT_CACHE_SIZE;i++) {
+        if (db->stmt_cache[i].sql) {
+            sqlite3_finalize(db->stmt_cache[i].stmt);
+            egoverlay_free(db->stmt_cache[i].sql);
+        }
+    }
+
     sqlite3_close_v2(db->db);
 
     return 0;
@@ -230,20 +363,58 @@ int db_lua_prepare(lua_State *L) {
         .. versionhistory::
             :0.0.1: Added
 */
-int db_lua_execute(lua_State *L) {
-    db_t *db = luaL_checkdb(L, 1);
-    const char *sql = luaL_checkstring(L, 2);
+// Fetch (or prepare and cache) the statement for sql. The returned
+// statement is reset and ready to step; it stays owned by the cache.
+static sqlite3_stmt *db_cached_statement(lua_State *L, db_t *db, const char *sql) {
+    db->stmt_cache_clock++;
+
+    db_cached_stmt_t *victim = &db->stmt_cache[0];
+
+    for (int i=0;i<DB_STMT_CACHE_SIZE;i++) {
+        db_cached_stmt_t *e = &db->stmt_cache[i];
+
+        if (e->sql && strcmp(e->sql, sql)==0) {
+            e->lastused = db->stmt_cache_clock;
+            sqlite3_reset(e->stmt);
+            sqlite3_clear_bindings(e->stmt);
+            return e->stmt;
+        }
+
+        if (!e->sql) {
+            victim = e;
+        } else if (victim->sql && e->lastused < victim->lastused) {
+            victim = e;
+        }
+    }
 
     sqlite3_stmt *stmt = NULL;
-    int r = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
+    if (sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL)!=SQLITE_OK) {
+        luaL_error(L, "Couldn't prepare statement: %s", sqlite3_errmsg(db->db));
+        return NULL;
+    }
 
-    if (r!=SQLITE_OK) {
-        return luaL_error(L, "Couldn't prepare statement: %s", sqlite3_errmsg(db->db));
+    if (victim->sql) {
+        sqlite3_finalize(victim->stmt);
+        egoverlay_free(victim->sql);
     }
 
-    r = sqlite3_step(stmt);
+    victim->sql = egoverlay_calloc(strlen(sql)+1, sizeof(char));
+    memcpy(victim->sql, sql, strlen(sql));
+    victim->stmt = stmt;
+    victim->lastused = db->stmt_cache_clock;
+
+    return stmt;
+}
+
+int db_lua_execute(lua_State *L) {
+    db_t *db = luaL_checkdb(L, 1);
+    const char *sql = luaL_checkstring(L, 2);
+
+    sqlite3_stmt *stmt = db_cached_statement(L, db, sql);
+
+    int r = sqlite3_step(stmt);
     if (r==SQLITE_DONE) {
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return 0;
     }
 
@@ -274,11 +445,11 @@ int db_lua_execute(lua_State *L) {
             }
             lua_setfield(L, -2, cname);
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return 1;
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     return luaL_error(L, "Error during statement:step : (%d) %s", r, sqlite3_errmsg(db->db));
 }
@@ -500,3 +671,900 @@ int statement_lua_finalize(lua_State *L) {
 
     return 0;
 }
+
+/*** RST
+    .. lua:method:: runjson(json)
+
+        Execute this statement once per element of a JSON array, binding each
+        object's fields to the statement's named parameters, entirely in
+        native code. The parameter names (without the leading ``:``) are
+        looked up as keys in each object; missing keys bind NULL. The
+        statement is reset between rows.
+
+        This is the bulk ingestion path for API sync: a payload of thousands
+        of rows goes straight from the JSON text into the database without
+        materializing Lua tables.
+
+        :param string json: A JSON array of objects.
+        :returns: The number of rows executed.
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int statement_lua_run_json(lua_State *L) {
+    statement_t *stmt = luaL_checkstatement(L, 1);
+
+    size_t jsonlen = 0;
+    const char *jsonstr = luaL_checklstring(L, 2, &jsonlen);
+
+    json_error_t jerr = {0};
+    json_t *root = json_loadb(jsonstr, jsonlen, 0, &jerr);
+
+    if (!root) return luaL_error(L, "couldn't parse json: %s (line %d)", jerr.text, jerr.line);
+
+    if (!json_is_array(root)) {
+        json_decref(root);
+        return luaL_error(L, "runjson requires a json array");
+    }
+
+    int param_count = sqlite3_bind_parameter_count(stmt->stmt);
+
+    size_t rows = json_array_size(root);
+    for (size_t row=0;row<rows;row++) {
+        json_t *obj = json_array_get(root, row);
+
+        if (!json_is_object(obj)) {
+            json_decref(root);
+            return luaL_error(L, "runjson array element %d is not an object", (int)row + 1);
+        }
+
+        sqlite3_reset(stmt->stmt);
+
+        for (int p=1;p<=param_count;p++) {
+            const char *pname = sqlite3_bind_parameter_name(stmt->stmt, p);
+
+            json_t *val = NULL;
+            if (pname && pname[0]) val = json_object_get(obj, pname + 1); // skip : or @ or $
+
+            if (!val || json_is_null(val)) {
+                sqlite3_bind_null(stmt->stmt, p);
+            } else if (json_is_integer(val)) {
+                sqlite3_bind_int64(stmt->stmt, p, json_integer_value(val));
+            } else if (json_is_real(val)) {
+                sqlite3_bind_double(stmt->stmt, p, json_real_value(val));
+            } else if (json_is_boolean(val)) {
+                sqlite3_bind_int(stmt->stmt, p, json_is_true(val) ? 1 : 0);
+            } else if (json_is_string(val)) {
+                sqlite3_bind_text(stmt->stmt, p, json_string_value(val), -1, SQLITE_TRANSIENT);
+            } else {
+                // arrays/objects are stored as their JSON text
+                char *dump = json_dumps(val, JSON_COMPACT);
+                sqlite3_bind_text(stmt->stmt, p, dump, -1, SQLITE_TRANSIENT);
+                free(dump);
+            }
+        }
+
+        int r = sqlite3_step(stmt->stmt);
+        if (r!=SQLITE_DONE && r!=SQLITE_ROW) {
+            const char *msg = sqlite3_errmsg(stmt->db->db);
+            json_decref(root);
+            return luaL_error(L, "runjson step failed on row %d: %s", (int)row + 1, msg);
+        }
+    }
+
+    sqlite3_reset(stmt->stmt);
+    json_decref(root);
+
+    lua_pushinteger(L, (lua_Integer)rows);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: execbatch(rows)
+
+        Execute this statement once per element of ``rows`` inside a single
+        implicit transaction. Each element is a table; named parameters are
+        bound from its keys (without the leading ``:``) and numbered
+        parameters from its sequence part. The statement is reset between
+        rows.
+
+        :param table rows:
+        :returns: The number of rows executed.
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int statement_lua_exec_batch(lua_State *L) {
+    statement_t *stmt = luaL_checkstatement(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    if (stmt->stmt==NULL) return luaL_error(L, "Can't execute a statement after it has been finalized.");
+
+    size_t count = luaL_len(L, 2);
+    int param_count = sqlite3_bind_parameter_count(stmt->stmt);
+
+    // one transaction around the whole batch; per-row transactions are what
+    // makes bulk inserts slow
+    int autocommit = sqlite3_get_autocommit(stmt->db->db);
+    if (autocommit) sqlite3_exec(stmt->db->db, "BEGIN", NULL, NULL, NULL);
+
+    for (size_t row=1;row<=count;row++) {
+        if (lua_geti(L, 2, row)!=LUA_TTABLE) {
+            if (autocommit) sqlite3_exec(stmt->db->db, "ROLLBACK", NULL, NULL, NULL);
+            return luaL_error(L, "execbatch row %d is not a table", (int)row);
+        }
+
+        int rowind = lua_gettop(L);
+
+        sqlite3_reset(stmt->stmt);
+
+        for (int p=1;p<=param_count;p++) {
+            const char *pname = sqlite3_bind_parameter_name(stmt->stmt, p);
+
+            if (pname && pname[0]) {
+                lua_getfield(L, rowind, pname + 1);
+            } else {
+                lua_geti(L, rowind, p);
+            }
+
+            switch (lua_type(L, -1)) {
+            case LUA_TNIL:
+                sqlite3_bind_null(stmt->stmt, p);
+                break;
+            case LUA_TNUMBER:
+                if (lua_isinteger(L, -1)) sqlite3_bind_int64(stmt->stmt, p, lua_tointeger(L, -1));
+                else sqlite3_bind_double(stmt->stmt, p, lua_tonumber(L, -1));
+                break;
+            case LUA_TBOOLEAN:
+                sqlite3_bind_int(stmt->stmt, p, lua_toboolean(L, -1));
+                break;
+            case LUA_TSTRING: {
+                size_t len = 0;
+                const char *s = lua_tolstring(L, -1, &len);
+                sqlite3_bind_text(stmt->stmt, p, s, (int)len, SQLITE_TRANSIENT);
+                break;
+            }
+            default:
+                if (autocommit) sqlite3_exec(stmt->db->db, "ROLLBACK", NULL, NULL, NULL);
+                return luaL_error(L, "execbatch row %d: can't bind Lua type %s",
+                                  (int)row, lua_typename(L, lua_type(L, -1)));
+            }
+
+            lua_pop(L, 1);
+        }
+
+        int r = sqlite3_step(stmt->stmt);
+        if (r!=SQLITE_DONE && r!=SQLITE_ROW) {
+            const char *msg = sqlite3_errmsg(stmt->db->db);
+            if (autocommit) sqlite3_exec(stmt->db->db, "ROLLBACK", NULL, NULL, NULL);
+            return luaL_error(L, "execbatch step failed on row %d: %s", (int)row, msg);
+        }
+
+        lua_pop(L, 1); // the row table
+    }
+
+    sqlite3_reset(stmt->stmt);
+
+    if (autocommit) sqlite3_exec(stmt->db->db, "COMMIT", NULL, NULL, NULL);
+
+    lua_pushinteger(L, (lua_Integer)count);
+
+    return 1;
+}
+
+static DWORD WINAPI db_async_thread_fn(LPVOID param);
+
+static void db_async_job_free(db_async_job_t *job) {
+    for (size_t c=0;c<job->nrows * job->ncols;c++) {
+        if (job->cells[c].text) egoverlay_free(job->cells[c].text);
+    }
+    if (job->cells) egoverlay_free(job->cells);
+
+    for (int c=0;c<job->ncols;c++) egoverlay_free(job->colnames[c]);
+    if (job->colnames) egoverlay_free(job->colnames);
+
+    if (job->errmsg) egoverlay_free(job->errmsg);
+    egoverlay_free(job->sql);
+    egoverlay_free(job);
+}
+
+// render thread: convert the collected rows to Lua tables and run the
+// callback as callback(rows) or callback(nil, errmsg)
+static int db_async_deliver(lua_State *L, db_async_job_t *job) {
+    // fire and forget jobs (maintenance, warmup) have no callback; surface
+    // errors in the log and drop the results
+    if (job->cbi==0) {
+        if (job->errmsg) {
+            logger_t *log = logger_get("sqlite");
+            logger_warn(log, "background job failed: %s", job->errmsg);
+        }
+        db_async_job_free(job);
+        return -1;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, job->cbi);
+    luaL_unref(L, LUA_REGISTRYINDEX, job->cbi);
+
+    if (job->errmsg) {
+        lua_pushnil(L);
+        lua_pushstring(L, job->errmsg);
+        db_async_job_free(job);
+        return 2;
+    }
+
+    lua_createtable(L, (int)job->nrows, 0);
+
+    for (size_t r=0;r<job->nrows;r++) {
+        lua_createtable(L, 0, job->ncols);
+
+        for (int c=0;c<job->ncols;c++) {
+            db_async_cell_t *cell = &job->cells[(r * job->ncols) + c];
+
+            switch (cell->type) {
+            case SQLITE_INTEGER: lua_pushinteger(L, cell->ival); break;
+            case SQLITE_FLOAT  : lua_pushnumber(L, cell->dval); break;
+            case SQLITE_TEXT   :
+            case SQLITE_BLOB   : lua_pushlstring(L, cell->text, cell->textlen); break;
+            default            : lua_pushnil(L); break;
+            }
+
+            lua_setfield(L, -2, job->colnames[c]);
+        }
+
+        lua_seti(L, -2, (lua_Integer)r + 1);
+    }
+
+    db_async_job_free(job);
+
+    return 1;
+}
+
+// worker thread: run the query and collect the full result
+static void db_async_run(db_async_job_t *job) {
+    sqlite3_stmt *stmt = NULL;
+
+    if (sqlite3_prepare_v2(job->db, job->sql, -1, &stmt, NULL)!=SQLITE_OK) {
+        const char *msg = sqlite3_errmsg(job->db);
+        job->errmsg = egoverlay_calloc(strlen(msg)+1, sizeof(char));
+        memcpy(job->errmsg, msg, strlen(msg));
+        return;
+    }
+
+    job->ncols = sqlite3_column_count(stmt);
+    job->colnames = egoverlay_calloc(job->ncols, sizeof(char*));
+    for (int c=0;c<job->ncols;c++) {
+        const char *name = sqlite3_column_name(stmt, c);
+        job->colnames[c] = egoverlay_calloc(strlen(name)+1, sizeof(char));
+        memcpy(job->colnames[c], name, strlen(name));
+    }
+
+    int r = 0;
+    while ((r=sqlite3_step(stmt))==SQLITE_ROW) {
+        if (job->nrows==job->rowcap) {
+            job->rowcap = job->rowcap ? job->rowcap * 2 : 64;
+            job->cells = egoverlay_realloc(job->cells, job->rowcap * job->ncols * sizeof(db_async_cell_t));
+        }
+
+        db_async_cell_t *row = job->cells + (job->nrows * job->ncols);
+        memset(row, 0, job->ncols * sizeof(db_async_cell_t));
+
+        for (int c=0;c<job->ncols;c++) {
+            row[c].type = sqlite3_column_type(stmt, c);
+
+            switch (row[c].type) {
+            case SQLITE_INTEGER:
+                row[c].ival = sqlite3_column_int64(stmt, c);
+                break;
+            case SQLITE_FLOAT:
+                row[c].dval = sqlite3_column_double(stmt, c);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const void *data = row[c].type==SQLITE_TEXT
+                    ? (const void*)sqlite3_column_text(stmt, c)
+                    : sqlite3_column_blob(stmt, c);
+                row[c].textlen = (size_t)sqlite3_column_bytes(stmt, c);
+                row[c].text = egoverlay_malloc(row[c].textlen + 1);
+                if (row[c].textlen) memcpy(row[c].text, data, row[c].textlen);
+                row[c].text[row[c].textlen] = 0;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        job->nrows++;
+    }
+
+    if (r!=SQLITE_DONE) {
+        const char *msg = sqlite3_errmsg(job->db);
+        job->errmsg = egoverlay_calloc(strlen(msg)+1, sizeof(char));
+        memcpy(job->errmsg, msg, strlen(msg));
+    }
+
+    sqlite3_finalize(stmt);
+}
+
+// queue a job on the connection's worker, creating it on first use
+static void db_async_submit(db_t *db, db_async_job_t *job) {
+    if (!db->async_thread) {
+        db->async_mutex = CreateMutex(0, FALSE, NULL);
+
+        DWORD tid = 0;
+        db->async_thread = CreateThread(0, 0, &db_async_thread_fn, db, 0, &tid);
+    }
+
+    WaitForSingleObject(db->async_mutex, INFINITE);
+
+    if (db->async_jobs==NULL) {
+        db->async_jobs = job;
+    } else {
+        db_async_job_t *last = db->async_jobs;
+        while (last->next) last = last->next;
+        last->next = job;
+    }
+
+    ReleaseMutex(db->async_mutex);
+}
+
+// fire and forget SQL on the worker (maintenance, cache warmup). errors are
+// logged instead of delivered
+static void db_async_submit_sql(db_t *db, const char *sql) {
+    db_async_job_t *job = egoverlay_calloc(1, sizeof(db_async_job_t));
+    job->db = db->db;
+    job->sql = egoverlay_calloc(strlen(sql)+1, sizeof(char));
+    memcpy(job->sql, sql, strlen(sql));
+    job->cbi = 0;
+
+    db_async_submit(db, job);
+}
+
+static DWORD WINAPI db_async_thread_fn(LPVOID param) {
+    db_t *db = (db_t*)param;
+
+    while (!db->async_stop) {
+        WaitForSingleObject(db->async_mutex, INFINITE);
+        db_async_job_t *jobs = db->async_jobs;
+        db->async_jobs = NULL;
+        ReleaseMutex(db->async_mutex);
+
+        if (!jobs) {
+            Sleep(5);
+            continue;
+        }
+
+        while (jobs) {
+            db_async_job_t *job = jobs;
+            jobs = job->next;
+            job->next = NULL;
+
+            db_async_run(job);
+            lua_manager_add_event_callback((lua_manager_event_callback*)&db_async_deliver, job);
+        }
+    }
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: queryasync(sql, callback)
+
+        Run a query on this connection's worker thread and deliver the full
+        result to ``callback(rows)`` (or ``callback(nil, errmsg)``) without
+        ever blocking the render thread. Queries on one connection run
+        serialized, in submission order.
+
+        .. code-block:: lua
+            :caption: Coroutine style usage
+
+            local rows, err
+            local finished = false
+
+            db:queryasync('SELECT * FROM markers WHERE mapid = 50', function(r, e)
+                rows, err = r, e
+                finished = true
+            end)
+
+            while not finished do coroutine.yield() end
+
+        :param string sql:
+        :param function callback:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int db_lua_query_async(lua_State *L) {
+    db_t *db = luaL_checkdb(L, 1);
+    size_t sqllen = 0;
+    const char *sql = luaL_checklstring(L, 2, &sqllen);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    db_async_job_t *job = egoverlay_calloc(1, sizeof(db_async_job_t));
+    job->db = db->db;
+    job->sql = egoverlay_calloc(sqllen+1, sizeof(char));
+    memcpy(job->sql, sql, sqllen);
+
+    lua_pushvalue(L, 3);
+    job->cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    db_async_submit(db, job);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: fetchall()
+
+        Step the statement to completion and return the whole result as a
+        packed :lua:class:`sqliteresult` userdata instead of one Lua table
+        per row. For large fetches (the markers query on map change) this
+        avoids creating tens of thousands of short lived tables; values are
+        converted lazily through the accessors.
+
+        :rtype: sqliteresult
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+
+#define SQLITE_RESULT_MT "sqliteresult"
+#define luaL_checksqliteresult(L, ind) (sqlite_result_t*)luaL_checkudata(L, ind, SQLITE_RESULT_MT)
+
+typedef struct {
+    int ncols;
+    size_t nrows;
+
+    char **colnames;
+
+    // packed cells, indexed row * ncols + col
+    uint8_t *types;
+    sqlite3_int64 *ivals;
+    double *dvals;
+    char **texts;
+    size_t *textlens;
+} sqlite_result_t;
+
+int sqlite_result_lua_del(lua_State *L);
+int sqlite_result_lua_rows(lua_State *L);
+int sqlite_result_lua_cols(lua_State *L);
+int sqlite_result_lua_colname(lua_State *L);
+int sqlite_result_lua_get(lua_State *L);
+int sqlite_result_lua_row(lua_State *L);
+
+static luaL_Reg sqlite_result_funcs[] = {
+    "__gc"   , &sqlite_result_lua_del,
+    "rows"   , &sqlite_result_lua_rows,
+    "cols"   , &sqlite_result_lua_cols,
+    "colname", &sqlite_result_lua_colname,
+    "get"    , &sqlite_result_lua_get,
+    "row"    , &sqlite_result_lua_row,
+    NULL     , NULL
+};
+
+int statement_lua_fetch_all(lua_State *L) {
+    statement_t *stmt = luaL_checkstatement(L, 1);
+
+    if (stmt->stmt==NULL) return luaL_error(L, "Can't fetch from a statement after it has been finalized.");
+
+    sqlite_result_t *res = lua_newuserdata(L, sizeof(sqlite_result_t));
+    memset(res, 0, sizeof(sqlite_result_t));
+
+    if (luaL_newmetatable(L, SQLITE_RESULT_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, sqlite_result_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    res->ncols = sqlite3_column_count(stmt->stmt);
+
+    res->colnames = egoverlay_calloc(res->ncols, sizeof(char*));
+    for (int c=0;c<res->ncols;c++) {
+        const char *name = sqlite3_column_name(stmt->stmt, c);
+        res->colnames[c] = egoverlay_calloc(strlen(name)+1, sizeof(char));
+        memcpy(res->colnames[c], name, strlen(name));
+    }
+
+    size_t rowcap = 0;
+
+    int r = 0;
+    while ((r=sqlite3_step(stmt->stmt))==SQLITE_ROW) {
+        if (res->nrows==rowcap) {
+            rowcap = rowcap ? rowcap * 2 : 256;
+            res->types    = egoverlay_realloc(res->types   , rowcap * res->ncols * sizeof(uint8_t));
+            res->ivals    = egoverlay_realloc(res->ivals   , rowcap * res->ncols * sizeof(sqlite3_int64));
+            res->dvals    = egoverlay_realloc(res->dvals   , rowcap * res->ncols * sizeof(double));
+            res->texts    = egoverlay_realloc(res->texts   , rowcap * res->ncols * sizeof(char*));
+            res->textlens = egoverlay_realloc(res->textlens, rowcap * res->ncols * sizeof(size_t));
+        }
+
+        for (int c=0;c<res->ncols;c++) {
+            size_t ind = (res->nrows * res->ncols) + c;
+
+            res->types[ind] = (uint8_t)sqlite3_column_type(stmt->stmt, c);
+            res->texts[ind] = NULL;
+            res->textlens[ind] = 0;
+
+            switch (res->types[ind]) {
+            case SQLITE_INTEGER:
+                res->ivals[ind] = sqlite3_column_int64(stmt->stmt, c);
+                break;
+            case SQLITE_FLOAT:
+                res->dvals[ind] = sqlite3_column_double(stmt->stmt, c);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const void *data = res->types[ind]==SQLITE_TEXT
+                    ? (const void*)sqlite3_column_text(stmt->stmt, c)
+                    : sqlite3_column_blob(stmt->stmt, c);
+                res->textlens[ind] = (size_t)sqlite3_column_bytes(stmt->stmt, c);
+                res->texts[ind] = egoverlay_malloc(res->textlens[ind] + 1);
+                if (res->textlens[ind]) memcpy(res->texts[ind], data, res->textlens[ind]);
+                res->texts[ind][res->textlens[ind]] = 0;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        res->nrows++;
+    }
+
+    sqlite3_reset(stmt->stmt);
+
+    if (r!=SQLITE_DONE) {
+        return luaL_error(L, "Error during fetchall: %s", sqlite3_errmsg(stmt->db->db));
+    }
+
+    return 1;
+}
+
+int sqlite_result_lua_del(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+
+    for (size_t i=0;i<res->nrows * res->ncols;i++) {
+        if (res->texts[i]) egoverlay_free(res->texts[i]);
+    }
+
+    if (res->types) {
+        egoverlay_free(res->types);
+        egoverlay_free(res->ivals);
+        egoverlay_free(res->dvals);
+        egoverlay_free(res->texts);
+        egoverlay_free(res->textlens);
+    }
+
+    for (int c=0;c<res->ncols;c++) egoverlay_free(res->colnames[c]);
+    egoverlay_free(res->colnames);
+
+    return 0;
+}
+
+/*** RST
+.. lua:class:: sqliteresult
+
+    A packed query result, see :lua:meth:`statement.fetchall`. Rows and
+    columns are 1-indexed.
+
+    .. lua:method:: rows()
+
+        :rtype: integer
+
+    .. lua:method:: cols()
+
+        :rtype: integer
+
+    .. lua:method:: colname(col)
+
+        :rtype: string
+
+    .. lua:method:: get(row, col)
+
+        Return a single value.
+
+    .. lua:method:: row(row)
+
+        Materialize one row as a table keyed by column name.
+
+        :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int sqlite_result_lua_rows(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+    lua_pushinteger(L, (lua_Integer)res->nrows);
+    return 1;
+}
+
+int sqlite_result_lua_cols(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+    lua_pushinteger(L, res->ncols);
+    return 1;
+}
+
+int sqlite_result_lua_colname(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+    int col = (int)luaL_checkinteger(L, 2);
+
+    if (col < 1 || col > res->ncols) return luaL_error(L, "column out of range");
+
+    lua_pushstring(L, res->colnames[col-1]);
+    return 1;
+}
+
+static void sqlite_result_push_cell(lua_State *L, sqlite_result_t *res, size_t row, int col) {
+    size_t ind = (row * res->ncols) + col;
+
+    switch (res->types[ind]) {
+    case SQLITE_INTEGER: lua_pushinteger(L, res->ivals[ind]); break;
+    case SQLITE_FLOAT  : lua_pushnumber(L, res->dvals[ind]); break;
+    case SQLITE_TEXT   :
+    case SQLITE_BLOB   : lua_pushlstring(L, res->texts[ind], res->textlens[ind]); break;
+    default            : lua_pushnil(L); break;
+    }
+}
+
+int sqlite_result_lua_get(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+    lua_Integer row = luaL_checkinteger(L, 2);
+    lua_Integer col = luaL_checkinteger(L, 3);
+
+    if (row < 1 || (size_t)row > res->nrows) return luaL_error(L, "row out of range");
+    if (col < 1 || col > res->ncols) return luaL_error(L, "column out of range");
+
+    sqlite_result_push_cell(L, res, (size_t)row - 1, (int)col - 1);
+
+    return 1;
+}
+
+int sqlite_result_lua_row(lua_State *L) {
+    sqlite_result_t *res = luaL_checksqliteresult(L, 1);
+    lua_Integer row = luaL_checkinteger(L, 2);
+
+    if (row < 1 || (size_t)row > res->nrows) return luaL_error(L, "row out of range");
+
+    lua_createtable(L, 0, res->ncols);
+    for (int c=0;c<res->ncols;c++) {
+        sqlite_result_push_cell(L, res, (size_t)row - 1, c);
+        lua_setfield(L, -2, res->colnames[c]);
+    }
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: maintain()
+
+        Run WAL checkpointing and query-planner maintenance on this
+        connection's worker thread — unless the player is in combat, in
+        which case nothing happens and ``false`` is returned. Call
+        periodically from a timer; the check makes it safe to call blindly.
+
+        :returns: ``true`` when maintenance was queued.
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int db_lua_maintain(lua_State *L) {
+    db_t *db = luaL_checkdb(L, 1);
+
+    // never land a checkpoint mid-combat; the caller's next tick retries
+    if (mumble_link_in_combat()) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    db_async_submit_sql(db, "PRAGMA wal_checkpoint(TRUNCATE)");
+    db_async_submit_sql(db, "PRAGMA optimize");
+
+    lua_pushboolean(L, 1);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: warmup(queries)
+
+        Run a list of queries on the worker thread, discarding results.
+        Meant for startup: touching the hot tables and indexes pulls their
+        pages into the cache so the first real query (the markers map-change
+        query) doesn't pay cold I/O.
+
+        :param table queries: A sequence of SQL strings.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int db_lua_warmup(lua_State *L) {
+    db_t *db = luaL_checkdb(L, 1);
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    lua_Integer n = luaL_len(L, 2);
+    for (lua_Integer i=1;i<=n;i++) {
+        if (lua_geti(L, 2, i)==LUA_TSTRING) {
+            db_async_submit_sql(db, lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: blobopen(table, column, rowid[, readwrite])
+
+        Open a blob value for incremental I/O. Large values (pack textures,
+        capture logs) stream through bounded chunks instead of materializing
+        as whole Lua strings.
+
+        :param string table:
+        :param string column:
+        :param integer rowid:
+        :param boolean readwrite: (Optional) Open for writing too.
+        :rtype: sqliteblob
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+
+#define SQLITE_BLOB_MT "sqliteblob"
+
+typedef struct {
+    sqlite3_blob *blob;
+} lua_sqlite_blob_t;
+
+#define luaL_checkblob(L, ind) (lua_sqlite_blob_t*)luaL_checkudata(L, ind, SQLITE_BLOB_MT)
+
+int sqlite_blob_lua_read(lua_State *L);
+int sqlite_blob_lua_write(lua_State *L);
+int sqlite_blob_lua_length(lua_State *L);
+int sqlite_blob_lua_close(lua_State *L);
+
+static luaL_Reg sqlite_blob_funcs[] = {
+    "read"  , &sqlite_blob_lua_read,
+    "write" , &sqlite_blob_lua_write,
+    "length", &sqlite_blob_lua_length,
+    "close" , &sqlite_blob_lua_close,
+    "__gc"  , &sqlite_blob_lua_close,
+    NULL    , NULL
+};
+
+int db_lua_blob_open(lua_State *L) {
+    db_t *db = luaL_checkdb(L, 1);
+    const char *table = luaL_checkstring(L, 2);
+    const char *column = luaL_checkstring(L, 3);
+    sqlite3_int64 rowid = (sqlite3_int64)luaL_checkinteger(L, 4);
+    int readwrite = lua_toboolean(L, 5);
+
+    sqlite3_blob *blob = NULL;
+    int r = sqlite3_blob_open(db->db, "main", table, column, rowid, readwrite, &blob);
+
+    if (r!=SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushstring(L, sqlite3_errmsg(db->db));
+        return 2;
+    }
+
+    lua_sqlite_blob_t *b = lua_newuserdata(L, sizeof(lua_sqlite_blob_t));
+    b->blob = blob;
+
+    if (luaL_newmetatable(L, SQLITE_BLOB_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, sqlite_blob_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+/*** RST
+.. lua:class:: sqliteblob
+
+    .. lua:method:: read(offset, len)
+
+        Read ``len`` bytes starting at ``offset`` (0-based). Returns the
+        bytes as a binary-safe string, or ``nil`` and an error message.
+
+        :param integer offset:
+        :param integer len:
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sqlite_blob_lua_read(lua_State *L) {
+    lua_sqlite_blob_t *b = luaL_checkblob(L, 1);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    lua_Integer len = luaL_checkinteger(L, 3);
+
+    if (!b->blob) return luaL_error(L, "blob is closed");
+    if (len < 0 || offset < 0) return luaL_error(L, "offset and len must not be negative");
+
+    luaL_Buffer buf;
+    char *out = luaL_buffinitsize(L, &buf, (size_t)len);
+
+    if (sqlite3_blob_read(b->blob, out, (int)len, (int)offset)!=SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushstring(L, "blob read failed");
+        return 2;
+    }
+
+    luaL_pushresultsize(&buf, (size_t)len);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: write(offset, data)
+
+        Write ``data`` at ``offset``. The blob's size is fixed at open; use
+        a zeroblob() column value to reserve space.
+
+        :param integer offset:
+        :param string data:
+        :returns: ``true`` on success.
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sqlite_blob_lua_write(lua_State *L) {
+    lua_sqlite_blob_t *b = luaL_checkblob(L, 1);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 3, &len);
+
+    if (!b->blob) return luaL_error(L, "blob is closed");
+
+    lua_pushboolean(L, sqlite3_blob_write(b->blob, data, (int)len, (int)offset)==SQLITE_OK);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: length()
+
+        Return the blob's size in bytes.
+
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sqlite_blob_lua_length(lua_State *L) {
+    lua_sqlite_blob_t *b = luaL_checkblob(L, 1);
+
+    if (!b->blob) return luaL_error(L, "blob is closed");
+
+    lua_pushinteger(L, sqlite3_blob_bytes(b->blob));
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: close()
+
+        Close the blob handle. Safe to call more than once.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int sqlite_blob_lua_close(lua_State *L) {
+    lua_sqlite_blob_t *b = luaL_checkblob(L, 1);
+
+    if (b->blob) {
+        sqlite3_blob_close(b->blob);
+        b->blob = NULL;
+    }
+
+    return 0;
+}
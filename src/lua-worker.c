@@ -0,0 +1,314 @@
+/*** RST
+worker
+======
+
+.. lua:module:: worker
+
+.. code-block:: lua
+
+    local worker = require 'worker'
+
+The :lua:mod:`worker` module runs Lua code in a separate Lua state on its
+own thread, with message passing to and from the overlay's main state. This
+is for CPU heavy module work (parsing, math over large data sets) that would
+otherwise have to be chopped into coroutine slices to avoid hitching the
+frame.
+
+Worker states are completely isolated: they have the standard Lua libraries
+but none of the overlay modules, and messages are copied between states as
+JSON compatible values (tables without cycles, strings, numbers, booleans).
+
+.. code-block:: lua
+    :caption: Example
+
+    local w = worker.new([=[
+        function onmessage(numbers)
+            local total = 0
+            for i, n in ipairs(numbers) do total = total + n end
+            post(total)
+        end
+    ]=])
+
+    w:onmessage(function(total)
+        print('sum: ' .. total)
+    end)
+
+    w:post({1, 2, 3, 4})
+*/
+#include "lua-worker.h"
+#include "lua-manager.h"
+#include "lua-json.h"
+#include "logging/logger.h"
+#include "utils.h"
+#include <windows.h>
+#include <string.h>
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+static logger_t *logger = NULL;
+
+typedef struct worker_msg_t {
+    json_t *value;
+    struct worker_msg_t *next;
+} worker_msg_t;
+
+typedef struct lua_worker_t {
+    HANDLE thread;
+    HANDLE mutex;
+    int stop;
+
+    char *source;
+
+    // main -> worker
+    worker_msg_t *inbox;
+    worker_msg_t *inbox_tail;
+
+    // worker -> main, delivered through the event callback queue
+    int onmessage_cbi;
+} lua_worker_t;
+
+int lua_worker_lua_open_module(lua_State *L);
+
+void lua_worker_init() {
+    logger = logger_get("lua-worker");
+
+    lua_manager_add_module_opener("worker", &lua_worker_lua_open_module);
+}
+
+#define LUA_WORKER_MT "LuaWorkerMetaTable"
+#define lua_checkworker(L, ind) (lua_worker_t*)luaL_checkudata(L, ind, LUA_WORKER_MT)
+
+struct worker_main_message {
+    int cbi;
+    json_t *value;
+};
+
+static int lua_worker_run_main_message(lua_State *L, struct worker_main_message *msg) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, msg->cbi);
+    lua_pushjson(L, msg->value);
+
+    json_decref(msg->value);
+    egoverlay_free(msg);
+
+    return 1;
+}
+
+// post() inside the worker state: hand the value to the main state's
+// onmessage callback through the event callback queue
+static int lua_worker_state_post(lua_State *L) {
+    lua_worker_t *worker = (lua_worker_t*)lua_touserdata(L, lua_upvalueindex(1));
+
+    json_t *value = lua_tojson(L, 1);
+
+    if (!worker->onmessage_cbi) {
+        if (value) json_decref(value);
+        return 0;
+    }
+
+    struct worker_main_message *msg = egoverlay_calloc(1, sizeof(struct worker_main_message));
+    msg->cbi = worker->onmessage_cbi;
+    msg->value = value ? value : json_null();
+
+    lua_manager_add_event_callback(&lua_worker_run_main_message, msg);
+
+    return 0;
+}
+
+static DWORD WINAPI lua_worker_thread(LPVOID param) {
+    lua_worker_t *worker = (lua_worker_t*)param;
+
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+
+    lua_pushlightuserdata(L, worker);
+    lua_pushcclosure(L, &lua_worker_state_post, 1);
+    lua_setglobal(L, "post");
+
+    if (luaL_loadstring(L, worker->source)!=LUA_OK || lua_pcall(L, 0, 0, 0)!=LUA_OK) {
+        logger_error(logger, "Error loading worker chunk: %s", lua_tostring(L, -1));
+        lua_close(L);
+        return 0;
+    }
+
+    while (!worker->stop) {
+        WaitForSingleObject(worker->mutex, INFINITE);
+        worker_msg_t *msgs = worker->inbox;
+        worker->inbox = NULL;
+        worker->inbox_tail = NULL;
+        ReleaseMutex(worker->mutex);
+
+        if (!msgs) {
+            Sleep(5);
+            continue;
+        }
+
+        while (msgs) {
+            worker_msg_t *msg = msgs;
+            msgs = msg->next;
+
+            if (lua_getglobal(L, "onmessage")==LUA_TFUNCTION) {
+                lua_pushjson(L, msg->value);
+
+                if (lua_pcall(L, 1, 0, 0)!=LUA_OK) {
+                    logger_error(logger, "Error in worker onmessage: %s", lua_tostring(L, -1));
+                    lua_pop(L, 1);
+                }
+            } else {
+                lua_pop(L, 1);
+            }
+
+            json_decref(msg->value);
+            egoverlay_free(msg);
+        }
+    }
+
+    lua_close(L);
+
+    return 0;
+}
+
+int lua_worker_lua_new(lua_State *L);
+int lua_worker_lua_del(lua_State *L);
+int lua_worker_lua_post(lua_State *L);
+int lua_worker_lua_onmessage(lua_State *L);
+
+luaL_Reg lua_worker_funcs[] = {
+    "__gc"     , &lua_worker_lua_del,
+    "post"     , &lua_worker_lua_post,
+    "onmessage", &lua_worker_lua_onmessage,
+    NULL       , NULL
+};
+
+int lua_worker_lua_open_module(lua_State *L) {
+    lua_newtable(L);
+    lua_pushcfunction(L, &lua_worker_lua_new);
+    lua_setfield(L, -2, "new");
+
+    return 1;
+}
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: new(source)
+
+    Create a :lua:class:`luaworker` running ``source`` in a new Lua state on
+    its own thread. The chunk should define a global ``onmessage(value)``
+    function and may call the global ``post(value)`` to send results back.
+
+    :param string source: Lua source for the worker state.
+    :rtype: luaworker
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int lua_worker_lua_new(lua_State *L) {
+    size_t sourcelen = 0;
+    const char *source = luaL_checklstring(L, 1, &sourcelen);
+
+    lua_worker_t *worker = lua_newuserdata(L, sizeof(lua_worker_t));
+    memset(worker, 0, sizeof(lua_worker_t));
+
+    if (luaL_newmetatable(L, LUA_WORKER_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, lua_worker_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    worker->source = egoverlay_calloc(sourcelen+1, sizeof(char));
+    memcpy(worker->source, source, sourcelen);
+
+    worker->mutex = CreateMutex(0, FALSE, NULL);
+
+    DWORD tid = 0;
+    worker->thread = CreateThread(0, 0, &lua_worker_thread, worker, 0, &tid);
+
+    return 1;
+}
+
+int lua_worker_lua_del(lua_State *L) {
+    lua_worker_t *worker = lua_checkworker(L, 1);
+
+    worker->stop = 1;
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+    CloseHandle(worker->mutex);
+
+    worker_msg_t *msg = worker->inbox;
+    while (msg) {
+        worker_msg_t *next = msg->next;
+        json_decref(msg->value);
+        egoverlay_free(msg);
+        msg = next;
+    }
+
+    // the onmessage ref is intentionally not released: a message the worker
+    // posted just before shutdown may still sit in the event callback queue
+    // holding this cbi, and unref'ing would let the registry slot be reused
+    // out from under it. one leaked ref per destroyed worker is the safe
+    // trade.
+
+    egoverlay_free(worker->source);
+
+    return 0;
+}
+
+/*** RST
+Classes
+-------
+
+.. lua:class:: luaworker
+
+    .. lua:method:: post(value)
+
+        Send a value to the worker state. ``value`` is copied as JSON and
+        delivered to the worker's ``onmessage`` function.
+
+        :param value: A JSON compatible value.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int lua_worker_lua_post(lua_State *L) {
+    lua_worker_t *worker = lua_checkworker(L, 1);
+
+    json_t *value = lua_tojson(L, 2);
+    if (!value) value = json_null();
+
+    worker_msg_t *msg = egoverlay_calloc(1, sizeof(worker_msg_t));
+    msg->value = value;
+
+    WaitForSingleObject(worker->mutex, INFINITE);
+    if (worker->inbox_tail) worker->inbox_tail->next = msg;
+    else worker->inbox = msg;
+    worker->inbox_tail = msg;
+    ReleaseMutex(worker->mutex);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: onmessage(callback)
+
+        Set the function called (on the overlay's main state) with each value
+        the worker posts back.
+
+        :param function callback:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int lua_worker_lua_onmessage(lua_State *L) {
+    lua_worker_t *worker = lua_checkworker(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (worker->onmessage_cbi) luaL_unref(L, LUA_REGISTRYINDEX, worker->onmessage_cbi);
+
+    lua_pushvalue(L, 2);
+    worker->onmessage_cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return 0;
+}
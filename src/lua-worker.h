@@ -0,0 +1,3 @@
+#pragma once
+
+void lua_worker_init();
@@ -28,7 +28,12 @@ require 'main-menu'
 require 'mumble-link-events'
 require 'mumble-link-info'
 
-require 'map-buddy'
 require 'markers'
 
-require 'psna-tracker'
+-- optional window modules activate lazily: their menu entries are stubs
+-- until first use unless their window was left open last session
+local lazy = require 'lazy-modules'
+lazy.defer({
+    { module = 'map-buddy'   , name = 'Map Buddy'   , settings = 'map-buddy.lua'    },
+    { module = 'psna-tracker', name = 'PSNA Tracker', settings = 'psna-tracker.lua' },
+})
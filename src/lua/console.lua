@@ -190,22 +190,77 @@ local win_show = console_settings:get("window.show")
 
 if console_settings:get("window.show") then console.win:show() end
 
+local textindex = require 'text-index'
+
 local history = {}
 local next_history = nil
 
+-- every line ever added this session, searchable in milliseconds even over
+-- hundreds of thousands of records; see console.search
+local searchindex = textindex.new()
+
+-- once the window is full, the oldest line's widget is recycled for the
+-- new line instead of creating and destroying a text element per message,
+-- so appends stay O(1) no matter how long the session runs
+local line_widgets = {}
+
 function console.add_line(text, color)
     local color = color or settings:get('overlay.ui.colors.text')
 
-    local t = uih.monospace_text(text, color)
-    message_box:pack_end(t, false, 'start')
+    searchindex:add(text)
 
-    while message_box:item_count() > console_settings:get('maxLines') do
+    if #line_widgets >= console_settings:get('maxLines') then
+        local t = table.remove(line_widgets, 1)
+        message_box:pop_start()
+
+        t:update_text(text)
+        t:color(color)
+
+        table.insert(line_widgets, t)
+        message_box:pack_end(t, false, 'start')
+    else
+        local t = uih.monospace_text(text, color)
+        table.insert(line_widgets, t)
+        message_box:pack_end(t, false, 'start')
+    end
+
+    -- if maxLines was lowered at runtime, drop the extras
+    while #line_widgets > console_settings:get('maxLines') do
+        table.remove(line_widgets, 1)
         message_box:pop_start()
     end
 
     message_scroll:scroll_max_y()
 end
 
+--[[ RST
+.. lua:function:: search(term[, limit])
+
+    Search every line added to the console this session (not just the
+    retained widgets) and return the matching lines, oldest first.
+
+    .. code-block:: lua
+
+        -- from the console prompt
+        for _,l in ipairs(require('console').search('timeout')) do print(l) end
+
+    :param string term:
+    :param integer limit: (Optional) Maximum matches, default 1000.
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function console.search(term, limit)
+    local out = {}
+
+    for _,id in ipairs(searchindex:search(term, limit)) do
+        table.insert(out, searchindex:get(id))
+    end
+
+    return out
+end
+
 local function run_text(text)
     if text == nil or text == '' then return end
 
@@ -246,9 +246,110 @@ function api.get(endpoint, params, done, err, sd, cache)
     end
 end
 
+-- the GW2 API accepts up to 200 ids per request
+local IDS_PER_REQUEST = 200
+
+-- pending id batches per endpoint/param. asynchronous id queries made within
+-- the same frame are merged into one request (split into chunks of up to 200
+-- ids) and each caller receives just the rows it asked for.
+local idbatches = {}
+
+local function flushidbatch(key)
+    local batch = idbatches[key]
+    idbatches[key] = nil
+
+    if not batch then return end
+
+    local chunks = {}
+    for s=1,#batch.ids,IDS_PER_REQUEST do
+        local chunk = {}
+        for i=s,math.min(s + IDS_PER_REQUEST - 1, #batch.ids) do
+            table.insert(chunk, batch.ids[i])
+        end
+        table.insert(chunks, chunk)
+    end
+
+    local remaining = #chunks
+    local rows = {}
+    local failed = nil
+
+    local function finish()
+        for _,w in ipairs(batch.waiters) do
+            if failed then
+                if w.err then w.err(failed) end
+            else
+                local result = {}
+                for _,id in ipairs(w.ids) do
+                    if rows[id] then table.insert(result, rows[id]) end
+                end
+                if w.done then w.done(result) end
+            end
+        end
+    end
+
+    local function onchunkdone(data)
+        if type(data)=='table' then
+            for _,row in ipairs(data) do
+                if row.id~=nil then rows[row.id] = row end
+            end
+        end
+
+        remaining = remaining - 1
+        if remaining==0 then finish() end
+    end
+
+    local function onchunkerr(msg)
+        failed = msg
+
+        remaining = remaining - 1
+        if remaining==0 then finish() end
+    end
+
+    for _,chunk in ipairs(chunks) do
+        -- the shared endpoint cache ignores params, it can't be used for
+        -- id queries
+        api.get(batch.endpoint, { [batch.paramname] = table.concat(chunk, ',') }, onchunkdone, onchunkerr, 3, false)
+    end
+end
+
+overlay.addeventhandler('update', function()
+    for key in pairs(idbatches) do
+        flushidbatch(key)
+    end
+end)
+
 function api.getwithids(endpoint, ids, paramname, done, err, sd, cached)
-    local idstr = idstostr(ids)
     paramname = paramname or 'ids'
+
+    -- asynchronous queries with concrete ids are coalesced; everything else
+    -- ('all', raw strings, synchronous calls) goes straight through
+    local batchable = (done~=nil or err~=nil) and (type(ids)=='table' or type(ids)=='number')
+
+    if batchable then
+        local idlist = ids
+        if type(ids)=='number' then idlist = { ids } end
+
+        local key = endpoint .. '?' .. paramname
+        local batch = idbatches[key]
+
+        if not batch then
+            batch = { endpoint = endpoint, paramname = paramname, ids = {}, idset = {}, waiters = {} }
+            idbatches[key] = batch
+        end
+
+        for _,id in ipairs(idlist) do
+            if not batch.idset[id] then
+                batch.idset[id] = true
+                table.insert(batch.ids, id)
+            end
+        end
+
+        table.insert(batch.waiters, { ids = idlist, done = done, err = err })
+
+        return
+    end
+
+    local idstr = idstostr(ids)
     local params = {}
     
     if idstr then
@@ -0,0 +1,152 @@
+--[[ RST
+gw2.render
+==========
+
+.. lua:module:: gw2.render
+
+.. code-block:: lua
+
+    local render = require 'gw2.render'
+
+The :lua:mod:`gw2.render` module downloads files from the Guild Wars 2
+render service (icons) and tile service (map tiles). Downloads run at
+background priority, concurrent requests for the same file are coalesced,
+and results are kept in an on-disk LRU cache so a file is only ever
+downloaded once until it's evicted.
+]]--
+
+local sqlite = require 'sqlite'
+local wr = require 'web-request'
+local logger = require 'logger'
+
+local M = {}
+
+local log = logger.logger:new('gw2.render')
+
+local db = sqlite.open('render-cache.db')
+
+db:execute([[
+    CREATE TABLE IF NOT EXISTS rendercache (
+        url TEXT PRIMARY KEY,
+        data BLOB NOT NULL,
+        size INTEGER NOT NULL,
+        lastused INTEGER NOT NULL
+    ) WITHOUT ROWID
+]])
+db:execute([[ CREATE INDEX IF NOT EXISTS idx_rendercache_lastused ON rendercache (lastused) ]])
+
+-- total cache budget; least recently used entries are evicted past this
+local MAX_CACHE_BYTES = 256 * 1024 * 1024
+
+local function evict()
+    local total = db:execute([[SELECT COALESCE(SUM(size), 0) AS total FROM rendercache]]).total
+
+    while total > MAX_CACHE_BYTES do
+        local victim = db:execute([[SELECT url, size FROM rendercache ORDER BY lastused ASC LIMIT 1]])
+        if not victim then break end
+
+        local del = db:prepare([[DELETE FROM rendercache WHERE url = ?]])
+        del:bind(1, victim.url)
+        del:step()
+        del:finalize()
+
+        total = total - victim.size
+    end
+end
+
+-- in-flight downloads by url, so concurrent requests for the same file
+-- share one transfer
+local pending = {}
+
+local function fetch(url, done)
+    local get = db:prepare([[SELECT data FROM rendercache WHERE url = ?]])
+    get:bind(1, url)
+    local row = get:step()
+    get:finalize()
+
+    if row then
+        local touch = db:prepare([[UPDATE rendercache SET lastused = ? WHERE url = ?]])
+        touch:bind(1, os.time())
+        touch:bind(2, url)
+        touch:step()
+        touch:finalize()
+
+        done(row.data)
+        return
+    end
+
+    if pending[url] then
+        table.insert(pending[url], done)
+        return
+    end
+    pending[url] = { done }
+
+    local req = wr.new(url)
+    req:priority('background')
+
+    req:queue(function(code, data, r)
+        local waiters = pending[url]
+        pending[url] = nil
+
+        if code >= 200 and code < 300 then
+            local ins = db:prepare([[
+                INSERT OR REPLACE INTO rendercache (url, data, size, lastused) VALUES (?, ?, ?, ?)
+            ]])
+            ins:bind(1, url)
+            ins:bind(2, data, true)
+            ins:bind(3, #data)
+            ins:bind(4, os.time())
+            ins:step()
+            ins:finalize()
+
+            evict()
+
+            for _, cb in ipairs(waiters) do cb(data) end
+        else
+            log:warn('GET %s -> %d', url, code)
+            for _, cb in ipairs(waiters) do cb(nil) end
+        end
+    end, 2)
+end
+
+--[[ RST
+Functions
+---------
+
+.. lua:function:: icon(signature, fileid, done)
+
+    Fetch an icon from the render service. ``done(data)`` is called with the
+    PNG data, or ``nil`` if the download failed.
+
+    :param string signature: The file signature hash.
+    :param integer fileid: The file id.
+    :param function done:
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function M.icon(signature, fileid, done)
+    fetch(string.format('https://render.guildwars2.com/file/%s/%d.png', signature, fileid), done)
+end
+
+--[[ RST
+.. lua:function:: tile(continent, floor, zoom, x, y, done)
+
+    Fetch a map tile from the tile service. ``done(data)`` is called with the
+    JPEG data, or ``nil`` if the download failed.
+
+    :param integer continent:
+    :param integer floor:
+    :param integer zoom:
+    :param integer x:
+    :param integer y:
+    :param function done:
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function M.tile(continent, floor, zoom, x, y, done)
+    fetch(string.format('https://tiles.guildwars2.com/%d/%d/%d/%d/%d.jpg', continent, floor, zoom, x, y), done)
+end
+
+return M
@@ -35,7 +35,7 @@ Attributes
 
 -- cheat a bit and create the db on load
 -- this way it at least exists before the startup event runs
-static.db = sqlite.open(overlay.datafolder('gw2') .. 'static.db')
+static.db = sqlite.open(overlay.datafolder('gw2') .. 'static.db', 'tuned')
 
 --[[ RST
 Database Tables
@@ -0,0 +1,316 @@
+--[[ RST
+gw2.sync
+========
+
+.. lua:module:: gw2.sync
+
+.. code-block:: lua
+
+    local sync = require 'gw2.sync'
+
+Incremental synchronization of account endpoints.
+
+Modules that display account state (achievements, bank, materials) used to
+refetch and reprocess whole endpoints every time they updated. This module
+fetches each endpoint on a schedule, keeps the last known rows in sqlite and
+emits an event containing only the rows that were added, changed, or removed
+since the previous fetch. Consumers react to the diff instead of walking the
+full payload, and the stored state survives restarts, so the first diff after
+launch is against the previous session rather than empty.
+
+Events
+------
+
+.. overlay:event:: gw2-sync-achievements
+.. overlay:event:: gw2-sync-bank
+.. overlay:event:: gw2-sync-materials
+
+    Queued after a sync pass finds differences. The event data is a table:
+
+    - ``added``: a sequence of new rows
+    - ``changed``: a sequence of rows whose content changed
+    - ``removed``: a sequence of keys no longer present
+
+    Rows are plain Lua tables as returned by the API. Bank rows carry an
+    additional ``slot`` field since empty slots have no id of their own.
+]]--
+
+local api = require 'gw2.api'
+local jansson = require 'jansson'
+local overlay = require 'eg-overlay'
+local settings = require 'settings'
+local sqlite = require 'sqlite'
+local logger = require 'logger'
+
+local sync = {}
+
+sync.log = logger.logger:new('gw2.sync')
+
+--[[ RST
+Settings
+--------
+
+The settings for :lua:mod:`gw2.sync` are stored in ``settings/gw2.sync.lua.json``.
+
+.. confval:: syncIntervalSeconds
+    :type: number
+    :default: 300
+
+    How often each endpoint is refetched.
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+sync.settings = settings.new('gw2.sync.lua')
+sync.settings:setdefault('syncIntervalSeconds', 300)
+
+local db = sqlite.open('gw2-sync.db')
+
+db:execute([[
+    CREATE TABLE IF NOT EXISTS syncstate (
+        endpoint TEXT NOT NULL,
+        key TEXT NOT NULL,
+        data TEXT NOT NULL,
+        updated INTEGER NOT NULL,
+        PRIMARY KEY (endpoint, key)
+    ) WITHOUT ROWID
+]])
+
+-- endpoints synced and how their rows are keyed. bank slots can be empty
+-- (null), so they are keyed by slot index instead of item id
+local endpoints = {
+    {
+        endpoint = 'account/achievements',
+        event    = 'gw2-sync-achievements',
+        key      = function(row, i) return tostring(row.id) end
+    },
+    {
+        endpoint = 'account/bank',
+        event    = 'gw2-sync-bank',
+        key      = function(row, i) return tostring(i) end,
+        slots    = true
+    },
+    {
+        endpoint = 'account/materials',
+        event    = 'gw2-sync-materials',
+        key      = function(row, i) return tostring(row.id) end
+    }
+}
+
+-- deterministic JSON serialization for change detection and storage.
+-- jansson.dumps needs a json value and pairs order isn't stable across
+-- fetches, so rows are serialized with sorted object keys before comparing.
+-- the output is valid JSON so stored rows can be loaded back with
+-- jansson.loads
+local function jsonescape(str)
+    return (str:gsub('[%c"\\]', function(c)
+        if c=='"' then return '\\"' end
+        if c=='\\' then return '\\\\' end
+        return string.format('\\u%04x', string.byte(c))
+    end))
+end
+
+local function serialize(v)
+    local t = type(v)
+    if t=='table' then
+        local n = 0
+        for _ in pairs(v) do n = n + 1 end
+
+        if n==#v then
+            -- a sequence; keep it as a JSON array
+            local parts = {}
+            for _,item in ipairs(v) do
+                table.insert(parts, serialize(item))
+            end
+            return '[' .. table.concat(parts, ',') .. ']'
+        end
+
+        local keys = {}
+        for k in pairs(v) do table.insert(keys, k) end
+        table.sort(keys, function(a,b) return tostring(a) < tostring(b) end)
+
+        local parts = {}
+        for _,k in ipairs(keys) do
+            table.insert(parts, string.format('"%s":%s', jsonescape(tostring(k)), serialize(v[k])))
+        end
+        return '{' .. table.concat(parts, ',') .. '}'
+    elseif t=='string' then
+        return '"' .. jsonescape(v) .. '"'
+    else
+        return tostring(v)
+    end
+end
+
+-- last known serialized rows per endpoint, keyed by row key. loaded from
+-- sqlite once at startup, then maintained in memory
+local laststate = {}
+
+local function loadstate(endpoint)
+    local state = {}
+
+    local s = db:prepare([[SELECT key, data FROM syncstate WHERE endpoint = ?]])
+    s:bind(1, endpoint)
+    for row in function() return s:step() end do
+        state[row.key] = row.data
+    end
+    s:finalize()
+
+    return state
+end
+
+local function storedeltas(endpoint, upserts, removed)
+    db:execute('BEGIN')
+
+    local now = overlay.time()
+
+    local up = db:prepare([[
+        INSERT INTO syncstate (endpoint, key, data, updated) VALUES (?, ?, ?, ?)
+        ON CONFLICT (endpoint, key) DO UPDATE SET data = excluded.data, updated = excluded.updated
+    ]])
+    for key, data in pairs(upserts) do
+        up:bind(1, endpoint)
+        up:bind(2, key)
+        up:bind(3, data)
+        up:bind(4, now)
+        up:step()
+        up:reset()
+    end
+    up:finalize()
+
+    local del = db:prepare([[DELETE FROM syncstate WHERE endpoint = ? AND key = ?]])
+    for _,key in ipairs(removed) do
+        del:bind(1, endpoint)
+        del:bind(2, key)
+        del:step()
+        del:reset()
+    end
+    del:finalize()
+
+    db:execute('COMMIT')
+end
+
+local function syncendpoint(ep)
+    local function done(data)
+        local rows = data:totable()
+        if type(rows)~='table' then return end
+
+        local state = laststate[ep.endpoint]
+        if not state then
+            state = loadstate(ep.endpoint)
+            laststate[ep.endpoint] = state
+        end
+
+        local added = {}
+        local changed = {}
+        local removed = {}
+        local upserts = {}
+        local seen = {}
+
+        for i,row in ipairs(rows) do
+            -- empty bank slots are json nulls; track them as absent
+            if type(row)=='table' then
+                local key = ep.key(row, i)
+                if ep.slots then row.slot = i end
+
+                seen[key] = true
+
+                local data = serialize(row)
+                if state[key]==nil then
+                    table.insert(added, row)
+                    upserts[key] = data
+                    state[key] = data
+                elseif state[key]~=data then
+                    table.insert(changed, row)
+                    upserts[key] = data
+                    state[key] = data
+                end
+            end
+        end
+
+        for key in pairs(state) do
+            if not seen[key] then table.insert(removed, key) end
+        end
+        for _,key in ipairs(removed) do state[key] = nil end
+
+        if #added > 0 or #changed > 0 or #removed > 0 then
+            storedeltas(ep.endpoint, upserts, removed)
+
+            sync.log:debug(
+                '%s: %d added, %d changed, %d removed',
+                ep.endpoint, #added, #changed, #removed
+            )
+            overlay.queueevent(ep.event, { added = added, changed = changed, removed = removed })
+        end
+    end
+
+    local function err(msg)
+        sync.log:warn("Couldn't sync %s: %s", ep.endpoint, tostring(msg))
+    end
+
+    -- always bypass the api response cache; the whole point is detecting
+    -- what actually changed upstream
+    api.get(ep.endpoint, nil, done, err, nil, false)
+end
+
+local function syncall()
+    if not api.settings:get('apiKey') then return end
+
+    for _,ep in ipairs(endpoints) do
+        syncendpoint(ep)
+    end
+end
+
+--[[ RST
+Functions
+---------
+
+.. lua:function:: get(endpoint)
+
+    Return the last synced rows for ``endpoint`` as a table keyed the same way
+    as the change events, or ``nil`` if the endpoint has never been synced.
+
+    :param endpoint: One of the synced endpoints, i.e. ``'account/achievements'``.
+    :type endpoint: string
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function sync.get(endpoint)
+    local state = laststate[endpoint]
+    if not state then
+        state = loadstate(endpoint)
+        laststate[endpoint] = state
+    end
+
+    local rows = {}
+    local any = false
+    for key, data in pairs(state) do
+        any = true
+        local r, row = jansson.loads(data)
+        if r then rows[key] = row:totable() end
+    end
+
+    if not any then return nil end
+
+    return rows
+end
+
+--[[ RST
+.. lua:function:: syncnow()
+
+    Run a sync pass immediately instead of waiting for the next interval.
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function sync.syncnow()
+    syncall()
+end
+
+overlay.addeventhandler('startup', function()
+    syncall()
+    overlay.interval(sync.settings:get('syncIntervalSeconds'), syncall)
+end)
+
+return sync
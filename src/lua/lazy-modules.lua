@@ -0,0 +1,63 @@
+--[[ RST
+lazy-modules
+============
+
+.. lua:module:: lazy-modules
+
+Lazy module activation from a declared manifest.
+
+Deferred modules don't load at startup: the manifest registers their menu
+entry as a stub, and the module is required on its first activation, with the
+click delegated to the module's exported ``primary_action``. Modules whose
+window was left open load eagerly so their windows appear at startup as
+before. This keeps both startup time and idle footprint flat as module
+counts grow.
+]]--
+
+local overlay = require 'eg-overlay'
+local settings = require 'settings'
+
+local M = {}
+
+--[[ RST
+Functions
+---------
+
+.. lua:function:: defer(entries)
+
+    Register deferred modules. Each entry is a table:
+
+    - ``module``: the module name to require on activation
+    - ``name``: the menu entry name
+    - ``settings``: the module's settings file name
+    - ``showsetting``: (optional) the window-visible setting key, default
+      ``'window.show'``
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function M.defer(entries)
+    for _,e in ipairs(entries) do
+        local s = settings.new(e.settings)
+
+        if s:get(e.showsetting or 'window.show') then
+            -- the window was open last session; load now so it shows at
+            -- startup and registers its own menu action
+            require(e.module)
+        else
+            local mod = nil
+
+            overlay.addeventhandler('startup', function()
+                overlay.queueevent('register-module-actions', {
+                    name = e.name,
+                    primary_action = function(ev)
+                        if not mod then mod = require(e.module) end
+                        if mod.primary_action then mod.primary_action(ev) end
+                    end
+                })
+            end)
+        end
+    end
+end
+
+return M
@@ -110,6 +110,10 @@ local function primary_action(event)
     end
 end
 
+-- exported so lazy activation stubs can delegate menu clicks after the
+-- module loads on demand
+mod.primary_action = primary_action
+
 local function on_startup()
     overlay.queueevent('register-module-actions', {
         name = "Map Buddy",
@@ -0,0 +1,310 @@
+--[[ RST
+markers.downloader
+==================
+
+.. lua:module:: markers.downloader
+
+.. code-block:: lua
+
+    local downloader = require 'markers.downloader'
+
+Download and import marker packs from inside the overlay.
+
+Packs are downloaded with segmented ranged requests when the server supports
+them (each segment resumes independently from whatever bytes are already on
+disk), verified by reassembled size and by parsing the zip central directory,
+imported through the normal zip loader, and registered so the markers show up
+without a restart.
+]]--
+
+local overlay = require 'eg-overlay'
+local web_request = require 'web-request'
+local zip = require 'zip'
+local logger = require 'logger'
+local settings = require 'markers.settings'
+local loaders = require 'markers.loaders'
+local manager = require 'markers.manager'
+local mp = require 'markers.package'
+
+local M = {}
+
+local log = logger.logger:new('markers.downloader')
+
+-- how many ranged requests a pack download is split into when the server
+-- supports ranges. web-request caps concurrency globally, so this only
+-- parallelizes within that budget
+local SEGMENTS = 4
+
+local function segpath(dest, i)
+    return dest .. '.seg' .. i
+end
+
+local function filesize(path)
+    local f = io.open(path, 'rb')
+    if not f then return 0 end
+
+    local size = f:seek('end')
+    f:close()
+
+    return size
+end
+
+local function append(path, data)
+    local f = io.open(path, 'ab')
+    if not f then return false end
+
+    f:write(data)
+    f:close()
+
+    return true
+end
+
+-- reassemble the segment files into dest. returns false if any segment is
+-- the wrong size (a future download can resume the incomplete segments)
+local function assemble(dest, total, seglens)
+    local out = io.open(dest, 'wb')
+    if not out then return false end
+
+    for i,len in ipairs(seglens) do
+        -- a zero length segment (tiny file split across more segments than
+        -- bytes) has no file at all
+        if len > 0 then
+            if filesize(segpath(dest, i))~=len then
+                out:close()
+                log:warn('Segment %d is %d bytes, expected %d.', i, filesize(segpath(dest, i)), len)
+                return false
+            end
+
+            local seg = io.open(segpath(dest, i), 'rb')
+            if not seg then
+                out:close()
+                return false
+            end
+
+            -- copy in bounded pieces; segments of a large pack shouldn't be
+            -- pulled into memory whole just to be concatenated
+            repeat
+                local data = seg:read(1024 * 1024)
+                if data then out:write(data) end
+            until not data
+            seg:close()
+        end
+    end
+    out:close()
+
+    if filesize(dest)~=total then return false end
+
+    for i in ipairs(seglens) do
+        os.remove(segpath(dest, i))
+    end
+
+    return true
+end
+
+-- import the downloaded zip into its pack database and register the pack
+-- with the manager so the markers appear without a restart
+local function importpack(zippath, err)
+    local packpath = zippath:gsub('%.zip$', '') .. '.db'
+
+    local ok, result = pcall(function()
+        local loader = loaders.zip_loader:new(zippath, packpath)
+        loader:load()
+    end)
+
+    if not ok then
+        if err then err(string.format("Couldn't import %s: %s", zippath, result)) end
+        return nil
+    end
+
+    local packpaths = settings:get('markerpacks') or {}
+    local registered = false
+    for _,p in ipairs(packpaths) do
+        if p==packpath then registered = true end
+    end
+
+    if not registered then
+        table.insert(packpaths, packpath)
+        settings:set('markerpacks', packpaths)
+    end
+
+    if not manager.packs[packpath] then
+        manager.packs[packpath] = mp.markerpack:open(packpath)
+    end
+
+    manager.reloadcategories()
+    if manager.packs[packpath] then
+        manager.precachepack(manager.packs[packpath])
+    end
+
+    return packpath
+end
+
+--[[ RST
+Functions
+---------
+
+.. lua:function:: download(opts)
+
+    Download and import a marker pack. ``opts`` is a table:
+
+    - ``url``: the pack zip URL (required)
+    - ``name``: the file name to store the pack under (required, ends in ``.zip``)
+    - ``done(packpath)``: (optional) called once the pack is imported
+    - ``err(message)``: (optional) called on failure
+    - ``onprogress(got, total)``: (optional) called as bytes arrive. ``total``
+      is ``0`` when the server doesn't report a size.
+
+    Downloads run in the background on the web-request thread at background
+    priority. When the server supports ranged requests the transfer is split
+    into segments that download in parallel and resume independently;
+    otherwise a single streaming request is used. The finished file is
+    verified by reassembled size and by parsing the zip central directory
+    before import.
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function M.download(opts)
+    local url = opts.url
+    local name = opts.name
+
+    if not url or not name then
+        error('downloader.download: url and name are required.', 2)
+    end
+
+    local dest = overlay.datafolder('markerpacks') .. name
+
+    local function fail(msg)
+        log:warn('%s', msg)
+        if opts.err then opts.err(msg) end
+    end
+
+    local function finish(total, seglens)
+        if not assemble(dest, total, seglens) then
+            fail(string.format("Couldn't assemble %s; partial segments kept for resume.", name))
+            return
+        end
+
+        -- opening the zip parses the central directory; a truncated or
+        -- corrupted download fails here instead of halfway through import
+        local zok, z = pcall(zip.open, dest)
+        if not zok or not z then
+            os.remove(dest)
+            fail(string.format('%s is not a valid zip; download discarded.', name))
+            return
+        end
+
+        log:info('Downloaded %s (%d bytes), importing...', name, total)
+
+        local packpath = importpack(dest, opts.err)
+        if packpath and opts.done then opts.done(packpath) end
+    end
+
+    -- plain streaming download, used when the server doesn't do ranges.
+    -- no resume: the file is rewritten from the start
+    local function singledownload()
+        os.remove(dest .. '.seg1')
+
+        local got = 0
+        local req = web_request.new(url)
+        req:priority('background')
+        req:queuestream(function(data)
+            append(segpath(dest, 1), data)
+            got = got + #data
+            if opts.onprogress then opts.onprogress(got, 0) end
+        end, function(code, r)
+            if code < 200 or code >= 400 then
+                fail(string.format('GET %s -> %d', url, code))
+                return
+            end
+            finish(got, {got})
+        end)
+    end
+
+    local function segmenteddownload(total)
+        local seglens = {}
+        local base = total // SEGMENTS
+
+        for i=1,SEGMENTS do
+            seglens[i] = base
+        end
+        seglens[SEGMENTS] = total - base * (SEGMENTS - 1)
+
+        local got = 0
+        local remaining = 0
+
+        local start = 0
+        for i=1,SEGMENTS do
+            local have = filesize(segpath(dest, i))
+            local seglen = seglens[i]
+
+            if have > seglen then
+                -- corrupt leftover; restart this segment
+                os.remove(segpath(dest, i))
+                have = 0
+            end
+
+            got = got + have
+
+            if have < seglen then
+                remaining = remaining + 1
+
+                local first = start + have
+                local last = start + seglen - 1
+                local segi = i
+
+                local req = web_request.new(url)
+                req:priority('background')
+                req:addheader('Range', string.format('bytes=%d-%d', first, last))
+                req:queuestream(function(data)
+                    append(segpath(dest, segi), data)
+                    got = got + #data
+                    if opts.onprogress then opts.onprogress(got, total) end
+                end, function(code, r)
+                    if code~=206 then
+                        fail(string.format('GET %s (segment %d) -> %d', url, segi, code))
+                        remaining = -1000 -- poison: don't finish
+                        return
+                    end
+
+                    remaining = remaining - 1
+                    if remaining==0 then finish(total, seglens) end
+                end)
+            end
+
+            start = start + seglen
+        end
+
+        if remaining==0 then
+            -- everything was already on disk from an earlier attempt
+            finish(total, seglens)
+        end
+    end
+
+    -- probe with a 1 byte range: a 206 tells us the server does ranges and
+    -- the Content-Range tells us the total size
+    local probe = web_request.new(url)
+    probe:priority('background')
+    probe:addheader('Range', 'bytes=0-0')
+    probe:queue(function(code, data, r)
+        if code==206 then
+            local range = r:responseheader('Content-Range')
+            local total = range and tonumber(string.match(range, 'bytes %d+%-%d+/(%d+)'))
+
+            if total and total > 0 then
+                log:info('Downloading %s (%d bytes, %d segments)...', url, total, SEGMENTS)
+                segmenteddownload(total)
+                return
+            end
+        end
+
+        if code >= 200 and code < 400 then
+            log:info('Downloading %s (no range support)...', url)
+            singledownload()
+        else
+            fail(string.format('GET %s -> %d', url, code))
+        end
+    end)
+end
+
+return M
@@ -5,6 +5,7 @@ local overlay = require 'eg-overlay'
 local converters = require 'markers.converters'
 local mp = require 'markers.package'
 local xmlcleaner = require 'xml-cleaner'
+local msettings = require 'markers.settings'
 
 local loaders = {}
 
@@ -155,6 +156,7 @@ function base_loader.begintag.POI(self, file, line, attrs)
 
     local cat = self.mp:category(typeid, true)
     local marker = cat:newmarker()
+    marker:sourcefile(file)
 
     if props.mapid==nil then
         xmlwarn(file, line, 'POI with no MapID.')
@@ -189,6 +191,7 @@ function base_loader.begintag.Trail(self, file, line, attrs)
     local typeid = attrs.type
     local cat = self.mp:category(typeid, true)
     local trail = cat:newtrail()
+    trail:sourcefile(file)
 
     for p,v in pairs(props) do
         trail[p] = v
@@ -236,9 +239,15 @@ function base_loader.begintag.Trail(self, file, line, attrs)
     end
 end
 
+-- how much XML is fed to the parser between coroutine yields. each chunk is
+-- parsed (and its SAX callbacks run) in one slice; the overlay resumes the
+-- coroutine with whatever frame time is left over
+local XML_CHUNK_SIZE = 65536
+
 function base_loader:loadxml(name, xmldata)
-    local cleanxml = xmlcleaner.cleanxml(xmldata, name)
-    --local cleanxml = xmldata
+    -- repaired chunk by chunk as it is fed to the parser; the document is
+    -- never duplicated in memory
+    local cleaner = xmlcleaner.newcleaner(name)
     local function startele(name, attrs, file, line)
         if self.begintag[name] then
             self.begintag[name](self, file, line, attrs)
@@ -253,11 +262,18 @@ function base_loader:loadxml(name, xmldata)
         end
     end
 
-    xml.read_string(cleanxml, name, {
+    local parser = xml.pushparser(name, {
         startelement = startele,
         endelement = endele
     })
 
+    for pos = 1, #xmldata, XML_CHUNK_SIZE do
+        parser:parse(cleaner:clean(string.sub(xmldata, pos, pos + XML_CHUNK_SIZE - 1)))
+        coroutine.yield()
+    end
+
+    parser:parse(cleaner:finish())
+    parser:finish()
 end
 
 loaders.zip_loader = {}
@@ -283,6 +299,22 @@ function loaders.zip_loader:load()
     loaders.log:info("Loading %s...", self.zip_path)
     self.zip = zip.open(self.zip_path)
 
+    -- the markerpack database is the compiled form of the zip. if it was
+    -- built from this exact zip content already there's nothing to do
+    local sourcehash = self.zip:contenthash()
+
+    self.mp.db:execute([[CREATE TABLE IF NOT EXISTS packmeta (key TEXT PRIMARY KEY, value TEXT)]])
+
+    local hashstmt = self.mp.db:prepare([[SELECT value FROM packmeta WHERE key = 'sourcehash']])
+    local hashrow = hashstmt:step()
+    hashstmt:finalize()
+
+    if hashrow and hashrow.value==sourcehash then
+        loaders.log:info("%s is unchanged (hash %s), skipping import.", self.zip_path, sourcehash)
+        self.zip = nil
+        return
+    end
+
     local files = self.zip:files()
     local start = overlay.time()
 
@@ -293,23 +325,90 @@ function loaders.zip_loader:load()
     -- So, turn off foreign key checks now and then run a check after everything
     -- is loaded.
     self.mp.db:execute('PRAGMA cache_size = 100000')
-    self.mp.db:execute('PRAGMA foreign_keys = OFF')
-    --self.mp.db:execute('BEGIN IMMEDIATE TRANSACTION')
+
+    -- parse every top level xml file on the worker pool; events come back in
+    -- submission order and are applied in bounded batches per frame
+    local function startele(name, attrs, file, line)
+        if self.begintag[name] then
+            self.begintag[name](self, file, line, attrs)
+        end
+    end
+
+    local function endele(name)
+        if self.endtag[name] then
+            self.endtag[name](self)
+        end
+    end
+
+    local function startdoc(name)
+        self.mp.db:execute('BEGIN TRANSACTION')
+    end
+
+    local function enddoc(name)
+        self.mp.db:execute('COMMIT TRANSACTION')
+    end
+
+    local queue = xml.parsequeue({
+        startelement = startele,
+        endelement = endele,
+        startdocument = startdoc,
+        enddocument = enddoc,
+    })
+
+    -- per file diffing: only files whose content changed since the last
+    -- import are reparsed; their previous markers and trails are replaced
+    local function getmeta(key)
+        local s = self.mp.db:prepare([[SELECT value FROM packmeta WHERE key = ?]])
+        s:bind(1, key)
+        local row = s:step()
+        s:finalize()
+        if row then return row.value end
+    end
+
+    local importedfiles = {}
 
     for i,f in ipairs(files) do
         -- find all top level xml files
         if string.find(f, '[^/]+%.xml') == 1 then
-            local fstr = self.zip:file_content(f)
-            self.mp.db:execute('BEGIN TRANSACTION')
-            self:loadxml(f, fstr)
-            self.mp.db:execute('COMMIT TRANSACTION')
+            local crc = string.format('%d', self.zip:filecrc(f))
+
+            if getmeta('filehash:'..f)==crc then
+                loaders.log:debug("%s is unchanged, skipping.", f)
+            else
+                self.mp:removefromfile(f)
+                queue:submit(f, xmlcleaner.cleanxml(self.zip:file_content(f), f))
+                importedfiles[f] = crc
+            end
             coroutine.yield()
         end
     end
 
-    --self.mp.db:execute('COMMIT TRANSACTION')
+    -- foreign keys are only disabled while inserting: packs don't always
+    -- declare categories before the POIs that reference them. deletes above
+    -- ran with them on so property/coordinate rows cascade properly
+    self.mp.db:execute('PRAGMA foreign_keys = OFF')
+
+    repeat
+        local done = queue:drain(2000)
+        coroutine.yield()
+    until done
+
+    local setfilehash = self.mp.db:prepare([[INSERT OR REPLACE INTO packmeta (key, value) VALUES (?, ?)]])
+    for f, crc in pairs(importedfiles) do
+        setfilehash:reset()
+        setfilehash:bind(1, 'filehash:'..f)
+        setfilehash:bind(2, crc)
+        setfilehash:step()
+    end
+    setfilehash:finalize()
+
     self.mp.db:execute('PRAGMA foreign_keys = ON')
-    
+
+    -- the big import cache would otherwise stay resident for the rest of the
+    -- session; drop back to the configured steady-state size
+    self.mp.db:execute(string.format('PRAGMA cache_size = %d', msettings:get('markerpackCacheSize')))
+    self.mp.db:execute('PRAGMA shrink_memory')
+
     -- loaders.log:info("Checking data integrity...")
     -- local stmt = self.mp.db:prepare('PRAGMA foreign_key_check(markers)')
     -- local function marker_rows()
@@ -353,6 +452,11 @@ function loaders.zip_loader:load()
     loaders.log:info("  %d trail points", trailpoints)
     loaders.log:info("  %d data files", datacount)
 
+    local sethash = self.mp.db:prepare([[INSERT OR REPLACE INTO packmeta (key, value) VALUES ('sourcehash', ?)]])
+    sethash:bind(1, sourcehash)
+    sethash:step()
+    sethash:finalize()
+
     loaders.log:info("Optimizing database...")
     self.mp.db:execute('PRAGMA optimize')
     loaders.log:info("Vacuuming...")
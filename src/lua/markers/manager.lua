@@ -157,7 +157,8 @@ local function addcategorytrails(category)
 
         if not texturearray:has(texturename) then
             local texturedf = category.markerpack:datafile(texturename)
-            texturearray:add(t.texture, texturedf:data())
+            -- trail textures tile along the path, they can't be atlas packed
+            texturearray:add(t.texture, texturedf:data(), { atlas = false })
         end
 
         -- show this one in the (mini)map
@@ -267,38 +268,185 @@ function M.reloadcategories(clear)
     if clear then
         activetypeids = {}
 
-        texturearray:clear()
+        -- the texture map is intentionally kept across map changes: textures
+        -- prefetched for neighboring maps (and textures shared between maps)
+        -- stay resident instead of being decoded again
         spritearray:clear()
         mapspritearray:clear()
 
         traillist:clear()
         maptraillist:clear()
-    else
-        for mp, cats in pairs(activetypeids) do
-            local pack = M.packs[mp]
-            for typeid,_ in pairs(cats) do
-                local cat = pack:category(typeid, false)
+    end
 
-                if not cat:ancestorsactive() then
-                    M.hidecategory(cat)
-                end
+    -- one recursive query per pack computes the exact set of categories that
+    -- should be visible; diffing it against what's currently materialized
+    -- means a bulk toggle (a parent with hundreds of descendants) does one
+    -- query, then touches only the categories that actually changed instead
+    -- of re-walking ancestors per category
+    for name, mp in pairs(M.packs) do
+        local wanted = mp:activecatsinmap(ml.mapid)
+        local current = activetypeids[name] or {}
+
+        local hide = {}
+        for typeid in pairs(current) do
+            if not wanted[typeid] then table.insert(hide, typeid) end
+        end
+        for _,typeid in ipairs(hide) do
+            -- a parent earlier in the list may have already hidden this one
+            if activetypeids[name] and activetypeids[name][typeid] then
+                M.hidecategory(mp:category(typeid, false))
             end
         end
+
+        local n = 0
+        for typeid in pairs(wanted) do
+            if not current[typeid] then
+                M.showcategory(mp:category(typeid, false))
+            end
+            n = n + 1
+            if n % 8 == 0 then coroutine.yield() end
+        end
     end
+end
 
-    for name, mp in pairs(M.packs) do
-        for cat in mp:categoriesinmapiter(ml.mapid) do
+-- Learned map adjacency. Every observed map transition is recorded (both
+-- directions) in settings; when a map becomes current, the packs' textures
+-- for its known neighbors are decoded in the background so the next map
+-- change mostly finds everything already resident.
+local lastmapid = nil
+local prefetchedmaps = {}
+
+local function recordadjacency(from, to)
+    if not from or from==0 or from==to then return end
+
+    local adj = settings:get('mapAdjacency') or {}
+
+    local fkey = tostring(from)
+    local tkey = tostring(to)
+
+    adj[fkey] = adj[fkey] or {}
+    adj[fkey][tkey] = true
+    adj[tkey] = adj[tkey] or {}
+    adj[tkey][fkey] = true
+
+    settings:set('mapAdjacency', adj)
+end
+
+local function prefetchtexture(pack, texturename, opts)
+    if not texturename or texturearray:has(texturename) then return end
+
+    local df = pack:datafile(texturename)
+    local texdata = df:data()
+
+    if texdata then
+        texturearray:add(texturename, texdata, opts)
+    end
+end
+
+local function prefetchmap(mapid)
+    if prefetchedmaps[mapid] then return end
+    prefetchedmaps[mapid] = true
+
+    log:debug("Prefetching markers for map %d...", mapid)
+
+    for name, pack in pairs(M.packs) do
+        for cat in pack:categoriesinmapiter(mapid) do
             if cat:ancestorsactive() then
-                M.showcategory(cat)
+                for m in cat:markersinmapiter(mapid) do
+                    prefetchtexture(pack, m.iconfile, { async = true, atlas = true })
+                    coroutine.yield()
+                end
+
+                for t in cat:trailsinmapiter(mapid) do
+                    -- trail textures can't be atlas packed or still loading
+                    -- when the trail is added, so load them synchronously
+                    prefetchtexture(pack, t.texture, { atlas = false })
+                    coroutine.yield()
+                end
             end
             coroutine.yield()
         end
     end
 end
 
+local function prefetchneighbors()
+    local adj = settings:get('mapAdjacency')
+    if not adj then return end
+
+    local neighbors = adj[tostring(ml.mapid)]
+    if not neighbors then return end
+
+    for nid in pairs(neighbors) do
+        prefetchmap(tonumber(nid))
+    end
+end
+
+-- Texture residency paging. Sprites and trails are already rebuilt per map,
+-- but decoded textures accumulate in the shared texture map across every map
+-- visited (plus prefetched neighbors). Track recently visited maps as an LRU;
+-- once more maps than maxResidentMaps have contributed textures, flush the
+-- texture map and let the current map's textures lazily re-add, so texture
+-- memory stays bounded by the LRU window instead of the whole session.
+settings:setdefault('maxResidentMaps', 4)
+
+local residentmaps = {}
+
+local function pageouttextures()
+    -- move-to-end LRU: revisiting a resident map must not count against the
+    -- budget (ping-ponging between two maps shouldn't flush anything)
+    for i,mid in ipairs(residentmaps) do
+        if mid==ml.mapid then
+            table.remove(residentmaps, i)
+            break
+        end
+    end
+    table.insert(residentmaps, ml.mapid)
+
+    if #residentmaps <= settings:get('maxResidentMaps') then return end
+
+    log:info("Texture LRU over budget (%d maps); flushing texture cache.", #residentmaps)
+
+    texturearray:clear()
+    residentmaps = { ml.mapid }
+    prefetchedmaps = {}
+end
+
+-- Decode every icon texture a pack ships into the shared atlas in the
+-- background. Run after an import so a freshly installed pack renders its
+-- markers without on-demand decode stalls (map prefetching skips maps it has
+-- already seen, so a new pack's textures wouldn't be warmed otherwise).
+function M.precachepack(pack)
+    local s = pack.db:prepare([[
+        SELECT DISTINCT value FROM markerprops WHERE property = 'iconfile'
+    ]])
+
+    local n = 0
+    for row in function() return s:step() end do
+        prefetchtexture(pack, row.value, { async = true, atlas = true })
+        n = n + 1
+        if n % 8 == 0 then coroutine.yield() end
+    end
+    s:finalize()
+
+    log:info('Pre-cached %d icon textures.', n)
+end
+
 local function onmapchange()
+    recordadjacency(lastmapid, ml.mapid)
+    lastmapid = ml.mapid
+
+    pageouttextures()
+
     coordconverter = gw2.coordconverter:new()
     M.reloadcategories(true)
+
+    -- release sqlite page caches grown during queries on the previous map
+    for name, pack in pairs(M.packs) do
+        pack.db:execute('PRAGMA shrink_memory')
+    end
+
+    -- after the current map is up, warm up the neighbors
+    prefetchneighbors()
 end
 
 local function onstartup()
@@ -8,6 +8,7 @@ markers.package
 
 local sqlite = require 'sqlite'
 local logger = require 'logger'
+local overlay = require 'eg-overlay'
 local settings = require 'markers.settings'
 
 local log = logger.logger:new('markers.package')
@@ -90,7 +91,7 @@ end
 function M.markerpack:new(path)
     local mp = {}
     
-    local dbok, db = pcall(sqlite.open, path)
+    local dbok, db = pcall(sqlite.open, path, 'tuned')
 
     if not dbok then
         error(string.format("Couldn't open markerpack: %s", db), 2)
@@ -116,6 +117,22 @@ function M.markerpack:new(path)
     mp.db:execute("PRAGMA journal_mode = WAL")
     mp.db:execute("PRAGMA synchronous = NORMAL")
 
+    -- periodic maintenance: checkpoint the WAL and re-run the analysis
+    -- driven optimize on the connection's worker thread. maintain() refuses
+    -- to run while the player is in combat, so calling it blindly on a
+    -- timer is safe
+    mp.maintenance_timer = overlay.interval(300, function()
+        mp.db:maintain()
+    end)
+
+    -- touch the hot tables/indexes in the background so the first real
+    -- map-change query hits warm pages instead of cold I/O
+    mp.db:warmup({
+        'SELECT COUNT(*) FROM markers',
+        'SELECT COUNT(*) FROM trails',
+        'SELECT COUNT(*) FROM categories'
+    })
+
     -- prepare all statements once and use them over and over again
     mp.statements = {
         markerpack = {},
@@ -143,6 +160,24 @@ function M.markerpack:new(path)
         SELECT * FROM actives
     ]])
 
+    mp.statements.markerpack.activecatsinmap = db:prepare([[
+        WITH RECURSIVE
+            actives (typeid) AS (
+                SELECT typeid FROM categories
+                WHERE parent IS NULL AND active = TRUE
+                UNION ALL
+                SELECT child.typeid FROM categories AS child, actives AS parent
+                WHERE child.parent = parent.typeid
+                  AND child.active = TRUE
+            )
+        SELECT typeid FROM actives
+        WHERE typeid IN (
+            SELECT DISTINCT type FROM markers WHERE mapid = :mapid
+            UNION
+            SELECT DISTINCT type FROM trails WHERE mapid = :mapid
+        )
+    ]])
+
     -- categories --
     mp.statements.category.insert = db:prepare([[
         INSERT INTO categories (typeid, parent, seq) VALUES (:typeid, :parent, :seq)
@@ -229,11 +264,15 @@ function M.markerpack:new(path)
     mp.statements.marker.delprop = db:prepare([[ DELETE FROM markerprops WHERE marker = :id AND property = :property ]])
     mp.statements.marker.setmapid = db:prepare([[ UPDATE markers SET mapid = :mapid WHERE id = :id ]])
     mp.statements.marker.getmapid = db:prepare([[ SELECT mapid FROM markers WHERE id = :id ]])
+    mp.statements.marker.setsourcefile = db:prepare([[ UPDATE markers SET sourcefile = :sourcefile WHERE id = :id ]])
+    mp.statements.marker.deletefromfile = db:prepare([[ DELETE FROM markers WHERE sourcefile = :sourcefile ]])
     mp.statements.marker.delete = db:prepare([[ DELETE FROM markers WHERE id = :id ]])
 
     -- trails --
     mp.statements.trail.setmapid = db:prepare([[ UPDATE trails SET mapid = :mapid WHERE id = :id ]])
     mp.statements.trail.getmapid = db:prepare([[ SELECT mapid FROM trails WHERE id = :id ]])
+    mp.statements.trail.setsourcefile = db:prepare([[ UPDATE trails SET sourcefile = :sourcefile WHERE id = :id ]])
+    mp.statements.trail.deletefromfile = db:prepare([[ DELETE FROM trails WHERE sourcefile = :sourcefile ]])
     mp.statements.trail.maxcoordseq = db:prepare([[ SELECT MAX(seq) + 1 AS newseq FROM trailcoords WHERE trail = :id ]])
     mp.statements.trail.addcoord = db:prepare([[
         INSERT INTO trailcoords (trail, seq, x, y, z)
@@ -376,6 +415,33 @@ function M.markerpack:toplevelcategoriesiter()
     return iter
 end
 
+--[[ RST
+    .. lua:method:: activecatsinmap(mapid)
+
+        Return the set of category typeids that have markers or trails in
+        ``mapid`` and are active with all of their ancestors active, computed
+        in a single recursive query. Keys are typeids, values ``true``.
+
+        :param integer mapid:
+        :rtype: table
+
+        .. versionhistory::
+            :0.1.0: Added
+]]--
+function M.markerpack:activecatsinmap(mapid)
+    local s = self.statements.markerpack.activecatsinmap
+    s:reset()
+    s:bind(':mapid', mapid)
+
+    local set = {}
+    for r in function() return s:step() end do
+        set[r.typeid] = true
+    end
+    s:reset()
+
+    return set
+end
+
 function M.markerpack:categoriesinmapiter(mapid)
     local s = self.statements.markerpack.catsinmap
     s:reset()
@@ -449,6 +515,31 @@ function M.markerpack:datafile(path)
     return df
 end
 
+--[[ RST
+    .. lua:method:: removefromfile(file)
+
+        Remove all markers and trails that were loaded from the given pack
+        file. Used before re-importing a changed file.
+
+        :param string file:
+
+        .. versionhistory::
+            :0.1.0: Added
+]]--
+function M.markerpack:removefromfile(file)
+    local dm = self.statements.marker.deletefromfile
+    dm:reset()
+    dm:bind(':sourcefile', file)
+    dm:step()
+    dm:reset()
+
+    local dt = self.statements.trail.deletefromfile
+    dt:reset()
+    dt:bind(':sourcefile', file)
+    dt:step()
+    dt:reset()
+end
+
 function M.markerpack:verifydata()
     self.db:execute([[
         CREATE TABLE IF NOT EXISTS markerpack (
@@ -496,7 +587,6 @@ function M.markerpack:verifydata()
         )
     ]])
     self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_markers_type ON markers (type) ]])
-    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_markers_mapid ON markers (mapid) ]])
 
     self.db:execute([[
         CREATE TABLE IF NOT EXISTS markerprops (
@@ -515,7 +605,6 @@ function M.markerpack:verifydata()
         )
     ]])
     self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_trails_type ON trails (type) ]])
-    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_trails_mapid ON trails (mapid) ]])
 
     self.db:execute([[
         CREATE TABLE IF NOT EXISTS trailprops (
@@ -545,6 +634,28 @@ function M.markerpack:verifydata()
         ) WITHOUT ROWID
     ]])
 
+    -- added after the initial schema: which pack file markers/trails came
+    -- from, so reloads can replace only the content of changed files
+    local havesource = self.db:execute([[
+        SELECT COUNT(*) AS count FROM pragma_table_info('markers') WHERE name = 'sourcefile'
+    ]])
+    if havesource.count==0 then
+        self.db:execute([[ ALTER TABLE markers ADD COLUMN sourcefile TEXT ]])
+        self.db:execute([[ ALTER TABLE trails ADD COLUMN sourcefile TEXT ]])
+    end
+    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_markers_sourcefile ON markers (sourcefile) ]])
+    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_trails_sourcefile ON trails (sourcefile) ]])
+
+    -- map-change migration: the hot queries are mapid+type shaped (the
+    -- category list for a map, then ids per category per map). a composite
+    -- index answers both from the index alone (the rowid rides along), so
+    -- map changes stop doing a row lookup per marker. the old single-column
+    -- map indexes are a prefix of these and get dropped
+    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_markers_map_type ON markers (mapid, type) ]])
+    self.db:execute([[ CREATE INDEX IF NOT EXISTS idx_trails_map_type ON trails (mapid, type) ]])
+    self.db:execute([[ DROP INDEX IF EXISTS idx_markers_mapid ]])
+    self.db:execute([[ DROP INDEX IF EXISTS idx_trails_mapid ]])
+
     return true
 end
 
@@ -1028,6 +1139,26 @@ function M.marker:mapid(value)
     end
 end
 
+--[[ RST
+    .. lua:method:: sourcefile(value)
+
+        Set the pack file this marker was loaded from, used to replace only
+        the content of changed files on reload.
+
+        :param string value:
+
+        .. versionhistory::
+            :0.1.0: Added
+]]--
+function M.marker:sourcefile(value)
+    local s = self.category.markerpack.statements.marker.setsourcefile
+    s:reset()
+    s:bind(':sourcefile', value)
+    s:bind(':id', self.id)
+    s:step()
+    s:reset()
+end
+
 --[[ RST
     .. lua:method:: delete()
 
@@ -1136,6 +1267,26 @@ function M.trail:mapid(value)
     end
 end
 
+--[[ RST
+    .. lua:method:: sourcefile(value)
+
+        Set the pack file this trail was loaded from, used to replace only
+        the content of changed files on reload.
+
+        :param string value:
+
+        .. versionhistory::
+            :0.1.0: Added
+]]--
+function M.trail:sourcefile(value)
+    local s = self.category.markerpack.statements.trail.setsourcefile
+    s:reset()
+    s:bind(':sourcefile', value)
+    s:bind(':id', self.id)
+    s:step()
+    s:reset()
+end
+
 
 --[[ RST
     .. lua:method:: addpoint(x, y, z)
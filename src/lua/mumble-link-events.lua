@@ -52,45 +52,20 @@ Events
 ]]--
 
 local overlay = require 'eg-overlay'
-local logger = require 'logger'
-local ml = require 'mumble-link'
 
 local mod = {}
 
-local log = logger.logger:new("mumble-link-events")
+-- the change detection and event queueing is done natively (see
+-- mumble_link_update_events in src/mumble-link.c); this module just tracks
+-- availability for modules that read mod.is_available
 mod.is_available = false
-mod.last_tick = ml.tick
-mod.last_tick_time = overlay.time()
-local map_id = ml.mapid
-
-local tick_to_tick_time = 0.4
-
-function mod.update()
-    local now = overlay.time()
-    if not mod.is_available and mod.last_tick~=ml.tick then
-        mod.is_available = true
-        overlay.queueevent('mumble-link-available')
-        log:debug('MumbleLink available')
-    elseif mod.is_available and mod.last_tick==ml.tick and now - mod.last_tick_time >= tick_to_tick_time then
-        mod.is_available = false
-        overlay.queueevent('mumble-link-unavailable')
-        log:debug('MumbleLink unavailable')
-    end
-
-    if mod.last_tick ~= ml.tick then
-        mod.last_tick = ml.tick
-        mod.last_tick_time = now
-    end
-
-    if not mod.is_available then return end
-
-    if map_id~=ml.mapid then
-        log:debug('MumbleLink new map ( %d -> %d )', map_id, ml.mapid)
-        map_id = ml.mapid
-        overlay.queueevent('mumble-link-map-changed')
-    end
-end
-
-overlay.addeventhandler('update', mod.update)
+
+overlay.addeventhandler('mumble-link-available', function()
+    mod.is_available = true
+end)
+
+overlay.addeventhandler('mumble-link-unavailable', function()
+    mod.is_available = false
+end)
 
 return mod
@@ -15,6 +15,7 @@ local uih = require 'ui-helpers'
 local overlay = require 'eg-overlay'
 local sqlite = require 'sqlite'
 local settings = require 'settings'
+local profiler = require 'profiler'
 
 local overlay_stats = {}
 
@@ -70,6 +71,18 @@ local function seperator()
 end
 
 local fps = stat_line('FPS', '???')
+local frametime = stat_line('Frame (CPU)', '?? ms')
+local degrade = stat_line('Degradation', '0')
+local gputime = stat_line('Frame (GPU)', '?? ms')
+
+seperator()
+
+-- per zone timings from the native profiler, see src/profiler.c
+local zone_lines = {}
+local zone_names = { 'events', 'coroutines', 'event-queue', 'draw-3d', 'ui' }
+for i, zone in ipairs(zone_names) do
+    zone_lines[zone] = stat_line('  ' .. zone, '?? ms')
+end
 
 seperator()
 
@@ -116,6 +129,16 @@ function overlay_stats.update()
 
     fps.value:update_text(string.format('%.2f', cur_fps))
 
+    local frame = profiler.lastframe()
+    frametime.value:update_text(string.format('%.2f ms', frame.frame))
+    degrade.value:update_text(string.format('%d', overlay.degradationlevel()))
+    if frame.gpu >= 0 then
+        gputime.value:update_text(string.format('%.2f ms', frame.gpu))
+    end
+    for zone, line in pairs(zone_lines) do
+        line.value:update_text(string.format('%.2f ms', frame.zones[zone] or 0.0))
+    end
+
     local mem = overlay.memusage()
     mem_cur.value:update_text(string.format('%.2f MB', mem.working_set / 1024.0 / 1024.0))
     mem_peak.value:update_text(string.format('%.2f MB', mem.peak_working_set / 1024.0 / 1024.0))
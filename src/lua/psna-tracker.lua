@@ -18,6 +18,7 @@ location is clicked.
 
 local ui = require 'eg-overlay-ui'
 local overlay = require 'eg-overlay'
+local schedule = require 'schedule'
 local uih = require 'ui-helpers'
 local settings = require 'settings'
 local logger = require 'logger'
@@ -218,64 +219,72 @@ psna.agents = {
     )
 }
 
-psna.weekday = 0
+-- agents move at 08:00 UTC; the schedule engine fires onchange exactly at
+-- that boundary, so nothing recomputes dates between rotations
+psna.rotation = schedule.weekly(8)
 
-psna.lastupdate = os.time()
+psna.weekday = 0
 
 local function agent_update_txt(agent, weekday)
     agent.loc_txt:update_text(agent.locations[weekday])
 end
 
-local function update()
-    local now = os.time()
-    if os.difftime(now, psna.lastupdate) < 1 then return end
+local function update_locations(weekday)
+    if weekday~=psna.weekday then
+        for n,a in pairs(psna.agents) do
+            agent_update_txt(a, weekday)
+        end
+        psna.weekday = weekday
+    end
+end
 
-    psna.lastupdate = now
+local function update_countdown()
+    local secs = psna.rotation:nextchange()
 
-    local date = os.date('!*t')
-    local weekday = date.wday
+    local hrstomove = secs // 3600
+    local minstomove = (secs % 3600) // 60
 
-    if date.hour < 8 then
-        weekday = weekday - 1
-        if weekday < 1 then weekday = 7 end
-    end
+    psna.timetomovetxt:update_text(string.format('Agents move in: %d hr %d min', hrstomove, minstomove))
+end
 
-    local hrstomove
-    if date.hour < 8 then
-        hrstomove = 8 - date.hour - 1
-    else
-        hrstomove = 32 - date.hour - 1
-    end
+psna.rotation:onchange(function(slot)
+    update_locations(slot)
+    update_countdown()
+end)
 
-    local minstomove = 60 - date.min
+local function show()
+    update_locations(psna.rotation:slot())
+    update_countdown()
 
-    local timetomove = string.format('Agents move in: %d hr %d min', hrstomove, minstomove)
+    -- the countdown shows minutes; refresh it once a minute while visible
+    psna.countdown_timer = overlay.interval(60, update_countdown)
+    psna.win:show()
+end
 
-    if weekday~=psna.weekday then
-        for n,a in pairs(psna.agents) do
-            agent_update_txt(a, weekday)
-        end
-        psna.weekday = weekday
+local function hide()
+    if psna.countdown_timer then
+        overlay.canceltimer(psna.countdown_timer)
+        psna.countdown_timer = nil
     end
-    
-    psna.timetomovetxt:update_text(timetomove)
+    psna.win:hide()
 end
 
 local function primary_action(event)
     if event=='click-left' then
         if psna_settings:get("window.show") then
-            psna.win:hide()
             psna_settings:set("window.show", false)
-            overlay.removeeventhandler('update', psna.update_handler_id)
-            psna.update_handler_id = nil
+            hide()
         else
-            psna.win:show()
             psna_settings:set("window.show", true)
-            psna.update_handler_id = overlay.addeventhandler('update', update)
+            show()
         end
     end
 end
 
+-- exported so lazy activation stubs can delegate menu clicks after the
+-- module loads on demand
+psna.primary_action = primary_action
+
 local function on_startup()
     overlay.queueevent('register-module-actions', {
         name = "PSNA Tracker",
@@ -284,8 +293,7 @@ local function on_startup()
 end
 
 if psna_settings:get('window.show') then
-    psna.update_handler_id = overlay.addeventhandler('update', update)
-    psna.win:show()
+    show()
 end
 
 overlay.addeventhandler('startup', on_startup)
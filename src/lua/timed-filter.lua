@@ -0,0 +1,77 @@
+--[[ RST
+timed-filter
+============
+
+.. lua:module:: timed-filter
+
+.. code-block:: lua
+
+    local timedfilter = require 'timed-filter'
+
+Time-gated marker visibility with zero steady-state cost.
+
+Packs tag time-limited content (festival windows, daily rotations) with
+sprite ``filterbits``; this module owns those bits. Each window binds a bit
+to a :lua:mod:`schedule` and a set of active slots: the bit is applied once
+when the window is registered and re-applied exactly when the schedule
+crosses a boundary (driven by the native timer wheel), so nothing checks the
+wall clock per marker or per frame.
+
+.. code-block:: lua
+    :caption: Example
+
+    local schedule = require 'schedule'
+    local timedfilter = require 'timed-filter'
+
+    -- bit 0x10 active only on weekends (Lua weekdays 1 = Sunday, 7 = Saturday)
+    timedfilter.window(0x10, schedule.weekly(8), {1, 7})
+]]--
+
+local o3d = require 'eg-overlay-3d'
+
+local M = {}
+
+local function applywindow(bit, slots, slot)
+    o3d.setfilterbits(bit, slots[slot] or false)
+end
+
+--[[ RST
+Functions
+---------
+
+.. lua:function:: window(bit, sched, activeslots)
+
+    Bind filter state ``bit`` to a schedule: the bit is set while the
+    schedule's current slot is one of ``activeslots`` and cleared otherwise,
+    recomputed only at schedule boundaries.
+
+    :param integer bit: A filter state bit (or mask) to own.
+    :param sched: A :lua:class:`schedule`.
+    :param activeslots: A sequence of slot indices during which the bit is
+        active.
+    :type activeslots: table
+    :rtype: schedule
+
+    .. important::
+        The schedule's ``onchange`` callback is owned by the window; pass a
+        dedicated schedule instance per window.
+
+    .. versionhistory::
+        :0.1.0: Added
+]]--
+function M.window(bit, sched, activeslots)
+    local slots = {}
+    for _,s in ipairs(activeslots) do
+        slots[s] = true
+    end
+
+    applywindow(bit, slots, sched:slot())
+
+    sched:onchange(function(slot)
+        applywindow(bit, slots, slot)
+    end)
+
+    return sched
+end
+
+return M
@@ -1,42 +1,39 @@
-local logger = require 'logger'
+--[[ RST
+xml-cleaner
+===========
+
+.. lua:module:: xml-cleaner
+
+Repair malformed marker pack XML before parsing.
+
+The actual repair is done by the native streaming cleaner in
+:lua:func:`libxml2.cleaner`; this module keeps the old whole-string
+``cleanxml`` entry point and adds :lua:func:`newcleaner` for callers that can
+stream chunks instead of duplicating the document in memory.
+]]--
+local xml = require 'libxml2'
 
 local M = {}
 
-local log = logger.logger:new("xml-cleaner")
+-- feed whole documents through the streaming cleaner in bounded pieces so
+-- the repair only ever holds one chunk of repaired output at a time beyond
+-- the result being assembled
+local CHUNK = 65536
 
 function M.cleanxml(xmldata, xmlname)
-    local outlines = {}
-
-    local linechars = {}
-    for c = 1, xmldata:len() do
-        local ch = xmldata:sub(c,c)
-        table.insert(linechars, ch)
-
-        if ch=='\n' then
-            table.insert(outlines, table.concat(linechars,''))
-            linechars = {}
-        elseif ch=='&' then
-            for lookahead = c + 1, xmldata:len() do
-                local lach = xmldata:sub(lookahead,lookahead)
-
-                if lach==';' then break end
-
-                if lach and not lach:match('[%a%d:%.%-]') then
-                    log:warn('%s:%d: invalid entity: %s', xmlname, #outlines + 1, xmldata:sub(c, lookahead))
-
-                    -- assume this is a raw ampersand and escape it
-                    table.insert(linechars, 'amp;')
-                    break
-                end
-            end
-        end
-    end
+    local cleaner = xml.cleaner(xmlname)
 
-    if #linechars > 0 then
-        table.insert(outlines, table.concat(linechars, ''))
+    local out = {}
+    for pos = 1, #xmldata, CHUNK do
+        table.insert(out, cleaner:clean(string.sub(xmldata, pos, pos + CHUNK - 1)))
     end
+    table.insert(out, cleaner:finish())
+
+    return table.concat(out)
+end
 
-    return table.concat(outlines, '')
+function M.newcleaner(xmlname)
+    return xml.cleaner(xmlname)
 end
 
 return M
@@ -28,9 +28,13 @@ data from Guild Wars 2. The shared memory is read on each attribute access.
 */
 
 #include <windows.h>
+#include <math.h>
+#include <stdio.h>
 #include "mumble-link.h"
 #include "utils.h"
 #include "logging/logger.h"
+#include "lua-manager.h"
+#include "lua-json.h"
 #include <stdint.h>
 #include <lua.h>
 #include <lauxlib.h>
@@ -109,12 +113,281 @@ typedef struct ml_t {
     gw2_ml_t *gw2_ml;
     logger_t *log;
 
-    uint32_t identity_tick;
+    uint32_t identity_hash;
     json_t *identity_cache;
 } ml_t;
 
 static ml_t *ml = NULL;
 
+// Secondary named link maps for multiboxed sessions: one overlay instance
+// tracks additional clients launched with -mumble <name>. Each link is
+// captured in the same per-frame pass as the primary and exposed to Lua
+// through ml.openlink(name).
+#define ML_MAX_LINKS 8
+
+typedef struct {
+    char *name;
+    HANDLE map_file;
+    gw2_ml_t *gw2_ml;
+    gw2_ml_t snapshot;
+} ml_secondary_t;
+
+static ml_secondary_t ml_links[ML_MAX_LINKS];
+static int ml_link_count = 0;
+
+void mumble_link_close_links();
+
+// Per frame coherent snapshot of the shared memory. The game writes the
+// struct while we read; copying field by field produced torn reads
+// (position from one game frame, camera from another). The game bumps tick
+// once per update, so a seqlock style retry loop gives every consumer one
+// coherent view per overlay frame.
+static gw2_ml_t ml_snapshot;
+
+// script mode has no frame loop to run mumble_link_capture; reads capture
+// on demand there instead
+static int ml_lazy_capture = 0;
+
+void mumble_link_enable_lazy_capture() {
+    ml_lazy_capture = 1;
+}
+
+// Interpolation state: when the overlay renders between game frames the
+// avatar/camera positions in the snapshot are extrapolated from the last
+// observed velocity, so markers track smoothly instead of juddering at the
+// game's tick rate. Teleports (large per-tick displacement) snap instead
+// of extrapolating.
+typedef struct {
+    float x;
+    float y;
+    float z;
+} ml_vec3_t;
+
+static uint32_t smooth_last_tick = 0;
+static double smooth_last_time = 0.0;
+static ml_vec3_t smooth_avatar_raw;
+static ml_vec3_t smooth_camera_raw;
+static ml_vec3_t smooth_avatar_vel;
+static ml_vec3_t smooth_camera_vel;
+
+#define ML_SNAP_DISTANCE 3.0f // meters per tick; anything larger is a teleport
+
+static void mumble_link_smooth_positions() {
+    double now = (double)GetTickCount64() / 1000.0;
+
+    if (ml_snapshot.tick!=smooth_last_tick) {
+        // a new game frame: refresh the velocity estimate from raw deltas
+        double dt = now - smooth_last_time;
+
+        float dx = ml_snapshot.avatar_position.x - smooth_avatar_raw.x;
+        float dy = ml_snapshot.avatar_position.y - smooth_avatar_raw.y;
+        float dz = ml_snapshot.avatar_position.z - smooth_avatar_raw.z;
+
+        float dist = sqrtf((dx * dx) + (dy * dy) + (dz * dz));
+
+        if (dt > 0.0 && dt < 0.25 && dist < ML_SNAP_DISTANCE) {
+            smooth_avatar_vel.x = (float)(dx / dt);
+            smooth_avatar_vel.y = (float)(dy / dt);
+            smooth_avatar_vel.z = (float)(dz / dt);
+
+            smooth_camera_vel.x = (float)((ml_snapshot.camera_position.x - smooth_camera_raw.x) / dt);
+            smooth_camera_vel.y = (float)((ml_snapshot.camera_position.y - smooth_camera_raw.y) / dt);
+            smooth_camera_vel.z = (float)((ml_snapshot.camera_position.z - smooth_camera_raw.z) / dt);
+        } else {
+            // stall, first sample, or teleport: don't extrapolate
+            smooth_avatar_vel = (ml_vec3_t){0};
+            smooth_camera_vel = (ml_vec3_t){0};
+        }
+
+        smooth_avatar_raw.x = ml_snapshot.avatar_position.x;
+        smooth_avatar_raw.y = ml_snapshot.avatar_position.y;
+        smooth_avatar_raw.z = ml_snapshot.avatar_position.z;
+        smooth_camera_raw.x = ml_snapshot.camera_position.x;
+        smooth_camera_raw.y = ml_snapshot.camera_position.y;
+        smooth_camera_raw.z = ml_snapshot.camera_position.z;
+
+        smooth_last_tick = ml_snapshot.tick;
+        smooth_last_time = now;
+        return;
+    }
+
+    // between game frames: extrapolate from the last raw sample, bounded so
+    // a stalled game doesn't fly markers off into the distance
+    double dt = now - smooth_last_time;
+    if (dt > 0.1) dt = 0.1;
+
+    ml_snapshot.avatar_position.x = smooth_avatar_raw.x + (float)(smooth_avatar_vel.x * dt);
+    ml_snapshot.avatar_position.y = smooth_avatar_raw.y + (float)(smooth_avatar_vel.y * dt);
+    ml_snapshot.avatar_position.z = smooth_avatar_raw.z + (float)(smooth_avatar_vel.z * dt);
+
+    ml_snapshot.camera_position.x = smooth_camera_raw.x + (float)(smooth_camera_vel.x * dt);
+    ml_snapshot.camera_position.y = smooth_camera_raw.y + (float)(smooth_camera_vel.y * dt);
+    ml_snapshot.camera_position.z = smooth_camera_raw.z + (float)(smooth_camera_vel.z * dt);
+}
+
+// Outbound publish channel: a shared memory segment mirroring the coherent
+// snapshot plus overlay computed fields, written once per frame with the
+// same seqlock pattern (odd sequence while writing). Companion processes
+// map "EGOverlayState", read seq, copy, and retry if seq changed or is odd
+// — no IPC round trips and no need to re-derive anything from MumbleLink.
+typedef struct {
+    uint32_t seq;
+    uint32_t version;
+
+    gw2_ml_t data;
+
+    // overlay computed
+    float frame_ms;
+    uint32_t overlay_frame; // increments once per published frame
+} eg_overlay_published_t;
+
+#define EG_OVERLAY_PUBLISH_VERSION 1
+
+static HANDLE publish_file = NULL;
+static eg_overlay_published_t *published = NULL;
+static uint32_t publish_frame = 0;
+
+void mumble_link_publish(float frame_ms) {
+    if (!published) {
+        if (publish_file) return; // creation failed earlier
+
+        publish_file = CreateFileMapping(
+            INVALID_HANDLE_VALUE,
+            NULL,
+            PAGE_READWRITE,
+            0,
+            sizeof(eg_overlay_published_t),
+            "EGOverlayState"
+        );
+
+        if (!publish_file) return;
+
+        published = (eg_overlay_published_t*)MapViewOfFile(
+            publish_file,
+            FILE_MAP_ALL_ACCESS,
+            0, 0,
+            sizeof(eg_overlay_published_t)
+        );
+
+        if (!published) return;
+
+        published->version = EG_OVERLAY_PUBLISH_VERSION;
+    }
+
+    published->seq++; // odd: write in progress
+    MemoryBarrier();
+
+    published->data = ml_snapshot;
+    published->frame_ms = frame_ms;
+    published->overlay_frame = ++publish_frame;
+
+    MemoryBarrier();
+    published->seq++; // even: consistent
+}
+
+// Capture/replay for deterministic benchmarking: --capture-mumble appends
+// every new tick's snapshot to a compact binary log; --replay-mumble feeds
+// those snapshots back one per frame instead of reading the shared memory,
+// so a reported session can be re-driven on any machine. EGMC header, then
+// raw gw2_ml_t records.
+#define ML_CAPTURE_MAGIC "EGMC"
+
+static FILE *ml_capture_file = NULL;
+static uint32_t ml_capture_last_tick = 0;
+
+static FILE *ml_replay_file = NULL;
+static int ml_replay_done = 0;
+
+int mumble_link_start_capture(const char *path) {
+    ml_capture_file = fopen(path, "wb");
+    if (!ml_capture_file) return 0;
+
+    fwrite(ML_CAPTURE_MAGIC, 1, 4, ml_capture_file);
+
+    return 1;
+}
+
+int mumble_link_start_replay(const char *path) {
+    ml_replay_file = fopen(path, "rb");
+    if (!ml_replay_file) return 0;
+
+    char magic[4] = {0};
+    if (fread(magic, 1, 4, ml_replay_file)!=4 || memcmp(magic, ML_CAPTURE_MAGIC, 4)!=0) {
+        fclose(ml_replay_file);
+        ml_replay_file = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+int mumble_link_in_combat() {
+    return (ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_IN_COMBAT) ? 1 : 0;
+}
+
+int mumble_link_replaying() {
+    return ml_replay_file!=NULL && !ml_replay_done;
+}
+
+void mumble_link_capture_stop() {
+    if (ml_capture_file) {
+        fclose(ml_capture_file);
+        ml_capture_file = NULL;
+    }
+    if (ml_replay_file) {
+        fclose(ml_replay_file);
+        ml_replay_file = NULL;
+    }
+}
+
+static void mumble_link_capture_secondaries() {
+    for (int l=0;l<ml_link_count;l++) {
+        ml_secondary_t *link = &ml_links[l];
+        if (!link->gw2_ml) continue;
+
+        for (int tries=0;tries<4;tries++) {
+            uint32_t tick_before = link->gw2_ml->tick;
+
+            memcpy(&link->snapshot, (const void*)link->gw2_ml, sizeof(gw2_ml_t));
+
+            if (link->gw2_ml->tick==tick_before) break;
+        }
+    }
+}
+
+void mumble_link_capture() {
+    if (ml_link_count) mumble_link_capture_secondaries();
+
+    if (ml_replay_file) {
+        if (fread(&ml_snapshot, sizeof(gw2_ml_t), 1, ml_replay_file)==1) {
+            mumble_link_smooth_positions();
+        } else {
+            ml_replay_done = 1;
+        }
+        return;
+    }
+
+    if (!ml || !ml->gw2_ml) return;
+
+    for (int tries=0;tries<4;tries++) {
+        uint32_t tick_before = ml->gw2_ml->tick;
+
+        memcpy(&ml_snapshot, (const void*)ml->gw2_ml, sizeof(gw2_ml_t));
+
+        if (ml->gw2_ml->tick==tick_before) {
+            mumble_link_smooth_positions();
+
+            if (ml_capture_file && ml_snapshot.tick!=ml_capture_last_tick) {
+                ml_capture_last_tick = ml_snapshot.tick;
+                fwrite(&ml_snapshot, sizeof(gw2_ml_t), 1, ml_capture_file);
+            }
+            return;
+        }
+    }
+    // torn after retries (the game is writing faster than we can copy);
+    // keep the last copy, next frame gets another chance
+}
+
 static void mumble_link_check_identity_cache();
 int mumble_link_open_module(lua_State *L);
 
@@ -148,20 +421,65 @@ void mumble_link_init() {
     lua_manager_add_module_opener("mumble-link", &mumble_link_open_module);
 }
 
-uint32_t mumble_link_tick()    { return ml->gw2_ml->tick;    }
-uint32_t mumble_link_version() { return ml->gw2_ml->version; }
+// Native change detection for the MumbleLink data. Runs once per frame on
+// the render thread and queues the mumble-link-* events only when something
+// actually changed; previously a Lua module re-read the shared memory on
+// every update event to do the same comparisons.
+void mumble_link_update_events() {
+    static uint32_t last_tick = 0;
+    static double last_tick_time = 0.0;
+    static int available = 0;
+    static uint32_t last_map_id = 0;
+
+    if (!ml || !ml->gw2_ml) return;
+
+    double now = (double)GetTickCount64() / 1000.0;
+    uint32_t tick = ml_snapshot.tick;
+
+    // the map the game was already on when the overlay started isn't a
+    // change; modules handle the initial map during startup
+    if (last_tick==0 && tick!=0) last_map_id = ml_snapshot.context.map_id;
+
+    if (!available && last_tick!=0 && last_tick!=tick) {
+        available = 1;
+        lua_manager_queue_event("mumble-link-available", NULL);
+        logger_debug(ml->log, "MumbleLink available");
+    } else if (available && last_tick==tick && now - last_tick_time >= 0.4) {
+        // the game stopped updating the data
+        available = 0;
+        lua_manager_queue_event("mumble-link-unavailable", NULL);
+        logger_debug(ml->log, "MumbleLink unavailable");
+    }
+
+    if (last_tick!=tick) {
+        last_tick = tick;
+        last_tick_time = now;
+    }
+
+    if (!available) return;
+
+    uint32_t map_id = ml_snapshot.context.map_id;
+    if (map_id!=last_map_id) {
+        logger_debug(ml->log, "MumbleLink new map ( %d -> %d )", last_map_id, map_id);
+        last_map_id = map_id;
+        lua_manager_queue_event("mumble-link-map-changed", NULL);
+    }
+}
+
+uint32_t mumble_link_tick()    { return ml_snapshot.tick;    }
+uint32_t mumble_link_version() { return ml_snapshot.version; }
 
 size_t mumble_link_name(char *name, size_t max_size) {
-    return WideCharToMultiByte(CP_UTF8, 0, ml->gw2_ml->name, -1, name, (int)max_size, NULL, NULL);
+    return WideCharToMultiByte(CP_UTF8, 0, ml_snapshot.name, -1, name, (int)max_size, NULL, NULL);
 }
 
 size_t mumble_link_identity(char *identity, size_t max_size) {
-    return WideCharToMultiByte(CP_UTF8, 0, ml->gw2_ml->identity, -1, identity, (int)max_size, NULL, NULL);
+    return WideCharToMultiByte(CP_UTF8, 0, ml_snapshot.identity, -1, identity, (int)max_size, NULL, NULL);
 }
 
 json_t *parse_identity() {
     char ident_mb[512] = {0};
-    WideCharToMultiByte(CP_UTF8, 0, ml->gw2_ml->identity, -1, ident_mb, 512, NULL, NULL);
+    WideCharToMultiByte(CP_UTF8, 0, ml_snapshot.identity, -1, ident_mb, 512, NULL, NULL);
     json_error_t error = {0};
     json_t *ident_json = json_loads(ident_mb, 0, &error);
 
@@ -220,21 +538,21 @@ mumble_link_ui_size_t mumble_link_ui_size() {
 }
 
 void mumble_link_avatar_position(float *x, float *y, float *z) {
-    *x = ml->gw2_ml->avatar_position.x;
-    *y = ml->gw2_ml->avatar_position.y;
-    *z = ml->gw2_ml->avatar_position.z;
+    *x = ml_snapshot.avatar_position.x;
+    *y = ml_snapshot.avatar_position.y;
+    *z = ml_snapshot.avatar_position.z;
 }
 
 void mumble_link_camera_position(float *x, float *y, float *z) {
-    *x = ml->gw2_ml->camera_position.x;
-    *y = ml->gw2_ml->camera_position.y;
-    *z = ml->gw2_ml->camera_position.z;
+    *x = ml_snapshot.camera_position.x;
+    *y = ml_snapshot.camera_position.y;
+    *z = ml_snapshot.camera_position.z;
 }
 
 void mumble_link_camera_front(float *x, float *y, float *z) {
-    *x = ml->gw2_ml->camera_front.x;
-    *y = ml->gw2_ml->camera_front.y;
-    *z = ml->gw2_ml->camera_front.z;
+    *x = ml_snapshot.camera_front.x;
+    *y = ml_snapshot.camera_front.y;
+    *z = ml_snapshot.camera_front.z;
 }
 
 float mumble_link_fov()  {
@@ -246,28 +564,30 @@ float mumble_link_fov()  {
 }
 
 void mumble_link_map_center(float *x, float *y) {
-    *x = ml->gw2_ml->context.map_center_x;
-    *y = ml->gw2_ml->context.map_center_y;
+    *x = ml_snapshot.context.map_center_x;
+    *y = ml_snapshot.context.map_center_y;
 }
 
 void mumble_link_map_size(uint16_t *width, uint16_t *height) {
-    *width = ml->gw2_ml->context.compass_width;
-    *height = ml->gw2_ml->context.compass_height;
+    *width = ml_snapshot.context.compass_width;
+    *height = ml_snapshot.context.compass_height;
 }
 
 float mumble_link_map_scale() {
-    return ml->gw2_ml->context.map_scale;
+    return ml_snapshot.context.map_scale;
 }
 
 float mumble_link_map_rotation() {
-    return ml->gw2_ml->context.compass_rotation;
+    return ml_snapshot.context.compass_rotation;
 }
 
 uint32_t mumble_link_ui_state() {
-    return ml->gw2_ml->context.ui_state;
+    return ml_snapshot.context.ui_state;
 }
 
 void mumble_link_cleanup() {
+    mumble_link_close_links();
+
     if (ml->identity_cache) json_decref(ml->identity_cache);
     if (ml->gw2_ml) UnmapViewOfFile(ml->gw2_ml);
     if (ml->map_file) CloseHandle(ml->map_file);
@@ -275,16 +595,22 @@ void mumble_link_cleanup() {
 }
 
 static void mumble_link_check_identity_cache() {
-    if (ml->identity_cache==NULL || ml->identity_tick!=ml->gw2_ml->tick) {
+    // the identity only changes on character/spec/map changes, but the tick
+    // changes every game frame. hash the raw buffer and reparse only when
+    // the content actually changed
+    uint32_t hash = djb2_hash_data((const uint8_t*)ml_snapshot.identity, sizeof(ml_snapshot.identity));
+
+    if (ml->identity_cache==NULL || ml->identity_hash!=hash) {
         if (ml->identity_cache) json_decref(ml->identity_cache);
 
         ml->identity_cache = parse_identity();
-        ml->identity_tick = ml->gw2_ml->tick;
+        ml->identity_hash = hash;
     }
 }
 
 static int mumble_link_lua_index(lua_State *L);
 static int mumble_link_lua_new_index(lua_State *L);
+int mumble_link_lua_open_link(lua_State *L);
 
 static luaL_Reg ml_funcs[] = {
     "__index",    &mumble_link_lua_index,
@@ -304,6 +630,7 @@ int mumble_link_open_module(lua_State *L) {
 }
 
 int mumble_link_lua_tick(lua_State *L);
+int mumble_link_lua_snapshot(lua_State *L);
 int mumble_link_lua_version(lua_State *L);
 int mumble_link_lua_character_name(lua_State *L);
 int mumble_link_lua_character_profession(lua_State *L);
@@ -322,6 +649,8 @@ int mumble_link_lua_map_open(lua_State *L);
 int mumble_link_lua_in_combat(lua_State *L);
 
 int mumble_link_lua_index(lua_State *L) {
+    if (ml_lazy_capture) mumble_link_capture();
+
     const char *key = luaL_checkstring(L, 2);
     //size_t key_len = strlen(key);
 
@@ -342,6 +671,11 @@ int mumble_link_lua_index(lua_State *L) {
     else if (strcmp(key, "uistate"                )==0) return mumble_link_lua_ui_state(L);
     else if (strcmp(key, "mapopen"                )==0) return mumble_link_lua_map_open(L);
     else if (strcmp(key, "incombat"               )==0) return mumble_link_lua_in_combat(L);
+    else if (strcmp(key, "snapshot"               )==0) return mumble_link_lua_snapshot(L);
+    else if (strcmp(key, "openlink"               )==0) {
+        lua_pushcfunction(L, &mumble_link_lua_open_link);
+        return 1;
+    }
 
     char *mod_name = lua_manager_get_lua_module_name(L);
     logger_warn(ml->log, "%s tried to read mumble-link.%s, does not exist.", mod_name, key);
@@ -545,7 +879,7 @@ void push_ml_xyz(lua_State *L, float *vals) {
         :0.1.0: Renamed from avatar_position to avatarposition
 */
 int mumble_link_lua_avatar_position(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->avatar_position);
+    push_ml_xyz(L, (float*)&ml_snapshot.avatar_position);
     return 1;
 }
 
@@ -564,7 +898,7 @@ int mumble_link_lua_avatar_position(lua_State *L) {
         :0.1.0: Renamed from avatar_front to avatarfront
 */
 int mumble_link_lua_avatar_front(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->avatar_front);
+    push_ml_xyz(L, (float*)&ml_snapshot.avatar_front);
     return 1;
 }
 
@@ -581,7 +915,7 @@ int mumble_link_lua_avatar_front(lua_State *L) {
         :0.1.0: Renamed from avatar_top to avatartop
 */
 int mumble_link_lua_avatar_top(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->avatar_top);
+    push_ml_xyz(L, (float*)&ml_snapshot.avatar_top);
     return 1;
 }
 
@@ -602,7 +936,7 @@ int mumble_link_lua_avatar_top(lua_State *L) {
         :0.1.0: Renamed from camera_position to cameraposition
 */
 int mumble_link_lua_camera_position(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->camera_position);
+    push_ml_xyz(L, (float*)&ml_snapshot.camera_position);
     return 1;
 }
 
@@ -621,7 +955,7 @@ int mumble_link_lua_camera_position(lua_State *L) {
         :0.1.0: Renamed from camera_front to camerafront
 */
 int mumble_link_lua_camera_front(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->camera_front);
+    push_ml_xyz(L, (float*)&ml_snapshot.camera_front);
     return 1;
 }
 
@@ -638,7 +972,7 @@ int mumble_link_lua_camera_front(lua_State *L) {
         :0.1.0: Renamed from camera_top to cameratop
 */
 int mumble_link_lua_camera_top(lua_State *L) {
-    push_ml_xyz(L, (float*)&ml->gw2_ml->camera_top);
+    push_ml_xyz(L, (float*)&ml_snapshot.camera_top);
     return 1;
 }
 
@@ -679,7 +1013,7 @@ int mumble_link_lua_camera_top(lua_State *L) {
         :0.1.0: Renamed from map_type to maptype
 */
 int mumble_link_lua_map_type(lua_State *L) {
-    switch (ml->gw2_ml->context.map_type) {
+    switch (ml_snapshot.context.map_type) {
     case  0: lua_pushstring(L, "redirect");              break;
     case  1: lua_pushstring(L, "character-creation");    break;
     case  2: lua_pushstring(L, "competitive-pvp");       break;
@@ -718,7 +1052,7 @@ int mumble_link_lua_map_type(lua_State *L) {
 */
 
 int mumble_link_lua_map_id(lua_State *L) {
-    lua_pushinteger(L, ml->gw2_ml->context.map_id);
+    lua_pushinteger(L, ml_snapshot.context.map_id);
     return 1;
 }
 
@@ -752,28 +1086,28 @@ int mumble_link_lua_map_id(lua_State *L) {
 int mumble_link_lua_ui_state(lua_State *L) {
     /*
     lua_createtable(L, 0, 7);
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_MAP_OPEN);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_MAP_OPEN);
     lua_setfield(L, -2, "map_open");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_COMPASS_TOP_RIGHT);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_COMPASS_TOP_RIGHT);
     lua_setfield(L, -2, "compass_top_right");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_COMPASS_ROTATE);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_COMPASS_ROTATE);
     lua_setfield(L, -2, "compass_rotate");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_GAME_FOCUS);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_GAME_FOCUS);
     lua_setfield(L, -2, "map_game_focus");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_COMP_MODE);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_COMP_MODE);
     lua_setfield(L, -2, "competitive_mode");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_TEXTBOX_FOCUS);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_TEXTBOX_FOCUS);
     lua_setfield(L, -2, "textbox_focus");
 
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_IN_COMBAT);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_IN_COMBAT);
     lua_setfield(L, -2, "in_combat");
     */
-    lua_pushinteger(L, ml->gw2_ml->context.ui_state);
+    lua_pushinteger(L, ml_snapshot.context.ui_state);
 
     return 1;
 }
@@ -790,7 +1124,7 @@ int mumble_link_lua_ui_state(lua_State *L) {
         :0.1.0: Added
 */
 int mumble_link_lua_map_open(lua_State *L) {
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_MAP_OPEN);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_MAP_OPEN);
     return 1;
 }
 
@@ -806,7 +1140,7 @@ int mumble_link_lua_map_open(lua_State *L) {
         :0.1.0: Added
 */
 int mumble_link_lua_in_combat(lua_State *L) {
-    lua_pushboolean(L, ml->gw2_ml->context.ui_state & MUMBLE_LINK_UI_STATE_IN_COMBAT);
+    lua_pushboolean(L, ml_snapshot.context.ui_state & MUMBLE_LINK_UI_STATE_IN_COMBAT);
     return 1;
 }
 
@@ -826,3 +1160,245 @@ Data
     .. versionhistory::
         :0.0.1: Added
 */
+
+// block writes to the shared snapshot
+static int mumble_link_lua_snapshot_newindex(lua_State *L) {
+    return luaL_error(L, "mumble-link snapshot tables are read-only");
+}
+
+static void mumble_link_push_vec(lua_State *L, float x, float y, float z) {
+    lua_createtable(L, 0, 3);
+    lua_pushnumber(L, x);
+    lua_setfield(L, -2, "x");
+    lua_pushnumber(L, y);
+    lua_setfield(L, -2, "y");
+    lua_pushnumber(L, z);
+    lua_setfield(L, -2, "z");
+}
+
+/*** RST
+    .. lua:attribute:: snapshot: table
+
+        A read-only table holding the current MumbleLink state: ``tick``,
+        ``mapid``, ``maptype``, ``uistate``, ``avatarposition``,
+        ``cameraposition`` and ``camerafront`` (as ``{x, y, z}`` tables),
+        and ``identity`` (the parsed identity object).
+
+        The table is built once per MumbleLink tick and shared by every
+        reader, so N modules reading player state per frame cost one build
+        instead of N conversions (the identity JSON in particular is parsed
+        once, not per consumer).
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int mumble_link_lua_snapshot(lua_State *L) {
+    static int snapshot_ref = LUA_NOREF;
+    static uint32_t snapshot_tick = 0;
+
+    uint32_t tick = ml->gw2_ml ? ml_snapshot.tick : 0;
+
+    if (snapshot_ref!=LUA_NOREF && snapshot_tick==tick) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, snapshot_ref);
+        return 1;
+    }
+
+    if (snapshot_ref!=LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, snapshot_ref);
+        snapshot_ref = LUA_NOREF;
+    }
+
+    // the writable data table is hidden behind a read-only proxy
+    lua_newtable(L); // proxy
+    lua_createtable(L, 0, 8); // data
+
+    lua_pushinteger(L, tick);
+    lua_setfield(L, -2, "tick");
+
+    lua_pushinteger(L, ml->gw2_ml ? ml_snapshot.context.map_id : 0);
+    lua_setfield(L, -2, "mapid");
+
+    lua_pushinteger(L, ml->gw2_ml ? ml_snapshot.context.map_type : 0);
+    lua_setfield(L, -2, "maptype");
+
+    lua_pushinteger(L, ml->gw2_ml ? ml_snapshot.context.ui_state : 0);
+    lua_setfield(L, -2, "uistate");
+
+    if (ml->gw2_ml) {
+        mumble_link_push_vec(L, ml_snapshot.avatar_position.x, ml_snapshot.avatar_position.y, ml_snapshot.avatar_position.z);
+        lua_setfield(L, -2, "avatarposition");
+
+        mumble_link_push_vec(L, ml_snapshot.camera_position.x, ml_snapshot.camera_position.y, ml_snapshot.camera_position.z);
+        lua_setfield(L, -2, "cameraposition");
+
+        mumble_link_push_vec(L, ml_snapshot.camera_front.x, ml_snapshot.camera_front.y, ml_snapshot.camera_front.z);
+        lua_setfield(L, -2, "camerafront");
+    }
+
+    mumble_link_check_identity_cache();
+    if (ml->identity_cache) {
+        lua_pushjson(L, ml->identity_cache);
+        lua_setfield(L, -2, "identity");
+    }
+
+    // proxy metatable: reads go to the data table, writes error
+    lua_createtable(L, 0, 2);
+    lua_pushvalue(L, -2); // data
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, &mumble_link_lua_snapshot_newindex);
+    lua_setfield(L, -2, "__newindex");
+
+    lua_setmetatable(L, -3); // on the proxy; pops meta... careful with order
+
+    lua_pop(L, 1); // the data table (now referenced by the metatable)
+
+    lua_pushvalue(L, -1);
+    snapshot_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    snapshot_tick = tick;
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: openlink(name)
+
+    Open an additional named MumbleLink map, for multiboxed sessions where a
+    second client was launched with ``-mumble <name>``. The link is captured
+    in the same per-frame pass as the primary; up to 8 links are supported.
+
+    :param string name: The link map name.
+    :rtype: mumblelink
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define ML_LINK_MT "MumbleLinkSecondaryMetaTable"
+
+int mumble_link_lua_link_snapshot(lua_State *L);
+
+static luaL_Reg ml_link_funcs[] = {
+    "snapshot", &mumble_link_lua_link_snapshot,
+    NULL      , NULL
+};
+
+int mumble_link_lua_open_link(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    int ind = -1;
+    for (int l=0;l<ml_link_count;l++) {
+        if (strcmp(ml_links[l].name, name)==0) {
+            ind = l;
+            break;
+        }
+    }
+
+    if (ind<0) {
+        if (ml_link_count==ML_MAX_LINKS) return luaL_error(L, "too many mumble links open");
+
+        ml_secondary_t *link = &ml_links[ml_link_count];
+
+        link->map_file = CreateFileMapping(
+            INVALID_HANDLE_VALUE,
+            NULL,
+            PAGE_READWRITE,
+            0,
+            sizeof(gw2_ml_t),
+            name
+        );
+
+        if (link->map_file==NULL) {
+            return luaL_error(L, "Couldn't create MumbleLink shared file for %s.", name);
+        }
+
+        link->gw2_ml = (gw2_ml_t*)MapViewOfFile(link->map_file, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(gw2_ml_t));
+
+        if (link->gw2_ml==NULL) {
+            CloseHandle(link->map_file);
+            link->map_file = NULL;
+            return luaL_error(L, "Couldn't map MumbleLink file for %s.", name);
+        }
+
+        link->name = egoverlay_calloc(strlen(name)+1, sizeof(char));
+        memcpy(link->name, name, strlen(name));
+
+        ind = ml_link_count++;
+
+        logger_info(ml->log, "opened mumble link '%s'", name);
+    }
+
+    int *plink = (int*)lua_newuserdata(L, sizeof(int));
+    *plink = ind;
+
+    if (luaL_newmetatable(L, ML_LINK_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, ml_link_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+/*** RST
+.. lua:class:: mumblelink
+
+    .. lua:method:: snapshot()
+
+        Return this link's current per-frame snapshot as a table with
+        ``tick``, ``mapid``, ``avatarposition`` (``{x, y, z}``, meters),
+        ``cameraposition``, and ``identity`` (the raw JSON string, or
+        ``nil`` before the client writes one).
+
+        :rtype: table
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int mumble_link_lua_link_snapshot(lua_State *L) {
+    int ind = *(int*)luaL_checkudata(L, 1, ML_LINK_MT);
+
+    if (ind < 0 || ind >= ml_link_count) return luaL_error(L, "invalid mumble link");
+
+    gw2_ml_t *s = &ml_links[ind].snapshot;
+
+    lua_newtable(L);
+
+    lua_pushinteger(L, s->tick);
+    lua_setfield(L, -2, "tick");
+    lua_pushinteger(L, s->context.map_id);
+    lua_setfield(L, -2, "mapid");
+
+    lua_newtable(L);
+    lua_pushnumber(L, s->avatar_position.x); lua_setfield(L, -2, "x");
+    lua_pushnumber(L, s->avatar_position.y); lua_setfield(L, -2, "y");
+    lua_pushnumber(L, s->avatar_position.z); lua_setfield(L, -2, "z");
+    lua_setfield(L, -2, "avatarposition");
+
+    lua_newtable(L);
+    lua_pushnumber(L, s->camera_position.x); lua_setfield(L, -2, "x");
+    lua_pushnumber(L, s->camera_position.y); lua_setfield(L, -2, "y");
+    lua_pushnumber(L, s->camera_position.z); lua_setfield(L, -2, "z");
+    lua_setfield(L, -2, "cameraposition");
+
+    if (s->identity[0]) {
+        char *identity = wchar_to_char(s->identity);
+        lua_pushstring(L, identity);
+        egoverlay_free(identity);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_setfield(L, -2, "identity");
+
+    return 1;
+}
+
+void mumble_link_close_links() {
+    for (int l=0;l<ml_link_count;l++) {
+        if (ml_links[l].gw2_ml) UnmapViewOfFile(ml_links[l].gw2_ml);
+        if (ml_links[l].map_file) CloseHandle(ml_links[l].map_file);
+        if (ml_links[l].name) egoverlay_free(ml_links[l].name);
+        memset(&ml_links[l], 0, sizeof(ml_secondary_t));
+    }
+    ml_link_count = 0;
+}
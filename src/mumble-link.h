@@ -32,6 +32,28 @@ typedef enum mumble_link_ui_size_t {
 void mumble_link_init();
 
 uint32_t mumble_link_tick();
+
+// copy the shared memory into the per frame coherent snapshot (seqlock
+// style retry on tick change); run once per frame before any reads
+void mumble_link_capture();
+
+// benchmark capture/replay of MumbleLink snapshots (see mumble_link_capture)
+int mumble_link_start_capture(const char *path);
+int mumble_link_start_replay(const char *path);
+int mumble_link_replaying();
+int mumble_link_in_combat();
+void mumble_link_capture_stop();
+
+// script mode (no frame loop) captures on demand instead
+void mumble_link_enable_lazy_capture();
+
+// write the published shared memory segment (EGOverlayState) for
+// companion processes; once per frame from the render loop
+void mumble_link_publish(float frame_ms);
+
+// per frame change detection; queues mumble-link-* events when the data
+// actually changed
+void mumble_link_update_events();
 uint32_t mumble_link_version();
 
 size_t mumble_link_name(char *name, size_t max_size);
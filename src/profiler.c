@@ -0,0 +1,586 @@
+/*** RST
+profiler
+========
+
+.. lua:module:: profiler
+
+.. code-block:: lua
+
+    local profiler = require 'profiler'
+
+The :lua:mod:`profiler` module exposes the overlay's frame instrumentation:
+named CPU zones recorded by the render thread (event pump, coroutines,
+3D draw, UI) and a whole-frame GPU time measured with timestamp queries,
+kept for the last 120 frames.
+*/
+#include "profiler.h"
+#include "lua-manager.h"
+#include "logging/logger.h"
+#include "app.h"
+#include "settings.h"
+#include "utils.h"
+#include <string.h>
+#include <glad/gl.h>
+#include "gl.h"
+#include <glfw/glfw3.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdio.h>
+#include <windows.h>
+
+#define PROFILER_FRAMES     120
+
+static double gpu_avg_ms = -1.0;
+#define PROFILER_MAX_ZONES   16
+#define PROFILER_ZONE_DEPTH   8
+
+typedef struct {
+    const char *name; // zone names must be string literals
+    double cpu_ms;
+} profiler_zone_sample_t;
+
+typedef struct {
+    double frame_ms;
+    double gpu_ms; // -1 until the query result lands, a few frames later
+
+    int draw_calls;
+    int instances;
+
+    int zone_count;
+    profiler_zone_sample_t zones[PROFILER_MAX_ZONES];
+
+    GLuint gpu_queries[2]; // frame begin/end timestamps
+    int gpu_pending;
+} profiler_frame_t;
+
+typedef struct {
+    profiler_frame_t frames[PROFILER_FRAMES];
+    int frame_ind; // the frame currently being recorded
+
+    double frame_start;
+
+    // zone stack for the current frame
+    int zone_stack[PROFILER_ZONE_DEPTH];
+    double zone_start[PROFILER_ZONE_DEPTH];
+    int zone_depth;
+} profiler_t;
+
+static profiler_t *profiler = NULL;
+
+// A/B comparison: frame times are accumulated into one of two labelled
+// buckets so the impact of a settings change can be measured in-place
+// (collect A, change the setting, collect B, report).
+typedef struct {
+    char label[64];
+    uint64_t frames;
+    double total_ms;
+    double min_ms;
+    double max_ms;
+} profiler_ab_bucket_t;
+
+static profiler_ab_bucket_t ab_buckets[2];
+static int ab_active = -1; // -1 off, 0 = A, 1 = B
+
+// Trace capture: while capturing, every completed zone (and spans reported
+// by other threads, like web request transfers and XML parse workers) is
+// recorded as a chrome://tracing complete event and dumped as JSON on stop.
+#define TRACE_MAX_EVENTS 65536
+
+typedef struct {
+    const char *name; // must be a string literal
+    double ts;        // seconds
+    double dur;       // seconds
+    DWORD tid;
+} profiler_trace_event_t;
+
+static profiler_trace_event_t *trace_events = NULL;
+static size_t trace_event_count = 0;
+static int trace_capturing = 0;
+static HANDLE trace_mutex = NULL;
+
+// shared clock for cross thread spans
+double profiler_time() {
+    return glfwGetTime();
+}
+
+void profiler_trace_complete(const char *name, double start_seconds, double dur_seconds) {
+    if (!trace_capturing) return;
+
+    WaitForSingleObject(trace_mutex, INFINITE);
+
+    if (trace_capturing && trace_event_count < TRACE_MAX_EVENTS) {
+        profiler_trace_event_t *e = &trace_events[trace_event_count++];
+        e->name = name;
+        e->ts = start_seconds;
+        e->dur = dur_seconds;
+        e->tid = GetCurrentThreadId();
+    }
+
+    ReleaseMutex(trace_mutex);
+}
+
+int profiler_lua_open_module(lua_State *L);
+
+void profiler_init() {
+    profiler = egoverlay_calloc(1, sizeof(profiler_t));
+
+    trace_mutex = CreateMutex(0, FALSE, NULL);
+
+    for (int f=0;f<PROFILER_FRAMES;f++) {
+        profiler->frames[f].gpu_ms = -1.0;
+    }
+
+    lua_manager_add_module_opener("profiler", &profiler_lua_open_module);
+}
+
+void profiler_cleanup() {
+    for (int f=0;f<PROFILER_FRAMES;f++) {
+        if (profiler->frames[f].gpu_queries[0]) {
+            glDeleteQueries(2, profiler->frames[f].gpu_queries);
+        }
+    }
+
+    egoverlay_free(profiler);
+}
+
+void profiler_frame_begin() {
+    profiler_frame_t *frame = &profiler->frames[profiler->frame_ind];
+
+    frame->frame_ms = 0.0;
+    frame->gpu_ms = -1.0;
+    frame->zone_count = 0;
+    frame->draw_calls = 0;
+    frame->instances = 0;
+
+    if (!frame->gpu_queries[0]) glGenQueries(2, frame->gpu_queries);
+    glQueryCounter(frame->gpu_queries[0], GL_TIMESTAMP);
+    frame->gpu_pending = 1;
+
+    profiler->frame_start = glfwGetTime();
+    profiler->zone_depth = 0;
+}
+
+void profiler_frame_end() {
+    profiler_frame_t *frame = &profiler->frames[profiler->frame_ind];
+
+    frame->frame_ms = (glfwGetTime() - profiler->frame_start) * 1000.0;
+    glQueryCounter(frame->gpu_queries[1], GL_TIMESTAMP);
+
+    profiler_trace_complete("frame", profiler->frame_start, frame->frame_ms / 1000.0);
+
+    if (ab_active>=0) {
+        profiler_ab_bucket_t *bucket = &ab_buckets[ab_active];
+
+        bucket->frames++;
+        bucket->total_ms += frame->frame_ms;
+        if (frame->frame_ms < bucket->min_ms || bucket->frames==1) bucket->min_ms = frame->frame_ms;
+        if (frame->frame_ms > bucket->max_ms) bucket->max_ms = frame->frame_ms;
+    }
+
+    // hitch detection: compare against a rolling average and log the zone
+    // breakdown when a frame blows past it, so the culprit is captured the
+    // moment it happens instead of needing a trace to be running
+    static double avg_frame_ms = 0.0;
+    static double last_hitch_log = 0.0;
+    static double hitch_threshold_ms = 0.0;
+
+    if (hitch_threshold_ms==0.0) {
+        settings_set_default_int(app_get_settings(), "overlay.hitchThresholdMs", 50);
+
+        int threshold = 50;
+        GET_APP_SETTING_INT("overlay.hitchThresholdMs", &threshold);
+        if (threshold < 1) threshold = 1;
+        hitch_threshold_ms = (double)threshold;
+    }
+
+    if (avg_frame_ms==0.0) avg_frame_ms = frame->frame_ms;
+
+    double hitch_at = avg_frame_ms * 2.0;
+    if (hitch_at < hitch_threshold_ms) hitch_at = hitch_threshold_ms;
+
+    double now = glfwGetTime();
+
+    if (frame->frame_ms > hitch_at && now - last_hitch_log > 1.0) {
+        last_hitch_log = now;
+
+        logger_t *log = logger_get("profiler");
+        logger_warn(log, "frame hitch: %.1fms (avg %.1fms)", frame->frame_ms, avg_frame_ms);
+
+        for (int z=0;z<frame->zone_count;z++) {
+            logger_warn(log, "  %-12s %8.2fms", frame->zones[z].name, frame->zones[z].cpu_ms);
+        }
+    }
+
+    // exponential rolling average, hitches excluded so one spike doesn't
+    // mask the next
+    if (frame->frame_ms <= hitch_at) {
+        avg_frame_ms = (avg_frame_ms * 0.95) + (frame->frame_ms * 0.05);
+    }
+
+    profiler->frame_ind = (profiler->frame_ind + 1) % PROFILER_FRAMES;
+
+    // collect GPU results that have landed; they're usually a few frames
+    // behind, which is why the timestamps live with their frame record
+    for (int f=0;f<PROFILER_FRAMES;f++) {
+        profiler_frame_t *pf = &profiler->frames[f];
+        if (!pf->gpu_pending) continue;
+        if (f==profiler->frame_ind) continue; // about to be overwritten anyway
+
+        GLint available = 0;
+        glGetQueryObjectiv(pf->gpu_queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 begin_ts = 0;
+        GLuint64 end_ts = 0;
+        glGetQueryObjectui64v(pf->gpu_queries[0], GL_QUERY_RESULT, &begin_ts);
+        glGetQueryObjectui64v(pf->gpu_queries[1], GL_QUERY_RESULT, &end_ts);
+
+        pf->gpu_ms = (double)(end_ts - begin_ts) / 1000000.0;
+        pf->gpu_pending = 0;
+
+        if (gpu_avg_ms < 0.0) gpu_avg_ms = pf->gpu_ms;
+        else gpu_avg_ms = (gpu_avg_ms * 0.9) + (pf->gpu_ms * 0.1);
+    }
+}
+
+// smoothed GPU frame time for the degradation controller; -1 until the
+// first timer query result lands
+double profiler_recent_gpu_ms() {
+    return gpu_avg_ms;
+}
+
+// draw statistics, reported by the draw paths
+void profiler_count_draw(int calls, int instances) {
+    if (!profiler) return;
+
+    profiler_frame_t *frame = &profiler->frames[profiler->frame_ind];
+    frame->draw_calls += calls;
+    frame->instances += instances;
+}
+
+void profiler_zone_begin(const char *name) {
+    if (!profiler || profiler->zone_depth==PROFILER_ZONE_DEPTH) return;
+
+    profiler_frame_t *frame = &profiler->frames[profiler->frame_ind];
+
+    if (frame->zone_count==PROFILER_MAX_ZONES) return;
+
+    int zone = frame->zone_count++;
+    frame->zones[zone].name = name;
+    frame->zones[zone].cpu_ms = 0.0;
+
+    profiler->zone_stack[profiler->zone_depth] = zone;
+    profiler->zone_start[profiler->zone_depth] = glfwGetTime();
+    profiler->zone_depth++;
+}
+
+void profiler_zone_end() {
+    if (!profiler || profiler->zone_depth==0) return;
+
+    profiler->zone_depth--;
+
+    profiler_frame_t *frame = &profiler->frames[profiler->frame_ind];
+    int zone = profiler->zone_stack[profiler->zone_depth];
+
+    frame->zones[zone].cpu_ms = (glfwGetTime() - profiler->zone_start[profiler->zone_depth]) * 1000.0;
+
+    profiler_trace_complete(
+        frame->zones[zone].name,
+        profiler->zone_start[profiler->zone_depth],
+        frame->zones[zone].cpu_ms / 1000.0
+    );
+}
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: frames()
+
+    Return the recorded frames, oldest first. Each entry is a table with
+    ``frame`` (CPU frame time in ms), ``gpu`` (GPU time in ms, or ``-1`` if
+    the query result hasn't landed yet), and ``zones``, a table of zone name
+    to CPU milliseconds.
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_frames(lua_State *L) {
+    lua_createtable(L, PROFILER_FRAMES - 1, 0);
+
+    int out = 1;
+    for (int i=1;i<PROFILER_FRAMES;i++) {
+        // oldest first; frame_ind is the frame currently being recorded
+        profiler_frame_t *frame = &profiler->frames[(profiler->frame_ind + i) % PROFILER_FRAMES];
+
+        lua_createtable(L, 0, 3);
+
+        lua_pushnumber(L, frame->frame_ms);
+        lua_setfield(L, -2, "frame");
+
+        lua_pushnumber(L, frame->gpu_ms);
+        lua_setfield(L, -2, "gpu");
+
+        lua_pushinteger(L, frame->draw_calls);
+        lua_setfield(L, -2, "drawcalls");
+
+        lua_pushinteger(L, frame->instances);
+        lua_setfield(L, -2, "instances");
+
+        lua_createtable(L, 0, frame->zone_count);
+        for (int z=0;z<frame->zone_count;z++) {
+            lua_pushnumber(L, frame->zones[z].cpu_ms);
+            lua_setfield(L, -2, frame->zones[z].name);
+        }
+        lua_setfield(L, -2, "zones");
+
+        lua_seti(L, -2, out++);
+    }
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: lastframe()
+
+    Return the most recently completed frame, in the same format as the
+    entries of :lua:func:`frames`.
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_last_frame(lua_State *L) {
+    profiler_frame_t *frame = &profiler->frames[(profiler->frame_ind + PROFILER_FRAMES - 1) % PROFILER_FRAMES];
+
+    lua_createtable(L, 0, 3);
+
+    lua_pushnumber(L, frame->frame_ms);
+    lua_setfield(L, -2, "frame");
+
+    lua_pushnumber(L, frame->gpu_ms);
+    lua_setfield(L, -2, "gpu");
+
+    lua_createtable(L, 0, frame->zone_count);
+    for (int z=0;z<frame->zone_count;z++) {
+        lua_pushnumber(L, frame->zones[z].cpu_ms);
+        lua_setfield(L, -2, frame->zones[z].name);
+    }
+    lua_setfield(L, -2, "zones");
+
+    return 1;
+}
+
+
+/*** RST
+.. lua:function:: tracestart()
+
+    Begin capturing trace events (zones on the render thread plus spans
+    reported by the request and parse worker threads). Capturing stops
+    automatically when the in-memory buffer fills.
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_trace_start(lua_State *L) {
+    UNUSED_PARAM(L);
+
+    WaitForSingleObject(trace_mutex, INFINITE);
+
+    if (!trace_events) trace_events = egoverlay_calloc(TRACE_MAX_EVENTS, sizeof(profiler_trace_event_t));
+    trace_event_count = 0;
+    trace_capturing = 1;
+
+    ReleaseMutex(trace_mutex);
+
+    return 0;
+}
+
+/*** RST
+.. lua:function:: tracestop(path)
+
+    Stop capturing and write the captured events to ``path`` as
+    chrome://tracing (Perfetto compatible) JSON.
+
+    :param string path:
+    :returns: The number of events written.
+    :rtype: integer
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_trace_stop(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    WaitForSingleObject(trace_mutex, INFINITE);
+    trace_capturing = 0;
+    size_t count = trace_event_count;
+    ReleaseMutex(trace_mutex);
+
+    FILE *f = fopen(path, "w");
+    if (!f) return luaL_error(L, "couldn't open %s", path);
+
+    fprintf(f, "{\"traceEvents\":[");
+
+    for (size_t i=0;i<count;i++) {
+        profiler_trace_event_t *e = &trace_events[i];
+
+        fprintf(f,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+            i ? "," : "",
+            e->name,
+            (unsigned long)e->tid,
+            e->ts * 1000000.0,
+            e->dur * 1000000.0
+        );
+    }
+
+    fprintf(f, "]}");
+    fclose(f);
+
+    lua_pushinteger(L, (lua_Integer)count);
+
+    return 1;
+}
+
+
+static void profiler_push_ab_bucket(lua_State *L, profiler_ab_bucket_t *bucket) {
+    lua_createtable(L, 0, 5);
+
+    lua_pushstring(L, bucket->label);
+    lua_setfield(L, -2, "label");
+
+    lua_pushinteger(L, (lua_Integer)bucket->frames);
+    lua_setfield(L, -2, "frames");
+
+    lua_pushnumber(L, bucket->frames ? bucket->total_ms / (double)bucket->frames : 0.0);
+    lua_setfield(L, -2, "avg");
+
+    lua_pushnumber(L, bucket->min_ms);
+    lua_setfield(L, -2, "min");
+
+    lua_pushnumber(L, bucket->max_ms);
+    lua_setfield(L, -2, "max");
+}
+
+/*** RST
+.. lua:function:: abstart(label)
+
+    Reset the A/B comparison and start collecting frame times into bucket A.
+
+    :param string label:
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_ab_start(lua_State *L) {
+    const char *label = luaL_checkstring(L, 1);
+
+    memset(ab_buckets, 0, sizeof(ab_buckets));
+    snprintf(ab_buckets[0].label, sizeof(ab_buckets[0].label), "%s", label);
+    ab_active = 0;
+
+    return 0;
+}
+
+/*** RST
+.. lua:function:: abswitch(label)
+
+    Switch collection to bucket B. Change the setting under test between
+    :lua:func:`abstart` and this call.
+
+    :param string label:
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_ab_switch(lua_State *L) {
+    const char *label = luaL_checkstring(L, 1);
+
+    snprintf(ab_buckets[1].label, sizeof(ab_buckets[1].label), "%s", label);
+    ab_active = 1;
+
+    return 0;
+}
+
+/*** RST
+.. lua:function:: abreport()
+
+    Stop collecting and return both buckets as tables with ``label``,
+    ``frames``, ``avg``, ``min``, and ``max`` (milliseconds). The summary is
+    also written to the log.
+
+    :returns: Bucket A and bucket B.
+    :rtype: table, table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_ab_report(lua_State *L) {
+    ab_active = -1;
+
+    logger_t *log = logger_get("profiler");
+    for (int b=0;b<2;b++) {
+        profiler_ab_bucket_t *bucket = &ab_buckets[b];
+        logger_info(log, "A/B %s: %llu frames, avg %.2fms, min %.2fms, max %.2fms",
+                    bucket->label,
+                    (unsigned long long)bucket->frames,
+                    bucket->frames ? bucket->total_ms / (double)bucket->frames : 0.0,
+                    bucket->min_ms,
+                    bucket->max_ms);
+    }
+
+    profiler_push_ab_bucket(L, &ab_buckets[0]);
+    profiler_push_ab_bucket(L, &ab_buckets[1]);
+
+    return 2;
+}
+
+/*** RST
+.. lua:function:: glstats()
+
+    Return cumulative GL state call statistics from the caching shim:
+    ``calls`` and ``redundant`` (calls elided because the state was already
+    set).
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int profiler_lua_gl_stats(lua_State *L) {
+    unsigned int calls = 0;
+    unsigned int redundant = 0;
+    gl_state_stats(&calls, &redundant);
+
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushinteger(L, redundant);
+    lua_setfield(L, -2, "redundant");
+
+    return 1;
+}
+
+static luaL_Reg profiler_funcs[] = {
+    "frames"    , &profiler_lua_frames,
+    "lastframe" , &profiler_lua_last_frame,
+    "tracestart", &profiler_lua_trace_start,
+    "tracestop" , &profiler_lua_trace_stop,
+    "gpumemory" , &profiler_lua_gpu_memory,
+    "abstart"   , &profiler_lua_ab_start,
+    "abswitch"  , &profiler_lua_ab_switch,
+    "abreport"  , &profiler_lua_ab_report,
+    "glstats"   , &profiler_lua_gl_stats,
+    NULL        , NULL
+};
+
+int profiler_lua_open_module(lua_State *L) {
+    lua_newtable(L);
+    luaL_setfuncs(L, profiler_funcs, 0);
+
+    return 1;
+}
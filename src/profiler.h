@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+// Frame time instrumentation: named CPU zones recorded per frame into a
+// ring buffer of recent frames, plus a whole-frame GPU time from timestamp
+// queries. Read from Lua through the profiler module.
+
+void profiler_init();
+void profiler_cleanup();
+
+// frame boundaries, called by the render loop
+void profiler_frame_begin();
+void profiler_frame_end();
+
+// named CPU zones. zones may nest up to a small fixed depth; time spent in
+// a nested zone is counted in both
+void profiler_zone_begin(const char *name);
+void profiler_zone_end();
+
+// the clock trace timestamps are measured against, safe from any thread
+double profiler_time();
+
+// report a completed span from any thread; recorded only while a trace
+// capture is active. name must be a string literal
+void profiler_trace_complete(const char *name, double start_seconds, double dur_seconds);
+
+// draw statistics, reported by the draw paths each frame
+void profiler_count_draw(int calls, int instances);
+
+// smoothed GPU frame time in ms, -1 until timer query results land
+double profiler_recent_gpu_ms();
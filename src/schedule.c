@@ -0,0 +1,307 @@
+/*** RST
+schedule
+========
+
+.. lua:module:: schedule
+
+.. code-block:: lua
+
+    local schedule = require 'schedule'
+
+Rotation and reset schedules computed natively.
+
+Modules tracking rotating vendors or daily/weekly resets used to redo date
+math on every UI refresh. A schedule compiles its rotation rule once (a
+boundary hour and slot count indexed by day-since-epoch) and then answers
+``slot()`` and ``nextchange()`` with integer arithmetic; ``onchange``
+arms a native timer for exactly the next boundary, so a tracker updates at
+rotation time and costs nothing in between.
+
+All boundaries are in UTC, matching the GW2 server resets.
+*/
+#include <time.h>
+#include <string.h>
+#include "schedule.h"
+#include "lua-manager.h"
+#include "utils.h"
+#include <lauxlib.h>
+
+typedef struct {
+    int hour;    // boundary hour, UTC
+    int slots;   // rotation length in days; 7 = weekly (Lua weekday slots)
+    int weekly;
+
+    int cb_ref;  // LUA_NOREF when no onchange callback armed
+} schedule_t;
+
+int schedule_lua_open_module(lua_State *L);
+
+void schedule_lua_init() {
+    lua_manager_add_module_opener("schedule", &schedule_lua_open_module);
+}
+
+// days since the unix epoch of the rotation day containing t: the boundary
+// hour shifts the day edge, so times before the boundary still count as the
+// previous day
+static int64_t schedule_day(schedule_t *sched, int64_t t) {
+    int64_t shifted = t - (int64_t)sched->hour * 3600;
+
+    // floor division for times before the epoch
+    if (shifted<0) return (shifted - 86399) / 86400;
+    return shifted / 86400;
+}
+
+static int schedule_slot(schedule_t *sched, int64_t t) {
+    int64_t day = schedule_day(sched, t);
+
+    if (sched->weekly) {
+        // Jan 1 1970 was a Thursday; Lua weekdays are 1 (Sunday) .. 7
+        return (int)((day + 4) % 7) + 1;
+    }
+
+    return (int)(day % sched->slots) + 1;
+}
+
+static int64_t schedule_next_change(schedule_t *sched, int64_t t) {
+    return (schedule_day(sched, t) + 1) * 86400 + (int64_t)sched->hour * 3600;
+}
+
+static schedule_t *schedule_check(lua_State *L, int ind) {
+    return (schedule_t*)luaL_checkudata(L, ind, "ScheduleMetaTable");
+}
+
+int schedule_lua_slot(lua_State *L);
+int schedule_lua_nextchange(lua_State *L);
+int schedule_lua_onchange(lua_State *L);
+int schedule_lua_stop(lua_State *L);
+int schedule_lua_del(lua_State *L);
+
+luaL_Reg schedule_obj_funcs[] = {
+    "slot"      , &schedule_lua_slot,
+    "nextchange", &schedule_lua_nextchange,
+    "onchange"  , &schedule_lua_onchange,
+    "stop"      , &schedule_lua_stop,
+    "__gc"      , &schedule_lua_del,
+    NULL        , NULL
+};
+
+static int schedule_lua_new(lua_State *L, int hour, int slots, int weekly) {
+    if (hour<0 || hour>23) return luaL_error(L, "schedule: boundary hour must be 0-23.");
+    if (slots<1) return luaL_error(L, "schedule: slots must be at least 1.");
+
+    schedule_t *sched = (schedule_t*)lua_newuserdata(L, sizeof(schedule_t));
+    memset(sched, 0, sizeof(schedule_t));
+    sched->hour = hour;
+    sched->slots = slots;
+    sched->weekly = weekly;
+    sched->cb_ref = LUA_NOREF;
+
+    if (luaL_newmetatable(L, "ScheduleMetaTable")) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, schedule_obj_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: daily(hour[, slots])
+
+    Create a daily rotation with a boundary at ``hour`` UTC. ``slots`` is the
+    rotation length in days and defaults to 1 (a plain daily reset).
+
+    :param integer hour: Boundary hour, 0-23 UTC.
+    :param integer slots: (Optional) Rotation length in days.
+    :rtype: schedule
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int schedule_lua_daily(lua_State *L) {
+    int hour = (int)luaL_checkinteger(L, 1);
+    int slots = (int)luaL_optinteger(L, 2, 1);
+
+    return schedule_lua_new(L, hour, slots, 0);
+}
+
+/*** RST
+.. lua:function:: weekly(hour)
+
+    Create a weekly rotation with a boundary at ``hour`` UTC. Slots are Lua
+    weekdays: 1 (Sunday) through 7 (Saturday).
+
+    :param integer hour: Boundary hour, 0-23 UTC.
+    :rtype: schedule
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int schedule_lua_weekly(lua_State *L) {
+    int hour = (int)luaL_checkinteger(L, 1);
+
+    return schedule_lua_new(L, hour, 7, 1);
+}
+
+luaL_Reg schedule_mod_funcs[] = {
+    "daily" , &schedule_lua_daily,
+    "weekly", &schedule_lua_weekly,
+    NULL    , NULL
+};
+
+int schedule_lua_open_module(lua_State *L) {
+    lua_newtable(L);
+    luaL_setfuncs(L, schedule_mod_funcs, 0);
+
+    return 1;
+}
+
+/*** RST
+Schedules
+---------
+
+.. lua:class:: schedule
+
+    .. lua:method:: slot([time])
+
+        Return the 1-based slot index active at ``time`` (default: now).
+
+        :param integer time: (Optional) A unix timestamp.
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int schedule_lua_slot(lua_State *L) {
+    schedule_t *sched = schedule_check(L, 1);
+    int64_t t = (int64_t)luaL_optinteger(L, 2, (lua_Integer)time(NULL));
+
+    lua_pushinteger(L, schedule_slot(sched, t));
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: nextchange([time])
+
+        Return the number of seconds until the next rotation boundary after
+        ``time`` (default: now), followed by the boundary as a unix timestamp.
+
+        :param integer time: (Optional) A unix timestamp.
+        :rtype: number, integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int schedule_lua_nextchange(lua_State *L) {
+    schedule_t *sched = schedule_check(L, 1);
+    int64_t t = (int64_t)luaL_optinteger(L, 2, (lua_Integer)time(NULL));
+
+    int64_t change = schedule_next_change(sched, t);
+    lua_pushinteger(L, change - t);
+    lua_pushinteger(L, change);
+
+    return 2;
+}
+
+static int schedule_lua_fired_cont(lua_State *L, int status, lua_KContext ctx) {
+    UNUSED_PARAM(L);
+    UNUSED_PARAM(status);
+    UNUSED_PARAM(ctx);
+
+    return 0;
+}
+
+// fired by the timer wheel at a rotation boundary: calls the user callback
+// with the new slot and re-arms for the next boundary. upvalue 1 is the
+// schedule userdata
+static int schedule_lua_fired(lua_State *L) {
+    schedule_t *sched = schedule_check(L, lua_upvalueindex(1));
+
+    if (sched->cb_ref==LUA_NOREF) return 0; // stopped since arming
+
+    int64_t now = (int64_t)time(NULL);
+
+    // re-arm first so a callback error can't kill the rotation. fire a
+    // second late to be safely on the far side of the boundary
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, &schedule_lua_fired, 1);
+    lua_manager_schedule_timeout(L, -1, (double)(schedule_next_change(sched, now) - now) + 1.0);
+    lua_pop(L, 1);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->cb_ref);
+    lua_pushinteger(L, schedule_slot(sched, now));
+    // timer callbacks run as coroutines; callk so the user callback can yield
+    lua_callk(L, 1, 0, 0, &schedule_lua_fired_cont);
+
+    return schedule_lua_fired_cont(L, LUA_OK, 0);
+}
+
+/*** RST
+    .. lua:method:: onchange(callback)
+
+        Call ``callback`` with the new slot index at every rotation boundary,
+        starting with the next one. Replaces any previous callback. Use
+        :lua:meth:`stop` to stop.
+
+        :param function callback:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int schedule_lua_onchange(lua_State *L) {
+    schedule_t *sched = schedule_check(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    int was_armed = sched->cb_ref!=LUA_NOREF;
+
+    if (was_armed) luaL_unref(L, LUA_REGISTRYINDEX, sched->cb_ref);
+
+    lua_pushvalue(L, 2);
+    sched->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    if (!was_armed) {
+        int64_t now = (int64_t)time(NULL);
+
+        lua_pushvalue(L, 1);
+        lua_pushcclosure(L, &schedule_lua_fired, 1);
+        lua_manager_schedule_timeout(L, -1, (double)(schedule_next_change(sched, now) - now) + 1.0);
+        lua_pop(L, 1);
+    }
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: stop()
+
+        Stop calling the :lua:meth:`onchange` callback.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int schedule_lua_stop(lua_State *L) {
+    schedule_t *sched = schedule_check(L, 1);
+
+    if (sched->cb_ref!=LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, sched->cb_ref);
+        sched->cb_ref = LUA_NOREF;
+    }
+
+    return 0;
+}
+
+int schedule_lua_del(lua_State *L) {
+    schedule_t *sched = schedule_check(L, 1);
+
+    if (sched->cb_ref!=LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, sched->cb_ref);
+        sched->cb_ref = LUA_NOREF;
+    }
+
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Native rotation/reset schedule engine for Lua modules; see schedule.c.
+
+void schedule_lua_init();
@@ -33,6 +33,25 @@ struct settings_t {
 
     uint8_t save_on_set;
 
+    // debounced persistence: sets mark the document dirty; a background
+    // writer flushes it (atomically, temp file + rename) once it's been
+    // quiet for the debounce window
+    int dirty;
+    double dirty_since;
+
+    // flat lookup cache: key path -> node in the document, so hot per-frame
+    // reads are one hash probe instead of walking the dotted path through
+    // jansson. cleared wholesale on any set (sets are rare, reads are not)
+    char *cache_keys[128];
+    json_t *cache_values[128];
+
+    // per key change callbacks, dispatched after a set
+    struct settings_change_cb_t *change_cbs;
+
+    // the currently published immutable snapshot, built lazily after a set
+    // invalidates the previous one. see settings_snapshot
+    struct settings_snapshot_t *snapshot;
+
     char *file_path;
     json_t *data;
 
@@ -53,6 +72,14 @@ void settings_release(settings_t *settings);
 
 json_t *settings_data_for_path(const char *path, json_t *data, int create);
 
+typedef struct settings_change_cb_t {
+    char *key;
+    int cbi;
+    struct settings_change_cb_t *next;
+} settings_change_cb_t;
+
+#define SETTINGS_CACHE_SIZE 128
+
 uint32_t settings_get_default_key_ind(settings_t *settings, const char *key);
 
 int settings_lua_new(lua_State *L);
@@ -62,6 +89,110 @@ int settings_lua_get(lua_State *L);
 int settings_lua_set_default(lua_State *L);
 int settings_lua_save_on_set(lua_State *L);
 int settings_lua_save(lua_State *L);
+int settings_lua_onchange(lua_State *L);
+
+// every live settings object, so the background writer can flush dirty
+// documents. guarded by live_settings_mutex, which also serializes writes
+// against settings_free
+#define SETTINGS_SAVE_DEBOUNCE 0.5
+
+static settings_t **live_settings = NULL;
+static size_t live_settings_count = 0;
+static size_t live_settings_capacity = 0;
+static HANDLE live_settings_mutex = NULL;
+static HANDLE settings_save_thread = NULL;
+static int settings_save_stop = 0;
+
+static double settings_now() {
+    return (double)GetTickCount64() / 1000.0;
+}
+
+static void settings_cache_clear(settings_t *settings);
+
+// serialize under the settings lock, then write to a temp file and rename
+// over the old one so a crash mid-write can't corrupt the document
+static void settings_write_file(settings_t *settings) {
+    settings_lock(settings);
+    char *settings_str = json_dumps(settings->data, JSON_INDENT(2));
+    settings->dirty = 0;
+    settings_release(settings);
+
+    if (!settings_str) return;
+
+    size_t tmplen = strlen(settings->file_path) + 5;
+    char *tmppath = egoverlay_calloc(tmplen, sizeof(char));
+    snprintf(tmppath, tmplen, "%s.tmp", settings->file_path);
+
+    FILE *settings_file = fopen(tmppath, "wb");
+    if (!settings_file) {
+        egoverlay_free(tmppath);
+        free(settings_str);
+        return;
+    }
+
+    fwrite(settings_str, sizeof(char), strlen(settings_str), settings_file);
+    fflush(settings_file);
+    fclose(settings_file);
+    free(settings_str);
+
+    MoveFileEx(tmppath, settings->file_path, MOVEFILE_REPLACE_EXISTING);
+    egoverlay_free(tmppath);
+}
+
+static DWORD WINAPI settings_save_thread_fn(LPVOID param) {
+    UNUSED_PARAM(param);
+
+    while (!settings_save_stop) {
+        double now = settings_now();
+
+        WaitForSingleObject(live_settings_mutex, INFINITE);
+        for (size_t i=0;i<live_settings_count;i++) {
+            settings_t *s = live_settings[i];
+
+            if (s->dirty && now - s->dirty_since > SETTINGS_SAVE_DEBOUNCE) {
+                settings_write_file(s);
+            }
+        }
+        ReleaseMutex(live_settings_mutex);
+
+        Sleep(100);
+    }
+
+    return 0;
+}
+
+static void settings_register_live(settings_t *settings) {
+    if (!live_settings_mutex) live_settings_mutex = CreateMutex(NULL, 0, NULL);
+
+    WaitForSingleObject(live_settings_mutex, INFINITE);
+
+    if (live_settings_count==live_settings_capacity) {
+        live_settings_capacity = live_settings_capacity ? live_settings_capacity * 2 : 8;
+        live_settings = egoverlay_realloc(live_settings, live_settings_capacity * sizeof(settings_t*));
+    }
+    live_settings[live_settings_count++] = settings;
+
+    ReleaseMutex(live_settings_mutex);
+
+    if (!settings_save_thread) {
+        DWORD tid = 0;
+        settings_save_thread = CreateThread(0, 0, &settings_save_thread_fn, NULL, 0, &tid);
+    }
+}
+
+static void settings_unregister_live(settings_t *settings) {
+    WaitForSingleObject(live_settings_mutex, INFINITE);
+
+    for (size_t i=0;i<live_settings_count;i++) {
+        if (live_settings[i]==settings) {
+            live_settings[i] = live_settings[live_settings_count-1];
+            live_settings_count--;
+            break;
+        }
+    }
+
+    ReleaseMutex(live_settings_mutex);
+}
 
 settings_t *settings_new(const char *name) {
     CreateDirectory("settings", NULL);
@@ -115,6 +246,8 @@ settings_t *settings_new(const char *name) {
 
     settings->save_on_set = 1;
 
+    settings_register_live(settings);
+
     settings_ref(settings);
 
     return settings;
@@ -130,6 +263,25 @@ void settings_unref(settings_t *settings) {
 }
 
 void settings_free(settings_t *settings) {
+    settings_unregister_live(settings);
+
+    if (settings->snapshot) settings_snapshot_release(settings->snapshot);
+
+    settings_cache_clear(settings);
+
+    settings_change_cb_t *cb = settings->change_cbs;
+    while (cb) {
+        settings_change_cb_t *next = cb->next;
+        // the cbi is left registered: a queued change event may still
+        // reference it
+        egoverlay_free(cb->key);
+        egoverlay_free(cb);
+        cb = next;
+    }
+
+    // anything still pending goes out now
+    if (settings->dirty) settings_write_file(settings);
+
     for (size_t h=0;h<settings->default_values_hash_size;h++) {
         if (settings->default_keys[h]) {
             egoverlay_free(settings->default_keys[h]);
@@ -175,11 +327,114 @@ int settings_has_value(settings_t *settings, const char *key) {
     return ret;
 }
 
+
+// Immutable, refcounted snapshots for threads that can't take the settings
+// lock per read. A snapshot is a deep copy of the document built lazily
+// after a set invalidated the previous one; readers hold a reference and
+// read the copy without any locking, writers just swap which snapshot is
+// published.
+struct settings_snapshot_t {
+    json_t *data;
+    volatile LONG refs;
+};
+
+settings_snapshot_t *settings_snapshot(settings_t *settings) {
+    settings_lock(settings);
+
+    if (!settings->snapshot) {
+        settings->snapshot = egoverlay_calloc(1, sizeof(settings_snapshot_t));
+        settings->snapshot->data = json_deep_copy(settings->data);
+        settings->snapshot->refs = 1; // the published reference
+    }
+
+    settings_snapshot_t *snap = settings->snapshot;
+    InterlockedIncrement(&snap->refs);
+
+    settings_release(settings);
+
+    return snap;
+}
+
+void settings_snapshot_release(settings_snapshot_t *snapshot) {
+    if (InterlockedDecrement(&snapshot->refs)==0) {
+        json_decref(snapshot->data);
+        egoverlay_free(snapshot);
+    }
+}
+
+// snapshot reads mirror the settings getters but need no lock: the data is
+// immutable for the snapshot's lifetime
+int settings_snapshot_get_int(settings_snapshot_t *snapshot, const char *key, int *value) {
+    json_t *val = settings_data_for_path(key, snapshot->data, 0);
+
+    if (val && json_is_integer(val)) {
+        *value = (int)json_integer_value(val);
+        return 1;
+    }
+
+    return 0;
+}
+
+int settings_snapshot_get_double(settings_snapshot_t *snapshot, const char *key, double *value) {
+    json_t *val = settings_data_for_path(key, snapshot->data, 0);
+
+    if (val && json_is_number(val)) {
+        *value = json_number_value(val);
+        return 1;
+    }
+
+    return 0;
+}
+
+int settings_snapshot_get_string(settings_snapshot_t *snapshot, const char *key, const char **value) {
+    json_t *val = settings_data_for_path(key, snapshot->data, 0);
+
+    if (val && json_is_string(val)) {
+        *value = json_string_value(val);
+        return 1;
+    }
+
+    return 0;
+}
+
+int settings_snapshot_get_boolean(settings_snapshot_t *snapshot, const char *key, int *value) {
+    json_t *val = settings_data_for_path(key, snapshot->data, 0);
+
+    if (val && json_is_boolean(val)) {
+        *value = json_is_true(val) ? 1 : 0;
+        return 1;
+    }
+
+    return 0;
+}
+
 int settings_get_internal(settings_t *settings, const char *key, json_t **value) {
     settings_lock(settings);
 
+    uint32_t ind = djb2_hash_string(key) % SETTINGS_CACHE_SIZE;
+
+    // cached pointers are nodes in the document; any set clears the cache,
+    // so they can't dangle
+    for (uint32_t probes=0;probes<SETTINGS_CACHE_SIZE;probes++) {
+        if (settings->cache_keys[ind]==NULL) break;
+
+        if (strcmp(settings->cache_keys[ind], key)==0) {
+            *value = settings->cache_values[ind];
+            settings_release(settings);
+            return 1;
+        }
+
+        ind = (ind + 1) % SETTINGS_CACHE_SIZE;
+    }
+
     json_t *val = settings_data_for_path(key, settings->data, 0);
 
+    if (val && settings->cache_keys[ind]==NULL) {
+        settings->cache_keys[ind] = egoverlay_calloc(strlen(key)+1, sizeof(char));
+        memcpy(settings->cache_keys[ind], key, strlen(key));
+        settings->cache_values[ind] = val;
+    }
+
     settings_release(settings);
 
     if (val) {
@@ -191,6 +446,56 @@ int settings_get_internal(settings_t *settings, const char *key, json_t **value)
     return 0;
 }
 
+// must be called with the settings lock held
+static void settings_cache_clear(settings_t *settings) {
+    for (int i=0;i<SETTINGS_CACHE_SIZE;i++) {
+        if (settings->cache_keys[i]) {
+            egoverlay_free(settings->cache_keys[i]);
+            settings->cache_keys[i] = NULL;
+            settings->cache_values[i] = NULL;
+        }
+    }
+}
+
+// dispatched through the event callback queue after a set
+struct settings_change_data {
+    int cbi;       // shared registration ref
+    char *key;
+    json_t *value; // may be NULL
+};
+
+static int settings_run_change_cb(lua_State *L, struct settings_change_data *data) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->cbi);
+    lua_pushstring(L, data->key);
+    if (data->value) lua_pushjson(L, data->value);
+    else lua_pushnil(L);
+
+    if (data->value) json_decref(data->value);
+    egoverlay_free(data->key);
+    egoverlay_free(data);
+
+    return 2;
+}
+
+// must be called after the lock is released; fires callbacks registered
+// for exactly this key
+static void settings_notify_change(settings_t *settings, const char *key, json_t *value) {
+    for (settings_change_cb_t *cb=settings->change_cbs;cb;cb=cb->next) {
+        if (strcmp(cb->key, key)!=0) continue;
+
+        struct settings_change_data *data = egoverlay_calloc(1, sizeof(struct settings_change_data));
+        data->cbi = cb->cbi;
+        data->key = egoverlay_calloc(strlen(key)+1, sizeof(char));
+        memcpy(data->key, key, strlen(key));
+        if (value) {
+            data->value = value;
+            json_incref(value);
+        }
+
+        lua_manager_add_event_callback((lua_manager_event_callback*)&settings_run_change_cb, data);
+    }
+}
+
 int settings_get(settings_t *settings, const char *key, json_t **value) {
     int r = settings_get_internal(settings, key, value);
 
@@ -342,9 +647,29 @@ void settings_set_internal(settings_t *settings, const char *key, json_t *value)
     json_object_set(parent, node_key, value);
     egoverlay_free(node_key);
 
-    if (settings->save_on_set) settings_save(settings);    
+    // the document changed under the cached pointers
+    settings_cache_clear(settings);
+
+    // retire the published snapshot; readers holding references keep
+    // theirs, the next settings_snapshot builds a fresh copy
+    if (settings->snapshot) {
+        settings_snapshot_release(settings->snapshot);
+        settings->snapshot = NULL;
+    }
+
+    if (settings->save_on_set) {
+        // debounced: the background writer flushes once sets go quiet
+        if (!settings->dirty) {
+            settings->dirty = 1;
+            settings->dirty_since = settings_now();
+        } else {
+            settings->dirty_since = settings_now();
+        }
+    }
 
     settings_release(settings);
+
+    settings_notify_change(settings, key, value);
 }
 
 void settings_set(settings_t *settings, const char *key, json_t *value) {
@@ -546,14 +871,7 @@ void settings_set_default_boolean(settings_t *settings, const char *key, int val
 }
 
 void settings_save(settings_t *settings) {
-    //logger_debug(settings->log, "Writing to %s", settings->file_path);
-    char *settings_str = json_dumps(settings->data, JSON_INDENT(2));
-
-    FILE *settings_file = fopen(settings->file_path, "wb");
-    fwrite(settings_str, sizeof(char), strlen(settings_str), settings_file);
-    fflush(settings_file);
-    fclose(settings_file);
-    free(settings_str);
+    settings_write_file(settings);
 }
 
 /*** RST
@@ -617,6 +935,7 @@ luaL_Reg settings_lua_funcs[] = {
     "setdefault", &settings_lua_set_default,
     "saveonset" , &settings_lua_save_on_set,
     "save"      , &settings_lua_save,
+    "onchange"  , &settings_lua_onchange,
     NULL        ,  NULL
 };
 
@@ -874,3 +1193,36 @@ int settings_lua_save(lua_State *L) {
 
     return 0;
 }
+
+/*** RST
+    .. lua:method:: onchange(key, callback)
+
+        Register ``callback(key, value)`` to be called whenever ``key`` is
+        set on this settings object. Modules can cache configuration values
+        and update them from the callback instead of re-reading settings
+        every frame.
+
+        :param string key:
+        :param function callback:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int settings_lua_onchange(lua_State *L) {
+    settings_t *settings = lua_checksettings(L, 1);
+    const char *key = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    settings_change_cb_t *cb = egoverlay_calloc(1, sizeof(settings_change_cb_t));
+
+    cb->key = egoverlay_calloc(strlen(key)+1, sizeof(char));
+    memcpy(cb->key, key, strlen(key));
+
+    lua_pushvalue(L, 3);
+    cb->cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    cb->next = settings->change_cbs;
+    settings->change_cbs = cb;
+
+    return 0;
+}
@@ -33,6 +33,19 @@ void settings_set_default_boolean(settings_t *settings, const char *key, int val
 
 void settings_save(settings_t *settings);
 
+// immutable, refcounted snapshots for worker threads: grab one, read it
+// without locks, release it. snapshots reflect the document as of the last
+// set before they were taken
+typedef struct settings_snapshot_t settings_snapshot_t;
+
+settings_snapshot_t *settings_snapshot(settings_t *settings);
+void settings_snapshot_release(settings_snapshot_t *snapshot);
+
+int settings_snapshot_get_int    (settings_snapshot_t *snapshot, const char *key, int *value);
+int settings_snapshot_get_double (settings_snapshot_t *snapshot, const char *key, double *value);
+int settings_snapshot_get_string (settings_snapshot_t *snapshot, const char *key, const char **value);
+int settings_snapshot_get_boolean(settings_snapshot_t *snapshot, const char *key, int *value);
+
 void lua_pushsettings(lua_State *L, settings_t *settings);
 
 settings_t *lua_checksettings(lua_State *L, int ind);
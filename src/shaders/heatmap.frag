@@ -0,0 +1,23 @@
+#version 460
+
+layout(location = 0) in vec2 uv;
+
+layout(binding = 0) uniform sampler2D density;
+
+layout(location = 3) uniform float intensity; // 1 / max cell value
+layout(location = 4) uniform float alpha;
+
+out vec4 color;
+
+void main() {
+    float d = clamp(texture(density, uv).r * intensity, 0.0, 1.0);
+
+    if (d <= 0.004) discard;
+
+    // blue -> green -> yellow -> red
+    vec3 c = mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), clamp(d * 3.0, 0.0, 1.0));
+    c = mix(c, vec3(1.0, 1.0, 0.0), clamp(d * 3.0 - 1.0, 0.0, 1.0));
+    c = mix(c, vec3(1.0, 0.0, 0.0), clamp(d * 3.0 - 2.0, 0.0, 1.0));
+
+    color = vec4(c, alpha * smoothstep(0.0, 0.25, d));
+}
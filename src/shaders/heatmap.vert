@@ -0,0 +1,26 @@
+#version 460
+
+// density overlay quad: corners generated from the continent coordinate
+// rect, rendered with the (mini)map transform
+
+layout(location = 0) uniform mat4 view;
+layout(location = 1) uniform mat4 proj;
+layout(location = 2) uniform vec4 rect; // left, top, right, bottom
+
+layout(location = 0) out vec2 uv;
+
+void main() {
+    vec2 corner = vec2(0.0, 0.0);
+
+    switch (gl_VertexID) {
+    case 0: corner = vec2(0.0, 1.0); break;
+    case 1: corner = vec2(1.0, 1.0); break;
+    case 2: corner = vec2(0.0, 0.0); break;
+    case 3: corner = vec2(1.0, 0.0); break;
+    }
+
+    uv = corner;
+
+    vec2 pos = mix(rect.xy, rect.zw, corner);
+    gl_Position = proj * view * vec4(pos.x, pos.y, 0.0, 1.0);
+}
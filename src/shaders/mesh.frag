@@ -0,0 +1,15 @@
+#version 460
+
+layout(location = 0) in vec3 frag_normal;
+layout(location = 1) in vec4 frag_color;
+
+out vec4 color;
+
+void main() {
+    // simple headlight-style shading so volumes read as 3D without a real
+    // lighting model
+    vec3 lightdir = normalize(vec3(0.3, 1.0, 0.2));
+    float shade = 0.65 + 0.35 * abs(dot(normalize(frag_normal), lightdir));
+
+    color = vec4(frag_color.rgb * shade, frag_color.a);
+}
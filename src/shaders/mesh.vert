@@ -0,0 +1,45 @@
+#version 460
+
+// instanced built-in meshes (boxes, domes, arrows). per-vertex position and
+// normal, per-instance transform and color; rotation follows the same
+// row-vector euler convention as the sprite shader
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 normal;
+
+layout(location = 3) in vec3 inst_pos;
+layout(location = 4) in vec3 inst_scale;
+layout(location = 5) in vec3 inst_rotation;
+layout(location = 6) in vec4 inst_color;
+
+layout(std140, binding = 0) uniform FrameGlobals {
+    mat4 frame_ortho;
+    mat4 scene_view;
+    mat4 scene_proj;
+    vec4 frame_player_pos;
+    vec4 frame_camera_pos;
+    float frame_time;
+};
+
+layout(location = 0) out vec3 frag_normal;
+layout(location = 1) out vec4 frag_color;
+
+void main() {
+    float cx = cos(inst_rotation.x);
+    float sx = sin(inst_rotation.x);
+    float cy = cos(inst_rotation.y);
+    float sy = sin(inst_rotation.y);
+    float cz = cos(inst_rotation.z);
+    float sz = sin(inst_rotation.z);
+
+    mat3 rx = mat3(1.0, 0.0, 0.0,   0.0, cx, -sx,   0.0, sx, cx);
+    mat3 ry = mat3(cy, 0.0, sy,   0.0, 1.0, 0.0,   -sy, 0.0, cy);
+    mat3 rz = mat3(cz, -sz, 0.0,   sz, cz, 0.0,   0.0, 0.0, 1.0);
+
+    vec3 world = (((pos * inst_scale) * rz) * ry) * rx + inst_pos;
+
+    frag_normal = ((normal * rz) * ry) * rx;
+    frag_color = inst_color;
+
+    gl_Position = scene_proj * scene_view * vec4(world, 1.0);
+}
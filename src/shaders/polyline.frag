@@ -1,9 +1,9 @@
 #version 460
 
-layout(location = 1) uniform vec4 color;
+layout(location = 0) in vec4 frag_color;
 
-layout(location = 0) out vec4 outColor;
+layout(location = 0) out vec4 out_color;
 
 void main() {
-    outColor = color;
-}
\ No newline at end of file
+    out_color = vec4(frag_color.rgb * frag_color.a, frag_color.a);
+}
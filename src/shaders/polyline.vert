@@ -1,8 +1,29 @@
 #version 460
-layout(location = 0) in vec2 in_position;
 
-layout(location = 0) uniform mat4 proj;
+layout(location = 0) in vec2 p0;
+layout(location = 1) in vec2 p1;
+layout(location = 2) in float width;
+layout(location = 3) in vec4 color;
+
+layout(location = 0) uniform mat4 view;
+layout(location = 1) uniform mat4 proj;
+
+layout(location = 0) out vec4 frag_color;
 
 void main() {
-    gl_Position = proj * vec4(in_position, 0.0, 1.0);
-}
\ No newline at end of file
+    // expand the segment into a quad in the vertex shader; each instance
+    // is one segment
+    vec2 dir = normalize(p1 - p0);
+    vec2 n = vec2(-dir.y, dir.x) * (width * 0.5);
+
+    vec2 pos = p0;
+    switch (gl_VertexID) {
+    case 0: pos = p0 + n; break;
+    case 1: pos = p0 - n; break;
+    case 2: pos = p1 + n; break;
+    case 3: pos = p1 - n; break;
+    }
+
+    gl_Position = proj * view * vec4(pos, 0.0, 1.0);
+    frag_color = color;
+}
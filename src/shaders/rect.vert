@@ -1,10 +1,11 @@
 #version 460
 
-layout(location = 0) uniform float left;
-layout(location = 1) uniform float top;
-layout(location = 2) uniform float right;
-layout(location = 3) uniform float bottom;
-layout(location = 4) uniform vec4 color;
+layout(location = 0) in float left;
+layout(location = 1) in float top;
+layout(location = 2) in float right;
+layout(location = 3) in float bottom;
+layout(location = 4) in vec4 color;
+
 layout(location = 5) uniform mat4 proj;
 
 layout(location = 0) out vec4 fragColor;
@@ -1,5 +1,9 @@
 #version 460
 #extension GL_ARB_shading_language_include : require
+#include "/capabilities.glsl"
+#if HAS_BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
 
 #define FRAGMENT_SHADER
 #include "/3dcommon.glsl"
@@ -11,6 +15,8 @@ layout(location = 3) in float fade_alpha;
 layout(location = 4) in float fade_dist;
 layout(location = 5) in float cam_player_dist;
 layout(location = 6) in float vert_cam_dist;
+layout(location = 7) flat in float frag_tex_layer;
+layout(location = 8) flat in uvec2 frag_tex_handle;
 
 layout(location = 0) out vec4 out_color;
 
@@ -20,6 +26,7 @@ layout(location = 6) uniform float map_bottom;
 layout(location = 7) uniform float map_height;
 
 layout(binding = 0) uniform sampler2D tex_sampler;
+layout(binding = 1) uniform sampler2DArray atlas_sampler;
 
 void main() {
     if (ismap==0) {
@@ -28,7 +35,24 @@ void main() {
         if (fade_alpha < 0.01) discard;
     }
 
-    vec4 texcolor = texture(tex_sampler, frag_tex_coord);
+    // atlas packed sprites sample the shared array texture, everything else
+    // samples its own texture
+    vec4 texcolor;
+    if (frag_tex_layer < 0.0) {
+#if HAS_BINDLESS_TEXTURES
+        // standalone textures carry a resident handle per instance, so the
+        // whole pass draws without rebinding
+        if (frag_tex_handle.x!=0u || frag_tex_handle.y!=0u) {
+            texcolor = texture(sampler2D(frag_tex_handle), frag_tex_coord);
+        } else {
+            texcolor = texture(tex_sampler, frag_tex_coord);
+        }
+#else
+        texcolor = texture(tex_sampler, frag_tex_coord);
+#endif
+    } else {
+        texcolor = texture(atlas_sampler, vec3(frag_tex_coord, frag_tex_layer));
+    }
 
     float alpha = frag_color.a;
 
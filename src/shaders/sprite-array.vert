@@ -1,5 +1,6 @@
 #version 460
 #extension GL_ARB_shading_language_include : require
+#include "/capabilities.glsl"
 
 #include "/3dcommon.glsl"
 
@@ -12,13 +13,32 @@ layout(location = 5) in float fade_near;
 layout(location = 6) in float fade_far;
 layout(location = 7) in vec4 color;
 layout(location = 8) in uint flags;
-layout(location = 9) in mat4 rotation;
+layout(location = 9) in vec3 rotation;
+layout(location = 10) in vec2 atlas_uv0;
+layout(location = 11) in float atlas_layer;
+// animation channel: x = mode (0 none, 1 pulse, 2 bob, 3 rotate),
+// y = phase, z = amplitude, w = speed. evaluated from frame_time so
+// animated sprites cost nothing on the CPU
+layout(location = 12) in vec4 anim;
+// bindless texture handle (lo, hi); 0 when the sprite samples the atlas or
+// the bound standalone texture
+layout(location = 13) in uvec2 tex_handle;
 
+// per frame globals shared by every pipeline
+layout(std140, binding = 0) uniform FrameGlobals {
+    mat4 frame_ortho;
+    mat4 scene_view;
+    mat4 scene_proj;
+    vec4 frame_player_pos;
+    vec4 frame_camera_pos;
+    float frame_time;
+};
+
+// only used for map lists; world lists read the scene matrices from the
+// frame globals
 layout(location = 0) uniform mat4 view;
 layout(location = 1) uniform mat4 proj;
-layout(location = 2) uniform vec3 player_pos;
 layout(location = 3) uniform uint ismap;
-layout(location = 4) uniform vec3 camera_pos;
 
 layout(location = 0) out vec2 frag_tex_coord;
 layout(location = 1) out vec4 frag_color;
@@ -27,15 +47,26 @@ layout(location = 3) out float fade_alpha; // result of fading due to fade_near
 layout(location = 4) out float fade_dist;
 layout(location = 5) out float cam_player_dist;
 layout(location = 6) out float vert_cam_dist;
+layout(location = 7) flat out float frag_tex_layer;
+layout(location = 8) flat out uvec2 frag_tex_handle;
 
 void main() {
+    float anim_t = frame_time * anim.w + anim.y;
+
     float y_size = size;
     float x_size = y_size * xy_ratio;
 
+    if (anim.x==1.0) {
+        // pulse: oscillate scale around the authored size
+        float pulse = 1.0 + anim.z * sin(anim_t);
+        x_size *= pulse;
+        y_size *= pulse;
+    }
+
     mat3 billboard = mat3(
-        view[0].xyz,
-        view[1].xyz,
-        view[2].xyz
+        scene_view[0].xyz,
+        scene_view[1].xyz,
+        scene_view[2].xyz
     );
 
     float left = x_size / 2.0 * -1.0;
@@ -51,42 +82,74 @@ void main() {
     // triangle strip, triangle 1 = b,a,d; triangle 2 = d,a,c
     case 0: // B
         vpos = vec3(right, bottom, 0.0);
-        frag_tex_coord = vec2(max_u, 0.0);
+        frag_tex_coord = atlas_uv0 + vec2(max_u, 0.0);
         break;
     case 1: // A
         vpos = vec3(left, bottom, 0.0);
-        frag_tex_coord = vec2(0.0, 0.0);
+        frag_tex_coord = atlas_uv0;
         break;
     case 2: // D
         vpos = vec3(right, top, 0.0);
-        frag_tex_coord = vec2(max_u, max_v);
+        frag_tex_coord = atlas_uv0 + vec2(max_u, max_v);
         break;
     case 3: // C
         vpos = vec3(left, top, 0.0);
-        frag_tex_coord = vec2(0.0, max_v);
+        frag_tex_coord = atlas_uv0 + vec2(0.0, max_v);
         break;
     }
 
+    frag_tex_layer = atlas_layer;
+    frag_tex_handle = tex_handle;
+
+    if (anim.x==3.0) {
+        // rotate: spin in the sprite plane; composes with the billboard
+        // and the authored euler rotation below
+        float ca = cos(anim_t);
+        float sa = sin(anim_t);
+        vpos.xy = vec2(vpos.x * ca - vpos.y * sa, vpos.x * sa + vpos.y * ca);
+    }
+
     if (ismap==0) {
         if ((flags & BILLBOARD) > 0) {
             vpos *= billboard;
         } else {
-            vpos = (vec4(vpos, 1.0) * rotation).xyz;
+            // build the rotation here from the euler angles; this matches
+            // the CPU path that used to upload a per-instance matrix:
+            // v' = v * Rz * Ry * Rx with the overlay's row-vector convention
+            float cx = cos(rotation.x);
+            float sx = sin(rotation.x);
+            float cy = cos(rotation.y);
+            float sy = sin(rotation.y);
+            float cz = cos(rotation.z);
+            float sz = sin(rotation.z);
+
+            mat3 rx = mat3(1.0, 0.0, 0.0,   0.0, cx, -sx,   0.0, sx, cx);
+            mat3 ry = mat3(cy, 0.0, sy,   0.0, 1.0, 0.0,   -sy, 0.0, cy);
+            mat3 rz = mat3(cz, -sz, 0.0,   sz, cz, 0.0,   0.0, 0.0, 1.0);
+
+            vpos = ((vpos * rz) * ry) * rx;
         }
     }
 
     out_flags = flags;
 
-    gl_Position = proj * view * vec4(pos.xyz + vpos, 1.0);
+    // bob: oscillate along world (or map) y
+    vec3 anim_offset = (anim.x==2.0) ? vec3(0.0, anim.z * sin(anim_t), 0.0) : vec3(0.0);
+
+    if (ismap==0) {
+        gl_Position = scene_proj * scene_view * vec4(pos.xyz + vpos + anim_offset, 1.0);
+    } else {
+        gl_Position = proj * view * vec4(pos.xyz + vpos + anim_offset, 1.0);
+    }
     frag_color = color;
 
-    fade_dist = distance(player_pos, pos);
+    fade_dist = distance(frame_player_pos.xyz, pos);
     if (ismap==0) {
         fade_alpha = distance_fade_alpha(fade_near, fade_far, fade_dist);
     } else {
         fade_alpha = 1.0;
     }
 
-    cam_player_dist = distance(camera_pos, player_pos);
-    vert_cam_dist = distance(camera_pos, pos);
+    cam_player_dist = distance(frame_camera_pos.xyz, frame_player_pos.xyz);
+    vert_cam_dist = distance(frame_camera_pos.xyz, pos);
 }
@@ -9,12 +9,16 @@ layout(location = 5) in float texTop;
 layout(location = 6) in float texRight;
 layout(location = 7) in float texBottom;
 layout(location = 8) in float texLayer;
+layout(location = 9) in vec4 glyphColor;
 
 layout(location = 0) uniform mat4 proj;
 
 layout(location = 0) out vec3 fragTexCoord;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+    fragColor = glyphColor;
 
-void main() {    
     switch (gl_VertexID) {
     // C----D
     // |    |
@@ -3,11 +3,20 @@
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec2 texuv;
 
+layout(std140, binding = 0) uniform FrameGlobals {
+    mat4 frame_ortho;
+    mat4 scene_view;
+    mat4 scene_proj;
+    vec4 frame_player_pos;
+    vec4 frame_camera_pos;
+    float frame_time;
+};
+
+// only used for map lists; world lists read the scene matrices from the
+// frame globals
 layout(location = 0) uniform mat4 view;
 layout(location = 1) uniform mat4 proj;
 layout(location = 8) uniform uint inmap;
-layout(location = 9) uniform vec3 player_pos;
-layout(location = 10) uniform vec3 camera_pos;
 
 layout(location = 0) out vec2 texpos;
 layout(location = 1) out float fade_dist;
@@ -15,14 +24,18 @@ layout(location = 2) out float cam_player_dist;
 layout(location = 3) out float vert_cam_dist;
 
 void main() {
-    gl_Position = proj * view * vec4(pos, 1.0);
+    if (inmap==0) {
+        gl_Position = scene_proj * scene_view * vec4(pos, 1.0);
+    } else {
+        gl_Position = proj * view * vec4(pos, 1.0);
+    }
     texpos = texuv;
 
-    cam_player_dist = distance(camera_pos, player_pos);
-    vert_cam_dist = distance(camera_pos, pos);
+    cam_player_dist = distance(frame_camera_pos.xyz, frame_player_pos.xyz);
+    vert_cam_dist = distance(frame_camera_pos.xyz, pos);
     
     if (inmap==0) {
-        fade_dist = distance(player_pos, pos);
+        fade_dist = distance(frame_player_pos.xyz, pos);
     } else {
         fade_dist = 0.0;
     }
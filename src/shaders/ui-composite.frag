@@ -0,0 +1,12 @@
+#version 460
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 0) uniform sampler2D uiTex;
+
+void main() {
+    // the cached UI is already premultiplied, pass it straight through
+    outColor = texture(uiTex, fragTexCoord);
+}
@@ -0,0 +1,14 @@
+#version 460
+
+layout(location = 0) uniform vec2 uvScale;
+
+layout(location = 0) out vec2 fragTexCoord;
+
+void main() {
+    // fullscreen triangle, no vertex buffer needed. the cache texture may
+    // be larger than the window; uvScale maps to the logical subregion
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+
+    fragTexCoord = pos * uvScale;
+    gl_Position = vec4((pos * 2.0) - 1.0, 0.0, 1.0);
+}
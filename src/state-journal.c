@@ -0,0 +1,210 @@
+/*** RST
+state-journal
+=============
+
+Functions for the binary state journal are exposed on the ``eg-overlay``
+module, see :lua:func:`journalget` and :lua:func:`journalset`.
+*/
+#include "state-journal.h"
+#include "utils.h"
+#include "logging/logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#define JOURNAL_PATH "state.journal"
+#define JOURNAL_MAGIC "EGJ1"
+
+typedef struct journal_entry_t {
+    char *key;
+    void *data;
+    size_t length;
+    struct journal_entry_t *next;
+} journal_entry_t;
+
+typedef struct {
+    journal_entry_t *entries;
+    FILE *file;        // open for appending
+    size_t live_bytes; // bytes of current values
+    size_t file_bytes; // bytes in the file including superseded records
+} state_journal_t;
+
+static state_journal_t *journal = NULL;
+
+static journal_entry_t *state_journal_find(const char *key) {
+    for (journal_entry_t *e=journal->entries;e;e=e->next) {
+        if (strcmp(e->key, key)==0) return e;
+    }
+    return NULL;
+}
+
+static void state_journal_store(const char *key, const void *data, size_t length) {
+    journal_entry_t *e = state_journal_find(key);
+
+    if (!e) {
+        e = egoverlay_calloc(1, sizeof(journal_entry_t));
+        e->key = egoverlay_calloc(strlen(key)+1, sizeof(char));
+        memcpy(e->key, key, strlen(key));
+        e->next = journal->entries;
+        journal->entries = e;
+    } else {
+        journal->live_bytes -= e->length;
+        egoverlay_free(e->data);
+    }
+
+    e->data = egoverlay_malloc(length ? length : 1);
+    if (length) memcpy(e->data, data, length);
+    e->length = length;
+
+    journal->live_bytes += length;
+}
+
+static void state_journal_append_record(FILE *f, const char *key, const void *data, size_t length) {
+    uint32_t keylen = (uint32_t)strlen(key);
+    uint32_t datalen = (uint32_t)length;
+
+    fwrite(&keylen, sizeof(keylen), 1, f);
+    fwrite(&datalen, sizeof(datalen), 1, f);
+    fwrite(key, 1, keylen, f);
+    fwrite(data, 1, datalen, f);
+}
+
+// rewrite the file with only the live records; temp + rename keeps it
+// crash safe
+static void state_journal_compact() {
+    logger_t *log = logger_get("state-journal");
+
+    FILE *f = fopen(JOURNAL_PATH ".tmp", "wb");
+    if (!f) return;
+
+    fwrite(JOURNAL_MAGIC, 1, 4, f);
+
+    for (journal_entry_t *e=journal->entries;e;e=e->next) {
+        state_journal_append_record(f, e->key, e->data, e->length);
+    }
+
+    fflush(f);
+    fclose(f);
+
+    if (journal->file) fclose(journal->file);
+    MoveFileEx(JOURNAL_PATH ".tmp", JOURNAL_PATH, MOVEFILE_REPLACE_EXISTING);
+
+    journal->file = fopen(JOURNAL_PATH, "ab");
+    journal->file_bytes = 4 + journal->live_bytes;
+
+    logger_debug(log, "compacted");
+}
+
+void state_journal_init() {
+    journal = egoverlay_calloc(1, sizeof(state_journal_t));
+
+    size_t len = 0;
+    char *data = NULL;
+
+    FILE *f = fopen(JOURNAL_PATH, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        len = (size_t)ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        data = egoverlay_malloc(len ? len : 1);
+        if (fread(data, 1, len, f)!=len) len = 0;
+        fclose(f);
+    }
+
+    int torn = 0;
+
+    if (len > 4 && memcmp(data, JOURNAL_MAGIC, 4)==0) {
+        size_t pos = 4;
+
+        // later records supersede earlier ones; a torn record at the tail
+        // (crash mid-append) just stops the replay
+        while (pos + 8 <= len) {
+            uint32_t keylen = 0;
+            uint32_t datalen = 0;
+            memcpy(&keylen, data + pos, 4);
+            memcpy(&datalen, data + pos + 4, 4);
+            pos += 8;
+
+            if (pos + keylen + datalen > len || keylen==0) {
+                pos -= 8;
+                break;
+            }
+
+            char *key = egoverlay_calloc(keylen+1, sizeof(char));
+            memcpy(key, data + pos, keylen);
+
+            state_journal_store(key, data + pos + keylen, datalen);
+            egoverlay_free(key);
+
+            pos += keylen + datalen;
+        }
+
+        journal->file_bytes = pos;
+        torn = pos < len;
+    } else if (len > 0) {
+        // an existing file with no (or bad) magic is unreadable garbage
+        torn = 1;
+    }
+
+    if (data) egoverlay_free(data);
+
+    if (torn) {
+        // appending after torn bytes would put every future record beyond
+        // where the next replay stops, silently losing it; rewrite the file
+        // to just the live state instead
+        state_journal_compact();
+    } else if (journal->file_bytes > 4096 && journal->file_bytes > 2 * (journal->live_bytes + 4)) {
+        // startup is the safe moment to drop superseded records
+        state_journal_compact();
+    } else {
+        journal->file = fopen(JOURNAL_PATH, "ab");
+        if (journal->file && journal->file_bytes==0) {
+            fwrite(JOURNAL_MAGIC, 1, 4, journal->file);
+            fflush(journal->file);
+            journal->file_bytes = 4;
+        }
+    }
+}
+
+void state_journal_cleanup() {
+    if (!journal) return;
+
+    if (journal->file) fclose(journal->file);
+
+    journal_entry_t *e = journal->entries;
+    while (e) {
+        journal_entry_t *next = e->next;
+        egoverlay_free(e->key);
+        egoverlay_free(e->data);
+        egoverlay_free(e);
+        e = next;
+    }
+
+    egoverlay_free(journal);
+    journal = NULL;
+}
+
+int state_journal_get(const char *key, const void **data, size_t *length) {
+    if (!journal) return 0;
+
+    journal_entry_t *e = state_journal_find(key);
+    if (!e) return 0;
+
+    *data = e->data;
+    *length = e->length;
+
+    return 1;
+}
+
+void state_journal_set(const char *key, const void *data, size_t length) {
+    if (!journal) return;
+
+    state_journal_store(key, data, length);
+
+    if (journal->file) {
+        state_journal_append_record(journal->file, key, data, length);
+        fflush(journal->file);
+        journal->file_bytes += 8 + strlen(key) + length;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Append-only binary state journal: small blobs of module state (window
+// geometry, last map, active pack list) persisted with O(record) appends
+// instead of full-document rewrites, loaded before Lua initializes, and
+// compacted at startup when the dead space outgrows the live data. Appends
+// are crash safe by construction: a torn tail record is simply ignored at
+// load.
+void state_journal_init();
+void state_journal_cleanup();
+
+// returns 1 and points data/length at the stored blob (valid until the
+// next set of the same key)
+int state_journal_get(const char *key, const void **data, size_t *length);
+
+void state_journal_set(const char *key, const void *data, size_t length);
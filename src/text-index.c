@@ -0,0 +1,389 @@
+/*** RST
+text-index
+==========
+
+.. lua:module:: text-index
+
+.. code-block:: lua
+
+    local textindex = require 'text-index'
+
+Incremental substring search over large record sets.
+
+Records are indexed by trigram as they're added; a search hashes the term's
+trigrams, walks the rarest posting list, and verifies candidates with a real
+substring check, so matching stays in the millisecond range over hundreds of
+thousands of records where a naive per-record ``string.find`` takes seconds.
+Matching is case-insensitive.
+
+The console uses one of these for live log search.
+*/
+#include <windows.h>
+#include <string.h>
+#include <ctype.h>
+#include "text-index.h"
+#include "lua-manager.h"
+#include "utils.h"
+#include <lauxlib.h>
+
+#define TEXT_INDEX_MT "TextIndexMetaTable"
+
+typedef struct {
+    uint32_t key;    // trigram packed into 24 bits; 0xFFFFFFFF = empty
+    uint32_t *ids;   // record ordinals containing this trigram
+    uint32_t count;
+    uint32_t capacity;
+} text_index_bucket_t;
+
+typedef struct {
+    // original record texts by ordinal, plus lowercased copies used for
+    // verification
+    char **texts;
+    char **lowered;
+    size_t count;
+    size_t capacity;
+
+    text_index_bucket_t *buckets;
+    size_t bucket_count; // power of two
+    size_t bucket_used;
+} text_index_t;
+
+#define lua_checktextindex(L, ind) (text_index_t*)luaL_checkudata(L, ind, TEXT_INDEX_MT)
+
+int text_index_lua_new(lua_State *L);
+int text_index_lua_add(lua_State *L);
+int text_index_lua_search(lua_State *L);
+int text_index_lua_get(lua_State *L);
+int text_index_lua_count(lua_State *L);
+int text_index_lua_clear(lua_State *L);
+int text_index_lua_del(lua_State *L);
+
+int text_index_lua_open_module(lua_State *L);
+
+void text_index_lua_init() {
+    lua_manager_add_module_opener("text-index", &text_index_lua_open_module);
+}
+
+int text_index_lua_open_module(lua_State *L) {
+    lua_newtable(L);
+    lua_pushcfunction(L, &text_index_lua_new);
+    lua_setfield(L, -2, "new");
+
+    return 1;
+}
+
+static luaL_Reg text_index_funcs[] = {
+    "add"   , &text_index_lua_add,
+    "search", &text_index_lua_search,
+    "get"   , &text_index_lua_get,
+    "count" , &text_index_lua_count,
+    "clear" , &text_index_lua_clear,
+    "__gc"  , &text_index_lua_del,
+    NULL    , NULL
+};
+
+/*** RST
+Functions
+---------
+
+.. lua:function:: new()
+
+    Create an empty index.
+
+    :rtype: textindex
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int text_index_lua_new(lua_State *L) {
+    text_index_t *index = lua_newuserdata(L, sizeof(text_index_t));
+    memset(index, 0, sizeof(text_index_t));
+
+    index->bucket_count = 4096;
+    index->buckets = egoverlay_calloc(index->bucket_count, sizeof(text_index_bucket_t));
+    for (size_t b=0;b<index->bucket_count;b++) index->buckets[b].key = 0xFFFFFFFF;
+
+    if (luaL_newmetatable(L, TEXT_INDEX_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, text_index_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+static void text_index_clear(text_index_t *index) {
+    for (size_t i=0;i<index->count;i++) {
+        egoverlay_free(index->texts[i]);
+        egoverlay_free(index->lowered[i]);
+    }
+    if (index->texts) egoverlay_free(index->texts);
+    if (index->lowered) egoverlay_free(index->lowered);
+    index->texts = NULL;
+    index->lowered = NULL;
+    index->count = 0;
+    index->capacity = 0;
+
+    for (size_t b=0;b<index->bucket_count;b++) {
+        if (index->buckets[b].key!=0xFFFFFFFF && index->buckets[b].ids) {
+            egoverlay_free(index->buckets[b].ids);
+        }
+        index->buckets[b].key = 0xFFFFFFFF;
+        index->buckets[b].ids = NULL;
+        index->buckets[b].count = 0;
+        index->buckets[b].capacity = 0;
+    }
+    index->bucket_used = 0;
+}
+
+int text_index_lua_del(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+
+    text_index_clear(index);
+    egoverlay_free(index->buckets);
+
+    return 0;
+}
+
+static uint32_t text_index_trigram(const char *s) {
+    return ((uint32_t)(uint8_t)s[0]) | ((uint32_t)(uint8_t)s[1] << 8) | ((uint32_t)(uint8_t)s[2] << 16);
+}
+
+static text_index_bucket_t *text_index_bucket(text_index_t *index, uint32_t key, int create) {
+    size_t ind = (key * 2654435761u) & (index->bucket_count - 1);
+
+    for (size_t probe=0;probe<index->bucket_count;probe++) {
+        text_index_bucket_t *b = &index->buckets[(ind + probe) & (index->bucket_count - 1)];
+
+        if (b->key==key) return b;
+        if (b->key==0xFFFFFFFF) {
+            if (!create) return NULL;
+            b->key = key;
+            index->bucket_used++;
+            return b;
+        }
+    }
+
+    return NULL; // table full; callers treat as miss
+}
+
+// grow the bucket table when it gets crowded so probes stay short
+static void text_index_maybe_grow(text_index_t *index) {
+    if (index->bucket_used * 2 < index->bucket_count) return;
+
+    size_t newcount = index->bucket_count * 2;
+    text_index_bucket_t *newbuckets = egoverlay_calloc(newcount, sizeof(text_index_bucket_t));
+    for (size_t b=0;b<newcount;b++) newbuckets[b].key = 0xFFFFFFFF;
+
+    for (size_t b=0;b<index->bucket_count;b++) {
+        text_index_bucket_t *old = &index->buckets[b];
+        if (old->key==0xFFFFFFFF) continue;
+
+        size_t ind = (old->key * 2654435761u) & (newcount - 1);
+        while (newbuckets[ind].key!=0xFFFFFFFF) ind = (ind + 1) & (newcount - 1);
+        newbuckets[ind] = *old;
+    }
+
+    egoverlay_free(index->buckets);
+    index->buckets = newbuckets;
+    index->bucket_count = newcount;
+}
+
+/*** RST
+Classes
+-------
+
+.. lua:class:: textindex
+
+    .. lua:method:: add(text)
+
+        Index a record. Returns the record id (sequential from 1).
+
+        :param string text:
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int text_index_lua_add(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+    size_t len = 0;
+    const char *text = luaL_checklstring(L, 2, &len);
+
+    if (index->count==index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        index->texts = egoverlay_realloc(index->texts, index->capacity * sizeof(char*));
+        index->lowered = egoverlay_realloc(index->lowered, index->capacity * sizeof(char*));
+    }
+
+    uint32_t ord = (uint32_t)index->count;
+
+    index->texts[ord] = egoverlay_calloc(len+1, sizeof(char));
+    memcpy(index->texts[ord], text, len);
+
+    char *lowered = egoverlay_calloc(len+1, sizeof(char));
+    for (size_t i=0;i<len;i++) lowered[i] = (char)tolower((uint8_t)text[i]);
+    index->lowered[ord] = lowered;
+
+    index->count++;
+
+    if (len >= 3) {
+        text_index_maybe_grow(index);
+
+        uint32_t last_key = 0xFFFFFFFF;
+        for (size_t i=0;i+3<=len;i++) {
+            uint32_t key = text_index_trigram(lowered + i);
+            if (key==last_key) continue; // runs of the same trigram
+            last_key = key;
+
+            text_index_bucket_t *b = text_index_bucket(index, key, 1);
+            if (!b) continue;
+
+            // each record appears once per posting list
+            if (b->count && b->ids[b->count-1]==ord) continue;
+
+            if (b->count==b->capacity) {
+                b->capacity = b->capacity ? b->capacity * 2 : 8;
+                b->ids = egoverlay_realloc(b->ids, b->capacity * sizeof(uint32_t));
+            }
+            b->ids[b->count++] = ord;
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer)ord + 1);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: search(term[, limit])
+
+        Return the ids of records containing ``term``, oldest first,
+        case-insensitively. ``limit`` caps the result count (default 1000).
+
+        Terms shorter than 3 characters fall back to a scan over all
+        records.
+
+        :param string term:
+        :param integer limit: (Optional)
+        :rtype: table
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int text_index_lua_search(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+    size_t termlen = 0;
+    const char *term = luaL_checklstring(L, 2, &termlen);
+    lua_Integer limit = luaL_optinteger(L, 3, 1000);
+
+    char *lterm = egoverlay_calloc(termlen+1, sizeof(char));
+    for (size_t i=0;i<termlen;i++) lterm[i] = (char)tolower((uint8_t)term[i]);
+
+    lua_newtable(L);
+    lua_Integer n = 0;
+
+    if (termlen < 3) {
+        // too short for trigrams; bounded scan
+        for (size_t i=0;i<index->count && n<limit;i++) {
+            if (termlen==0 || strstr(index->lowered[i], lterm)) {
+                lua_pushinteger(L, (lua_Integer)i + 1);
+                lua_rawseti(L, -2, ++n);
+            }
+        }
+
+        egoverlay_free(lterm);
+        return 1;
+    }
+
+    // walk the rarest posting list among the term's trigrams and verify
+    // each candidate with a real substring check
+    text_index_bucket_t *rarest = NULL;
+
+    for (size_t i=0;i+3<=termlen;i++) {
+        text_index_bucket_t *b = text_index_bucket(index, text_index_trigram(lterm + i), 0);
+
+        if (!b) {
+            // a trigram nothing contains: no matches at all
+            egoverlay_free(lterm);
+            return 1;
+        }
+
+        if (!rarest || b->count < rarest->count) rarest = b;
+    }
+
+    if (rarest) {
+        for (uint32_t c=0;c<rarest->count && n<limit;c++) {
+            uint32_t ord = rarest->ids[c];
+
+            if (strstr(index->lowered[ord], lterm)) {
+                lua_pushinteger(L, (lua_Integer)ord + 1);
+                lua_rawseti(L, -2, ++n);
+            }
+        }
+    }
+
+    egoverlay_free(lterm);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: get(id)
+
+        Return the original text of a record, or ``nil``.
+
+        :param integer id:
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int text_index_lua_get(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+    lua_Integer id = luaL_checkinteger(L, 2);
+
+    if (id < 1 || (size_t)id > index->count) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushstring(L, index->texts[id - 1]);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: count()
+
+        Return the number of indexed records.
+
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int text_index_lua_count(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+
+    lua_pushinteger(L, (lua_Integer)index->count);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: clear()
+
+        Remove all records.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int text_index_lua_clear(lua_State *L) {
+    text_index_t *index = lua_checktextindex(L, 1);
+
+    text_index_clear(index);
+
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Incremental trigram substring index exposed to Lua; see text-index.c.
+
+void text_index_lua_init();
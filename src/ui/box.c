@@ -29,6 +29,12 @@ struct ui_box_t {
 
     int spacing;
 
+    // preferred size cache, valid for a single layout pass. nested boxes
+    // otherwise recompute their children's sizes once per ancestor
+    uint64_t layout_gen;
+    int pref_width;
+    int pref_height;
+
     int events;
 };
 
@@ -37,7 +43,7 @@ static void ui_box_draw(ui_box_t *box, int offset_x, int offset_y, mat4f_t *proj
 static int ui_box_get_preferred_size(ui_box_t *box, int *width, int *height);
 
 ui_box_t *ui_box_new(ui_box_orientation_e orientation) {
-    ui_box_t *box = egoverlay_calloc(1, sizeof(ui_box_t));
+    ui_box_t *box = ui_element_alloc(sizeof(ui_box_t));
     box->element.draw = &ui_box_draw;
     box->element.get_preferred_size = &ui_box_get_preferred_size;
     box->element.free = &ui_box_free;
@@ -54,17 +60,17 @@ void ui_box_free(ui_box_t *box) {
     while (i) {
         ui_box_item_t *n = i->next;
         ui_element_unref(i->item);
-        egoverlay_free(i);
+        ui_element_pool_free(i, sizeof(ui_box_item_t));
         i = n;
     }
 
-    egoverlay_free(box);
+    ui_element_pool_free(box, sizeof(ui_box_t));
 }
 
 void ui_box_pack_end(ui_box_t *box, ui_element_t *element, int expand, int align) {
     ui_element_ref(element);
     
-    ui_box_item_t *i = egoverlay_calloc(1, sizeof(ui_box_item_t));
+    ui_box_item_t *i = ui_element_alloc(sizeof(ui_box_item_t));
     i->item = element;
     i->align = align;
     i->expand = expand;
@@ -148,8 +154,10 @@ static void ui_box_draw(ui_box_t *box, int offset_x, int offset_y, mat4f_t *proj
                 x = offset_x + box->element.x + box->element.width - box->padding.right - item_width;
             }
 
-            ui_element_draw(i->item, x, y, proj);
-            
+            if (!ui_rect_culled(x + i->item->x, y + i->item->y, i->item->width, i->item->height)) {
+                ui_element_draw(i->item, x, y, proj);
+            }
+
             y += i->item->height;
             if (i->next) y += box->spacing;
             
@@ -189,7 +197,10 @@ static void ui_box_draw(ui_box_t *box, int offset_x, int offset_y, mat4f_t *proj
 
             //ui_rect_draw(x, y, item_width, item_height, 0xFF0000FF, proj);
 
-            ui_element_draw(i->item, x, y, proj);
+            if (!ui_rect_culled(x + i->item->x, y + i->item->y, i->item->width, i->item->height)) {
+                ui_element_draw(i->item, x, y, proj);
+            }
+
             x += i->item->width;
             if (i->next) x += box->spacing;
             i = i->next;
@@ -207,6 +218,12 @@ static void ui_box_draw(ui_box_t *box, int offset_x, int offset_y, mat4f_t *proj
 }
 
 static int ui_box_get_preferred_size(ui_box_t *box, int *width, int *height) {
+    if (box->layout_gen==ui_layout_generation()) {
+        *width = box->pref_width;
+        *height = box->pref_height;
+        return 1;
+    }
+
     *height = box->padding.top + box->padding.bottom;
     *width = box->padding.left + box->padding.right;
 
@@ -247,6 +264,10 @@ static int ui_box_get_preferred_size(ui_box_t *box, int *width, int *height) {
         *height += max_item_height;
     }
 
+    box->layout_gen = ui_layout_generation();
+    box->pref_width = *width;
+    box->pref_height = *height;
+
     return 1;    
 }
 
@@ -517,7 +538,7 @@ int ui_box_lua_pop_start(lua_State *L) {
     if (f) {
         box->items = f->next;
         ui_element_unref(f->item);
-        egoverlay_free(f);
+        ui_element_pool_free(f, sizeof(ui_box_item_t));
     }
 
     return 0;
@@ -544,7 +565,7 @@ int ui_box_lua_pop_end(lua_State *L) {
         }
         if (box->items == f) box->items = NULL;
         ui_element_unref(f->item);
-        egoverlay_free(f);
+        ui_element_pool_free(f, sizeof(ui_box_item_t));
         if (prev) prev->next = NULL;
     }
 
@@ -39,7 +39,7 @@ int ui_button_get_preferred_size(ui_button_t *button, int *width, int *height);
 int ui_button_process_mouse_event(ui_button_t *button, ui_mouse_event_t *event, int offset_x, int offset_y);
 
 ui_button_t *ui_button_new() {
-    ui_button_t *btn = egoverlay_calloc(1, sizeof(ui_button_t));
+    ui_button_t *btn = ui_element_alloc(sizeof(ui_button_t));
 
     btn->element.draw                = &ui_button_draw;
     btn->element.get_preferred_size  = &ui_button_get_preferred_size;
@@ -76,7 +76,7 @@ void ui_button_free(ui_button_t *button) {
         lua_manager_unref(button->lua_bind_table);
         egoverlay_free(button->lua_bind_field);
     }
-    egoverlay_free(button);
+    ui_element_pool_free(button, sizeof(ui_button_t));
 }
 
 void ui_button_draw(ui_button_t *button, int offset_x, int offset_y, mat4f_t *proj) {
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ui.h"
+#include "chart.h"
+#include "rect.h"
+#include "../app.h"
+#include "../utils.h"
+#include <lauxlib.h>
+
+// A ring-buffer backed sparkline/histogram. Samples are pushed at zero
+// allocation into a fixed ring; draw scales them into bar instances and
+// submits the whole chart as one bulk append to the batched rect pipeline.
+struct ui_chart_t {
+    ui_element_t element;
+
+    float *samples;
+    size_t capacity;
+    size_t count;  // total pushed, ring position = count % capacity
+
+    ui_color_t color;
+
+    // fixed range; when max <= min the range follows the data
+    float range_min;
+    float range_max;
+
+    // per-draw instance scratch, sized to capacity
+    ui_rect_instance_t *instances;
+};
+
+ui_chart_t *ui_chart_new(size_t capacity);
+void ui_chart_free(ui_chart_t *chart);
+void ui_chart_draw(ui_chart_t *chart, int offset_x, int offset_y, mat4f_t *proj);
+int ui_chart_get_preferred_size(ui_chart_t *chart, int *width, int *height);
+
+ui_chart_t *ui_chart_new(size_t capacity) {
+    ui_chart_t *chart = ui_element_alloc(sizeof(ui_chart_t));
+
+    chart->capacity = capacity;
+    chart->samples = egoverlay_calloc(capacity, sizeof(float));
+    chart->instances = egoverlay_calloc(capacity, sizeof(ui_rect_instance_t));
+    chart->color = 0x00FF00CC;
+
+    chart->element.draw               = (ui_draw_fn*)&ui_chart_draw;
+    chart->element.get_preferred_size = (ui_get_preferred_size_fn*)&ui_chart_get_preferred_size;
+    chart->element.free               = (ui_element_free_fn*)&ui_chart_free;
+
+    ui_element_ref(chart);
+
+    return chart;
+}
+
+void ui_chart_free(ui_chart_t *chart) {
+    egoverlay_free(chart->samples);
+    egoverlay_free(chart->instances);
+    ui_element_pool_free(chart, sizeof(ui_chart_t));
+}
+
+// push a sample into the ring; O(1), no allocation
+void ui_chart_push(ui_chart_t *chart, float value) {
+    chart->samples[chart->count % chart->capacity] = value;
+    chart->count++;
+
+    // element coords are parent-relative; without the absolute offset a
+    // rect here would mislead the swap hint, so mark a full damage
+    ui_damage();
+}
+
+void ui_chart_draw(ui_chart_t *chart, int offset_x, int offset_y, mat4f_t *proj) {
+    if (chart->element.width <= 0 || chart->element.height <= 0 || chart->count==0) return;
+
+    size_t n = chart->count < chart->capacity ? chart->count : chart->capacity;
+
+    float lo = chart->range_min;
+    float hi = chart->range_max;
+
+    if (hi <= lo) {
+        // auto range over the resident samples
+        lo = chart->samples[0];
+        hi = chart->samples[0];
+        for (size_t i=1;i<n;i++) {
+            if (chart->samples[i] < lo) lo = chart->samples[i];
+            if (chart->samples[i] > hi) hi = chart->samples[i];
+        }
+        if (hi==lo) hi = lo + 1.f;
+    }
+
+    int x = offset_x + chart->element.x;
+    int y = offset_y + chart->element.y;
+    int w = chart->element.width;
+    int h = chart->element.height;
+
+    // one bar per sample, newest at the right edge
+    float barw = (float)w / (float)chart->capacity;
+    if (barw < 1.f) barw = 1.f;
+
+    size_t ninst = 0;
+    for (size_t i=0;i<n;i++) {
+        // oldest resident sample first
+        size_t ind = chart->count <= chart->capacity ? i : (chart->count + i) % chart->capacity;
+
+        float v = (chart->samples[ind] - lo) / (hi - lo);
+        if (v < 0.f) v = 0.f;
+        if (v > 1.f) v = 1.f;
+
+        int barh = (int)(v * (float)h);
+        if (barh < 1) barh = 1;
+
+        int bx = x + (int)((float)(chart->capacity - n + i) * barw);
+        if (bx >= x + w) break;
+
+        int bw = (int)barw;
+        if (bw < 1) bw = 1;
+
+        ui_rect_instance(&chart->instances[ninst++], bx, y + h - barh, bw, barh, chart->color);
+    }
+
+    if (ninst) ui_rect_draw_cached(chart->instances, ninst, proj);
+}
+
+int ui_chart_get_preferred_size(ui_chart_t *chart, int *width, int *height) {
+    *width = (int)chart->capacity;
+    *height = 40;
+
+    return 1;
+}
+
+void lua_pushuichart(lua_State *L, ui_chart_t *chart);
+
+int ui_chart_lua_new(lua_State *L);
+int ui_chart_lua_del(lua_State *L);
+int ui_chart_lua_push(lua_State *L);
+int ui_chart_lua_color(lua_State *L);
+int ui_chart_lua_range(lua_State *L);
+
+luaL_Reg ui_chart_funcs[] = {
+    "__gc" , &ui_chart_lua_del,
+    "push" , &ui_chart_lua_push,
+    "color", &ui_chart_lua_color,
+    "range", &ui_chart_lua_range,
+    NULL   ,  NULL
+};
+
+void ui_chart_lua_register_ui_funcs(lua_State *L) {
+    lua_pushcfunction(L, &ui_chart_lua_new);
+    lua_setfield(L, -2, "chart");
+}
+
+void lua_pushuichart(lua_State *L, ui_chart_t *chart) {
+    ui_chart_t **pchart = (ui_chart_t**)lua_newuserdata(L, sizeof(ui_chart_t*));
+    *pchart = chart;
+
+    if (luaL_newmetatable(L, "UIChartMetaTable")) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushboolean(L, 1);
+        lua_setfield(L, -2, "__is_uielement");
+
+        luaL_setfuncs(L, ui_chart_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    ui_element_ref(chart);
+}
+
+#define lua_checkuichart(L, ind) *(ui_chart_t**)luaL_checkudata(L, ind, "UIChartMetaTable")
+
+/*** RST
+Chart Element
+=============
+
+.. lua:currentmodule:: eg-overlay-ui
+
+Functions
+---------
+
+.. lua:function:: chart(samples)
+
+    Create a chart element: a ring-buffer backed sparkline that draws one
+    bar per retained sample as a single batched draw. Push costs nothing to
+    allocate, so live frame-time graphs can update every frame.
+
+    :param integer samples: The ring capacity (bars shown).
+    :rtype: uichart
+
+    .. code-block:: lua
+        :caption: Example
+
+        local chart = ui.chart(120)
+        chart:range(0, 33) -- milliseconds
+
+        -- per update
+        chart:push(frametime)
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int ui_chart_lua_new(lua_State *L) {
+    lua_Integer capacity = luaL_checkinteger(L, 1);
+
+    if (capacity < 1 || capacity > 4096) {
+        return luaL_error(L, "chart capacity must be 1-4096 samples.");
+    }
+
+    ui_chart_t *chart = ui_chart_new((size_t)capacity);
+    lua_pushuichart(L, chart);
+    ui_element_unref(chart);
+
+    return 1;
+}
+
+int ui_chart_lua_del(lua_State *L) {
+    ui_chart_t *chart = lua_checkuichart(L, 1);
+
+    ui_element_unref(chart);
+
+    return 0;
+}
+
+/*** RST
+Chart Methods
+-------------
+
+.. lua:class:: uichart
+
+    .. lua:method:: push(value)
+
+        Add a sample to the ring, evicting the oldest when full.
+
+        :param number value:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_chart_lua_push(lua_State *L) {
+    ui_chart_t *chart = lua_checkuichart(L, 1);
+    float value = (float)luaL_checknumber(L, 2);
+
+    ui_chart_push(chart, value);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: color(value)
+
+        Set the bar color, see :ref:`colors`. Default ``0x00FF00CC``.
+
+        :param integer value:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_chart_lua_color(lua_State *L) {
+    ui_chart_t *chart = lua_checkuichart(L, 1);
+
+    chart->color = (ui_color_t)luaL_checkinteger(L, 2);
+    ui_damage();
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: range(min, max)
+
+        Fix the value range bars are scaled against. With ``max <= min`` the
+        chart auto-ranges over the resident samples.
+
+        :param number min:
+        :param number max:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_chart_lua_range(lua_State *L) {
+    ui_chart_t *chart = lua_checkuichart(L, 1);
+
+    chart->range_min = (float)luaL_checknumber(L, 2);
+    chart->range_max = (float)luaL_checknumber(L, 3);
+    ui_damage();
+
+    return 0;
+}
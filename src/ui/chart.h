@@ -0,0 +1,6 @@
+#pragma once
+#include <lua.h>
+
+typedef struct ui_chart_t ui_chart_t;
+
+void ui_chart_lua_register_ui_funcs(lua_State *L);
@@ -1,5 +1,10 @@
 #include <math.h>
+#include <windows.h>
+#include <string.h>
 #include "font.h"
+#include "../app.h"
+#include "../settings.h"
+#include "../profiler.h"
 #include "../utils.h"
 #include "../logging/logger.h"
 #include "../gl.h"
@@ -7,15 +12,24 @@
 
 #include <ft2build.h>
 #include <freetype/ftmm.h>
+#include <freetype/ftoutln.h>
 #include <freetype/ftsnames.h>
 #include <freetype/ttnameid.h>
 #include FT_FREETYPE_H
 
-// up to CACHE_MAX_SIZE fonts/size combinations can be stored in the cache
-// 50 seems like a very reasonable number?
-// The cache is a hash map, with the keys being the path to the font file and 
-// size concatenated together, ie. 'fonts/Roboto-Regular.ttf20'
-#define CACHE_MAX_SIZE 50
+// Every font file is loaded once and the FT_Face shared across all of the
+// variation/size instances created from it. The face's size and variation
+// coordinates are mutable FreeType state, so each instance re-applies its own
+// before using the face (ui_font_activate); instances that render back to
+// back, like a weight animation, only pay for the coordinate swap, not a new
+// face.
+typedef struct font_face_entry_t {
+    char *path;
+    FT_Face face;
+    int refs;
+    ui_font_t *active; // instance whose size/coords are currently applied
+    struct font_face_entry_t *next;
+} font_face_entry_t;
 
 typedef struct {
     logger_t *log;
@@ -24,16 +38,64 @@ typedef struct {
     GLuint vbo;
     FT_Library ftlib;
 
-    size_t cache_size;
-    uint32_t *cache_keys;
-    ui_font_t **cache_fonts;
+    // instance cache: a move to front list keyed on the full
+    // path/size/weight/slant/width tuple. widgets hold the returned pointers
+    // indefinitely, so entries are never evicted; they stay ordered by last
+    // use so the fonts rendering every frame are found first
+    ui_font_t *font_list;
+
+    font_face_entry_t *faces;
 
+    // frame scoped glyph batch. every ui_font_render_text call appends to
+    // vbodata and the whole batch is drawn by ui_font_flush, which runs at
+    // scissor/viewport changes and at the end of the UI pass. all fonts
+    // share one atlas, so the batch is a single draw call
     ui_font_vbo_data_t *vbodata;
-    size_t vbo_data_size;
+    size_t vbo_data_size; // in glyphs
+    size_t batch_count;
+    mat4f_t batch_proj;
+
+    // shared glyph atlas. glyphs from every cached font/size are shelf packed
+    // into FONT_ATLAS_SIZE texture array layers, grown on demand, so all text
+    // renders from a single texture bind
+    GLuint atlas;
+    GLsizei atlas_layers;
+    int *shelf_x;
+    int *shelf_y;
+    int *shelf_h;
 } ui_font_global_t;
 
 static ui_font_global_t *fonts = NULL;
 
+// Shaped run cache: a direct mapped cache of recently shaped strings.
+// Strings that render every frame (even without a widget level layout
+// object) hit the cache and skip decoding/kerning and heap allocations.
+#define RUN_CACHE_SIZE 256
+
+typedef struct {
+    uint32_t hash;
+    ui_font_t *font;
+    char *text;
+    size_t len;
+
+    size_t glyph_count;
+    ui_font_vbo_data_t *glyphs;
+} ui_font_shaped_run_t;
+
+static ui_font_shaped_run_t run_cache[RUN_CACHE_SIZE];
+
+
+// Number of subpixel x positions each glyph is rasterized at. Quads snap to
+// whole pixels and the fractional pen position picks the variant, so slowly
+// scrolling/animated text moves smoothly instead of shimmering as glyphs
+// re-snap. Variants are lazy rendered like everything else; static text only
+// ever touches variant 0.
+#define UI_FONT_SUBPIXEL_VARIANTS 4
+
+// glyph map key: codepoints stop at 0x10FFFF (21 bits), the variant index
+// lives above them
+#define GLYPH_KEY(codepoint, variant) ((codepoint) | ((uint32_t)(variant) << 22))
+
 // Cached metrics for each rendered glyph
 typedef struct glyph_metrics_t {
     double bearing_x;
@@ -42,6 +104,11 @@ typedef struct glyph_metrics_t {
     int bitmap_width;
     int bitmap_rows;
     FT_UInt char_index;
+
+    // placement within the shared atlas
+    int tex_x;
+    int tex_y;
+    int tex_layer;
 } glyph_metrics_t;
 
 // Glyphs are pre-rendered into OpenGL textures and then each glyph is drawn as
@@ -49,27 +116,33 @@ typedef struct glyph_metrics_t {
 // not baked up front. Each glyph is lazy loaded (rendered) as needed, with a
 // predefined list of common glyphs loaded at initialization (preload_chars)
 //
-// The textures that hold the glyphs are GLYPH_TEX_SIZE (512x512). This means
-// that larger font sizes may need multiple textures to hold glyphs, especially
-// if additional glyphs outside the preload_chars are needed.
-// This does mean that storage for particularly huge fonts becomes pretty
-// inefficient (ie. 1 texture per glyph for anything over 256 pixels), but I
-// expect that users won't be using fonts with a size over 100 pixels, much less
-// 256.
-//
-// Each texture is stored as a layer in a 2D texture array. All glyphs are for
-// a font are stored in a hash map (of the codepoint). The order the glyphs are
-// rendered is the order in which they will appear in the texture array.
-#define GLYPH_TEX_SIZE 512
+// All fonts and sizes share one shelf packed atlas (a 2D texture array with
+// FONT_ATLAS_SIZE layers, grown on demand). Each glyph records where it was
+// placed in its metrics, so rendering a frame's worth of text from any mix of
+// fonts only ever binds one texture.
+#define FONT_ATLAS_SIZE 2048
+#define FONT_ATLAS_PAD     1
 
 struct ui_font_t {
+    char *path;
     int size;
+    int weight;
+    int slant;
+    int width;
     FT_Face face;
+    font_face_entry_t *face_entry;
+
+    // resolved variation design coordinates, NULL for static fonts
+    FT_Fixed *var_coords;
+    FT_UInt var_num_axis;
 
-    // the number of glyphs that can fit on a single layer of the texture array
-    size_t page_max_glyphs;
-    // the number of glyphs per row in the texture
-    size_t page_glyph_x;
+    // metrics memoized at creation; the shared face's size state changes as
+    // other instances activate it, so these can't be read back later
+    float ascender;
+    uint32_t height;
+    uint32_t line_spacing;
+
+    ui_font_t *cache_next;
 
     // glyph codepoint hash map
     size_t glyphmap_capacity;
@@ -77,12 +150,7 @@ struct ui_font_t {
     uint32_t *glyphs;
 
     // hash map contents
-    size_t *glyph_index; // where is the glyph within the texture array?
     glyph_metrics_t *metrics;
-    GLuint *texture_num; // which layer in the array
-
-    GLuint texture_levels;
-    GLuint texture;
 };
 
 struct ui_font_vbo_data_t {
@@ -95,12 +163,17 @@ struct ui_font_vbo_data_t {
     float tex_right;
     float tex_bottom;
     float tex_layer;
+
+    float r;
+    float g;
+    float b;
+    float a;
 };
 
 ui_font_t *ui_font_new(const char *path, int size, int weight, int slant, int width);
 void ui_font_free(ui_font_t *font);
 
-static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint);
+static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint, int variant);
 
 int ui_font_get_codepoint_ind(ui_font_t *font, uint32_t codepoint, size_t *ind);
 
@@ -109,6 +182,168 @@ static const char preload_chars[] =
     "abcdefghijklmnopqrstuvwxyz"
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
+// ---- startup glyph prewarm ----
+// Rasterizing the preload set runs ~90 FreeType renders; doing that on the
+// render thread puts FreeType in the time-to-first-frame path. The prewarm
+// thread rasterizes them during the parallel-init window with its own
+// FT_Library (FreeType libraries are not shareable across threads) into
+// staging buffers; ui_font_new consumes them with atlas uploads only.
+typedef struct {
+    uint32_t codepoint;
+    double bearing_x;
+    double bearing_y;
+    double advance_x;
+    int width;
+    int rows;
+    FT_UInt char_index;
+    uint8_t *pixels; // gamma corrected, width * rows
+} ui_font_prewarm_glyph_t;
+
+typedef struct {
+    char *path;
+    int size;
+
+    ui_font_prewarm_glyph_t glyphs[128];
+    int count;
+
+    HANDLE thread;
+    volatile LONG done;
+    int consumed;
+} ui_font_prewarm_t;
+
+static ui_font_prewarm_t *font_prewarm = NULL;
+
+static void ui_font_gamma_correct(const uint8_t *src, uint8_t *dst, size_t count) {
+    for (size_t i=0;i<count;i++) {
+        double a = src[i] / 255.0;
+        dst[i] = (uint8_t)ceil(pow(a, 1/2.2) * 255);
+    }
+}
+
+static DWORD WINAPI ui_font_prewarm_thread_fn(LPVOID param) {
+    ui_font_prewarm_t *pw = (ui_font_prewarm_t*)param;
+
+    FT_Library lib = NULL;
+    FT_Face face = NULL;
+
+    if (FT_Init_FreeType(&lib)==0 && FT_New_Face(lib, pw->path, 0, &face)==0 &&
+        FT_Set_Pixel_Sizes(face, 0, pw->size)==0
+    ) {
+        for (size_t c=0;preload_chars[c] && pw->count<128;c++) {
+            uint32_t codepoint = (uint32_t)preload_chars[c];
+            FT_UInt glyph = FT_Get_Char_Index(face, codepoint);
+
+            if (FT_Load_Glyph(face, glyph, FT_LOAD_DEFAULT)) continue;
+            if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) continue;
+
+            ui_font_prewarm_glyph_t *g = &pw->glyphs[pw->count];
+            g->codepoint = codepoint;
+            g->bearing_x = (double)face->glyph->metrics.horiBearingX / 64.0;
+            g->bearing_y = (double)face->glyph->metrics.horiBearingY / 64.0;
+            g->advance_x = (double)face->glyph->metrics.horiAdvance / 64.0;
+            g->width = face->glyph->bitmap.width;
+            g->rows = face->glyph->bitmap.rows;
+            g->char_index = glyph;
+
+            size_t npixels = (size_t)g->width * g->rows;
+            if (npixels) {
+                g->pixels = egoverlay_malloc(npixels);
+                ui_font_gamma_correct(face->glyph->bitmap.buffer, g->pixels, npixels);
+            }
+
+            pw->count++;
+        }
+    }
+
+    if (face) FT_Done_Face(face);
+    if (lib) FT_Done_FreeType(lib);
+
+    InterlockedExchange(&pw->done, 1);
+
+    return 0;
+}
+
+// start rasterizing the default UI font's preload set on a worker; called
+// from the app's parallel-init stage, before the fonts system exists
+void ui_font_prewarm(const char *path, int size) {
+    if (font_prewarm) return;
+
+    font_prewarm = egoverlay_calloc(1, sizeof(ui_font_prewarm_t));
+    font_prewarm->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(font_prewarm->path, path, strlen(path));
+    font_prewarm->size = size;
+
+    font_prewarm->thread = CreateThread(0, 0, &ui_font_prewarm_thread_fn, font_prewarm, 0, NULL);
+}
+
+static void ui_font_prewarm_free() {
+    if (!font_prewarm) return;
+
+    if (font_prewarm->thread) {
+        WaitForSingleObject(font_prewarm->thread, INFINITE);
+        CloseHandle(font_prewarm->thread);
+    }
+
+    for (int g=0;g<font_prewarm->count;g++) {
+        if (font_prewarm->glyphs[g].pixels) egoverlay_free(font_prewarm->glyphs[g].pixels);
+    }
+    egoverlay_free(font_prewarm->path);
+    egoverlay_free(font_prewarm);
+    font_prewarm = NULL;
+}
+
+static void ui_font_atlas_place(int width, int height, int *x, int *y, int *layer);
+
+// adopt the staged glyphs: map inserts plus atlas uploads, no FreeType work
+static int ui_font_consume_prewarm(ui_font_t *font) {
+    if (!font_prewarm || font_prewarm->consumed || !font_prewarm->done) return 0;
+    if (font_prewarm->size!=font->size || strcmp(font_prewarm->path, font->path)!=0) return 0;
+
+    font_prewarm->consumed = 1;
+
+    for (int i=0;i<font_prewarm->count;i++) {
+        ui_font_prewarm_glyph_t *g = &font_prewarm->glyphs[i];
+
+        // the initial map holds the whole preload set comfortably
+        size_t glyphind = g->codepoint % font->glyphmap_capacity;
+        while (font->glyphs[glyphind]!=0) {
+            glyphind++;
+            if (glyphind>=font->glyphmap_capacity) glyphind = 0;
+        }
+
+        font->glyphs[glyphind] = g->codepoint;
+        font->metrics[glyphind].bearing_x = g->bearing_x;
+        font->metrics[glyphind].bearing_y = g->bearing_y;
+        font->metrics[glyphind].advance_x = g->advance_x;
+        font->metrics[glyphind].bitmap_width = g->width;
+        font->metrics[glyphind].bitmap_rows = g->rows;
+        font->metrics[glyphind].char_index = g->char_index;
+        font->glyph_count++;
+
+        int tex_x = 0;
+        int tex_y = 0;
+        int tex_layer = 0;
+        ui_font_atlas_place(g->width, g->rows, &tex_x, &tex_y, &tex_layer);
+
+        font->metrics[glyphind].tex_x = tex_x;
+        font->metrics[glyphind].tex_y = tex_y;
+        font->metrics[glyphind].tex_layer = tex_layer;
+
+        if (g->pixels) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTextureSubImage3D(
+                fonts->atlas,
+                0, tex_x, tex_y, tex_layer,
+                g->width, g->rows, 1,
+                GL_RED, GL_UNSIGNED_BYTE, g->pixels
+            );
+        }
+    }
+
+    return 1;
+}
+
+
 gl_shader_source_list_t shader_sources[] = {
     "shaders/text-quad.vert", GL_VERTEX_SHADER,
     "shaders/text-quad.frag", GL_FRAGMENT_SHADER,
@@ -133,6 +368,7 @@ void ui_font_init() {
 
     fonts->vbo_data_size = 512;
     fonts->vbodata = egoverlay_calloc(fonts->vbo_data_size, sizeof(ui_font_vbo_data_t));
+    fonts->batch_count = 0;
 
     glGenVertexArrays(1, &fonts->vao);
     glGenBuffers(1, &fonts->vbo);
@@ -149,25 +385,42 @@ void ui_font_init() {
     VERT_ATTRIB_FLOAT(6, 1, ui_font_vbo_data_t, tex_right );
     VERT_ATTRIB_FLOAT(7, 1, ui_font_vbo_data_t, tex_bottom);
     VERT_ATTRIB_FLOAT(8, 1, ui_font_vbo_data_t, tex_layer );
+    VERT_ATTRIB_VEC4 (9, 1, ui_font_vbo_data_t, r         );
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    fonts->cache_fonts = egoverlay_calloc(CACHE_MAX_SIZE, sizeof(ui_font_t*));
-    fonts->cache_keys = egoverlay_calloc(CACHE_MAX_SIZE, sizeof(uint32_t));
 }
 
 void ui_font_cleanup() {
     logger_debug(fonts->log, "cleanup");
-    for (size_t i=0;i<CACHE_MAX_SIZE;i++) {
-        if (fonts->cache_keys[i]) ui_font_free(fonts->cache_fonts[i]);
+
+    ui_font_prewarm_free();
+
+    for (size_t r=0;r<RUN_CACHE_SIZE;r++) {
+        if (run_cache[r].text) {
+            egoverlay_free(run_cache[r].text);
+            egoverlay_free(run_cache[r].glyphs);
+            run_cache[r].text = NULL;
+        }
+    }
+    ui_font_t *font = fonts->font_list;
+    while (font) {
+        ui_font_t *next = font->cache_next;
+        ui_font_free(font);
+        font = next;
     }
-    egoverlay_free(fonts->cache_fonts);
-    egoverlay_free(fonts->cache_keys);
     egoverlay_free(fonts->vbodata);
 
     gl_shader_program_free(fonts->shader_program);
 
+    if (fonts->atlas) glDeleteTextures(1, &fonts->atlas);
+    if (fonts->atlas_layers) {
+        egoverlay_free(fonts->shelf_x);
+        egoverlay_free(fonts->shelf_y);
+        egoverlay_free(fonts->shelf_h);
+    }
+
     glDeleteBuffers(1, &fonts->vbo);
     glDeleteVertexArrays(1, &fonts->vao);
 
@@ -178,16 +431,41 @@ void ui_font_cleanup() {
 ui_font_t *ui_font_new(const char *path, int size, int weight, int slant, int width) {
     ui_font_t *font = egoverlay_calloc(1, sizeof(ui_font_t));
 
-    FT_Error err = FT_New_Face(fonts->ftlib, path, 0, &font->face);
-    if (err) {
-        logger_error(fonts->log, "Couldn't load %s", path);
-        return NULL;
+    font->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(font->path, path, strlen(path));
+
+    font_face_entry_t *fe = fonts->faces;
+    while (fe && strcmp(fe->path, path)!=0) fe = fe->next;
+
+    if (!fe) {
+        FT_Face face;
+        FT_Error err = FT_New_Face(fonts->ftlib, path, 0, &face);
+        if (err) {
+            logger_error(fonts->log, "Couldn't load %s", path);
+            egoverlay_free(font->path);
+            egoverlay_free(font);
+            return NULL;
+        }
+
+        fe = egoverlay_calloc(1, sizeof(font_face_entry_t));
+        fe->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+        memcpy(fe->path, path, strlen(path));
+        fe->face = face;
+        fe->next = fonts->faces;
+        fonts->faces = fe;
     }
 
+    fe->refs++;
+    font->face_entry = fe;
+    font->face = fe->face;
+
     FT_MM_Var *mm_var;
     if (!FT_Get_MM_Var(font->face, &mm_var)) {
         FT_Fixed *coords = egoverlay_calloc(mm_var->num_axis, sizeof(FT_Fixed));
-        FT_Get_Var_Design_Coordinates(font->face, mm_var->num_axis, coords);
+
+        // start from the axis defaults, not the face's current coordinates;
+        // the face is shared and another instance may have changed them
+        for (FT_UInt a=0;a<mm_var->num_axis;a++) coords[a] = mm_var->axis[a].def;
 
         for (FT_UInt a=0;a<mm_var->num_axis;a++) {
             if (weight!=INT_MIN && strcmp(mm_var->axis[a].name,"Weight")==0) {
@@ -230,64 +508,91 @@ ui_font_t *ui_font_new(const char *path, int size, int weight, int slant, int wi
         }
 
         FT_Set_Var_Design_Coordinates(font->face, mm_var->num_axis, coords);
+        font->var_coords = coords;
+        font->var_num_axis = mm_var->num_axis;
         FT_Done_MM_Var(fonts->ftlib, mm_var);
-        egoverlay_free(coords);
     } else {
         logger_warn(fonts->log, "%s is not a variable font; weight, slant, and width will be ignored.", path);
     }
 
-    err = FT_Set_Pixel_Sizes(font->face, 0, size);
+    FT_Error err = FT_Set_Pixel_Sizes(font->face, 0, size);
     if (err) {
         logger_error(fonts->log, "Couldn't set size %d for %s.", size, path);
         error_and_exit("EG-OVerlay: UI-Font", "Couldn't set size %d for %s.", size, path);
     }
-    
-    int max_w = 0;
-    int max_h = 0;
+    fe->active = font;
 
-    max_w = FT_MulFix(font->face->bbox.xMax - font->face->bbox.xMin, font->face->size->metrics.x_scale);
-    max_h = FT_MulFix(font->face->bbox.yMax - font->face->bbox.yMin, font->face->size->metrics.y_scale);
+    font->size = size;
+    font->weight = weight;
+    font->slant = slant;
+    font->width = width;
 
-    font->size = ((max_w > max_h ? max_w : max_h) / 64);
-    font->page_glyph_x = (uint32_t)GLYPH_TEX_SIZE / font->size;
-    font->page_max_glyphs = font->page_glyph_x * font->page_glyph_x;
+    font->ascender = font->face->size->metrics.ascender / 64.f;
+    font->height = (uint32_t)((font->face->size->metrics.ascender - font->face->size->metrics.descender) / 64);
+    font->line_spacing = (uint32_t)(font->face->size->metrics.height / 64);
 
     // initial hashmap size of 256, enough for standard ascii and then some
     font->glyphmap_capacity = 256;
     font->glyphs = egoverlay_calloc(font->glyphmap_capacity, sizeof(uint32_t));
     font->metrics = egoverlay_calloc(font->glyphmap_capacity, sizeof(glyph_metrics_t));
-    font->texture_num = egoverlay_calloc(font->glyphmap_capacity, sizeof(GLuint));
-    font->glyph_index = egoverlay_calloc(font->glyphmap_capacity, sizeof(size_t));
 
-    logger_debug(fonts->log, "new font, %s size %d (%d), %d glyphs per page.",
-                 path, size, font->size, font->page_max_glyphs);
+    logger_debug(fonts->log, "new font, %s size %d.", path, size);
 
-    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &font->texture);
-    font->texture_levels = 1;
-
-    glTextureStorage3D(font->texture, 1, GL_R8, GLYPH_TEX_SIZE, GLYPH_TEX_SIZE, 1);
+    // weight/slant/width variants change glyph shapes; only the plain
+    // instance can adopt the prewarmed set
+    int prewarmed = 0;
+    if (weight==INT_MIN && slant==INT_MIN && width==INT_MIN) {
+        prewarmed = ui_font_consume_prewarm(font);
+    }
 
-    size_t c = 0;
-    while (preload_chars[c]) {
-        ui_font_render_glyph(font, preload_chars[c++]);
+    if (!prewarmed) {
+        size_t c = 0;
+        while (preload_chars[c]) {
+            ui_font_render_glyph(font, preload_chars[c++], 0);
+        }
     }
 
     return font;
 }
 
 void ui_font_free(ui_font_t *font) {
-    glDeleteTextures(1, &font->texture);
-
+    egoverlay_free(font->path);
     egoverlay_free(font->glyphs);
     egoverlay_free(font->metrics);
-    egoverlay_free(font->texture_num);
-    egoverlay_free(font->glyph_index);
+    if (font->var_coords) egoverlay_free(font->var_coords);
+
+    font_face_entry_t *fe = font->face_entry;
+    fe->refs--;
 
-    FT_Done_Face(font->face);
+    if (fe->refs==0) {
+        font_face_entry_t **e = &fonts->faces;
+        while (*e && *e!=fe) e = &(*e)->next;
+        if (*e) *e = fe->next;
+
+        FT_Done_Face(fe->face);
+        egoverlay_free(fe->path);
+        egoverlay_free(fe);
+    } else if (fe->active==font) {
+        fe->active = NULL;
+    }
 
     egoverlay_free(font);
 }
 
+// re-apply this instance's size and variation coordinates to the shared face
+// if another instance used it last. must run before any face state dependent
+// FreeType call (glyph loading, kerning)
+static void ui_font_activate(ui_font_t *font) {
+    if (font->face_entry->active==font) return;
+
+    if (font->var_coords) {
+        FT_Set_Var_Design_Coordinates(font->face, font->var_num_axis, font->var_coords);
+    }
+    FT_Set_Pixel_Sizes(font->face, 0, font->size);
+
+    font->face_entry->active = font;
+}
+
 int ui_font_get_codepoint_ind(ui_font_t *font, uint32_t codepoint, size_t *ind) {
     size_t gind = codepoint % font->glyphmap_capacity;
 
@@ -301,24 +606,123 @@ int ui_font_get_codepoint_ind(ui_font_t *font, uint32_t codepoint, size_t *ind)
     return 1;
 }
 
-static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint) {
-    FT_UInt glyph = FT_Get_Char_Index(font->face, codepoint);
+// Grow the shared atlas by another layer, copying existing layers over.
+static void ui_font_atlas_grow() {
+    GLsizei newlayers = fonts->atlas_layers ? fonts->atlas_layers + 1 : 1;
+
+    GLuint newtex = 0;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &newtex);
+    glTextureStorage3D(newtex, 1, GL_R8, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, newlayers);
+
+    if (fonts->atlas) {
+        glCopyImageSubData(
+            fonts->atlas, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            newtex      , GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, fonts->atlas_layers
+        );
+        glDeleteTextures(1, &fonts->atlas);
+    }
+
+    fonts->atlas = newtex;
+    fonts->shelf_x = egoverlay_realloc(fonts->shelf_x, newlayers * sizeof(int));
+    fonts->shelf_y = egoverlay_realloc(fonts->shelf_y, newlayers * sizeof(int));
+    fonts->shelf_h = egoverlay_realloc(fonts->shelf_h, newlayers * sizeof(int));
+
+    fonts->shelf_x[newlayers-1] = 0;
+    fonts->shelf_y[newlayers-1] = 0;
+    fonts->shelf_h[newlayers-1] = 0;
+
+    fonts->atlas_layers = newlayers;
+}
+
+// Shelf pack a glyph of the given dimensions into the shared atlas.
+static void ui_font_atlas_place(int width, int height, int *x, int *y, int *layer) {
+    int w = width + FONT_ATLAS_PAD;
+    int h = height + FONT_ATLAS_PAD;
+
+    for (;;) {
+        for (GLsizei l=0;l<fonts->atlas_layers;l++) {
+            if (fonts->shelf_x[l] + w > FONT_ATLAS_SIZE) {
+                if (fonts->shelf_h[l]==0) continue;
+
+                // close the open shelf and start a new one
+                fonts->shelf_y[l] += fonts->shelf_h[l];
+                fonts->shelf_x[l] = 0;
+                fonts->shelf_h[l] = 0;
+            }
+
+            if (fonts->shelf_y[l] + h > FONT_ATLAS_SIZE) continue; // layer full
+
+            *x = fonts->shelf_x[l];
+            *y = fonts->shelf_y[l];
+            *layer = (int)l;
+
+            fonts->shelf_x[l] += w;
+            if (h > fonts->shelf_h[l]) fonts->shelf_h[l] = h;
+
+            return;
+        }
+
+        ui_font_atlas_grow();
+    }
+}
+
+// Resolve the fallback font for the given font, if one is configured
+// (overlay.ui.font.pathFallback) and this font isn't already it.
+static ui_font_t *ui_font_get_fallback(ui_font_t *font) {
+    const char *fallback_path = NULL;
+
+    GET_APP_SETTING_STR("overlay.ui.font.pathFallback", &fallback_path);
+
+    if (!fallback_path || fallback_path[0]==0) return NULL;
+    if (strcmp(font->path, fallback_path)==0) return NULL;
+
+    return ui_font_get(fallback_path, font->size, INT_MIN, INT_MIN, INT_MIN);
+}
+
+static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint, int variant) {
+    ui_font_activate(font);
+
+    FT_Face face = font->face;
+    FT_UInt glyph = FT_Get_Char_Index(face, codepoint);
+
+    // codepoints this font doesn't cover go through the fallback chain. the
+    // glyph is rendered from the fallback face into the shared atlas but
+    // cached in this font's map, so the lookup only happens once
+    if (glyph==0) {
+        ui_font_t *fallback = ui_font_get_fallback(font);
+
+        if (fallback) {
+            FT_UInt fbglyph = FT_Get_Char_Index(fallback->face, codepoint);
+
+            if (fbglyph) {
+                ui_font_activate(fallback);
+                face = fallback->face;
+                glyph = fbglyph;
+            }
+        }
+    }
 
-    FT_Error err = FT_Load_Glyph(font->face, glyph, FT_LOAD_DEFAULT);
+    FT_Error err = FT_Load_Glyph(face, glyph, FT_LOAD_DEFAULT);
     if (err) {
         logger_error(fonts->log, "Couldn't load glyph for %c", codepoint);
         return;
     }
 
-    FT_Render_Glyph(font->face->glyph, FT_RENDER_MODE_NORMAL);
+    // shift the outline right by the variant's subpixel offset before
+    // rasterizing. bitmap glyphs can't be shifted; they alias to variant 0
+    if (variant && face->glyph->format==FT_GLYPH_FORMAT_OUTLINE) {
+        FT_Outline_Translate(&face->glyph->outline, variant * 64 / UI_FONT_SUBPIXEL_VARIANTS, 0);
+    }
+
+    FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
 
     if (font->glyph_count==font->glyphmap_capacity) {
         // hash map is full, make a bigger one
         size_t newcap = font->glyphmap_capacity + 128;
-        uint32_t *newglyphs = calloc(newcap, sizeof(uint32_t));
+        uint32_t *newglyphs = egoverlay_calloc(newcap, sizeof(uint32_t));
 
-        glyph_metrics_t *newmetrics = calloc(newcap, sizeof(glyph_metrics_t));
-        GLuint *newtexnums = calloc(newcap, sizeof(GLuint));
+        glyph_metrics_t *newmetrics = egoverlay_calloc(newcap, sizeof(glyph_metrics_t));
 
         // move the existing glyphs into the new map
         for (size_t g=0;g<font->glyphmap_capacity;g++) {
@@ -333,63 +737,48 @@ static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint) {
 
             newglyphs[newind] = font->glyphs[g];
             memcpy(&newmetrics[newind], &font->metrics[g], sizeof(glyph_metrics_t));
-            newtexnums[newind] = font->texture_num[g];
         }
 
         egoverlay_free(font->glyphs);
         egoverlay_free(font->metrics);
-        egoverlay_free(font->texture_num);
 
         font->glyphmap_capacity = newcap;
         font->glyphs = newglyphs;
         font->metrics = newmetrics;
-        font->texture_num = newtexnums;
     }
     
-    size_t glyphind = codepoint % font->glyphmap_capacity;
+    uint32_t key = GLYPH_KEY(codepoint, variant);
+    size_t glyphind = key % font->glyphmap_capacity;
 
     while (font->glyphs[glyphind]!=0) {
         glyphind++;
         if (glyphind>=font->glyphmap_capacity) glyphind = 0;
     }
 
-    font->glyphs[glyphind] = codepoint;
+    font->glyphs[glyphind] = key;
 
     // cache glyph metrics
-    font->metrics[glyphind].bearing_x = (double)font->face->glyph->metrics.horiBearingX / 64.0;
-    font->metrics[glyphind].bearing_y = (double)font->face->glyph->metrics.horiBearingY / 64.0;
-    font->metrics[glyphind].advance_x = (double)font->face->glyph->metrics.horiAdvance / 64.0;
-    font->metrics[glyphind].bitmap_width = font->face->glyph->bitmap.width;
-    font->metrics[glyphind].bitmap_rows = font->face->glyph->bitmap.rows;
+    font->metrics[glyphind].bearing_x = (double)face->glyph->metrics.horiBearingX / 64.0;
+    font->metrics[glyphind].bearing_y = (double)face->glyph->metrics.horiBearingY / 64.0;
+    font->metrics[glyphind].advance_x = (double)face->glyph->metrics.horiAdvance / 64.0;
+    font->metrics[glyphind].bitmap_width = face->glyph->bitmap.width;
+    font->metrics[glyphind].bitmap_rows = face->glyph->bitmap.rows;
     font->metrics[glyphind].char_index = FT_Get_Char_Index(font->face, codepoint);
-    font->glyph_index[glyphind] = font->glyph_count;
     font->glyph_count++;
 
-    if (font->glyph_count > font->page_max_glyphs * font->texture_levels) {
-        // this glyph will spill over onto a new layer in the texture
+    FT_Bitmap bm = face->glyph->bitmap;
 
-        // create a new texture
-        GLuint newtex = 0;
-        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &newtex);
-        glTextureStorage3D(newtex, 1, GL_R8, GLYPH_TEX_SIZE, GLYPH_TEX_SIZE, font->texture_levels + 1);
+    int tex_x = 0;
+    int tex_y = 0;
+    int tex_layer = 0;
+    ui_font_atlas_place((int)bm.width, (int)bm.rows, &tex_x, &tex_y, &tex_layer);
 
-        // copy the existing layers over
-        glCopyImageSubData(
-            font->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,      // source
-            newtex       , GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,      // destination
-            GLYPH_TEX_SIZE, GLYPH_TEX_SIZE, font->texture_levels // w, h, d
-        );
-        
-        // delete the old one
-        glDeleteTextures(1, &font->texture);
-        font->texture = newtex;
-        font->texture_levels++;
-    }
+    font->metrics[glyphind].tex_x = tex_x;
+    font->metrics[glyphind].tex_y = tex_y;
+    font->metrics[glyphind].tex_layer = tex_layer;
 
-    font->texture_num[glyphind] = font->texture_levels - 1;
+    if (bm.width==0 || bm.rows==0) return;
 
-    FT_Bitmap bm = font->face->glyph->bitmap;
- 
     // fist we need to gamma correct it
     uint8_t *pixels = egoverlay_calloc(bm.rows * bm.width, sizeof(uint8_t));
     for (size_t gy=0;gy<bm.rows;gy++) {
@@ -404,14 +793,11 @@ static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint) {
         }
     }
 
-    // then copy the corrected bitmap into the texture
-    size_t tex_x = ((font->glyph_index[glyphind] % font->page_glyph_x) * font->size);
-    size_t tex_y = (((font->glyph_index[glyphind] % font->page_max_glyphs) / font->page_glyph_x) * font->size);
-
+    // then copy the corrected bitmap into the atlas
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTextureSubImage3D(
-        font->texture,
-        0, (GLint)tex_x, (GLint)tex_y, font->texture_num[glyphind],
+        fonts->atlas,
+        0, tex_x, tex_y, tex_layer,
         bm.width, bm.rows, 1,
         GL_RED, GL_UNSIGNED_BYTE, pixels
     );
@@ -419,21 +805,40 @@ static void ui_font_render_glyph(ui_font_t *font, uint32_t codepoint) {
     egoverlay_free(pixels);
 }
 
-void ui_font_render_text(
-    ui_font_t *font,
-    mat4f_t *proj,
-    int x,
-    int y,
-    const char *text,
-    size_t count,
-    ui_color_t color
-) {
-    size_t vbo_size = sizeof(ui_font_vbo_data_t) * count;
+// Draw the accumulated glyph batch, if any.
+void ui_font_flush() {
+    if (!fonts || fonts->batch_count==0) return;
 
-    if (vbo_size > fonts->vbo_data_size) {
-        fonts->vbodata = egoverlay_realloc(fonts->vbodata, vbo_size);
-        fonts->vbo_data_size = vbo_size;
-    }
+    size_t vbo_size = fonts->batch_count * sizeof(ui_font_vbo_data_t);
+
+    glBindBuffer(GL_ARRAY_BUFFER, fonts->vbo);
+    glBufferData(GL_ARRAY_BUFFER, vbo_size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vbo_size, fonts->vbodata);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    gl_shader_program_use(fonts->shader_program);
+    glBindVertexArray(fonts->vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, fonts->atlas);
+
+    glUniformMatrix4fv(0, 1, GL_FALSE, (const GLfloat*)&fonts->batch_proj); // projection
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)fonts->batch_count);
+    profiler_count_draw(1, (int)fonts->batch_count);
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glUseProgram(0);
+
+    fonts->batch_count = 0;
+}
+
+// Shape text into glyph quads starting at the given pen origin, writing at
+// most count entries to out. Returns the number of quads written; the final
+// pen x position is written to pen_end when given. Colors are left unset.
+size_t ui_font_shape(ui_font_t *font, const char *text, size_t count, float x, float y, ui_font_vbo_data_t *out, float *pen_end) {
+    ui_font_activate(font);
 
     FT_UInt glyph;
     FT_UInt prev_glyph = 0;
@@ -444,7 +849,7 @@ void ui_font_render_text(
     int glyph_bytes = 0;
     int bytes_remaining = 0;
 
-    float penx = (float)x;
+    float penx = x;
     size_t vbo_ind = 0;
     for (size_t c=0;c<count;c++) {
         // handle multi-byte UTF-8 characters
@@ -478,7 +883,7 @@ void ui_font_render_text(
 
         size_t char_ind = 0;
         if (!ui_font_get_codepoint_ind(font, codepoint, &char_ind)) {
-            ui_font_render_glyph(font, codepoint);
+            ui_font_render_glyph(font, codepoint, 0);
             c -= glyph_bytes;
             codepoint = 0;
             continue;
@@ -496,29 +901,46 @@ void ui_font_render_text(
         if (font->metrics[char_ind].bitmap_width == 0) {
             // this is an empty glyph, just move the pen position forward without rendering
             penx += (float)font->metrics[char_ind].advance_x;
-            vbo_size -= sizeof(ui_font_vbo_data_t);
+            prev_glyph = glyph;
+            glyph_bytes = 0;
             continue;
         }
         
-        size_t glyph_ind = font->glyph_index[char_ind];
+        // snap the quad to a whole pixel and pick the subpixel variant
+        // rasterized closest to the fractional pen position
+        float pos  = penx + (float)font->metrics[char_ind].bearing_x;
+        float left = floorf(pos);
+        int variant = (int)((pos - left) * UI_FONT_SUBPIXEL_VARIANTS + 0.5f);
+        if (variant==UI_FONT_SUBPIXEL_VARIANTS) {
+            variant = 0;
+            left += 1.f;
+        }
 
-        float left = penx + (float)font->metrics[char_ind].bearing_x;
-        float top  = y + (font->face->size->metrics.ascender / 64.f) - (float)font->metrics[char_ind].bearing_y;
-        
-        float tex_left = ((float)(glyph_ind % font->page_glyph_x) * font->size);
-        float tex_top  = ((float)((glyph_ind % font->page_max_glyphs)/ font->page_glyph_x) * font->size);
+        size_t var_ind = char_ind;
+        if (variant) {
+            if (!ui_font_get_codepoint_ind(font, GLYPH_KEY(codepoint, variant), &var_ind)) {
+                ui_font_render_glyph(font, codepoint, variant);
+                // fall back to variant 0 if rendering failed
+                if (!ui_font_get_codepoint_ind(font, GLYPH_KEY(codepoint, variant), &var_ind)) var_ind = char_ind;
+            }
+        }
 
-        fonts->vbodata[vbo_ind].left   = left;
-        fonts->vbodata[vbo_ind].top    = top;
-        fonts->vbodata[vbo_ind].right  = left + font->metrics[char_ind].bitmap_width;
-        fonts->vbodata[vbo_ind].bottom = top + font->metrics[char_ind].bitmap_rows;
+        float top  = y + font->ascender - (float)font->metrics[var_ind].bearing_y;
 
-        fonts->vbodata[vbo_ind].tex_left   = tex_left;
-        fonts->vbodata[vbo_ind].tex_top    = tex_top;
-        fonts->vbodata[vbo_ind].tex_right  = (tex_left + font->metrics[char_ind].bitmap_width);
-        fonts->vbodata[vbo_ind].tex_bottom = (tex_top + font->metrics[char_ind].bitmap_rows);
+        float tex_left = (float)font->metrics[var_ind].tex_x;
+        float tex_top  = (float)font->metrics[var_ind].tex_y;
 
-        fonts->vbodata[vbo_ind].tex_layer = (float)font->texture_num[char_ind];
+        out[vbo_ind].left   = left;
+        out[vbo_ind].top    = top;
+        out[vbo_ind].right  = left + font->metrics[var_ind].bitmap_width;
+        out[vbo_ind].bottom = top + font->metrics[var_ind].bitmap_rows;
+
+        out[vbo_ind].tex_left   = tex_left;
+        out[vbo_ind].tex_top    = tex_top;
+        out[vbo_ind].tex_right  = (tex_left + font->metrics[var_ind].bitmap_width);
+        out[vbo_ind].tex_bottom = (tex_top + font->metrics[var_ind].bitmap_rows);
+
+        out[vbo_ind].tex_layer = (float)font->metrics[var_ind].tex_layer;
         vbo_ind++;
 
         penx += (float)font->metrics[char_ind].advance_x;
@@ -526,67 +948,231 @@ void ui_font_render_text(
         glyph_bytes = 0;
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, fonts->vbo);
-    glBufferData(GL_ARRAY_BUFFER, vbo_size, NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vbo_size, fonts->vbodata);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (pen_end) *pen_end = penx;
 
-    gl_shader_program_use(fonts->shader_program);
-    glBindVertexArray(fonts->vao);
+    return vbo_ind;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, font->texture);        
+// Compute the pen x position before every byte of text in a single shaping
+// pass: out[i] is the width of the first i bytes (continuation bytes of a
+// multi byte character repeat the value at its start) and out[count] is the
+// total width. This is what editors need for O(1) caret math and O(log n)
+// click positioning instead of re-measuring prefixes.
+void ui_font_get_prefix_widths(ui_font_t *font, const char *text, size_t count, float *out) {
+    ui_font_activate(font);
+
+    FT_UInt glyph;
+    FT_UInt prev_glyph = 0;
 
-    glUniform4f(1, UI_COLOR_R(color), UI_COLOR_G(color), UI_COLOR_B(color), UI_COLOR_A(color)); // color
-    glUniformMatrix4fv(0, 1, GL_FALSE, (const GLfloat*)proj);                                   // projection
+    uint32_t codepoint = 0;
+    int glyph_bytes = 0;
+    int bytes_remaining = 0;
 
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+    float penx = 0.f;
+    size_t glyph_start = 0;
 
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
-    glUseProgram(0);
+    for (size_t c=0;c<count;c++) {
+        out[c] = penx;
+
+        if ((text[c] & 0x80)==0) {
+            codepoint = text[c];
+            bytes_remaining = 0;
+        } else if ((text[c] & 0xF0) == 0xF0) {
+            codepoint = (text[c] & 0x07) << 18;
+            bytes_remaining = 3;
+        } else if ((text[c] & 0xE0) == 0xE0) {
+            codepoint = (text[c] & 0x0F) << 12;
+            bytes_remaining = 2;
+        } else if ((text[c] & 0xC0) == 0xC0) {
+            codepoint = (text[c] & 0x1F) << 6;
+            bytes_remaining = 1;
+        } else if ((text[c] & 0x80) == 0x80) {
+            int shift_bits = 6 * (bytes_remaining - 1);
+            codepoint |= (text[c] & 0x3F) << shift_bits;
+            bytes_remaining--;
+        }
+        glyph_bytes++;
+        if (bytes_remaining) continue;
+
+        size_t char_ind = 0;
+        if (!ui_font_get_codepoint_ind(font, codepoint, &char_ind)) {
+            ui_font_render_glyph(font, codepoint, 0);
+            c -= glyph_bytes;
+            glyph_bytes = 0;
+            codepoint = 0;
+            continue;
+        }
+
+        glyph = font->metrics[char_ind].char_index;
+
+        if (glyph_start>0 && FT_HAS_KERNING(font->face)) {
+            FT_Vector delta;
+            FT_Get_Kerning(font->face, prev_glyph, glyph, FT_KERNING_DEFAULT, &delta);
+            penx += delta.x / 64;
+        }
+
+        penx += (float)font->metrics[char_ind].advance_x;
+        prev_glyph = glyph;
+        glyph_bytes = 0;
+        glyph_start = c + 1;
+    }
+
+    out[count] = penx;
 }
 
-ui_font_t *ui_font_get(const char *path, int size, int weight, int slant, int width) {
-    if (fonts->cache_size == CACHE_MAX_SIZE) {
-        logger_error(fonts->log, "Reached maximum cached fonts.");
-        error_and_exit("EG-Overlay: UI-Font", "Reached maximum cached fonts.");
+// Make room for count more glyphs in the batch and point the batch at proj,
+// flushing first if the projection changed.
+static ui_font_vbo_data_t *ui_font_batch_reserve(mat4f_t *proj, size_t count) {
+    if (fonts->batch_count && memcmp(&fonts->batch_proj, proj, sizeof(mat4f_t))!=0) ui_font_flush();
+    fonts->batch_proj = *proj;
+
+    if (fonts->batch_count + count > fonts->vbo_data_size) {
+        while (fonts->vbo_data_size < fonts->batch_count + count) fonts->vbo_data_size *= 2;
+        fonts->vbodata = egoverlay_realloc(fonts->vbodata, fonts->vbo_data_size * sizeof(ui_font_vbo_data_t));
     }
 
-    char buf[1024] = {0};
-    sprintf_s(buf, 1024, "%s%d%d%d%d", path, size, weight, slant, width);
-    uint32_t hash = djb2_hash_string(buf);
-    size_t key_ind = hash % CACHE_MAX_SIZE;
+    return fonts->vbodata + fonts->batch_count;
+}
 
-    size_t n = fonts->cache_size;   
-    
-    while (n--) {
-        if (fonts->cache_keys[key_ind]==hash) return fonts->cache_fonts[key_ind];
-        key_ind++;
-        if (key_ind==hash % CACHE_MAX_SIZE) break;
-        if (key_ind>= CACHE_MAX_SIZE) key_ind = 0;
-    }
-
-    logger_debug(fonts->log, "Didn't find %s, creating.", buf);
-    ui_font_t *f = ui_font_new(path, size, weight, slant, width);
-
-    key_ind = hash % CACHE_MAX_SIZE;
-    while (fonts->cache_keys[key_ind]!=hash){
-        if (fonts->cache_keys[key_ind]) {
-            key_ind++;
-            if (key_ind>=CACHE_MAX_SIZE) key_ind = 0;
-        } else {
-            fonts->cache_keys[key_ind] = hash;
-            fonts->cache_fonts[key_ind] = f;
+// Append pre-shaped quads (relative to the pen origin) to the batch at the
+// given position and color.
+static void ui_font_batch_quads(
+    const ui_font_vbo_data_t *quads,
+    size_t count,
+    mat4f_t *proj,
+    int x,
+    int y,
+    ui_color_t color
+) {
+    if (count==0) return;
+
+    ui_font_vbo_data_t *dest = ui_font_batch_reserve(proj, count);
+
+    for (size_t g=0;g<count;g++) {
+        dest[g] = quads[g];
+        dest[g].left   += x;
+        dest[g].right  += x;
+        dest[g].top    += y;
+        dest[g].bottom += y;
+
+        dest[g].r = UI_COLOR_R(color);
+        dest[g].g = UI_COLOR_G(color);
+        dest[g].b = UI_COLOR_B(color);
+        dest[g].a = UI_COLOR_A(color);
+    }
+
+    fonts->batch_count += count;
+}
+
+void ui_font_render_text(
+    ui_font_t *font,
+    mat4f_t *proj,
+    int x,
+    int y,
+    const char *text,
+    size_t count,
+    ui_color_t color
+) {
+    if (count==0) return;
+
+    uint32_t hash = djb2_hash_data((const uint8_t*)text, count);
+    ui_font_shaped_run_t *run = &run_cache[hash % RUN_CACHE_SIZE];
+
+    if (run->text==NULL ||
+        run->hash!=hash ||
+        run->font!=font ||
+        run->len!=count ||
+        memcmp(run->text, text, count)!=0
+    ) {
+        // miss; shape the run and replace whatever occupied the slot
+        if (run->text) {
+            egoverlay_free(run->text);
+            egoverlay_free(run->glyphs);
         }
+
+        run->hash = hash;
+        run->font = font;
+        run->len = count;
+        run->text = egoverlay_malloc(count);
+        memcpy(run->text, text, count);
+
+        run->glyphs = egoverlay_calloc(count, sizeof(ui_font_vbo_data_t));
+        run->glyph_count = ui_font_shape(font, text, count, 0.f, 0.f, run->glyphs, NULL);
+    }
+
+    ui_font_batch_quads(run->glyphs, run->glyph_count, proj, x, y, color);
+}
+
+// A cached text layout: the shaped glyph quads for a string, relative to the
+// pen origin. Widgets that display the same string every frame build the
+// layout once and replay it, skipping the per frame UTF-8 decode, glyph
+// lookups, and kerning.
+struct ui_font_layout_t {
+    size_t glyph_count;
+    ui_font_vbo_data_t *glyphs;
+    uint32_t width;
+};
+
+ui_font_layout_t *ui_font_layout_new(ui_font_t *font, const char *text, size_t count) {
+    ui_font_layout_t *layout = egoverlay_calloc(1, sizeof(ui_font_layout_t));
+
+    if (count) {
+        layout->glyphs = egoverlay_calloc(count, sizeof(ui_font_vbo_data_t));
+
+        float pen_end = 0.f;
+        layout->glyph_count = ui_font_shape(font, text, count, 0.f, 0.f, layout->glyphs, &pen_end);
+        layout->width = (uint32_t)pen_end;
     }
 
-    fonts->cache_size++;
+    return layout;
+}
+
+void ui_font_layout_free(ui_font_layout_t *layout) {
+    if (layout->glyphs) egoverlay_free(layout->glyphs);
+    egoverlay_free(layout);
+}
 
-    return f;
+uint32_t ui_font_layout_width(ui_font_layout_t *layout) {
+    return layout->width;
+}
+
+void ui_font_layout_draw(ui_font_layout_t *layout, mat4f_t *proj, int x, int y, ui_color_t color) {
+    ui_font_batch_quads(layout->glyphs, layout->glyph_count, proj, x, y, color);
+}
+
+ui_font_t *ui_font_get(const char *path, int size, int weight, int slant, int width) {
+    ui_font_t **f = &fonts->font_list;
+
+    while (*f) {
+        ui_font_t *font = *f;
+        if (font->size==size && font->weight==weight && font->slant==slant &&
+            font->width==width && strcmp(font->path, path)==0
+        ) {
+            // move to the front of the list so the fonts in use every frame
+            // are found first
+            *f = font->cache_next;
+            font->cache_next = fonts->font_list;
+            fonts->font_list = font;
+
+            return font;
+        }
+        f = &font->cache_next;
+    }
+
+    logger_debug(fonts->log, "Didn't find %s size %d (%d/%d/%d), creating.", path, size, weight, slant, width);
+    ui_font_t *font = ui_font_new(path, size, weight, slant, width);
+
+    if (font) {
+        font->cache_next = fonts->font_list;
+        fonts->font_list = font;
+    }
+
+    return font;
 }
 
 uint32_t ui_font_get_text_width(ui_font_t *font, const char *text, int count) {
+    ui_font_activate(font);
+
     FT_UInt glyph;
     FT_UInt prev_glyph = 0;
 
@@ -633,7 +1219,7 @@ uint32_t ui_font_get_text_width(ui_font_t *font, const char *text, int count) {
 
         size_t char_ind = 0;
         if (!ui_font_get_codepoint_ind(font, codepoint, &char_ind)) {
-            ui_font_render_glyph(font, codepoint);
+            ui_font_render_glyph(font, codepoint, 0);
             c -= glyph_bytes;
             codepoint = 0;
             continue;
@@ -656,6 +1242,8 @@ uint32_t ui_font_get_text_width(ui_font_t *font, const char *text, int count) {
 }
 
 uint32_t ui_font_get_index_of_width(ui_font_t *font, const char *text, int width) {
+    ui_font_activate(font);
+
     FT_UInt glyph;
     FT_UInt prev_glyph = 0;
 
@@ -701,7 +1289,7 @@ uint32_t ui_font_get_index_of_width(ui_font_t *font, const char *text, int width
 
         size_t char_ind = 0;
         if (!ui_font_get_codepoint_ind(font, codepoint, &char_ind)) {
-            ui_font_render_glyph(font, codepoint);
+            ui_font_render_glyph(font, codepoint, 0);
             c -= glyph_bytes;
             codepoint = 0;
             continue;
@@ -724,16 +1312,18 @@ uint32_t ui_font_get_index_of_width(ui_font_t *font, const char *text, int width
     return c;
 }
 
-uint32_t ui_font_get_text_height(ui_font_t *font) {
-    //int asc = FT_MulFix(font->face->ascender, font->face->size->metrics.y_scale);
-    //int desc = FT_MulFix(font->face->descender, font->face->size->metrics.y_scale);
+// a weight variant of an existing font instance; same file and size. used
+// by text markup for bold spans
+ui_font_t *ui_font_variant(ui_font_t *font, int weight) {
+    return ui_font_get(font->path, font->size, weight, INT_MIN, INT_MIN);
+}
 
-    //return (asc - desc) / 64;
-    return (font->face->size->metrics.ascender - font->face->size->metrics.descender)  / 64;
+uint32_t ui_font_get_text_height(ui_font_t *font) {
+    return font->height;
 }
 
 uint32_t ui_font_get_line_spacing(ui_font_t *font) {
-    return font->face->size->metrics.height / 64;
+    return font->line_spacing;
 }
 
 
@@ -4,11 +4,17 @@
 
 typedef struct ui_font_t ui_font_t;
 typedef struct ui_font_vbo_data_t ui_font_vbo_data_t;
+typedef struct ui_font_layout_t ui_font_layout_t;
 
 void ui_font_init();
 void ui_font_cleanup();
 
+// start background rasterization of the preload glyph set for the default
+// UI font; call during parallel init, before ui_font_init
+void ui_font_prewarm(const char *path, int size);
+
 ui_font_t *ui_font_get(const char *path, int size, int weight, int slant, int width);
+ui_font_t *ui_font_variant(ui_font_t *font, int weight);
 
 void ui_font_render_text(
     ui_font_t *font,
@@ -20,10 +26,24 @@ void ui_font_render_text(
     ui_color_t color
 );
 
+// cached shaped text. build once for static strings, then draw each frame
+ui_font_layout_t *ui_font_layout_new(ui_font_t *font, const char *text, size_t count);
+void ui_font_layout_free(ui_font_layout_t *layout);
+uint32_t ui_font_layout_width(ui_font_layout_t *layout);
+void ui_font_layout_draw(ui_font_layout_t *layout, mat4f_t *proj, int x, int y, ui_color_t color);
+
+// draw any batched text. text rendered by ui_font_render_text is
+// accumulated and drawn in bulk; this runs automatically when the scissor
+// or viewport changes and at the end of the UI pass
+void ui_font_flush();
+
 uint32_t ui_font_get_text_width(ui_font_t *font, const char *text, int count);
 uint32_t ui_font_get_text_height(ui_font_t *font);
 uint32_t ui_font_get_line_spacing(ui_font_t *font);
 
 uint32_t ui_font_get_index_of_width(ui_font_t *font, const char *text, int width);
 
+// pen positions before every byte in one pass; out needs count+1 entries
+void ui_font_get_prefix_widths(ui_font_t *font, const char *text, size_t count, float *out);
+
 //int ui_font_get_text_wrap_indices(ui_font_t *font, const char *text, int width, int **wrap_indices);
@@ -13,11 +13,18 @@ typedef struct ui_grid_cell_t {
 
     int halign;
     int valign;
+
+    // last measured preferred size, for incremental column/row sizing;
+    // -1 forces a change on the next pass
+    int last_w;
+    int last_h;
 } ui_grid_cell_t;
 
 struct ui_grid_t {
     ui_element_t element;
 
+    int sized_once;
+
     int rows;
     int cols;
 
@@ -27,6 +34,13 @@ struct ui_grid_t {
     int *colwidths;
     int *rowheights;
 
+    // preferred size cache, valid for a single layout pass. the row/column
+    // sizing arrays and cell item sizes set while computing it stay valid
+    // for the rest of the pass too
+    uint64_t layout_gen;
+    int pref_width;
+    int pref_height;
+
     ui_grid_cell_t *cells;
 };
 
@@ -37,7 +51,7 @@ void ui_grid_draw(ui_grid_t *grid, int offset_x, int offset_y, mat4f_t *proj);
 void ui_grid_free(ui_grid_t *grid);
 
 ui_grid_t *ui_grid_new(int rows, int cols) {
-    ui_grid_t *grid = egoverlay_calloc(1, sizeof(ui_grid_t));
+    ui_grid_t *grid = ui_element_alloc(sizeof(ui_grid_t));
 
     grid->cells = egoverlay_calloc(rows * cols, sizeof(ui_grid_cell_t));
 
@@ -68,7 +82,7 @@ void ui_grid_free(ui_grid_t *grid) {
     egoverlay_free(grid->rowheights);
     egoverlay_free(grid->colspacing);
     egoverlay_free(grid->colwidths);
-    egoverlay_free(grid);
+    ui_element_pool_free(grid, sizeof(ui_grid_t));
 }
 
 void ui_grid_attach(
@@ -87,6 +101,10 @@ void ui_grid_attach(
     cell->item = uielement;
     cell->rowspan = rowspan;
     cell->colspan = colspan;
+
+    // structural change: restart the incremental sizing state so a column
+    // whose widest cell was replaced can shrink
+    grid->sized_once = 0;
     cell->halign = horizalign;
     cell->valign = vertalign;
     ui_element_ref(cell->item);
@@ -94,18 +112,40 @@ void ui_grid_attach(
 
 void ui_grid_rowspacing(ui_grid_t *grid, int row, int spacing) {
     grid->rowspacing[row] = spacing;
+    grid->sized_once = 0; // spacing feeds the cached preferred size
 }
 
 void ui_grid_colspacing(ui_grid_t *grid, int col, int spacing) {
     grid->colspacing[col] = spacing;
+    grid->sized_once = 0;
 }
 
 int ui_grid_get_preferred_size(ui_grid_t *grid, int *width, int *height) {
-    int pheight = 0;
-    int pwidth = 0;
+    if (grid->layout_gen==ui_layout_generation()) {
+        *width = grid->pref_width;
+        *height = grid->pref_height;
+        return 1;
+    }
 
-    memset(grid->rowheights, 0, sizeof(int) * grid->rows);
-    memset(grid->colwidths, 0, sizeof(int) * grid->cols);
+    // incremental sizing: column widths and row heights are maintained from
+    // each cell's cached measurement. a changed cell only touches its own
+    // column/row — growing is a max update, shrinking recomputes just that
+    // column or row from the cached values (no re-measurement) — so a
+    // one-cell text update in a data table no longer re-derives the whole
+    // grid
+    int changed = !grid->sized_once;
+
+    if (!grid->sized_once) {
+        memset(grid->rowheights, 0, sizeof(int) * grid->rows);
+        memset(grid->colwidths, 0, sizeof(int) * grid->cols);
+
+        // a full invalidation restarts the incremental state; every cell
+        // has to re-report
+        for (int i=0;i<grid->rows * grid->cols;i++) {
+            grid->cells[i].last_w = -1;
+            grid->cells[i].last_h = -1;
+        }
+    }
 
     for (int r=0;r<grid->rows;r++) {
         for (int c=0;c<grid->cols;c++) {
@@ -115,18 +155,68 @@ int ui_grid_get_preferred_size(ui_grid_t *grid, int *width, int *height) {
             int cw = 0;
             int ch = 0;
             if (cell->item->get_preferred_size && cell->item->get_preferred_size(cell->item, &cw, &ch)) {
-                if (grid->colwidths[c] < cw && cell->colspan==1) grid->colwidths[c] = cw;
-                if (grid->rowheights[r] < ch && cell->rowspan==1) grid->rowheights[r] = ch;
+                if (cw==cell->last_w && ch==cell->last_h) continue;
+
+                changed = 1;
+
+                if (cell->colspan==1) {
+                    if (cw >= grid->colwidths[c]) {
+                        grid->colwidths[c] = cw;
+                    } else if (cell->last_w==grid->colwidths[c]) {
+                        // the shrinking cell may have been the column max;
+                        // re-derive this column from the cached sizes
+                        int max = 0;
+                        for (int rr=0;rr<grid->rows;rr++) {
+                            ui_grid_cell_t *other = &GRID_CELL(grid, rr, c);
+                            int w = (other==cell) ? cw : other->last_w;
+                            if (other->item && other->colspan==1 && w > max) max = w;
+                        }
+                        grid->colwidths[c] = max;
+                    }
+                }
+
+                if (cell->rowspan==1) {
+                    if (ch >= grid->rowheights[r]) {
+                        grid->rowheights[r] = ch;
+                    } else if (cell->last_h==grid->rowheights[r]) {
+                        int max = 0;
+                        for (int cc=0;cc<grid->cols;cc++) {
+                            ui_grid_cell_t *other = &GRID_CELL(grid, r, cc);
+                            int h = (other==cell) ? ch : other->last_h;
+                            if (other->item && other->rowspan==1 && h > max) max = h;
+                        }
+                        grid->rowheights[r] = max;
+                    }
+                }
+
+                cell->last_w = cw;
+                cell->last_h = ch;
                 ui_element_set_size(cell->item, cw, ch);
             }
         }
-        pheight += grid->rowheights[r] + grid->rowspacing[r];
     }
 
+    if (!changed) {
+        // nothing moved; the cached preferred size and the fill sizes set
+        // on a previous pass are still correct
+        *width = grid->pref_width;
+        *height = grid->pref_height;
+        grid->layout_gen = ui_layout_generation();
+        return 1;
+    }
+
+    int pheight = 0;
+    int pwidth = 0;
+
+    for (int r=0;r<grid->rows;r++) {
+        pheight += grid->rowheights[r] + grid->rowspacing[r];
+    }
     for (int c=0;c<grid->cols;c++) {
         pwidth += grid->colwidths[c] + grid->colspacing[c];
     }
 
+    grid->sized_once = 1;
+
     // cell items were set to their preferred sizes above, but any that had
     // 'fill' alignments need to be fixed up now
     for (int r=0;r<grid->rows;r++) {
@@ -154,6 +244,10 @@ int ui_grid_get_preferred_size(ui_grid_t *grid, int *width, int *height) {
     *width = pwidth;
     *height = pheight;
 
+    grid->layout_gen = ui_layout_generation();
+    grid->pref_width = pwidth;
+    grid->pref_height = pheight;
+
     return 1;
 }
 
@@ -203,7 +297,14 @@ void ui_grid_draw(ui_grid_t *grid, int offset_x, int offset_y, mat4f_t *proj) {
                 } else if (cell->valign==1) {
                     extra_y += grid->rowheights[r] - cell->item->height;
                 }
-                ui_element_draw(cell->item, cx + extra_x, cy + extra_y, proj);                
+                if (!ui_rect_culled(
+                        cx + extra_x + cell->item->x,
+                        cy + extra_y + cell->item->y,
+                        cell->item->width,
+                        cell->item->height
+                )) {
+                    ui_element_draw(cell->item, cx + extra_x, cy + extra_y, proj);
+                }
             }
             cx += grid->colwidths[c] + grid->colspacing[c];
         }
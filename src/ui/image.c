@@ -1,10 +1,14 @@
+#include <math.h>
 #include <stb_image.h>
 #include <lauxlib.h>
 #include <string.h>
 #include "image.h"
+#include "rect.h"
+#include "font.h"
 #include "../logging/logger.h"
 #include "../utils.h"
 #include "../gl.h"
+#include "../profiler.h"
 
 struct ui_image_t {
     int tex_size;
@@ -15,8 +19,26 @@ struct ui_image_t {
     float tex_max_v;
 
     GLuint texture;
+
+    struct ui_image_texture_cache_t *cache_entry; // shared texture, or NULL
 };
 
+// Shared texture cache: image widgets displaying the same source (by
+// content hash of the file) share one mipmapped texture instead of each
+// uploading their own full resolution copy.
+typedef struct ui_image_texture_cache_t {
+    uint32_t hash;
+    size_t data_len; // guards against hash collisions between different files
+    GLuint texture;
+    int tex_size;
+    int img_width;
+    int img_height;
+    int refs;
+    struct ui_image_texture_cache_t *next;
+} ui_image_texture_cache_t;
+
+static ui_image_texture_cache_t *texture_cache = NULL;
+
 static logger_t *logger = NULL;
 
 static gl_shader_program_t *shader_program = NULL;
@@ -45,11 +67,40 @@ void ui_image_cleanup() {
 ui_image_t *ui_image_new_from_file(const char *path) {
     logger_debug(logger, "Loading image from %s", path);
 
-    ui_image_t *img = egoverlay_calloc(1, sizeof(ui_image_t));
+    ui_image_t *img = ui_element_alloc(sizeof(ui_image_t));
 
-    int n;
+    size_t filelen = 0;
+    char *filedata = load_file(path, &filelen);
+
+    if (filedata==NULL) {
+        logger_error(logger, "Couldn't load image from %s", path);
+        abort();
+    }
 
-    uint8_t *pixels = stbi_load(path, &img->img_width, &img->img_height, &n, 4);
+    // widgets showing the same file share the texture
+    uint32_t hash = djb2_hash_data((const uint8_t*)filedata, filelen);
+
+    for (ui_image_texture_cache_t *c=texture_cache;c;c=c->next) {
+        if (c->hash==hash && c->data_len==filelen) {
+            c->refs++;
+
+            img->cache_entry = c;
+            img->texture = c->texture;
+            img->tex_size = c->tex_size;
+            img->img_width = c->img_width;
+            img->img_height = c->img_height;
+            img->tex_max_u = (float)c->img_width / (float)c->tex_size;
+            img->tex_max_v = (float)c->img_height / (float)c->tex_size;
+
+            egoverlay_free(filedata);
+
+            return img;
+        }
+    }
+
+    int n;
+    uint8_t *pixels = stbi_load_from_memory((const uint8_t*)filedata, (int)filelen, &img->img_width, &img->img_height, &n, 4);
+    egoverlay_free(filedata);
 
     if (pixels==NULL) {
         logger_error(logger, "Couldn't load image from %s", path);
@@ -76,31 +127,68 @@ ui_image_t *ui_image_new_from_file(const char *path) {
         memcpy(tex_pixels + tex_row_offset, pixels + img_row_offset, img->img_width * 4);
     }
 
+    // full mip chain so icons drawn far below native size sample an
+    // appropriately sized level instead of shimmering
+    GLsizei mipmaplevels = 1 + (GLsizei)floorf(log2f((float)texsize));
+
     glGenTextures(1, &img->texture);
     glBindTexture(GL_TEXTURE_2D, img->texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texsize, texsize, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_pixels);
+    glTexStorage2D(GL_TEXTURE_2D, mipmaplevels, GL_RGBA8, texsize, texsize);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texsize, texsize, GL_RGBA, GL_UNSIGNED_BYTE, tex_pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
     egoverlay_free(tex_pixels);
     stbi_image_free(pixels);
 
+    ui_image_texture_cache_t *entry = egoverlay_calloc(1, sizeof(ui_image_texture_cache_t));
+    entry->hash = hash;
+    entry->data_len = filelen;
+    entry->texture = img->texture;
+    entry->tex_size = img->tex_size;
+    entry->img_width = img->img_width;
+    entry->img_height = img->img_height;
+    entry->refs = 1;
+    entry->next = texture_cache;
+    texture_cache = entry;
+
+    img->cache_entry = entry;
+
     return img;
 }
 
 void ui_image_free(ui_image_t *image) {
+    if (image->cache_entry) {
+        image->cache_entry->refs--;
+
+        if (image->cache_entry->refs==0) {
+            ui_image_texture_cache_t **c = &texture_cache;
+            while (*c && *c!=image->cache_entry) c = &(*c)->next;
+            if (*c) *c = image->cache_entry->next;
+
+            glDeleteTextures(1, &image->cache_entry->texture);
+            egoverlay_free(image->cache_entry);
+        }
+    } else {
+        glDeleteTextures(1, &image->texture);
+    }
 
-    glDeleteTextures(1, &image->texture);
-    egoverlay_free(image);
+    ui_element_pool_free(image, sizeof(ui_image_t));
 }
 
 void ui_image_draw(ui_image_t *image, mat4f_t *proj, int x, int y, int width, int height, float saturation_f, float value_f) {
+    // images draw immediately; anything batched before this point has to be
+    // drawn first so the image lands on top of it
+    ui_rect_flush();
+    ui_font_flush();
+
     gl_shader_program_use(shader_program);
     glBindVertexArray(vao);
 
@@ -118,6 +206,7 @@ void ui_image_draw(ui_image_t *image, mat4f_t *proj, int x, int y, int width, in
     glBindTexture(GL_TEXTURE_2D, image->texture);        
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    profiler_count_draw(1, 1);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
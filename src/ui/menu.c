@@ -27,6 +27,11 @@ struct ui_menu_item_t {
 
     ui_menu_t *sub_menu;
 
+    // lazy submenus: a Lua builder invoked on first open instead of
+    // constructing whole submenu trees up front
+    int submenu_builder_cbi;
+    int submenu_building;
+
     ui_menu_t *parent_menu;
 
     ui_element_t *child;
@@ -44,6 +49,15 @@ struct ui_menu_t {
     ui_color_t border_color;
 };
 
+// carries a lazy submenu build request through the event callback queue;
+// built in the draw path, consumed by ui_menu_item_run_submenu_builder
+struct submenu_builder_data {
+    ui_menu_item_t *item;
+    int cbi;
+};
+
+static int ui_menu_item_run_submenu_builder(lua_State *L, struct submenu_builder_data *data);
+
 void ui_menu_free(ui_menu_t *menu);
 
 void ui_menu_item_draw(ui_menu_item_t *item, int offset_x, int offset_y, mat4f_t *proj);
@@ -54,7 +68,7 @@ int ui_menu_item_process_mouse_event(ui_menu_item_t *item, ui_mouse_event_t *eve
 int ui_menu_process_mouse_event(ui_menu_t *menu, ui_mouse_event_t *event, int offset_x, int offset_y);
 
 ui_menu_item_t *ui_menu_item_new() {
-    ui_menu_item_t *mi = egoverlay_calloc(1, sizeof(ui_menu_item_t));
+    ui_menu_item_t *mi = ui_element_alloc(sizeof(ui_menu_item_t));
     mi->element.draw                = &ui_menu_item_draw;
     mi->element.process_mouse_event = &ui_menu_item_process_mouse_event;
     mi->element.get_preferred_size  = &ui_menu_item_get_preferred_size;
@@ -120,7 +134,8 @@ void ui_menu_item_free(ui_menu_item_t *item) {
     if (item->child) ui_element_unref(item->child);
     if (item->pre) ui_element_unref(item->pre);
     if (item->sub_menu) ui_element_unref(item->sub_menu);
-    egoverlay_free(item);
+    if (item->submenu_builder_cbi) lua_manager_unref(item->submenu_builder_cbi);
+    ui_element_pool_free(item, sizeof(ui_menu_item_t));
 }
 
 int ui_menu_item_process_mouse_event(ui_menu_item_t *item, ui_mouse_event_t *event, int offset_x, int offset_y) {
@@ -129,6 +144,19 @@ int ui_menu_item_process_mouse_event(ui_menu_item_t *item, ui_mouse_event_t *eve
     if (event->event==UI_MOUSE_EVENT_TYPE_ENTER) {
         item->draw_bg = 1;
 
+        if (!item->sub_menu && item->submenu_builder_cbi && !item->submenu_building) {
+            // build it on first open; the submenu appears once the builder
+            // runs on the next event pump
+            item->submenu_building = 1;
+            ui_element_ref(item);
+
+            struct submenu_builder_data *data = egoverlay_calloc(1, sizeof(struct submenu_builder_data));
+            data->item = item;
+            data->cbi = item->submenu_builder_cbi;
+
+            lua_manager_add_event_callback((lua_manager_event_callback*)&ui_menu_item_run_submenu_builder, data);
+        }
+
         if (item->sub_menu) {
             item->sub_menu->element.x = offset_x + item->element.x + item->element.width - 10;
             item->sub_menu->element.y = offset_y + item->element.y;
@@ -217,7 +245,7 @@ void ui_menu_draw(ui_menu_t *menu, int offset_x, int offset_y, mat4f_t *proj) {
 }
 
 ui_menu_t *ui_menu_new() {
-    ui_menu_t *menu = egoverlay_calloc(1, sizeof(ui_menu_t));
+    ui_menu_t *menu = ui_element_alloc(sizeof(ui_menu_t));
     menu->element.draw = &ui_menu_draw;
     menu->element.process_mouse_event = &ui_menu_process_mouse_event;
     menu->element.free = &ui_menu_free;
@@ -245,7 +273,7 @@ ui_menu_t *ui_menu_new() {
 void ui_menu_free(ui_menu_t *menu) {
     ui_element_unref(menu->box);
 
-    egoverlay_free(menu);
+    ui_element_pool_free(menu, sizeof(ui_menu_t));
 }
 
 int ui_menu_process_mouse_event(ui_menu_t *menu, ui_mouse_event_t *event, int offset_x, int offset_y) {   
@@ -302,6 +330,32 @@ void ui_menu_add_item(ui_menu_t *menu, ui_menu_item_t *item) {
     ui_box_pack_end(menu->box, (ui_element_t*)item, 0, -999);
 }
 
+static int ui_menu_item_run_submenu_builder(lua_State *L, struct submenu_builder_data *data) {
+    ui_menu_item_t *item = data->item;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->cbi);
+
+    if (lua_pcall(L, 0, 1, 0)!=LUA_OK) {
+        logger_t *log = logger_get("ui-menu");
+        logger_error(log, "Error building submenu: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    } else if (!lua_isnil(L, -1)) {
+        ui_menu_t *menu = lua_checkuimenu(L, -1);
+
+        item->sub_menu = menu;
+        ui_element_ref(menu); // item free unrefs
+
+        ui_damage();
+    }
+
+    item->submenu_building = 0;
+    ui_element_unref(item);
+
+    egoverlay_free(data);
+
+    return 0;
+}
+
 void ui_menu_item_set_sub_menu(ui_menu_item_t *item, ui_menu_t *menu) {
     item->sub_menu = menu;
 }
@@ -344,6 +398,7 @@ int ui_menu_item_lua_set_child(lua_State *L);
 int ui_menu_item_lua_enabled(lua_State *L);
 int ui_menu_item_lua_set_pre(lua_State *L);
 int ui_menu_item_lua_set_submenu(lua_State *L);
+int ui_menu_item_lua_submenu_builder(lua_State *L);
 
 void ui_menu_lua_register_ui_funcs(lua_State *L) {
     lua_pushcfunction(L, &ui_menu_lua_new);
@@ -390,6 +445,7 @@ luaL_Reg ui_menu_item_funcs[] = {
     "set_child"         , &ui_menu_item_lua_set_child,
     "set_pre"           , &ui_menu_item_lua_set_pre,
     "set_submenu"       , &ui_menu_item_lua_set_submenu,
+    "submenubuilder"    , &ui_menu_item_lua_submenu_builder,
     "enabled"           , &ui_menu_item_lua_enabled,
     "addeventhandler"   , &ui_element_lua_addeventhandler,
     "removeeventhandler", &ui_element_lua_removeeventhandler,
@@ -647,3 +703,28 @@ int ui_menu_item_lua_enabled(lua_State *L) {
 /*** RST
     .. include:: /docs/_include/ui_element_eventhandlers.rst
 */
+
+/*** RST
+    .. lua:method:: submenubuilder(builder)
+
+        Set a function that builds this item's submenu the first time it
+        opens, instead of constructing the whole tree up front. The builder
+        is called with no arguments and returns a :lua:class:`uimenu` (or
+        ``nil``).
+
+        :param function builder:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_menu_item_lua_submenu_builder(lua_State *L) {
+    ui_menu_item_t *item = lua_checkuimenuitem(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (item->submenu_builder_cbi) lua_manager_unref(item->submenu_builder_cbi);
+
+    lua_pushvalue(L, 2);
+    item->submenu_builder_cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return 0;
+}
@@ -4,11 +4,23 @@
 #include "rect.h"
 #include "../utils.h"
 #include "../lamath.h"
+#include "../profiler.h"
+#include <string.h>
 #include <lauxlib.h>
 
 static logger_t *logger = NULL;
 static gl_shader_program_t *shader_program = NULL;
 static GLuint vao = 0;
+static GLuint vbo = 0;
+
+// Rects are accumulated into a frame scoped batch and drawn instanced, the
+// same way text is. The batch flushes on projection, scissor, or viewport
+// changes and after each top level element; rects always flush before text
+// so labels stay on top of their backgrounds.
+static ui_rect_instance_t *batch = NULL;
+static size_t batch_capacity = 0;
+static size_t batch_count = 0;
+static mat4f_t batch_proj = {0};
 
 void ui_rect_init() {
     logger = logger_get("ui-rect");
@@ -21,6 +33,22 @@ void ui_rect_init() {
     gl_shader_program_link(shader_program);
 
     glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    VERT_ATTRIB_FLOAT(0, 1, ui_rect_instance_t, left  );
+    VERT_ATTRIB_FLOAT(1, 1, ui_rect_instance_t, top   );
+    VERT_ATTRIB_FLOAT(2, 1, ui_rect_instance_t, right );
+    VERT_ATTRIB_FLOAT(3, 1, ui_rect_instance_t, bottom);
+    VERT_ATTRIB_VEC4 (4, 1, ui_rect_instance_t, r     );
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    batch_capacity = 256;
+    batch = egoverlay_calloc(batch_capacity, sizeof(ui_rect_instance_t));
 }
 
 void ui_rect_cleanup() {
@@ -28,30 +56,83 @@ void ui_rect_cleanup() {
 
     gl_shader_program_free(shader_program);
 
+    glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
-}
 
-void ui_rect_draw(int x, int y, int width, int height, ui_color_t color, mat4f_t *proj) {    
-    gl_shader_program_use(shader_program);
+    egoverlay_free(batch);
+    batch = NULL;
+}
 
-    float left = (float)x;
-    float top = (float)y;
-    float right = (float)x + width;
-    float bottom = (float)y + height;
+void ui_rect_flush() {
+    if (!batch || batch_count==0) return;
 
-    glUniform1f(0, left);
-    glUniform1f(1, top);
-    glUniform1f(2, right);
-    glUniform1f(3, bottom);
-    
-    glUniform4f(4, UI_COLOR_R(color), UI_COLOR_G(color), UI_COLOR_B(color), UI_COLOR_A(color));
-    glUniformMatrix4fv(5, 1, GL_FALSE, (const GLfloat*)proj);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, batch_count * sizeof(ui_rect_instance_t), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, batch_count * sizeof(ui_rect_instance_t), batch);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    gl_shader_program_use(shader_program);
     glBindVertexArray(vao);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glUniformMatrix4fv(5, 1, GL_FALSE, (const GLfloat*)&batch_proj);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)batch_count);
+    profiler_count_draw(1, (int)batch_count);
 
     glBindVertexArray(0);
+    glUseProgram(0);
+
+    batch_count = 0;
 }
 
+// Append pre-built instances (cached chrome geometry) in one memcpy.
+void ui_rect_draw_cached(const ui_rect_instance_t *rects, size_t count, mat4f_t *proj) {
+    if (count==0) return;
 
+    if (batch_count && memcmp(&batch_proj, proj, sizeof(mat4f_t))!=0) ui_rect_flush();
+    batch_proj = *proj;
+
+    while (batch_count + count > batch_capacity) {
+        batch_capacity *= 2;
+        batch = egoverlay_realloc(batch, batch_capacity * sizeof(ui_rect_instance_t));
+    }
+
+    memcpy(batch + batch_count, rects, count * sizeof(ui_rect_instance_t));
+    batch_count += count;
+}
+
+// Fill a single instance record; used to build cached geometry.
+void ui_rect_instance(ui_rect_instance_t *out, int x, int y, int width, int height, ui_color_t color) {
+    out->left   = (float)x;
+    out->top    = (float)y;
+    out->right  = (float)x + width;
+    out->bottom = (float)y + height;
+    out->r = UI_COLOR_R(color);
+    out->g = UI_COLOR_G(color);
+    out->b = UI_COLOR_B(color);
+    out->a = UI_COLOR_A(color);
+}
+
+void ui_rect_draw(int x, int y, int width, int height, ui_color_t color, mat4f_t *proj) {
+    if (batch_count && memcmp(&batch_proj, proj, sizeof(mat4f_t))!=0) ui_rect_flush();
+    batch_proj = *proj;
+
+    if (batch_count==batch_capacity) {
+        batch_capacity *= 2;
+        batch = egoverlay_realloc(batch, batch_capacity * sizeof(ui_rect_instance_t));
+    }
+
+    ui_rect_instance_t *r = batch + batch_count;
+
+    r->left   = (float)x;
+    r->top    = (float)y;
+    r->right  = (float)x + width;
+    r->bottom = (float)y + height;
+
+    r->r = UI_COLOR_R(color);
+    r->g = UI_COLOR_G(color);
+    r->b = UI_COLOR_B(color);
+    r->a = UI_COLOR_A(color);
+
+    batch_count++;
+}
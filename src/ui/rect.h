@@ -5,8 +5,30 @@
 
 typedef struct ui_rect_s ui_rect_t;
 
+// one instanced rect record, as uploaded to the batched pipeline. cached
+// chrome geometry is built from these and appended in bulk
+typedef struct {
+    float left;
+    float top;
+    float right;
+    float bottom;
+
+    float r;
+    float g;
+    float b;
+    float a;
+} ui_rect_instance_t;
+
 void ui_rect_init();
 void ui_rect_cleanup();
 
 void ui_rect_draw(int x, int y, int width, int height, ui_color_t color, mat4f_t *proj);
 
+// draw any batched rects. runs automatically when the scissor or viewport
+// changes and at the end of the UI pass, before batched text
+void ui_rect_flush();
+
+// bulk append pre-built instances, and a helper to build them
+void ui_rect_draw_cached(const ui_rect_instance_t *rects, size_t count, mat4f_t *proj);
+void ui_rect_instance(ui_rect_instance_t *out, int x, int y, int width, int height, ui_color_t color);
+
@@ -44,7 +44,7 @@ int ui_scroll_view_process_mouse_event(ui_scroll_view_t *scroll, ui_mouse_event_
 void ui_scroll_view_size_updated(ui_scroll_view_t *scroll);
 
 ui_scroll_view_t *ui_scroll_view_new() {
-    ui_scroll_view_t *scroll = egoverlay_calloc(1, sizeof(ui_scroll_view_t));
+    ui_scroll_view_t *scroll = ui_element_alloc(sizeof(ui_scroll_view_t));
     scroll->element.width = 100;
     scroll->element.height = 100;
     scroll->element.draw = &ui_scroll_view_draw;
@@ -61,7 +61,7 @@ ui_scroll_view_t *ui_scroll_view_new() {
 void ui_scroll_view_free(ui_scroll_view_t *scroll) {
     if (scroll->child) ui_element_unref(scroll->child);
 
-    egoverlay_free(scroll);
+    ui_element_pool_free(scroll, sizeof(ui_scroll_view_t));
 }
 
 void ui_scroll_view_set_child(ui_scroll_view_t *scroll, ui_element_t *child) {
@@ -108,7 +108,11 @@ void ui_scroll_view_draw(ui_scroll_view_t *scroll, int offset_x, int offset_y, m
             int cx = sx - scroll->disp_x;
             int cy = sy - scroll->disp_y;
 
+            // only the part of the child inside the view is visible; let
+            // layout containers skip everything else
+            ui_push_cull_rect(sx, sy, scroll->element.width, scroll->element.height);
             ui_element_draw(scroll->child, cx, cy, proj);
+            ui_pop_cull_rect();
 
             if (scroll->show_vertical_bar) {
                 ui_color_t border_color = 0;
@@ -23,7 +23,7 @@ void ui_separator_draw(ui_separator_t *sep, int offset_x, int offset_y, mat4f_t
 int ui_separator_get_preferred_size(ui_separator_t *sep, int *width, int *height);
 
 ui_separator_t *ui_separator_new(int orientation) {
-    ui_separator_t *sep = egoverlay_calloc(1, sizeof(ui_separator_t));
+    ui_separator_t *sep = ui_element_alloc(sizeof(ui_separator_t));
 
     sep->orientation = orientation;
     sep->thickness = 1;
@@ -39,7 +39,7 @@ ui_separator_t *ui_separator_new(int orientation) {
 }
 
 void ui_separator_free(ui_separator_t *sep) {
-    egoverlay_free(sep);
+    ui_element_pool_free(sep, sizeof(ui_separator_t));
 }
 
 void ui_separator_draw(ui_separator_t *sep, int offset_x, int offset_y, mat4f_t *proj) {
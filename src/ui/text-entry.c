@@ -18,6 +18,12 @@ struct ui_text_entry_t {
     ui_font_t *font;
 
     size_t text_len;
+
+    // cached pen positions: advances[i] is the width of the first i bytes.
+    // rebuilt lazily in one shaping pass after edits, so caret math is O(1)
+    // and click positioning is a binary search instead of re-measuring
+    float *advances;
+    int advances_valid;
     char *text;
 
     char *hint;
@@ -52,7 +58,7 @@ typedef struct {
 int ui_text_lua_keydown_event_run_callback(lua_State *L, keydown_event_data_t *data);
 
 ui_text_entry_t *ui_text_entry_new(ui_font_t *font) {
-    ui_text_entry_t *entry = egoverlay_calloc(1, sizeof(ui_text_entry_t));
+    ui_text_entry_t *entry = ui_element_alloc(sizeof(ui_text_entry_t));
 
     entry->element.draw = &ui_text_entry_draw;
     entry->element.get_preferred_size = &ui_text_entry_get_preferred_size;
@@ -62,6 +68,7 @@ ui_text_entry_t *ui_text_entry_new(ui_font_t *font) {
 
     entry->font = font;
     entry->text = egoverlay_calloc(MAX_TEXT_LEN + 1, sizeof(char));
+    entry->advances = egoverlay_calloc(MAX_TEXT_LEN + 1, sizeof(float));
 
     entry->pref_width = 50;
     entry->pref_height = ui_font_get_line_spacing(entry->font) + 4;
@@ -78,18 +85,24 @@ ui_text_entry_t *ui_text_entry_new(ui_font_t *font) {
 void ui_text_entry_free(ui_text_entry_t *entry) {
     if (entry->lua_cbi) lua_manager_unref(entry->lua_cbi);
     egoverlay_free(entry->text);
-    egoverlay_free(entry);
+    egoverlay_free(entry->advances);
+    ui_element_pool_free(entry, sizeof(ui_text_entry_t));
 }
 
 const char *ui_text_entry_get_text(ui_text_entry_t *entry) {
     return entry->text;
 }
 
+static float ui_text_entry_caret_x(ui_text_entry_t *entry, size_t pos);
+static size_t ui_text_entry_index_at(ui_text_entry_t *entry, float x);
+
 void ui_text_entry_set_text(ui_text_entry_t *entry, const char *text) {
     memset(entry->text, 0, MAX_TEXT_LEN);
     memcpy(entry->text, text, strlen(text));
+    entry->advances_valid = 0;
 
-    entry->pref_width = ui_font_get_text_width(entry->font, entry->text, (int)strlen(entry->text));
+    entry->text_len = strlen(entry->text);
+    entry->pref_width = (int)ui_text_entry_caret_x(entry, entry->text_len);
 }
 
 int ui_text_lua_keydown_event_run_callback(lua_State *L, keydown_event_data_t *data) {
@@ -181,8 +194,8 @@ int ui_text_entry_process_mouse_event(ui_text_entry_t *entry, ui_mouse_event_t *
             if (text_x < 0 || text_x > entry->element.width - 4) return 0;
             if (text_y < 0 || text_y > entry->element.height - 4) return 0;
 
-            entry->caret_pos = ui_font_get_index_of_width(entry->font, entry->text, text_x);
-            entry->caret_x = ui_font_get_text_width(entry->font, entry->text, entry->caret_pos);
+            entry->caret_pos = (int)ui_text_entry_index_at(entry, (float)text_x);
+            entry->caret_x = (int)ui_text_entry_caret_x(entry, entry->caret_pos);
 
             return 1;
         }
@@ -197,9 +210,68 @@ int ui_text_entry_process_mouse_event(ui_text_entry_t *entry, ui_mouse_event_t *
     return 1;
 }
 
+static void ui_text_entry_update_advances(ui_text_entry_t *entry) {
+    if (entry->advances_valid) return;
+
+    ui_font_get_prefix_widths(entry->font, entry->text, entry->text_len, entry->advances);
+    entry->advances_valid = 1;
+}
+
+// caret x from the cached advances, O(1)
+static float ui_text_entry_caret_x(ui_text_entry_t *entry, size_t pos) {
+    ui_text_entry_update_advances(entry);
+
+    if (pos > entry->text_len) pos = entry->text_len;
+
+    return entry->advances[pos];
+}
+
+// byte index whose pen position is nearest x, by binary search
+static size_t ui_text_entry_index_at(ui_text_entry_t *entry, float x) {
+    ui_text_entry_update_advances(entry);
+
+    size_t lo = 0;
+    size_t hi = entry->text_len;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (entry->advances[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
 void ui_text_entry_set_caret_pos(ui_text_entry_t *entry, int caret_pos) {
     entry->caret_pos = caret_pos;
-    entry->caret_x = ui_font_get_text_width(entry->font, entry->text, entry->caret_pos);
+    entry->caret_x = (int)ui_text_entry_caret_x(entry, caret_pos);
+}
+
+// delivery end of Ctrl+V: runs on the render thread once the clipboard worker
+// finishes. insertion is bounded to the space left in the buffer, and the
+// entry is pinned with an element ref while the read is in flight
+static void ui_text_entry_paste_clipboard(char *text, void *data) {
+    ui_text_entry_t *entry = (ui_text_entry_t*)data;
+
+    if (text) {
+        size_t ct_len = strlen(text);
+
+        if (entry->text_len + ct_len > MAX_TEXT_LEN) ct_len = MAX_TEXT_LEN - entry->text_len;
+
+        if (ct_len) {
+            memmove(entry->text + entry->caret_pos + ct_len, entry->text + entry->caret_pos,
+                    entry->text_len - entry->caret_pos);
+            memcpy(entry->text + entry->caret_pos, text, ct_len);
+            entry->text_len += ct_len;
+            entry->advances_valid = 0;
+            ui_text_entry_set_caret_pos(entry, entry->caret_pos + (int)ct_len);
+            ui_damage();
+        }
+
+        egoverlay_free(text);
+    }
+
+    ui_element_unref(entry);
 }
 
 int ui_text_entry_process_keyboard_event(ui_text_entry_t *entry, ui_keyboard_event_t *event) {
@@ -225,6 +297,7 @@ int ui_text_entry_process_keyboard_event(ui_text_entry_t *entry, ui_keyboard_eve
             memcpy(entry->text + entry->caret_pos - 1, entry->text + entry->caret_pos,
                    entry->text_len - entry->caret_pos + 1);
             entry->text_len--;
+            entry->advances_valid = 0;
             ui_text_entry_set_caret_pos(entry, entry->caret_pos - 1);
         }
         return 1;
@@ -235,6 +308,7 @@ int ui_text_entry_process_keyboard_event(ui_text_entry_t *entry, ui_keyboard_eve
             memcpy(entry->text + entry->caret_pos, entry->text + entry->caret_pos + 1,
                    entry->text_len - entry->caret_pos);
             entry->text_len--;
+            entry->advances_valid = 0;
         }
         return 1;
     }
@@ -278,25 +352,11 @@ int ui_text_entry_process_keyboard_event(ui_text_entry_t *entry, ui_keyboard_eve
     }
 
     if (event->ctrl && !event->alt && !event->shift && event->vk_key=='V') {
-        char *clipboard_text = app_getclipboard_text();
-        if (clipboard_text) {
-            size_t ct_len = strlen(clipboard_text);
-            if (entry->text_len + ct_len < MAX_TEXT_LEN) {
-                if (entry->caret_pos < entry->text_len) {
-                    char *text_right = egoverlay_calloc(entry->text_len - entry->caret_pos, sizeof(char));
-                    memcpy(text_right, entry->text + entry->caret_pos, entry->text_len - entry->caret_pos);
-
-                    memcpy(entry->text + entry->caret_pos + strlen(clipboard_text), text_right,
-                           entry->text_len - entry->caret_pos);
-                    egoverlay_free(text_right);
-                }
-            }
-
-            memcpy(entry->text + entry->caret_pos, clipboard_text, strlen(clipboard_text));
-            entry->text_len += strlen(clipboard_text);
-            ui_text_entry_set_caret_pos(entry, entry->caret_pos + (int)strlen(clipboard_text));
-        }
-        egoverlay_free(clipboard_text);
+        // the clipboard is read off-thread; the text arrives through
+        // ui_text_entry_paste_clipboard on the render thread next frame
+        ui_element_ref(entry);
+        app_getclipboard_text_async(&ui_text_entry_paste_clipboard, entry);
+        return 1;
     }
 
     if (!event->alt && !event->ctrl && event->ascii[0] && entry->text_len < MAX_TEXT_LEN) {
@@ -319,7 +379,8 @@ int ui_text_entry_process_keyboard_event(ui_text_entry_t *entry, ui_keyboard_eve
             entry->text_len++;
         }
 
-        entry->caret_x = ui_font_get_text_width(entry->font, entry->text, entry->caret_pos);
+        entry->advances_valid = 0;
+        entry->caret_x = (int)ui_text_entry_caret_x(entry, entry->caret_pos);
 
         keydown_event_data_t *kdevent = egoverlay_calloc(1, sizeof(keydown_event_data_t));
         kdevent->entry = entry;
@@ -486,10 +547,11 @@ int ui_text_entry_lua_text(lua_State *L) {
         const char *text = luaL_checkstring(L, 2);
         entry->text_len = strlen(text);
         memset(entry->text, 0, MAX_TEXT_LEN);
+        entry->advances_valid = 0;
         memcpy(entry->text, text, entry->text_len);
 
         entry->caret_pos = (int)entry->text_len;
-        entry->caret_x = ui_font_get_text_width(entry->font, entry->text, (int)strlen(entry->text));
+        entry->caret_x = (int)ui_text_entry_caret_x(entry, entry->text_len);
 
         return 0;
     }
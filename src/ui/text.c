@@ -3,8 +3,9 @@
 #include "ui.h"
 #include "../lamath.h"
 #include "../utils.h"
-#include <glad/gl.h>
+#include "../gl.h"
 #include <string.h>
+#include <stdlib.h>
 
 #include <lauxlib.h>
 
@@ -16,6 +17,15 @@ struct ui_text_s {
     ui_font_t *font;
     int lines;
 
+    // cached shaped layout per line, rebuilt when the text changes
+    ui_font_layout_t **line_layouts;
+
+    // markup mode: the text is compiled into styled runs instead (inline
+    // color and bold spans), each with its own cached layout
+    int markup;
+    struct ui_text_run_t *runs;
+    int run_count;
+
     ui_color_t color;
 
     int pref_width;
@@ -34,7 +44,7 @@ static int ui_text_get_preferred_size(ui_text_t *text, int *width, int *height);
 void ui_text_update_size(ui_text_t *text);
 
 ui_text_t *ui_text_new(const char *text, ui_color_t color, ui_font_t *font) {
-    ui_text_t *t = egoverlay_calloc(1, sizeof(ui_text_t));
+    ui_text_t *t = ui_element_alloc(sizeof(ui_text_t));
 
     t->element.draw = &ui_text_draw;
     t->element.get_preferred_size = &ui_text_get_preferred_size;
@@ -51,29 +61,192 @@ ui_text_t *ui_text_new(const char *text, ui_color_t color, ui_font_t *font) {
     return t;
 }
 
+
+// A styled run: a span of text sharing one color and font, shaped once.
+// {#RRGGBBAA}...{/} opens a color span, {b}...{/} a bold span; spans nest,
+// and {{ is a literal brace
+typedef struct ui_text_run_t {
+    ui_font_layout_t *layout;
+    ui_color_t color; // 0 = inherit the element color
+    ui_font_t *font;
+    int line;
+    int x; // pen offset within the line
+} ui_text_run_t;
+
+#define UI_TEXT_STYLE_DEPTH 8
+
+// compile markup into styled runs; widths and line count land back on the
+// text element
+static void ui_text_compile_markup(ui_text_t *text) {
+    int run_capacity = 8;
+    text->runs = egoverlay_calloc(run_capacity, sizeof(ui_text_run_t));
+    text->run_count = 0;
+
+    struct {
+        ui_color_t color;
+        ui_font_t *font;
+    } style[UI_TEXT_STYLE_DEPTH];
+    int depth = 0;
+    style[0].color = 0; // inherit
+    style[0].font = text->font;
+
+    text->lines = 1;
+    text->pref_width = 0;
+
+    int line = 0;
+    int penx = 0;
+
+    // the current literal segment, with escapes collapsed
+    char *seg = egoverlay_calloc(strlen(text->text)+1, sizeof(char));
+    size_t seglen = 0;
+
+    const char *p = text->text;
+
+    for (;;) {
+        int flush = 0;
+        int newline = 0;
+        ui_color_t newcolor = 0;
+        int bold = 0;
+        int pop = 0;
+        int advance = 1;
+
+        if (*p==0) {
+            flush = 1;
+            advance = 0;
+        } else if (*p=='\n') {
+            flush = 1;
+            newline = 1;
+        } else if (p[0]=='{' && p[1]=='{') {
+            seg[seglen++] = '{';
+            p += 2;
+            continue;
+        } else if (p[0]=='{' && p[1]=='/' && p[2]=='}') {
+            flush = 1;
+            pop = 1;
+            advance = 3;
+        } else if (p[0]=='{' && p[1]=='b' && p[2]=='}') {
+            flush = 1;
+            bold = 1;
+            advance = 3;
+        } else if (p[0]=='{' && p[1]=='#') {
+            // {#RRGGBBAA}
+            char hex[9] = {0};
+            int h = 0;
+            const char *q = p + 2;
+            while (*q && *q!='}' && h<8) hex[h++] = *q++;
+
+            if (h==8 && *q=='}') {
+                flush = 1;
+                newcolor = (ui_color_t)strtoul(hex, NULL, 16);
+                if (newcolor==0) newcolor = 1; // 0 means inherit; keep visible
+                advance = (int)(q - p) + 1;
+            } else {
+                seg[seglen++] = *p;
+            }
+        } else {
+            seg[seglen++] = *p;
+        }
+
+        if (flush) {
+            if (seglen) {
+                if (text->run_count==run_capacity) {
+                    run_capacity *= 2;
+                    text->runs = egoverlay_realloc(text->runs, run_capacity * sizeof(ui_text_run_t));
+                }
+
+                ui_text_run_t *run = &text->runs[text->run_count++];
+                run->font = style[depth].font;
+                run->color = style[depth].color;
+                run->line = line;
+                run->x = penx;
+                run->layout = ui_font_layout_new(run->font, seg, seglen);
+
+                penx += (int)ui_font_layout_width(run->layout);
+                seglen = 0;
+            }
+
+            if (penx > text->pref_width) text->pref_width = penx;
+
+            if (newline) {
+                line++;
+                text->lines++;
+                penx = 0;
+            }
+
+            if ((newcolor || bold) && depth < UI_TEXT_STYLE_DEPTH - 1) {
+                depth++;
+                style[depth] = style[depth-1];
+                if (newcolor) style[depth].color = newcolor;
+                if (bold) style[depth].font = ui_font_variant(style[depth-1].font, 700);
+            } else if (pop && depth > 0) {
+                depth--;
+            }
+        }
+
+        if (!advance) break;
+        p += advance;
+    }
+
+    egoverlay_free(seg);
+
+    text->pref_height = (ui_font_get_line_spacing(text->font) * text->lines) + 2;
+}
+
+void ui_text_free_layouts(ui_text_t *text) {
+    if (text->runs) {
+        for (int r=0;r<text->run_count;r++) ui_font_layout_free(text->runs[r].layout);
+        egoverlay_free(text->runs);
+        text->runs = NULL;
+        text->run_count = 0;
+    }
+
+    if (!text->line_layouts) return;
+
+    for (int l=0;l<text->lines;l++) ui_font_layout_free(text->line_layouts[l]);
+    egoverlay_free(text->line_layouts);
+    text->line_layouts = NULL;
+}
+
 void ui_text_free(ui_text_t *text) {
+    ui_text_free_layouts(text);
     egoverlay_free(text->text);
-    egoverlay_free(text);
+    ui_element_pool_free(text, sizeof(ui_text_t));
 }
 
 void ui_text_update_size(ui_text_t *text) {
+    ui_text_free_layouts(text);
+
+    if (text->markup) {
+        ui_text_compile_markup(text);
+
+        if (text->wrap_indices) egoverlay_free(text->wrap_indices);
+        text->wrap_indices_count = 0;
+        return;
+    }
 
     text->lines = 1;
-    int loffset = 0;
-    text->pref_width = 0;
     for (int c=0;c<strlen(text->text);c++) {
-        if (text->text[c]=='\n') {
-            text->lines++;
-            int width = ui_font_get_text_width(text->font, text->text + loffset, c - loffset);
-            if (width > text->pref_width) text->pref_width = width;
-            loffset = c + 1;
-        }
+        if (text->text[c]=='\n') text->lines++;
+    }
+
+    // shape each line once; the layouts are replayed every frame in draw and
+    // provide the widths here
+    text->line_layouts = egoverlay_calloc(text->lines, sizeof(ui_font_layout_t*));
+
+    text->pref_width = 0;
+    int loffset = 0;
+    for (int l=0;l<text->lines;l++) {
+        int nextl = 0;
+        while ((loffset + nextl) < strlen(text->text) && text->text[loffset + nextl]!='\n') nextl++;
+
+        text->line_layouts[l] = ui_font_layout_new(text->font, text->text + loffset, nextl);
+
+        int width = (int)ui_font_layout_width(text->line_layouts[l]);
+        if (width > text->pref_width) text->pref_width = width;
+
+        loffset += nextl + 1;
     }
-    int width = ui_font_get_text_width(text->font, text->text + loffset, (int)strlen(text->text) - loffset);
-    if (width > text->pref_width) text->pref_width = width;
 
-    //text->pref_width = ui_font_get_text_width(text->font, text->text, (int)strlen(text->text));
-    //text->pref_height = ui_font_get_text_height(text->font);
     text->pref_height = (ui_font_get_line_spacing(text->font) * text->lines) + 2;
 
     if (text->wrap_indices) egoverlay_free(text->wrap_indices);
@@ -82,6 +255,8 @@ void ui_text_update_size(ui_text_t *text) {
 
 
 void ui_text_update_text(ui_text_t *text, const char *new_text) {
+    ui_damage();
+
     if (text->text) egoverlay_free(text->text);
 
     size_t text_len = 0;
@@ -121,13 +296,22 @@ void ui_text_draw(ui_text_t *text, int offset_x, int offset_y,  mat4f_t *proj) {
     int old_scissor[4] = {0};
     if (push_scissor(x, y, text->element.width, text->element.height, old_scissor)) {
 
-        int loffset = 0;
-        for (int curline=0;curline<text->lines;curline++) {
-            int nextl = 0;
-            while ((loffset + nextl) < strlen(text->text) && text->text[loffset + nextl]!='\n') nextl++;
-            ui_font_render_text(text->font, proj, x, y, text->text + loffset, nextl, text->color);
-            loffset += nextl + 1;
-            y += ui_font_get_line_spacing(text->font);
+        if (text->markup) {
+            int spacing = (int)ui_font_get_line_spacing(text->font);
+
+            for (int r=0;r<text->run_count;r++) {
+                ui_text_run_t *run = &text->runs[r];
+                ui_font_layout_draw(
+                    run->layout, proj,
+                    x + run->x, y + run->line * spacing,
+                    run->color ? run->color : text->color
+                );
+            }
+        } else {
+            for (int curline=0;curline<text->lines;curline++) {
+                ui_font_layout_draw(text->line_layouts[curline], proj, x, y, text->color);
+                y += ui_font_get_line_spacing(text->font);
+            }
         }
         pop_scissor(old_scissor);
         if (text->events) {
@@ -137,6 +321,15 @@ void ui_text_draw(ui_text_t *text, int offset_x, int offset_y,  mat4f_t *proj) {
     }
 }
 
+// enable or disable markup mode; the text recompiles immediately
+void ui_text_markup(ui_text_t *text, int enabled) {
+    if (text->markup==enabled) return;
+
+    text->markup = enabled;
+    ui_text_update_size(text);
+    ui_damage();
+}
+
 void ui_text_set_pos(ui_text_t *text, int x, int y) {
     text->element.x = x;
     text->element.y = y;
@@ -154,6 +347,8 @@ int ui_text_lua_new(lua_State *L);
 int ui_text_lua_del(lua_State *L);
 int ui_text_lua_update_text(lua_State *L);
 int ui_text_lua_events(lua_State *L);
+int ui_text_lua_color(lua_State *L);
+int ui_text_lua_markup(lua_State *L);
 
 luaL_Reg ui_text_funcs[] = {
     "update_text"       , &ui_text_lua_update_text,
@@ -161,6 +356,8 @@ luaL_Reg ui_text_funcs[] = {
     "addeventhandler"   , &ui_element_lua_addeventhandler,
     "removeeventhandler", &ui_element_lua_removeeventhandler,
     "events"            , &ui_text_lua_events,
+    "color"             , &ui_text_lua_color,
+    "markup"            , &ui_text_lua_markup,
     "background"        , &ui_element_lua_background,
     NULL                , NULL
 };
@@ -319,3 +516,44 @@ int ui_text_lua_events(lua_State *L) {
 /*** RST
     .. include:: /docs/_include/ui_element_colors.rst
 */
+
+/*** RST
+    .. lua:method:: color(value)
+
+        Set the text color. See :ref:`colors`.
+
+        :param integer value:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_text_lua_color(lua_State *L) {
+    ui_text_t *text = lua_checkuitext(L, 1);
+    text->color = (ui_color_t)luaL_checkinteger(L, 2);
+
+    ui_damage();
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: markup(enabled)
+
+        Enable inline markup for this text element. With markup on, the text
+        is compiled once into styled runs: ``{#RRGGBBAA}...{/}`` colors a
+        span, ``{b}...{/}`` bolds one (spans nest, up to 8 deep), and
+        ``{{`` is a literal brace. One element replaces a box full of
+        per-style text elements, and restyling is just update_text.
+
+        :param boolean enabled:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int ui_text_lua_markup(lua_State *L) {
+    ui_text_t *text = lua_checkuitext(L, 1);
+
+    ui_text_markup(text, lua_toboolean(L, 2));
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include <windows.h>
+#include <stdlib.h>
 #include "ui.h"
 #include "logging/logger.h"
+#include "../gl.h"
 #include "utils.h"
 #include "lamath.h"
 #include "rect.h"
@@ -17,6 +19,7 @@
 #include "text-entry.h"
 #include "separator.h"
 #include "grid.h"
+#include "chart.h"
 #include "../utils.h"
 
 #include <lauxlib.h>
@@ -51,8 +54,38 @@ typedef struct {
 
     ui_input_element_t *input_elements;
 
+    // bounds tree over the input elements (see ui_bounds_tree_rebuild).
+    // rebuilt lazily on the first query after the element set changes
+    struct ui_bounds_node_t *bounds_nodes;
+    size_t bounds_node_count;
+    size_t bounds_node_capacity;
+    int bounds_root;
+    int *bounds_hits;
+    size_t bounds_leaf_count;
+    int bounds_dirty;
+
     HANDLE input_mutex;
 
+    // retained UI cache. the element tree is only re-rendered into the
+    // cache texture when something is damaged; otherwise the cached texture
+    // is composited over the scene as-is
+    GLuint fbo;
+    GLuint fbo_texture;
+    int fbo_width;      // the logical (window) size being rendered
+    int fbo_height;
+    int fbo_tex_width;  // the allocated texture size; grow-only so resizes
+    int fbo_tex_height; // and monitor hops don't reallocate every step
+    gl_shader_program_t *composite_program;
+    int damaged;
+
+    // layout caches key off this; it advances once per re-render so each
+    // container computes its preferred size at most once per pass
+    uint64_t layout_generation;
+
+    // damage raised while re-rendering is layout side effects, not real
+    // changes; it would otherwise force a re-render every frame
+    int in_draw;
+
     ui_element_t *focus_element;
 } ui_t;
 
@@ -67,6 +100,303 @@ typedef struct {
 
 int ui_element_lua_event_handler_callback(lua_State *L, ui_element_event_handler_data_t *data);
 
+gl_shader_source_list_t ui_composite_srcs[] = {
+    "shaders/ui-composite.vert", GL_VERTEX_SHADER,
+    "shaders/ui-composite.frag", GL_FRAGMENT_SHADER,
+    NULL                       , 0
+};
+
+// Size class pools for UI element structs and other small, high churn UI
+// allocations (box items, input list nodes). Lua modules rebuild whole
+// window hierarchies on map change; recycling the fixed size blocks keeps
+// that from fragmenting the heap over long sessions. Blocks are rounded up
+// to 64 byte classes; anything larger falls through to the normal heap.
+// The free lists are not locked: elements are only created, drawn, and
+// destroyed on the render thread.
+#define UI_POOL_CLASS_SIZE  64
+#define UI_POOL_CLASS_COUNT  8
+
+typedef struct ui_pool_block_t {
+    struct ui_pool_block_t *next;
+} ui_pool_block_t;
+
+static ui_pool_block_t *ui_pool_free_lists[UI_POOL_CLASS_COUNT];
+
+void *ui_element_alloc(size_t size) {
+    size_t cls = (size + UI_POOL_CLASS_SIZE - 1) / UI_POOL_CLASS_SIZE;
+
+    if (cls==0 || cls > UI_POOL_CLASS_COUNT) return egoverlay_calloc(1, size);
+
+    if (ui_pool_free_lists[cls-1]) {
+        ui_pool_block_t *block = ui_pool_free_lists[cls-1];
+        ui_pool_free_lists[cls-1] = block->next;
+
+        memset(block, 0, cls * UI_POOL_CLASS_SIZE);
+
+        return block;
+    }
+
+    return egoverlay_calloc(1, cls * UI_POOL_CLASS_SIZE);
+}
+
+void ui_element_pool_free(void *ptr, size_t size) {
+    size_t cls = (size + UI_POOL_CLASS_SIZE - 1) / UI_POOL_CLASS_SIZE;
+
+    if (cls==0 || cls > UI_POOL_CLASS_COUNT) {
+        egoverlay_free(ptr);
+        return;
+    }
+
+    ui_pool_block_t *block = (ui_pool_block_t*)ptr;
+    block->next = ui_pool_free_lists[cls-1];
+    ui_pool_free_lists[cls-1] = block;
+}
+
+// Mark the UI as needing a re-render. Anything that changes what the UI
+// looks like has to call this, otherwise the stale cache keeps compositing.
+// Damage bounds for presentation. ui_damage() marks the whole frame;
+// ui_damage_rect accumulates a bounding box instead, and when every damage
+// in a frame came with a rect the present path can hint the swap to copy
+// only that region (see gl_swap_hint_rect). State resets after each present.
+// starts full so the very first pass lays everything out
+static int damage_full = 1;
+static int damage_has_rect = 0;
+static int damage_x0;
+static int damage_y0;
+static int damage_x1;
+static int damage_y1;
+
+void ui_damage() {
+    if (ui && !ui->in_draw) {
+        ui->damaged = 1;
+        damage_full = 1;
+    }
+}
+
+void ui_damage_rect(int x, int y, int w, int h) {
+    if (!ui || ui->in_draw) return;
+
+    ui->damaged = 1;
+
+    if (!damage_has_rect) {
+        damage_x0 = x;
+        damage_y0 = y;
+        damage_x1 = x + w;
+        damage_y1 = y + h;
+        damage_has_rect = 1;
+    } else {
+        if (x < damage_x0) damage_x0 = x;
+        if (y < damage_y0) damage_y0 = y;
+        if (x + w > damage_x1) damage_x1 = x + w;
+        if (y + h > damage_y1) damage_y1 = y + h;
+    }
+}
+
+// returns 1 with the frame's bounding box when every damage came with a
+// rect; 0 means present the full frame
+int ui_damage_bounds(int *x, int *y, int *w, int *h) {
+    if (damage_full || !damage_has_rect) return 0;
+
+    *x = damage_x0;
+    *y = damage_y0;
+    *w = damage_x1 - damage_x0;
+    *h = damage_y1 - damage_y0;
+
+    return 1;
+}
+
+void ui_damage_bounds_reset() {
+    damage_full = 0;
+    damage_has_rect = 0;
+}
+
+// The current layout pass generation, see ui_t.layout_generation.
+uint64_t ui_layout_generation() {
+    return ui->layout_generation;
+}
+
+// is a re-render pending? used by the idle detector in the render loop
+int ui_is_damaged() {
+    return ui ? ui->damaged : 0;
+}
+
+// Fast hit data for the low level input hooks: the hooks must decide
+// consume-vs-pass-through without blocking on the render thread, so a
+// double buffered snapshot of the input element bounds (plus capture and
+// focus flags) is published after each re-render and read lock free.
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} ui_hit_rect_t;
+
+typedef struct {
+    // volatile: the hook thread reads count then rects unfenced, and the
+    // compiler must not reorder or fold those loads (see ui_hit_test_fast)
+    ui_hit_rect_t * volatile rects;
+    volatile LONG count;
+    LONG capacity;
+} ui_hit_slot_t;
+
+static ui_hit_slot_t hit_slots[2];
+static volatile LONG hit_active = 0;
+static volatile LONG hit_capture = 0;
+static volatile LONG hit_focus = 0;
+
+// buffers replaced by growth are retired instead of freed: a hook thread
+// preempted across two snapshot swaps can still be reading an old buffer,
+// so old storage stays valid until cleanup. growth is rare and monotonic,
+// so this holds a handful of buffers at most
+#define UI_HIT_RETIRED_MAX 16
+static ui_hit_rect_t *hit_retired[UI_HIT_RETIRED_MAX];
+static int hit_retired_count = 0;
+
+static void ui_hit_slot_reserve(ui_hit_slot_t *slot, LONG count) {
+    if (count <= slot->capacity) return;
+
+    LONG newcap = slot->capacity ? slot->capacity : 256;
+    while (newcap < count) newcap *= 2;
+
+    if (slot->rects) {
+        if (hit_retired_count < UI_HIT_RETIRED_MAX) {
+            hit_retired[hit_retired_count++] = slot->rects;
+        }
+        // past the retire budget the old buffer is intentionally leaked
+        // rather than risking a use-after-free in the hook thread
+    }
+
+    slot->rects = egoverlay_calloc(newcap, sizeof(ui_hit_rect_t));
+    slot->capacity = newcap;
+}
+
+// Coarse tile occupancy mask over the screen (64px tiles, up to 8K on a
+// side), published with the snapshot. Most mouse positions are over the
+// game world; a clear tile answers pass-through with one array read,
+// and only positions in occupied tiles fall back to the rect scan.
+#define HIT_TILE_SHIFT 6
+#define HIT_TILE_DIM   128
+
+static uint8_t hit_tiles[2][HIT_TILE_DIM * HIT_TILE_DIM];
+
+// called with the input mutex held, after the input element list rebuilt
+static void ui_update_hit_snapshot() {
+    LONG inactive = 1 - hit_active;
+
+    memset(hit_tiles[inactive], 0, sizeof(hit_tiles[inactive]));
+
+    LONG total = 0;
+    for (ui_input_element_t *e=ui->input_elements;e;e=e->prev) total++;
+
+    ui_hit_slot_t *slot = &hit_slots[inactive];
+    ui_hit_slot_reserve(slot, total);
+
+    LONG count = 0;
+    for (ui_input_element_t *e=ui->input_elements;e;e=e->prev) {
+        int x = e->offset_x + e->x;
+        int y = e->offset_y + e->y;
+
+        slot->rects[count].x = x;
+        slot->rects[count].y = y;
+        slot->rects[count].w = e->w;
+        slot->rects[count].h = e->h;
+        count++;
+
+        int tx0 = x >> HIT_TILE_SHIFT;
+        int ty0 = y >> HIT_TILE_SHIFT;
+        int tx1 = (x + e->w) >> HIT_TILE_SHIFT;
+        int ty1 = (y + e->h) >> HIT_TILE_SHIFT;
+
+        if (tx0 < 0) tx0 = 0;
+        if (ty0 < 0) ty0 = 0;
+        if (tx1 >= HIT_TILE_DIM) tx1 = HIT_TILE_DIM - 1;
+        if (ty1 >= HIT_TILE_DIM) ty1 = HIT_TILE_DIM - 1;
+
+        for (int ty=ty0;ty<=ty1;ty++) {
+            for (int tx=tx0;tx<=tx1;tx++) {
+                hit_tiles[inactive][ty * HIT_TILE_DIM + tx] = 1;
+            }
+        }
+    }
+
+    slot->count = count;
+    InterlockedExchange(&hit_active, inactive);
+}
+
+// hook thread: is this point over the overlay UI (or is input captured)?
+int ui_hit_test_fast(int x, int y) {
+    if (hit_capture) return 1;
+
+    LONG active = hit_active;
+
+    // coarse reject first: the common case (mouse over the game world)
+    // never touches the rect list
+    if (x >= 0 && y >= 0) {
+        int tx = x >> HIT_TILE_SHIFT;
+        int ty = y >> HIT_TILE_SHIFT;
+
+        if (tx < HIT_TILE_DIM && ty < HIT_TILE_DIM && !hit_tiles[active][ty * HIT_TILE_DIM + tx]) {
+            return 0;
+        }
+    }
+
+    ui_hit_slot_t *slot = &hit_slots[active];
+
+    // count is read before rects: buffers only ever grow, so a count paired
+    // with any newer buffer stays in bounds, while the reverse pairing (old
+    // smaller buffer, newer larger count) could read past the allocation
+    LONG count = slot->count;
+    ui_hit_rect_t *rects = slot->rects;
+
+    for (LONG i=0;i<count && rects;i++) {
+        ui_hit_rect_t *r = &rects[i];
+        if (x>=r->x && x<=r->x + r->w && y>=r->y && y<=r->y + r->h) return 1;
+    }
+
+    return 0;
+}
+
+// hook thread: does anything have keyboard focus?
+int ui_has_focus_fast() {
+    return hit_focus!=0;
+}
+
+// Cull rectangle stack. A scrolling container pushes its visible region
+// before drawing its child; layout containers then skip drawing items that
+// fall entirely outside it (while still advancing layout), so a long list
+// only pays for the rows actually on screen.
+#define UI_CULL_RECT_MAX 8
+
+static int cull_rects[UI_CULL_RECT_MAX][4];
+static int cull_rect_count = 0;
+
+void ui_push_cull_rect(int x, int y, int w, int h) {
+    if (cull_rect_count==UI_CULL_RECT_MAX) return;
+
+    cull_rects[cull_rect_count][0] = x;
+    cull_rects[cull_rect_count][1] = y;
+    cull_rects[cull_rect_count][2] = w;
+    cull_rects[cull_rect_count][3] = h;
+    cull_rect_count++;
+}
+
+void ui_pop_cull_rect() {
+    if (cull_rect_count) cull_rect_count--;
+}
+
+// Returns 1 when the given rectangle is entirely outside the innermost
+// cull rectangle (if any).
+int ui_rect_culled(int x, int y, int w, int h) {
+    if (cull_rect_count==0) return 0;
+
+    int *cr = cull_rects[cull_rect_count-1];
+
+    if (x + w < cr[0] || x > cr[0] + cr[2]) return 1;
+    if (y + h < cr[1] || y > cr[1] + cr[3]) return 1;
+
+    return 0;
+}
+
 void ui_init() {
     ui = egoverlay_calloc(1, sizeof(ui_t));
 
@@ -93,7 +423,8 @@ void ui_init() {
     settings_set_default_int(app_settings, "overlay.ui.colors.menuItemHover",         0x2E3859FF);
     settings_set_default_int(app_settings, "overlay.ui.colors.menuItemHighlight",     0x3a4670FF);
 
-    settings_set_default_string(app_settings, "overlay.ui.font.path"    , "fonts/Inter.ttf");
+    settings_set_default_string(app_settings, "overlay.ui.font.path"        , "fonts/Inter.ttf");
+    settings_set_default_string(app_settings, "overlay.ui.font.pathFallback", "");
     settings_set_default_string(app_settings, "overlay.ui.font.pathMono", "fonts/CascadiaCode.ttf");
     settings_set_default_int   (app_settings, "overlay.ui.font.size"    , 12);
     settings_set_default_int   (app_settings, "overlay.ui.font.weight"  , 400);
@@ -104,30 +435,63 @@ void ui_init() {
     ui_image_init();
 
     ui->input_mutex = CreateMutex(0, FALSE, NULL);
+    ui->bounds_root = -1;
+
+    ui->composite_program = gl_shader_program_new_with_sources(ui_composite_srcs);
+    ui->damaged = 1;
+    damage_full = 1;
 
     lua_manager_add_module_opener("eg-overlay-ui", &ui_lua_open_module);
 }
 
 void ui_clear_top_level_elements() {
+    ui_damage();
+
     ui_element_list_t *tle=ui->top_level_elements;
     while (tle) {
         ui_element_list_t *n = tle->next;
         ui_element_unref(tle->element);
-        egoverlay_free(tle);
+        ui_element_pool_free(tle, sizeof(ui_element_list_t));
         tle = n;
     }
     ui->top_level_elements = NULL;
 }
 
+void ui_cleanup_fbo() {
+    if (!ui->fbo) return;
+
+    glDeleteFramebuffers(1, &ui->fbo);
+    glDeleteTextures(1, &ui->fbo_texture);
+    ui->fbo = 0;
+    ui->fbo_texture = 0;
+    ui->fbo_tex_width = 0;
+    ui->fbo_tex_height = 0;
+}
+
 void ui_cleanup() {
+    ui_cleanup_fbo();
+    gl_shader_program_free(ui->composite_program);
+
     
     ui_input_element_t *e = ui->input_elements;
     while (e) {
         ui_input_element_t *prev = e->prev;
-        egoverlay_free(e);
+        ui_element_pool_free(e, sizeof(ui_input_element_t));
         e = prev;
     }
 
+    if (ui->bounds_nodes) egoverlay_free(ui->bounds_nodes);
+    if (ui->bounds_hits) egoverlay_free(ui->bounds_hits);
+
+    for (int s=0;s<2;s++) {
+        if (hit_slots[s].rects) egoverlay_free(hit_slots[s].rects);
+        hit_slots[s].rects = NULL;
+        hit_slots[s].count = 0;
+        hit_slots[s].capacity = 0;
+    }
+    for (int r=0;r<hit_retired_count;r++) egoverlay_free(hit_retired[r]);
+    hit_retired_count = 0;
+
     CloseHandle(ui->input_mutex);
     logger_debug(ui->log, "cleanup");
     ui_rect_cleanup();
@@ -140,6 +504,14 @@ void ui_cleanup() {
 void ui_element_draw(void *element, int offset_x, int offset_y, mat4f_t *proj) {
     ui_element_t *e = (ui_element_t*)element;
 
+    // anything entirely outside the innermost cull rect would be scissored
+    // away; skip its draw (and background/border) entirely. containers that
+    // cull per-child already avoid dispatching here, this catches everything
+    // drawn through other parents (separators, decorations, nested content)
+    if (e->width>0 && e->height>0 && ui_rect_culled(offset_x + e->x, offset_y + e->y, e->width, e->height)) {
+        return;
+    }
+
     if (UI_COLOR_A_INT(e->bg_color)>0) {
         int bgx = offset_x + e->x;
         int bgy = offset_y + e->y;
@@ -168,13 +540,19 @@ int ui_element_has_focus(ui_element_t *element) {
 
 void ui_grab_focus(void *element) {
     ui->focus_element = element;
+    hit_focus = 1;
+    ui_damage();
 }
 
 void ui_clear_focus() {
     ui->focus_element = NULL;
+    hit_focus = 0;
+    ui_damage();
 }
 
 void ui_add_top_level_element(void *element) {
+    ui_damage();
+
     for (ui_element_list_t *e=ui->top_level_elements;e;e=e->next) {
         
         if (e->element==element) {
@@ -183,7 +561,7 @@ void ui_add_top_level_element(void *element) {
         }
     }
 
-    ui_element_list_t *e = egoverlay_calloc(1, sizeof(ui_element_list_t));
+    ui_element_list_t *e = ui_element_alloc(sizeof(ui_element_list_t));
 
     e->element = element;
 
@@ -201,6 +579,8 @@ void ui_add_top_level_element(void *element) {
 }
 
 void ui_remove_top_level_element(void *element) {
+    ui_damage();
+
     ui_element_list_t *e = ui->top_level_elements;
 
     ui_element_unref(element);
@@ -218,7 +598,7 @@ void ui_remove_top_level_element(void *element) {
                 ui->top_level_elements = e->next;
             }
 
-            egoverlay_free(e);
+            ui_element_pool_free(e, sizeof(ui_element_list_t));
             return;
         }
         e = e->next;
@@ -226,6 +606,8 @@ void ui_remove_top_level_element(void *element) {
 }
 
 void ui_move_element_to_top(void *element) {
+    ui_damage();
+
     ui_element_list_t *e = ui->top_level_elements;
 
     if (e->element==element && !e->next) return; // this is the only element being drawn
@@ -254,21 +636,102 @@ void ui_move_element_to_top(void *element) {
 
 void ui_draw(mat4f_t *proj) {
     WaitForSingleObject(ui->input_mutex, INFINITE);
-    // clear out the input element list. it will be populated as elements draw each frame
-    ui_input_element_t *ie = ui->input_elements;
-    while (ie) {
-        ui_input_element_t *n = ie;
-        ie = ie->prev;
-        egoverlay_free(n);
+
+    int fbw = 0;
+    int fbh = 0;
+    app_get_framebuffer_size(&fbw, &fbh);
+
+    if (fbw!=ui->fbo_width || fbh!=ui->fbo_height) {
+        // the texture only grows; shrinking just renders into (and
+        // composites from) a subregion, so dragging between monitors or
+        // resizing doesn't reallocate at every step
+        if (fbw > ui->fbo_tex_width || fbh > ui->fbo_tex_height) {
+            ui_cleanup_fbo();
+
+            int tw = fbw > ui->fbo_tex_width ? fbw : ui->fbo_tex_width;
+            int th = fbh > ui->fbo_tex_height ? fbh : ui->fbo_tex_height;
+
+            glGenTextures(1, &ui->fbo_texture);
+            glBindTexture(GL_TEXTURE_2D, ui->fbo_texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, tw, th);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glGenFramebuffers(1, &ui->fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, ui->fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ui->fbo_texture, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            ui->fbo_tex_width = tw;
+            ui->fbo_tex_height = th;
+        }
+
+        ui->fbo_width = fbw;
+        ui->fbo_height = fbh;
+        ui->damaged = 1;
+        damage_full = 1;
     }
-    ui->input_elements = NULL;
 
-    ui_element_list_t *e = ui->top_level_elements;
-    while(e) {
-        ui_element_draw(e->element, 0, 0, proj);
-        e = e->next;
+    if (ui->damaged) {
+        // scroll and drag damage is a pure transform: positions change but
+        // no widget's preferred size can have. keeping the layout
+        // generation stable lets every per-generation sizing cache (box,
+        // grid, text) answer from cache, so the pass is a translated redraw
+        // instead of a relayout. content changes come through ui_damage()
+        // (full) and bump the generation as before
+        if (damage_full) ui->layout_generation++;
+
+        ui->in_draw = 1;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, ui->fbo);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // clear out the input element list. it will be populated as elements
+        // draw. on undamaged frames the list from the last re-render stays
+        // valid since nothing moved
+        ui_input_element_t *ie = ui->input_elements;
+        while (ie) {
+            ui_input_element_t *n = ie;
+            ie = ie->prev;
+            ui_element_pool_free(n, sizeof(ui_input_element_t));
+        }
+        ui->input_elements = NULL;
+        ui->bounds_dirty = 1;
+
+        ui_element_list_t *e = ui->top_level_elements;
+        while(e) {
+            ui_element_draw(e->element, 0, 0, proj);
+            // flush per top level element so batched draws can't bleed over
+            // a window drawn later. rects first, so text stays on top
+            ui_rect_flush();
+            ui_font_flush();
+            e = e->next;
+        }
+
+        ui_update_hit_snapshot();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        ui->in_draw = 0;
+        ui->damaged = 0;
     }
 
+    // composite the cached UI over the scene, sampling only the logical
+    // subregion of the (possibly larger) cache texture
+    gl_shader_program_use(ui->composite_program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ui->fbo_texture);
+
+    glUniform2f(0,
+        (float)ui->fbo_width / (float)ui->fbo_tex_width,
+        (float)ui->fbo_height / (float)ui->fbo_tex_height
+    );
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+
     ReleaseMutex(ui->input_mutex);
 }
 
@@ -276,12 +739,16 @@ void ui_element_set_size(ui_element_t *element, int width, int height) {
     element->width = width;
     element->height = height;
 
+    ui_damage();
+
     if (element->size_updated) element->size_updated(element);
 }
 
 void ui_element_set_pos(ui_element_t *element, int x, int y) {
     element->x = x;
     element->y = y;
+
+    ui_damage();
 }
 
 int ui_element_get_preferred_size(ui_element_t *element, int *width, int *height) {
@@ -313,13 +780,15 @@ void ui_element_unref(ui_element_t *element) {
         ui->mouse_over_element = NULL;
     }
 
+    ui->bounds_dirty = 1;
+
     ui_input_element_t *e = ui->input_elements;
     ui_input_element_t *next = NULL;
     while (e) {
         ui_input_element_t *prev = e->prev;
         if (e->element==element) {
             if (ui->input_elements==e) ui->input_elements = prev;
-            egoverlay_free(e);
+            ui_element_pool_free(e, sizeof(ui_input_element_t));
             if (next) next->prev = prev;
             break;
         } else {
@@ -332,15 +801,17 @@ void ui_element_unref(ui_element_t *element) {
 
     for (size_t hi=0;hi<element->lua_event_handler_count;hi++) {
         lua_manager_unref(element->lua_event_handlers[hi]);
+        if (element->lua_event_handler_events[hi]) egoverlay_free(element->lua_event_handler_events[hi]);
     }
     if (element->lua_event_handlers) egoverlay_free(element->lua_event_handlers);
+    if (element->lua_event_handler_events) egoverlay_free(element->lua_event_handler_events);
 
     if (element->free) element->free(element);
 
     }
 
 void ui_add_input_element(int offset_x, int offset_y, int x, int y, int w, int h, ui_element_t *element) {
-    ui_input_element_t *e = egoverlay_calloc(1, sizeof(ui_input_element_t));
+    ui_input_element_t *e = ui_element_alloc(sizeof(ui_input_element_t));
 
     e->offset_x = offset_x;
     e->offset_y = offset_y;
@@ -355,11 +826,14 @@ void ui_add_input_element(int offset_x, int offset_y, int x, int y, int w, int h
 
     e->prev = ui->input_elements;
     ui->input_elements = e;
+    ui->bounds_dirty = 1;
 
     ReleaseMutex(ui->input_mutex);
 }
 
 static void ui_send_leave_event(ui_element_t *element, int offset_x, int offset_y) {
+    ui_damage();
+
     ui_mouse_event_t leave = {0};
     leave.event = UI_MOUSE_EVENT_TYPE_LEAVE;
     if (element->process_mouse_event) element->process_mouse_event(element, &leave, offset_x, offset_y);
@@ -367,6 +841,8 @@ static void ui_send_leave_event(ui_element_t *element, int offset_x, int offset_
 }
 
 static void ui_send_enter_event(ui_element_t *element, int offset_x, int offset_y) {
+    ui_damage();
+
     ui_mouse_event_t enter = {0};
     enter.event = UI_MOUSE_EVENT_TYPE_ENTER;
     if (element->process_mouse_event) element->process_mouse_event(element, &enter, offset_x, offset_y);
@@ -374,6 +850,8 @@ static void ui_send_enter_event(ui_element_t *element, int offset_x, int offset_
 }
 
 void ui_send_lua_mouse_event(ui_element_t *element, ui_mouse_event_t *event) {
+    ui_damage();
+
     const char *ename = "unknown";
 
     if (event->event==UI_MOUSE_EVENT_TYPE_BTN_DOWN) {
@@ -404,19 +882,185 @@ void ui_send_lua_mouse_event(ui_element_t *element, ui_mouse_event_t *event) {
     ui_element_call_lua_event_handlers(element, ename);
 }
 
+// AABB tree over the registered input elements. The input list is rebuilt by
+// every damage pass and walked per mouse event, which is effectively quadratic
+// while dragging across a busy UI; the tree turns each hit test into a
+// root-to-leaf descent. Leaves keep their registration order so overlap still
+// resolves to the topmost (most recently drawn) element.
+typedef struct ui_bounds_node_t {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+    int left;  // child node indices, -1 on leaves
+    int right;
+    int order; // leaf draw order, higher is on top
+    ui_input_element_t *element;
+} ui_bounds_node_t;
+
+typedef struct {
+    int center_x;
+    int center_y;
+    int node; // leaf node index
+} ui_bounds_leaf_t;
+
+static int ui_bounds_leaf_cmp_x(const void *a, const void *b) {
+    return ((const ui_bounds_leaf_t*)a)->center_x - ((const ui_bounds_leaf_t*)b)->center_x;
+}
+
+static int ui_bounds_leaf_cmp_y(const void *a, const void *b) {
+    return ((const ui_bounds_leaf_t*)a)->center_y - ((const ui_bounds_leaf_t*)b)->center_y;
+}
+
+static int ui_bounds_node_new() {
+    if (ui->bounds_node_count==ui->bounds_node_capacity) {
+        ui->bounds_node_capacity = ui->bounds_node_capacity ? ui->bounds_node_capacity * 2 : 64;
+        ui->bounds_nodes = egoverlay_realloc(ui->bounds_nodes, ui->bounds_node_capacity * sizeof(ui_bounds_node_t));
+    }
+
+    return (int)ui->bounds_node_count++;
+}
+
+// median split on the wider axis of the leaf centers
+static int ui_bounds_tree_build(ui_bounds_leaf_t *leaves, size_t count) {
+    if (count==1) return leaves[0].node;
+
+    int min_cx = leaves[0].center_x;
+    int max_cx = leaves[0].center_x;
+    int min_cy = leaves[0].center_y;
+    int max_cy = leaves[0].center_y;
+    for (size_t l=1;l<count;l++) {
+        if (leaves[l].center_x < min_cx) min_cx = leaves[l].center_x;
+        if (leaves[l].center_x > max_cx) max_cx = leaves[l].center_x;
+        if (leaves[l].center_y < min_cy) min_cy = leaves[l].center_y;
+        if (leaves[l].center_y > max_cy) max_cy = leaves[l].center_y;
+    }
+
+    if (max_cx - min_cx >= max_cy - min_cy) {
+        qsort(leaves, count, sizeof(ui_bounds_leaf_t), &ui_bounds_leaf_cmp_x);
+    } else {
+        qsort(leaves, count, sizeof(ui_bounds_leaf_t), &ui_bounds_leaf_cmp_y);
+    }
+
+    size_t half = count / 2;
+    int left = ui_bounds_tree_build(leaves, half);
+    int right = ui_bounds_tree_build(leaves + half, count - half);
+
+    int ni = ui_bounds_node_new();
+    ui_bounds_node_t *n = &ui->bounds_nodes[ni];
+    ui_bounds_node_t *ln = &ui->bounds_nodes[left];
+    ui_bounds_node_t *rn = &ui->bounds_nodes[right];
+    n->min_x = ln->min_x < rn->min_x ? ln->min_x : rn->min_x;
+    n->min_y = ln->min_y < rn->min_y ? ln->min_y : rn->min_y;
+    n->max_x = ln->max_x > rn->max_x ? ln->max_x : rn->max_x;
+    n->max_y = ln->max_y > rn->max_y ? ln->max_y : rn->max_y;
+    n->left = left;
+    n->right = right;
+    n->order = -1;
+    n->element = NULL;
+
+    return ni;
+}
+
+// called with the input mutex held
+static void ui_bounds_tree_rebuild() {
+    ui->bounds_node_count = 0;
+    ui->bounds_root = -1;
+    ui->bounds_dirty = 0;
+
+    size_t count = 0;
+    for (ui_input_element_t *e=ui->input_elements;e;e=e->prev) count++;
+
+    if (ui->bounds_hits) {
+        egoverlay_free(ui->bounds_hits);
+        ui->bounds_hits = NULL;
+    }
+    ui->bounds_leaf_count = count;
+
+    if (count==0) return;
+
+    ui->bounds_hits = egoverlay_calloc(count, sizeof(int));
+
+    ui_bounds_leaf_t *leaves = egoverlay_calloc(count, sizeof(ui_bounds_leaf_t));
+
+    // the list head is the most recently registered (topmost) element
+    int order = (int)count;
+    size_t l = 0;
+    for (ui_input_element_t *e=ui->input_elements;e;e=e->prev) {
+        int ni = ui_bounds_node_new();
+        ui_bounds_node_t *n = &ui->bounds_nodes[ni];
+        n->min_x = e->offset_x + e->x;
+        n->min_y = e->offset_y + e->y;
+        n->max_x = n->min_x + e->w;
+        n->max_y = n->min_y + e->h;
+        n->left = -1;
+        n->right = -1;
+        n->order = --order;
+        n->element = e;
+
+        leaves[l].center_x = n->min_x + e->w / 2;
+        leaves[l].center_y = n->min_y + e->h / 2;
+        leaves[l].node = ni;
+        l++;
+    }
+
+    ui->bounds_root = ui_bounds_tree_build(leaves, count);
+
+    egoverlay_free(leaves);
+}
+
+static void ui_bounds_query_top(int ni, int x, int y, ui_input_element_t **best, int *best_order) {
+    ui_bounds_node_t *n = &ui->bounds_nodes[ni];
+
+    if (x < n->min_x || x > n->max_x || y < n->min_y || y > n->max_y) return;
+
+    if (n->left<0) {
+        if (n->order > *best_order) {
+            *best = n->element;
+            *best_order = n->order;
+        }
+        return;
+    }
+
+    ui_bounds_query_top(n->left, x, y, best, best_order);
+    ui_bounds_query_top(n->right, x, y, best, best_order);
+}
+
+// collect every leaf containing the point into ui->bounds_hits, topmost first
+static void ui_bounds_query_all(int ni, int x, int y, size_t *count) {
+    ui_bounds_node_t *n = &ui->bounds_nodes[ni];
+
+    if (x < n->min_x || x > n->max_x || y < n->min_y || y > n->max_y) return;
+
+    if (n->left<0) {
+        // insertion sort by descending order; hit counts at a point are tiny
+        size_t i = *count;
+        while (i>0 && ui->bounds_nodes[ui->bounds_hits[i-1]].order < n->order) {
+            ui->bounds_hits[i] = ui->bounds_hits[i-1];
+            i--;
+        }
+        ui->bounds_hits[i] = ni;
+        (*count)++;
+        return;
+    }
+
+    ui_bounds_query_all(n->left, x, y, count);
+    ui_bounds_query_all(n->right, x, y, count);
+}
+
 int ui_process_mouse_event(ui_mouse_event_t *event) {
     WaitForSingleObject(ui->input_mutex, INFINITE);
 
     ui->last_mouse_x = event->x;
     ui->last_mouse_y = event->y;
 
+    if (ui->bounds_dirty) ui_bounds_tree_rebuild();
+
     ui_input_element_t *top_element_under_mouse = NULL;
+    int top_order = -1;
 
-        for (ui_input_element_t *e = ui->input_elements;e;e = e->prev) {
-        if (MOUSE_POINT_IN_RECT(event->x, event->y, e->offset_x + e->x, e->offset_y + e->y, e->w, e->h)) {
-            top_element_under_mouse = e;
-            break;
-        }
+    if (ui->bounds_root>=0) {
+        ui_bounds_query_top(ui->bounds_root, event->x, event->y, &top_element_under_mouse, &top_order);
     }
 
     if (top_element_under_mouse && ui->mouse_over_element!=top_element_under_mouse->element) {
@@ -438,12 +1082,24 @@ int ui_process_mouse_event(ui_mouse_event_t *event) {
     if (ui->mouse_capture_element) {
         ui_send_lua_mouse_event(ui->mouse_capture_element, event);
 
-        if (ui->mouse_capture_element->process_mouse_event(
-                ui->mouse_capture_element,
-                event,
-                ui->capture_offset_x,
-                ui->capture_offset_y
-            )) {
+        ui_element_t *cap = ui->mouse_capture_element;
+
+        // remember where the captured element was before the handler so a
+        // drag damages old + new position instead of the whole frame
+        int px0 = ui->capture_offset_x + cap->x;
+        int py0 = ui->capture_offset_y + cap->y;
+        int px1 = px0 + cap->width;
+        int py1 = py0 + cap->height;
+
+        if (cap->process_mouse_event(cap, event, ui->capture_offset_x, ui->capture_offset_y)) {
+            int nx0 = ui->capture_offset_x + cap->x;
+            int ny0 = ui->capture_offset_y + cap->y;
+            if (nx0 < px0) px0 = nx0;
+            if (ny0 < py0) py0 = ny0;
+            if (nx0 + cap->width > px1) px1 = nx0 + cap->width;
+            if (ny0 + cap->height > py1) py1 = ny0 + cap->height;
+
+            ui_damage_rect(px0, py0, px1 - px0, py1 - py0);
             ReleaseMutex(ui->input_mutex);
             return 1;
         }
@@ -453,19 +1109,34 @@ int ui_process_mouse_event(ui_mouse_event_t *event) {
         ui_send_lua_mouse_event(top_element_under_mouse->element, event);
     }
 
-    ui_input_element_t *e = ui->input_elements;
-
-    while (e) { 
-        if (MOUSE_POINT_IN_RECT(event->x, event->y, e->offset_x + e->x, e->offset_y + e->y, e->w, e->h)) {
-            if (e->element->process_mouse_event) {
-                if (e->element->process_mouse_event(e->element, event, e->offset_x, e->offset_y)) {
-                    ReleaseMutex(ui->input_mutex);
-                    return 1;
-                }
+    size_t hit_count = 0;
+    if (ui->bounds_root>=0) ui_bounds_query_all(ui->bounds_root, event->x, event->y, &hit_count);
+
+    for (size_t h=0;h<hit_count;h++) {
+        ui_input_element_t *e = ui->bounds_hits ? ui->bounds_nodes[ui->bounds_hits[h]].element : NULL;
+
+        if (e && e->element->process_mouse_event) {
+            if (e->element->process_mouse_event(e->element, event, e->offset_x, e->offset_y)) {
+                // damage the union of the element's registered rect and its
+                // rect after the handler ran, so drags damage old + new
+                // position instead of the whole frame
+                int x0 = e->offset_x + e->x;
+                int y0 = e->offset_y + e->y;
+                int x1 = x0 + e->w;
+                int y1 = y0 + e->h;
+
+                int nx0 = e->offset_x + e->element->x;
+                int ny0 = e->offset_y + e->element->y;
+                if (nx0 < x0) x0 = nx0;
+                if (ny0 < y0) y0 = ny0;
+                if (nx0 + e->element->width > x1) x1 = nx0 + e->element->width;
+                if (ny0 + e->element->height > y1) y1 = ny0 + e->element->height;
+
+                ui_damage_rect(x0, y0, x1 - x0, y1 - y0);
+                ReleaseMutex(ui->input_mutex);
+                return 1;
             }
         }
-
-        e = e->prev;
     }
 
     ReleaseMutex(ui->input_mutex);
@@ -477,6 +1148,7 @@ int ui_process_mouse_event(ui_mouse_event_t *event) {
 
 int ui_process_keyboard_event(ui_keyboard_event_t *event) {
     if (ui->focus_element && ui->focus_element->process_keyboard_event) {
+        ui_damage();
         return ui->focus_element->process_keyboard_event(ui->focus_element, event);
     }
 
@@ -488,6 +1160,7 @@ void ui_capture_mouse_events(ui_element_t *element, int offset_x, int offset_y)
         ui->mouse_capture_element = element;
         ui->capture_offset_x = offset_x;
         ui->capture_offset_y = offset_y;
+        hit_capture = 1;
     }
 }
 
@@ -496,6 +1169,7 @@ void ui_release_mouse_events(ui_element_t *element) {
         ui->mouse_capture_element = NULL;
         ui->capture_offset_x = 0;
         ui->capture_offset_y = 0;
+        hit_capture = 0;
     }
 }
 
@@ -504,14 +1178,26 @@ int ui_element_lua_addeventhandler(lua_State *L) {
 
     if (!lua_isfunction(L, 2)) return luaL_error(L, "Event handler must be a function.");
 
-    int *h = element->lua_event_handlers;
+    char *filter = NULL;
+    if (lua_gettop(L)>=3 && lua_type(L, 3)==LUA_TSTRING) {
+        const char *event = lua_tostring(L, 3);
+        filter = egoverlay_calloc(strlen(event)+1, sizeof(char));
+        memcpy(filter, event, strlen(event));
+    }
+
     size_t newcount = element->lua_event_handler_count + 1;
-    
-    element->lua_event_handlers = egoverlay_realloc(h, newcount * sizeof(int));
+
+    element->lua_event_handlers = egoverlay_realloc(element->lua_event_handlers, newcount * sizeof(int));
+    element->lua_event_handler_events = egoverlay_realloc(
+        element->lua_event_handler_events,
+        newcount * sizeof(char*)
+    );
 
     lua_pushvalue(L, 2);
     int cbi = luaL_ref(L, LUA_REGISTRYINDEX);
-    element->lua_event_handlers[element->lua_event_handler_count++] = cbi;
+    element->lua_event_handlers[element->lua_event_handler_count] = cbi;
+    element->lua_event_handler_events[element->lua_event_handler_count] = filter;
+    element->lua_event_handler_count++;
 
     lua_pushinteger(L, cbi);
     
@@ -535,14 +1221,23 @@ int ui_element_lua_removeeventhandler(lua_State *L) {
         return luaL_error(L, "Lua event handler not found.");
     }
 
+    if (element->lua_event_handler_events[cbi_ind]) {
+        egoverlay_free(element->lua_event_handler_events[cbi_ind]);
+    }
+
     for (size_t i=cbi_ind;i<element->lua_event_handler_count-1;i++) {
         element->lua_event_handlers[i] = element->lua_event_handlers[i+1];
+        element->lua_event_handler_events[i] = element->lua_event_handler_events[i+1];
     }
 
     element->lua_event_handlers = egoverlay_realloc(
         element->lua_event_handlers,
         sizeof(int) * (element->lua_event_handler_count - 1)
     );
+    element->lua_event_handler_events = egoverlay_realloc(
+        element->lua_event_handler_events,
+        sizeof(char*) * (element->lua_event_handler_count - 1)
+    );
     element->lua_event_handler_count--;
 
     return 0;
@@ -550,6 +1245,14 @@ int ui_element_lua_removeeventhandler(lua_State *L) {
 
 void ui_element_call_lua_event_handlers(ui_element_t *element, const char *event) {
     for (size_t hi=0;hi<element->lua_event_handler_count;hi++) {
+        // handlers registered for a specific event only see that event; the
+        // filter runs here instead of broadcasting into Lua
+        if (element->lua_event_handler_events[hi] &&
+            strcmp(element->lua_event_handler_events[hi], event)!=0
+        ) {
+            continue;
+        }
+
         ui_element_event_handler_data_t *d = egoverlay_calloc(1, sizeof(ui_element_event_handler_data_t));
 
         d->cbi = element->lua_event_handlers[hi];
@@ -575,6 +1278,7 @@ int ui_element_lua_background(lua_State *L) {
 
     if (lua_gettop(L)==2) {
         element->bg_color = (ui_color_t)luaL_checkinteger(L, 2);
+        ui_damage();
         return 0;
     }
 
@@ -646,6 +1350,7 @@ int ui_lua_open_module(lua_State *L) {
     ui_menu_lua_register_ui_funcs(L);
     ui_separator_lua_register_ui_funcs(L);
     ui_grid_lua_register_ui_funcs(L);
+    ui_chart_lua_register_ui_funcs(L);
 
     return 1;
 }
@@ -125,6 +125,8 @@ struct ui_element_t {
 
     size_t lua_event_handler_count;
     int *lua_event_handlers;
+    // optional per handler event name filter; NULL receives every event
+    char **lua_event_handler_events;
 };
 
 int ui_element_has_focus(void *element);
@@ -153,6 +155,36 @@ int ui_process_mouse_event(ui_mouse_event_t *event);
 
 void ui_draw(mat4f_t *proj);
 
+// mark the UI as needing a re-render. widget code must call this whenever
+// something visible changes, otherwise the cached UI keeps compositing
+void ui_damage();
+void ui_damage_rect(int x, int y, int w, int h);
+int ui_damage_bounds(int *x, int *y, int *w, int *h);
+void ui_damage_bounds_reset();
+
+// is a re-render pending? used by the idle detector
+int ui_is_damaged();
+
+// lock free queries for the low level input hooks: is the point over the
+// UI (or input captured), and does anything have keyboard focus
+int ui_hit_test_fast(int x, int y);
+int ui_has_focus_fast();
+
+// advances once per re-render; containers cache their preferred size for
+// the duration of a layout pass keyed by this
+uint64_t ui_layout_generation();
+
+// cull rectangle stack for virtualized scrolling: containers skip drawing
+// children entirely outside the innermost rect
+void ui_push_cull_rect(int x, int y, int w, int h);
+void ui_pop_cull_rect();
+int ui_rect_culled(int x, int y, int w, int h);
+
+// size class pooled allocation for element structs and other small, high
+// churn UI allocations. size must be the same value at alloc and free
+void *ui_element_alloc(size_t size);
+void ui_element_pool_free(void *ptr, size_t size);
+
 void ui_capture_mouse_events(ui_element_t *element, int offset_x, int offset_y);
 void ui_release_mouse_events(ui_element_t *element);
 
@@ -52,6 +52,19 @@ struct ui_window_s {
     ui_color_t border_hl_color;
     ui_color_t titlebar_text_color;
 
+    // cached chrome geometry, rebuilt on position/size/state changes
+    ui_rect_instance_t chrome[6];
+    size_t chrome_count;
+    int chrome_x;
+    int chrome_y;
+    int chrome_w;
+    int chrome_h;
+    int chrome_highlight;
+    int chrome_resizer;
+    int chrome_titlebar;
+    ui_color_t chrome_bg;
+    ui_color_t chrome_border;
+
     int shown;
 };
 
@@ -71,21 +84,52 @@ static void ui_window_draw_decorations(ui_window_t *win, int offset_x, int offse
     int win_x = offset_x + win->element.x;
     int win_y = offset_y + win->element.y;
 
-    // background
-    ui_rect_draw(win_x, win_y, win->element.width, win->element.height, win->bg_color, proj);
+    // the chrome geometry (background, borders, titlebar, resizer) is
+    // rebuilt only when position, size, or the highlight/resizer states
+    // change, and submitted to the batched rect pipeline in one append
+    if (win_x!=win->chrome_x || win_y!=win->chrome_y ||
+        win->element.width!=win->chrome_w || win->element.height!=win->chrome_h ||
+        win->highlight_title!=win->chrome_highlight ||
+        (win->resizable && win->draw_resizer)!=win->chrome_resizer ||
+        win->showtitlebar!=win->chrome_titlebar ||
+        win->bg_color!=win->chrome_bg ||
+        win->border_color!=win->chrome_border
+    ) {
+        int n = 0;
 
-    // borders
-    ui_rect_draw(win_x, win_y, 1, win->element.height, win->border_color, proj); // left
-    ui_rect_draw(win_x, win_y + win->element.height - 1, win->element.width, 1, win->border_color, proj); // bottom
-    ui_rect_draw(win_x + win->element.width - 1, win_y, 1, win->element.height, win->border_color, proj); // right
+        ui_rect_instance(&win->chrome[n++], win_x, win_y, win->element.width, win->element.height, win->bg_color);
 
-    if (win->showtitlebar) {
-        int titlebar_height = win->child_y_offset - 1;
+        ui_rect_instance(&win->chrome[n++], win_x, win_y, 1, win->element.height, win->border_color); // left
+        ui_rect_instance(&win->chrome[n++], win_x, win_y + win->element.height - 1, win->element.width, 1, win->border_color); // bottom
+        ui_rect_instance(&win->chrome[n++], win_x + win->element.width - 1, win_y, 1, win->element.height, win->border_color); // right
 
-        // titlebar
-        ui_rect_draw(win_x, win_y, win->element.width, titlebar_height, 
-                     win->highlight_title ? win->border_hl_color : win->border_color, proj);
+        if (win->showtitlebar) {
+            ui_rect_instance(&win->chrome[n++], win_x, win_y, win->element.width, win->child_y_offset - 1,
+                             win->highlight_title ? win->border_hl_color : win->border_color);
+        } else {
+            ui_rect_instance(&win->chrome[n++], win_x, win_y, win->element.width, 1, win->border_color); // top
+        }
 
+        if (win->resizable && win->draw_resizer) {
+            ui_rect_instance(&win->chrome[n++], win_x + win->element.width - 11, win_y + win->element.height - 11,
+                             10, 10, win->border_hl_color);
+        }
+
+        win->chrome_count = n;
+        win->chrome_x = win_x;
+        win->chrome_y = win_y;
+        win->chrome_w = win->element.width;
+        win->chrome_h = win->element.height;
+        win->chrome_highlight = win->highlight_title;
+        win->chrome_resizer = win->resizable && win->draw_resizer;
+        win->chrome_titlebar = win->showtitlebar;
+        win->chrome_bg = win->bg_color;
+        win->chrome_border = win->border_color;
+    }
+
+    ui_rect_draw_cached(win->chrome, win->chrome_count, proj);
+
+    if (win->showtitlebar) {
         // caption
         int old_scissor[4];
         push_scissor(win_x + 1, win_y + 1, win->element.width - 2, win->child_y_offset - 2, old_scissor);
@@ -93,20 +137,11 @@ static void ui_window_draw_decorations(ui_window_t *win, int offset_x, int offse
         ui_font_render_text(win_font, proj, win_x + 3, win_y + 3, win->caption, strlen(win->caption), win->titlebar_text_color);
 
         pop_scissor(old_scissor);
-    } else {
-        // top border
-        ui_rect_draw(win_x, win_y, win->element.width, 1, win->border_color, proj);
-    }
-
-    // resize box
-    if (win->resizable && win->draw_resizer) {
-        ui_rect_draw(win_x + win->element.width - 11, win_y + win->element.height - 11,
-                     10, 10, win->border_hl_color, proj);
     }
 }
 
 ui_window_t *ui_window_new(const char *caption, int x, int y) {
-    ui_window_t *win = egoverlay_calloc(1, sizeof(ui_window_t));
+    ui_window_t *win = ui_element_alloc(sizeof(ui_window_t));
 
     win->caption = egoverlay_calloc(strlen(caption)+1, sizeof(char));
     memcpy(win->caption, caption, strlen(caption));
@@ -157,7 +192,7 @@ void ui_window_free(ui_window_t *window) {
     if (window->settings_path) egoverlay_free(window->settings_path);
 
     egoverlay_free(window->caption);
-    egoverlay_free(window);
+    ui_element_pool_free(window, sizeof(ui_window_t));
 }
 
 void ui_window_draw(ui_window_t *win, int offset_x, int offset_y, mat4f_t *proj) {
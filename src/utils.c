@@ -1,6 +1,8 @@
 #include "app.h"
 #include "utils.h"
 #include "logging/logger.h"
+#include "ui/font.h"
+#include "ui/rect.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
@@ -43,7 +45,21 @@ uint32_t djb2_hash_string(const char *string) {
     return hash;
 }
 
+// same as djb2_hash_string, but for binary data that may contain NULs
+uint32_t djb2_hash_data(const uint8_t *data, size_t length) {
+    uint32_t hash = 5381;
+
+    for (size_t i=0;i<length;i++)
+        hash = ((hash << 5) + hash) + data[i];
+
+    return hash;
+}
+
 void push_child_viewport(int x, int y, int w, int h, int *old_vp, mat4f_t *vp_proj) {
+    // batched draws have to land under the viewport they were submitted with
+    ui_rect_flush();
+    ui_font_flush();
+
     glGetIntegerv(GL_VIEWPORT, old_vp);
 
     int fb_w, fb_h;
@@ -59,11 +75,13 @@ void push_child_viewport(int x, int y, int w, int h, int *old_vp, mat4f_t *vp_pr
 }
 
 void pop_child_viewport(int *old_vp) {
+    ui_rect_flush();
+    ui_font_flush();
+
     glViewport(old_vp[0], old_vp[1], old_vp[2], old_vp[3]);
 }
 
 int push_scissor(int x, int y, int width, int height, int *old_scissor) {
-    
     glGetIntegerv(GL_SCISSOR_BOX, old_scissor);
 
     int fb_w, fb_h;
@@ -89,12 +107,34 @@ int push_scissor(int x, int y, int width, int height, int *old_scissor) {
 
     if (sh <= 0 || sw <=0) return 0;
 
+    // widgets routinely push the same region their parent already set. when
+    // the clip doesn't actually change there's nothing to set and, more
+    // importantly, no reason to break the rect/text batches
+    if (sx==old_scissor[0] && sy==old_scissor[1] && sw==old_scissor[2] && sh==old_scissor[3]) {
+        return 1;
+    }
+
+    // batched draws have to land under the scissor they were submitted with
+    ui_rect_flush();
+    ui_font_flush();
+
     glScissor(sx, sy, sw, sh);
 
     return 1;
 }
 
 void pop_scissor(int *old_scissor) {
+    int cur[4] = {0};
+    glGetIntegerv(GL_SCISSOR_BOX, cur);
+
+    // nothing changed since the matching push, keep the batches intact
+    if (cur[0]==old_scissor[0] && cur[1]==old_scissor[1] && cur[2]==old_scissor[2] && cur[3]==old_scissor[3]) {
+        return;
+    }
+
+    ui_rect_flush();
+    ui_font_flush();
+
     glScissor(old_scissor[0], old_scissor[1], old_scissor[2], old_scissor[3]);
 }
 
@@ -129,3 +169,86 @@ char *wchar_to_char(wchar_t *wstr) {
 
     return str;
 }
+
+// Shared string interning. Names that cross subsystems (texture keys, event
+// names, category ids) get one canonical heap copy, so holders can compare
+// by pointer and skip per-lookup strdup/strcmp. Interned strings live for
+// the process; never free them.
+#define INTERN_INITIAL_SIZE 256
+
+static char **intern_table = NULL;
+static size_t intern_capacity = 0;
+static size_t intern_count = 0;
+static CRITICAL_SECTION intern_cs;
+static INIT_ONCE intern_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK intern_init(PINIT_ONCE once, PVOID param, PVOID *context) {
+    UNUSED_PARAM(once);
+    UNUSED_PARAM(param);
+    UNUSED_PARAM(context);
+
+    InitializeCriticalSection(&intern_cs);
+    intern_capacity = INTERN_INITIAL_SIZE;
+    intern_table = egoverlay_calloc(intern_capacity, sizeof(char*));
+
+    return TRUE;
+}
+
+// free the intern table at shutdown so the CRT leak dump stays clean.
+// nothing may use interned pointers after this
+void eg_intern_cleanup() {
+    if (!intern_table) return;
+
+    for (size_t i=0;i<intern_capacity;i++) {
+        if (intern_table[i]) egoverlay_free(intern_table[i]);
+    }
+    egoverlay_free(intern_table);
+    intern_table = NULL;
+    intern_capacity = 0;
+    intern_count = 0;
+}
+
+const char *eg_intern(const char *s) {
+    InitOnceExecuteOnce(&intern_once, &intern_init, NULL, NULL);
+
+    uint32_t hash = djb2_hash_string(s);
+
+    EnterCriticalSection(&intern_cs);
+
+    if (intern_count * 2 >= intern_capacity) {
+        size_t newcap = intern_capacity * 2;
+        char **newtable = egoverlay_calloc(newcap, sizeof(char*));
+
+        for (size_t i=0;i<intern_capacity;i++) {
+            if (!intern_table[i]) continue;
+
+            size_t ind = djb2_hash_string(intern_table[i]) % newcap;
+            while (newtable[ind]) ind = (ind + 1) % newcap;
+            newtable[ind] = intern_table[i];
+        }
+
+        egoverlay_free(intern_table);
+        intern_table = newtable;
+        intern_capacity = newcap;
+    }
+
+    size_t ind = hash % intern_capacity;
+    while (intern_table[ind]) {
+        if (strcmp(intern_table[ind], s)==0) {
+            const char *r = intern_table[ind];
+            LeaveCriticalSection(&intern_cs);
+            return r;
+        }
+        ind = (ind + 1) % intern_capacity;
+    }
+
+    size_t len = strlen(s);
+    intern_table[ind] = egoverlay_calloc(len+1, sizeof(char));
+    memcpy(intern_table[ind], s, len);
+    intern_count++;
+
+    const char *r = intern_table[ind];
+    LeaveCriticalSection(&intern_cs);
+
+    return r;
+}
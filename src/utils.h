@@ -13,6 +13,12 @@
 char *load_file(const char *path, size_t *length);
 
 uint32_t djb2_hash_string(const char *string);
+uint32_t djb2_hash_data(const uint8_t *data, size_t length);
+
+// canonical shared copy of a string; interned strings compare by pointer
+// and live for the whole process (never free them)
+const char *eg_intern(const char *s);
+void eg_intern_cleanup();
 
 void push_child_viewport(int x, int y, int w, int h, int *old_vp, mat4f_t *vp_proj);
 void pop_child_viewport(int *old_vp);
@@ -2,14 +2,21 @@
 #include "logging/logger.h"
 #include "utils.h"
 #include "lua-manager.h"
+#include "app.h"
+#include "settings.h"
+#include "profiler.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include <curl/curl.h>
+#include <zlib.h>
 #include <windows.h>
 #include <lua.h>
 #include <lauxlib.h>
 
-static CURL *curl = NULL;
 static logger_t *logger = NULL;
+static long max_concurrent_requests = 6;
+static long connect_timeout_seconds = 10;
+static long stall_timeout_seconds = 30;
 static HANDLE request_thread = NULL;
 static DWORD request_thread_id = 0;
 static int stop_thread = 0;
@@ -19,6 +26,23 @@ typedef struct web_request_list_t {
     web_request_callback *cb;
     int cbi;
     int requesti;
+
+    // scheduling: 0 = high, 1 = normal, 2 = background. filled from the
+    // request when it's queued
+    int priority;
+    char *host;
+    int retries;
+
+    // streaming: chunk callback ref. when set, response data is delivered
+    // to Lua chunk by chunk as it arrives instead of buffering the body,
+    // and cbi (if any) is called with just the response code at the end
+    int streamcbi;
+
+    // download-to-file: body bytes go straight to this path on the worker
+    // thread (preallocated when the server reports a length); the callback
+    // receives the path instead of the body
+    char *download_path;
+
     char *source;
     struct web_request_list_t *next;
 } web_request_list_t;
@@ -27,6 +51,8 @@ static web_request_list_t *request_queue = NULL;
 HANDLE queue_mutex = NULL;
 
 static DWORD WINAPI web_request_thread(LPVOID lpParam);
+static void web_cache_peer_init();
+static void web_cache_peer_cleanup();
 
 typedef struct web_request_value_list_t {
     char *name;
@@ -34,12 +60,22 @@ typedef struct web_request_value_list_t {
     struct web_request_value_list_t *next;
 } web_request_value_list_t;
 
+static web_request_value_list_t *web_request_value_list_new_item(const char *name, const char *value);
+static void web_request_value_list_add_item(web_request_value_list_t **list, web_request_value_list_t *item);
+static void web_request_hold_host(const char *host, double seconds);
+
 struct web_request_t {
     char *url;
 
     web_request_value_list_t *headers;
     web_request_value_list_t *query_params;
 
+    // response headers captured at completion; readable from the done
+    // callback via request:responseheader(name)
+    web_request_value_list_t *response_headers;
+
+    int priority; // 0 = high, 1 = normal (default), 2 = background
+
     int free_after_perform;
 };
 
@@ -47,18 +83,42 @@ void lua_pushwebrequest(lua_State *L, web_request_t *request, int lua_managed);
 web_request_t *lua_checkwebrequest(lua_State *L, int ind);
 int web_request_lua_open_module(lua_State *L);
 
+// curl_global_init (schannel setup, etc.) is one of the slower independent
+// startup stages; app_init runs it on a worker thread overlapping the rest
+// of initialization and web_request_init only verifies the result
+static CURLcode curl_global_result = CURLE_FAILED_INIT;
+
+void web_request_global_init() {
+    curl_global_result = curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
 void web_request_init() {
     logger = logger_get("web-request");
 
-    if (curl_global_init(CURL_GLOBAL_DEFAULT)!=CURLE_OK) {
+    settings_set_default_int(app_get_settings(), "overlay.peerCachePort", 0);
+
+    if (curl_global_result!=CURLE_OK) {
         logger_error(logger, "Error while performing curl_global_init.");
         error_and_exit("EG-Overlay: Web Request", "Error while performing curl_global_init.");
     }
 
-    curl = curl_easy_init();
-    if (curl==NULL) {
-        logger_error(logger, "Error while performing curl_easy_init.");
-        error_and_exit("EG-Overlay: Web Request", "Error while performing curl_easy_init.");
+    settings_t *app_settings = app_get_settings();
+    settings_set_default_int(app_settings, "overlay.webRequestConcurrency", 6);
+
+    int concurrency = 6;
+    GET_APP_SETTING_INT("overlay.webRequestConcurrency", &concurrency);
+    if (concurrency < 1) concurrency = 1;
+    max_concurrent_requests = concurrency;
+
+    settings_set_default_int(app_settings, "overlay.webRequestConnectTimeout", 10);
+    settings_set_default_int(app_settings, "overlay.webRequestStallTimeout", 30);
+
+    int timeout = 0;
+    if (GET_APP_SETTING_INT("overlay.webRequestConnectTimeout", &timeout) && timeout > 0) {
+        connect_timeout_seconds = timeout;
+    }
+    if (GET_APP_SETTING_INT("overlay.webRequestStallTimeout", &timeout) && timeout > 0) {
+        stall_timeout_seconds = timeout;
     }
 
     queue_mutex = CreateMutex(0, FALSE, NULL);
@@ -73,6 +133,8 @@ void web_request_init() {
         error_and_exit("EG-Overlay: Web Request", "Couldn't create request thread.");
     }
 
+    web_cache_peer_init();
+
     lua_manager_add_module_opener("web-request", &web_request_lua_open_module);
 }
 
@@ -83,29 +145,31 @@ void web_request_cleanup() {
 
     CloseHandle(queue_mutex);
 
-    curl_easy_cleanup(curl);
+    web_cache_peer_cleanup();
+
     curl_global_cleanup();
 }
 
-static size_t web_request_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-    UNUSED_PARAM(size);
+struct web_request_lua_chunk_data {
+    int cbi; // the shared chunk callback ref; unreffed by the done event
+    char *data;
+    size_t len;
+};
 
-    // naive but should work for text response data just fine
+static int web_request_run_lua_chunk(lua_State *L, struct web_request_lua_chunk_data *chunk) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, chunk->cbi);
+    lua_pushlstring(L, chunk->data, chunk->len);
 
-    char **data = (char**)userdata;
-    size_t cur_len = (*data) ? strlen(*data) : 0;
-    size_t new_len = cur_len + nmemb + 1;
+    egoverlay_free(chunk->data);
+    egoverlay_free(chunk);
 
-    *data = egoverlay_realloc(*data, new_len);
-    //if (cur_len) memcpy(new_data, *data, cur_len);
-    memcpy((*data) + cur_len, ptr, nmemb);
-    (*data)[new_len-1] = 0;
+    return 1;
+}
 
-    //free(*data);
-    //*data = new_data;
+// forward declaration, the write callback needs the active request
+typedef struct active_request_t active_request_t;
 
-    return nmemb;
-}
+static size_t web_request_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
 
 struct web_request_lua_callback_data {
     web_request_t *req;
@@ -113,13 +177,14 @@ struct web_request_lua_callback_data {
     int cbi;
     long http_code;
     char *data;
+    size_t data_len; // bodies can be binary, never strlen them
 };
 
 static int web_request_run_lua_callback(lua_State *L, struct web_request_lua_callback_data *data) {
     lua_rawgeti(L, LUA_REGISTRYINDEX, data->cbi);
 
     lua_pushinteger(L, data->http_code);
-    lua_pushstring(L, data->data);
+    lua_pushlstring(L, data->data, data->data_len);
     lua_pushwebrequest(L, data->req, 0);
 
     /*
@@ -140,12 +205,597 @@ static int web_request_run_lua_callback(lua_State *L, struct web_request_lua_cal
     return 3;
 }
 
-static void web_request_perform(web_request_list_t *req) {
+// an in-flight request on the multi handle
+struct active_request_t {
+    CURL *easy;
+    CURLU *url;
+    struct curl_slist *hdrs;
+    char *data;
+    size_t data_len;
+
+    // response decompression (gzip/deflate), done here on the request
+    // thread so callers always see decoded bodies
+    z_stream zstrm;
+    int zchecked;
+    int zactive;
+
+    // the final request URL, used as the response cache key
+    char *cache_url;
+
+    // download-to-file target, opened on the first body byte
+    HANDLE out_file;
+    int out_file_opened;
+
+    double start_time; // for trace spans
+
+    web_request_list_t *req;
+
+    struct active_request_t *next;
+};
+
+// Is the response body compressed? Valid once headers have arrived, which
+// is always true inside the write callback.
+static int web_request_is_compressed(CURL *easy) {
+    struct curl_header *h = NULL;
+
+    if (curl_easy_header(easy, "Content-Encoding", 0, CURLH_HEADER, -1, &h)!=CURLHE_OK) return 0;
+
+    return strstr(h->value, "gzip")!=NULL || strstr(h->value, "deflate")!=NULL;
+}
+
+// download-to-file: append bytes to the request's target, opening and
+// preallocating the file on the first byte. returns 0 to abort the transfer
+static int web_request_write_file_bytes(active_request_t *a, const uint8_t *bytes, size_t len) {
+    if (!a->out_file_opened) {
+        a->out_file_opened = 1;
+        a->out_file = CreateFile(
+            a->req->download_path,
+            GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+        );
+
+        if (a->out_file==INVALID_HANDLE_VALUE) {
+            logger_error(logger, "Couldn't open %s for download.", a->req->download_path);
+            return 0;
+        }
+
+        // preallocate when the server told us how big the body is, so a
+        // large pack lands in sequential, unfragmented writes
+        curl_off_t total = 0;
+        if (curl_easy_getinfo(a->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &total)==CURLE_OK && total > 0) {
+            LARGE_INTEGER size;
+            size.QuadPart = total;
+            if (SetFilePointerEx(a->out_file, size, NULL, FILE_BEGIN)) {
+                SetEndOfFile(a->out_file);
+                size.QuadPart = 0;
+                SetFilePointerEx(a->out_file, size, NULL, FILE_BEGIN);
+            }
+        }
+    }
+
+    if (a->out_file==INVALID_HANDLE_VALUE) return 0;
+
+    DWORD written = 0;
+    if (!WriteFile(a->out_file, bytes, (DWORD)len, &written, NULL) || written!=len) {
+        logger_error(logger, "Short write to %s.", a->req->download_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+static size_t web_request_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    UNUSED_PARAM(size);
+
+    active_request_t *a = (active_request_t*)userdata;
+
+    if (!a->zchecked) {
+        a->zchecked = 1;
+
+        if (web_request_is_compressed(a->easy)) {
+            // 15+32: auto-detect gzip or zlib wrapping
+            if (inflateInit2(&a->zstrm, 15 + 32)==Z_OK) a->zactive = 1;
+        }
+    }
+
+    if (a->zactive) {
+        // decompress as data arrives; output goes through the same paths
+        // (chunk events or the buffered body) as plain responses
+        a->zstrm.next_in = (Bytef*)ptr;
+        a->zstrm.avail_in = (uInt)nmemb;
+
+        uint8_t out[16384];
+
+        while (a->zstrm.avail_in) {
+            a->zstrm.next_out = out;
+            a->zstrm.avail_out = sizeof(out);
+
+            int zr = inflate(&a->zstrm, Z_NO_FLUSH);
+            if (zr!=Z_OK && zr!=Z_STREAM_END && zr!=Z_BUF_ERROR) {
+                logger_error(logger, "Error decompressing response body.");
+                return 0; // abort the transfer
+            }
+
+            size_t produced = sizeof(out) - a->zstrm.avail_out;
+
+            if (produced) {
+                if (a->req->download_path) {
+                    // decoded bytes land in the file like plain bodies do;
+                    // recurse through the plain path's file branch
+                    if (web_request_write_file_bytes(a, out, produced)==0) return 0;
+                } else if (a->req->streamcbi) {
+                    struct web_request_lua_chunk_data *chunk =
+                        egoverlay_calloc(1, sizeof(struct web_request_lua_chunk_data));
+                    chunk->cbi = a->req->streamcbi;
+                    chunk->data = egoverlay_malloc(produced);
+                    memcpy(chunk->data, out, produced);
+                    chunk->len = produced;
+
+                    lua_manager_add_event_callback(&web_request_run_lua_chunk, chunk);
+                } else {
+                    size_t new_len = a->data_len + produced + 1;
+
+                    a->data = egoverlay_realloc(a->data, new_len);
+                    memcpy(a->data + a->data_len, out, produced);
+                    a->data[new_len-1] = 0;
+                    a->data_len += produced;
+                }
+            }
+
+            if (zr==Z_STREAM_END) break;
+            if (zr==Z_BUF_ERROR && produced==0) break;
+        }
+
+        return nmemb;
+    }
+
+    if (a->req->download_path) {
+        if (web_request_write_file_bytes(a, (const uint8_t*)ptr, nmemb)==0) return 0;
+
+        return nmemb;
+    }
+
+    if (a->req->streamcbi) {
+        // deliver the chunk straight to Lua; nothing is buffered here
+        struct web_request_lua_chunk_data *chunk = egoverlay_calloc(1, sizeof(struct web_request_lua_chunk_data));
+        chunk->cbi = a->req->streamcbi;
+        chunk->data = egoverlay_malloc(nmemb);
+        memcpy(chunk->data, ptr, nmemb);
+        chunk->len = nmemb;
+
+        lua_manager_add_event_callback(&web_request_run_lua_chunk, chunk);
+
+        return nmemb;
+    }
+
+    size_t new_len = a->data_len + nmemb + 1;
+
+    a->data = egoverlay_realloc(a->data, new_len);
+    memcpy(a->data + a->data_len, ptr, nmemb);
+    a->data[new_len-1] = 0;
+    a->data_len += nmemb;
+
+    return nmemb;
+}
+
+// On-disk response cache. Responses that carry an ETag or Last-Modified
+// header are stored under web-cache/ keyed by a hash of the URL; later
+// requests to the same URL send the validators and a 304 is served from the
+// cached body without re-downloading.
+typedef struct {
+    char magic[4]; // EGWC
+    char etag[256];
+    char lastmod[128];
+    uint32_t urllen;
+} web_cache_header_t;
+
+static void web_cache_path(char *buf, size_t buflen, const char *url) {
+    snprintf(buf, buflen, "web-cache/%08x.egwc", djb2_hash_string(url));
+}
+
+// Read the stored validators for url. Returns 1 when a cache entry exists.
+static int web_cache_validators(const char *url, char *etag, size_t etaglen, char *lastmod, size_t lastmodlen) {
+    char path[64];
+    web_cache_path(path, sizeof(path), url);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+
+    web_cache_header_t header = {0};
+    if (fread(&header, sizeof(header), 1, f)!=1 || memcmp(header.magic, "EGWC", 4)!=0) {
+        fclose(f);
+        return 0;
+    }
+
+    // hash collision check: the stored url has to match
+    char *stored_url = egoverlay_calloc(header.urllen + 1, sizeof(char));
+    size_t r = fread(stored_url, 1, header.urllen, f);
+    fclose(f);
+
+    int match = r==header.urllen && strcmp(stored_url, url)==0;
+    egoverlay_free(stored_url);
+
+    if (!match) return 0;
+
+    snprintf(etag, etaglen, "%s", header.etag);
+    snprintf(lastmod, lastmodlen, "%s", header.lastmod);
+
+    return 1;
+}
+
+// Read the cached body for url, or NULL.
+static char *web_cache_body(const char *url, size_t *length) {
+    char path[64];
+    web_cache_path(path, sizeof(path), url);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    web_cache_header_t header = {0};
+    if (fread(&header, sizeof(header), 1, f)!=1 || memcmp(header.magic, "EGWC", 4)!=0) {
+        fclose(f);
+        return NULL;
+    }
+
+    fseek(f, header.urllen, SEEK_CUR);
+
+    long body_start = ftell(f);
+    fseek(f, 0, SEEK_END);
+    long body_len = ftell(f) - body_start;
+    fseek(f, body_start, SEEK_SET);
+
+    if (body_len < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    char *body = egoverlay_calloc(body_len + 1, sizeof(char));
+    fread(body, 1, body_len, f);
+    fclose(f);
+
+    if (length) *length = (size_t)body_len;
+
+    return body;
+}
+
+static void web_cache_store(const char *url, const char *etag, const char *lastmod, const char *body, size_t body_len) {
+    CreateDirectory("web-cache", NULL);
+
+    char path[64];
+    web_cache_path(path, sizeof(path), url);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+
+    web_cache_header_t header = {0};
+    memcpy(header.magic, "EGWC", 4);
+    if (etag) snprintf(header.etag, sizeof(header.etag), "%s", etag);
+    if (lastmod) snprintf(header.lastmod, sizeof(header.lastmod), "%s", lastmod);
+    header.urllen = (uint32_t)strlen(url);
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(url, 1, header.urllen, f);
+    fwrite(body, 1, body_len, f);
+
+    fclose(f);
+}
+
+// LAN peer cache. Multi-seat deployments point overlay.peerCacheUrl at a
+// sibling seat's responder (overlay.peerCachePort); before a cold request
+// goes to the internet, the sibling's cache entry for the URL is fetched
+// and stored locally, so the origin request becomes a cheap revalidation
+// (304) instead of a full download. Entries transfer as whole EGWC records,
+// validators included, so correctness still rests on origin revalidation.
+
+static char *peer_cache_url = NULL; // e.g. http://192.168.1.20:7680
+
+// Fetch web-cache/<hash>.egwc from the peer and store it locally. Runs on
+// the request worker thread with a short timeout so a dead peer costs
+// little. Returns 1 when the local cache was primed.
+static int web_cache_peer_prime(const char *url) {
+    if (!peer_cache_url || !peer_cache_url[0]) return 0;
+
+    char path[64];
+    web_cache_path(path, sizeof(path), url);
+
+    char peerurl[512];
+    snprintf(peerurl, sizeof(peerurl), "%s/%08x.egwc", peer_cache_url, djb2_hash_string(url));
+
+    char tmppath[80];
+    snprintf(tmppath, sizeof(tmppath), "%s.peer", path);
+
+    CreateDirectory("web-cache", NULL);
+
+    FILE *out = fopen(tmppath, "wb");
+    if (!out) return 0;
+
+    CURL *easy = curl_easy_init();
+    curl_easy_setopt(easy, CURLOPT_URL, peerurl);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, NULL); // default fwrite
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, out);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, 250L);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, 5000L);
+
+    CURLcode r = curl_easy_perform(easy);
+
+    long code = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(easy);
+    fclose(out);
+
+    if (r!=CURLE_OK || code!=200) {
+        remove(tmppath);
+        return 0;
+    }
+
+    // validate the record before adopting it: EGWC magic and matching url
+    FILE *f = fopen(tmppath, "rb");
+    if (!f) return 0;
+
+    web_cache_header_t header = {0};
+    int ok = fread(&header, sizeof(header), 1, f)==1 && memcmp(header.magic, "EGWC", 4)==0;
+
+    if (ok) {
+        char *stored_url = egoverlay_calloc(header.urllen + 1, sizeof(char));
+        ok = fread(stored_url, 1, header.urllen, f)==header.urllen && strcmp(stored_url, url)==0;
+        egoverlay_free(stored_url);
+    }
+    fclose(f);
+
+    if (!ok) {
+        remove(tmppath);
+        return 0;
+    }
+
+    remove(path);
+    if (rename(tmppath, path)!=0) {
+        remove(tmppath);
+        return 0;
+    }
+
+    logger_info(logger, "peer cache primed %s", url);
+
+    return 1;
+}
+
+// The serving side: a minimal HTTP responder over web-cache/. Only
+// GET /<8 hex>.egwc is answered; anything else is a 404. One request per
+// connection, HTTP/1.0 style.
+static SOCKET peer_serve_socket = INVALID_SOCKET;
+static HANDLE peer_serve_thread = NULL;
+static volatile LONG peer_serve_stop = 0;
+
+static DWORD WINAPI web_cache_peer_serve_fn(LPVOID param) {
+    UNUSED_PARAM(param);
+
+    while (!peer_serve_stop) {
+        SOCKET client = accept(peer_serve_socket, NULL, NULL);
+        if (client==INVALID_SOCKET) break;
+
+        char reqbuf[512] = {0};
+        int got = recv(client, reqbuf, sizeof(reqbuf)-1, 0);
+
+        char name[32] = {0};
+        int valid = 0;
+
+        if (got > 0 && sscanf(reqbuf, "GET /%31s", name)==1 && strlen(name)==13) {
+            valid = strspn(name, "0123456789abcdef")==8 && strcmp(name + 8, ".egwc")==0;
+        }
+
+        if (valid) {
+            char path[64];
+            snprintf(path, sizeof(path), "web-cache/%s", name);
+
+            size_t len = 0;
+            char *data = load_file(path, &len);
+
+            if (data) {
+                char hdr[128];
+                int hlen = snprintf(
+                    hdr, sizeof(hdr),
+                    "HTTP/1.0 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                    len
+                );
+                send(client, hdr, hlen, 0);
+
+                size_t off = 0;
+                while (off < len) {
+                    int sent = send(client, data + off, (int)(len - off), 0);
+                    if (sent<=0) break;
+                    off += sent;
+                }
+
+                egoverlay_free(data);
+            } else {
+                valid = 0;
+            }
+        }
+
+        if (!valid) {
+            const char *resp = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
+            send(client, resp, (int)strlen(resp), 0);
+        }
+
+        closesocket(client);
+    }
+
+    return 0;
+}
+
+static void web_cache_peer_init() {
+    const char *peerurl = NULL;
+    GET_APP_SETTING_STR("overlay.peerCacheUrl", &peerurl);
+
+    if (peerurl && peerurl[0]) {
+        peer_cache_url = egoverlay_calloc(strlen(peerurl)+1, sizeof(char));
+        memcpy(peer_cache_url, peerurl, strlen(peerurl));
+        logger_info(logger, "peer cache: %s", peer_cache_url);
+    }
+
+    int port = 0;
+    GET_APP_SETTING_INT("overlay.peerCachePort", &port);
+
+    if (port > 0 && port < 65536) {
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+
+        peer_serve_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons((u_short)port);
+
+        if (bind(peer_serve_socket, (struct sockaddr*)&addr, sizeof(addr))==0 &&
+            listen(peer_serve_socket, 8)==0
+        ) {
+            DWORD tid = 0;
+            peer_serve_thread = CreateThread(0, 0, &web_cache_peer_serve_fn, NULL, 0, &tid);
+            logger_info(logger, "peer cache responder on port %d", port);
+        } else {
+            logger_error(logger, "Couldn't bind peer cache responder to port %d.", port);
+            closesocket(peer_serve_socket);
+            peer_serve_socket = INVALID_SOCKET;
+        }
+    }
+}
+
+static void web_cache_peer_cleanup() {
+    if (peer_serve_thread) {
+        InterlockedExchange(&peer_serve_stop, 1);
+        closesocket(peer_serve_socket); // unblocks accept
+        WaitForSingleObject(peer_serve_thread, INFINITE);
+        CloseHandle(peer_serve_thread);
+        peer_serve_thread = NULL;
+        peer_serve_socket = INVALID_SOCKET;
+    }
+
+    if (peer_cache_url) {
+        egoverlay_free(peer_cache_url);
+        peer_cache_url = NULL;
+    }
+}
+
+// Configure an easy handle for req and add it to the multi handle.
+// Persisted DNS cache and connection pre-warming. Resolved addresses are
+// saved across runs and preloaded into curl (as overridable entries, so a
+// changed address still re-resolves after the cache timeout), and a throw
+// away request to the GW2 API is queued at startup so DNS + TCP + TLS are
+// already set up when the first real request goes out.
+#define DNS_CACHE_MAX 8
+
+typedef struct {
+    char host[128];
+    char ip[64];
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[DNS_CACHE_MAX];
+static int dns_cache_count = 0;
+static int dns_cache_dirty = 0;
+static struct curl_slist *dns_resolve_list = NULL;
+
+static void web_request_load_dns_cache() {
+    FILE *f = fopen("web-cache/dns.txt", "r");
+    if (!f) return;
+
+    char line[256];
+    while (dns_cache_count < DNS_CACHE_MAX && fgets(line, sizeof(line), f)) {
+        dns_cache_entry_t *e = &dns_cache[dns_cache_count];
+
+        if (sscanf(line, "%127s %63s", e->host, e->ip)==2) {
+            char resolve[256];
+            snprintf(resolve, sizeof(resolve), "+%s:443:%s", e->host, e->ip);
+            dns_resolve_list = curl_slist_append(dns_resolve_list, resolve);
+            dns_cache_count++;
+        }
+    }
+
+    fclose(f);
+}
+
+static void web_request_save_dns_cache() {
+    if (!dns_cache_dirty) return;
+
+    CreateDirectory("web-cache", NULL);
+
+    FILE *f = fopen("web-cache/dns.txt", "w");
+    if (!f) return;
+
+    for (int i=0;i<dns_cache_count;i++) {
+        fprintf(f, "%s %s\n", dns_cache[i].host, dns_cache[i].ip);
+    }
+
+    fclose(f);
+    dns_cache_dirty = 0;
+}
+
+static void web_request_record_dns(CURL *easy, CURLU *url) {
+    char *ip = NULL;
+    if (curl_easy_getinfo(easy, CURLINFO_PRIMARY_IP, &ip)!=CURLE_OK || !ip || !ip[0]) return;
+
+    char *host = NULL;
+    if (curl_url_get(url, CURLUPART_HOST, &host, 0)!=CURLUE_OK || !host) return;
+
+    for (int i=0;i<dns_cache_count;i++) {
+        if (strcmp(dns_cache[i].host, host)==0) {
+            if (strcmp(dns_cache[i].ip, ip)!=0) {
+                snprintf(dns_cache[i].ip, sizeof(dns_cache[i].ip), "%s", ip);
+                dns_cache_dirty = 1;
+            }
+            curl_free(host);
+            return;
+        }
+    }
+
+    if (dns_cache_count < DNS_CACHE_MAX) {
+        dns_cache_entry_t *e = &dns_cache[dns_cache_count];
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        snprintf(e->ip, sizeof(e->ip), "%s", ip);
+        dns_cache_count++;
+        dns_cache_dirty = 1;
+    }
+
+    curl_free(host);
+}
+
+struct web_request_lua_stream_done_data {
+    int streamcbi;
+    int donecbi;
+    int reqi;
+    long http_code;
+    web_request_t *req;
+};
+
+static int web_request_run_lua_stream_done(lua_State *L, struct web_request_lua_stream_done_data *data) {
+    // all chunk events were queued before this one, the chunk callback can
+    // be released now
+    luaL_unref(L, LUA_REGISTRYINDEX, data->streamcbi);
+
+    int nargs = 0;
+    if (data->donecbi) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, data->donecbi);
+        lua_pushinteger(L, data->http_code);
+        lua_pushwebrequest(L, data->req, 0);
+        nargs = 2;
+
+        luaL_unref(L, LUA_REGISTRYINDEX, data->donecbi);
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, data->reqi);
+
+    egoverlay_free(data);
+
+    return nargs;
+}
+
+static void web_request_start(CURLM *multi, active_request_t **active, web_request_list_t *req) {
     web_request_t *request = req->request;
-    curl_easy_reset(curl);
 
-    CURLU *url = curl_url();
-    curl_url_set(url, CURLUPART_URL, request->url, CURLU_URLENCODE);
+    active_request_t *a = egoverlay_calloc(1, sizeof(active_request_t));
+    a->req = req;
+    a->easy = curl_easy_init();
+
+    a->url = curl_url();
+    curl_url_set(a->url, CURLUPART_URL, request->url, CURLU_URLENCODE);
 
     web_request_value_list_t *v = request->query_params;
     while (v) {
@@ -156,16 +806,14 @@ static void web_request_perform(web_request_list_t *req) {
         query_param[strlen(v->name)] = '=';
         memcpy(query_param + strlen(v->name)+1, v->value, strlen(v->value));
 
-        curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_URLENCODE | CURLU_APPENDQUERY);
+        curl_url_set(a->url, CURLUPART_QUERY, query_param, CURLU_URLENCODE | CURLU_APPENDQUERY);
 
         egoverlay_free(query_param);
 
         v = v->next;
     }
 
-    curl_easy_setopt(curl, CURLOPT_CURLU, url);
-
-    struct curl_slist *hdrs = NULL;
+    curl_easy_setopt(a->easy, CURLOPT_CURLU, a->url);
 
     v = request->headers;
     while (v) {
@@ -176,25 +824,130 @@ static void web_request_perform(web_request_list_t *req) {
         memcpy(header + strlen(v->name), ": ", 2);
         memcpy(header + strlen(v->name) + 2, v->value, strlen(v->value));
 
-        hdrs = curl_slist_append(hdrs, header);
+        a->hdrs = curl_slist_append(a->hdrs, header);
 
         egoverlay_free(header);
 
         v = v->next;
     }
 
-    if (hdrs) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
+    int have_accept_encoding = 0;
+    for (web_request_value_list_t *h=request->headers;h;h=h->next) {
+        if (_stricmp(h->name, "Accept-Encoding")==0) {
+            have_accept_encoding = 1;
+            break;
+        }
+    }
+    if (!have_accept_encoding) {
+        a->hdrs = curl_slist_append(a->hdrs, "Accept-Encoding: gzip, deflate");
+    }
+
+    // streamed transfers bypass the response cache entirely: the body isn't
+    // buffered, so there'd be nothing to store or to serve on a 304
+    char *effurl = NULL;
+    if (!req->streamcbi && curl_url_get(a->url, CURLUPART_URL, &effurl, 0)==CURLUE_OK) {
+        // the cache key has to vary on authorization, otherwise responses
+        // for different API keys would share an entry
+        const char *auth = "";
+        for (web_request_value_list_t *h=request->headers;h;h=h->next) {
+            if (_stricmp(h->name, "Authorization")==0) {
+                auth = h->value;
+                break;
+            }
+        }
+
+        size_t keylen = strlen(effurl) + strlen(auth) + 2;
+        a->cache_url = egoverlay_calloc(keylen, sizeof(char));
+        snprintf(a->cache_url, keylen, "%s\n%s", effurl, auth);
+        curl_free(effurl);
+
+        char etag[256] = {0};
+        char lastmod[128] = {0};
+
+        // cold locally? ask a LAN sibling for its cache record first so the
+        // origin request below can revalidate instead of re-downloading
+        if (!web_cache_validators(a->cache_url, etag, sizeof(etag), lastmod, sizeof(lastmod))) {
+            web_cache_peer_prime(a->cache_url);
+        }
+
+        if (web_cache_validators(a->cache_url, etag, sizeof(etag), lastmod, sizeof(lastmod))) {
+            char validator[384];
+
+            if (etag[0]) {
+                snprintf(validator, sizeof(validator), "If-None-Match: %s", etag);
+                a->hdrs = curl_slist_append(a->hdrs, validator);
+            }
+            if (lastmod[0]) {
+                snprintf(validator, sizeof(validator), "If-Modified-Since: %s", lastmod);
+                a->hdrs = curl_slist_append(a->hdrs, validator);
+            }
+        }
+    }
+
+    if (a->hdrs) curl_easy_setopt(a->easy, CURLOPT_HTTPHEADER, a->hdrs);
+
+    if (dns_resolve_list) curl_easy_setopt(a->easy, CURLOPT_RESOLVE, dns_resolve_list);
 
-    char *data = NULL;
+    // hung transfers must not pin a connection slot forever: bound the
+    // connect phase (which also covers stuck DNS lookups) and abort any
+    // transfer that stalls below 1 byte/s, without capping how long a
+    // healthy large download may take
+    curl_easy_setopt(a->easy, CURLOPT_CONNECTTIMEOUT, connect_timeout_seconds);
+    curl_easy_setopt(a->easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(a->easy, CURLOPT_LOW_SPEED_TIME, stall_timeout_seconds);
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &web_request_write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&data);
+    curl_easy_setopt(a->easy, CURLOPT_WRITEFUNCTION, &web_request_write_callback);
+    curl_easy_setopt(a->easy, CURLOPT_WRITEDATA, (void*)a);
+    curl_easy_setopt(a->easy, CURLOPT_PRIVATE, a);
 
-    CURLcode res = curl_easy_perform(curl);
+    a->start_time = profiler_time();
+
+    curl_multi_add_handle(multi, a->easy);
+
+    a->next = *active;
+    *active = a;
+}
+
+// Run callbacks for a completed transfer and tear its handle down. Returns
+// the request node when it should be requeued (rate limited), NULL when it
+// was fully completed.
+static web_request_list_t *web_request_finish(CURLM *multi, active_request_t **active, CURL *easy, CURLcode res) {
+    active_request_t *a = NULL;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, &a);
+
+    web_request_list_t *req = a->req;
+    web_request_t *request = req->request;
+    web_request_list_t *requeue = NULL;
+
+    profiler_trace_complete("http-transfer", a->start_time, profiler_time() - a->start_time);
 
     if (res==CURLE_OK) {
+        web_request_record_dns(easy, a->url);
+
         long http_code = 0;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+
+        // streamed requests can't be retried transparently: chunks of the
+        // 429 body were already delivered
+        if (http_code==429 && req->retries < 5 && !req->streamcbi) {
+            // rate limited: hold the host for Retry-After (default 5s) and
+            // put the request back on the pending queue
+            double hold = 5.0;
+
+            struct curl_header *ra = NULL;
+            if (curl_easy_header(easy, "Retry-After", 0, CURLH_HEADER, -1, &ra)==CURLHE_OK) {
+                double v = atof(ra->value);
+                if (v > 0) hold = v;
+            }
+
+            logger_warn(logger, "GET %s -> 429, holding %s for %.0fs", request->url, req->host, hold);
+
+            web_request_hold_host(req->host, hold);
+            req->retries++;
+            requeue = req;
+
+            goto teardown;
+        }
 
         if (http_code>=200 && http_code<400) {
             if (req->source) logger_info(logger, "%s: GET %s -> %d", req->source, request->url, http_code);
@@ -204,35 +957,281 @@ static void web_request_perform(web_request_list_t *req) {
             else logger_warn(logger, "GET %s -> %d", request->url, http_code);
         }
 
-        if (req->cb) req->cb(http_code, data, request);
+        // capture the response headers onto the request so done callbacks
+        // can read them (content ranges, etags, etc.)
+        struct curl_header *rh = NULL;
+        while ((rh = curl_easy_nextheader(easy, CURLH_HEADER, -1, rh))!=NULL) {
+            web_request_value_list_add_item(&request->response_headers, web_request_value_list_new_item(rh->name, rh->value));
+        }
+
+        if (req->streamcbi) {
+            struct web_request_lua_stream_done_data *sd = egoverlay_calloc(1, sizeof(struct web_request_lua_stream_done_data));
+            sd->streamcbi = req->streamcbi;
+            sd->donecbi = req->cbi;
+            sd->reqi = req->requesti;
+            sd->http_code = http_code;
+            sd->req = request;
+            lua_manager_add_event_callback(&web_request_run_lua_stream_done, sd);
+
+            goto teardown;
+        }
+
+        if (req->download_path) {
+            // trim the preallocation to what actually arrived and hand the
+            // path to the callback in place of a body
+            if (a->out_file!=INVALID_HANDLE_VALUE && a->out_file) {
+                SetEndOfFile(a->out_file);
+                CloseHandle(a->out_file);
+                a->out_file = NULL;
+            }
+
+            if (req->cbi) {
+                struct web_request_lua_callback_data *ld =
+                    egoverlay_calloc(1, sizeof(struct web_request_lua_callback_data));
+                ld->cbi = req->cbi;
+                ld->data = egoverlay_calloc(strlen(req->download_path)+1, sizeof(char));
+                memcpy(ld->data, req->download_path, strlen(req->download_path));
+                ld->data_len = strlen(req->download_path);
+                ld->req = request;
+                ld->reqi = req->requesti;
+                ld->http_code = http_code;
+                lua_manager_add_event_callback(&web_request_run_lua_callback, ld);
+            }
+
+            goto teardown;
+        }
+
+        const char *body = a->data ? a->data : "";
+        size_t body_len = a->data_len;
+        char *cached_body = NULL;
+
+        if (http_code==304 && a->cache_url) {
+            // not modified, hand the cached body to the callbacks
+            cached_body = web_cache_body(a->cache_url, &body_len);
+
+            if (cached_body) {
+                body = cached_body;
+                http_code = 200;
+            }
+        } else if (http_code==200 && a->cache_url && a->data) {
+            struct curl_header *etag_hdr = NULL;
+            struct curl_header *lastmod_hdr = NULL;
+
+            curl_easy_header(easy, "ETag", 0, CURLH_HEADER, -1, &etag_hdr);
+            curl_easy_header(easy, "Last-Modified", 0, CURLH_HEADER, -1, &lastmod_hdr);
+
+            if (etag_hdr || lastmod_hdr) {
+                web_cache_store(
+                    a->cache_url,
+                    etag_hdr ? etag_hdr->value : NULL,
+                    lastmod_hdr ? lastmod_hdr->value : NULL,
+                    a->data,
+                    a->data_len
+                );
+            }
+        }
+
+        if (req->cb) req->cb(http_code, (char*)body, request);
         if (req->cbi) {
             size_t ldsize = sizeof(struct web_request_lua_callback_data);
             struct web_request_lua_callback_data *ld = egoverlay_calloc(1, ldsize);
             ld->cbi = req->cbi;
-            ld->data = egoverlay_calloc(strlen(data)+1, sizeof(char));
-            memcpy(ld->data, data, strlen(data));
+            ld->data = egoverlay_calloc(body_len+1, sizeof(char));
+            memcpy(ld->data, body, body_len);
+            ld->data_len = body_len;
             ld->req = request;
             ld->reqi = req->requesti;
             ld->http_code = http_code;
             lua_manager_add_event_callback(&web_request_run_lua_callback, ld);
         }
+        if (cached_body) egoverlay_free(cached_body);
     } else {
         logger_error(logger, "Error while performing GET to %s: %s", request->url, curl_easy_strerror(res));
+
+        if (req->download_path && a->out_file && a->out_file!=INVALID_HANDLE_VALUE) {
+            // drop the partial file; the documented contract is code 0 with
+            // no usable path
+            CloseHandle(a->out_file);
+            a->out_file = NULL;
+            DeleteFile(req->download_path);
+        }
+
+        if (req->cbi && !req->streamcbi) {
+            // the documented contract: callbacks get code 0 when the request
+            // failed before completing
+            struct web_request_lua_callback_data *ld = egoverlay_calloc(1, sizeof(struct web_request_lua_callback_data));
+            ld->cbi = req->cbi;
+            ld->data = egoverlay_calloc(1, sizeof(char));
+            ld->req = request;
+            ld->reqi = req->requesti;
+            ld->http_code = 0;
+            lua_manager_add_event_callback(&web_request_run_lua_callback, ld);
+        }
+
+        if (req->streamcbi) {
+            // still deliver completion (code 0) and release the refs
+            struct web_request_lua_stream_done_data *sd = egoverlay_calloc(1, sizeof(struct web_request_lua_stream_done_data));
+            sd->streamcbi = req->streamcbi;
+            sd->donecbi = req->cbi;
+            sd->reqi = req->requesti;
+            sd->http_code = 0;
+            sd->req = request;
+            lua_manager_add_event_callback(&web_request_run_lua_stream_done, sd);
+        }
     }
 
-    curl_url_cleanup(url);
+teardown:
+    if (a->zactive) inflateEnd(&a->zstrm);
+
+    if (a->out_file && a->out_file!=INVALID_HANDLE_VALUE) CloseHandle(a->out_file);
+
+    curl_multi_remove_handle(multi, easy);
+    curl_easy_cleanup(easy);
+    curl_url_cleanup(a->url);
+
+    if (a->data) egoverlay_free(a->data);
+    if (a->cache_url) egoverlay_free(a->cache_url);
+    if (a->hdrs) curl_slist_free_all(a->hdrs);
 
-    if (data) egoverlay_free(data);
+    if (!requeue) {
+        if (request->free_after_perform) web_request_free(request);
 
-    if (hdrs) curl_slist_free_all(hdrs);
+        if (req->source) egoverlay_free(req->source);
+        if (req->host) egoverlay_free(req->host);
+        if (req->download_path) egoverlay_free(req->download_path);
+        egoverlay_free(req);
+    }
+
+    // unlink
+    active_request_t **p = active;
+    while (*p && *p!=a) p = &(*p)->next;
+    if (*p) *p = a->next;
+
+    egoverlay_free(a);
 
-    if (request->free_after_perform) web_request_free(request);
+    return requeue;
+}
+
+// Per-host rate limit backoff. A 429 response puts its host on hold until
+// the Retry-After deadline and the request goes back into the pending queue.
+#define HOST_BACKOFF_MAX 8
+
+typedef struct {
+    char host[128];
+    double retry_at;
+} host_backoff_t;
+
+static host_backoff_t host_backoffs[HOST_BACKOFF_MAX];
+
+static double web_request_now() {
+    return (double)GetTickCount64() / 1000.0;
+}
+
+static int web_request_host_held(const char *host) {
+    if (!host) return 0;
+
+    double now = web_request_now();
+
+    for (int i=0;i<HOST_BACKOFF_MAX;i++) {
+        if (host_backoffs[i].host[0] && strcmp(host_backoffs[i].host, host)==0) {
+            return host_backoffs[i].retry_at > now;
+        }
+    }
+
+    return 0;
+}
+
+static void web_request_hold_host(const char *host, double seconds) {
+    if (!host) return;
+
+    double retry_at = web_request_now() + seconds;
+
+    for (int i=0;i<HOST_BACKOFF_MAX;i++) {
+        if (host_backoffs[i].host[0] && strcmp(host_backoffs[i].host, host)==0) {
+            host_backoffs[i].retry_at = retry_at;
+            return;
+        }
+    }
+
+    for (int i=0;i<HOST_BACKOFF_MAX;i++) {
+        if (!host_backoffs[i].host[0] || host_backoffs[i].retry_at <= web_request_now()) {
+            snprintf(host_backoffs[i].host, sizeof(host_backoffs[i].host), "%s", host);
+            host_backoffs[i].retry_at = retry_at;
+            return;
+        }
+    }
+}
+
+// pending requests per priority class, FIFO within a class
+static web_request_list_t *pending_heads[3];
+static web_request_list_t *pending_tails[3];
+
+// queue depth metrics, read from the Lua side for backpressure decisions.
+// updated with interlocked ops since they're written on the worker thread
+static volatile LONG pending_count = 0;
+static volatile LONG active_count_metric = 0;
+static volatile LONG queued_count = 0;
+
+static void web_request_pend(web_request_list_t *w) {
+    InterlockedIncrement(&pending_count);
+
+    int p = w->priority;
+    if (p < 0) p = 0;
+    if (p > 2) p = 2;
+
+    w->next = NULL;
+    if (pending_tails[p]) pending_tails[p]->next = w;
+    else pending_heads[p] = w;
+    pending_tails[p] = w;
+}
+
+// pop the highest priority pending request whose host isn't rate limited
+static web_request_list_t *web_request_next_startable() {
+    for (int p=0;p<3;p++) {
+        web_request_list_t **w = &pending_heads[p];
+
+        while (*w) {
+            if (!web_request_host_held((*w)->host)) {
+                web_request_list_t *r = *w;
+                *w = r->next;
+                if (pending_tails[p]==r) {
+                    // find the new tail
+                    pending_tails[p] = NULL;
+                    for (web_request_list_t *t=pending_heads[p];t;t=t->next) pending_tails[p] = t;
+                }
+                r->next = NULL;
+                InterlockedDecrement(&pending_count);
+                return r;
+            }
+            w = &(*w)->next;
+        }
+    }
+
+    return NULL;
 }
 
 static DWORD WINAPI web_request_thread(LPVOID lpParam) {
     UNUSED_PARAM(lpParam);
     
     logger_debug(logger, "request thread starting...");
+
+    // requests run concurrently on a multi handle, up to the configured
+    // connection limit, with HTTP/2 multiplexing per connection. a slow
+    // endpoint no longer blocks everything queued behind it
+    CURLM *multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_concurrent_requests);
+
+    active_request_t *active = NULL;
+
+    web_request_load_dns_cache();
+
+    // warm up the API connection pool before any module asks for it
+    web_request_t *warm = web_request_new("https://api.guildwars2.com/v2/build");
+    web_request_queue(warm, NULL, 1, "pre-warm", 0);
+
+    int active_count = 0;
+
     while(!stop_thread) {
         WaitForSingleObject(queue_mutex, INFINITE);
 
@@ -246,14 +1245,101 @@ static DWORD WINAPI web_request_thread(LPVOID lpParam) {
         ReleaseMutex(queue_mutex);
 
         while (r) {
-            web_request_perform(r);
-            web_request_list_t *prev = r;
-            r = r->next;
-            if (prev->source) egoverlay_free(prev->source);
-            egoverlay_free(prev);
+            web_request_list_t *next = r->next;
+
+            InterlockedDecrement(&queued_count);
+
+            r->priority = r->request->priority;
+
+            // remember the host for rate limit bookkeeping
+            CURLU *u = curl_url();
+            if (curl_url_set(u, CURLUPART_URL, r->request->url, CURLU_URLENCODE)==CURLUE_OK) {
+                char *host = NULL;
+                if (curl_url_get(u, CURLUPART_HOST, &host, 0)==CURLUE_OK && host) {
+                    r->host = egoverlay_calloc(strlen(host)+1, sizeof(char));
+                    memcpy(r->host, host, strlen(host));
+                    curl_free(host);
+                }
+            }
+            curl_url_cleanup(u);
+
+            web_request_pend(r);
+            r = next;
+        }
+
+        // fill free slots, high priority classes first, skipping hosts that
+        // are rate limited
+        while (active_count < max_concurrent_requests) {
+            web_request_list_t *w = web_request_next_startable();
+            if (!w) break;
+
+            web_request_start(multi, &active, w);
+            active_count++;
+            InterlockedIncrement(&active_count_metric);
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg = NULL;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg==CURLMSG_DONE) {
+                web_request_list_t *requeue = web_request_finish(multi, &active, msg->easy_handle, msg->data.result);
+                active_count--;
+                InterlockedDecrement(&active_count_metric);
+
+                if (requeue) web_request_pend(requeue);
+            }
+        }
+
+        web_request_save_dns_cache();
+
+        if (running) {
+            curl_multi_poll(multi, NULL, 0, 25, NULL);
+        } else {
+            Sleep(25);
         }
-        Sleep(25);
     }
+
+    // drop anything still in flight
+    while (active) {
+        active_request_t *a = active;
+        active = a->next;
+
+        if (a->zactive) inflateEnd(&a->zstrm);
+        curl_multi_remove_handle(multi, a->easy);
+        curl_easy_cleanup(a->easy);
+        curl_url_cleanup(a->url);
+        if (a->data) egoverlay_free(a->data);
+        if (a->cache_url) egoverlay_free(a->cache_url);
+        if (a->hdrs) curl_slist_free_all(a->hdrs);
+        if (a->req->request->free_after_perform) web_request_free(a->req->request);
+        if (a->req->source) egoverlay_free(a->req->source);
+        if (a->req->host) egoverlay_free(a->req->host);
+        egoverlay_free(a->req);
+        egoverlay_free(a);
+    }
+
+    for (int p=0;p<3;p++) {
+        web_request_list_t *w = pending_heads[p];
+        while (w) {
+            web_request_list_t *next = w->next;
+            if (w->request->free_after_perform) web_request_free(w->request);
+            if (w->source) egoverlay_free(w->source);
+            if (w->host) egoverlay_free(w->host);
+            egoverlay_free(w);
+            w = next;
+        }
+        pending_heads[p] = NULL;
+        pending_tails[p] = NULL;
+    }
+
+    curl_multi_cleanup(multi);
+
+    web_request_save_dns_cache();
+    if (dns_resolve_list) curl_slist_free_all(dns_resolve_list);
+
     logger_debug(logger, "request thread ending...");
 
     return 0;
@@ -266,6 +1352,8 @@ web_request_t *web_request_new(const char *url) {
     r->url = egoverlay_calloc(strlen(url) + 1, sizeof(char));
     memcpy(r->url, url, strlen(url));
 
+    r->priority = 1;
+
     return r;
 }
 
@@ -293,6 +1381,17 @@ void web_request_free(web_request_t *request) {
         v = n;
     }
 
+    v = request->response_headers;
+    n = NULL;
+
+    while (v) {
+        egoverlay_free(v->name);
+        egoverlay_free(v->value);
+        n = v->next;
+        egoverlay_free(v);
+        v = n;
+    }
+
     egoverlay_free(request);
 }
 
@@ -335,6 +1434,8 @@ void web_request_queue(
     const char *source,
     int cbi
 ) {
+    InterlockedIncrement(&queued_count);
+
     web_request_list_t *w = egoverlay_calloc(1, sizeof(web_request_list_t));
     w->request = request;
     w->cb = callback;
@@ -365,6 +1466,10 @@ int web_request_lua_del(lua_State *L);
 int web_request_lua_add_header(lua_State *L);
 int web_request_lua_add_query_parameter(lua_State *L);
 int web_request_lua_queue(lua_State *L);
+int web_request_lua_queue_stream(lua_State *L);
+int web_request_lua_priority(lua_State *L);
+int web_request_lua_response_header(lua_State *L);
+int web_request_lua_download_to(lua_State *L);
 
 /*** RST
 web-request
@@ -395,10 +1500,44 @@ event will not receive a response until the following frame/events run.
     are not completed.
 */
 
+/*** RST
+.. lua:function:: stats()
+
+    Return the request queue depths: ``queued`` (handed off but not yet
+    scheduled), ``pending`` (waiting for a free connection slot), and
+    ``active`` (transfers in flight). Modules doing bulk downloads can use
+    this to throttle themselves.
+
+    :rtype: table
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+int web_request_lua_stats(lua_State *L) {
+    lua_createtable(L, 0, 3);
+
+    lua_pushinteger(L, (lua_Integer)queued_count);
+    lua_setfield(L, -2, "queued");
+
+    lua_pushinteger(L, (lua_Integer)pending_count);
+    lua_setfield(L, -2, "pending");
+
+    lua_pushinteger(L, (lua_Integer)active_count_metric);
+    lua_setfield(L, -2, "active");
+
+    return 1;
+}
+
+int websocket_lua_new(lua_State *L);
+
 int web_request_lua_open_module(lua_State *L) {
     lua_newtable(L);
     lua_pushcfunction(L, &web_request_lua_new);
     lua_setfield(L, -2, "new");
+    lua_pushcfunction(L, &web_request_lua_stats);
+    lua_setfield(L, -2, "stats");
+    lua_pushcfunction(L, &websocket_lua_new);
+    lua_setfield(L, -2, "websocket");
 
     return 1;
 }
@@ -408,9 +1547,42 @@ luaL_Reg web_request_lua_funcs[] = {
     "addheader"        , &web_request_lua_add_header,
     "addqueryparameter", &web_request_lua_add_query_parameter,
     "queue"            , &web_request_lua_queue,
+    "queuestream"      , &web_request_lua_queue_stream,
+    "priority"         , &web_request_lua_priority,
+    "responseheader"   , &web_request_lua_response_header,
+    "downloadto"       , &web_request_lua_download_to,
     NULL               ,  NULL
 };
 
+/*** RST
+    .. lua:method:: responseheader(name)
+
+        Return the value of a response header, or ``nil``. Only valid once
+        the request has completed, i.e. from a ``done`` callback. Header
+        names are matched case-insensitively.
+
+        :param string name:
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int web_request_lua_response_header(lua_State *L) {
+    web_request_t *r = lua_checkwebrequest(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+
+    for (web_request_value_list_t *v=r->response_headers;v;v=v->next) {
+        if (_stricmp(v->name, name)==0) {
+            lua_pushstring(L, v->value);
+            return 1;
+        }
+    }
+
+    lua_pushnil(L);
+
+    return 1;
+}
+
 void web_request_lua_register_metatable(lua_State *L) {
     if (luaL_newmetatable(L, "WebRequestMetaTable")) {
         lua_pushvalue(L, -1);
@@ -556,6 +1728,8 @@ int web_request_lua_add_query_parameter(lua_State *L) {
 int web_request_lua_queue(lua_State *L) {
     web_request_t *r = lua_checkwebrequest(L, 1);
 
+    InterlockedIncrement(&queued_count);
+
     web_request_list_t *w = egoverlay_calloc(1, sizeof(web_request_list_t));
     w->request = r;
 
@@ -598,6 +1772,154 @@ int web_request_lua_queue(lua_State *L) {
     return 0;
 }
 
+/*** RST
+    .. lua:method:: downloadto(path, callback)
+
+        Queue the request with the response body written straight to
+        ``path`` on the worker thread instead of being buffered in memory.
+        When the server reports a content length the file is preallocated up
+        front, so a large pack download lands in sequential writes and never
+        competes with texture memory.
+
+        ``callback(code, path, request)`` receives the file path in place of
+        the body; on failure (``code`` 0) the partial file is deleted.
+
+        :param string path:
+        :param callback: Called on completion.
+        :type callback: function
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int web_request_lua_download_to(lua_State *L) {
+    web_request_t *r = lua_checkwebrequest(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    InterlockedIncrement(&queued_count);
+
+    web_request_list_t *w = egoverlay_calloc(1, sizeof(web_request_list_t));
+    w->request = r;
+
+    w->download_path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(w->download_path, path, strlen(path));
+
+    lua_pushvalue(L, 1);
+    w->requesti = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_pushvalue(L, 3);
+    w->cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    char *mod_name = lua_manager_get_lua_module_name_and_line2(L, 1);
+    size_t mod_name_len = strlen(mod_name);
+
+    w->source = egoverlay_calloc(mod_name_len+1, sizeof(char));
+    memcpy(w->source, mod_name, mod_name_len);
+    egoverlay_free(mod_name);
+
+    WaitForSingleObject(queue_mutex, INFINITE);
+
+    if (request_queue==NULL) {
+        request_queue = w;
+    } else {
+        web_request_list_t *last = request_queue;
+        while (last->next) last = last->next;
+        last->next = w;
+    }
+
+    ReleaseMutex(queue_mutex);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: priority(value)
+
+        Set this request's scheduling priority. Higher priority requests are
+        started first when the concurrency limit is reached.
+
+        :param string value: One of ``'high'``, ``'normal'`` (the default),
+            or ``'background'``.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int web_request_lua_priority(lua_State *L) {
+    web_request_t *r = lua_checkwebrequest(L, 1);
+    const char *value = luaL_checkstring(L, 2);
+
+    if      (strcmp(value, "high"      )==0) r->priority = 0;
+    else if (strcmp(value, "normal"    )==0) r->priority = 1;
+    else if (strcmp(value, "background")==0) r->priority = 2;
+    else return luaL_error(L, "priority must be 'high', 'normal', or 'background'");
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: queuestream(chunk_function[, done_function])
+
+        Queue the request, streaming the response body to
+        ``chunk_function(data)`` as it arrives instead of buffering the whole
+        body. ``done_function(code, request)`` is called once the transfer
+        completes (``code`` is ``0`` when the request failed before
+        completing). Chunks are delivered in order, before the completion
+        callback.
+
+        This keeps memory bounded for large downloads and lets coroutine
+        based consumers process data incrementally.
+
+        :param chunk_function: Called with each chunk of response data.
+        :type chunk_function: function
+        :param done_function: (Optional) Called when the transfer completes.
+        :type done_function: function
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int web_request_lua_queue_stream(lua_State *L) {
+    web_request_t *r = lua_checkwebrequest(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    InterlockedIncrement(&queued_count);
+
+    web_request_list_t *w = egoverlay_calloc(1, sizeof(web_request_list_t));
+    w->request = r;
+
+    // keep the request alive until completion
+    lua_pushvalue(L, 1);
+    w->requesti = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_pushvalue(L, 2);
+    w->streamcbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    if (lua_gettop(L)>=3 && lua_type(L, 3)==LUA_TFUNCTION) {
+        lua_pushvalue(L, 3);
+        w->cbi = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    char *mod_name = lua_manager_get_lua_module_name_and_line2(L, 1);
+    size_t mod_name_len = strlen(mod_name);
+
+    w->source = egoverlay_calloc(mod_name_len+1, sizeof(char));
+    memcpy(w->source, mod_name, mod_name_len);
+    egoverlay_free(mod_name);
+
+    WaitForSingleObject(queue_mutex, INFINITE);
+
+    if (request_queue==NULL) {
+        request_queue = w;
+    } else {
+        web_request_list_t *last = request_queue;
+        while (last->next) last = last->next;
+        last->next = w;
+    }
+
+    ReleaseMutex(queue_mutex);
+
+    return 0;
+}
+
 /*** RST
 Callback Functions
 ------------------
@@ -657,3 +1979,364 @@ Example
 
     req:queue(on_completed)
 */
+
+/*** RST
+WebSockets
+----------
+
+.. lua:function:: websocket(url, onmessage[, onclose])
+
+    Open a persistent WebSocket connection.
+
+    The connection runs on its own thread; received messages are delivered
+    to ``onmessage(data, binary)`` through the normal event callback path,
+    usually within a frame of arrival, so live data (squad positions) skips
+    HTTP polling entirely. ``onclose(reason)`` fires once when the
+    connection ends, whether from :lua:meth:`close`, the server, or an
+    error.
+
+    :param string url: A ``ws://`` or ``wss://`` URL.
+    :param function onmessage:
+    :param function onclose: (Optional)
+    :rtype: websocket
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define WEBSOCKET_MT "WebSocketMetaTable"
+
+typedef struct websocket_out_t {
+    uint8_t *data;
+    size_t len;
+    int binary;
+    struct websocket_out_t *next;
+} websocket_out_t;
+
+typedef struct {
+    char *url;
+
+    HANDLE thread;
+    HANDLE mutex;
+    volatile LONG stop;
+
+    websocket_out_t *outgoing;
+
+    int onmessagecbi;
+    int onclosecbi;
+
+    volatile LONG closed; // onclose delivered (or queued)
+
+    int ref_count;
+} websocket_t;
+
+#define lua_checkwebsocket(L, ind) (*(websocket_t**)luaL_checkudata(L, ind, WEBSOCKET_MT))
+
+struct websocket_msg_data {
+    websocket_t *ws;
+    uint8_t *data;
+    size_t len;
+    int binary;
+    int close; // deliver onclose instead of onmessage
+};
+
+static void websocket_release(websocket_t *ws) {
+    if (InterlockedDecrement((volatile LONG*)&ws->ref_count)!=0) return;
+
+    if (ws->thread) CloseHandle(ws->thread);
+    if (ws->mutex) CloseHandle(ws->mutex);
+
+    websocket_out_t *o = ws->outgoing;
+    while (o) {
+        websocket_out_t *next = o->next;
+        egoverlay_free(o->data);
+        egoverlay_free(o);
+        o = next;
+    }
+
+    egoverlay_free(ws->url);
+    egoverlay_free(ws);
+}
+
+// runs on the Lua thread via the event callback queue
+static int websocket_deliver(lua_State *L, struct websocket_msg_data *msg) {
+    websocket_t *ws = msg->ws;
+
+    if (msg->close) {
+        if (ws->onclosecbi) {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ws->onclosecbi);
+            lua_pushlstring(L, (const char*)msg->data, msg->len);
+            egoverlay_free(msg->data);
+            egoverlay_free(msg);
+            websocket_release(ws);
+            return 1;
+        }
+
+        egoverlay_free(msg->data);
+        egoverlay_free(msg);
+        websocket_release(ws);
+        return -1;
+    }
+
+    // the userdata may have been collected while this message was in
+    // flight; the callbacks were released with it
+    if (ws->onmessagecbi==0) {
+        egoverlay_free(msg->data);
+        egoverlay_free(msg);
+        websocket_release(ws);
+        return -1;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ws->onmessagecbi);
+    lua_pushlstring(L, (const char*)msg->data, msg->len);
+    lua_pushboolean(L, msg->binary);
+
+    egoverlay_free(msg->data);
+    egoverlay_free(msg);
+    websocket_release(ws);
+
+    return 2;
+}
+
+static void websocket_queue_delivery(websocket_t *ws, const uint8_t *data, size_t len, int binary, int close) {
+    if (close && InterlockedExchange(&ws->closed, 1)) return; // once
+
+    struct websocket_msg_data *msg = egoverlay_calloc(1, sizeof(struct websocket_msg_data));
+    msg->ws = ws;
+    msg->data = egoverlay_malloc(len ? len : 1);
+    if (len) memcpy(msg->data, data, len);
+    msg->len = len;
+    msg->binary = binary;
+    msg->close = close;
+
+    InterlockedIncrement((volatile LONG*)&ws->ref_count);
+
+    lua_manager_add_event_callback((lua_manager_event_callback*)&websocket_deliver, msg);
+}
+
+static DWORD WINAPI websocket_thread_fn(LPVOID param) {
+    websocket_t *ws = (websocket_t*)param;
+
+    CURL *easy = curl_easy_init();
+    curl_easy_setopt(easy, CURLOPT_URL, ws->url);
+    curl_easy_setopt(easy, CURLOPT_CONNECT_ONLY, 2L);
+
+    CURLcode r = curl_easy_perform(easy);
+    if (r!=CURLE_OK) {
+        const char *err = curl_easy_strerror(r);
+        logger_warn(logger, "websocket connect to %s failed: %s", ws->url, err);
+        websocket_queue_delivery(ws, (const uint8_t*)err, strlen(err), 0, 1);
+        curl_easy_cleanup(easy);
+        websocket_release(ws);
+        return 0;
+    }
+
+    // receive buffer grown to the largest message seen
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+    size_t buf_used = 0;
+    int cur_binary = 0;
+
+    while (!ws->stop) {
+        // drain the outgoing queue first
+        WaitForSingleObject(ws->mutex, INFINITE);
+        websocket_out_t *out = ws->outgoing;
+        ws->outgoing = NULL;
+        ReleaseMutex(ws->mutex);
+
+        while (out) {
+            websocket_out_t *next = out->next;
+
+            // curl_ws_send can take the frame partially or ask to retry
+            size_t off = 0;
+            unsigned int flags = out->binary ? CURLWS_BINARY : CURLWS_TEXT;
+            while (off < out->len || (out->len==0 && off==0)) {
+                size_t sent = 0;
+                CURLcode sr = curl_ws_send(easy, out->data + off, out->len - off, &sent, 0, flags);
+
+                if (sr==CURLE_AGAIN) {
+                    Sleep(5);
+                    continue;
+                }
+                if (sr!=CURLE_OK) break;
+
+                off += sent;
+                if (out->len==0) break;
+            }
+
+            egoverlay_free(out->data);
+            egoverlay_free(out);
+            out = next;
+        }
+
+        // then poll for incoming frames
+        size_t rlen = 0;
+        const struct curl_ws_frame *frame = NULL;
+        uint8_t chunk[4096];
+
+        CURLcode rr = curl_ws_recv(easy, chunk, sizeof(chunk), &rlen, &frame);
+
+        if (rr==CURLE_AGAIN) {
+            Sleep(10);
+            continue;
+        }
+
+        if (rr!=CURLE_OK || !frame) {
+            websocket_queue_delivery(ws, (const uint8_t*)"connection lost", 15, 0, 1);
+            break;
+        }
+
+        if (frame->flags & CURLWS_CLOSE) {
+            websocket_queue_delivery(ws, (const uint8_t*)"closed by server", 16, 0, 1);
+            break;
+        }
+
+        // reassemble fragmented messages; bytesleft > 0 means more of this
+        // message follows
+        // the message type only rides on the first fragment
+        if (buf_used==0) cur_binary = (frame->flags & CURLWS_BINARY) ? 1 : 0;
+
+        if (buf_used + rlen > buf_size) {
+            buf_size = buf_used + rlen;
+            buf = egoverlay_realloc(buf, buf_size);
+        }
+        memcpy(buf + buf_used, chunk, rlen);
+        buf_used += rlen;
+
+        if (frame->bytesleft==0 && !(frame->flags & CURLWS_CONT)) {
+            websocket_queue_delivery(ws, buf, buf_used, cur_binary, 0);
+            buf_used = 0;
+        }
+    }
+
+    if (ws->stop) {
+        curl_ws_send(easy, "", 0, &(size_t){0}, 0, CURLWS_CLOSE);
+        websocket_queue_delivery(ws, (const uint8_t*)"closed", 6, 0, 1);
+    }
+
+    if (buf) egoverlay_free(buf);
+    curl_easy_cleanup(easy);
+    websocket_release(ws);
+
+    return 0;
+}
+
+int websocket_lua_send(lua_State *L);
+int websocket_lua_close(lua_State *L);
+int websocket_lua_del(lua_State *L);
+
+static luaL_Reg websocket_funcs[] = {
+    "send" , &websocket_lua_send,
+    "close", &websocket_lua_close,
+    "__gc" , &websocket_lua_del,
+    NULL   , NULL
+};
+
+int websocket_lua_new(lua_State *L) {
+    const char *url = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    websocket_t *ws = egoverlay_calloc(1, sizeof(websocket_t));
+
+    ws->url = egoverlay_calloc(strlen(url)+1, sizeof(char));
+    memcpy(ws->url, url, strlen(url));
+
+    lua_pushvalue(L, 2);
+    ws->onmessagecbi = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    if (lua_gettop(L)>=3 && lua_isfunction(L, 3)) {
+        lua_pushvalue(L, 3);
+        ws->onclosecbi = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    ws->mutex = CreateMutex(0, FALSE, NULL);
+
+    // one reference for the Lua userdata, one for the thread
+    ws->ref_count = 2;
+
+    DWORD tid = 0;
+    ws->thread = CreateThread(0, 0, &websocket_thread_fn, ws, 0, &tid);
+
+    websocket_t **pws = (websocket_t**)lua_newuserdata(L, sizeof(websocket_t*));
+    *pws = ws;
+
+    if (luaL_newmetatable(L, WEBSOCKET_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, websocket_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    if (logger) logger_info(logger, "websocket: %s", url);
+
+    return 1;
+}
+
+/*** RST
+.. lua:class:: websocket
+
+    .. lua:method:: send(data[, binary])
+
+        Queue a message. Sent from the connection's thread.
+
+        :param string data:
+        :param boolean binary: (Optional) Send as a binary frame.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int websocket_lua_send(lua_State *L) {
+    websocket_t *ws = lua_checkwebsocket(L, 1);
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 2, &len);
+    int binary = lua_toboolean(L, 3);
+
+    websocket_out_t *out = egoverlay_calloc(1, sizeof(websocket_out_t));
+    out->data = egoverlay_malloc(len ? len : 1);
+    if (len) memcpy(out->data, data, len);
+    out->len = len;
+    out->binary = binary;
+
+    WaitForSingleObject(ws->mutex, INFINITE);
+    if (ws->outgoing==NULL) {
+        ws->outgoing = out;
+    } else {
+        websocket_out_t *last = ws->outgoing;
+        while (last->next) last = last->next;
+        last->next = out;
+    }
+    ReleaseMutex(ws->mutex);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: close()
+
+        Close the connection. ``onclose`` fires once the thread winds down.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int websocket_lua_close(lua_State *L) {
+    websocket_t *ws = lua_checkwebsocket(L, 1);
+
+    InterlockedExchange(&ws->stop, 1);
+
+    return 0;
+}
+
+int websocket_lua_del(lua_State *L) {
+    websocket_t *ws = lua_checkwebsocket(L, 1);
+
+    InterlockedExchange(&ws->stop, 1);
+
+    if (ws->onmessagecbi) luaL_unref(L, LUA_REGISTRYINDEX, ws->onmessagecbi);
+    if (ws->onclosecbi) luaL_unref(L, LUA_REGISTRYINDEX, ws->onclosecbi);
+    ws->onmessagecbi = 0;
+    ws->onclosecbi = 0;
+
+    websocket_release(ws);
+
+    return 0;
+}
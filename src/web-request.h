@@ -5,6 +5,10 @@ typedef struct web_request_t web_request_t;
 void web_request_init();
 void web_request_cleanup();
 
+// runs curl_global_init; called early on a worker thread so it overlaps
+// the rest of startup. web_request_init checks the result
+void web_request_global_init();
+
 web_request_t *web_request_new(const char *url);
 void web_request_free(web_request_t *request);
 
@@ -19,16 +19,21 @@ The :lua:mod:`libxml2` module is, as its name suggests, a Lua binding to
 */
 #include "xml.h"
 #include "utils.h"
+#include "profiler.h"
 #include "logging/logger.h"
 #include "lua-manager.h"
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <lauxlib.h>
 #include <string.h>
+#include <windows.h>
 
 int xml_lua_open_module(lua_State *L);
 
 void xml_lua_init() {
+    // required before parsing from multiple threads (see parsequeue)
+    xmlInitParser();
+
     lua_manager_add_module_opener("libxml2", &xml_lua_open_module);
 }
 
@@ -38,6 +43,9 @@ void xml_cleanup() {
 
 int xml_lua_read_file(lua_State *L);
 int xml_lua_read_string(lua_State *L);
+int xml_lua_push_parser_new(lua_State *L);
+int xml_lua_parse_queue_new(lua_State *L);
+int xml_lua_cleaner_new(lua_State *L);
 
 void xml_doc_lua_register_metatable(lua_State *L);
 void lua_pushxmldoc(lua_State *L, xmlDocPtr doc, int lua_managed);
@@ -50,6 +58,9 @@ xmlNodePtr lua_checkxmlnode(lua_State *L, int ind);
 static luaL_Reg xml_funcs[] = {
     "read_file",   &xml_lua_read_file,
     "read_string", &xml_lua_read_string,
+    "pushparser",  &xml_lua_push_parser_new,
+    "parsequeue",  &xml_lua_parse_queue_new,
+    "cleaner",     &xml_lua_cleaner_new,
     NULL, NULL
 };
 
@@ -113,6 +124,10 @@ void xml_error_handler(error_handler_data_t *data, const xmlError *error) {
     */
 }
 
+// element and attribute names go through the shared intern cache in
+// lua-manager; packs use the same ~30 names millions of times
+#define xml_push_interned(L, s, len) lua_manager_push_interned(L, s, len)
+
 /*** RST
 Functions
 ---------
@@ -168,7 +183,7 @@ void xml_lua_sax_start_element_ns(
 
     lua_rawgeti(cbs->L, LUA_REGISTRYINDEX, cbs->startelement);
 
-    lua_pushstring(cbs->L, (const char*)localname);
+    xml_push_interned(cbs->L, (const char*)localname, strlen((const char*)localname));
 
     lua_createtable(cbs->L, 0, nb_attributes);
     for (int a=0;a<nb_attributes;a++) {
@@ -176,8 +191,9 @@ void xml_lua_sax_start_element_ns(
         const char *attrvalue = (const char *)attributes[(a * 5) + 3];
         const char *attrvalend = (const char *)attributes[(a * 5) + 4];
         size_t attrvallen = (size_t)(attrvalend) - (size_t)(attrvalue);
+        xml_push_interned(cbs->L, attrname, strlen(attrname));
         lua_pushlstring(cbs->L, attrvalue, attrvallen);
-        lua_setfield(cbs->L, -2, attrname);
+        lua_rawset(cbs->L, -3);
     }
 
     lua_pushstring(cbs->L, cbs->ctx->input->filename);
@@ -206,7 +222,7 @@ void xml_lua_sax_end_element_ns(
 
     lua_rawgeti(cbs->L, LUA_REGISTRYINDEX, cbs->endelement);
 
-    lua_pushstring(cbs->L, (const char *)localname);
+    xml_push_interned(cbs->L, (const char*)localname, strlen((const char*)localname));
     lua_pushstring(cbs->L, cbs->ctx->input->filename);
     lua_pushinteger(cbs->L, cbs->ctx->input->line);
 
@@ -319,6 +335,622 @@ int xml_lua_read_string(lua_State *L) {
     return 1;
 }
 
+/*** RST
+.. lua:function:: pushparser(name, callbacks)
+
+    Create a :lua:class:`XMLPushParser` that parses a document fed to it in
+    chunks, running the same SAX callbacks as :lua:func:`read_string`. This
+    lets a coroutine feed a large document in bounded slices, yielding
+    between chunks, so parsing a huge marker pack doesn't blow the frame
+    budget.
+
+    :param string name: The document name, typically a path or file name.
+    :param table callbacks: See :lua:func:`read_string`.
+    :rtype: XMLPushParser
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define XML_PUSH_PARSER_MT "XMLPushParser"
+#define lua_checkxmlpushparser(L, ind) (xml_push_parser_t*)luaL_checkudata(L, ind, XML_PUSH_PARSER_MT)
+
+typedef struct {
+    xml_lua_sax_cbs_t cbs;
+    xmlParserCtxtPtr ctx;
+    error_handler_data_t err_data;
+    int done;
+} xml_push_parser_t;
+
+int xml_lua_push_parser_parse(lua_State *L);
+int xml_lua_push_parser_finish(lua_State *L);
+int xml_lua_push_parser_del(lua_State *L);
+
+static luaL_Reg xml_push_parser_funcs[] = {
+    "parse" , &xml_lua_push_parser_parse,
+    "finish", &xml_lua_push_parser_finish,
+    "__gc"  , &xml_lua_push_parser_del,
+    NULL    , NULL
+};
+
+int xml_lua_push_parser_new(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    xml_push_parser_t *parser = lua_newuserdata(L, sizeof(xml_push_parser_t));
+    memset(parser, 0, sizeof(xml_push_parser_t));
+
+    if (luaL_newmetatable(L, XML_PUSH_PARSER_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, xml_push_parser_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    if (lua_getfield(L, 2, "startelement")==LUA_TFUNCTION) {
+        parser->cbs.startelement = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+        lua_pop(L, 1);
+    }
+
+    if (lua_getfield(L, 2, "endelement")==LUA_TFUNCTION) {
+        parser->cbs.endelement = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+        lua_pop(L, 1);
+    }
+
+    xmlSAXHandler sh = {0};
+    sh.initialized = XML_SAX2_MAGIC;
+    sh.startElementNs = &xml_lua_sax_start_element_ns;
+    sh.endElementNs = &xml_lua_sax_end_element_ns;
+
+    // the handler contents are copied into the context
+    parser->ctx = xmlCreatePushParserCtxt(&sh, &parser->cbs, NULL, 0, name);
+    parser->cbs.ctx = parser->ctx;
+
+    xmlCtxtSetOptions(parser->ctx, XML_PARSE_NOBLANKS | XML_PARSE_RECOVER | XML_PARSE_NOENT);
+    xmlCtxtSetErrorHandler(parser->ctx, &xml_error_handler, &parser->err_data);
+
+    return 1;
+}
+
+/*** RST
+.. lua:class:: XMLPushParser
+
+    A SAX parser fed in chunks, see :lua:func:`pushparser`.
+
+    .. lua:method:: parse(chunk)
+
+        Parse the next chunk of the document. Callbacks run for anything
+        completed by this chunk before this returns.
+
+        :param string chunk:
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_push_parser_parse(lua_State *L) {
+    xml_push_parser_t *parser = lua_checkxmlpushparser(L, 1);
+
+    size_t chunklen = 0;
+    const char *chunk = luaL_checklstring(L, 2, &chunklen);
+
+    if (parser->done) return luaL_error(L, "parser is already finished");
+
+    // callbacks run on whichever coroutine is feeding the parser
+    parser->cbs.L = L;
+
+    xmlParseChunk(parser->ctx, chunk, (int)chunklen, 0);
+
+    return 0;
+}
+
+/*** RST
+    .. lua:method:: finish()
+
+        Signal the end of the document and run any remaining callbacks.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_push_parser_finish(lua_State *L) {
+    xml_push_parser_t *parser = lua_checkxmlpushparser(L, 1);
+
+    if (parser->done) return 0;
+
+    parser->cbs.L = L;
+
+    xmlParseChunk(parser->ctx, NULL, 0, 1);
+    parser->done = 1;
+
+    return 0;
+}
+
+int xml_lua_push_parser_del(lua_State *L) {
+    xml_push_parser_t *parser = lua_checkxmlpushparser(L, 1);
+
+    if (parser->cbs.startelement) luaL_unref(L, LUA_REGISTRYINDEX, parser->cbs.startelement);
+    if (parser->cbs.endelement) luaL_unref(L, LUA_REGISTRYINDEX, parser->cbs.endelement);
+
+    if (parser->ctx) {
+        if (parser->ctx->myDoc) xmlFreeDoc(parser->ctx->myDoc);
+        xmlFreeParserCtxt(parser->ctx);
+    }
+
+    return 0;
+}
+
+
+/*** RST
+.. lua:function:: parsequeue(callbacks)
+
+    Create a :lua:class:`XMLParseQueue` that parses submitted documents on a
+    pool of worker threads. The workers record SAX events into buffers; the
+    events are then delivered to the Lua callbacks, in submission order, by
+    :lua:meth:`XMLParseQueue.drain`, typically a batch per frame from a
+    coroutine.
+
+    ``callbacks`` may contain ``startelement`` and ``endelement`` as for
+    :lua:func:`read_string`, plus ``startdocument`` and ``enddocument``,
+    which are called with the document name at its delivery boundaries.
+
+    :param table callbacks:
+    :rtype: XMLParseQueue
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define XML_PARSE_QUEUE_MT "XMLParseQueue"
+#define lua_checkxmlparsequeue(L, ind) (xml_parse_queue_t*)luaL_checkudata(L, ind, XML_PARSE_QUEUE_MT)
+
+#define XML_QUEUE_MAX_THREADS 4
+
+// buffered SAX event record types
+#define XML_QUEUE_EVENT_START 1
+#define XML_QUEUE_EVENT_END   2
+
+// document states; WAITING -> PARSING by a worker, PARSING -> PARSED by the
+// same worker, PARSED -> DELIVERED on the Lua side. the event buffer is only
+// touched by the owning worker until PARSED
+#define XML_QUEUE_DOC_WAITING   0
+#define XML_QUEUE_DOC_PARSING   1
+#define XML_QUEUE_DOC_PARSED    2
+#define XML_QUEUE_DOC_DELIVERED 3
+
+typedef struct xml_queue_doc_t {
+    char *name;
+    char *data;
+    size_t datalen;
+
+    int state;
+
+    xmlParserCtxtPtr ctx; // only valid while parsing
+
+    uint8_t *events;
+    size_t events_len;
+    size_t events_cap;
+    size_t read_pos;
+
+    struct xml_queue_doc_t *next;
+} xml_queue_doc_t;
+
+typedef struct {
+    int startelement;
+    int endelement;
+    int startdocument;
+    int enddocument;
+
+    HANDLE mutex;
+    HANDLE threads[XML_QUEUE_MAX_THREADS];
+    int thread_count;
+    int stop;
+
+    xml_queue_doc_t *docs; // submission (and delivery) order
+    xml_queue_doc_t *docs_tail;
+} xml_parse_queue_t;
+
+static void xml_queue_doc_append(xml_queue_doc_t *doc, const void *data, size_t len) {
+    if (doc->events_len + len > doc->events_cap) {
+        doc->events_cap = doc->events_cap ? doc->events_cap * 2 : 4096;
+        while (doc->events_len + len > doc->events_cap) doc->events_cap *= 2;
+        doc->events = egoverlay_realloc(doc->events, doc->events_cap);
+    }
+
+    memcpy(doc->events + doc->events_len, data, len);
+    doc->events_len += len;
+}
+
+static void xml_queue_start_element_ns(
+    void *ud,
+    const xmlChar *localname,
+    const xmlChar *prefix,
+    const xmlChar *URI,
+    int nb_namespaces,
+    const xmlChar **namespaces,
+    int nb_attributes,
+    int nb_defaulted,
+    const xmlChar **attributes
+) {
+    UNUSED_PARAM(prefix);
+    UNUSED_PARAM(URI);
+    UNUSED_PARAM(nb_namespaces);
+    UNUSED_PARAM(namespaces);
+    UNUSED_PARAM(nb_defaulted);
+
+    xml_queue_doc_t *doc = (xml_queue_doc_t*)ud;
+
+    uint8_t type = XML_QUEUE_EVENT_START;
+    int32_t line = doc->ctx->input->line;
+    uint16_t namelen = (uint16_t)strlen((const char*)localname);
+    uint16_t nattrs = (uint16_t)nb_attributes;
+
+    xml_queue_doc_append(doc, &type, 1);
+    xml_queue_doc_append(doc, &line, 4);
+    xml_queue_doc_append(doc, &namelen, 2);
+    xml_queue_doc_append(doc, localname, namelen);
+    xml_queue_doc_append(doc, &nattrs, 2);
+
+    for (int a=0;a<nb_attributes;a++) {
+        const char *attrname = (const char *)attributes[a * 5];
+        const char *attrvalue = (const char *)attributes[(a * 5) + 3];
+        const char *attrvalend = (const char *)attributes[(a * 5) + 4];
+
+        uint16_t klen = (uint16_t)strlen(attrname);
+        uint32_t vlen = (uint32_t)(attrvalend - attrvalue);
+
+        xml_queue_doc_append(doc, &klen, 2);
+        xml_queue_doc_append(doc, attrname, klen);
+        xml_queue_doc_append(doc, &vlen, 4);
+        xml_queue_doc_append(doc, attrvalue, vlen);
+    }
+}
+
+static void xml_queue_end_element_ns(
+    void *ud,
+    const xmlChar *localname,
+    const xmlChar *prefix,
+    const xmlChar *URI
+) {
+    UNUSED_PARAM(prefix);
+    UNUSED_PARAM(URI);
+
+    xml_queue_doc_t *doc = (xml_queue_doc_t*)ud;
+
+    uint8_t type = XML_QUEUE_EVENT_END;
+    int32_t line = doc->ctx->input->line;
+    uint16_t namelen = (uint16_t)strlen((const char*)localname);
+
+    xml_queue_doc_append(doc, &type, 1);
+    xml_queue_doc_append(doc, &line, 4);
+    xml_queue_doc_append(doc, &namelen, 2);
+    xml_queue_doc_append(doc, localname, namelen);
+}
+
+static DWORD WINAPI xml_queue_thread(LPVOID param) {
+    xml_parse_queue_t *queue = (xml_parse_queue_t*)param;
+
+    while (!queue->stop) {
+        xml_queue_doc_t *doc = NULL;
+
+        WaitForSingleObject(queue->mutex, INFINITE);
+        for (xml_queue_doc_t *d=queue->docs;d;d=d->next) {
+            if (d->state==XML_QUEUE_DOC_WAITING) {
+                d->state = XML_QUEUE_DOC_PARSING;
+                doc = d;
+                break;
+            }
+        }
+        ReleaseMutex(queue->mutex);
+
+        if (!doc) {
+            Sleep(5);
+            continue;
+        }
+
+        error_handler_data_t err_data = {0};
+        err_data.file = doc->data;
+        err_data.file_size = doc->datalen;
+
+        xmlSAXHandler sh = {0};
+        sh.initialized = XML_SAX2_MAGIC;
+        sh.startElementNs = &xml_queue_start_element_ns;
+        sh.endElementNs = &xml_queue_end_element_ns;
+
+        xmlParserCtxtPtr ctx = xmlNewSAXParserCtxt(&sh, doc);
+        doc->ctx = ctx;
+
+        xmlCtxtSetOptions(ctx, XML_PARSE_NOBLANKS | XML_PARSE_RECOVER | XML_PARSE_NOENT);
+        xmlCtxtSetErrorHandler(ctx, &xml_error_handler, &err_data);
+
+        double parse_start = profiler_time();
+
+        xmlDocPtr xdoc = xmlCtxtReadMemory(ctx, doc->data, (int)doc->datalen, doc->name, NULL,
+                                           XML_PARSE_RECOVER | XML_PARSE_NOENT);
+        if (xdoc) xmlFreeDoc(xdoc);
+
+        profiler_trace_complete("xml-parse", parse_start, profiler_time() - parse_start);
+
+        doc->ctx = NULL;
+        xmlFreeParserCtxt(ctx);
+
+        WaitForSingleObject(queue->mutex, INFINITE);
+        doc->state = XML_QUEUE_DOC_PARSED;
+        ReleaseMutex(queue->mutex);
+    }
+
+    return 0;
+}
+
+int xml_lua_parse_queue_submit(lua_State *L);
+int xml_lua_parse_queue_drain(lua_State *L);
+int xml_lua_parse_queue_del(lua_State *L);
+
+static luaL_Reg xml_parse_queue_funcs[] = {
+    "submit", &xml_lua_parse_queue_submit,
+    "drain" , &xml_lua_parse_queue_drain,
+    "__gc"  , &xml_lua_parse_queue_del,
+    NULL    , NULL
+};
+
+int xml_lua_parse_queue_new(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    xml_parse_queue_t *queue = lua_newuserdata(L, sizeof(xml_parse_queue_t));
+    memset(queue, 0, sizeof(xml_parse_queue_t));
+
+    if (luaL_newmetatable(L, XML_PARSE_QUEUE_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, xml_parse_queue_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    const char *cbnames[] = { "startelement", "endelement", "startdocument", "enddocument" };
+    int *cbrefs[4] = { &queue->startelement, &queue->endelement, &queue->startdocument, &queue->enddocument };
+
+    for (int cb=0;cb<4;cb++) {
+        if (lua_getfield(L, 1, cbnames[cb])==LUA_TFUNCTION) {
+            *cbrefs[cb] = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    queue->mutex = CreateMutex(0, FALSE, NULL);
+
+    SYSTEM_INFO si = {0};
+    GetSystemInfo(&si);
+
+    queue->thread_count = (int)si.dwNumberOfProcessors - 1;
+    if (queue->thread_count < 1) queue->thread_count = 1;
+    if (queue->thread_count > XML_QUEUE_MAX_THREADS) queue->thread_count = XML_QUEUE_MAX_THREADS;
+
+    for (int t=0;t<queue->thread_count;t++) {
+        queue->threads[t] = CreateThread(0, 0, &xml_queue_thread, queue, 0, NULL);
+    }
+
+    return 1;
+}
+
+/*** RST
+.. lua:class:: XMLParseQueue
+
+    A pool backed SAX parser, see :lua:func:`parsequeue`.
+
+    .. lua:method:: submit(name, xml)
+
+        Queue a document for parsing.
+
+        :param string name: The document name.
+        :param string xml: The XML to parse.
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_parse_queue_submit(lua_State *L) {
+    xml_parse_queue_t *queue = lua_checkxmlparsequeue(L, 1);
+
+    size_t namelen = 0;
+    const char *name = luaL_checklstring(L, 2, &namelen);
+    size_t datalen = 0;
+    const char *data = luaL_checklstring(L, 3, &datalen);
+
+    xml_queue_doc_t *doc = egoverlay_calloc(1, sizeof(xml_queue_doc_t));
+
+    doc->name = egoverlay_calloc(namelen+1, sizeof(char));
+    memcpy(doc->name, name, namelen);
+
+    doc->data = egoverlay_malloc(datalen);
+    memcpy(doc->data, data, datalen);
+    doc->datalen = datalen;
+
+    WaitForSingleObject(queue->mutex, INFINITE);
+    if (queue->docs_tail) queue->docs_tail->next = doc;
+    else queue->docs = doc;
+    queue->docs_tail = doc;
+    ReleaseMutex(queue->mutex);
+
+    return 0;
+}
+
+static void xml_queue_run_name_cb(lua_State *L, int ref, const char *name) {
+    if (ref==0) return;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lua_pushstring(L, name);
+
+    if (lua_pcall(L, 1, 0, 0)!=LUA_OK) {
+        logger_t *log = logger_get("xml");
+        logger_error(log, "Error during document callback: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+/*** RST
+    .. lua:method:: drain(maxevents)
+
+        Deliver up to ``maxevents`` buffered SAX events to the callbacks.
+        Documents are delivered in submission order; a document's events are
+        only delivered after it finished parsing.
+
+        Returns ``true`` when every submitted document has been fully
+        delivered, ``false`` when there's more to do (either more buffered
+        events or workers still parsing).
+
+        :param integer maxevents:
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_parse_queue_drain(lua_State *L) {
+    xml_parse_queue_t *queue = lua_checkxmlparsequeue(L, 1);
+    int maxevents = (int)luaL_checkinteger(L, 2);
+
+    logger_t *log = logger_get("xml");
+
+    int n = 0;
+    while (n < maxevents) {
+        // next undelivered document, in submission order
+        xml_queue_doc_t *doc = queue->docs;
+        while (doc && doc->state==XML_QUEUE_DOC_DELIVERED) doc = doc->next;
+
+        if (!doc) {
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+
+        WaitForSingleObject(queue->mutex, INFINITE);
+        int state = doc->state;
+        ReleaseMutex(queue->mutex);
+
+        if (state!=XML_QUEUE_DOC_PARSED) {
+            // still being parsed, come back later
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+
+        if (doc->read_pos==0) xml_queue_run_name_cb(L, queue->startdocument, doc->name);
+
+        while (n < maxevents && doc->read_pos < doc->events_len) {
+            uint8_t type = doc->events[doc->read_pos];
+            doc->read_pos += 1;
+
+            int32_t line = 0;
+            memcpy(&line, doc->events + doc->read_pos, 4);
+            doc->read_pos += 4;
+
+            uint16_t namelen = 0;
+            memcpy(&namelen, doc->events + doc->read_pos, 2);
+            doc->read_pos += 2;
+
+            const char *ename = (const char*)(doc->events + doc->read_pos);
+            doc->read_pos += namelen;
+
+            if (type==XML_QUEUE_EVENT_START) {
+                uint16_t nattrs = 0;
+                memcpy(&nattrs, doc->events + doc->read_pos, 2);
+                doc->read_pos += 2;
+
+                if (queue->startelement) {
+                    lua_rawgeti(L, LUA_REGISTRYINDEX, queue->startelement);
+                    xml_push_interned(L, ename, namelen);
+                    lua_createtable(L, 0, nattrs);
+                }
+
+                for (uint16_t a=0;a<nattrs;a++) {
+                    uint16_t klen = 0;
+                    memcpy(&klen, doc->events + doc->read_pos, 2);
+                    doc->read_pos += 2;
+                    const char *k = (const char*)(doc->events + doc->read_pos);
+                    doc->read_pos += klen;
+
+                    uint32_t vlen = 0;
+                    memcpy(&vlen, doc->events + doc->read_pos, 4);
+                    doc->read_pos += 4;
+                    const char *v = (const char*)(doc->events + doc->read_pos);
+                    doc->read_pos += vlen;
+
+                    if (queue->startelement) {
+                        xml_push_interned(L, k, klen);
+                        lua_pushlstring(L, v, vlen);
+                        lua_rawset(L, -3);
+                    }
+                }
+
+                if (queue->startelement) {
+                    lua_pushstring(L, doc->name);
+                    lua_pushinteger(L, line);
+
+                    if (lua_pcall(L, 4, 0, 0)!=LUA_OK) {
+                        logger_error(log, "Error during startelement callback: %s", lua_tostring(L, -1));
+                        lua_pop(L, 1);
+                    }
+                }
+            } else {
+                if (queue->endelement) {
+                    lua_rawgeti(L, LUA_REGISTRYINDEX, queue->endelement);
+                    xml_push_interned(L, ename, namelen);
+                    lua_pushstring(L, doc->name);
+                    lua_pushinteger(L, line);
+
+                    if (lua_pcall(L, 3, 0, 0)!=LUA_OK) {
+                        logger_error(log, "Error during endelement callback: %s", lua_tostring(L, -1));
+                        lua_pop(L, 1);
+                    }
+                }
+            }
+
+            n++;
+        }
+
+        if (doc->read_pos>=doc->events_len) {
+            xml_queue_run_name_cb(L, queue->enddocument, doc->name);
+
+            doc->state = XML_QUEUE_DOC_DELIVERED;
+
+            // the data and events aren't needed anymore
+            egoverlay_free(doc->data);
+            doc->data = NULL;
+            if (doc->events) egoverlay_free(doc->events);
+            doc->events = NULL;
+            doc->events_len = 0;
+        }
+    }
+
+    lua_pushboolean(L, 0);
+    return 1;
+}
+
+int xml_lua_parse_queue_del(lua_State *L) {
+    xml_parse_queue_t *queue = lua_checkxmlparsequeue(L, 1);
+
+    queue->stop = 1;
+    for (int t=0;t<queue->thread_count;t++) {
+        WaitForSingleObject(queue->threads[t], INFINITE);
+        CloseHandle(queue->threads[t]);
+    }
+    CloseHandle(queue->mutex);
+
+    xml_queue_doc_t *doc = queue->docs;
+    while (doc) {
+        xml_queue_doc_t *next = doc->next;
+        egoverlay_free(doc->name);
+        if (doc->data) egoverlay_free(doc->data);
+        if (doc->events) egoverlay_free(doc->events);
+        egoverlay_free(doc);
+        doc = next;
+    }
+
+    if (queue->startelement) luaL_unref(L, LUA_REGISTRYINDEX, queue->startelement);
+    if (queue->endelement) luaL_unref(L, LUA_REGISTRYINDEX, queue->endelement);
+    if (queue->startdocument) luaL_unref(L, LUA_REGISTRYINDEX, queue->startdocument);
+    if (queue->enddocument) luaL_unref(L, LUA_REGISTRYINDEX, queue->enddocument);
+
+    return 0;
+}
+
 /*** RST
 Classes
 -------
@@ -487,7 +1119,37 @@ void xml_node_lua_register_metatable(lua_State *L) {
     }
 }
 
+// Node wrappers are pooled in a weak-valued cache keyed by the node pointer:
+// walking a document revisits parents and siblings constantly, and reusing
+// the wrapper instead of allocating a fresh userdata per visit keeps a large
+// tree walk from churning hundreds of thousands of transient allocations.
+// The weak values let the GC release wrappers in bulk once a walk drops
+// them; nodes owned by Lua (lua_managed) always get a fresh wrapper since
+// their lifetime is tied to the userdata itself.
+#define XML_NODE_CACHE_KEY "eg-overlay-xml-node-cache"
+
 void lua_pushxmlnode(lua_State *L, xmlNodePtr node, int lua_managed) {
+    if (!lua_managed) {
+        if (lua_getfield(L, LUA_REGISTRYINDEX, XML_NODE_CACHE_KEY)==LUA_TNIL) {
+            lua_pop(L, 1);
+
+            lua_newtable(L);
+            lua_newtable(L);
+            lua_pushstring(L, "v");
+            lua_setfield(L, -2, "__mode");
+            lua_setmetatable(L, -2);
+
+            lua_pushvalue(L, -1);
+            lua_setfield(L, LUA_REGISTRYINDEX, XML_NODE_CACHE_KEY);
+        }
+
+        if (lua_rawgetp(L, -1, node)!=LUA_TNIL) {
+            lua_remove(L, -2); // drop the cache table, leave the wrapper
+            return;
+        }
+        lua_pop(L, 1);
+    }
+
     xmlNodePtr *ppnode = (xmlNodePtr*)lua_newuserdata(L, sizeof(xmlNodePtr));
     *ppnode = node;
 
@@ -495,6 +1157,13 @@ void lua_pushxmlnode(lua_State *L, xmlNodePtr node, int lua_managed) {
     lua_setiuservalue(L, -2, 1);
     xml_node_lua_register_metatable(L);
     lua_setmetatable(L, -2);
+
+    if (!lua_managed) {
+        // cache[node] = wrapper; stack: cache, wrapper
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, -3, node);
+        lua_remove(L, -2);
+    }
 }
 
 xmlNodePtr lua_checkxmlnode(lua_State *L, int ind) {
@@ -817,3 +1486,241 @@ int xml_node_lua_line(lua_State *L) {
 
     return 1;
 }
+
+/*** RST
+Cleaners
+--------
+
+.. lua:function:: cleaner(name)
+
+    Create a streaming cleaner that repairs malformed XML chunk by chunk.
+
+    Marker pack XML routinely contains raw ``&`` characters that aren't part
+    of a valid entity; libxml2 aborts on them. The cleaner escapes them to
+    ``&amp;`` as data streams through, carrying at most one partial entity
+    across chunk boundaries, so a whole document never has to be duplicated
+    in memory just to be repaired.
+
+    :param name: A name used in log warnings, typically the file name.
+    :type name: string
+    :rtype: xmlcleaner
+
+    .. code-block:: lua
+        :caption: Example
+
+        local cleaner = xml.cleaner('markers.xml')
+
+        for chunk in chunks do
+            parser:parse(cleaner:clean(chunk))
+        end
+        parser:parse(cleaner:finish())
+        parser:finish()
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define XML_CLEANER_MT "XMLCleanerMetaTable"
+
+// the longest run of entity characters considered before deciding a '&' is a
+// raw ampersand; also bounds what is carried across chunk boundaries
+#define XML_CLEANER_MAX_ENTITY 32
+
+typedef struct {
+    char *name;
+
+    // partial entity carried from the previous chunk
+    char pending[XML_CLEANER_MAX_ENTITY + 2];
+    size_t pending_len;
+
+    int line;
+    int done;
+} xml_cleaner_t;
+
+#define lua_checkxmlcleaner(L, ind) (xml_cleaner_t*)luaL_checkudata(L, ind, XML_CLEANER_MT)
+
+int xml_lua_cleaner_clean(lua_State *L);
+int xml_lua_cleaner_finish(lua_State *L);
+int xml_lua_cleaner_del(lua_State *L);
+
+static luaL_Reg xml_cleaner_funcs[] = {
+    "clean" , &xml_lua_cleaner_clean,
+    "finish", &xml_lua_cleaner_finish,
+    "__gc"  , &xml_lua_cleaner_del,
+    NULL    , NULL
+};
+
+int xml_lua_cleaner_new(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    xml_cleaner_t *cleaner = lua_newuserdata(L, sizeof(xml_cleaner_t));
+    memset(cleaner, 0, sizeof(xml_cleaner_t));
+    cleaner->line = 1;
+
+    cleaner->name = egoverlay_calloc(strlen(name)+1, sizeof(char));
+    memcpy(cleaner->name, name, strlen(name));
+
+    if (luaL_newmetatable(L, XML_CLEANER_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, xml_cleaner_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+static int xml_cleaner_entity_char(char c) {
+    // entity names, plus '#' for character references
+    return (c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9') ||
+           c==':' || c=='.' || c=='-' || c=='#';
+}
+
+// scan data for raw ampersands, appending the repaired output to buf. when
+// at_end is 0 an ampersand too close to the end of data to judge is stashed
+// in pending for the next chunk instead of being emitted
+static void xml_cleaner_run(xml_cleaner_t *cleaner, const char *data, size_t len, int at_end, luaL_Buffer *buf) {
+    size_t i = 0;
+
+    while (i<len) {
+        char c = data[i];
+
+        if (c=='\n') cleaner->line++;
+
+        if (c!='&') {
+            luaL_addchar(buf, c);
+            i++;
+            continue;
+        }
+
+        // find where this entity resolves
+        size_t j = i + 1;
+        int valid = -1; // -1 undecided, 0 raw ampersand, 1 entity
+        while (j<len && j - i <= XML_CLEANER_MAX_ENTITY) {
+            if (data[j]==';') {
+                valid = 1;
+                break;
+            }
+            if (!xml_cleaner_entity_char(data[j])) {
+                valid = 0;
+                break;
+            }
+            j++;
+        }
+
+        if (valid==-1) {
+            if (j - i > XML_CLEANER_MAX_ENTITY) {
+                // too long to be an entity
+                valid = 0;
+            } else if (!at_end) {
+                // undecided at the chunk boundary; carry it over
+                cleaner->pending_len = len - i;
+                memcpy(cleaner->pending, data + i, cleaner->pending_len);
+                return;
+            } else {
+                // end of document, never resolved
+                valid = 0;
+            }
+        }
+
+        if (valid) {
+            luaL_addlstring(buf, data + i, j - i + 1);
+            i = j + 1;
+        } else {
+            logger_t *log = logger_get("xml-cleaner");
+            logger_warn(log, "%s:%d: invalid entity, escaping raw '&'.", cleaner->name, cleaner->line);
+
+            luaL_addlstring(buf, "&amp;", 5);
+            i++;
+        }
+    }
+}
+
+/*** RST
+.. lua:class:: xmlcleaner
+
+    .. lua:method:: clean(chunk)
+
+        Repair a chunk. Returns the repaired data, which may be shorter than
+        the input if a potential entity straddles the chunk boundary (the
+        remainder is emitted with the next chunk or :lua:meth:`finish`).
+
+        :param string chunk:
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_cleaner_clean(lua_State *L) {
+    xml_cleaner_t *cleaner = lua_checkxmlcleaner(L, 1);
+
+    size_t chunklen = 0;
+    const char *chunk = luaL_checklstring(L, 2, &chunklen);
+
+    if (cleaner->done) return luaL_error(L, "cleaner is already finished");
+
+    luaL_Buffer buf;
+    luaL_buffinit(L, &buf);
+
+    if (cleaner->pending_len) {
+        // prepend the carried partial entity to the chunk and re-scan. the
+        // carry is copied into the pending array before xml_cleaner_run
+        // returns, so the work buffer can be freed right after
+        size_t worklen = cleaner->pending_len + chunklen;
+        char *work = egoverlay_calloc(worklen, sizeof(char));
+        memcpy(work, cleaner->pending, cleaner->pending_len);
+        memcpy(work + cleaner->pending_len, chunk, chunklen);
+
+        cleaner->pending_len = 0;
+        xml_cleaner_run(cleaner, work, worklen, 0, &buf);
+
+        egoverlay_free(work);
+    } else {
+        xml_cleaner_run(cleaner, chunk, chunklen, 0, &buf);
+    }
+
+    luaL_pushresult(&buf);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: finish()
+
+        Flush any carried partial entity and return the final repaired bytes.
+
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int xml_lua_cleaner_finish(lua_State *L) {
+    xml_cleaner_t *cleaner = lua_checkxmlcleaner(L, 1);
+
+    if (cleaner->done) return luaL_error(L, "cleaner is already finished");
+    cleaner->done = 1;
+
+    luaL_Buffer buf;
+    luaL_buffinit(L, &buf);
+
+    if (cleaner->pending_len) {
+        size_t len = cleaner->pending_len;
+        cleaner->pending_len = 0;
+        xml_cleaner_run(cleaner, cleaner->pending, len, 1, &buf);
+    }
+
+    luaL_pushresult(&buf);
+
+    return 1;
+}
+
+int xml_lua_cleaner_del(lua_State *L) {
+    xml_cleaner_t *cleaner = lua_checkxmlcleaner(L, 1);
+
+    if (cleaner->name) {
+        egoverlay_free(cleaner->name);
+        cleaner->name = NULL;
+    }
+
+    return 0;
+}
@@ -24,6 +24,7 @@ Functions
 #include "logging/logger.h"
 #include "utils.h"
 #include <stdio.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdint.h>
 #include <lauxlib.h>
@@ -56,69 +57,184 @@ typedef struct zip_file_header_t {
 } zip_file_header_t;
 
 typedef struct zip_t {
-    FILE *fstream;
+    // the whole file is memory mapped; entry metadata and stored entry
+    // content are read straight out of the mapping
+    HANDLE file;
+    HANDLE mapping;
+    const uint8_t *map;
+    size_t map_size;
+
     zip_file_header_t *files;
 
+    // name -> entry hash, built once after the central directory parse so
+    // per-entry lookups during import are probes instead of list scans
+    zip_file_header_t **name_map;
+    size_t name_map_size;
+
+    // reusable decompression buffer, grown to the largest entry seen so far
+    uint8_t *inflate_buf;
+    size_t inflate_buf_size;
+
     int ref_count;
+
+    // open-zip cache bookkeeping
+    char *path;
+    __time64_t mtime;
+    int64_t size;
+    struct zip_t *cache_next;
 } zip_t;
 
+// Parsed zips are cached across reopens keyed by path. Loaders reopen the
+// same pack zip repeatedly; as long as the file's mtime and size match, the
+// cached central directory (and mapping) are reused instead of rescanned.
+static zip_t *zip_cache = NULL;
+static CRITICAL_SECTION zip_cache_cs;
+static INIT_ONCE zip_cache_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK zip_cache_init(PINIT_ONCE once, PVOID param, PVOID *context) {
+    UNUSED_PARAM(once);
+    UNUSED_PARAM(param);
+    UNUSED_PARAM(context);
+
+    InitializeCriticalSection(&zip_cache_cs);
+
+    return TRUE;
+}
+
 int zip_lua_open_module(lua_State *L);
 
 void zip_lua_init() {
     lua_manager_add_module_opener("zip", &zip_lua_open_module);
 }
 
+// release the cached parses at shutdown so the CRT leak dump stays clean
+void zip_cleanup() {
+    while (zip_cache) {
+        zip_t *c = zip_cache;
+        zip_cache = c->cache_next;
+        c->cache_next = NULL;
+        zip_unref(c);
+    }
+}
+
 zip_t *zip_open(const char *path);
 void zip_free(zip_t *zip);
 
 void zip_ref(zip_t *zip);
 void zip_unref(zip_t *zip);
 
-int zip_find_central_directory(FILE *zip, uint32_t *cd_offset, uint32_t *cd_size);
-int zip_read_central_directory_file_header(FILE *zip, zip_cdfh_t *cdfh);
+int zip_find_central_directory(zip_t *zip, uint32_t *cd_offset, uint32_t *cd_size);
+int zip_read_central_directory_file_header(zip_t *zip, size_t *pos, zip_cdfh_t *cdfh);
+
+static __time64_t zip_file_mtime(const char *path, int64_t *size) {
+    struct __stat64 st;
+
+    if (_stat64(path, &st)!=0) return 0;
+
+    if (size) *size = st.st_size;
+    return st.st_mtime;
+}
+
+static void zip_build_name_map(zip_t *zip) {
+    size_t count = 0;
+    for (zip_file_header_t *fh=zip->files;fh;fh=fh->next) count++;
+
+    zip->name_map_size = 16;
+    while (zip->name_map_size < count * 2) zip->name_map_size <<= 1;
+    zip->name_map = egoverlay_calloc(zip->name_map_size, sizeof(zip_file_header_t*));
+
+    for (zip_file_header_t *fh=zip->files;fh;fh=fh->next) {
+        size_t ind = djb2_hash_string(fh->cdfh.file_name) & (zip->name_map_size - 1);
+        while (zip->name_map[ind]) ind = (ind + 1) & (zip->name_map_size - 1);
+        zip->name_map[ind] = fh;
+    }
+}
+
+static zip_cdfh_t *zip_lookup_entry(zip_t *zip, const char *path) {
+    if (!zip->name_map) return NULL;
+
+    size_t ind = djb2_hash_string(path) & (zip->name_map_size - 1);
+    while (zip->name_map[ind]) {
+        if (strcmp(zip->name_map[ind]->cdfh.file_name, path)==0) return &zip->name_map[ind]->cdfh;
+        ind = (ind + 1) & (zip->name_map_size - 1);
+    }
+
+    return NULL;
+}
 
 zip_t *zip_open(const char *path) {
-    logger_t *log = logger_get("zip");    
-    FILE *f = fopen(path, "rb");
+    logger_t *log = logger_get("zip");
+
+    // reuse a cached parse when the file hasn't changed
+    InitOnceExecuteOnce(&zip_cache_once, &zip_cache_init, NULL, NULL);
+
+    int64_t fsize = 0;
+    __time64_t mtime = zip_file_mtime(path, &fsize);
+
+    EnterCriticalSection(&zip_cache_cs);
+    for (zip_t *c=zip_cache;c;c=c->cache_next) {
+        if (strcmp(c->path, path)==0) {
+            if (c->mtime==mtime && c->size==fsize) {
+                zip_ref(c);
+                LeaveCriticalSection(&zip_cache_cs);
+                return c;
+            }
+            break; // stale cache entry; fall through and re-open
+        }
+    }
+    LeaveCriticalSection(&zip_cache_cs);
 
-    if (!f) {
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file==INVALID_HANDLE_VALUE) {
         logger_error(log, "Couldn't open %s.", path);
         return NULL;
     }
 
-    uint32_t cd_offset = 0;
-    uint32_t cd_size = 0;
-    if (zip_find_central_directory(f, &cd_offset, &cd_size)) {
-        logger_error(log, "%s : Couldn't find central directory (this probably isn't a zip file).", path);
-        fclose(f);
+    LARGE_INTEGER file_size = {0};
+    GetFileSizeEx(file, &file_size);
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        logger_error(log, "Couldn't create file mapping for %s.", path);
+        CloseHandle(file);
+        return NULL;
+    }
+
+    const uint8_t *map = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map) {
+        logger_error(log, "Couldn't map %s.", path);
+        CloseHandle(mapping);
+        CloseHandle(file);
         return NULL;
     }
 
     zip_t *zip = egoverlay_calloc(1, sizeof(zip_t));
-    zip->fstream = f;
+    zip->file = file;
+    zip->mapping = mapping;
+    zip->map = map;
+    zip->map_size = (size_t)file_size.QuadPart;
 
-    // start reading the central directory file entries
-    if (fseek(f, cd_offset, SEEK_SET)) {
-        fclose(f);
-        logger_error(log, "%s : Couldn't seek to central directory file entries.", path);
-        egoverlay_free(zip);
+    uint32_t cd_offset = 0;
+    uint32_t cd_size = 0;
+    if (zip_find_central_directory(zip, &cd_offset, &cd_size)) {
+        logger_error(log, "%s : Couldn't find central directory (this probably isn't a zip file).", path);
+        zip_free(zip);
         return NULL;
     }
 
-    size_t cd_read_size = 0;
+    size_t pos = cd_offset;
+    size_t cd_end = (size_t)cd_offset + cd_size;
     zip_file_header_t *prev = NULL;
-    while (cd_read_size < cd_size) {
+    while (pos < cd_end) {
         zip_file_header_t *fh = egoverlay_calloc(1, sizeof(zip_file_header_t));
 
-        size_t cdfh_size = zip_read_central_directory_file_header(f, &fh->cdfh);
-        if (cdfh_size<0) {
-            fclose(f);
+        if (zip_read_central_directory_file_header(zip, &pos, &fh->cdfh)) {
             logger_error(log, "%s : Couldn't read central directory file header.", path);
             egoverlay_free(fh);
             zip_free(zip);
             return NULL;
         }
-        cd_read_size += cdfh_size;
 
         _strlwr_s(fh->cdfh.file_name, fh->cdfh.file_name_len + 1);
 
@@ -127,16 +243,57 @@ zip_t *zip_open(const char *path) {
         prev = fh;
     }
 
-    zip_ref(zip);
+    zip_build_name_map(zip);
+
+    zip->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(zip->path, path, strlen(path));
+    zip->mtime = mtime;
+    zip->size = fsize;
 
-    // logger_debug(log, "Created 0x%x (%s)", zip, path);
+    // evict a stale cached parse of the same path, then cache this one.
+    // the cache holds its own reference so the parse survives close/reopen
+    EnterCriticalSection(&zip_cache_cs);
+
+    zip_t *stale = NULL;
+    zip_t **c = &zip_cache;
+    while (*c) {
+        if (strcmp((*c)->path, path)==0) {
+            stale = *c;
+            *c = stale->cache_next;
+            break;
+        }
+        c = &(*c)->cache_next;
+    }
+
+    zip->cache_next = zip_cache;
+    zip_cache = zip;
+    zip_ref(zip); // cache reference
+    zip_ref(zip); // caller reference
+
+    LeaveCriticalSection(&zip_cache_cs);
+
+    if (stale) zip_unref(stale);
 
     return zip;
 }
 
 void zip_free(zip_t *zip) {
-    // logger_t *log = logger_get("zip");
-    // logger_debug(log, "Freeing 0x%x", zip);
+    // a zip being freed can't still be in the cache (the cache holds a
+    // reference), but guard against it anyway
+    InitOnceExecuteOnce(&zip_cache_once, &zip_cache_init, NULL, NULL);
+    EnterCriticalSection(&zip_cache_cs);
+    zip_t **c = &zip_cache;
+    while (*c) {
+        if (*c==zip) {
+            *c = zip->cache_next;
+            break;
+        }
+        c = &(*c)->cache_next;
+    }
+    LeaveCriticalSection(&zip_cache_cs);
+
+    if (zip->name_map) egoverlay_free(zip->name_map);
+    if (zip->path) egoverlay_free(zip->path);
 
     zip_file_header_t *h = zip->files;
     zip_file_header_t *next = NULL;
@@ -146,17 +303,22 @@ void zip_free(zip_t *zip) {
         egoverlay_free(h);
         h = next;
     }
-    fclose(zip->fstream);
+
+    if (zip->inflate_buf) egoverlay_free(zip->inflate_buf);
+
+    if (zip->map) UnmapViewOfFile(zip->map);
+    if (zip->mapping) CloseHandle(zip->mapping);
+    if (zip->file && zip->file!=INVALID_HANDLE_VALUE) CloseHandle(zip->file);
+
     egoverlay_free(zip);
 }
 
 void zip_ref(zip_t *zip) {
-    zip->ref_count++;
+    InterlockedIncrement((volatile LONG*)&zip->ref_count);
 }
 
 void zip_unref(zip_t *zip) {
-    zip->ref_count--;
-    if (zip->ref_count==0) zip_free(zip);
+    if (InterlockedDecrement((volatile LONG*)&zip->ref_count)==0) zip_free(zip);
 }
 
 void lua_pushzip(lua_State *L, zip_t *zip);
@@ -168,71 +330,64 @@ int zip_lua_del(lua_State *L);
 
 int zip_lua_files(lua_State *L);
 int zip_lua_file_content(lua_State *L);
+int zip_lua_content_hash(lua_State *L);
+int zip_lua_file_crc(lua_State *L);
+
+int zip_writer_lua_create(lua_State *L);
 
 int zip_lua_open_module(lua_State *L) {
     lua_newtable(L);
     lua_pushcfunction(L, &zip_lua_open);
     lua_setfield(L, -2, "open");
+    lua_pushcfunction(L, &zip_writer_lua_create);
+    lua_setfield(L, -2, "create");
 
     //luaL_setfuncs(L, zip_funcs, 0);
 
     return 1;
 }
 
-char *read_string(FILE *zip, size_t len) {
-    char *str = egoverlay_malloc(sizeof(char) * (len + 1));
-    _fread_nolock(str, sizeof(char), len, zip);
-    str[len] = 0;
-
-    return str;
-}
-
-uint32_t read_uint32(FILE *zip) {
+// all reads come straight out of the mapping via a cursor
+static uint32_t map_uint32(zip_t *zip, size_t *pos) {
     uint32_t val = 0;
-    _fread_nolock(&val, sizeof(uint32_t), 1, zip);
+    memcpy(&val, zip->map + *pos, 4);
+    *pos += 4;
 
     return val;
 }
 
-uint16_t read_uint16(FILE *zip) {
+static uint16_t map_uint16(zip_t *zip, size_t *pos) {
     uint16_t val = 0;
-    _fread_nolock(&val, sizeof(uint16_t), 1, zip);
+    memcpy(&val, zip->map + *pos, 2);
+    *pos += 2;
+
     return val;
 }
 
-int zip_find_central_directory(FILE *zip, uint32_t *cd_offset, uint32_t *cd_size) {
-    long eocd_start = -22;
+int zip_find_central_directory(zip_t *zip, uint32_t *cd_offset, uint32_t *cd_size) {
+    if (zip->map_size < 22) return -1;
 
-    fseek(zip, 0, SEEK_END);
-    size_t file_size = ftell(zip);
-
-    // start looking for the end of central directory record
-    fseek(zip, eocd_start, SEEK_END);
-
-    // start at 22 bytes from the end and look for the EOCD signature
-    uint32_t eocd_sig = 0;
-    while ((eocd_start * -1) < (file_size -22) && (eocd_sig=read_uint32(zip))!=0x06054b50) {
-        eocd_start--;
-        fseek(zip, eocd_start - 4, SEEK_END); // -4 because we read 4 bytes for the signature each time
+    // scan backwards from the end for the EOCD signature
+    size_t eocd = zip->map_size - 22;
+    for (;;) {
+        size_t pos = eocd;
+        if (map_uint32(zip, &pos)==0x06054b50) break;
+        if (eocd==0) return -1;
+        eocd--;
     }
 
-    if ((eocd_start * -1) >= (file_size - 22)) {
-        // couldn't find EOCD, probably not a zip file. or it's corrupted.
-        fclose(zip);
-        return -1;
-    }
+    size_t pos = eocd + 4;
 
     // these should be 0, unless someone tries to use part of an archive originally stored on floppy disks
-    uint16_t cd_disk_num = read_uint16(zip);
+    uint16_t cd_disk_num = map_uint16(zip, &pos);
     UNUSED_PARAM(cd_disk_num);
-    
-    uint16_t cd_start_disk = read_uint16(zip);
-    uint16_t cd_disk_records = read_uint16(zip);
 
+    uint16_t cd_start_disk = map_uint16(zip, &pos);
+    uint16_t cd_disk_records = map_uint16(zip, &pos);
 
-    uint16_t cd_records = read_uint16(zip);
-    *cd_size = read_uint32(zip);
-    *cd_offset = read_uint32(zip);
+    uint16_t cd_records = map_uint16(zip, &pos);
+    *cd_size = map_uint32(zip, &pos);
+    *cd_offset = map_uint32(zip, &pos);
 
     if (
         cd_start_disk==0xFFFF ||
@@ -244,35 +399,43 @@ int zip_find_central_directory(FILE *zip, uint32_t *cd_offset, uint32_t *cd_size
         abort();
     }
 
+    if ((size_t)*cd_offset + *cd_size > zip->map_size) return -1;
+
     return 0;
 }
 
-int zip_read_central_directory_file_header(FILE *zip, zip_cdfh_t *cdfh) {
-    int cd_read_size = 0;
-    uint32_t cdfh_sig = read_uint32(zip); cd_read_size += 4;
+int zip_read_central_directory_file_header(zip_t *zip, size_t *pos, zip_cdfh_t *cdfh) {
+    if (*pos + 46 > zip->map_size) return -1;
+
+    uint32_t cdfh_sig = map_uint32(zip, pos);
 
     if (cdfh_sig!=0x02014b50) {
         return -1;
     }
 
-    cdfh->version_by             = read_uint16(zip); cd_read_size += 2;
-    cdfh->version_extract        = read_uint16(zip); cd_read_size += 2;
-    cdfh->gp_bits                = read_uint16(zip); cd_read_size += 2;
-    cdfh->compression_method     = read_uint16(zip); cd_read_size += 2;
-    cdfh->file_mod_time          = read_uint16(zip); cd_read_size += 2;
-    cdfh->file_mod_date          = read_uint16(zip); cd_read_size += 2;
-    cdfh->file_crc               = read_uint32(zip); cd_read_size += 4;
-    cdfh->file_compressed_size   = read_uint32(zip); cd_read_size += 4;
-    cdfh->file_uncompressed_size = read_uint32(zip); cd_read_size += 4;
-    cdfh->file_name_len          = read_uint16(zip); cd_read_size += 2;
-    cdfh->extra_fld_len          = read_uint16(zip); cd_read_size += 2;
-    cdfh->comment_len            = read_uint16(zip); cd_read_size += 2;
-    cdfh->disk_num               = read_uint16(zip); cd_read_size += 2;
-    cdfh->int_attrs              = read_uint16(zip); cd_read_size += 2;
-    cdfh->ext_attrs              = read_uint32(zip); cd_read_size += 4;
-    cdfh->file_offset            = read_uint32(zip); cd_read_size += 4;
-
-    cdfh->file_name = read_string(zip, cdfh->file_name_len);
+    cdfh->version_by             = map_uint16(zip, pos);
+    cdfh->version_extract        = map_uint16(zip, pos);
+    cdfh->gp_bits                = map_uint16(zip, pos);
+    cdfh->compression_method     = map_uint16(zip, pos);
+    cdfh->file_mod_time          = map_uint16(zip, pos);
+    cdfh->file_mod_date          = map_uint16(zip, pos);
+    cdfh->file_crc               = map_uint32(zip, pos);
+    cdfh->file_compressed_size   = map_uint32(zip, pos);
+    cdfh->file_uncompressed_size = map_uint32(zip, pos);
+    cdfh->file_name_len          = map_uint16(zip, pos);
+    cdfh->extra_fld_len          = map_uint16(zip, pos);
+    cdfh->comment_len            = map_uint16(zip, pos);
+    cdfh->disk_num               = map_uint16(zip, pos);
+    cdfh->int_attrs              = map_uint16(zip, pos);
+    cdfh->ext_attrs              = map_uint32(zip, pos);
+    cdfh->file_offset            = map_uint32(zip, pos);
+
+    if (*pos + cdfh->file_name_len > zip->map_size) return -1;
+
+    cdfh->file_name = egoverlay_malloc(cdfh->file_name_len + 1);
+    memcpy(cdfh->file_name, zip->map + *pos, cdfh->file_name_len);
+    cdfh->file_name[cdfh->file_name_len] = 0;
+    *pos += cdfh->file_name_len;
 
     // ensure it's lower case
     _strlwr_s(cdfh->file_name, cdfh->file_name_len+1);
@@ -281,14 +444,86 @@ int zip_read_central_directory_file_header(FILE *zip, zip_cdfh_t *cdfh) {
         if (cdfh->file_name[i]=='\\') cdfh->file_name[i] = '/';
     }
 
-    cd_read_size += cdfh->file_name_len;
+    *pos += cdfh->extra_fld_len; // extra field
+    *pos += cdfh->comment_len;   // comment
+
+    return 0;
+}
+
+// Find the content of path in the zip. For stored entries *data points
+// directly into the file mapping (zero copy); for deflated entries it points
+// into the zip's reusable inflate buffer and stays valid until the next
+// call. Returns 0 on success.
+int zip_file_data(zip_t *zip, const char *path, const uint8_t **data, size_t *length) {
+    logger_t *log = logger_get("zip");
+
+    zip_cdfh_t *cdfh = zip_lookup_entry(zip, path);
+
+    if (!cdfh) return -1;
+
+    // the local header's name/extra lengths can differ from the central
+    // directory's, so they have to be read to find the data
+    size_t pos = cdfh->file_offset;
+    if (pos + 30 > zip->map_size) return -1;
+
+    if (map_uint32(zip, &pos)!=0x04034b50) {
+        logger_error(log, "%s : bad local file header.", path);
+        return -1;
+    }
+
+    pos += 4; // version, gp bits
+
+    uint16_t compression = map_uint16(zip, &pos);
+
+    pos += 16; // mod time/date, crc, compressed/uncompressed sizes
+
+    uint16_t file_name_len = map_uint16(zip, &pos);
+    uint16_t extra_len = map_uint16(zip, &pos);
+    pos += (size_t)file_name_len + extra_len;
+
+    if (pos + cdfh->file_compressed_size > zip->map_size) return -1;
+
+    if (compression==0) { // stored, hand back a slice of the mapping
+        *data = zip->map + pos;
+        *length = cdfh->file_uncompressed_size;
+        return 0;
+    }
+
+    if (compression!=8) {
+        logger_error(log, "%s : unsupported compression: %d", path, compression);
+        return -1;
+    }
+
+    if (zip->inflate_buf_size < cdfh->file_uncompressed_size) {
+        zip->inflate_buf = egoverlay_realloc(zip->inflate_buf, cdfh->file_uncompressed_size);
+        zip->inflate_buf_size = cdfh->file_uncompressed_size;
+    }
+
+    z_stream strm = {0};
+
+    // windowbits -15 = raw compression (no zlib headers)
+    if (inflateInit2(&strm, -15)!=Z_OK) {
+        logger_error(log, "Couldn't initialize zlib.");
+        return -1;
+    }
+
+    strm.avail_in = cdfh->file_compressed_size;
+    strm.next_in = (uint8_t*)(zip->map + pos); // inflate straight from the mapping
+    strm.avail_out = (uInt)zip->inflate_buf_size;
+    strm.next_out = zip->inflate_buf;
+
+    int ret = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END) {
+        logger_error(log, "%s : expected stream end.", path);
+        return -1;
+    }
 
-    _fseek_nolock(zip, cdfh->extra_fld_len, SEEK_CUR); // extra field
-    cd_read_size += cdfh->extra_fld_len;
-    _fseek_nolock(zip, cdfh->comment_len, SEEK_CUR); // comment
-    cd_read_size += cdfh->comment_len;
+    *data = zip->inflate_buf;
+    *length = cdfh->file_uncompressed_size;
 
-    return cd_read_size;
+    return 0;
 }
 
 /*** RST
@@ -324,6 +559,8 @@ static luaL_Reg zip_funcs[] = {
     "__gc",         &zip_lua_del,
     "files",        &zip_lua_files,
     "file_content", &zip_lua_file_content,
+    "contenthash",  &zip_lua_content_hash,
+    "filecrc",      &zip_lua_file_crc,
     NULL, NULL
 };
 
@@ -406,81 +643,430 @@ int zip_lua_file_content(lua_State *L) {
         if (file_path[i] == '\\') file_path[i] = '/';
     }
 
-    zip_cdfh_t *cdfh = NULL;
+    const uint8_t *data = NULL;
+    size_t length = 0;
+    int r = zip_file_data(zip, file_path, &data, &length);
+
+    free(file_path);
+
+    if (r) return 0;
+
+    lua_pushlstring(L, (const char*)data, length);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: contenthash()
+
+        Return a hash string identifying the contents of this zip. The hash
+        covers the central directory metadata (file names, CRCs, and sizes),
+        so it changes whenever any file in the zip changes without having to
+        read or decompress the file data.
+
+        :rtype: string
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int zip_lua_content_hash(lua_State *L) {
+    zip_t *zip = lua_checkzip(L, 1);
+
+    uint32_t hash = 5381;
+
     for (zip_file_header_t *fh=zip->files;fh;fh=fh->next) {
-        if (strcmp(file_path, fh->cdfh.file_name)==0) {
-            cdfh = &fh->cdfh;
-            break;
-        }
+        const char *c = fh->cdfh.file_name;
+        while (*c) hash = ((hash << 5) + hash) + *c++;
+
+        uint8_t *crc = (uint8_t*)&fh->cdfh.file_crc;
+        for (int i=0;i<4;i++) hash = ((hash << 5) + hash) + crc[i];
+
+        uint8_t *size = (uint8_t*)&fh->cdfh.file_uncompressed_size;
+        for (int i=0;i<4;i++) hash = ((hash << 5) + hash) + size[i];
     }
 
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%08x", hash);
+    lua_pushstring(L, buf);
+
+    return 1;
+}
+
+/*** RST
+    .. lua:method:: filecrc(path)
+
+        Return the CRC32 of a file in this zip, from the central directory.
+        Returns ``nil`` if ``path`` does not exist in this zip.
+
+        :param string path:
+        :rtype: integer
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int zip_lua_file_crc(lua_State *L) {
+    zip_t *zip = lua_checkzip(L, 1);
+
+    const char *file_path_orig = luaL_checkstring(L, 2);
+    char *file_path = _strdup(file_path_orig);
+
+    _strlwr_s(file_path, strlen(file_path)+1);
+    for (size_t i = 0; i < strlen(file_path); i++) {
+        if (file_path[i] == '\\') file_path[i] = '/';
+    }
+
+    zip_cdfh_t *cdfh = NULL;
+    cdfh = zip_lookup_entry(zip, file_path);
+
     free(file_path);
 
     if (!cdfh) return 0;
 
-    _fseek_nolock(zip->fstream, cdfh->file_offset, SEEK_SET);
-    uint32_t file_hdr_sig = read_uint32(zip->fstream);
-    if (file_hdr_sig!=0x04034b50) {
-        return luaL_error(L, "Error reading local file header.");
+    lua_pushinteger(L, (lua_Integer)cdfh->file_crc);
+
+    return 1;
+}
+
+/*** RST
+.. lua:function:: create(path)
+
+    Create a zip file for writing.
+
+    Entries added with :lua:meth:`add` are DEFLATE compressed in parallel on
+    a small worker pool when :lua:meth:`finish` runs and written to disk as
+    each completes in order, so exporting a large pack takes seconds instead
+    of a serial recompress. Entries whose compressed form would be larger
+    than the original (already-compressed PNGs) are stored uncompressed
+    automatically; pass ``store = true`` in the options to force it.
+
+    :param string path:
+    :rtype: zipwriter
+
+    .. code-block:: lua
+        :caption: Example
+
+        local w = zip.create('export.zip')
+
+        w:add('markers.xml', xmldata)
+        w:add('icon.png', icondata, { store = true })
+
+        w:finish()
+
+    .. versionhistory::
+        :0.1.0: Added
+*/
+
+#define ZIP_WRITER_MT "ZipWriterMetaTable"
+
+// how many worker threads finish() compresses with
+#define ZIP_WRITER_THREADS 4
+
+typedef struct {
+    char *name;
+    uint8_t *data;
+    size_t size;
+
+    int store;       // caller requested store mode
+
+    // filled by the compression workers
+    uint8_t *packed;
+    size_t packed_size;
+    int method;      // 0 = store, 8 = deflate
+    uint32_t crc;
+    volatile LONG done;
+} zip_writer_entry_t;
+
+typedef struct {
+    char *path;
+
+    zip_writer_entry_t *entries;
+    size_t count;
+    size_t capacity;
+
+    volatile LONG next_job;
+
+    int finished;
+} zip_writer_t;
+
+#define lua_checkzipwriter(L, ind) (zip_writer_t*)luaL_checkudata(L, ind, ZIP_WRITER_MT)
+
+int zip_writer_lua_add(lua_State *L);
+int zip_writer_lua_finish(lua_State *L);
+int zip_writer_lua_del(lua_State *L);
+
+static luaL_Reg zip_writer_funcs[] = {
+    "add"   , &zip_writer_lua_add,
+    "finish", &zip_writer_lua_finish,
+    "__gc"  , &zip_writer_lua_del,
+    NULL    , NULL
+};
+
+int zip_writer_lua_create(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    zip_writer_t *writer = lua_newuserdata(L, sizeof(zip_writer_t));
+    memset(writer, 0, sizeof(zip_writer_t));
+
+    writer->path = egoverlay_calloc(strlen(path)+1, sizeof(char));
+    memcpy(writer->path, path, strlen(path));
+
+    if (luaL_newmetatable(L, ZIP_WRITER_MT)) {
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+        luaL_setfuncs(L, zip_writer_funcs, 0);
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+static void zip_writer_free_entries(zip_writer_t *writer) {
+    for (size_t e=0;e<writer->count;e++) {
+        egoverlay_free(writer->entries[e].name);
+        if (writer->entries[e].data) egoverlay_free(writer->entries[e].data);
+        if (writer->entries[e].packed) egoverlay_free(writer->entries[e].packed);
     }
+    if (writer->entries) egoverlay_free(writer->entries);
+    writer->entries = NULL;
+    writer->count = 0;
+    writer->capacity = 0;
+}
 
-    _fseek_nolock(zip->fstream, 4, SEEK_CUR); 
+int zip_writer_lua_del(lua_State *L) {
+    zip_writer_t *writer = lua_checkzipwriter(L, 1);
 
-    uint16_t compression = read_uint16(zip->fstream);
+    zip_writer_free_entries(writer);
+    egoverlay_free(writer->path);
 
-    _fseek_nolock(zip->fstream, 16, SEEK_CUR);
-    uint16_t file_name_len = read_uint16(zip->fstream);
-    uint16_t extra_len = read_uint16(zip->fstream);
-    _fseek_nolock(zip->fstream, file_name_len + extra_len, SEEK_CUR);
+    return 0;
+}
+
+/*** RST
+.. lua:class:: zipwriter
 
-    if (compression!=8 && compression!=0) {
-        return luaL_error(L, "unsupported compression: %d", compression);
+    .. lua:method:: add(name, data[, options])
+
+        Add an entry. ``options`` may contain ``store = true`` to skip
+        compression.
+
+        :param string name:
+        :param string data:
+        :param table options: (Optional)
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int zip_writer_lua_add(lua_State *L) {
+    zip_writer_t *writer = lua_checkzipwriter(L, 1);
+    size_t namelen = 0;
+    const char *name = luaL_checklstring(L, 2, &namelen);
+    size_t datalen = 0;
+    const char *data = luaL_checklstring(L, 3, &datalen);
+
+    if (writer->finished) return luaL_error(L, "zip writer is already finished");
+    if (writer->count==0xFFFF) return luaL_error(L, "zip writer supports up to 65535 entries");
+
+    int store = 0;
+    if (lua_gettop(L)>=4 && lua_istable(L, 4)) {
+        if (lua_getfield(L, 4, "store")!=LUA_TNIL) store = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+
+    if (writer->count==writer->capacity) {
+        writer->capacity = writer->capacity ? writer->capacity * 2 : 64;
+        writer->entries = egoverlay_realloc(writer->entries, writer->capacity * sizeof(zip_writer_entry_t));
     }
 
-    if (compression==0) { // no compression, just stored
-        uint8_t *data = egoverlay_calloc(cdfh->file_compressed_size, sizeof(uint8_t));
-        _fread_nolock(data, sizeof(uint8_t), cdfh->file_compressed_size, zip->fstream);
+    zip_writer_entry_t *entry = &writer->entries[writer->count];
+    memset(entry, 0, sizeof(zip_writer_entry_t));
+
+    entry->name = egoverlay_calloc(namelen+1, sizeof(char));
+    memcpy(entry->name, name, namelen);
+    entry->data = egoverlay_malloc(datalen);
+    memcpy(entry->data, data, datalen);
+    entry->size = datalen;
+    entry->store = store;
+
+    writer->count++;
+
+    return 0;
+}
 
-        lua_pushlstring(L, (char*)data, cdfh->file_compressed_size);
-    
-        egoverlay_free(data);
+// compression worker: entries are claimed with an interlocked index so the
+// pool load balances itself
+static DWORD WINAPI zip_writer_thread_fn(LPVOID param) {
+    zip_writer_t *writer = (zip_writer_t*)param;
+
+    for (;;) {
+        LONG job = InterlockedIncrement(&writer->next_job) - 1;
+        if ((size_t)job >= writer->count) break;
+
+        zip_writer_entry_t *entry = &writer->entries[job];
+
+        entry->crc = (uint32_t)crc32(0, entry->data, (uInt)entry->size);
+
+        if (!entry->store && entry->size) {
+            z_stream strm = {0};
+            if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)==Z_OK) {
+                uLong bound = deflateBound(&strm, (uLong)entry->size);
+                uint8_t *out = egoverlay_malloc(bound);
+
+                strm.next_in = entry->data;
+                strm.avail_in = (uInt)entry->size;
+                strm.next_out = out;
+                strm.avail_out = (uInt)bound;
+
+                if (deflate(&strm, Z_FINISH)==Z_STREAM_END && strm.total_out < entry->size) {
+                    entry->packed = out;
+                    entry->packed_size = strm.total_out;
+                    entry->method = 8;
+                } else {
+                    // incompressible (PNGs); store it
+                    egoverlay_free(out);
+                }
+
+                deflateEnd(&strm);
+            }
+        }
+
+        if (!entry->packed) {
+            entry->packed = entry->data;
+            entry->packed_size = entry->size;
+            entry->method = 0;
+            entry->data = NULL; // ownership moved
+        }
+
+        InterlockedExchange(&entry->done, 1);
+    }
+
+    return 0;
+}
+
+static void zip_write_u16(FILE *f, uint16_t v) { fwrite(&v, 2, 1, f); }
+static void zip_write_u32(FILE *f, uint32_t v) { fwrite(&v, 4, 1, f); }
+
+/*** RST
+    .. lua:method:: finish()
+
+        Compress and write all entries, then the central directory. The
+        writer can't be used afterwards.
+
+        :returns: ``true`` on success.
+        :rtype: boolean
+
+        .. versionhistory::
+            :0.1.0: Added
+*/
+int zip_writer_lua_finish(lua_State *L) {
+    zip_writer_t *writer = lua_checkzipwriter(L, 1);
+
+    if (writer->finished) return luaL_error(L, "zip writer is already finished");
+    writer->finished = 1;
+
+    FILE *f = fopen(writer->path, "wb");
+    if (!f) {
+        zip_writer_free_entries(writer);
+        lua_pushboolean(L, 0);
         return 1;
     }
 
-    z_stream strm;
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = 0;
-    strm.next_in = 0;
+    // compress on the pool while this thread writes each entry as it
+    // completes, in order
+    HANDLE threads[ZIP_WRITER_THREADS] = {0};
+    int nthreads = ZIP_WRITER_THREADS;
+    if ((size_t)nthreads > writer->count) nthreads = (int)writer->count;
 
-    // windowbits -15 = raw compression (no zlib headers)
-    if (inflateInit2(&strm, -15)!=Z_OK) {
-        return luaL_error(L, "Couldn't initialize zlib.");
+    for (int t=0;t<nthreads;t++) {
+        threads[t] = CreateThread(0, 0, &zip_writer_thread_fn, writer, 0, NULL);
     }
+    if (nthreads==0) writer->next_job = 0;
 
-    uint8_t *compressed_data = egoverlay_calloc(cdfh->file_compressed_size, sizeof(uint8_t));
-    _fread_nolock(compressed_data, sizeof(uint8_t), cdfh->file_compressed_size, zip->fstream);
-    uint8_t *uncompressed_data = egoverlay_calloc(cdfh->file_uncompressed_size, sizeof(uint8_t));
+    uint32_t *offsets = egoverlay_calloc(writer->count ? writer->count : 1, sizeof(uint32_t));
+    uint32_t offset = 0;
 
-    strm.avail_out = cdfh->file_uncompressed_size;
-    strm.next_out = uncompressed_data;
-    strm.avail_in = cdfh->file_compressed_size;
-    strm.next_in = compressed_data;
+    for (size_t e=0;e<writer->count;e++) {
+        zip_writer_entry_t *entry = &writer->entries[e];
 
-    int ret = inflate(&strm, Z_FINISH); // uncompress in a single run
-    if (ret != Z_STREAM_END) {
-        egoverlay_free(compressed_data);
-        egoverlay_free(uncompressed_data);
-        return luaL_error(L, "expected stream end.");
+        while (!entry->done) Sleep(1);
+
+        offsets[e] = offset;
+
+        size_t namelen = strlen(entry->name);
+
+        zip_write_u32(f, 0x04034b50);
+        zip_write_u16(f, 20);                  // version needed
+        zip_write_u16(f, 0);                   // flags
+        zip_write_u16(f, (uint16_t)entry->method);
+        zip_write_u16(f, 0);                   // mod time
+        zip_write_u16(f, 0);                   // mod date
+        zip_write_u32(f, entry->crc);
+        zip_write_u32(f, (uint32_t)entry->packed_size);
+        zip_write_u32(f, (uint32_t)entry->size);
+        zip_write_u16(f, (uint16_t)namelen);
+        zip_write_u16(f, 0);                   // extra len
+        fwrite(entry->name, 1, namelen, f);
+        fwrite(entry->packed, 1, entry->packed_size, f);
+
+        offset += (uint32_t)(30 + namelen + entry->packed_size);
+
+        // the raw input isn't needed once written
+        if (entry->data) {
+            egoverlay_free(entry->data);
+            entry->data = NULL;
+        }
     }
 
-    // TODO: CRC checking
-    lua_pushlstring(L, (char*)uncompressed_data, cdfh->file_uncompressed_size);
-    inflateEnd(&strm);
-    
-    egoverlay_free(compressed_data);
-    egoverlay_free(uncompressed_data);
+    for (int t=0;t<nthreads;t++) {
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+    }
+
+    // central directory
+    uint32_t cd_start = offset;
+
+    for (size_t e=0;e<writer->count;e++) {
+        zip_writer_entry_t *entry = &writer->entries[e];
+        size_t namelen = strlen(entry->name);
+
+        zip_write_u32(f, 0x02014b50);
+        zip_write_u16(f, 20);                  // version made by
+        zip_write_u16(f, 20);                  // version needed
+        zip_write_u16(f, 0);                   // flags
+        zip_write_u16(f, (uint16_t)entry->method);
+        zip_write_u16(f, 0);                   // mod time
+        zip_write_u16(f, 0);                   // mod date
+        zip_write_u32(f, entry->crc);
+        zip_write_u32(f, (uint32_t)entry->packed_size);
+        zip_write_u32(f, (uint32_t)entry->size);
+        zip_write_u16(f, (uint16_t)namelen);
+        zip_write_u16(f, 0);                   // extra len
+        zip_write_u16(f, 0);                   // comment len
+        zip_write_u16(f, 0);                   // disk number
+        zip_write_u16(f, 0);                   // internal attrs
+        zip_write_u32(f, 0);                   // external attrs
+        zip_write_u32(f, offsets[e]);
+        fwrite(entry->name, 1, namelen, f);
+
+        offset += (uint32_t)(46 + namelen);
+    }
+
+    // end of central directory
+    zip_write_u32(f, 0x06054b50);
+    zip_write_u16(f, 0);                       // disk number
+    zip_write_u16(f, 0);                       // cd disk
+    zip_write_u16(f, (uint16_t)writer->count);
+    zip_write_u16(f, (uint16_t)writer->count);
+    zip_write_u32(f, offset - cd_start);       // cd size
+    zip_write_u32(f, cd_start);                // cd offset
+    zip_write_u16(f, 0);                       // comment len
+
+    int ok = fflush(f)==0;
+    fclose(f);
+
+    egoverlay_free(offsets);
+    zip_writer_free_entries(writer);
+
+    lua_pushboolean(L, ok);
 
     return 1;
 }
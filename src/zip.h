@@ -1,3 +1,20 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <lua.h>
 
-void zip_lua_init();
\ No newline at end of file
+typedef struct zip_t zip_t;
+
+void zip_lua_init();
+void zip_cleanup();
+
+zip_t *zip_open(const char *path);
+void zip_ref(zip_t *zip);
+void zip_unref(zip_t *zip);
+
+// find the content of path. for stored entries *data points directly into
+// the zip's file mapping (zero copy); for deflated entries it points into a
+// reusable buffer valid until the next call. returns 0 on success
+int zip_file_data(zip_t *zip, const char *path, const uint8_t **data, size_t *length);
+
+zip_t *lua_checkzip(lua_State *L, int ind);